@@ -31,75 +31,42 @@
 	    queuep
 	    queue->list
 	    queue-length
-	    delete-from-queue)
+	    delete-from-queue
+	    enqueue-vector
+	    dequeue-vector)
 
     (open rep
-	  rep.data.datums
 	  rep.test.framework)
 
   (define-structure-alias queues rep.data.queues)
 
-  (define type-id (cons))
+  ;; Queues are deques (see src/deques.c) that grow as needed; each
+  ;; operation takes constant time, and conses nothing.
 
-  (define-datum-printer type-id (lambda (q stream)
-				  (declare (unused q))
-				  (write stream "#<queue>")))
+  (define (make-queue)
+    (make-deque))
 
-  ;; Each queue is (TAIL . HEAD). HEAD is the list of items, TAIL
-  ;; points to the last cell in HEAD, or the empty list.
+  (define enqueue deque-push-back)
 
-  (define (make-queue)
-    (make-datum (cons) type-id))
-
-  (define (enqueue q x)
-    (let ((cell (datum-ref q type-id))
-	  (new (list x)))
-      (if (null (cdr cell))
-	  ;; empty queue
-	  (progn
-	    (rplacd cell new)
-	    (rplaca cell new))
-	;; tail pointer is set
-	(rplacd (car cell) new)
-	(rplaca cell new))))
-
-  (define (dequeue q)
-    (let ((cell (datum-ref q type-id)))
-      (if (null (cdr cell))
-	  (error "Can't dequeue from empty queue")
-	(prog1 (car (cdr cell))
-	  (if (not (eq (car cell) (cdr cell)))
-	      ;; at least one element left
-	      (rplacd cell (cdr (cdr cell)))
-	    ;; queue needs to be empty now
-	    (rplacd cell '())
-	    (rplaca cell '()))))))
-
-  (define (queue-empty-p q)
-    (null (cdr (datum-ref q type-id))))
+  (define dequeue deque-pop-front)
+
+  (define queue-empty-p deque-empty-p)
 
   (define (queuep q)
-    (has-type-p q type-id))
-
-  (define (queue->list q)
-    (cdr (datum-ref q type-id)))
-
-  (define (queue-length q)
-    (length (queue->list q)))
-
-  (define (delete-from-queue q x)
-    (let ((cell (datum-ref q type-id)))
-      (let loop ((ptr cell))
-	(if (null (cdr ptr))
-	    ;; avoid pointing tail to itself..
-	    (if (null (cdr cell))
-		(rplaca cell '())
-	      (rplaca cell ptr))
-	  (if (eq (cadr ptr) x)
-	      (progn
-		(rplacd ptr (cddr ptr))
-		(loop ptr))
-	    (loop (cdr ptr)))))))
+    (and (dequep q) (not (deque-capacity q))))
+
+  (define queue->list deque->list)
+
+  (define queue-length deque-length)
+
+  (define delete-from-queue deque-delete)
+
+  ;; add each element of VECTOR to Q
+  (define enqueue-vector deque-push-vector)
+
+  ;; remove up to COUNT elements from Q, all if COUNT is false, returning
+  ;; them in a vector
+  (define dequeue-vector deque-pop-vector)
 
 ;;; tests
 
@@ -142,4 +109,34 @@
 
 	(delete-from-queue queue 3)
 	(test (= (queue-length queue) 0))
-	(test (queue-empty-p queue))))))
+	(test (queue-empty-p queue))
+
+	;; wrapping around, and growing while wrapped
+	(do ((i 0 (1+ i)))
+	    ((= i 6))
+	  (enqueue queue i))
+	(test (= (dequeue queue) 0))
+	(test (= (dequeue queue) 1))
+	(do ((i 6 (1+ i)))
+	    ((= i 20))
+	  (enqueue queue i))
+	(test (= (queue-length queue) 18))
+	(test (equal (dequeue-vector queue 3) [2 3 4]))
+	(enqueue-vector queue [20 21])
+	(test (equal (queue->list queue)
+		     '(5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21)))
+	(test (equal (dequeue-vector queue) [5 6 7 8 9 10 11 12 13 14 15
+					     16 17 18 19 20 21]))
+	(test (queue-empty-p queue))
+
+	;; capacities that can't be allocated are errors
+	(test (condition-case nil
+		  (progn
+		    (make-deque (1- (ash 1 61)))
+		    nil)
+		(error t)))
+	(test (condition-case nil
+		  (progn
+		    (make-deque (ash 1 60))
+		    nil)
+		(error t)))))))
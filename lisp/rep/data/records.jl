@@ -62,17 +62,17 @@
 	    define-record-type
 	    define-record-discloser)
 
-    (open rep
-	  rep.data.datums)
+    (open rep)
 
   (define-structure-alias records rep.data.records)
 
 ;;; record type structures
 
+  ;; Records themselves are native objects (see records.c), the
+  ;; record type is this vector, which the C printer also looks at
+
   (define (make-record-type name fields)
-    (let ((rt (vector name fields nil)))
-      (define-datum-printer rt (record-printer rt))
-      rt))
+    (vector name fields nil))
 
   (define (record-type-name rt) (aref rt 0))
   (define (record-type-fields rt) (aref rt 1))
@@ -82,9 +82,13 @@
 ;;; record mechanics
 
   (define (make-record rt)
-    (make-datum (make-vector (length (record-type-fields rt))) rt))
+    (apply %make-record rt (make-list (length (record-type-fields rt)))))
 
-  (define make-record-datum make-datum)
+  ;; VALUES is a vector with one element for each field of RT
+  (define (make-record-datum values rt)
+    (do ((i (1- (length values)) (1- i))
+	 (out '() (cons (aref values i) out)))
+	((< i 0) (apply %make-record rt out))))
 
   (define (field-index rt field)
     (do ((i 0 (1+ i))
@@ -92,12 +96,6 @@
 	((eq (car fields) field) i)
       (and (null fields) (error "No such field: %s, %s"
 				(record-type-name rt) field))))
-  
-  (define (field-ref rt record index)
-    (aref (datum-ref record rt) index))
-
-  (define (field-set rt record index value)
-    (aset (datum-ref record rt) index value))
 
 ;;; interface implementations
 
@@ -110,7 +108,7 @@
 		     (ids indices))
 	    (if (and rest ids)
 		(progn
-		  (field-set rt record (car ids) (car rest))
+		  (%record-set record rt (car ids) (car rest))
 		  (loop (cdr rest) (cdr ids)))
 	      record))))))
 
@@ -124,23 +122,23 @@
 	       (out '()))
       (if (null rest)
 	  `(lambda ,args
-	     (make-record-datum (vector ,@(nreverse out)) ,rt))
+	     (%make-record ,rt ,@(nreverse out)))
 	(loop (cdr rest)
 	      (cons (and (has-field-p (car rest)) (car rest)) out)))))
 
   (define (record-accessor rt field)
     (let ((index (field-index rt field)))
       (lambda (record)
-	(field-ref rt record index))))
+	(%record-ref record rt index))))
 
   (define (record-modifier rt field)
     (let ((index (field-index rt field)))
       (lambda (record value)
-	(field-set rt record index value))))
+	(%record-set record rt index value))))
 
   (define (record-predicate rt)
     (lambda (arg)
-      (has-type-p arg rt)))
+      (%record-p arg rt)))
 
   (define (record-printer rt)
     (lambda (record stream)
@@ -153,28 +151,44 @@
 
 ;;; syntax
 
+  ;; The functions are defined directly in terms of the record
+  ;; primitives, which the compiler turns into single instructions,
+  ;; and declared inline so that calls from the same file don't even
+  ;; need a function call. Constructors with keyword parameters can't
+  ;; be inlined.
+
   (defmacro define-record-type (rt constructor . fields)
-    (let (names predicate-defs accessor-defs modifier-defs)
+    (let (names predicate-defs accessor-defs modifier-defs inlines)
       (when (and fields (symbolp (car fields)))
-	(setq predicate-defs `((define ,(car fields) (record-predicate ,rt))))
+	(setq predicate-defs `((define (,(car fields) arg)
+				 (%record-p arg ,rt))))
+	(setq inlines (list (car fields)))
 	(setq fields (cdr fields)))
       (setq names (mapcar car fields))
-      (mapc (lambda (field)
-	      (when (cadr field)
-		(setq accessor-defs
-		      (cons `(define ,(cadr field)
-			       (record-accessor ,rt ',(car field)))
-			    accessor-defs)))
-	      (when (caddr field)
-		(setq modifier-defs
-		      (cons `(define ,(caddr field)
-			       (record-modifier ,rt ',(car field)))
-			    modifier-defs))))
-	    fields)
+      (let loop ((rest fields)
+		 (index 0))
+	(when rest
+	  (let ((field (car rest)))
+	    (when (cadr field)
+	      (setq accessor-defs
+		    (cons `(define (,(cadr field) record)
+			     (%record-ref record ,rt ,index))
+			  accessor-defs))
+	      (setq inlines (cons (cadr field) inlines)))
+	    (when (caddr field)
+	      (setq modifier-defs
+		    (cons `(define (,(caddr field) record value)
+			     (%record-set record ,rt ,index value))
+			  modifier-defs))
+	      (setq inlines (cons (caddr field) inlines))))
+	  (loop (cdr rest) (1+ index))))
+      (unless (memq '#!key (cdr constructor))
+	(setq inlines (cons (car constructor) inlines)))
       `(progn
 	 (define ,rt (make-record-type ',rt ',names))
+	 (declare (inline ,@inlines))
 	 (define ,(car constructor)
 	   ,(make-record-constructor rt (cdr constructor) names))
 	 ,@predicate-defs
-	 ,@accessor-defs
-	 ,@modifier-defs))))
+	 ,@(nreverse accessor-defs)
+	 ,@(nreverse modifier-defs)))))
@@ -35,91 +35,55 @@
 	    get-from-ring
 	    set-ring-head)
 
-    (open rep
-	  rep.data.datums)
+    (open rep)
 
   (define-structure-alias ring rep.data.ring)
 
   ;; default size of a ring buffer
   (defconst default-size 16)
 
-  ;; key for datum access
-  (define key (cons))
-
-  (define-datum-printer key (lambda (d s)
-			      (declare (unused d))
-			      (write s "#<ring>")))
-
-  ;; A ring buffer of size N is defined by a vector with N+2 slots; the
-  ;; first slot is used to store the size of the buffer, the second stores
-  ;; the position of the next slot to be filled.
+  ;; A ring buffer is a deque with a fixed capacity (see src/deques.c),
+  ;; the oldest item at the front, the newest at the back.
 
   (define (ring-capacity ring)
     "Returns the number of slots in the ring buffer RING."
-    (- (length (datum-ref ring key)) 2))
+    (deque-capacity ring))
 
   (define (ring-size ring)
     "Returns the number of filled slots in the ring buffer RING."
-    (aref (datum-ref ring key) 0))
-
-  (define (set-size ring size)
-    (aset (datum-ref ring key) 0 size))
-
-  (define (get-pos ring)
-    (aref (datum-ref ring key) 1))
-  (define (set-pos ring pos)
-    (aset (datum-ref ring key) 1 pos))
-
-  (define (get-item ring pos)
-    (aref (datum-ref ring key) (+ pos 2)))
-  (define (set-item ring pos val)
-    (aset (datum-ref ring key) (+ pos 2) val))
+    (deque-length ring))
 
 ;;; higher level public api
 
   (define (make-ring #!optional size)
     "Create a ring buffer that can contain SIZE values. If SIZE is not
 specified the default capacity `ring-default-size' is used."
-    (unless size (setq size default-size))
-    (let ((ring (make-datum (make-vector (+ size 2)) key)))
-      (set-size ring 0)
-      (set-pos ring 0)
-      ring))
+    (make-deque (or size default-size) t))
 
   (define (ring-append ring object)
     "Append OBJECT to the ring buffer RING. This may overwrite a previously
 added object."
-    (set-item ring (get-pos ring) object)
-    (let ((new-pos (mod (1+ (get-pos ring)) (ring-capacity ring))))
-      (unless (= (ring-size ring) (ring-capacity ring))
-	(set-size ring (1+ (ring-size ring))))
-      (set-pos ring new-pos)))
+    (deque-push-back ring object))
 
   (define (ring-ref ring #!optional depth)
     "Read an object from the ring buffer RING. If DEPTH is true it
 defines the object to access, the most recently added item is at
 depth zero, the next at depth one, and so on. If there is no item at
 DEPTH nil is returned."
-    (unless depth (setq depth 0))
-    (if (>= depth (ring-capacity ring))
-	nil
-      (get-item ring (mod (- (get-pos ring) (1+ depth))
-			  (ring-capacity ring)))))
+    (let ((index (- (deque-length ring) (or depth 0) 1)))
+      (and (>= index 0) (< index (deque-length ring))
+	   (deque-ref ring index))))
 
   (define (ring-replace ring object)
     "Replaces the most recently added object in ring buffer RING with OBJECT.
 If RING contains no items, add OBJECT as the first."
-    (if (zerop (ring-size ring))
-	(add-to-ring ring object)
-      (set-item ring (mod (1- (get-pos ring)) (ring-capacity ring)) object)))
+    (if (deque-empty-p ring)
+	(deque-push-back ring object)
+      (deque-set ring (1- (deque-length ring)) object)))
 
   (define (ring->list ring)
     "Return the elements in ring buffer RING as a list, newest to oldest."
-    (let ((size (ring-size ring))
-	  (contents '()))
-      (do ((i 0 (1+ i)))
-	  ((= i size) (nreverse contents))
-	(setq contents (cons (ring-ref ring i) contents)))))
+    (nreverse (deque->list ring)))
 
 ;;; compatibility api
 
@@ -25,52 +25,17 @@
 (open-structures '(rep.lang.math))
 
 ;;;###autoload
-(defun sort (lst #!optional pred)
-  "Sort LST destructively, but stably, returning the sorted list.
+(defun sort (seq #!optional pred key)
+  "Sort SEQ, a list or vector, destructively, but stably, returning the
+sorted sequence.
 
 If PRED is defined it is used to compare two objects, it should return t
 when the first is `less' than the second. By default the standard less-than
 function (`<') is used.
 
+If KEY is non-nil it is called once on each element, and the values it
+returns are compared instead of the elements themselves.
+
 The fact that the sort is stable means that sort keys which are equal will
 preserve their original position in relation to each other."
-  (let
-      ((len (length lst)))
-  (if (< len 2)
-      lst
-    ;; default to sorting smaller to greater
-    (unless pred (setq pred <))
-    (let
-	((mid (nthcdr (1- (quotient len 2)) lst)))
-      (setq mid (prog1
-		    (cdr mid)
-		  (rplacd mid nil)))
-      ;; Now we have two separate lists, LST and MID; sort them..
-      (setq lst (sort lst pred)
-	    mid (sort mid pred))
-      ;; ..then merge them back together
-      (let
-	  ((out-head nil)		;Start of the list being built
-	   (out nil)			;Cell whose cdr is next link
-	   tem)
-	;; While both lists have elements compare them
-	(while (and lst mid)
-	  (setq tem (if (funcall pred (car mid) (car lst))
-			(prog1
-			    mid
-			  (setq mid (cdr mid)))
-		      (prog1
-			  lst
-			(setq lst (cdr lst)))))
-	  (if out
-	      (progn
-		(rplacd out tem)
-		(setq out tem))
-	    (setq out-head tem
-		  out tem)))
-	;; If either has elements left just append them
-	(when (or lst mid)
-	  (if out
-	      (rplacd out (or lst mid))
-	    (setq out-head (or lst mid))))
-	out-head)))))
+  (%sort seq pred key))
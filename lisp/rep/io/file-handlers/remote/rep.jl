@@ -31,6 +31,7 @@
     (open rep
 	  rep.regexp
 	  rep.system
+	  rep.data.tables
 	  rep.io.processes
 	  rep.io.files
 	  rep.io.file-handlers
@@ -59,7 +60,11 @@
 
 (defvar remote-rep-dircache-expiry-time 60)
 
-(defvar remote-rep-dircache-max-dirs 5)
+(defvar remote-rep-dircache-max-dirs 50)
+
+(defvar remote-rep-read-ahead-dirs 8
+  "After listing a remote directory, the number of its subdirectories
+whose listings are requested in the background, or nil.")
 
 (define remote-rep-sessions nil)
 
@@ -70,6 +75,9 @@
 
 (defconst remote-rep-required-protocol 1)
 
+;; From this version requests may be tagged and pipelined
+(defconst remote-rep-pipeline-protocol 2)
+
 (define remote-rep-hex-map (let
 			       ((map (make-string 128 0))
 				i)
@@ -90,18 +98,35 @@
 (defconst remote-rep-host 0)
 (defconst remote-rep-user 1)
 (defconst remote-rep-process 2)
-(defconst remote-rep-status 3)	;success,failure,busy,nil,dying,timed-out
-(defconst remote-rep-callback 4)
-(defconst remote-rep-dircache 5)
+(defconst remote-rep-status 3)	;busy while connecting,success,failure,dying
+(defconst remote-rep-queue 4)		;requests awaiting replies, oldest first
+(defconst remote-rep-dircache 5)	;table of directory cache entries
 (defconst remote-rep-pending-output 6)
 (defconst remote-rep-login-data 7)	;PASSWD while logging in
 (defconst remote-rep-error 8)
 (defconst remote-rep-protocol 9)
-(defconst remote-rep-struct-size 10)
+(defconst remote-rep-current 10)	;request whose reply is being read
+(defconst remote-rep-next-tag 11)
+(defconst remote-rep-links 12)		;symlink contents, keyed by file struct
+(defconst remote-rep-struct-size 13)
+
+;; request structure
+
+(defconst remote-rep-req-tag 0)		;nil when sent untagged
+(defconst remote-rep-req-type 1)
+(defconst remote-rep-req-reader 2)
+(defconst remote-rep-req-status 3)	;busy,success,failure
+(defconst remote-rep-req-error 4)
+(defconst remote-rep-req-data 5)
+(defconst remote-rep-req-callback 6)	;called with the request when done
+(defconst remote-rep-req-struct-size 7)
 
 (defmacro remote-rep-status-p (session stat)
   `(eq (aref ,session remote-rep-status) ,stat))
 
+(defmacro remote-rep-pipelined-p (session)
+  `(>= (aref ,session remote-rep-protocol) remote-rep-pipeline-protocol))
+
 ;; Return an rep structure for HOST and USER, with a running rep session
 (defun remote-rep-open-host (host #!optional user)
   (unless user
@@ -109,7 +134,8 @@
   (catch 'foo
     (mapc (lambda (s)
 	    (when (and (string= (aref s remote-rep-host) host)
-		       (string= (aref s remote-rep-user) user))
+		       (string= (aref s remote-rep-user) user)
+		       (not (remote-rep-status-p s 'dying)))
 	      ;; Move S to the head of the list
 	      (setq remote-rep-sessions
 		    (cons s (delq s remote-rep-sessions)))
@@ -184,11 +210,15 @@
 
 ;; Communicating with the remote process
 
+;; Each command sent makes a request, queued on the session until its
+;; reply has been read. Servers speaking protocol 2 echo the tag sent
+;; in front of a command before its reply, so commands can be
+;; pipelined; older servers get one command at a time.
+
 (defun remote-rep-write (session fmt #!rest args)
   (when (remote-rep-status-p session 'dying)
     (error "rep-remote session is dying"))
-  (apply format (aref session remote-rep-process) fmt args)
-  (aset session remote-rep-status 'busy))
+  (apply format (aref session remote-rep-process) fmt args))
 
 (defun remote-rep-send-int (session int)
   (remote-rep-write session "%08x" int))
@@ -197,30 +227,110 @@
   (remote-rep-send-int session (length string))
   (remote-rep-write session "%s" string))
 
-(defun remote-rep-while (session status #!optional type)
-  (when (and (not (eq status 'dying))
-	     (remote-rep-status-p session 'dying))
+(defun remote-rep-new-tag (session)
+  (let
+      ((tag (or (aref session remote-rep-next-tag) 0)))
+    (aset session remote-rep-next-tag (logand (1+ tag) #xfffffff))
+    tag))
+
+;; Send command TYPE with string arguments ARGS, returning the request
+;; that will receive its reply. READER parses the reply (see below)
+;; and DATA is for its use, CALLBACK is called with the request once
+;; it's finished. OUTPUT-FUN is called with SESSION to write anything
+;; following the command itself.
+(defun remote-rep-send-command (session type args
+				#!key reader data callback output-fun)
+  (when (remote-rep-status-p session 'dying)
     (error "rep-remote session is dying"))
-  (while (remote-rep-status-p session status)
-    (when (and (process-running-p (aref session remote-rep-process))
-	       (accept-process-output-1 (aref session remote-rep-process)
-					remote-rep-timeout))
-      (aset session remote-rep-status 'timed-out)
-      (error "rep-remote process timed out (%s)" (or type "unknown")))))
-
-(defun remote-rep-command (session type #!optional output-fun #!rest args)
+  ;; OUTPUT-FUN may write a lot, so let the replies already on their
+  ;; way drain first; otherwise both ends could block writing
+  (when (or output-fun (not (remote-rep-pipelined-p session)))
+    (remote-rep-drain session))
+  (let
+      ((req (make-vector remote-rep-req-struct-size)))
+    (aset req remote-rep-req-tag (and (remote-rep-pipelined-p session)
+				      (remote-rep-new-tag session)))
+    (aset req remote-rep-req-type type)
+    (aset req remote-rep-req-reader (or reader remote-rep-read-status))
+    (aset req remote-rep-req-status 'busy)
+    (aset req remote-rep-req-data data)
+    (aset req remote-rep-req-callback callback)
+    (aset session remote-rep-queue
+	  (nconc (aref session remote-rep-queue) (list req)))
+    (when (aref req remote-rep-req-tag)
+      (remote-rep-write session "#%08x" (aref req remote-rep-req-tag)))
+    (remote-rep-write session "%c%c" type (length args))
+    (mapc (lambda (a)
+	    (remote-rep-send-string session a)) args)
+    (when output-fun
+      (funcall output-fun session))
+    req))
+
+;; Mark REQ as finished with STATUS
+(defun remote-rep-finish (session req status)
+  (aset req remote-rep-req-status status)
+  (aset session remote-rep-queue (delq req (aref session remote-rep-queue)))
+  (when (eq (aref session remote-rep-current) req)
+    (aset session remote-rep-current nil))
+  (when (aref req remote-rep-req-callback)
+    ((aref req remote-rep-req-callback) req)))
+
+;; Fail everything SESSION is waiting for, with error message MSG
+(defun remote-rep-abort-requests (session msg)
+  (when (remote-rep-status-p session 'busy)
+    (aset session remote-rep-error msg)
+    (aset session remote-rep-status 'failure))
+  (mapc (lambda (req)
+	  (aset req remote-rep-req-error msg)
+	  (remote-rep-finish session req 'failure))
+	(aref session remote-rep-queue)))
+
+;; Wait for more output from SESSION, TYPE says what for
+(defun remote-rep-accept (session type)
+  (when (remote-rep-status-p session 'dying)
+    (error "rep-remote session is dying"))
+  (let
+      ((process (aref session remote-rep-process)))
+    (if (and process (process-running-p process))
+	(when (accept-process-output-1 process remote-rep-timeout)
+	  ;; there's no telling which reply would arrive next
+	  (remote-rep-close-session session)
+	  (error "rep-remote process timed out (%s)" (or type "unknown")))
+      (remote-rep-abort-requests session "rep-remote process exited"))))
+
+(defun remote-rep-wait (session req)
+  (while (eq (aref req remote-rep-req-status) 'busy)
+    (remote-rep-accept session (aref req remote-rep-req-type))))
+
+;; Wait for the replies to everything sent to SESSION
+(defun remote-rep-drain (session)
+  (while (aref session remote-rep-queue)
+    (remote-rep-wait session (car (aref session remote-rep-queue)))))
+
+;; Send command TYPE and wait for its reply, returning the request.
+;; Signals a file-error if the command failed
+(defun remote-rep-request (session type args #!key reader data output-fun)
   (when remote-rep-display-progress
     (message (format nil "rep %c %s: " type args) t))
-  (remote-rep-while session 'busy type)
-  (remote-rep-write session "%c%c" type (length args))
-  (mapc (lambda (a)
-	  (remote-rep-send-string session a)) args)
-  (when output-fun
-    (funcall output-fun session))
-  (remote-rep-while session 'busy type)
-  (when remote-rep-display-progress
-    (format t " %s" (aref session remote-rep-status)))
-  (remote-rep-error-if-unsuccessful session type args))
+  (let
+      ((req (remote-rep-send-command session type args
+				     #:reader reader #:data data
+				     #:output-fun output-fun)))
+    (remote-rep-wait session req)
+    (when remote-rep-display-progress
+      (format t " %s" (aref req remote-rep-req-status)))
+    (or (eq (aref req remote-rep-req-status) 'success)
+	(signal 'file-error
+		(list (aref req remote-rep-req-error)
+		      type
+		      (format nil "%s@%s %s"
+			      (aref session remote-rep-user)
+			      (aref session remote-rep-host) args))))
+    req))
+
+(defun remote-rep-command (session type #!optional output-fun #!rest args)
+  (remote-rep-request session type args #:output-fun output-fun)
+  t)
 
 ;; Return t if successful, else signal a file-error
 (defun remote-rep-error-if-unsuccessful (session #!optional type args)
@@ -250,7 +360,124 @@
       ((len (remote-rep-read-length string point)))
     (when (and len (>= (length string) (+ point 8 len)))
       (substring string (+ point 8) (+ point 8 len)))))
-    
+
+;; Reply readers are called as (READER SESSION REQ OUTPUT POINT) with
+;; the next part of REQ's reply at POINT in OUTPUT. They return the
+;; position after the text they used, calling remote-rep-finish once
+;; the whole reply has been read. Returning POINT itself means that
+;; more output is needed.
+
+;; A plain success or failure reply
+(defun remote-rep-read-status (session req output point)
+  (cond ((= (aref output point) ?\001)
+	 (remote-rep-finish session req 'success)
+	 (1+ point))
+	((= (aref output point) ?\177)
+	 (let
+	     ((msg (remote-rep-read-string output (1+ point))))
+	   (if msg
+	       (progn
+		 (aset req remote-rep-req-error msg)
+		 (remote-rep-finish session req 'failure)
+		 (+ point 9 (length msg)))
+	     point)))
+	(t
+	 ;; junk, skip it
+	 (length output))))
+
+;; Success followed by a string, left in REQ's data slot
+(defun remote-rep-read-string-reply (session req output point)
+  (if (= (aref output point) ?\001)
+      (let
+	  ((string (remote-rep-read-string output (1+ point))))
+	(if string
+	    (progn
+	      (aset req remote-rep-req-data string)
+	      (remote-rep-finish session req 'success)
+	      (+ point 9 (length string)))
+	  point))
+    (remote-rep-read-status session req output point)))
+
+;; Success followed by a length and that many bytes, which are written
+;; to the file in the car of REQ's data as they arrive. The cdr counts
+;; the bytes still to come.
+(defun remote-rep-read-file (session req output point)
+  (let
+      ((state (aref req remote-rep-req-data)))
+    (cond ((cdr state)
+	   (let
+	       ((this (min (cdr state) (- (length output) point))))
+	     (write (car state) (if (and (zerop point)
+					 (= this (length output)))
+				    output
+				  (substring output point (+ point this))))
+	     (rplacd state (- (cdr state) this))
+	     (when (zerop (cdr state))
+	       (remote-rep-finish session req 'success))
+	     (+ point this)))
+	  ((= (aref output point) ?\001)
+	   (let
+	       ((len (remote-rep-read-length output (1+ point))))
+	     (cond ((null len)
+		    point)
+		   ((zerop len)
+		    (remote-rep-finish session req 'success)
+		    (+ point 9))
+		   (t
+		    (rplacd state len)
+		    (+ point 9)))))
+	  (t
+	   (remote-rep-read-status session req output point)))))
+
+;; Handle the output while logging in, up to the signature and the
+;; status following it
+(defun remote-rep-read-signature (session output point)
+  (cond ((and (null (aref session remote-rep-protocol))
+	      (string-match remote-rep-passwd-msgs output point))
+	 ;; Send password
+	 (remote-rep-write
+	  session "%s\n"
+	  (let
+	      ((pass (remote-rep-get-passwd
+		      (aref session remote-rep-user)
+		      (aref session remote-rep-host))))
+	    (unless pass
+	      (remote-rep-close-session session)
+	      (error "No valid password"))
+	    (aset session remote-rep-login-data pass)
+	    pass))
+	 (length output))
+	((string-match remote-rep-signature output point)
+	 (aset session remote-rep-protocol
+	       (string->number (expand-last-match "\\1")))
+	 (match-end))
+	((null (aref session remote-rep-protocol))
+	 (length output))
+	((= (aref output point) ?\001)
+	 ;; success
+	 (aset session remote-rep-status 'success)
+	 (1+ point))
+	((= (aref output point) ?\177)
+	 ;; failure, look for error message
+	 (let
+	     ((msg (remote-rep-read-string output (1+ point))))
+	   (if msg
+	       (progn
+		 (aset session remote-rep-error msg)
+		 (aset session remote-rep-status 'failure)
+		 (+ point 9 (length msg)))
+	     point)))
+	(t
+	 (length output))))
+
+(defun remote-rep-find-request (session tag)
+  (catch 'return
+    (mapc (lambda (req)
+	    (when (eql (aref req remote-rep-req-tag) tag)
+	      (throw 'return req)))
+	  (aref session remote-rep-queue))
+    nil))
+
 (defun remote-rep-output-filter (session output)
   (when (aref session remote-rep-pending-output)
     (setq output (concat (aref session remote-rep-pending-output) output))
@@ -259,61 +486,57 @@
     (let
 	((print-escape t))
       (format (stderr-file) "rep output: %S\n" output)))
-  (if (aref session remote-rep-callback)
-      (funcall (aref session remote-rep-callback) session output 0)
-    (let
-	((point 0))
-      (while (< point (length output))
-	(cond ((and (null (aref session remote-rep-protocol))
-		    (string-match remote-rep-passwd-msgs output point))
-	       ;; Send password
-	       (remote-rep-write
-		session "%s\n"
-		(let
-		    ((pass (remote-rep-get-passwd
-			    (aref session remote-rep-user)
-			    (aref session remote-rep-host))))
-		  (unless pass
-		    (remote-rep-close-session session)
-		    (error "No valid password"))
-		  (aset session remote-rep-login-data pass)
-		  pass))
-	       (setq point (length output)))
-	      ((string-match remote-rep-signature output point)
-	       (aset session remote-rep-protocol
-		     (string->number (expand-last-match "\\1")))
-	       (setq point (match-end)))
-	      ((= (aref output point) ?\001)
-	       ;; success
-	       (aset session remote-rep-status 'success)
-	       (setq point (1+ point)))
-	      ((= (aref output point) ?\177)
-	       ;; failure, look for error message
-	       (let
-		   ((msg (remote-rep-read-string output (1+ point))))
-		 (if msg
-		     (progn
-		       (aset session remote-rep-error msg)
-		       (aset session remote-rep-status 'failure)
-		       (setq point (+ point 9 (length msg))))
-		   (aset session remote-rep-pending-output
-			 (substring output point))
-		   (setq point (length output)))))
-	      (t
-;	       (unless (string-looking-at "\\s*$" output point)
-;		 (format standard-error "remote-rep: unhandled output %S\n"
-;			 (substring output point)))
-	       (setq point (length output))))))))
+  (let
+      ((point 0)
+       next)
+    (while (< point (length output))
+      (cond ((remote-rep-status-p session 'busy)
+	     (setq next (remote-rep-read-signature session output point)))
+	    ((aref session remote-rep-current)
+	     (let
+		 ((req (aref session remote-rep-current)))
+	       (setq next ((aref req remote-rep-req-reader)
+			   session req output point))))
+	    ((null (aref session remote-rep-queue))
+	     ;; nothing was asked for
+	     (setq next (length output)))
+	    ((null (aref (car (aref session remote-rep-queue))
+			 remote-rep-req-tag))
+	     (aset session remote-rep-current
+		   (car (aref session remote-rep-queue)))
+	     (setq next nil))
+	    ((< (length output) (+ point 9))
+	     (setq next point))
+	    ((= (aref output point) ?#)
+	     (let
+		 ((req (remote-rep-find-request
+			session (remote-rep-read-length output (1+ point)))))
+	       (unless req
+		 (remote-rep-close-session session)
+		 (error "rep-remote replied to an unknown request"))
+	       (aset session remote-rep-current req)
+	       (setq next (+ point 9))))
+	    (t
+	     (setq next (length output))))
+      (cond ((null next))
+	    ((= next point)
+	     ;; wait for the rest
+	     (aset session remote-rep-pending-output (substring output point))
+	     (setq point (length output)))
+	    (t
+	     (setq point next))))))
 
 (defun remote-rep-sentinel (process)
   (let
       ((session (remote-rep-get-session-by-process process)))
     (unless (process-in-use-p process)
+      (remote-rep-abort-requests session "rep-remote process exited")
       (aset session remote-rep-process nil)
       (aset session remote-rep-dircache nil)
+      (aset session remote-rep-links nil)
       (aset session remote-rep-status nil)
       (aset session remote-rep-pending-output nil)
-      (aset session remote-rep-callback nil)
+      (aset session remote-rep-current nil)
       (setq remote-rep-sessions (delq session remote-rep-sessions)))))
 
 
@@ -322,7 +545,8 @@
 ;; SESSION has been started, wait for the connection to
 ;; succeed or fail
 (defun remote-rep-connect (session)
-  (remote-rep-while session 'busy 'connect)
+  (while (remote-rep-status-p session 'busy)
+    (remote-rep-accept session 'connect))
   (remote-rep-error-if-unsuccessful session "connect")
   (unless (>= (aref session remote-rep-protocol) remote-rep-required-protocol)
     (error "rep-remote program on %s is too old"
@@ -330,52 +554,13 @@
 
 (defun remote-rep-get (session remote-file local-file)
   (let
-      ((remote-rep-get-fh (open-file local-file 'write))
-       (remote-rep-len nil))
-    (when remote-rep-get-fh
+      ((fh (open-file local-file 'write)))
+    (when fh
       (unwind-protect
-	  (progn
-	    (aset session remote-rep-callback
-		  (lambda (session output point)
-		    (unless remote-rep-len
-		      (cond ((= (aref output point) ?\001)
-			     ;; success
-			     (let
-				 ((len (remote-rep-read-length
-					output (1+ point))))
-			       (if len
-				   (progn
-				     (setq remote-rep-len len)
-				     (setq point (+ point 9)))
-				 ;; wait for next output
-				 (aset session remote-rep-pending-output
-				       (substring output point)))))
-			    ((= (aref output point) ?\177)
-			     ;; failure
-			     (let
-				 ((msg (remote-rep-read-string
-					output (1+ point))))
-			       (if msg
-				   (progn
-				     (aset session
-					   remote-rep-status 'failure)
-				     (aset session remote-rep-error msg))
-				 (aset remote-rep-pending-output
-				       (substring output point)))))))
-		    (when remote-rep-len
-		      (let
-			  ((this (min remote-rep-len
-				      (- (length output) point))))
-			(write remote-rep-get-fh
-			       (substring output point (+ point this)))
-			(setq remote-rep-len (- remote-rep-len this))
-			(setq point (+ point this)))
-		      (when (zerop remote-rep-len)
-			(aset session remote-rep-status 'success)))))
-	    (unwind-protect
-		(remote-rep-command session ?G nil remote-file)
-	      (aset session remote-rep-callback nil)))
-	(close-file remote-rep-get-fh)))))
+	  (remote-rep-request session ?G (list remote-file)
+			      #:reader remote-rep-read-file
+			      #:data (cons fh nil))
+	(close-file fh)))))
 
 (defun remote-rep-put (session local-file remote-file)
   (unwind-protect
@@ -434,33 +619,9 @@
      session (file-name-directory file))))
 
 (defun remote-rep-read-symlink (session file)
-  (let
-      (remote-rep-link)
-    (aset session remote-rep-callback
-	  (lambda (session output point)
-	    (cond ((= (aref output point) ?\001)
-		   ;; success
-		   (setq remote-rep-link
-			 (remote-rep-read-string
-			  output (1+ point)))
-		   (if remote-rep-link
-		       (aset session remote-rep-status 'success)
-		     (aset session remote-rep-pending-output
-			   (substring output point))))
-		  ((= (aref output point) ?\177)
-		   (let
-		       ((msg (remote-rep-read-string
-			      output (1+ point))))
-		     (if msg
-			 (progn
-			   (aset session remote-rep-status 'failure)
-			   (aset session remote-rep-error msg))
-		       (aset session remote-rep-pending-output
-			     (substring output point))))))))
-    (unwind-protect
-	(remote-rep-command session ?l nil file)
-      (aset session remote-rep-callback nil))
-    remote-rep-link))
+  (aref (remote-rep-request session ?l (list file)
+			    #:reader remote-rep-read-string-reply)
+	remote-rep-req-data))
 
 
 ;; Directory handling/caching
@@ -479,75 +640,97 @@
 (defconst remote-rep-cache-dir 0)
 (defconst remote-rep-cache-expiry 1)
 (defconst remote-rep-cache-entries 2)
-(defconst remote-rep-cache-struct-size 3)
+(defconst remote-rep-cache-names 3)\t;table mapping names to entries
+(defconst remote-rep-cache-request 4)\t;readdir request while in flight
+(defconst remote-rep-cache-struct-size 5)
 
 (defun remote-rep-file-owner-p (session file)
   (string= (aref session remote-rep-user)
 	   (aref file remote-rep-file-user)))
 
 (defun remote-rep-dir-cached-p (session dir)
+  (and (aref session remote-rep-dircache)
+       (table-ref (aref session remote-rep-dircache)
+		  (directory-file-name dir))))
+
+;; Make room in the directory cache by discarding expired entries, or
+;; failing that the one that expires soonest
+(defun remote-rep-prune-dircache (session)
+  (let
+      ((cache (aref session remote-rep-dircache))
+       (now (current-time))
+       (doomed '())
+       oldest)
+    (table-walk (lambda (dir entry)
+		  (cond ((aref entry remote-rep-cache-request))
+			((not (time-later-p
+			       (aref entry remote-rep-cache-expiry) now))
+			 (setq doomed (cons dir doomed)))
+			((or (null oldest)
+			     (time-later-p
+			      (aref oldest remote-rep-cache-expiry)
+			      (aref entry remote-rep-cache-expiry)))
+			 (setq oldest entry))))
+		cache)
+    (when (and (null doomed) oldest)
+      (setq doomed (list (aref oldest remote-rep-cache-dir))))
+    (mapc (lambda (dir)
+	    (table-unset cache dir)) doomed)))
+
+;; Ask for a listing of directory DIR, returning its new cache entry
+;; without waiting for the reply
+(defun remote-rep-cache-directory (session dir)
+  (let
+      ((entry (make-vector remote-rep-cache-struct-size)))
+    (if (aref session remote-rep-dircache)
+	(when (>= (table-size (aref session remote-rep-dircache))
+		  remote-rep-dircache-max-dirs)
+	  (remote-rep-prune-dircache session))
+      (aset session remote-rep-dircache (make-table string-hash string=)))
+    (aset entry remote-rep-cache-dir dir)
+    (aset entry remote-rep-cache-expiry
+	  (fix-time (cons (car (current-time))
+			  (+ (cdr (current-time))
+			     remote-rep-dircache-expiry-time))))
+    (aset entry remote-rep-cache-names (make-table string-hash string=))
+    (table-set (aref session remote-rep-dircache) dir entry)
+    (aset entry remote-rep-cache-request
+	  (remote-rep-send-command
+	   session ?D (list dir)
+	   #:reader remote-rep-read-dir-entries
+	   #:data entry
+	   #:callback (lambda (req)
+			(declare (unused req))
+			(aset entry remote-rep-cache-request nil))))
+    entry))
+
+;; Return the cache entry of directory DIR, listing it if necessary
+(defun remote-rep-get-directory (session dir)
   (setq dir (directory-file-name dir))
-  (catch 'exit
-    (mapc (lambda (dir-entry)
-	    (when (string= (aref dir-entry remote-rep-cache-dir) dir)
-	      (throw 'exit dir-entry)))
-	  (aref session remote-rep-dircache))))
+  (let
+      ((entry (remote-rep-dir-cached-p session dir)))
+    (when (or (null entry)
+	      (and (null (aref entry remote-rep-cache-request))
+		   (not (time-later-p (aref entry remote-rep-cache-expiry)
+				      (current-time)))))
+      (setq entry (remote-rep-cache-directory session dir)))
+    (when (aref entry remote-rep-cache-request)
+      ;; a failed listing leaves the entry empty
+      (remote-rep-wait session (aref entry remote-rep-cache-request)))
+    entry))
 
 (defun remote-rep-get-file (session filename)
   (let
       ((dir (file-name-directory filename))
-       (base (file-name-nondirectory filename))
-       entry)
+       (base (file-name-nondirectory filename)))
     (when (string= base "")
       ;; hack, hack
       (setq base (file-name-nondirectory dir)
 	    dir (file-name-directory dir))
       (when (string= base "")
 	(setq base ".")))
-    (setq dir (directory-file-name dir))
-    (setq entry (remote-rep-dir-cached-p session dir))
-    (if (not (and entry (time-later-p (aref entry remote-rep-cache-expiry)
-				      (current-time))))
-	(progn
-	  ;; Cache directory DIR
-	  (when entry
-	    (aset session remote-rep-dircache
-		  (delq entry (aref session remote-rep-dircache)))
-	    (setq entry nil))
-	  (remote-rep-while session 'busy 'dircache)
-	  (when (>= (length (aref session remote-rep-dircache))
-		    remote-rep-dircache-max-dirs)
-	    ;; delete the least-recently-used entry
-	    (setcdr (nthcdr (1- (length (aref session remote-rep-dircache)))
-			    (aref session remote-rep-dircache)) nil))
-	  ;; add the new (empty) entry for the directory to be read.
-	  (setq entry
-		(vector dir (fix-time
-			     (cons (car (current-time))
-				   (+ (cdr (current-time))
-				      remote-rep-dircache-expiry-time))) nil))
-	  (aset session remote-rep-dircache
-		(cons entry (aref session remote-rep-dircache)))
-	  ;; construct the callback function to have the new cache entry
-	  ;; as the first argument
-	  (aset session remote-rep-callback
-		(lambda (#!rest args)
-		  (apply remote-rep-dircache-callback entry args)))
-	  (unwind-protect
-	      (condition-case nil
-		  (remote-rep-command session ?D nil dir)
-		(file-error))
-	    (aset session remote-rep-callback nil)))
-      ;; entry is still valid, move it to the front of the list
-      (aset session remote-rep-dircache
-	    (cons entry (delq entry (aref session remote-rep-dircache)))))
-    ;; ENTRY now has the valid dircache directory structure
-    (catch 'return
-      (mapc (lambda (f)
-	      (when (string= (aref f remote-rep-file-name) base)
-		(throw 'return f)))
-	    (aref entry remote-rep-cache-entries))
-      nil)))
+    (table-ref (aref (remote-rep-get-directory session dir)
+		     remote-rep-cache-names) base)))
 
 ;; similar to remote-rep-get-file, but symbolic links are followed
 (defun remote-rep-lookup-file (session file)
@@ -556,61 +739,76 @@
     (while (and file-struct
 		(eq (aref file-struct remote-rep-file-type) 'symlink))
       (let
-	  ((link (remote-rep-read-symlink session file)))
+	  ((link (remote-rep-symlink-contents session file file-struct)))
 	(setq file (expand-file-name link (file-name-directory file)))
 	(setq file-struct (remote-rep-get-file session file))))
     file-struct))
 
-(defun remote-rep-dircache-callback (cache-entry session output point)
-  (catch 'done
-    (while (string-match "\002" output point)
-      (let*
-	  ((start (match-end))
-	   (text (remote-rep-read-string output start))
-	   file-struct)
-	(if text
-	    (progn
-	      (setq file-struct (read-from-string text))
-	      (unless (vectorp file-struct)
-		(error "file-struct isn't a vector!: %S" file-struct))
-	      (aset cache-entry remote-rep-cache-entries
-		    (cons file-struct
-			  (aref cache-entry remote-rep-cache-entries)))
-	      (setq point (+ start 8 (length text))))
-	  (throw 'done t)))))
-  (when (< point (length output))
-    (cond ((= (aref output point) ?\001)
-	   ;; success marker
-	   (aset session remote-rep-status 'success))
-	  ((= (aref output point) ?\177)
-	   ;; failure
-	   (let
-	       ((msg (remote-rep-read-string output (1+ point))))
-	     (if msg
-		 (progn
-		   (aset session remote-rep-status 'failure)
-		   (aset session remote-rep-error msg))
-	       ;; save output for next time
-	       (aset session
-		     remote-rep-pending-output (substring output point)))))
-	  (t
-	   ;; some output to save for next time
-	   (aset session
-		 remote-rep-pending-output (substring output point))))))
+;; The contents of symlink FILE, whose entry is FILE-STRUCT. These are
+;; only read again once the directory has been
+(defun remote-rep-symlink-contents (session file file-struct)
+  (unless (aref session remote-rep-links)
+    (aset session remote-rep-links (make-weak-table eq-hash eq)))
+  (or (table-ref (aref session remote-rep-links) file-struct)
+      (table-set (aref session remote-rep-links) file-struct
+		 (remote-rep-read-symlink session file))))
+
+;; Each directory entry is a \002 followed by a string holding a file
+;; struct, the status comes after the last one
+(defun remote-rep-read-dir-entries (session req output point)
+  (let
+      ((entry (aref req remote-rep-req-data))
+       text)
+    (while (and (< point (length output))
+		(= (aref output point) ?\002)
+		(setq text (remote-rep-read-string output (1+ point))))
+      (let
+	  ((file-struct (read-from-string text)))
+	(unless (vectorp file-struct)
+	  (error "file-struct isn't a vector!: %S" file-struct))
+	(aset entry remote-rep-cache-entries
+	      (cons file-struct (aref entry remote-rep-cache-entries)))
+	(table-set (aref entry remote-rep-cache-names)
+		   (aref file-struct remote-rep-file-name) file-struct)
+	(setq point (+ point 9 (length text)))))
+    (if (and (< point (length output))
+	     (/= (aref output point) ?\002))
+	(remote-rep-read-status session req output point)
+      point)))
+
+;; Ask for the listings of the subdirectories in cache entry ENTRY that
+;; aren't cached, up to `remote-rep-read-ahead-dirs' of them, without
+;; waiting for the replies. Descending into one then needs no round trip
+(defun remote-rep-read-ahead (session entry)
+  (when (and remote-rep-read-ahead-dirs (remote-rep-pipelined-p session))
+    (let
+	((todo remote-rep-read-ahead-dirs)
+	 (dir (file-name-as-directory (aref entry remote-rep-cache-dir))))
+      (catch 'done
+	(mapc (lambda (f)
+		(when (<= todo 0)
+		  (throw 'done t))
+		(when (and (eq (aref f remote-rep-file-type) 'directory)
+			   (not (member (aref f remote-rep-file-name)
+					'("." ".."))))
+		  (let
+		      ((subdir (concat dir (aref f remote-rep-file-name))))
+		    (unless (remote-rep-dir-cached-p session subdir)
+		      (remote-rep-cache-directory session subdir)
+		      (setq todo (1- todo))))))
+	      (aref entry remote-rep-cache-entries))))))
 
 (defun remote-rep-invalidate-directory (session directory)
-  (setq directory (directory-file-name directory))
-  (let
-      ((entry (remote-rep-dir-cached-p session directory)))
-    (when entry
-      (aset session remote-rep-dircache
-	    (delq entry (aref session remote-rep-dircache))))))
+  (when (aref session remote-rep-dircache)
+    (table-unset (aref session remote-rep-dircache)
+		 (directory-file-name directory))))
 
 (defun remote-rep-empty-cache ()
   "Discard all cached rep-remote directory entries."
   (interactive)
   (mapc (lambda (ses)
-	  (aset ses remote-rep-dircache nil)) remote-rep-sessions))
+	  (aset ses remote-rep-dircache nil)
+	  (aset ses remote-rep-links nil)) remote-rep-sessions))
 
 
 ;; Password caching
@@ -727,13 +925,11 @@
       (cond
        ((eq op 'directory-files)
 	(let
-	    ;; XXX this assumes local/remote have same naming structure!
-	    ((dir (file-name-as-directory file-name)))
-	  (remote-rep-lookup-file session dir)
+	    ((entry (remote-rep-get-directory session file-name)))
+	  (remote-rep-read-ahead session entry)
 	  (mapcar (lambda (f)
 		    (aref f remote-rep-file-name))
-		  (aref (remote-rep-dir-cached-p session dir)
-			remote-rep-cache-entries))))
+		  (aref entry remote-rep-cache-entries))))
        ((eq op 'delete-file)
 	(remote-rep-rm session file-name))
        ((eq op 'delete-directory)
@@ -542,6 +542,18 @@ by loading FILE."
 
 (%define call-with-current-continuation call/cc)
 
+(defun call-with-escape-continuation (fun)
+  "Call FUN with a single argument, a function that when called (with an
+optional value) exits immediately from this call, returning that value.
+Unlike `call/cc' nothing needs to be copied, but the escape function can
+only be used until the call returns."
+  (let ((tag (list 'escape)))
+    (call-with-catch tag (lambda ()
+			   (fun (lambda (#!optional value)
+				  (throw tag value)))))))
+
+(%define call/ec call-with-escape-continuation)
+
 (defun dynamic-wind (before thunk after)
   "Call THUNK without arguments, returning the result of this call.
 BEFORE and AFTER are also called (without arguments), whenever
@@ -555,7 +567,8 @@ of THUNK) each function will be called exactly once."
       (call-with-barrier thunk nil before after)
     (after)))
 
-(export-bindings '(call-with-current-continuation dynamic-wind))
+(export-bindings '(call-with-current-continuation
+		   call-with-escape-continuation call/ec dynamic-wind))
 
 
 ;; misc
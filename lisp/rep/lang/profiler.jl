@@ -26,26 +26,62 @@
 
     (export call-in-profiler
 	    print-profile
-	    profile-interval)
+	    print-call-tree
+	    write-folded-stacks
+	    profile-interval
+	    call-in-allocation-profiler
+	    print-allocation-profile
+	    allocation-profile-interval
+	    call-in-bytecode-profiler
+	    print-bytecode-profile
+	    call-in-type-feedback
+	    save-type-feedback)
 
     (open rep
 	  rep.lang.record-profile
-	  rep.data.symbol-table)
+	  rep.data.symbol-table
+	  rep.data.tables
+	  rep.io.files
+	  rep.structures
+	  rep.threads
+	  rep.regexp
+	  rep.vm.interpreter
+	  rep.vm.bytecode-defs)
 
-  (define (call-in-profiler thunk)
-    (start-profiler)
+  ;; measure CPU time, or elapsed time if WALL-CLOCK is true
+  (define (call-in-profiler thunk #!optional wall-clock)
+    (start-profiler wall-clock)
     (unwind-protect
 	(thunk)
       (stop-profiler)))
 
-  (define (print-profile #!optional stream)
+  (define (call-in-allocation-profiler thunk)
+    (start-allocation-profiler)
+    (unwind-protect
+	(thunk)
+      (stop-allocation-profiler)))
+
+  (define (call-in-bytecode-profiler thunk)
+    (start-bytecode-profiler)
+    (unwind-protect
+	(thunk)
+      (stop-bytecode-profiler)))
+
+  (define (call-in-type-feedback thunk)
+    (start-type-feedback)
+    (unwind-protect
+	(thunk)
+      (stop-type-feedback)))
+
+  (define (print-table table stream)
     ;; each element is (SYMBOL . (LOCAL . TOTAL))
     (let ((profile '())
 	  (total-samples 0))
-      (symbol-table-walk (lambda (key data)
-			   (setq profile (cons (cons key data) profile))
-			   (setq total-samples (+ total-samples (car data))))
-			 (fetch-profile))
+      (when table
+	(symbol-table-walk (lambda (key data)
+			     (setq profile (cons (cons key data) profile))
+			     (setq total-samples (+ total-samples (car data))))
+			   table))
       (setq profile (sort profile (lambda (x y)
 				    (> (cadr x) (cadr y)))))
       (format (or stream standard-output)
@@ -61,4 +97,120 @@
 			  (symbol-name name) local
 			  (round (* (/ local total-samples) 100)) total
 			  (round (* (/ total total-samples) 100))))))
-	    profile))))
+	    profile)))
+
+  (define (print-profile #!optional stream)
+    (print-table (fetch-profile) stream))
+
+  ;; the name of a thread or function in the call tree
+  (define (call-tree-name object)
+    (cond ((closurep object) (or (closure-name object) "<lambda>"))
+	  ((subrp object) (subr-name object))
+	  ((threadp object)
+	   (format nil "<thread %s>" (or (thread-name object) "")))
+	  (t "<main>")))
+
+  ;; print the call tree of the samples taken by the profiler, each
+  ;; call indented below its caller, omitting those with fewer than
+  ;; MIN-PERCENT (default 1) of the samples
+  (define (print-call-tree #!optional stream min-percent)
+    (let* ((tree (fetch-call-tree))
+	   (total-samples (apply + (mapcar caddr tree)))
+	   (min-samples (/ (* (or min-percent 1) total-samples) 100)))
+      (define (print-node node depth)
+	(let ((total (caddr node)))
+	  (when (and (> total 0) (>= total min-samples))
+	    (format (or stream standard-output)
+		    "%10d (%3d%%) %10d  %s%s\n"
+		    total (quotient (* total 100) total-samples) (cadr node)
+		    (make-string (* depth 2) #\space)
+		    (call-tree-name (car node)))
+	    (mapc (lambda (child) (print-node child (1+ depth)))
+		  (sort (copy-sequence (cdddr node))
+			(lambda (x y) (> (caddr x) (caddr y))))))))
+      (format (or stream standard-output)
+	      "%17s %10s  %s\n\n" "Total" "Self" "Function Name")
+      (mapc (lambda (node) (print-node node 0)) tree)))
+
+  ;; write the profile to STREAM in the `folded stacks' format read by
+  ;; flame graph tools, a line `THREAD;OUTER;...;INNER COUNT' for each
+  ;; call stack sampled (spaces and semicolons in names become `_')
+  (define (write-folded-stacks #!optional stream)
+    (define (write-node node prefix)
+      (let ((name (concat prefix (string-replace
+				  "[ ;]" "_" (call-tree-name (car node))))))
+	(when (> (cadr node) 0)
+	  (format (or stream standard-output) "%s %d\n" name (cadr node)))
+	(mapc (lambda (child) (write-node child (concat name ";")))
+	      (cdddr node))))
+    (mapc (lambda (node) (write-node node "")) (fetch-call-tree)))
+
+  ;; each sample represents (allocation-profile-interval) bytes
+  (define (print-allocation-profile #!optional stream)
+    (print-table (fetch-allocation-profile) stream))
+
+  ;; print the LIMIT (default 40) most frequent opcode sequences
+  (define (print-bytecode-profile #!optional stream limit)
+    (let ((profile (sort (fetch-bytecode-profile)
+			 (lambda (x y) (> (cdr x) (cdr y)))))
+	  (total-pairs 0))
+      (mapc (lambda (cell)
+	      (when (= (length (car cell)) 2)
+		(setq total-pairs (+ total-pairs (cdr cell)))))
+	    profile)
+      (format (or stream standard-output)
+	      "%-40s %12s\n\n" "Opcode Sequence" "Count")
+      (do ((rest profile (cdr rest))
+	   (i 0 (1+ i)))
+	  ((or (null rest) (>= i (or limit 40))))
+	(let ((seq (caar rest))
+	      (count (cdar rest)))
+	  (format (or stream standard-output)
+		  "%-40s %12d (%2d%%)\n"
+		  (mapconcat (lambda (op)
+			       (let ((name (bytecode-name op)))
+				 (if name (symbol-name name) "?")))
+			     seq "; ")
+		  count (quotient (* count 100) total-pairs))))))
+
+  ;; (MODULE . NAME) for named closures, the name of subrs, else t
+  (define (type-feedback-name fun)
+    (cond ((and (closurep fun) (closure-name fun)
+		(closure-structure fun)
+		(structure-name (closure-structure fun)))
+	   (cons (structure-name (closure-structure fun))
+		 (intern (closure-name fun))))
+	  ((subrp fun) (intern (subr-name fun)))
+	  (t t)))
+
+  ;; write the type feedback recorded by the virtual machine to FILE,
+  ;; one `(MODULE NAME (PC OPCODE COUNT TYPES CALLEE)...)' form for
+  ;; each named function, for the compiler to read when
+  ;; *compiler-type-feedback* names FILE
+  (define (save-type-feedback file)
+    (let ((table (make-table equal-hash equal))
+	  (stream (open-file file 'write)))
+      (mapc (lambda (entry)
+	      (let ((name (and (nth 6 entry)
+			       (type-feedback-name (nth 6 entry)))))
+		(when (consp name)
+		  (table-set table name
+			     (cons (list (nth 1 entry)
+					 (bytecode-name (nth 2 entry))
+					 (nth 3 entry)
+					 (nth 4 entry)
+					 (and (nth 5 entry)
+					      (type-feedback-name (nth 5 entry))))
+				   (table-ref table name))))))
+	    (fetch-type-feedback))
+      (unwind-protect
+	  (progn
+	    (write stream ";; rep type feedback\n")
+	    (table-walk (lambda (name sites)
+			  (prin1 (list* (car name) (cdr name)
+					(sort sites (lambda (x y)
+						      (< (car x) (car y)))))
+				 stream)
+			  (write stream #\newline))
+			table))
+	(close-file stream)))))
@@ -145,11 +145,14 @@ When read, the syntax `FOO#BAR' expands to `(structure-ref FOO BAR)'."
   (list '%structure-set-binds (list '%current-structure) ''t))
 (defmacro export-all ()
   (list '%structure-exports-all (list '%current-structure) ''t))
+(defmacro seal ()
+  (list '%structure-seal (list '%current-structure) ''t))
 
 (let ((meta-struct (make-structure '(open %open-structures
 				     access %access-structures
 				     set-binds %structure-set-binds
 				     export-all %structure-exports-all
+				     seal %structure-seal
 				     %current-structure quote)
 				   nil nil '%meta)))
   (structure-define meta-struct 'quote quote)
@@ -161,6 +164,8 @@ When read, the syntax `FOO#BAR' expands to `(structure-ref FOO BAR)'."
   (structure-define meta-struct '%structure-set-binds structure-set-binds)
   (structure-define meta-struct 'export-all export-all)
   (structure-define meta-struct '%structure-exports-all structure-exports-all)
+  (structure-define meta-struct 'seal seal)
+  (structure-define meta-struct '%structure-seal structure-seal)
   (structure-define meta-struct '%current-structure current-structure))
 
 
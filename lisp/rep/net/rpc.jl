@@ -87,6 +87,34 @@
 ;; executing rpc call
 
 
+;; Wire format:
+
+;; Connections made by this module exchange frames, each a four-byte
+;; big-endian length with its top bit set, followed by that many bytes
+;; of data written by `write-fasl'. The data holds one or more
+;; messages, each either:
+
+;;	(call CALL-ID SERVANT-ID ARGS...)
+;;	(result CALL-ID RETURNED? VALUE-OR-EXCEPTION)
+
+;; CALL-ID is false for calls that want no result. Any number of calls
+;; may be outstanding on a connection at once, results are matched to
+;; calls by their ids, not by their order.
+
+;; Messages sent while handling those received (results, and any
+;; calls made by the servants) are queued until all the received
+;; messages have been handled, or until a synchronous call needs to
+;; wait, then those queued for each connection are sent in a single
+;; frame, sharing one symbol table. Other messages are sent as they're
+;; made, the socket code already collects the output of one event loop
+;; iteration into as few writes as possible.
+
+;; A peer that sends a printed Lisp form (which can't start with a
+;; byte with its top bit set) instead of a frame is assumed to be using
+;; the old text protocol, and the same messages are exchanged with it
+;; as printed text from then on.
+
+
 (define-structure rep.net.rpc
 
     (export rpc-socket-listener
@@ -108,6 +136,7 @@
     (open rep
 	  rep.io.sockets
 	  rep.io.processes
+	  rep.io.files
 	  rep.system
 	  rep.regexp
 	  rep.data.tables
@@ -121,11 +150,18 @@
 	(apply format standard-error fmt args))))
 
   (define-record-type :socket-data
-    (make-socket-data closable)
+    (make-socket-data closable pending-calls)
     ;; no predicate
     (pending-data socket-pending-data socket-pending-data-set!)
     (closable socket-closable-p)
-    (pending-calls socket-pending-calls socket-pending-calls-set!))
+    ;; maps from CALL-ID -> CALLBACK
+    (pending-calls socket-pending-calls)
+    ;; true when SOCKET is using binary frames
+    (binary socket-binary-p socket-binary-set!)
+    ;; length of the frame being received, or false
+    (frame-length socket-frame-length socket-frame-length-set!)
+    ;; messages waiting to be sent, most recent first
+    (queued socket-queued socket-queued-set!))
 
   ;; The socket used to listen for connections to this server (or false)
   (define listener-socket nil)
@@ -155,7 +191,8 @@ by knowing its address and port number."
     (let ((server (socket-peer-address socket))
 	  (port (socket-peer-port socket)))
       (table-set socket-cache (cons server port) socket)
-      (table-set socket-data-table socket (make-socket-data closable))))
+      (table-set socket-data-table socket
+		 (make-socket-data closable (make-table eq-hash eq)))))
 
   (define (deregister-rpc-server socket)
     "Remove SOCKET from the table of rpc connections."
@@ -170,20 +207,21 @@ by knowing its address and port number."
 	    (close-socket socket))
 	  (table-unset socket-data-table socket)
 	  ;; fail-out any pending calls on this socket
-	  (mapc (lambda (id)
-		  (dispatch-pending-call
-		   socket id nil
-		   (list 'rpc-error "Lost connection" server port)))
-		(socket-pending-calls data))))))
+	  (let ((callbacks '()))
+	    (table-walk (lambda (id callback)
+			  (declare (unused id))
+			  (setq callbacks (cons callback callbacks)))
+			(socket-pending-calls data))
+	    (mapc (lambda (callback)
+		    (callback nil (list 'rpc-error
+					"Lost connection" server port)))
+		  callbacks))))))
 
   ;; Return the data structure associated with SOCKET
   (define (socket-data socket) (table-ref socket-data-table socket))
 
 ;;; socket I/O
 
-  ;; maps from ID -> (CALLBACK ERROR? VALUE)
-  (define pending-calls (make-table eq-hash eq))
-
   ;; XXX make this unspoofable
   (define make-call-id
     (let ((counter 0))
@@ -191,16 +229,13 @@ by knowing its address and port number."
 	(setq counter (1+ counter)))))
 
   (define (record-pending-call socket id callback)
-    (table-set pending-calls id callback)
-    (let ((data (socket-data socket)))
-      (socket-pending-calls-set! data (cons id (socket-pending-calls data)))))
+    (table-set (socket-pending-calls (socket-data socket)) id callback))
 
   (define (dispatch-pending-call socket id succeeded value)
-    (let ((data (socket-data socket)))
-      (socket-pending-calls-set! data (delq id (socket-pending-calls data))))
-    (let ((callback (table-ref pending-calls id)))
+    (let* ((data (socket-data socket))
+	   (callback (and data (table-ref (socket-pending-calls data) id))))
       (when callback
-	(table-unset pending-calls id)
+	(table-unset (socket-pending-calls data) id)
 	(callback succeeded value))))
 
   (define (rpc-socket-listener master-socket)
@@ -213,6 +248,7 @@ server sockets."
 				  (lambda ()
 				    (deregister-rpc-server socket))))
       (register-rpc-server socket #:closable nil)
+      (use-binary-frames socket)
       socket))
 
   ;; Open an rpc connection to HOST:PORT; signals an error on failure
@@ -224,8 +260,116 @@ server sockets."
 				  (lambda ()
 				    (deregister-rpc-server socket))))
       (register-rpc-server socket #:closable t)
+      (use-binary-frames socket)
       socket))
 
+;;; framing
+
+  (define frame-header-length 4)
+
+  (define (use-binary-frames socket)
+    (socket-binary-set! (socket-data socket) t)
+    (set-socket-receiver socket frame-receiver frame-header-length))
+
+  (define (encode-frame-header n)
+    (let ((header (make-string frame-header-length)))
+      (aset header 0 (logior #x80 (logand (ash n -24) #x7f)))
+      (aset header 1 (logand (ash n -16) #xff))
+      (aset header 2 (logand (ash n -8) #xff))
+      (aset header 3 (logand n #xff))
+      header))
+
+  (define (decode-frame-header header)
+    (logior (ash (logand (aref header 0) #x7f) 24)
+	    (ash (aref header 1) 16)
+	    (ash (aref header 2) 8)
+	    (aref header 3)))
+
+  ;; Called by the socket code with each complete frame header or body
+  (define (frame-receiver socket)
+    (let ((data (socket-data socket)))
+      (cond ((not data)
+	     ;; deregistered, discard the input
+	     (set-socket-receiver socket nil)
+	     (socket-read-bytes socket))
+
+	    ((not (socket-frame-length data))
+	     (let ((header (socket-read-bytes socket frame-header-length)))
+	       (if (zerop (logand (aref header 0) #x80))
+		   ;; a printed form, fall back to the text protocol
+		   (let ((rest (socket-read-bytes socket)))
+		     (set-socket-receiver socket nil)
+		     (socket-binary-set! data nil)
+		     (rpc-output-handler
+		      socket (if rest (concat header rest) header)))
+		 (let ((n (decode-frame-header header)))
+		   (socket-frame-length-set! data n)
+		   (set-socket-receiver socket frame-receiver n)))))
+
+	    (t
+	     (let ((body (socket-read-bytes socket
+					    (socket-frame-length data))))
+	       ;; this function may be called reentrantly, so make sure
+	       ;; the state is consistent before handling the messages
+	       (socket-frame-length-set! data nil)
+	       (set-socket-receiver socket frame-receiver frame-header-length)
+	       (handle-messages socket
+				(condition-case nil
+				    (read-fasl-string body)
+				  (error
+				   (error "Can't parse rpc frame: %S"
+					  body)))))))))
+
+;;; batching
+
+  ;; True while handling received messages, when messages sent are
+  ;; queued, to be written together once all have been handled
+  (define batching (make-fluid nil))
+
+  ;; Sockets with queued messages
+  (define queued-sockets '())
+
+  (define (write-messages socket binary messages)
+    (if binary
+	(let ((body (write-fasl nil messages)))
+	  (write socket (encode-frame-header (length body)))
+	  (write socket body))
+      (mapc (lambda (message)
+	      (write socket (prin1-to-string message))) messages)))
+
+  ;; Write all queued messages
+  (define (flush-queued-messages)
+    (let ((sockets (nreverse queued-sockets)))
+      (setq queued-sockets '())
+      (mapc (lambda (socket)
+	      (let ((data (socket-data socket)))
+		(when (and data (socket-queued data))
+		  (let ((messages (nreverse (socket-queued data))))
+		    (socket-queued-set! data '())
+		    (write-messages socket (socket-binary-p data) messages)))))
+	    sockets)))
+
+  ;; Send MESSAGE to SOCKET, or queue it if batching
+  (define (send-message socket message)
+    (let ((data (socket-data socket)))
+      (debug "Wrote: %S\n" message)
+      (cond ((not (fluid batching))
+	     (write-messages socket (socket-binary-p data) (list message)))
+	    (t
+	     (unless (socket-queued data)
+	       (setq queued-sockets (cons socket queued-sockets)))
+	     (socket-queued-set! data (cons message (socket-queued data)))))))
+
+  ;; Handle each of the list of MESSAGES received from SOCKET, then
+  ;; send any messages this caused in as few frames as possible
+  (define (handle-messages socket messages)
+    (let-fluids ((batching t))
+      (mapc (lambda (form)
+	      (debug "Parsed: %S\n" form)
+	      (handle-message socket form)) messages))
+    (unless (fluid batching)
+      (flush-queued-messages)))
+
   (define (rpc-output-handler socket output)
     "The function used to handle any OUTPUT from SOCKET."
     (let ((sock-data (socket-data socket)))
@@ -245,52 +389,46 @@ server sockets."
 	       (error "Can't parse rpc message: %S"
 		      (socket-pending-data sock-data))))
 
-	    (debug "Parsed: %S\n" form)
-
 	    ;; this function may be called reentrantly, so make sure the
 	    ;; state is always consistent..
 	    (socket-pending-data-set!
 	     ;; stream is (STRING . POINT)
 	     sock-data (substring (cdr stream) (car stream)))
 
-	    (case (car form)
-	      ((result)
-	       ;; (result CALL-ID RETURNED? VALUE-OR-EXCEPTION)
-	       (let ((id (nth 1 form))
-		     (succeeded (nth 2 form))
-		     (value (nth 3 form)))
-		 (dispatch-pending-call socket id succeeded value)))
-
-	      ((call)
-	       ;; (call CALL-ID SERVANT-ID ARGS...)
-	       (let ((id (nth 1 form))
-		     (servant-id (nth 2 form))
-		     (args (nthcdr 3 form)))
-		 (let ((result (call-with-exception-handler
-				(lambda ()
-				  (let ((impl (servant-ref servant-id)))
-				    (unless impl
-				      (error
-				       "No such RPC servant: %s" servant-id))
-				    (let-fluids ((active-socket socket))
-				      (list t (apply impl args)))))
-				(lambda (data)
-				  (list nil data)))))
-		   (when id
-		     (let ((response (list* 'result id result)))
-		       (debug "Wrote: %S\n" response)
-		       (write socket (prin1-to-string response)))))))))))))
+	    (handle-messages socket (list form)))))))
+
+  (define (handle-message socket form)
+    (case (car form)
+      ((result)
+       ;; (result CALL-ID RETURNED? VALUE-OR-EXCEPTION)
+       (let ((id (nth 1 form))
+	     (succeeded (nth 2 form))
+	     (value (nth 3 form)))
+	 (dispatch-pending-call socket id succeeded value)))
+
+      ((call)
+       ;; (call CALL-ID SERVANT-ID ARGS...)
+       (let ((id (nth 1 form))
+	     (servant-id (nth 2 form))
+	     (args (nthcdr 3 form)))
+	 (let ((result (call-with-exception-handler
+			(lambda ()
+			  (let ((impl (servant-ref servant-id)))
+			    (unless impl
+			      (error "No such RPC servant: %s" servant-id))
+			    (let-fluids ((active-socket socket))
+			      (list t (apply impl args)))))
+			(lambda (data)
+			  (list nil data)))))
+	   (when (and id (socket-data socket))
+	     (send-message socket (list* 'result id result))))))))
 
   (define (invoke-method socket id callback servant-id args)
     (record-pending-call socket id callback)
-    (let ((request (list* 'call id servant-id args)))
-      (debug "Wrote: %S\n" request)
-      (write socket (prin1-to-string request))))
+    (send-message socket (list* 'call id servant-id args)))
 
   (define (invoke-oneway-method socket servant-id args)
-    (let ((request (list* 'call nil servant-id args)))
-      (debug "Wrote: %S\n" request)
-      (write socket (prin1-to-string request))))
+    (send-message socket (list* 'call nil servant-id args)))
 
   (define (synchronous-method-call socket servant-id args)
     (let ((id (make-call-id))
@@ -302,8 +440,12 @@ server sockets."
 		       (setq succeeded a)
 		       (setq value b))
 		     servant-id args)
-      (while (not done)
-	(accept-process-output 60))
+      ;; the result may depend on anything queued, or sent while
+      ;; waiting for it
+      (flush-queued-messages)
+      (let-fluids ((batching nil))
+	(while (not done)
+	  (accept-process-output 60)))
       (if succeeded
 	  value
 	(raise-exception value))))
@@ -367,7 +509,14 @@ becomes invalid."
   (define proxy-table (make-table string-hash string=))
 
   (define (make-proxy server port servant-id)
-    (let ((global-id (make-global-id server port servant-id)))
+    (let ((global-id (make-global-id server port servant-id))
+	  (socket nil))
+
+      ;; Avoid looking up the connection each call, while it's open
+      (define (proxy-socket)
+	(if (and socket (socket-data socket))
+	    socket
+	  (setq socket (server-socket server port))))
 
       (define (proxy)
 	(lambda args
@@ -381,16 +530,16 @@ becomes invalid."
 		((oneway)
 		 ;; async request - no result required
 		 (oneway-method-call
-		  (server-socket server port) servant-id (cddr args)))
+		  (proxy-socket) servant-id (cddr args)))
 
 		((async)
 		 (asynchronous-method-call
-		  (server-socket server port)
+		  (proxy-socket)
 		  (caddr args) servant-id (cdddr args))))
 
 	    ;; otherwise, just forward to the server
 	    (synchronous-method-call
-	     (server-socket server port) servant-id args))))
+	     (proxy-socket) servant-id args))))
 
       ;; Avoid consing a new proxy each time..
       (let ((ref (table-ref proxy-table global-id)))
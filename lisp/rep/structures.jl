@@ -56,14 +56,14 @@
   "Return the name of the structure binding of SYM, using the list of module
 names IMPORTED as the search start points."
   (when imported
-    (let ((tem (structure-exports-p (get-structure (car imported)) sym)))
+    (let ((tem (structure-exports-p (intern-structure (car imported)) sym)))
       (cond ((null tem)
 	     (locate-binding sym (cdr imported)))
 	    ((eq tem 'external)
 	     ;; this module exports it, but it doesn't define
 	     ;; it, so search its imports
 	     (locate-binding sym (structure-imports
-				  (get-structure (car imported)))))
+				  (intern-structure (car imported)))))
 	    (t (car imported))))))
 
 (export-bindings '(make-interface parse-interface
@@ -35,6 +35,10 @@ Jade, select this file, then evaluate:
 ;;; ::autoload-start::
 (autoload-self-test 'rep.data.queues 'rep.data.queues)
 (autoload-self-test 'rep.data 'rep.test.data)
+(autoload-self-test 'rep.regexp 'rep.test.regexp)
+(autoload-self-test 'rep.vm.compiler 'rep.test.fasl)
 (autoload-self-test 'rep.www.quote-url 'rep.www.quote-url)
 (autoload-self-test 'rep.www.cgi-get 'rep.www.cgi-get)
+(autoload-self-test 'rep.www.http 'rep.www.http)
+(autoload-self-test 'rep.util.base64 'rep.util.base64)
 ;;; ::autoload-end::
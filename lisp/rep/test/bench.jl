@@ -0,0 +1,181 @@
+#| bench.jl -- framework for timing lisp workloads
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+#| Each benchmark is a thunk that is called a few times to warm up
+   (letting caches fill and hot functions be translated), then timed
+   over a number of iterations. The results are written as one
+   s-expression per benchmark,
+
+	(NAME (iterations . N) (median . USECS) (p99 . USECS)
+	      (min . USECS) (max . USECS) (mean . USECS))
+
+   so that a later run can be compared against them using
+   `compare-benchmark-results'. |#
+
+(define-structure rep.test.bench
+
+    (export define-benchmark
+	    benchmark-names
+	    run-benchmark
+	    run-benchmarks
+	    write-benchmark-results
+	    read-benchmark-results
+	    compare-benchmark-results
+	    benchmark-warm-up
+	    benchmark-iterations)
+
+    (open rep
+	  rep.system
+	  rep.io.files)
+
+  ;; list of (NAME . THUNK), most recently defined first
+  (define benchmarks '())
+
+  ;; number of untimed calls made before timing each benchmark
+  (define benchmark-warm-up (make-fluid 3))
+
+  ;; number of timed calls of each benchmark
+  (define benchmark-iterations (make-fluid 100))
+
+  (define (define-benchmark name thunk)
+    (let ((cell (assq name benchmarks)))
+      (if cell
+	  (rplacd cell thunk)
+	(setq benchmarks (cons (cons name thunk) benchmarks)))))
+
+  (define (benchmark-names) (reverse (mapcar car benchmarks)))
+
+
+;;; statistics
+
+  ;; the value at fraction P of the way through sorted list TIMES,
+  ;; using the nearest rank
+  (define (percentile times p)
+    (let ((rank (max 1 (inexact->exact (ceiling (* p (length times)))))))
+      (nth (1- rank) times)))
+
+  (define (summarize times)
+    (let ((sorted (sort (copy-sequence times))))
+      `((iterations . ,(length sorted))
+	(median . ,(percentile sorted 1/2))
+	(p99 . ,(percentile sorted 99/100))
+	(min . ,(car sorted))
+	(max . ,(last sorted))
+	(mean . ,(quotient (apply + sorted) (length sorted))))))
+
+
+;;; running
+
+  ;; Call THUNK, returning the number of microseconds it took
+  (define (time-call thunk)
+    (let ((start (current-utime)))
+      (thunk)
+      (- (current-utime) start)))
+
+  (define (run-benchmark name)
+    "Run the benchmark called NAME, returning its result; a list whose
+car is NAME and whose cdr is an alist of statistics."
+    (let ((thunk (cdr (assq name benchmarks)))
+	  (times '()))
+      (unless thunk
+	(error "No such benchmark: %s" name))
+      (do ((i 0 (1+ i)))
+	  ((= i (fluid benchmark-warm-up)))
+	(thunk))
+      ;; start each benchmark from a clean heap, so earlier ones don't
+      ;; leave garbage for it to collect
+      (garbage-collect)
+      (do ((i 0 (1+ i)))
+	  ((= i (max 1 (fluid benchmark-iterations))))
+	(setq times (cons (time-call thunk) times)))
+      (cons name (summarize times))))
+
+  (define (run-benchmarks #!optional names stream)
+    "Run the benchmarks named in the list NAMES (or all of them), writing
+the results to STREAM (or to standard-output) as they're made. Progress
+is reported on standard-error. Returns the list of results."
+    (let ((results '()))
+      (unless stream
+	(setq stream standard-output))
+      (write-results-header stream)
+      (mapc (lambda (name)
+	      (format standard-error "%-24s" (symbol-name name))
+	      (let ((result (run-benchmark name)))
+		(format standard-error " %10dus median %10dus p99\n"
+			(cdr (assq 'median (cdr result)))
+			(cdr (assq 'p99 (cdr result))))
+		(prin1 result stream)
+		(write stream #\newline)
+		(setq results (cons result results))))
+	    (or names (benchmark-names)))
+      (nreverse results)))
+
+
+;;; results
+
+  (define (write-results-header stream)
+    (format stream ";; librep %s benchmark results, %s\n"
+	    rep-version (current-time-string)))
+
+  (define (write-benchmark-results results file)
+    "Write the list of benchmark RESULTS to FILE."
+    (let ((stream (open-file file 'write)))
+      (unwind-protect
+	  (progn
+	    (write-results-header stream)
+	    (mapc (lambda (x)
+		    (prin1 x stream)
+		    (write stream #\newline)) results))
+	(close-file stream))))
+
+  (define (read-benchmark-results file)
+    "Return the list of benchmark results stored in FILE."
+    (let ((stream (open-file file 'read))
+	  (results '()))
+      (unwind-protect
+	  (condition-case nil
+	      (while t
+		(setq results (cons (read stream) results)))
+	    (end-of-stream))
+	(close-file stream))
+      (nreverse results)))
+
+  (define (compare-benchmark-results old new #!optional stream)
+    "Print the median time of each benchmark in the results NEW, and as a
+percentage of the median of the same benchmark in OLD. Either may be a
+list of results or the name of a file they were written to."
+    (when (stringp old)
+      (setq old (read-benchmark-results old)))
+    (when (stringp new)
+      (setq new (read-benchmark-results new)))
+    (unless stream
+      (setq stream standard-output))
+    (mapc (lambda (result)
+	    (let ((before (cdr (assq 'median (cdr (assq (car result) old)))))
+		  (after (cdr (assq 'median (cdr result)))))
+	      (if (and before (> before 0))
+		  (format stream "%-24s %10d %10d %6d%%\n"
+			  (symbol-name (car result)) before after
+			  (quotient (* after 100) before))
+		(format stream "%-24s %10s %10d\n"
+			(symbol-name (car result)) "-" after))))
+	  new)))
@@ -0,0 +1,205 @@
+#| benchmarks.jl -- standard workloads for `make bench'
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.test.benchmarks
+
+    (export run-benchmarks-and-exit)
+
+    (open rep
+	  rep.system
+	  rep.regexp
+	  rep.io.files
+	  rep.io.sockets
+	  rep.data.tables
+	  rep.test.bench)
+
+;;; interpreter
+
+  ;; this is quoted so that it isn't compiled with the rest of the file
+  (define interpreted-fib
+    '(letrec ((fib (lambda (n)
+		     (if (< n 2)
+			 n
+		       (+ (fib (- n 1)) (fib (- n 2)))))))
+       (fib 15)))
+
+  (define-benchmark 'eval (lambda () (eval interpreted-fib)))
+
+
+;;; virtual machine
+
+  (define (fib n)
+    (if (< n 2)
+	n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+  (define-benchmark 'vm-fib (lambda () (fib 20)))
+
+  (define-benchmark 'vm-lists
+    (lambda ()
+      (do ((i 0 (1+ i)))
+	  ((= i 20))
+	(let loop ((n 0) (lst '()))
+	  (if (< n 500)
+	      (loop (1+ n) (cons n lst))
+	    (length (filter (lambda (x) (zerop (logand x 1)))
+			    (mapcar 1+ (reverse lst)))))))))
+
+  (define-benchmark 'vm-vectors
+    (lambda ()
+      (let ((v (make-vector 1000 0)))
+	(do ((j 0 (1+ j)))
+	    ((= j 20))
+	  (do ((i 0 (1+ i)))
+	      ((= i 1000))
+	    (aset v i (+ (aref v i) i)))))))
+
+
+;;; garbage collection
+
+  (define-benchmark 'gc
+    (lambda ()
+      (do ((i 0 (1+ i)))
+	  ((= i 20000))
+	(list (make-vector 4) (make-string 16) (cons i i)))
+      (garbage-collect)))
+
+
+;;; hash tables
+
+  (define table-keys
+    (let loop ((i 0) (out '()))
+      (if (= i 2000)
+	  out
+	(loop (1+ i) (cons (format nil "key-%d" i) out)))))
+
+  (define-benchmark 'tables
+    (lambda ()
+      (let ((tab (make-table string-hash string=)))
+	(mapc (lambda (k) (table-set tab k t)) table-keys)
+	(mapc (lambda (k) (table-ref tab k)) table-keys)
+	(mapc (lambda (k) (table-unset tab k)) table-keys))))
+
+
+;;; regular expressions
+
+  (define regexp-lines
+    (let loop ((i 0) (out '()))
+      (if (= i 200)
+	  out
+	(loop (1+ i) (cons (format nil "line %d: user%d@host%d.example.org ok"
+				   i i (* i 7)) out)))))
+
+  (define-benchmark 'regexp-match
+    (lambda ()
+      (do ((i 0 (1+ i)))
+	  ((= i 10))
+	(mapc (lambda (line)
+		(string-match "\\([a-z0-9]+\\)@\\([a-z0-9.]+\\)" line)
+		(string-match "^line [0-9]+: .* \\(fail\\|error\\)$" line))
+	      regexp-lines))))
+
+  (define-benchmark 'regexp-replace
+    (lambda ()
+      (mapc (lambda (line)
+	      (string-replace "[0-9]+" "<\\0>" line))
+	    regexp-lines)))
+
+
+;;; printing and reading
+
+  (define-benchmark 'format
+    (lambda ()
+      (do ((i 0 (1+ i)))
+	  ((= i 2000))
+	(format nil "%s %d %x %S %-8s|" "string" i i '(a "b" 3) 'sym))))
+
+  (define reader-input
+    (prin1-to-string
+     (let loop ((i 0) (out '()))
+       (if (= i 500)
+	   out
+	 (loop (1+ i) (cons (list i (format nil "s%d" i) 'symbol
+				  (vector i 1.5 #\a)) out))))))
+
+  (define-benchmark 'reader (lambda () (read-from-string reader-input)))
+
+
+;;; file i/o
+
+  (define-benchmark 'file-io
+    (lambda ()
+      (let ((file (make-temp-name)))
+	(unwind-protect
+	    (progn
+	      (let ((stream (open-file file 'write)))
+		(do ((i 0 (1+ i)))
+		    ((= i 2000))
+		  (format stream "%d the quick brown fox jumps over it\n" i))
+		(close-file stream))
+	      (let ((stream (open-file file 'read)))
+		(while (read-line stream))
+		(close-file stream)))
+	  (delete-file file)))))
+
+
+;;; sockets
+
+  ;; Echo a few hundred messages over a local socket, waiting for each
+  ;; reply before sending the next
+  (define-benchmark 'sockets
+    (lambda ()
+      (let* ((address (make-temp-name))
+	     (connection nil)
+	     (replies 0)
+	     (server (socket-local-server
+		      address (lambda (s)
+				(setq connection
+				      (socket-accept
+				       s (lambda (data)
+					   (write connection data)))))))
+	     (client (socket-local-client
+		      address (lambda (data)
+				(declare (unused data))
+				(setq replies (1+ replies))))))
+	(unwind-protect
+	    (progn
+	      (while (not connection)
+		(accept-socket-output-1 server 0 100))
+	      (do ((i 0 (1+ i)))
+		  ((= i 200))
+		(write client "ping\n")
+		(while (= replies i)
+		  (accept-socket-output-1 connection 0 100)
+		  (accept-socket-output-1 client 0 100))))
+	  (close-socket client)
+	  (when connection
+	    (close-socket connection))
+	  (close-socket server)
+	  (delete-file address)))))
+
+
+;;; entry point
+
+  (define (run-benchmarks-and-exit)
+    (run-benchmarks)
+    (throw 'quit 0)))
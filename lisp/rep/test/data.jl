@@ -25,7 +25,10 @@
 (define-structure rep.data.self-tests ()
 
     (open rep
+	  rep.io.files
+	  rep.data.codecs
 	  rep.data.records
+	  rep.data.tables
 	  rep.test.framework)
 
 ;;; equality function tests
@@ -189,11 +192,158 @@
     (test (string= (mapconcat string-upcase '("foo" "bar" "baz") " ")
 		   "FOO BAR BAZ")))
 
+;;; hash table tests
+
+  (define (table-self-test)
+    (let ((tab (make-table equal-hash equal)))
+      (do ((i 0 (1+ i))) ((= i 1000))
+	(table-set tab (number->string i) i))
+      (test (= (table-size tab) 1000))
+      (test (eql (table-ref tab "999") 999))
+      (do ((i 0 (+ i 2))) ((>= i 1000))
+	(table-unset tab (number->string i)))
+      (test (= (table-size tab) 500))
+      (test (not (table-bound-p tab "998")))
+      (test (eql (table-ref tab "997") 997))
+      (test (= (table-fold (lambda (k v acc)
+			     (declare (unused k v))
+			     (1+ acc)) 0 tab) 500))
+      (test (= (length (table-keys tab)) 500))
+      (test (= (length (table->vector tab)) 1000)))
+
+    (let ((tab (make-table eq-hash eq 10)))
+      (table-load tab '((a . 1) (b . 2)))
+      (table-load tab [c 3 a 4])
+      (test (= (table-size tab) 3))
+      (test (equal (table-ref-vector tab [a b c d] 'none) [4 2 3 none]))
+      (let ((copy (make-table eq-hash eq)))
+	(table-reserve copy 100)
+	(table-merge copy tab)
+	(test (= (table-size copy) 3))
+	(test (eql (table-ref copy 'c) 3)))
+      ;; sizes beyond what a table can hold are rejected
+      (test (condition-case nil
+		(progn (table-reserve tab (ash 1 40)) nil)
+	      (bad-arg t)))
+      (test (condition-case nil
+		(progn (make-table eq-hash eq (ash 1 40)) nil)
+	      (bad-arg t)))
+      (test (= (table-size tab) 3)))
+
+    (let ((tab (make-table string-hash (lambda (x y) (string= x y)))))
+      (table-set tab "foo" 1)
+      (test (eql (table-ref tab (copy-sequence "foo")) 1))
+      (test (equal (table->alist tab) '(("foo" . 1))))))
+
+;;; sort tests
+
+  (define (sorted-p seq pred)
+    (let loop ((i 1))
+      (cond ((>= i (length seq)) t)
+	    ((pred (elt seq i) (elt seq (1- i))) nil)
+	    (t (loop (1+ i))))))
+
+  (define (sort-self-test)
+    (test (null (sort '())))
+    (test (equal (sort (vector)) []))
+    (test (equal (sort (list 1)) '(1)))
+    (test (equal (sort (list 5 3 7 4)) '(3 4 5 7)))
+    (test (equal (sort (vector 5 3 7 4)) [3 4 5 7]))
+    (test (equal (sort (list 5 3 7 4) >) '(7 5 4 3)))
+    (test (equal (sort (vector "b" "c" "a") string<) ["a" "b" "c"]))
+    (test (equal (sort (list -3 1 -2) < abs) '(1 -2 -3)))
+
+    ;; a vector is sorted in place
+    (let ((v (vector 3 1 2)))
+      (sort v)
+      (test (equal v [1 2 3])))
+
+    ;; elements with equal keys keep their order
+    (let* ((pairs (do ((i 0 (1+ i))
+		       (out '() (cons (cons (mod (* i 7) 5) i) out)))
+		      ((= i 200) (nreverse out))))
+	   (by-car (lambda (x y) (< (car x) (car y))))
+	   (stable-p (lambda (seq)
+		       (let loop ((i 1))
+			 (cond ((>= i (length seq)) t)
+			       ((and (= (car (elt seq i)) (car (elt seq (1- i))))
+				     (< (cdr (elt seq i)) (cdr (elt seq (1- i)))))
+				nil)
+			       (t (loop (1+ i))))))))
+      (let ((l (sort (copy-sequence pairs) by-car)))
+	(test (= (length l) 200))
+	(test (sorted-p l by-car))
+	(test (stable-p l)))
+      (let ((v (sort (apply vector pairs) by-car)))
+	(test (sorted-p v by-car))
+	(test (stable-p v)))
+      (let ((l (sort (copy-sequence pairs) < car)))
+	(test (sorted-p l by-car))
+	(test (stable-p l))))
+
+    ;; longer sequences, compared with an insertion sort
+    (let ((numbers (do ((i 0 (1+ i))
+			(x 1 (mod (+ (* x 75) 74) 65537))
+			(out '() (cons x out)))
+		       ((= i 500) out))))
+      (let ((expected (let loop ((rest numbers)
+				 (out '()))
+			(if (null rest)
+			    out
+			  (loop (cdr rest)
+				(let insert ((l out)
+					     (before '()))
+				  (if (or (null l) (<= (car rest) (car l)))
+				      (nconc (nreverse before) (cons (car rest) l))
+				    (insert (cdr l) (cons (car l) before)))))))))
+	(test (equal (sort (copy-sequence numbers)) expected))
+	(test (equal (sort (apply vector numbers)) (apply vector expected))))))
+
+;;; heap limit tests
+
+  ;; Call THUNK, which allocates more than the heap limit allows. It
+  ;; may succeed or signal memory-exhausted, but nothing else.
+  (define (within-heap-limit thunk)
+    (condition-case nil
+	(progn
+	  (thunk)
+	  t)
+      (memory-exhausted t)))
+
+  (define (heap-limit-self-test)
+    (let ((big (make-string 200000 ?a))
+	  (file (make-temp-name))
+	  (old-limit (heap-limit)))
+      (let ((stream (open-file file 'write)))
+	(do ((i 0 (1+ i)))
+	    ((= i 10))
+	  (write stream big))
+	(close-file stream))
+      (garbage-collect)
+      (heap-limit (+ (cdr (assq 'live (memory-usage))) 300000))
+      (unwind-protect
+	  (progn
+	    (test (within-heap-limit (lambda () (concat big big))))
+	    (test (within-heap-limit (lambda () (file-contents-string file))))
+	    (test (within-heap-limit (lambda () (base64-encode-string big))))
+	    (test (within-heap-limit (lambda () (base64-decode-string big))))
+	    ;; keeping more than the limit alive signals at a collection
+	    (test (condition-case nil
+		      (do ((i 0 (1+ i))
+			   (l '() (cons i l)))
+			  ((= i 100000) nil))
+		    (memory-exhausted t))))
+	(heap-limit (or old-limit 0))
+	(delete-file file))))
+
   (define (self-test)
     (equality-self-test)
     (cons-self-test)
     (record-self-test)
-    (string-util-self-test))
+    (table-self-test)
+    (string-util-self-test)
+    (sort-self-test)
+    (heap-limit-self-test))
 
   ;;###autoload
   (define-self-test 'rep.data self-test))
@@ -0,0 +1,84 @@
+#| rep.test.fasl -- checks for compiled files in fasl format
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.test.fasl ()
+
+    (open rep
+	  rep.io.files
+	  rep.structures
+	  rep.vm.compiler
+	  rep.test.framework)
+
+  (define example-data '(1 -123456789 "two\nlines" three [4 [5.5] "6"]
+			 (7 . 8) ()))
+
+  (define example-source
+    (format nil "(define-structure rep.test.fasl-example
+    (export fact greet data)
+    (open rep)
+  (define data '%S)
+  (define (fact n) (if (> n 1) (* n (fact (1- n))) 1))
+  (define (greet s) (concat s \"!\")))\n" example-data))
+
+  (define (example-ref name)
+    (%structure-ref (get-structure 'rep.test.fasl-example) name))
+
+  (define (self-test)
+    ;; objects read back as they were written
+    (test (equal (read-fasl-string (write-fasl nil example-data))
+		 example-data))
+    (test (null (read-fasl-string (write-fasl nil '()))))
+
+    ;; a file compiled to fasl data loads and runs
+    (let* ((source (concat (make-temp-name) ".jl"))
+	   (compiled (concat source "c")))
+      (unwind-protect
+	  (progn
+	    (let ((stream (open-file source 'write)))
+	      (write stream example-source)
+	      (close-file stream))
+	    (let ((*compiler-write-binary* t))
+	      (compile-file source))
+	    (test (fasl-file-p compiled))
+	    (test (not (fasl-file-p source)))
+	    (load compiled nil t t)
+	    (test (bytecodep (closure-function (example-ref 'fact))))
+	    (test (eql ((example-ref 'fact) 10) 3628800))
+	    (test (equal ((example-ref 'greet) "hi") "hi!"))
+	    (test (equal (example-ref 'data) example-data)))
+	(when (file-exists-p source)
+	  (delete-file source))
+	(when (file-exists-p compiled)
+	  (delete-file compiled))))
+
+    ;; open-coded mapcar behaves like the real one
+    (let ((f (compile-function (lambda (x) (mapcar (lambda (y) (car y)) x)))))
+      (test (bytecodep (closure-function f)))
+      (test (equal (f '((1) (2 3) ())) '(1 2 ())))
+      (test (null (f '())))
+      (test (equal (f '((1) . 2)) '(1)))
+      (test (condition-case nil
+		(progn (f [(1) (2)]) nil)
+	      (bad-arg t)))))
+
+  ;;###autoload
+  (define-self-test 'rep.vm.compiler self-test))
@@ -0,0 +1,199 @@
+#| rep.test.regexp -- checks for rep.regexp module
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.test.regexp ()
+
+    (open rep
+	  rep.regexp
+	  rep.test.framework)
+
+;;; random regexps and strings
+
+  ;; a linear congruential generator, so the same cases are checked
+  ;; each time
+  (define seed 1)
+
+  (define (next-random n)
+    (setq seed (logand (+ (* seed 69069) 1) #x3fffffff))
+    (mod (ash seed -8) n))
+
+  (define atoms ["a" "b" "ab" "." "[ab]" "[^a]" "\\w" "\\W" "x" "(a|b)"
+		 "(ab|a)" "\\bb" "^" "$" "(a*)" "[a-c]"])
+
+  (define postfixes ["" "" "*" "+" "?" "*?" "+?"])
+
+  (define (random-regexp n)
+    (do ((i 0 (1+ i))
+	 (out '() (cons (aref postfixes (next-random (length postfixes)))
+			(cons (aref atoms (next-random (length atoms))) out))))
+	((= i n) (apply concat (nreverse out)))))
+
+  (define (random-string n)
+    (let ((chars "aabbxc ")
+	  (string (make-string n)))
+      (do ((i 0 (1+ i)))
+	  ((= i n) string)
+	(aset string i (aref chars (next-random (length chars)))))))
+
+  ;; Return the bounds of the first three groups of the match of RE
+  ;; in STRING, or false if there's no match
+  (define (match-groups re string #!optional start fold)
+    (condition-case data
+	(and (string-match re string start fold)
+	     (do ((i 0 (1+ i))
+		  (out '() (cons (cons (match-start i) (match-end i)) out)))
+		 ((= i 3) out)))
+      (error (list 'error (car data)))))
+
+;;; the backtracking matcher and the automaton must agree
+
+  (define (automaton-self-test)
+    (let ((old-limit (regexp-backtrack-limit)))
+      (setq seed 1)
+      (unwind-protect
+	  (do ((i 0 (1+ i)))
+	      ((= i 2500))
+	    (let ((re (random-regexp (1+ (next-random 4))))
+		  (string (random-string (next-random 12)))
+		  (fold (= (next-random 3) 0)))
+	      (regexp-backtrack-limit old-limit)
+	      (let ((expected (match-groups re string nil fold)))
+		(regexp-backtrack-limit 0)
+		(test (equal (match-groups re string nil fold) expected)))))
+	(regexp-backtrack-limit old-limit)))
+
+    ;; \W doesn't match the end of the string
+    (test (string-match "(a*)\\W?" ""))
+    (test (eql (match-end) 0))
+    (test (not (string-match "a\\W" "a"))))
+
+;;; unanchored searches skip to where a match could start
+
+  (define literal-atoms ["a" "b" "ab" "abc" "xa" "A" "." "[ab]" "[^a]"
+			 "\\w" "\\W" "(a|b)" "(ab|a)" "\\bb" "^" "$" "(a*)"])
+
+  (define (random-literal-regexp n)
+    (do ((i 0 (1+ i))
+	 (out '() (cons (aref postfixes (next-random (length postfixes)))
+			(cons (aref literal-atoms
+				    (next-random (length literal-atoms)))
+			      out))))
+	((= i n) (apply concat (nreverse out)))))
+
+  ;; Search for RE in STRING by trying it at each position in turn
+  (define (match-groups-slowly re string start fold)
+    (condition-case data
+	(let loop ((i start))
+	  (cond ((string-looking-at re string i fold)
+		 (do ((j 0 (1+ j))
+		      (out '() (cons (cons (match-start j) (match-end j)) out)))
+		     ((= j 3) out)))
+		((< i (length string))
+		 (loop (1+ i)))
+		(t nil)))
+      (error (list 'error (car data)))))
+
+  (define (search-self-test)
+    (let ((old-limit (regexp-backtrack-limit)))
+      (setq seed 3)
+      (unwind-protect
+	  (do ((i 0 (1+ i)))
+	      ((= i 3600))
+	    (let* ((re (random-literal-regexp (1+ (next-random 4))))
+		   (string (random-string (next-random 16)))
+		   (start (next-random (1+ (length string))))
+		   (fold (= (next-random 3) 0))
+		   (expected (match-groups-slowly re string start fold)))
+	      (regexp-backtrack-limit old-limit)
+	      (test (equal (match-groups re string start fold) expected))
+	      (regexp-backtrack-limit 0)
+	      (test (equal (match-groups re string start fold) expected))))
+	(regexp-backtrack-limit old-limit)))
+
+    ;; negated classes don't match the end of the string
+    (test (not (string-match "\\W" "ab")))
+    (test (not (string-match "[^a]" "aa")))
+    (test (string-match "b\\W*" "ab"))
+    (test (eql (match-end) 2))
+    (test (not (string-match "b\\W" "ab"))))
+
+;;; regexp sets
+
+  (define (valid-regexp-p re)
+    (condition-case nil
+	(progn
+	  (string-match re "")
+	  t)
+      (error nil)))
+
+  ;; What a regexp set made from PATTERNS should return, found by
+  ;; trying each pattern in turn
+  (define (regexp-set-expected patterns string start fold all)
+    (let loop ((i 0)
+	       (rest patterns)
+	       (out '()))
+      (cond ((null rest)
+	     (and all (nreverse out)))
+	    ((not (string-match (car rest) string start fold))
+	     (loop (1+ i) (cdr rest) out))
+	    (all
+	     (loop (1+ i) (cdr rest) (cons i out)))
+	    (t i))))
+
+  (define (regexp-set-self-test)
+    (let ((s (make-regexp-set '("foo" "ba+r" "^x"))))
+      (test (regexp-set-p s))
+      (test (not (regexp-set-p "foo")))
+      (test (eql (regexp-set-match s "a baaar foo") 0))
+      (test (equal (regexp-set-match s "a baaar foo" 0 t) '(0 1)))
+      (test (eql (regexp-set-match s "xyz") 2))
+      (test (not (regexp-set-match s "a bz")))
+      (string-match "b" "abc")
+      (regexp-set-match s "foo")
+      (test (eql (match-start) 1)))
+
+    (setq seed 2)
+    (do ((i 0 (1+ i)))
+	((= i 500))
+      (let ((patterns (do ((j (1+ (next-random 5)) (1- j))
+			   (out '() (let ((re (random-regexp
+					       (1+ (next-random 3)))))
+				      (if (valid-regexp-p re)
+					  (cons re out)
+					out))))
+			  ((= j 0) out)))
+	    (string (random-string (next-random 12)))
+	    (fold (= (next-random 3) 0)))
+	(let ((set (make-regexp-set patterns fold))
+	      (start (next-random (1+ (length string)))))
+	  (test (eql (regexp-set-match set string start)
+		     (regexp-set-expected patterns string start fold nil)))
+	  (test (equal (regexp-set-match set string start t)
+		       (regexp-set-expected patterns string start fold t)))))))
+
+  (define (self-test)
+    (automaton-self-test)
+    (search-self-test)
+    (regexp-set-self-test))
+
+  ;;###autoload
+  (define-self-test 'rep.regexp self-test))
@@ -28,57 +28,162 @@
 	    message-port-p
 	    message-fetch
 	    message-send
-	    message-waiting-p)
+	    message-waiting-p
+	    make-vat
+	    message-port-remote-p
+	    close-message-port)
 
     (open rep
 	  rep.threads
+	  rep.threads.utils
 	  rep.threads.mutex
 	  rep.threads.condition-variable
 	  rep.data.records
-	  rep.data.queues)
+	  rep.data.queues
+	  rep.io.sockets
+	  rep.system)
+
+  ;; SOCKET is false for ports within this process. Remote ports are
+  ;; one end of a socket connecting two vats (processes running copies
+  ;; of this Lisp system); each message is sent as a line holding its
+  ;; length, followed by its printed representation. Their queues are
+  ;; only filled from the socket's receiver, with preemption disabled.
 
   (define-record-type :message-port
-    (create-port queue mutex condition)
+    (create-port queue mutex condition socket)
     message-port-p
     (queue port-queue)
     (mutex port-mutex)
-    (condition port-condition))
+    (condition port-condition)
+    (socket port-socket))
 
   (define (make-message-port)
     "Create and return a new message port."
-    (create-port (make-queue) (make-mutex) (make-condition-variable)))
+    (create-port (make-queue) (make-mutex) (make-condition-variable) nil))
+
+  (define (message-port-remote-p port)
+    "Return true if message port PORT is connected to a different vat."
+    (and (port-socket port) t))
 
   (define (message-waiting-p port)
     "Return true if there are messages waiting on message port PORT."
-    (obtain-mutex (port-mutex port))
-    (unwind-protect
-	(not (queue-empty-p (port-queue port)))
-      (release-mutex (port-mutex port))))
+    (if (port-socket port)
+	(progn
+	  (when (socketp (port-socket port))
+	    (accept-socket-output-1 (port-socket port) 0 0))
+	  (not (queue-empty-p (port-queue port))))
+      (obtain-mutex (port-mutex port))
+      (unwind-protect
+	  (not (queue-empty-p (port-queue port)))
+	(release-mutex (port-mutex port)))))
 
   (define (message-fetch port #!optional timeout)
     "Fetch the earliest unread message sent to message port PORT. Blocks the
 current thread for TIMEOUT milliseconds, or indefinitely if TIMEOUT isn't
 defined. Returns the message, or false if no message could be read."
-    (obtain-mutex (port-mutex port))
-    (unwind-protect
-	(let again ((can-wait t))
-	  (if (queue-empty-p (port-queue port))
-	      (if can-wait
-		  (again (condition-variable-wait (port-condition port)
-						  (port-mutex port) timeout))
-		nil)
-	    ;; we have a waiting message
-	    (dequeue (port-queue port))))
-      (release-mutex (port-mutex port))))
+    (if (port-socket port)
+	(fetch-remote port timeout)
+      (obtain-mutex (port-mutex port))
+      (unwind-protect
+	  (let again ((can-wait t))
+	    (if (queue-empty-p (port-queue port))
+		(if can-wait
+		    (again (condition-variable-wait (port-condition port)
+						    (port-mutex port) timeout))
+		  nil)
+	      ;; we have a waiting message
+	      (dequeue (port-queue port))))
+	(release-mutex (port-mutex port)))))
 
   (define (message-send port message)
-    "Send the message MESSAGE (an arbitrary value) to message port PORT."
-    (obtain-mutex (port-mutex port))
-    (unwind-protect
-	(progn
-	  (enqueue (port-queue port) message)
-	  (condition-variable-signal (port-condition port)))
-      (release-mutex (port-mutex port)))))
+    "Send the message MESSAGE to message port PORT. If PORT is remote,
+MESSAGE is copied, and may only be built from numbers, strings, symbols,
+lists and vectors; otherwise it may be an arbitrary value."
+    (if (port-socket port)
+	(send-remote port message)
+      (obtain-mutex (port-mutex port))
+      (unwind-protect
+	  (progn
+	    (enqueue (port-queue port) message)
+	    (condition-variable-signal (port-condition port)))
+	(release-mutex (port-mutex port)))))
+
+;;; vats
+
+  (define (make-vat fun)
+    "Start a new vat: a separate process running a copy of this Lisp
+system, so that it can run in parallel with this one. The new vat
+calls FUN with a message port connected to the one returned by this
+function, and exits when FUN returns. Vats share no data,
+only the messages sent between them."
+    (remote-port
+     (socket-fork (lambda (socket)
+		    (call-with-dynamic-root
+		     (lambda ()
+		       (fun (remote-port socket))))))))
+
+  (define (close-message-port port)
+    "Disconnect the remote message port PORT, once everything sent to it
+has been written. Messages already received may still be fetched."
+    (when (socketp (port-socket port))
+      (close-socket (port-socket port))))
+
+  (define (remote-port socket)
+    (let ((port (create-port (make-queue) nil nil socket))
+	  (size nil))
+      (define (receiver socket)
+	(if (not size)
+	    (let ((header (socket-read-until socket "\n")))
+	      (setq size (string->number
+			  (substring header 0 (1- (length header)))))
+	      (set-socket-receiver socket receiver size))
+	  (let ((message (read (make-string-input-stream
+				(socket-read-bytes socket size)))))
+	    (setq size nil)
+	    (set-socket-receiver socket receiver "\n")
+	    (without-interrupts
+	     (enqueue (port-queue port) message)))))
+      (set-socket-receiver socket receiver "\n")
+      port))
+
+  (define (transferable-p x)
+    (cond ((or (null x) (numberp x) (stringp x) (symbolp x)) t)
+	  ((consp x)
+	   (let loop ((rest x))
+	     (if (consp rest)
+		 (and (transferable-p (car rest)) (loop (cdr rest)))
+	       (transferable-p rest))))
+	  ((vectorp x)
+	   (let loop ((i 0))
+	     (or (= i (length x))
+		 (and (transferable-p (aref x i)) (loop (1+ i))))))
+	  (t nil)))
+
+  (define (send-remote port message)
+    (unless (transferable-p message)
+      (signal 'bad-arg (list message 2)))
+    (let ((data (let ((print-length nil)
+		      (print-level nil))
+		  (format nil "%S" message)))
+	  (socket (port-socket port)))
+      (format socket "%d\n%s" (length data) data)
+      (socket-flush socket)))
+
+  (define (fetch-remote port timeout)
+    (let ((queue (port-queue port))
+	  (socket (port-socket port))
+	  (deadline (and timeout (+ (quotient (current-utime) 1000) timeout))))
+      (let loop ()
+	(if (not (queue-empty-p queue))
+	    (without-interrupts
+	     (dequeue queue))
+	  (let ((wait (if deadline
+			  (- deadline (quotient (current-utime) 1000))
+			1000)))
+	    (when (and (socketp socket) (> wait 0))
+	      (accept-socket-output-1 socket (quotient wait 1000)
+				      (remainder wait 1000))
+	      (loop))))))))
 
 
 #| Test function:
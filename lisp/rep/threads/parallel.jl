@@ -0,0 +1,123 @@
+#| parallel.jl -- mapping functions over sequences using several vats
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+(define-structure rep.threads.parallel
+
+    (export parallel-map
+	    parallel-for-each
+	    parallel-workers)
+
+    (open rep
+	  rep.system
+	  rep.threads.message-port)
+
+  ;; Each call starts a fresh set of vats. They are forked after the
+  ;; sequence has been built, so they share it with the caller (the
+  ;; memory is only copied if either side then modifies it); only the
+  ;; results travel back through the message ports.
+
+  (define workers (processor-count))
+
+  (define (parallel-workers #!optional count)
+    "Return the maximum number of vats that `parallel-map' and
+`parallel-for-each' start at once, by default the number of processors.
+If COUNT is defined, change it to that number first."
+    (when count
+      (unless (and (fixnump count) (> count 0))
+	(signal 'bad-arg (list count 1)))
+      (setq workers count))
+    workers)
+
+  ;; Call FUN on the elements of vector ITEMS in parallel, returning
+  ;; a list of the results or of true values when KEEP is false.
+  (define (run fun items keep)
+    (let* ((total (length items))
+	   (count (min workers total)))
+      (if (<= count 1)
+	  (let loop ((i 0) (out '()))
+	    (if (= i total)
+		(nreverse out)
+	      (let ((value (fun (aref items i))))
+		(loop (1+ i) (cons (if keep value t) out)))))
+	(let ((ports (let loop ((k 0) (out '()))
+		       (if (= k count)
+			   (nreverse out)
+			 (loop (1+ k)
+			       (cons (start-worker fun items keep
+						   (quotient (* k total) count)
+						   (quotient (* (1+ k) total)
+							     count))
+				     out))))))
+	  (unwind-protect
+	      (apply nconc (mapcar collect ports))
+	    (mapc close-message-port ports))))))
+
+  ;; Start a vat mapping FUN over elements START to END-1 of ITEMS.
+  (define (start-worker fun items keep start end)
+    (make-vat
+     (lambda (port)
+       (condition-case data
+	   (message-send port
+			 (cons t (let loop ((i start) (out '()))
+				   (if (= i end)
+				       (nreverse out)
+				     (let ((value (fun (aref items i))))
+				       (loop (1+ i)
+					     (cons (if keep value t) out)))))))
+	 (error
+	  (message-send port (list nil (car data)
+				   (format nil "%S" (cdr data)))))))))
+
+  (define (collect port)
+    (let ((reply (message-fetch port)))
+      (cond ((null reply)
+	     (error "Parallel worker exited without replying"))
+	    ((car reply) (cdr reply))
+	    (t (signal (nth 1 reply) (list (nth 2 reply)))))))
+
+  (define (parallel-map fun sequence)
+    "Return the result of applying FUN to each element of SEQUENCE
+(a list or vector), as a sequence of the same type. The elements are
+divided between up to `(parallel-workers)' vats, which run in parallel,
+so changes FUN makes to Lisp data needn't be seen by the caller,
+and its results are copied back (so they may only be built from numbers,
+strings, symbols, lists and vectors). If FUN signals an error, the
+same error is signalled here, with its data replaced by its printed
+representation."
+    (cond ((vectorp sequence)
+	   (apply vector (run fun sequence t)))
+	  ((listp sequence)
+	   (run fun (apply vector sequence) t))
+	  (t (signal 'bad-arg (list sequence 2)))))
+
+  (define (parallel-for-each fun sequence)
+    "Apply FUN to each element of SEQUENCE (a list or vector), dividing
+the work between up to `(parallel-workers)' vats running in parallel,
+and return once they have all finished. Since FUN runs in other
+vats, only its effects outside the Lisp system (on files, for example)
+can be relied on."
+    (cond ((vectorp sequence)
+	   (run fun sequence nil))
+	  ((listp sequence)
+	   (run fun (apply vector sequence) nil))
+	  (t (signal 'bad-arg (list sequence 2))))
+    nil))
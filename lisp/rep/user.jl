@@ -75,6 +75,8 @@ where OPTIONS are any of:
 
     --check		run self tests and exit
 
+    --image FILE	load Lisp files from the image FILE
+
     --version		print version details
     --no-rc		don't load rc or site-init files
     --quit, -q		terminate the interpreter process\n" program-name)
@@ -29,80 +29,48 @@
     (export base64-encode
 	    base64-decode)
 
-    (open rep)
+    (open rep
+	  rep.data.codecs
+	  rep.test.framework)
 
-  ;; INPUT and OUTPUT are any type of stream
-
-  (defconst mime-base64-alphabet
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/")
+  ;; INPUT and OUTPUT are any type of stream. The work is done by the
+  ;; native kernels in rep.data.codecs, which also have versions
+  ;; working on strings
 
   (define (base64-encode input output)
-    (let ((col 0)
-	  reg reg1 reg2 reg3)
-      (catch 'done
-	(while t
-	  (setq reg1 (read-char input))
-	  (setq reg2 (read-char input))
-	  (setq reg3 (read-char input))
-	  (cond
-	   ((and reg1 reg2 reg3)
-	    ;; Got our 24 bits, split into four 6 bit quantities
-	    (progn
-	      (setq reg (logior (lsh reg1 16) (lsh reg2 8) reg3))
-	      (write output (aref mime-base64-alphabet (lsh reg -18)))
-	      (write output (aref mime-base64-alphabet
-				  (logand (lsh reg -12) #o77)))
-	      (write output (aref mime-base64-alphabet
-				  (logand (lsh reg -6) #o77)))
-	      (write output (aref mime-base64-alphabet (logand reg #o77)))
-	      (setq col (+ col 4))
-	      (when (>= col 76)
-		(write output #\newline)
-		(setq col 0))))
-	   (reg2
-	    ;; 16 bits read, shift in 2 zeros
-	    (setq reg (lsh (logior (lsh reg1 8) reg2) 2))
-	    (write output (aref mime-base64-alphabet (lsh reg -12)))
-	    (write output (aref mime-base64-alphabet
-				(logand (lsh reg -6) #o77)))
-	    (write output (aref mime-base64-alphabet (logand reg #o77)))
-	    (write output #\=)
-	    (throw 'done t))
-	   (reg1
-	    ;; eight bits read, shift in 4 zeros
-	    (setq reg (lsh reg1 4))
-	    (write output (aref mime-base64-alphabet (lsh reg -6)))
-	    (write output (aref mime-base64-alphabet (logand reg #o77)))
-	    (write output #\=)
-	    (write output #\=)
-	    (throw 'done t))
-	   (t
-	    ;; 0 bits read
-	    (throw 'done t)))))
-      (write output #\newline)))
+    (base64-encode-stream input output))
 
   (define (base64-decode input output)
-    (let ((reg 0)
-	  (bits 0)
-	  char)
-      (while (setq char (read-char input))
-	(cond
-	 ((and (>= char #\A) (<= char #\Z))
-	  (setq char (- char #\A)))
-	 ((and (>= char #\a) (<= char #\z))
-	  (setq char (+ 26 (- char #\a))))
-	 ((and (>= char #\0) (<= char #\9))
-	  (setq char (+ 52 (- char #\0))))
-	 ((= char #\+)
-	  (setq char 62))
-	 ((= char #\/)
-	  (setq char 63))
-	 (t (setq char nil)))
-	(when char
-	  (setq reg (logior (lsh reg 6) char))
-	  (setq bits (+ bits 6)))
-	(while (>= bits 8)
-	  (setq char (lsh reg (- 8 bits)))
-	  (setq reg (logxor reg (lsh char (- bits 8))))
-	  (setq bits (- bits 8))
-	  (write output char))))))
+    (base64-decode-stream input output))
+
+
+;; Tests
+
+  (define (encode string)
+    (let ((output (make-string-output-stream)))
+      (base64-encode (make-string-input-stream string) output)
+      (get-output-stream-string output)))
+
+  (define (decode string)
+    (let ((output (make-string-output-stream)))
+      (base64-decode (make-string-input-stream string) output)
+      (get-output-stream-string output)))
+
+  (define (self-test)
+    (test (string= (encode "") "\n"))
+    (test (string= (encode "f") "Zg==\n"))
+    (test (string= (encode "fo") "Zm8=\n"))
+    (test (string= (encode "foobar") "Zm9vYmFy\n"))
+    (test (string= (encode (make-string 60 ?a))
+		   (concat (apply concat (make-list 19 "YWFh")) "\nYWFh\n")))
+    (test (string= (decode "Zm9v\nYmE=\n") "fooba"))
+    (let ((bytes (let ((s (make-string 256)))
+		   (do ((i 0 (1+ i)))
+		       ((= i 256) s)
+		     (aset s i i)))))
+      (test (string= (decode (encode bytes)) bytes))
+      (test (string= (base64-encode-string bytes) (encode bytes)))
+      (test (string= (base64-decode-string (encode bytes)) bytes))))
+
+  ;;###autoload
+  (define-self-test 'rep.util.base64 self-test))
@@ -97,7 +97,7 @@
 
       string->number number->string mapconcat string-upper-case-p
       string-lower-case-p string-capitalized-p string-upcase string-downcase
-      capitalize-string mapconcat
+      capitalize-string mapconcat string-index string-search string-count
 
       ;; make-timer delete-timer set-timer
       ;; make-table make-weak-table string-hash symbol-hash eq-hash
@@ -20,27 +20,67 @@
 ;; the Free Software Foundation, 51 Franklin Street, Fifth Floor, 
 ;; Boston, MA 02110-1301 USA
 
+;; The cache itself lives in rep.data.tables (memo-cache-call etc),
+;; which hashes the arguments where they are, without consing a key.
+;; When the caller states the function's arity, the wrapper takes its
+;; arguments directly as well, so a cache hit allocates nothing.
+
 (define-structure rep.util.memoize
 
-    (export memoize memoize-function)
+    (export memoize memoize-function
+	    memoize-stats memoize-clear)
 
     (open rep
 	  rep.data.tables)
 
   (define-structure-alias memoize rep.util.memoize)
 
-  (define (memoize f)
+  ;; maps memoized functions to their caches
+  (define caches (make-weak-table eq-hash eq))
+
+  (define (memoize f #!key max-size ttl weak arity)
     "Create and return a caching version of the function F. F may not be
-an autoload definition."
+an autoload definition.
+
+If MAX-SIZE is given, at most that many results are kept, the least
+recently used being discarded first. If TTL is given, results more than
+that many seconds old are recomputed.
+
+If WEAK is true, arguments are compared with `eq' rather than `equal',
+and results are discarded once their first argument has been garbage
+collected; use this when memoizing a function of objects.
+
+If ARITY, the number of arguments F takes, is given and at most three,
+the returned function takes exactly that many arguments, and doesn't
+need to make a list of them when called."
 
     (unless (functionp f)
       (error "can only memoize functions: %s" f))
 
-    (let ((cache (make-table equal-hash equal)))
+    (let* ((cache (make-memo-cache f max-size ttl weak))
+	   (fun (case arity
+		  ((0) (lambda () (memo-cache-call cache)))
+		  ((1) (lambda (a) (memo-cache-call cache a)))
+		  ((2) (lambda (a b) (memo-cache-call cache a b)))
+		  ((3) (lambda (a b c) (memo-cache-call cache a b c)))
+		  (t (lambda args (apply memo-cache-call cache args))))))
+      (table-set caches fun cache)
+      fun))
+
+  (define (memoized-cache fun)
+    (or (table-ref caches fun)
+	(error "not a memoized function: %s" fun)))
+
+  (define (memoize-stats fun #!optional reset)
+    "Return an association list of statistics about the cache of FUN, a
+function returned by `memoize': its current `size', and the number of
+`hits', `misses', `evictions' and `expirations' so far. If RESET is
+true, the counts are zeroed after being read."
+    (memo-cache-stats (memoized-cache fun) reset))
 
-      (lambda args
-	(or (table-ref cache args)
-	    (table-set cache args (apply f args))))))
+  (define (memoize-clear fun)
+    "Discard all results cached by FUN, a function returned by `memoize'."
+    (memo-cache-clear (memoized-cache fun)))
 
   ;; backwards compatibility
   (define memoize-function memoize))
@@ -0,0 +1,148 @@
+;; module-index.jl -- write indexes of the Lisp files in a directory
+
+;; This file is part of librep.
+
+;; librep is free software; you can redistribute it and/or modify it
+;; under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 2, or (at your option)
+;; any later version.
+
+;; librep is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with librep; see the file COPYING.  If not, write to
+;; the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+;; Boston, MA 02110-1301 USA
+
+;; A module index lists the Lisp files under a directory of the
+;; load-path, so that `load' needn't probe the directory for each
+;; suffix of each file it looks for. For a file containing just a
+;; `define-structure' form it also records the structure's exports;
+;; opening that structure then doesn't load it until one of them is
+;; referenced. The format is described in src/lispcmds.c.
+
+;; The exports are only recorded when they can be known without
+;; loading the file: its interface must parse, and nothing in it may
+;; export further bindings at run time. Since lazily opened structures
+;; depend on the exports being right, the index is ignored for any
+;; file that has been modified since it was written.
+
+(define-structure rep.util.module-index
+
+    (export make-module-index
+	    make-module-index-batch)
+
+    (open rep
+	  rep.io.files
+	  rep.regexp
+	  rep.structures
+	  rep.system)
+
+  (define index-file-name "rep-modules")
+
+  (define index-magic "rep-module-index 1\n")
+
+  ;; symbols whose presence means a module's exports can't be known
+  ;; from its interface
+  (define dynamic-export-symbols '(export-all %structure-exports-all
+				   structure-exports-all export-bindings
+				   export-binding set-interface))
+
+  ;; return true if FORM mentions any of the symbols in SYMBOLS,
+  ;; other than as quoted data
+  (define (mentions-any-p form symbols)
+    (cond ((symbolp form) (memq form symbols))
+	  ((consp form)
+	   (and (not (eq (car form) 'quote))
+		(or (mentions-any-p (car form) symbols)
+		    (mentions-any-p (cdr form) symbols))))
+	  ((vectorp form)
+	   (let loop ((i 0))
+	     (and (< i (length form))
+		  (or (mentions-any-p (aref form i) symbols)
+		      (loop (1+ i))))))
+	  (t nil)))
+
+  ;; Read the forms in FILE, returning `(NAME . EXPORTS)' if, other
+  ;; than declarations, it contains a single define-structure form whose
+  ;; exports can be known, else nil
+  (define (structure-exports file)
+    (condition-case nil
+	(let ((stream (open-file file 'read))
+	      (forms '()))
+	  (unwind-protect
+	      (condition-case nil
+		  (while t
+		    (let ((form (read stream)))
+		      (unless (eq (car form) 'declare)
+			(setq forms (cons form forms)))))
+		(end-of-stream))
+	    (close-file stream))
+	  (let ((form (and (null (cdr forms)) (car forms))))
+	    (when (and (eq (car form) 'define-structure)
+		       (symbolp (nth 1 form))
+		       (not (mentions-any-p (nthcdr 3 form)
+					    dynamic-export-symbols)))
+	      (let ((exports (parse-interface (nth 2 form))))
+		(and exports (cons (nth 1 form) exports))))))
+      (error nil)))
+
+  ;; Call (FUN NAME SUFFIX) for each Lisp file under DIRECTORY, NAME
+  ;; being relative to DIRECTORY and without SUFFIX
+  (define (walk-lisp-files fun directory #!optional prefix)
+    (mapc (lambda (file)
+	    (let ((full (expand-file-name file directory)))
+	      (cond ((or (eq (aref file 0) #\.)
+			 (string-match "[^!-~]" file)))
+		    ((file-directory-p full)
+		     (walk-lisp-files fun full (concat prefix file #\/)))
+		    ((string-match "\\.jlc?$" file)
+		     (fun (concat prefix (substring file 0 (match-start)))
+			  (substring file (match-start)))))))
+	  (directory-files directory)))
+
+  (define (make-module-index directory)
+    "Write an index of the Lisp files under DIRECTORY, a directory of the
+`load-path', to the file `rep-modules' in it. Returns the number of
+files indexed."
+    (let ((files '())
+	  (index (expand-file-name index-file-name directory)))
+      (walk-lisp-files (lambda (name suffix)
+			 (let ((cell (assoc name files)))
+			   (if cell
+			       (rplacd cell (cons suffix (cdr cell)))
+			     (setq files (cons (list name suffix) files)))))
+		       directory)
+      (setq files (sort files (lambda (x y) (string< (car x) (car y)))))
+      (let* ((new-name (concat index ".new"))
+	     (stream (open-file new-name 'write)))
+	(unwind-protect
+	    (progn
+	      (write stream index-magic)
+	      (mapc (lambda (cell)
+		      (let ((exports
+			     (and (member ".jl" (cdr cell))
+				  (structure-exports
+				   (expand-file-name (concat (car cell) ".jl")
+						     directory)))))
+			(format stream "%s\t%s\t%s\t%s\n" (car cell)
+				(mapconcat identity (sort (cdr cell)) " ")
+				(if exports (car exports) "-")
+				(if exports
+				    (mapconcat symbol-name (cdr exports) " ")
+				  "-"))))
+		    files))
+	  (close-file stream))
+	(rename-file new-name index))
+      (flush-module-indexes)
+      (length files)))
+
+  ;; Call like `rep --batch -l rep.util.module-index
+  ;; -f make-module-index-batch DIRECTORIES...'
+  (define (make-module-index-batch)
+    (while command-line-args
+      (make-module-index (car command-line-args))
+      (setq command-line-args (cdr command-line-args)))))
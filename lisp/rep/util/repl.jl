@@ -158,7 +158,7 @@
 ;;; module utils
 
   (define (module-exports-p name var)
-    (structure-exports-p (get-structure name) var))
+    (structure-exports-p (intern-structure name) var))
 
   (define (module-imports name)
      (structure-imports (get-structure name)))
@@ -461,6 +461,33 @@ commands may be abbreviated to their unique leading characters.\n\n")
      (print-profile))
    "FORM")
 
+  (define-repl-command
+   'call-tree
+   (lambda (form)
+     (require 'rep.lang.profiler)
+     (format standard-output "%S\n\n" (call-in-profiler
+				       (lambda () (repl-eval form))))
+     (print-call-tree))
+   "FORM")
+
+  (define-repl-command
+   'allocation-profile
+   (lambda (form)
+     (require 'rep.lang.profiler)
+     (format standard-output "%S\n\n" (call-in-allocation-profiler
+				       (lambda () (repl-eval form))))
+     (print-allocation-profile))
+   "FORM")
+
+  (define-repl-command
+   'bytecode-profile
+   (lambda (form)
+     (require 'rep.lang.profiler)
+     (format standard-output "%S\n\n" (call-in-bytecode-profiler
+				       (lambda () (repl-eval form))))
+     (print-bytecode-profile))
+   "FORM")
+
   (define-repl-command
    'check
    (lambda (#!optional module)
@@ -196,7 +196,8 @@
 		   ;; instruction with constant
 		   (emit-insn (car insn) (get-const-id (cadr insn))))
 
-		  ((memq (car insn) byte-jmp-insns)
+		  ((or (memq (car insn) byte-jmp-insns)
+		       (memq (car insn) byte-fused-jmp-insns))
 		   (emit-jmp (car insn) (cadr insn)))
 
 		  (t (apply emit-insn insn)))
@@ -28,6 +28,7 @@
 	    bytecode-minor
 	    bytecode
 	    bytecode-ref
+	    bytecode-name
 	    byte-max-1-byte-arg
 	    byte-max-2-byte-arg
 	    byte-max-3-byte-arg
@@ -38,7 +39,7 @@
   ;; Instruction set version
   ;; Don't forget to update the version number in src/bytecodes.h
   (defconst bytecode-major 11)
-  (defconst bytecode-minor 1)
+  (defconst bytecode-minor 3)
 
   ;; macro to get a named bytecode
   (defmacro bytecode (name)
@@ -220,6 +221,19 @@
       (optional-arg* . #xce)
       (keyword-arg* . #xcf)
 
+;;; Superinstructions, only emitted by the peephole optimizer
+
+      (slot-ref-car . #xd0)		;push (car slot[n])
+      (slot-ref-cdr . #xd1)		;push (cdr slot[n])
+      (dup-slot-set . #xd2)		;slot[n] = stk[0]
+      (eq-jn . #xd3)			;pop two, if not eq jmp x
+
+;;; Records
+
+      (record-ref . #xd4)		;call-3 %record-ref
+      (record-set . #xd5)		;call-4 %record-set
+      (record-p . #xd6)			;push (%record-p pop[1] pop[2])
+
       (last-before-jmps . #xf7)
 
 ;;; All jmps take two-byte arguments
@@ -234,6 +248,12 @@
       (jnp . #xfe)			;if stk[0] nil, jmp x, else pop
       (jtp . #xff)))			;if stk[0] t, jmp x, else pop
 
+  ;; return the name of opcode OP, ignoring any embedded argument
+  (define (bytecode-name op)
+    (when (< op (bytecode-ref 'last-with-args))
+      (setq op (logand op #xf8)))
+    (car (rassq op bytecode-alist)))
+
   ;; maximum argument value in 1,2,3 byte instructions
   (defconst byte-max-1-byte-arg 5)
   (defconst byte-max-2-byte-arg #xff)
@@ -269,7 +289,7 @@
      0   -1  0   -1  -1  0   0   nil
      -1  -2  -1  -1  0   0   -1  -2	;#xc0
      -1  +1  +1  +1  0   0   nil nil
-     nil nil nil nil nil nil nil nil	;#xd0
+     +1  +1  0   -2  -2  -3  -1  nil	;#xd0
      nil nil nil nil nil nil nil nil
      -1  nil nil nil nil nil nil nil	;#xe0
      -1  nil nil nil nil nil nil nil
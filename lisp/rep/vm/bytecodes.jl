@@ -24,12 +24,12 @@
 
 (define-structure rep.vm.bytecodes
 
-    (export bytecode-major bytecode-minor bytecode bytecode-ref
+    (export bytecode-major bytecode-minor bytecode bytecode-ref bytecode-name
 	    byte-max-1-byte-arg byte-max-2-byte-arg byte-max-3-byte-arg
 	    byte-two-byte-insns byte-three-byte-insns
 	    byte-insn-stack-delta byte-constant-insns
 	    byte-varref-free-insns byte-side-effect-free-insns
-	    byte-conditional-jmp-insns byte-jmp-insns
+	    byte-conditional-jmp-insns byte-jmp-insns byte-fused-jmp-insns
 	    byte-opcodes-with-constants byte-varref-insns
 	    byte-varset-insns byte-varbind-insns
 	    byte-nth-insns byte-nthcdr-insns)
@@ -39,7 +39,10 @@
 ;;; Description of instruction set for when optimising
 
   ;; list of instructions that always have a 1-byte argument following them
-  (define byte-two-byte-insns (list (bytecode pushi)))
+  (define byte-two-byte-insns (list (bytecode pushi)
+				    (bytecode slot-ref-car)
+				    (bytecode slot-ref-cdr)
+				    (bytecode dup-slot-set)))
 
   ;; list of instructions that always have a 2-byte argument following them
   (define byte-three-byte-insns
@@ -52,7 +55,8 @@
 	  (bytecode jn)
 	  (bytecode jt)
 	  (bytecode jnp)
-	  (bytecode jtp)))
+	  (bytecode jtp)
+	  (bytecode eq-jn)))
 
   ;; list of instructions that are both side-effect free and don't
   ;; reference any variables. Also none of these may ever raise exceptions
@@ -71,7 +75,8 @@
 	      sub mul div rem lnot not lor land gt ge lt le inc dec ash
 	      boundp get reverse assoc assq rassoc rassq last copy-sequence
 	      lxor max min mod make-closure enclose quotient floor ceiling
-	      truncate round exp log sin cos tan sqrt expt structure-ref)
+	      truncate round exp log sin cos tan sqrt expt structure-ref
+	      record-ref record-p)
            byte-varref-free-insns))
 
   ;; list of all conditional jumps
@@ -80,6 +85,10 @@
   ;; list of all jump instructions
   (define byte-jmp-insns (list* 'jmp 'ejmp byte-conditional-jmp-insns))
 
+  ;; list of superinstructions ending with a conditional jump. These
+  ;; only exist after the final peephole pass
+  (define byte-fused-jmp-insns '(eq-jn))
+
   ;; list of all varref instructions
   (define byte-varref-insns '(refn refg slot-ref))
 
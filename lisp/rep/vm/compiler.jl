@@ -28,6 +28,7 @@
 
     (export compile-file
 	    compile-directory
+	    compile-directory-parallel
 	    compile-lisp-lib
 	    compile-lib-batch
 	    compile-batch
@@ -42,6 +43,8 @@
 	  rep.system
 	  rep.io.files
 	  rep.regexp
+	  rep.threads.parallel
+	  rep.util.md5
 	  rep.vm.compiler.basic
 	  rep.vm.compiler.bindings
 	  rep.vm.compiler.modules
@@ -115,7 +118,10 @@ instructions encode their destination in the following two bytes (also
 in big-endian form).
 
 Any opcode between `op-last-with-args' and `op-last-before-jmps' is a
-straightforward single-byte instruction.
+straightforward single-byte instruction, apart from a few that take a
+one or two byte argument after the opcode. Some of these are
+superinstructions, combining common sequences of other instructions
+into one; the peephole optimizer introduces them as its last step.
 
 The machine simulated by lispmach.c is a simple stack-machine, each
 call to the byte-code interpreter gets its own stack; the size of stack
@@ -263,8 +269,14 @@ we would like. This is due to the view of folded functions as
 		 (when (setq dst-file (open-file temp-file 'write))
 		   (condition-case error-info
 		       (unwind-protect
-			   (progn
-			     ;; write out the results
+			   ;; write out the results. The fasl format
+			   ;; can't have a `#!' header
+			   (if (and *compiler-write-binary* (not header))
+			       (write-fasl dst-file
+					   (cons `(validate-byte-code
+						   ,bytecode-major
+						   ,bytecode-minor)
+						 (delq nil body)))
 			     (when header
 			       (write dst-file header))
 			     (format dst-file ";; Source file: %s\n(validate-byte-code %d %d)\n"
@@ -286,8 +298,16 @@ we would like. This is due to the view of folded functions as
 		   (let ((real-name (concat file-name (if (string-match
 							   "\\.jl$" file-name)
 							  ?c ".jlc"))))
-		     (copy-file temp-file real-name)
-		     (set-file-modes real-name (file-modes file-name)))
+		     ;; Replace the old file atomically, so that anything
+		     ;; still loading it (e.g. the rep.user module, when
+		     ;; the library is compiled in batch mode)
+		     ;; keeps reading the old contents, not the new ones.
+		     ;; Renaming a copy in the same directory also means
+		     ;; that nothing can see a partly written file
+		     (let ((new-name (concat real-name ".new")))
+		       (copy-file temp-file new-name)
+		       (set-file-modes new-name (file-modes file-name))
+		       (rename-file new-name real-name)))
 		   t)))
 	   (when (file-exists-p temp-file)
 	     (delete-file temp-file))))))))
@@ -315,6 +335,192 @@ EXCLUDE-RE may be a regexp matching files which shouldn't be compiled."
 	(directory-files dir-name))
   t)
 
+
+;;; Compiling many files at once
+
+;; Digests of the sources of the up-to-date object files found under a
+;; directory are kept in this file in the directory, so that a source
+;; file whose modification time has changed but whose contents haven't
+;; isn't recompiled. It holds an alist of (RELATIVE-NAME . MD5)
+(define digest-file ".jlc-digests")
+
+;; md5-local-file needs bignums, otherwise its digests are inexact
+;; floats (which are still integerp) and meaningless; the files' times
+;; are compared instead
+(define digests-usable (let ((digest (md5-string "")))
+			 (and (integerp digest) (exactp digest))))
+
+(define (read-digests dir-name)
+  (let ((file (expand-file-name digest-file dir-name)))
+    (or (and digests-usable (file-exists-p file)
+	     (condition-case nil
+		 (let ((stream (open-file file 'read)))
+		   (unwind-protect
+		       (read stream)
+		     (close-file stream)))
+	       (error nil)))
+	'())))
+
+(define (write-digests dir-name digests)
+  (when digests-usable
+    (let* ((file (expand-file-name digest-file dir-name))
+	   (new-file (concat file ".new"))
+	   (stream (open-file new-file 'write)))
+      (unwind-protect
+	  (let ((print-length nil)
+		(print-level nil))
+	    (format stream "%S\n" digests))
+	(close-file stream))
+      (rename-file new-file file))))
+
+;; Return an alist of (FILE . DEPENDENCIES) for the Lisp files under
+;; DIR-NAME, where DEPENDENCIES are the modules the file uses
+(define (scan-lisp-files dir-name exclude-re)
+  (let ((out '()))
+    (let scan ((dir-name dir-name))
+      (mapc (lambda (file)
+	      (unless (or (and exclude-re (string-match exclude-re file))
+			  (eq (aref file 0) #\.))
+		(let ((abs-file (expand-file-name file dir-name)))
+		  (cond ((file-directory-p abs-file)
+			 (scan abs-file))
+			((string-match "\\.jl$" file)
+			 (setq out (cons (cons abs-file
+					       (file-dependencies abs-file))
+					 out)))))))
+	    (directory-files dir-name)))
+    (nreverse out)))
+
+(define (file-dependencies file)
+  (let ((stream (open-file file 'read))
+	(out '()))
+    (unwind-protect
+	(condition-case nil
+	    (while t
+	      (setq out (append (structure-dependencies (read stream)) out)))
+	  (error nil))
+      (close-file stream))
+    out))
+
+;; Sort the files to be compiled into waves, such that each file comes
+;; after those of the modules it depends on
+(define (compilation-waves files dir-name)
+  (let ((levels '())
+	(in-progress '()))
+    (define (file-for-module name)
+      (let ((file (expand-file-name (concat (structure-file name) ".jl")
+				    dir-name)))
+	(and (assoc file files) file)))
+    (define (level file)
+      (cond ((cdr (assoc file levels)))
+	    ((member file in-progress) 0)	;circular, just ignore it
+	    (t (setq in-progress (cons file in-progress))
+	       (let ((n 0))
+		 (mapc (lambda (dep)
+			 (let ((dep-file (file-for-module dep)))
+			   (when (and dep-file (not (equal dep-file file)))
+			     (setq n (max n (1+ (level dep-file)))))))
+		       (cdr (assoc file files)))
+		 (setq levels (cons (cons file n) levels))
+		 n))))
+    (let ((waves '()))
+      (mapc (lambda (cell)
+	      (let* ((n (level (car cell)))
+		     (wave (assq n waves)))
+		(if wave
+		    (rplacd wave (cons (car cell) (cdr wave)))
+		  (setq waves (cons (list n (car cell)) waves)))))
+	    files)
+      (mapcar (lambda (wave) (nreverse (cdr wave)))
+	      (sort waves (lambda (x y) (< (car x) (car y))))))))
+
+;; Compile FILE, returning (FILE DOC-DB ERROR), where DOC-DB is the
+;; database its doc strings were written to, and ERROR describes why
+;; the file couldn't be compiled, or is false
+(define (compile-one-file file)
+  (let ((documentation-file (and *compiler-write-docs* (make-temp-name))))
+    (report-progress file)
+    (list file documentation-file
+	  (let ((failure (catch 'error
+			   (condition-case data
+			       (progn
+				 (compile-file file)
+				 nil)
+			     (error data)))))
+	    (and failure (format nil "%S" failure))))))
+
+;; Add the doc strings in the database DOC-DB to the real one
+(define (merge-documentation doc-db)
+  (require 'rep.io.db.gdbm)
+  (when (file-exists-p doc-db)
+    (let ((from (gdbm-open doc-db 'read nil '(no-lock))))
+      (when from
+	(unwind-protect
+	    (let ((to (gdbm-open documentation-file 'append nil '(no-lock))))
+	      (when to
+		(unwind-protect
+		    (gdbm-walk (lambda (key)
+				 (gdbm-store to key (gdbm-fetch from key)
+					     'replace))
+			       from)
+		  (gdbm-close to))))
+	  (gdbm-close from))))
+    (delete-file doc-db)))
+
+(defun compile-directory-parallel (dir-name #!optional force-p exclude-re)
+  "Compiles all Lisp files under the directory DIR-NAME whose object
+files are out of date, if FORCE-P is false, or all of them otherwise,
+as `compile-directory' does, but using up to `(parallel-workers)'
+processes at once. A file is only compiled after the files of the
+modules it uses, and only if its contents have changed since it was
+last compiled here (or, when that isn't known, if its object file is
+older than it).
+
+EXCLUDE-RE may be a regexp matching files which shouldn't be compiled.
+If any files can't be compiled, an error is signalled after the others
+have been."
+  (let* ((dir-name (file-name-as-directory (expand-file-name dir-name)))
+	 (digests (read-digests dir-name))
+	 (all-files (scan-lisp-files dir-name exclude-re))
+	 (new-digests '())
+	 (files (filter (lambda (cell)
+			  (let* ((file (car cell))
+				 (c-name (concat file ?c))
+				 (relative (substring file (length dir-name)))
+				 (digest (and digests-usable
+					      (md5-local-file file)))
+				 (old (cdr (assoc relative digests))))
+			    (setq new-digests (cons (cons relative digest)
+						    new-digests))
+			    (or force-p
+				(not (file-exists-p c-name))
+				(if old
+				    (not (equal old digest))
+				  (file-newer-than-file-p file c-name)))))
+			all-files))
+	 (failed '()))
+    (unwind-protect
+	(mapc (lambda (wave)
+		(mapc (lambda (result)
+			(when (nth 1 result)
+			  (merge-documentation (nth 1 result)))
+			(when (nth 2 result)
+			  (format standard-error "%s: %s\n"
+				  (nth 0 result) (nth 2 result))
+			  (setq failed (cons (nth 0 result) failed))))
+		      (parallel-map compile-one-file wave)))
+	      (compilation-waves files dir-name))
+      ;; Only remember the digests of files that are now compiled
+      (write-digests dir-name
+		     (filter (lambda (cell)
+			       (not (member (expand-file-name (car cell)
+							      dir-name)
+					    failed)))
+			     new-digests)))
+    (when failed
+      (error "Couldn't compile: %s" (nreverse failed)))
+    t))
+
 (defun compile-lisp-lib (#!optional directory force-p)
   "Recompile all out of date files in the lisp library directory. If FORCE-P
 is true it's as though all files were out of date.
@@ -322,11 +528,17 @@ This makes sure that all doc strings are written to their special file and
 that files which shouldn't be compiled aren't."
   (interactive "\nP")
   (let ((*compiler-write-docs* t))
-    (compile-directory (or directory lisp-lib-directory)
-		       force-p lib-exclude-re)))
+    (compile-directory-parallel (or directory lisp-lib-directory)
+				force-p lib-exclude-re)))
 
-;; Call like `rep --batch -l compiler -f compile-lib-batch [--force] DIR'
+;; Call like `rep --batch -l compiler -f compile-lib-batch [--write-binary]
+;; [--jobs N] [--force] DIR'
 (defun compile-lib-batch ()
+  (when (get-command-line-option "--write-binary")
+    (setq *compiler-write-binary* t))
+  (let ((jobs (get-command-line-option "--jobs" t)))
+    (when jobs
+      (parallel-workers (string->number jobs))))
   (let ((force (when (equal (car command-line-args) "--force")
 		 (setq command-line-args (cdr command-line-args))
 		 t))
@@ -334,10 +546,13 @@ that files which shouldn't be compiled aren't."
     (setq command-line-args (cdr command-line-args))
     (compile-lisp-lib dir force)))
 
-;; Call like `rep --batch -l compiler -f compile-batch [--write-docs] FILES...'
+;; Call like `rep --batch -l compiler -f compile-batch [--write-docs]
+;; [--write-binary] FILES...'
 (defun compile-batch ()
   (when (get-command-line-option "--write-docs")
     (setq *compiler-write-docs* t))
+  (when (get-command-line-option "--write-binary")
+    (setq *compiler-write-binary* t))
   (while command-line-args
     (compile-file (car command-line-args))
     (setq command-line-args (cdr command-line-args))))
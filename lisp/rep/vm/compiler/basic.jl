@@ -60,6 +60,14 @@
     "When t all doc-strings are appended to the doc file and replaced with
 their position in that file.")
 
+  (defvar *compiler-write-binary* nil
+    "When t compiled files are written in the binary fasl format (see
+`write-fasl') instead of as printed Lisp forms.")
+
+  (defvar *compiler-type-feedback* nil
+    "When non-nil, the name of a file written by `save-type-feedback'. Hot
+calls it records between small functions of the same module are inlined.")
+
   (defvar *compiler-no-low-level-optimisations* nil)
 
   (defvar *compiler-debug* nil)
@@ -158,7 +166,7 @@ their position in that file.")
 	 ((setq val (assq form (fluid const-env)))
 	  ;; A constant from this file
 	  (compile-constant (cdr val)))
-	 ((compiler-binding-immutable-p form)
+	 ((compiler-binding-constant-p form)
 	  ;; A known constant
 	  (compile-constant (compiler-symbol-value form)))
 	 (t
@@ -175,7 +183,7 @@ their position in that file.")
 	      (setq form nil)))
 	  (unless (null form)
 	    ;; A subroutine application of some sort
-	    (let (fun)
+	    (let (fun def)
 	      (cond
 	       ;; Check if there's a special handler for this function
 	       ((and (variable-ref-p (car form))
@@ -201,6 +209,10 @@ their position in that file.")
 
 		   ;; Assume a normal function call
 
+		   ((setq def (local-function fun (length (cdr form))))
+		    ;; A call to a closure that doesn't escape
+		    (compile-lambda-inline def (cdr form) nil return-follows))
+
 		   ((inlinable-call-p fun return-follows)
 		    ;; an inlinable tail call
 		    (note-binding-referenced fun t)
@@ -215,6 +227,15 @@ their position in that file.")
 		    ;; A call to a function that should be open-coded
 		    (compile-lambda-inline (cdr (assq fun (fluid inline-env)))
 					   (cdr form) nil return-follows fun))
+
+		   ((setq def (sealed-definition fun (length (cdr form))))
+		    ;; A small function from a sealed module
+		    (compile-sealed-inline def (cdr form) return-follows fun))
+
+		   ((setq def (feedback-definition fun (length (cdr form))))
+		    ;; A hot call to a small function from this module
+		    (compile-guarded-inline def fun (cdr form) return-follows))
+
 		   (t
 		    (compile-form-1
 		     fun #:in-tail-slot (inlinable-call-p fun return-follows))
@@ -43,6 +43,9 @@
 	    note-function-call-made
 	    binding-tail-call-only-p
 	    note-closure-made
+	    mentions-p
+	    call-with-local-functions
+	    local-function
 	    allocate-bindings)
 
     (open rep
@@ -54,6 +57,7 @@
   (define lex-bindings (make-fluid '()))	;alist of bound variables
   (define lexically-pure (make-fluid t))	;any dynamic state?
   (define unsafe-for-call/cc (make-fluid nil))
+  (define local-functions (make-fluid '()))	;alist of (CELL LAMBDA ENV TAG)
 
   (define (spec-bound-p var)
     (or (memq var (fluid defvars))
@@ -165,6 +169,82 @@
     (mapc (lambda (cell)
 	    (tag-cell 'enclosed cell)) (fluid lex-bindings)))
 
+;; closures that don't escape
+
+  ;; return t if symbol VAR occurs anywhere in FORM
+  (define (mentions-p var form)
+    (cond ((eq form var) t)
+	  ((consp form)
+	   (or (mentions-p var (car form)) (mentions-p var (cdr form))))
+	  (t nil)))
+
+  ;; return t if lambda-list ARGS accepts NARGS arguments
+  (define (accepts-args-p args nargs)
+    (let loop ((rest args)
+	       (state 'required)
+	       (n 0))
+      (cond ((null rest) (if (eq state 'required) (= n nargs) (<= nargs n)))
+	    ((symbolp rest) (>= nargs n))
+	    ((memq (car rest) '(#!optional &optional))
+	     (and (>= nargs n) (loop (cdr rest) 'optional n)))
+	    ((memq (car rest) '(#!rest &rest)) (>= nargs n))
+	    ((eq (car rest) '#!key) nil)
+	    (t (loop (cdr rest) state (1+ n))))))
+
+  ;; FUNS is a list of (VAR . LAMBDA), the lambda expressions that would
+  ;; be bound to each (lexical) VAR, with no bindings of VAR yet
+  ;; made. Call THUNK with each VAR bound to a local function, which
+  ;; compile-form-1 inlines at each call instead of making a closure
+  ;; and storing it. If any VAR escapes (is referenced other than by
+  ;; calling it) the code generated so far is discarded and FALLBACK
+  ;; is called instead, to compile the usual way
+  (define (call-with-local-functions funs thunk fallback)
+    (let ((env (fluid lex-bindings))
+	  (tag (list 'local-function)))
+      (push-state)
+      (when (catch tag
+	      (call-with-frame
+	       (lambda ()
+		 (let-fluids ((local-functions (fluid local-functions)))
+		   (mapc (lambda (cell)
+			   (note-binding (car cell) t)
+			   (let ((binding (lexical-binding (car cell))))
+			     (tag-cell 'local-function binding)
+			     (fluid-set local-functions
+					(cons (list binding (cdr cell) env tag)
+					      (fluid local-functions)))))
+			 funs)
+		   (thunk))))
+	      nil)
+	;; the frame wasn't left normally, so pop its bindings before
+	;; reload-state looks for the saved ones by name
+	(fluid-set lex-bindings env)
+	(reload-state)
+	(fallback))
+      (pop-state)))
+
+  (define (escape-local-function cell)
+    (throw (nth 3 (assq cell (fluid local-functions))) t))
+
+  ;; If VAR is bound to a local function that may be inlined when
+  ;; called with NARGS arguments here, return its lambda expression.
+  ;; If it can't be inlined, the local function escapes
+  (define (local-function var nargs)
+    (let ((cell (and (symbolp var) (lexical-binding var))))
+      (when (and cell (cell-tagged-p 'local-function cell))
+	(let* ((def (cdr (assq cell (fluid local-functions))))
+	       (fun (car def)))
+	  ;; none of the bindings made since the function was
+	  ;; defined may shadow a variable it refers to
+	  (let loop ((rest (fluid lex-bindings)))
+	    (cond ((eq rest (nth 1 def)))
+		  ((or (null rest) (mentions-p (caar rest) fun))
+		   (escape-local-function cell))
+		  (t (loop (cdr rest)))))
+	  (unless (accepts-args-p (nth 1 fun) nargs)
+	    (escape-local-function cell))
+	  fun))))
+
   (define (emit-binding var)
     (if (spec-bound-p var)
 	(progn
@@ -176,7 +256,9 @@
 
   (define (emit-varset sym)
     (test-variable-ref sym)
-    (cond ((spec-bound-p sym)
+    (cond ((binding-tagged-p sym 'local-function)
+	   (escape-local-function (lexical-binding sym)))
+	  ((spec-bound-p sym)
 	   (emit-insn `(push ,sym))
 	   (increment-stack)
 	   (emit-insn '(%set))
@@ -190,7 +272,9 @@
 	   (emit-insn `(setg ,sym)))))
 
   (define (emit-varref form #!optional in-tail-slot)
-    (cond ((spec-bound-p form)
+    (cond ((binding-tagged-p form 'local-function)
+	   (escape-local-function (lexical-binding form)))
+	  ((spec-bound-p form)
 	   ;; Specially bound
 	   (emit-insn `(push ,form))
 	   (increment-stack)
@@ -27,12 +27,22 @@
 (define-structure rep.vm.compiler.inline
 
     (export compile-lambda-inline
-	    compile-tail-call)
+	    compile-tail-call
+	    sealed-definition
+	    compile-sealed-inline
+	    feedback-guard
+	    feedback-definition
+	    compile-guarded-inline
+	    form-size)
 
     (open rep
+	  rep.structures
+	  rep.data.tables
+	  rep.io.files
 	  rep.vm.compiler.utils
 	  rep.vm.compiler.basic
 	  rep.vm.compiler.modules
+	  rep.vm.compiler.src
 	  rep.vm.compiler.lap
 	  rep.vm.compiler.bindings)
 
@@ -120,14 +130,103 @@
       (decrement-stack)
       (setq args-left (1- args-left))))
 
+  ;; Largest lambda expression (in cons cells) that will be inlined
+  ;; at more than one call site when it doesn't escape
+  (defconst max-local-function-size 48)
+
+  (defun form-size (form)
+    (if (consp form)
+	(+ 1 (form-size (car form)) (form-size (cdr form)))
+      0))
+
+  ;; Return the number of calls to VAR in FORM, or nil if VAR occurs
+  ;; other than as the function of a call
+  (defun count-calls (var form)
+    (catch 'escapes
+      (let loop ((form form))
+	(cond ((eq form var) (throw 'escapes nil))
+	      ((or (atom form) (eq (car form) 'quote)) 0)
+	      (t (let ((count (if (eq (car form) var) 1 0))
+		       (rest (if (eq (car form) var) (cdr form) form)))
+		   (while (consp rest)
+		     (setq count (+ count (loop (car rest))))
+		     (setq rest (cdr rest)))
+		   (+ count (loop rest))))))))
+
+  ;; Return a list of (VAR . LAMBDA) for each required parameter VAR in
+  ;; LAMBDA-LIST whose argument in ARGS is a lambda expression that BODY
+  ;; only ever calls, so that it needn't be made into a closure
+  (defun local-function-args (lambda-list args body)
+    (let ((vars (get-lambda-vars lambda-list))
+	  (out '()))
+      (while (and (consp lambda-list) (consp args)
+		  (not (memq (car lambda-list)
+			     '(#!optional &optional #!rest &rest #!key))))
+	(let ((var (car lambda-list))
+	      (fun (car args))
+	      count)
+	  ;; let wraps each value in a progn
+	  (when (and (eq (car fun) 'progn) (consp (cdr fun)) (null (cddr fun))
+		     (compiler-binding-from-rep-p 'progn))
+	    (setq fun (cadr fun)))
+	  (when (and (symbolp var)
+		     (not (spec-bound-p var))
+		     (constant-function-p fun)
+		     (setq fun (constant-function-value fun))
+		     (eq (car fun) 'lambda)
+		     (not (let loop ((rest vars))
+			    (and rest (or (mentions-p (car rest) fun)
+					  (loop (cdr rest))))))
+		     (setq count (count-calls var body))
+		     (or (= count 1)
+			 (and (> count 1)
+			      (<= (form-size fun) max-local-function-size))))
+	    (setq out (cons (cons var fun) out))))
+	(setq lambda-list (cdr lambda-list))
+	(setq args (cdr args)))
+      (nreverse out)))
+
   ;; This compiles an inline lambda, i.e. FUN is something like
   ;; (lambda (LAMBDA-LIST...) BODY...)
   ;; If PUSHED-ARGS-ALREADY is true it should be a count of the number
   ;; of arguments pushed onto the stack (in reverse order). In this case,
   ;; ARGS is ignored
+  ;; Parameters bound to lambda expressions that don't escape from the
+  ;; body aren't bound at all, their calls are inlined instead
   (defun compile-lambda-inline (fun args #!optional pushed-args-already
 				return-follows name)
     (setq fun (compiler-macroexpand fun))
+    (let ((funs (and (not pushed-args-already)
+		     (local-function-args (nth 1 fun) args (nthcdr 2 fun))))
+	  (depth (fluid inline-depth)))
+      (if (null funs)
+	  (compile-lambda-inline-1 fun args pushed-args-already
+				   return-follows name)
+	(call-with-local-functions
+	 funs
+	 (lambda ()
+	   (let loop ((rest-vars (nth 1 fun))
+		      (rest-args args)
+		      (vars '())
+		      (vals '()))
+	     (cond ((and (consp rest-vars) (assq (car rest-vars) funs)
+			 (consp rest-args))
+		    (loop (cdr rest-vars) (cdr rest-args) vars vals))
+		   ((and (consp rest-vars) (consp rest-args))
+		    (loop (cdr rest-vars) (cdr rest-args)
+			  (cons (car rest-vars) vars)
+			  (cons (car rest-args) vals)))
+		   (t (compile-lambda-inline-1
+		       (list* 'lambda (nconc (nreverse vars) rest-vars)
+			      (nthcdr 2 fun))
+		       (nconc (nreverse vals) rest-args)
+		       nil return-follows name)))))
+	 (lambda ()
+	   (fluid-set inline-depth depth)
+	   (compile-lambda-inline-1 fun args nil return-follows name))))))
+
+  (defun compile-lambda-inline-1 (fun args pushed-args-already
+				  return-follows name)
     (when (>= (fluid-set inline-depth (1+ (fluid inline-depth)))
 	      max-inline-depth)
       (fluid-set inline-depth 0)
@@ -181,6 +280,197 @@
 	      (compile-body body return-follows))))))
       (fluid-set inline-depth (1- (fluid inline-depth)))))
 
+;;; functions from sealed modules
+
+  ;; Call FUN on each symbol in the expression FORM that isn't quoted
+  (defun walk-free-symbols (fun form)
+    (cond ((symbolp form) (fun form))
+	  ((or (atom form) (eq (car form) 'quote)))
+	  (t (mapc (lambda (x) (walk-free-symbols fun x)) form))))
+
+  ;; If FUN is bound to a function from a sealed module that recorded
+  ;; its definition, and it may be inlined here with NARGS arguments,
+  ;; return the recorded lambda expression
+  (defun sealed-definition (fun nargs)
+    (when (and (symbolp fun)
+	       (compiler-binding-immutable-p fun))
+      (let* ((value (compiler-symbol-value fun))
+	     (struct (and (closurep value) (closure-structure value)))
+	     (def (and struct (structure-name struct)
+		       (get fun (intern
+				 (concat "compiler-inline#"
+					 (symbol-name
+					  (structure-name struct))))))))
+	(when (and def (= (length (nth 1 def)) nargs))
+	  (catch 'out
+	    ;; parameters must bind lexically, and everything else in
+	    ;; the body must still refer to the rep functions
+	    (walk-free-symbols
+	     (lambda (var)
+	       (unless (if (memq var (nth 1 def))
+			   (not (special-variable-p var))
+			 (or (memq var '(nil t))
+			     (keywordp var)
+			     (compiler-binding-from-rep-p var)))
+		 (throw 'out nil)))
+	     (nthcdr 2 def))
+	    def)))))
+
+  (defun substitute-constants (alist form)
+    (cond ((symbolp form)
+	   (let ((cell (assq form alist)))
+	     (if cell (cdr cell) form)))
+	  ((or (atom form) (eq (car form) 'quote)) form)
+	  (t (mapcar (lambda (x) (substitute-constants alist x)) form))))
+
+  ;; Compile a call to the function from a sealed module whose
+  ;; definition is DEF with arguments ARGS. Constant arguments are
+  ;; substituted into the body, so that compiling it can fold what
+  ;; depends on them; the others are bound as by an inline lambda
+  (defun compile-sealed-inline (def args #!optional return-follows name)
+    (let loop ((params (nth 1 def))
+	       (args args)
+	       (alist '())
+	       (vars '())
+	       (vals '()))
+      (cond ((consp params)
+	     (if (compiler-constant-p (car args))
+		 (loop (cdr params) (cdr args)
+		       (cons (cons (car params)
+				   (quote-constant
+				    (compiler-constant-value (car args))))
+			     alist)
+		       vars vals)
+	       (loop (cdr params) (cdr args) alist
+		     (cons (car params) vars) (cons (car args) vals))))
+	    (vars
+	     (compile-lambda-inline
+	      (list 'lambda (nreverse vars)
+		    (substitute-constants alist (nth 2 def)))
+	      (nreverse vals) nil return-follows name))
+	    (t (compile-form-1 (substitute-constants alist (nth 2 def))
+			       #:return-follows return-follows)))))
+
+;;; guarded inlining from type feedback
+
+  (define feedback-file nil)		;file the tables were read from
+  (define feedback-calls nil)		;(MODULE . NAME) -> ((CALLEE . COUNT)...)
+  (define feedback-callees nil)		;(MODULE . CALLEE) -> t
+
+  ;; Fewest calls from one function to another in the type feedback
+  ;; that make inlining the callee worthwhile
+  (defconst min-feedback-calls 100)
+
+  ;; functions whose inline definitions are being compiled
+  (define feedback-inlined (make-fluid '()))
+
+  ;; Read the file written by save-type-feedback named by
+  ;; *compiler-type-feedback*, keeping only the calls that each
+  ;; function made to functions in its own module, at call sites that
+  ;; never saw any other function
+  (define (read-type-feedback)
+    (unless (equal feedback-file *compiler-type-feedback*)
+      (setq feedback-file *compiler-type-feedback*)
+      (setq feedback-calls (make-table equal-hash equal))
+      (setq feedback-callees (make-table equal-hash equal))
+      (when feedback-file
+	(let ((stream (open-file feedback-file 'read)))
+	  (unwind-protect
+	      (condition-case nil
+		  (while t
+		    (let* ((form (read stream))
+			   (module (car form))
+			   (calls '()))
+		      (mapc (lambda (site)
+			      (let ((callee (nth 4 site)))
+				(when (and (eq (nth 1 site) 'call)
+					   (consp callee)
+					   (eq (car callee) module))
+				  (let ((cell (assq (cdr callee) calls)))
+				    (if cell
+					(rplacd cell (+ (cdr cell) (nth 2 site)))
+				      (setq calls (cons (cons (cdr callee)
+							      (nth 2 site))
+							calls)))))))
+			    (nthcdr 2 form))
+		      (table-set feedback-calls (cons module (nth 1 form)) calls)
+		      (mapc (lambda (cell)
+			      (when (>= (cdr cell) min-feedback-calls)
+				(table-set feedback-callees
+					   (cons module (car cell)) t)))
+			    calls)))
+		(end-of-stream))
+	    (close-file stream))))))
+
+  ;; If the type feedback shows that the function NAME in the current
+  ;; module is called often enough to be inlined, return the symbol
+  ;; whose binding the inlined calls compare with NAME's value
+  (defun feedback-guard (name)
+    (when (and *compiler-type-feedback*
+	       (fluid current-module)
+	       (symbolp (fluid current-module)))
+      (read-type-feedback)
+      (and (table-ref feedback-callees (cons (fluid current-module) name))
+	   (intern (concat (symbol-name name) "#guard")))))
+
+  ;; the name of the innermost function being compiled that isn't
+  ;; being inlined
+  (define (feedback-caller)
+    (let loop ((rest (fluid lambda-stack)))
+      (cond ((null rest) nil)
+	    ((lambda-inlined (car rest)) (loop (cdr rest)))
+	    ((stringp (lambda-name (car rest)))
+	     (intern (lambda-name (car rest))))
+	    (t (lambda-name (car rest))))))
+
+  ;; If the type feedback shows that the function being compiled calls
+  ;; FUN, a small function defined in the current module, often enough
+  ;; that it's worth inlining the call with NARGS arguments, return
+  ;; FUN's definition
+  (defun feedback-definition (fun nargs)
+    (let ((guard (and (symbolp fun)
+		      (not (memq fun (fluid feedback-inlined)))
+		      (not (has-local-binding-p fun))
+		      (feedback-guard fun)))
+	  caller count def)
+      (when (and guard
+		 (memq guard (fluid defines))
+		 (setq caller (feedback-caller))
+		 (setq count (cdr (assq fun (table-ref
+					     feedback-calls
+					     (cons (fluid current-module)
+						   caller)))))
+		 (>= count min-feedback-calls)
+		 (setq def (cdr (assq fun (fluid sealed-candidates))))
+		 (= (length (nth 1 def)) nargs))
+	(catch 'out
+	  ;; the body's free variables mustn't be shadowed here
+	  (walk-free-symbols
+	   (lambda (var)
+	     (when (if (memq var (nth 1 def))
+		       (special-variable-p var)
+		     (has-local-binding-p var))
+	       (throw 'out nil)))
+	   (nthcdr 2 def))
+	  def))))
+
+  ;; Compile a call to FUN, with definition DEF (see feedback-definition)
+  ;; and arguments ARGS, to inline DEF as long as FUN still has the value
+  ;; it had when the module was loaded, or else call it
+  (defun compile-guarded-inline (def fun args #!optional return-follows)
+    (let ((next-label (make-label))
+	  (end-label (make-label)))
+      (compile-form-1 (list 'eq fun (feedback-guard fun)))
+      (decrement-stack)
+      (emit-insn `(jn ,next-label))
+      (let-fluids ((feedback-inlined (cons fun (fluid feedback-inlined))))
+	(compile-sealed-inline def args return-follows fun)
+	(decrement-stack)
+	(emit-insn `(jmp ,end-label))
+	(fix-label next-label)
+	(compile-form-1 (cons fun args) #:return-follows return-follows))
+      (fix-label end-label)))
+
   (define (pop-between top bottom)
     (or (and (>= top bottom) (>= bottom 0))
 	(break)
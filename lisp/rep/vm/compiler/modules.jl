@@ -34,6 +34,7 @@
 	    compiler-boundp
 	    compiler-binding-from-rep-p
 	    compiler-binding-immutable-p
+	    compiler-binding-constant-p
 	    get-procedure-handler
 	    get-language-property
 	    compiler-macroexpand
@@ -47,10 +48,12 @@
 	    compile-top-level-define-structure
 	    compile-structure-ref
 	    compile-function
-	    compile-module)
+	    compile-module
+	    structure-dependencies)
 
     (open rep
 	  rep.structures
+	  rep.data.tables
 	  rep.vm.compiler.basic
 	  rep.vm.compiler.bindings
 	  rep.vm.compiler.utils
@@ -170,6 +173,13 @@
 	   (and struct (binding-immutable-p (variable-stem var)
 					    (find-structure struct))))))
 
+  ;; return t if the binding of VAR is immutable and its value may be
+  ;; compiled in as a constant. Functions from sealed modules are
+  ;; immutable, but a closure can't be written to the output file
+  (defun compiler-binding-constant-p (var)
+    (and (compiler-binding-immutable-p var)
+	 (not (closurep (compiler-symbol-value var)))))
+
   (defun get-language-property (prop)
     (and (fluid current-language) (get (fluid current-language) prop)))
 
@@ -182,21 +192,38 @@
 	    (get (variable-stem name) prop)
 	  prop))))
 
+  ;; FORM -> (EXPANDER MACRO-ENV . EXPANSION) for each expansion made
+  ;; by compiler-macroexpand-1, which is called several times for most
+  ;; forms. Only used while the macro and local macros are unchanged
+  (define expansion-cache (make-weak-table eq-hash eq))
+
   (defun compiler-macroexpand-1 (form)
     (when (and (consp form)
 	       (symbolp (car form))
 	       (not (has-local-binding-p (car form))))
       (let* ((def (assq (car form) (fluid macro-env)))
-	     ;; make #<subr macroexpand> pass us any inner expansions
-	     (macro-environment compiler-macroexpand-1))
-	(if def
-	    (setq form (apply (cdr def) (cdr form)))
-	  (setq def (compiler-symbol-value (car form)))
-	  (when (and (eq (car def) 'macro) (functionp (cdr def)))
-	    (when (and (closurep (cdr def))
-		       (eq (car (closure-function (cdr def))) 'autoload))
-	      (setq def (load-autoload (cdr def))))
-	    (setq form (apply (cdr def) (cdr form)))))))
+	     (expander
+	      (if def
+		  (cdr def)
+		(setq def (compiler-symbol-value (car form)))
+		(when (and (eq (car def) 'macro) (functionp (cdr def)))
+		  (when (and (closurep (cdr def))
+			     (eq (car (closure-function (cdr def))) 'autoload))
+		    (setq def (load-autoload (cdr def))))
+		  (cdr def)))))
+	(when expander
+	  (let ((cached (table-ref expansion-cache form)))
+	    (if (and cached (eq (car cached) expander)
+		     (eq (cadr cached) (fluid macro-env)))
+		(setq form (cddr cached))
+	      (let ((out (let
+			     ;; make #<subr macroexpand> pass us any inner
+			     ;; expansions
+			     ((macro-environment compiler-macroexpand-1))
+			   (apply expander (cdr form)))))
+		(table-set expansion-cache form
+			   (list* expander (fluid macro-env) out))
+		(setq form out)))))))
     form)
 
   (defun compiler-macroexpand (form #!optional pred)
@@ -222,6 +249,8 @@
 				     accessed))
 		 (const-env nil)
 		 (inline-env nil)
+		 (sealed-module nil)
+		 (sealed-candidates nil)
 		 (defuns nil)
 		 (defvars (fluid defvars))
 		 (defines nil)
@@ -397,6 +426,28 @@
 	     (decrement-stack (if name 4 3))))
 	 opened accessed))))
 
+  ;; Return the names of the modules that the top-level FORM needs
+  ;; loading before it can be compiled: those opened or accessed by a
+  ;; structure definition, or required
+  (defun structure-dependencies (form)
+    (case (car form)
+      ((define-structure structure)
+       (let ((config (nth (if (eq (car form) 'structure) 2 3) form))
+	     (out '()))
+	 (unless (listp (car config))
+	   (setq config (list config)))
+	 (mapc (lambda (clause)
+		 (when (memq (car clause) '(open access))
+		   (setq out (append (reverse (cdr clause)) out))))
+	       config)
+	 (nreverse out)))
+      ((require)
+       (let ((feature (cadr form)))
+	 (and (consp feature) (eq (car feature) 'quote)
+	      (symbolp (cadr feature))
+	      (list (cadr feature)))))
+      (t '())))
+
   (defun compile-structure-ref (form)
     (let
 	((struct (nth 1 form))
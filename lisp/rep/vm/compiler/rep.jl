@@ -68,7 +68,8 @@
 
 ;;; pass 1 support
 
-  (defun pass-1 (forms) (add-progns (pass-1* forms)))
+  (defun pass-1 (forms)
+    (add-progns (nconc (pass-1* forms) (sealed-definitions))))
 
   (defun pass-1* (forms) (lift-progns (mapcar do-pass-1 forms)))
 
@@ -109,7 +110,9 @@
       (case (car form)
 	((defun)
 	 (remember-function (nth 1 form) (nth 2 form) (nthcdr 3 form))
-	 (let* ((body (cdddr form))
+	 (note-sealable-function (nth 1 form) (cons 'lambda (nthcdr 2 form)))
+	 (let* ((name (nth 1 form))
+		(body (cdddr form))
 		(doc (car body))
 		prop-name)
 	   (when (and (not *compiler-write-docs*)
@@ -120,7 +123,8 @@
 			    (symbol-name (fluid current-module)))))
 	     (setq form
 		   `(progn (put ',(cadr form) ',prop-name ,doc)
-			   ,form)))))
+			   ,form)))
+	   (setq form (add-feedback-guard name form))))
 
 	((defmacro)
 	 (remember-function (nth 1 form) (nth 2 form))
@@ -139,7 +143,16 @@
 	 (fluid-set const-env (cons (cons (nth 1 form) (nth 2 form))
 				    (fluid const-env))))
 
-	((%define) (remember-lexical-variable (nth 1 form)))
+	((%define)
+	 (remember-lexical-variable (nth 1 form))
+	 (let ((value (nth 2 form)))
+	   ;; (define (NAME ARGS...) ...) gives (make-closure 'LAMBDA ...)
+	   (when (and (eq (car value) 'make-closure)
+		      (eq (car (nth 1 value)) 'quote))
+	     (setq value (cadr (nth 1 value))))
+	   (when (eq (car value) 'lambda)
+	     (note-sealable-function (nth 1 form) value)
+	     (setq form (add-feedback-guard (nth 1 form) form)))))
 
 	((require)
 	 (if (compiler-constant-p (cadr form))
@@ -165,6 +178,113 @@
 
       form))
 
+;;; sealed modules
+
+  ;; Functions that the inlinable functions of a sealed module may
+  ;; call, as well as the constant-functions
+  (define sealable-functions
+    '(quote cond if when unless and or eq eql symbolp keywordp cons list))
+
+  ;; Largest body (in cons cells) worth inlining
+  (defconst max-sealable-size 32)
+
+  ;; Note that NAME is defined at top-level as the lambda expression FUN.
+  ;; If its body is a single small expression, it may be inlined by
+  ;; the importers of a sealed module (see sealed-definitions)
+  (defun note-sealable-function (name fun)
+    (let ((args (nth 1 fun))
+	  (body (nthcdr 2 fun))
+	  (cell (assq name (fluid sealed-candidates))))
+      (when (and (stringp (car body)) (cdr body))
+	(setq body (cdr body)))
+      (if cell
+	  ;; defined more than once, leave it alone
+	  (rplacd cell nil)
+	(fluid-set sealed-candidates
+		   (cons (cons name
+			       (and (listp args)
+				    (null (cdr body))
+				    (<= (form-size body) max-sealable-size)
+				    (let loop ((rest args))
+				      (or (null rest)
+					  (and (consp rest)
+					       (symbolp (car rest))
+					       (not (memq (car rest)
+							  '(&optional &rest
+							    #!optional
+							    #!rest #!key)))
+					       (loop (cdr rest)))))
+				    (list 'lambda args (car body))))
+			 (fluid sealed-candidates))))))
+
+  ;; return t if NAME is the rep function of that name and has no
+  ;; side-effects
+  (defun sealable-function-p (name params)
+    (and (symbolp name)
+	 (not (memq name params))
+	 (not (assq name (fluid defuns)))
+	 (not (memq name (fluid defines)))
+	 (eq (locate-variable name) 'rep)
+	 (or (memq name constant-functions)
+	     (memq name sealable-functions))))
+
+  ;; return t if FORM only refers to the variables PARAMS and calls
+  ;; sealable functions
+  (defun sealable-form-p (form params)
+    (cond ((symbolp form)
+	   (or (memq form params) (memq form '(nil t)) (keywordp form)))
+	  ((atom form) t)
+	  ((not (sealable-function-p (car form) params)) nil)
+	  ((eq (car form) 'quote) t)
+	  ((eq (car form) 'cond)
+	   (let loop ((rest (cdr form)))
+	     (or (null rest)
+		 (and (consp rest)
+		      (consp (car rest))
+		      (sealable-body-p (car rest) params)
+		      (loop (cdr rest))))))
+	  (t (sealable-body-p (cdr form) params))))
+
+  (defun sealable-body-p (forms params)
+    (let loop ((rest forms))
+      (or (null rest)
+	  (and (consp rest)
+	       (sealable-form-p (car rest) params)
+	       (loop (cdr rest))))))
+
+  ;; After (declare (sealed)), return the forms to append to the module
+  ;; body that record the definitions of its inlinable functions in
+  ;; the compiler-inline#MODULE property of their names, and make their
+  ;; bindings immutable so they can't be redefined behind the back of
+  ;; code that inlined them
+  (defun sealed-definitions ()
+    (when (and (fluid sealed-module) (symbolp (fluid current-module)))
+      (let ((prop (intern (concat "compiler-inline#"
+				  (symbol-name (fluid current-module)))))
+	    (out '()))
+	(mapc (lambda (cell)
+		(let ((name (car cell))
+		      (fun (cdr cell)))
+		  (when (and fun (sealable-form-p (nth 2 fun) (nth 1 fun)))
+		    (setq out (list* `(put ',name ',prop ',fun)
+				     `(%make-binding-immutable ',name)
+				     out)))))
+	      (fluid sealed-candidates))
+	out)))
+
+;;; type feedback
+
+  ;; If calls to NAME may be inlined by feedback-definition, follow
+  ;; its definition FORM by that of the binding the inlined calls
+  ;; compare NAME with, so they notice if it's redefined
+  (defun add-feedback-guard (name form)
+    (let ((guard (feedback-guard name)))
+      (if (not guard)
+	  form
+	(remember-lexical-variable guard)
+	`(progn ,@(if (eq (car form) 'progn) (cdr form) (list form))
+		(%define ,guard ,name)))))
+
 ;;; pass 2 support
 
   (defun pass-2 (forms)
@@ -381,6 +501,68 @@
 	(decrement-stack))))
   (put 'mapc 'rep-compile-fun compile-mapc)
 
+  ;; Likewise for mapcar, consing the results onto a list kept on the
+  ;; stack under the list being scanned. If the argument isn't a list
+  ;; the real mapcar is called instead, so that it signals the error
+  (defun compile-mapcar (form)
+    (let
+	((fun (nth 1 form))
+	 (lst (nth 2 form)))
+      (if (constant-function-p fun)
+	  (let
+	      ((top-label (make-label))
+	       (test-label (make-label))
+	       (call-label (make-label))
+	       (end-label (make-label)))
+	    (compile-constant '())
+	    (compile-form-1 lst)
+	    (emit-insn '(dup))
+	    (increment-stack)
+	    (emit-insn '(listp))
+	    (emit-insn `(jn ,call-label))
+	    (decrement-stack)
+	    (emit-insn `(jmp ,test-label))
+	    (fix-label top-label)
+	    (emit-insn '(dup))
+	    (increment-stack)
+	    (emit-insn '(car))
+	    (compile-lambda-inline (constant-function-value fun) nil 1)
+	    ;; RESULTS LIST VALUE -> VALUE RESULTS (cdr LIST)
+	    (emit-insn '(swap2))
+	    (emit-insn '(cdr))
+	    ;; -> (cdr LIST) (cons VALUE RESULTS)
+	    (emit-insn '(swap2))
+	    (emit-insn '(cons))
+	    (decrement-stack)
+	    (emit-insn '(swap))
+	    ;; like mapcar, stop at the first tail that isn't a cons
+	    (fix-label test-label)
+	    (emit-insn '(dup))
+	    (increment-stack)
+	    (emit-insn '(consp))
+	    (emit-insn `(jt ,top-label))
+	    (decrement-stack)
+	    (emit-insn '(pop))
+	    (decrement-stack)
+	    (emit-insn '(nreverse))
+	    (emit-insn `(jmp ,end-label))
+	    ;; RESULTS LIST -> (mapcar FUN LIST)
+	    (fix-label call-label)
+	    (increment-stack)
+	    (compile-form-1 fun)
+	    (emit-insn '(swap))
+	    (emit-insn '(mapcar))
+	    (decrement-stack)
+	    (emit-insn '(swap))
+	    (emit-insn '(pop))
+	    (decrement-stack)
+	    (fix-label end-label))
+	(compile-form-1 fun)
+	(compile-form-1 lst)
+	(emit-insn '(mapcar))
+	(decrement-stack))))
+  (put 'mapcar 'rep-compile-fun compile-mapcar)
+
   (defun compile-progn (form #!optional return-follows)
     (compile-body (cdr form) return-follows))
   (put 'progn 'rep-compile-fun compile-progn)
@@ -1028,6 +1210,19 @@
     (emit-insn (list (get-form-opcode (car form))))
     (decrement-stack 2))
 
+  ;; Instruction taking 4 args on the stack
+  (defun compile-4-args (form)
+    (when (nthcdr 5 form)
+      (compiler-warning
+       'parameters "More than four parameters to `%s'; rest ignored"
+       (car form)))
+    (compile-form-1 (nth 1 form))
+    (compile-form-1 (nth 2 form))
+    (compile-form-1 (nth 3 form))
+    (compile-form-1 (nth 4 form))
+    (emit-insn (list (get-form-opcode (car form))))
+    (decrement-stack 3))
+
   ;; Compile a form `(OP ARG1 ARG2 ARG3 ...)' into as many two argument
   ;; instructions as needed (PUSH ARG1; PUSH ARG2; OP; PUSH ARG3; OP; ...)
   (defun compile-binary-op (form)
@@ -1093,6 +1288,12 @@
     (put 'aset 'rep-compile-opcode 'aset)
     (put 'aref 'rep-compile-fun compile-2-args)
     (put 'aref 'rep-compile-opcode 'aref)
+    (put '%record-ref 'rep-compile-fun compile-3-args)
+    (put '%record-ref 'rep-compile-opcode 'record-ref)
+    (put '%record-set 'rep-compile-fun compile-4-args)
+    (put '%record-set 'rep-compile-opcode 'record-set)
+    (put '%record-p 'rep-compile-fun compile-2-args)
+    (put '%record-p 'rep-compile-opcode 'record-p)
     (put 'length 'rep-compile-fun compile-1-args)
     (put 'length 'rep-compile-opcode 'length)
     (put '+ 'rep-compile-fun compile-binary-op)
@@ -1179,8 +1380,6 @@
     (put 'rassq 'rep-compile-opcode 'rassq)
     (put 'last 'rep-compile-fun compile-1-args)
     (put 'last 'rep-compile-opcode 'last)
-    (put 'mapcar 'rep-compile-fun compile-2-args)
-    (put 'mapcar 'rep-compile-opcode 'mapcar)
     (put 'member 'rep-compile-fun compile-2-args)
     (put 'member 'rep-compile-opcode 'member)
     (put 'memq 'rep-compile-fun compile-2-args)
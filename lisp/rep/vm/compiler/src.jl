@@ -28,6 +28,7 @@
 
     (export coalesce-constants
 	    mash-constants
+	    quote-constant
 	    source-code-transform)
 
     (open rep
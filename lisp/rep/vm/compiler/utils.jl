@@ -29,6 +29,7 @@
     (export current-stack max-stack
 	    current-b-stack max-b-stack
 	    const-env inline-env
+	    sealed-module sealed-candidates
 	    defuns defvars defines
 	    output-stream
 	    silence-compiler
@@ -66,6 +67,8 @@
 
   (define const-env (make-fluid '()))		;alist of (NAME . CONST-DEF)
   (define inline-env (make-fluid '()))		;alist of (NAME . FUN-VALUE)
+  (define sealed-module (make-fluid nil))	;t after (declare (sealed))
+  (define sealed-candidates (make-fluid '()))	;alist of (NAME . LAMBDA)
   (define defuns (make-fluid '()))		;alist of (NAME REQ OPT RESTP)
 					; for all functions/macros in the file
   (define defvars (make-fluid '()))		;all vars declared at top-level
@@ -339,7 +342,7 @@
    ((symbolp form)
     (or (keywordp form)
 	(assq form (fluid const-env))
-	(compiler-binding-immutable-p form)))
+	(compiler-binding-constant-p form)))
    ;; Assume self-evaluating
    (t t)))
 
@@ -351,7 +354,7 @@
     (nth 1 form))
    ((symbolp form)
     (cond ((keywordp form) form)
-	  ((compiler-binding-immutable-p form)
+	  ((compiler-binding-constant-p form)
 	   (compiler-symbol-value form))
 	  (t (cdr (assq form (fluid const-env))))))
    (t form)))
@@ -390,4 +393,13 @@
 
 (put 'inline 'compiler-decl-fun declare-inline)
 
+;; (declare (sealed)) -- the module's small pure functions may be
+;; inlined by the modules that import them, so they can't be redefined
+
+(defun declare-sealed (form)
+  (declare (unused form))
+  (fluid-set sealed-module t))
+
+(put 'sealed 'compiler-decl-fun declare-sealed)
+
 )
@@ -77,7 +77,8 @@
      "test-scm" "test-scm-f" "%define" "spec-bind"	; #xc0
      "set" "required-arg" "optional-arg" "rest-arg"
      "not-zero-p" "keyword-arg" "optional-arg*" "keyword-arg*"
-     nil nil nil nil nil nil nil nil	; #xd0
+     "slot-ref-car #%d" "slot-ref-cdr #%d" "dup-slot-set #%d" "eq-jn\t%d"
+     "record-ref" "record-set" "record-p" nil	; #xd0
      nil nil nil nil nil nil nil nil
      nil nil nil nil nil nil nil nil	; #xe0
      nil nil nil nil nil nil nil nil
@@ -132,16 +133,17 @@
 	    (format stream "refg\t[%d] %S" arg (aref consts arg)))
 	   ((= op (bytecode setg))
 	    (format stream "setg\t[%d] %S" arg (aref consts arg)))))
-	 ((> c (bytecode last-before-jmps))
+	 ((or (> c (bytecode last-before-jmps))
+	      (= c (bytecode eq-jn)))
 	  (setq arg (logior (ash (aref code-string (1+ i)) 8)
 			    (aref code-string (+ i 2)))
 		op c
 		i (+ i 2))
 	  (format stream (aref disassembler-opcodes op) arg))
-	 ((= c (bytecode pushi))
+	 ((memq c byte-two-byte-insns)
 	  (setq arg (aref code-string (1+ i)))
 	  (setq i (1+ i))
-	  (when (>= arg 128)
+	  (when (and (= c (bytecode pushi)) (>= arg 128))
 	    (setq arg (- (- 256 arg))))
 	  (format stream (aref disassembler-opcodes c) arg))
 	 ((or (= c (bytecode pushi-pair-neg))
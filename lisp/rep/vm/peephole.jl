@@ -544,5 +544,35 @@
 	    (setq tem (cdr tem)))))
 	(shift))
 
+      ;; finally, replace the sequences executed most often by the
+      ;; equivalent superinstructions. These are unknown to all the
+      ;; passes above
+      (setq point code-string)
+      (refill)
+      (while insn0
+	(cond
+	 ;; slot-ref X; car --> slot-ref-car X
+	 ;; slot-ref X; cdr --> slot-ref-cdr X
+	 ((and (eq (car insn0) 'slot-ref)
+	       (memq (car insn1) '(car cdr))
+	       (< (cadr insn0) 256))
+	  (rplaca insn0 (if (eq (car insn1) 'car) 'slot-ref-car 'slot-ref-cdr))
+	  (del-1))
+
+	 ;; dup; slot-set X --> dup-slot-set X
+	 ((and (eq (car insn0) 'dup)
+	       (eq (car insn1) 'slot-set)
+	       (< (cadr insn1) 256))
+	  (rplaca insn0 'dup-slot-set)
+	  (rplacd insn0 (cdr insn1))
+	  (del-1))
+
+	 ;; eq; jn X --> eq-jn X
+	 ((and (eq (car insn0) 'eq) (eq (car insn1) 'jn))
+	  (rplaca insn0 'eq-jn)
+	  (rplacd insn0 (cdr insn1))
+	  (del-1)))
+	(shift))
+
       ;; drop the extra cons we added
       (cons (cdr code-string) extra-stack))))
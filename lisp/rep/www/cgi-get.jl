@@ -29,18 +29,11 @@
     (open rep
 	  rep.system
 	  rep.regexp
+	  rep.data.codecs
 	  rep.test.framework)
 
   (define-structure-alias cgi-get rep.www.cgi-get)
 
-  (define unquote-plus-map (let ((map (make-string (1+ ?+)))
-				 (i 0))
-			     (while (< i ?+)
-			       (aset map i i)
-			       (setq i (1+ i)))
-			     (aset map ?+ ? )
-			     map))
-
   (defun cgi-get-params (#!optional query-string)
     (unless query-string
       (setq query-string (getenv "QUERY_STRING")))
@@ -60,25 +53,8 @@
 	(setq params (cons (cons name value) params)))
       (nreverse params)))
 
-  (defsubst hexdigit (char)
-    (if (and (>= char ?0) (<= char ?9))
-	(- char ?0)
-      (+ (- (char-upcase char) ?A) 10)))
-
   (defun unquote (string)
-    (let
-	((frags nil)
-	 (point 0))
-      (setq string (translate-string string unquote-plus-map))
-      (while (string-match "%.." string point)
-	(setq frags (cons (substring string point (match-start)) frags))
-	(setq point (match-end))
-	(setq frags (cons (+ (* (hexdigit (aref string (- point 2))) 16)
-			     (hexdigit (aref string (1- point)))) frags)))
-      (if (zerop point)
-	  string
-	(setq frags (cons (substring string point) frags))
-	(apply concat (nreverse frags)))))
+    (url-unquote-string string t))
 
 
 ;; Tests
@@ -95,7 +71,9 @@
     (test (equal (cgi-get-params "foo=%3A%2F%3D")
 		 '((foo . ":/="))))
     (test (equal (cgi-get-params "foo=+bar+")
-		 '((foo . " bar ")))))
+		 '((foo . " bar "))))
+    (test (equal (cgi-get-params "a+b=%2B%2b")
+		 (list (cons (intern "a b") "++")))))
 
   ;;###autoload
   (define-self-test 'rep.www.cgi-get self-test))
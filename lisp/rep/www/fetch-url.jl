@@ -25,25 +25,62 @@
 (define-structure rep.www.fetch-url
 
     (export fetch-url
-	    fetch-url-async)
+	    fetch-url-async
+	    fetch-url-async-status)
 
     (open rep
-	  rep.io.processes)
+	  rep.io.processes
+	  rep.regexp
+	  rep.www.http)
+
+  ;; http: URLs are fetched by rep.www.http, reusing its connections;
+  ;; anything else is passed to wget. `fetch-url-async' always uses
+  ;; wget, since its callback is given the wget process
 
   (defvar *wget-program* "wget"
     "Location of `wget' program.")
 
   (put 'wget 'error-message "Wget Error")
 
+  (define (native-url-p url)
+    (string-looking-at "http://" url 0 t))
+
   (define (fetch-url url dest-stream)
-    (let ((process (make-process dest-stream)))
-      (set-process-error-stream process standard-error)
-      (unless (zerop (call-process process nil *wget-program*
-				   "-nv" "-O" "-" url))
-	(signal 'wget (list url)))))
+    (if (native-url-p url)
+	(let ((status (car (http-get url dest-stream))))
+	  (unless (and (>= status 200) (< status 300))
+	    (signal 'http-error (list url status))))
+      (let ((process (make-process dest-stream)))
+	(set-process-error-stream process standard-error)
+	(unless (zerop (call-process process nil *wget-program*
+				     "-nv" "-O" "-" url))
+	  (signal 'wget (list url))))))
 
   (define (fetch-url-async url dest-stream callback #!optional error-stream)
     (let ((process (make-process dest-stream)))
       (set-process-error-stream process (or error-stream standard-error))
       (set-process-function process callback)
-      (start-process process nil *wget-program* "-nv" "-O" "-" url))))
+      (start-process process *wget-program* "-nv" "-O" "-" url)))
+
+  ;; Like fetch-url-async, but http: URLs are fetched natively, and
+  ;; whatever the scheme CALLBACK is called once, with true if the URL
+  ;; was fetched successfully or false if not
+  (define (fetch-url-async-status url dest-stream callback
+				  #!optional error-stream)
+    (let ((errors (or error-stream standard-error)))
+      (if (native-url-p url)
+	  (http-request url #:stream dest-stream
+			#:callback
+			(lambda (status headers body)
+			  (declare (unused body))
+			  (cond ((not status)
+				 (format errors "%s: %s\n" url (cadr headers)))
+				((not (and (>= status 200) (< status 300)))
+				 (format errors "%s: HTTP status %d\n"
+					 url status)))
+			  (callback (and status (>= status 200) (< status 300)))))
+	(fetch-url-async url dest-stream
+			 (lambda (process)
+			   (unless (process-in-use-p process)
+			     (callback (eql (process-exit-value process) 0))))
+			 errors)))))
@@ -0,0 +1,584 @@
+#| http.jl -- asynchronous HTTP/1.1 client
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA
+|#
+
+;; Commentary:
+
+;; Requests are made over plain TCP sockets, driven by the event loop
+;; through the socket receiver framing (see `set-socket-receiver'), so
+;; any number may be in progress at once. Connections are kept open
+;; after each response when the server allows it, and reused for the
+;; next request to the same host and port; at most
+;; `*http-connections-per-host*' are opened to each, further requests
+;; wait for one of them to become free.
+
+;; Response bodies are written to the request's stream as they
+;; arrive, a piece at a time, whether they're delimited by a length,
+;; sent in chunks, or last until the connection closes.
+
+;; Only `http:' URLs are supported, there's no TLS.
+
+(define-structure rep.www.http
+
+    (export http-request
+	    http-get
+	    http-close-connections)
+
+    (open rep
+	  rep.io.sockets
+	  rep.io.processes
+	  rep.regexp
+	  rep.system
+	  rep.data.tables
+	  rep.data.records
+	  rep.data.queues
+	  rep.test.framework)
+
+  (defvar *http-connections-per-host* 4
+    "Maximum number of connections `http-request' opens to each server.")
+
+  (defvar *http-user-agent* "librep"
+    "Value of the User-Agent header sent with each HTTP request.")
+
+  (put 'http-error 'error-message "HTTP Error")
+
+  ;; Largest number of body bytes passed to the stream at once
+  (define piece-size 65536)
+
+  (define redirect-codes '(301 302 303 307 308))
+
+  (define-record-type :request
+    (make-request method host port path headers body stream callback
+		  redirects)
+    ;; no predicate
+    (method request-method)
+    (host request-host)
+    (port request-port)
+    (path request-path)
+    (headers request-headers)
+    (body request-body)
+    (stream request-stream)
+    (callback request-callback)
+    (redirects request-redirects)
+    ;; the response, once its headers have been read
+    (status request-status request-status-set!)
+    (response-headers request-response-headers
+		      request-response-headers-set!)
+    ;; where the body goes: the request's stream, a string output
+    ;; stream, or false to discard it (for redirects)
+    (sink request-sink request-sink-set!))
+
+  (define-record-type :connection
+    (make-connection host socket)
+    ;; no predicate
+    (host connection-host)
+    (socket connection-socket connection-socket-set!)
+    ;; the function given to `set-socket-receiver'
+    (receiver connection-receiver connection-receiver-set!)
+    (request connection-request connection-request-set!)
+    ;; one of idle, headers, body, chunk-size, chunk-data, chunk-end,
+    ;; trailer or until-close
+    (state connection-state connection-state-set!)
+    ;; bytes of the body or chunk not yet read
+    (remaining connection-remaining connection-remaining-set!)
+    (keep-alive connection-keep-alive connection-keep-alive-set!)
+    ;; true if a request has already been answered on this connection
+    (reused connection-reused connection-reused-set!))
+
+  (define-record-type :host
+    (make-host key idle count waiting)
+    ;; no predicate
+    (key host-key)
+    (idle host-idle host-idle-set!)
+    (count host-count host-count-set!)
+    (waiting host-waiting))
+
+  ;; maps from "HOST:PORT" -> HOST
+  (define hosts (make-table string-hash string=))
+
+  (define (host-for name port)
+    (let ((key (format nil "%s:%d" name port)))
+      (or (table-ref hosts key)
+	  (let ((host (make-host key '() 0 (make-queue))))
+	    (table-set hosts key host)
+	    host))))
+
+;;; URLs
+
+  ;; Return (HOST PORT PATH) for the http URL, or false
+  (define (parse-url url)
+    (when (string-looking-at "http://([^/:?#]+)(:([0-9]+))?([/?][^#]*)?"
+			     url 0 t)
+      (let ((host (expand-last-match "\\1"))
+	    (port (if (match-start 3)
+		      (string->number (expand-last-match "\\3"))
+		    80))
+	    (path (if (match-start 4) (expand-last-match "\\4") "/")))
+	(list host port (if (= (aref path 0) ?/)
+			    path
+			  (concat #\/ path))))))
+
+  ;; Return the URL that LOCATION refers to from REQUEST
+  (define (resolve-location request location)
+    (let ((base (if (= (request-port request) 80)
+		    (concat "http://" (request-host request))
+		  (format nil "http://%s:%d"
+			  (request-host request) (request-port request)))))
+      (cond ((string-looking-at "[a-zA-Z][a-zA-Z0-9+.-]*:" location)
+	     location)
+	    ((string-looking-at "//" location)
+	     (concat "http:" location))
+	    ((string-looking-at "/" location)
+	     (concat base location))
+	    (t
+	     (let ((path (request-path request)))
+	       (concat base
+		       (substring path 0 (1+ (string-index-last path ?/)))
+		       location))))))
+
+  (define (string-index-last string char)
+    (let loop ((i (1- (length string))))
+      (cond ((< i 0) nil)
+	    ((= (aref string i) char) i)
+	    (t (loop (1- i))))))
+
+;;; requests
+
+  (define (http-request url #!key method headers body stream callback
+			(redirects 5))
+    "Start an HTTP request for URL, returning immediately.
+
+METHOD is the request method, a string (by default \"GET\"), HEADERS an
+alist of extra (NAME . VALUE) strings to send, and BODY a string to
+send after them. Redirections are followed, at most REDIRECTS times.
+
+The response body is written to STREAM as it arrives; if STREAM is
+false it's collected in a string. Once the response is complete
+(CALLBACK STATUS HEADERS BODY) is called, STATUS being the response
+code, HEADERS an alist of (NAME . VALUE), with NAMEs in lower case, and
+BODY the string, when STREAM was false. If the request fails CALLBACK
+is called with STATUS false and HEADERS the error, a list (ERROR-SYMBOL
+. DATA)."
+    (let ((parsed (parse-url url)))
+      (if (not parsed)
+	  (fail-request callback (list 'http-error "Unsupported URL" url))
+	(start-request (make-request (or method "GET")
+				     (nth 0 parsed) (nth 1 parsed)
+				     (nth 2 parsed) headers body stream
+				     callback redirects)))))
+
+  (define (http-get url #!optional stream)
+    "Fetch URL, waiting for the response, and return a list (STATUS
+HEADERS BODY) as passed to the callback of `http-request'. The body is
+written to STREAM if it's defined. Signals an error if the request
+fails."
+    (let (result)
+      (http-request url #:stream stream
+		    #:callback (lambda args (setq result args)))
+      (while (not result)
+	(accept-process-output 60))
+      (unless (car result)
+	(signal (car (nth 1 result)) (cdr (nth 1 result))))
+      result))
+
+  (define (fail-request callback error)
+    (when callback
+      (callback nil error nil)))
+
+  ;; Send REQUEST on an idle connection to its host, a new one, or
+  ;; queue it until one is free
+  (define (start-request request)
+    (let ((host (host-for (request-host request) (request-port request))))
+      (cond ((host-idle host)
+	     (let ((conn (car (host-idle host))))
+	       (host-idle-set! host (cdr (host-idle host)))
+	       (send-request conn request)))
+	    ((< (host-count host) *http-connections-per-host*)
+	     (let ((conn (condition-case data
+			     (open-connection host request)
+			   (error
+			    (fail-request (request-callback request) data)
+			    nil))))
+	       (when conn
+		 (send-request conn request))))
+	    (t
+	     (enqueue (host-waiting host) request)))))
+
+  (define (open-connection host request)
+    (let ((conn (make-connection host nil)))
+      (connection-receiver-set!
+       conn (lambda (socket)
+	      (condition-case data
+		  (receive-input conn socket)
+		(http-error
+		 (let ((request (connection-request conn)))
+		   (close-connection conn)
+		   (when request
+		     (fail-request (request-callback request) data)))))))
+      (connection-socket-set!
+       conn (socket-client (request-host request) (request-port request)
+			   nil (lambda (socket)
+				 (declare (unused socket))
+				 (connection-closed conn))))
+      (host-count-set! host (1+ (host-count host)))
+      conn))
+
+  (define (send-request conn request)
+    (let ((socket (connection-socket conn))
+	  (body (request-body request)))
+      (connection-request-set! conn request)
+      (connection-state-set! conn 'headers)
+      (set-socket-receiver socket (connection-receiver conn) "\r\n\r\n")
+      (write socket (format nil "%s %s HTTP/1.1\r\n"
+			    (request-method request) (request-path request)))
+      (write socket (if (= (request-port request) 80)
+			(format nil "Host: %s\r\n" (request-host request))
+		      (format nil "Host: %s:%d\r\n" (request-host request)
+			      (request-port request))))
+      (write socket (format nil "User-Agent: %s\r\n" *http-user-agent*))
+      (mapc (lambda (header)
+	      (write socket (format nil "%s: %s\r\n"
+				    (car header) (cdr header))))
+	    (request-headers request))
+      (when body
+	(write socket (format nil "Content-Length: %d\r\n" (length body))))
+      (write socket "\r\n")
+      (when body
+	(write socket body))))
+
+;;; responses
+
+  ;; Return (STATUS VERSION . HEADERS) from the header block TEXT
+  (define (parse-headers text)
+    (let ((lines (string-split "\r\n" text))
+	  (headers '()))
+      (unless (string-looking-at "HTTP/([0-9.]+) +([0-9]+)" (car lines))
+	(signal 'http-error (list "Bad response" (car lines))))
+      (let ((version (expand-last-match "\\1"))
+	    (status (string->number (expand-last-match "\\2"))))
+	(mapc (lambda (line)
+		(cond ((string-looking-at "([^:]+):[ \t]*(.*[^ \t])?" line)
+		       (setq headers
+			     (cons (cons (string-downcase
+					  (expand-last-match "\\1"))
+					 (or (and (match-start 2)
+						  (expand-last-match "\\2"))
+					     ""))
+				   headers)))
+		      ((and headers (string-looking-at "[ \t]+(.*)" line))
+		       ;; a continuation line
+		       (rplacd (car headers)
+			       (concat (cdar headers) #\space
+				       (expand-last-match "\\1"))))))
+	      (cdr lines))
+	(list* status version (nreverse headers)))))
+
+  (define (header-ref headers name)
+    (cdr (assoc name headers)))
+
+  ;; Called by the socket whenever the next part of the response has
+  ;; arrived
+  (define (receive-input conn socket)
+    (case (connection-state conn)
+      ((headers)
+       (read-headers conn socket))
+
+      ((body chunk-data)
+       (let ((data (socket-read-bytes
+		    socket (min piece-size (connection-remaining conn)))))
+	 (deliver conn data)
+	 (connection-remaining-set!
+	  conn (- (connection-remaining conn) (length data)))
+	 (cond ((> (connection-remaining conn) 0)
+		(set-socket-receiver
+		 socket (connection-receiver conn)
+		 (min piece-size (connection-remaining conn))))
+	       ((eq (connection-state conn) 'body)
+		(finish-response conn))
+	       (t
+		(connection-state-set! conn 'chunk-end)
+		(set-socket-receiver socket (connection-receiver conn) 2)))))
+
+      ((chunk-size)
+       (let ((line (socket-read-until socket "\r\n")))
+	 (unless (string-looking-at "[0-9a-fA-F]+" line)
+	   (signal 'http-error (list "Bad chunk header" line)))
+	 (let ((size (string->number (substring line 0 (match-end)) 16)))
+	   (if (zerop size)
+	       (connection-state-set! conn 'trailer)
+	     (connection-state-set! conn 'chunk-data)
+	     (connection-remaining-set! conn size)
+	     (set-socket-receiver socket (connection-receiver conn)
+				  (min piece-size size))))))
+
+      ((chunk-end)
+       (socket-read-bytes socket 2)
+       (connection-state-set! conn 'chunk-size)
+       (set-socket-receiver socket (connection-receiver conn) "\r\n"))
+
+      ((trailer)
+       (when (string= (socket-read-until socket "\r\n") "\r\n")
+	 (finish-response conn)))
+
+      ((until-close)
+       (deliver conn (socket-read-bytes socket)))
+
+      (t
+       ;; nothing should arrive while idle
+       (socket-read-bytes socket)
+       (close-connection conn))))
+
+  (define (read-headers conn socket)
+    (let* ((request (connection-request conn))
+	   (parsed (parse-headers (socket-read-until socket "\r\n\r\n")))
+	   (status (car parsed))
+	   (headers (cddr parsed))
+	   (connection (string-downcase (or (header-ref headers "connection")
+					    "")))
+	   (length (header-ref headers "content-length")))
+      (unless (< status 200)
+	;; not an interim response
+	(request-status-set! request status)
+	(request-response-headers-set! request headers)
+	(connection-keep-alive-set!
+	 conn (if (string= (cadr parsed) "1.0")
+		  (string-match "keep-alive" connection)
+		(not (string-match "close" connection))))
+	(request-sink-set!
+	 request (cond ((and (memq status redirect-codes)
+			     (header-ref headers "location")
+			     (> (request-redirects request) 0))
+			nil)
+		       ((request-stream request))
+		       (t (make-string-output-stream))))
+	(cond ((or (string= (request-method request) "HEAD")
+		   (= status 204) (= status 304))
+	       (finish-response conn))
+	      ((string-match "chunked" (or (header-ref headers
+						       "transfer-encoding")
+					   "") 0 t)
+	       (connection-state-set! conn 'chunk-size)
+	       (set-socket-receiver socket (connection-receiver conn) "\r\n"))
+	      (length
+	       (let ((n (string->number length)))
+		 (if (or (not n) (zerop n))
+		     (finish-response conn)
+		   (connection-state-set! conn 'body)
+		   (connection-remaining-set! conn n)
+		   (set-socket-receiver socket (connection-receiver conn)
+					(min piece-size n)))))
+	      (t
+	       (connection-keep-alive-set! conn nil)
+	       (connection-state-set! conn 'until-close)
+	       (set-socket-receiver socket (connection-receiver conn) nil))))))
+
+  ;; Pass the string DATA from the body of the current response on
+  (define (deliver conn data)
+    (let ((sink (request-sink (connection-request conn))))
+      (when sink
+	(write sink data))))
+
+  (define (finish-response conn)
+    (let ((request (connection-request conn)))
+      (connection-request-set! conn nil)
+      (connection-state-set! conn 'idle)
+      (if (connection-keep-alive conn)
+	  (release-connection conn)
+	(close-connection conn))
+      (complete-request request)))
+
+  ;; Call the callback of REQUEST, whose response has been read, or
+  ;; follow its redirection
+  (define (complete-request request)
+    (let ((status (request-status request))
+	  (headers (request-response-headers request))
+	  (sink (request-sink request)))
+      (cond ((not sink)
+	     (let* ((url (resolve-location
+			  request (header-ref headers "location")))
+		    (method (if (or (= status 303)
+				    (and (memq status '(301 302))
+					 (string= (request-method request)
+						  "POST")))
+				"GET"
+			      (request-method request))))
+	       (http-request url #:method method
+			     #:headers (request-headers request)
+			     #:body (and (string= method (request-method
+							  request))
+					 (request-body request))
+			     #:stream (request-stream request)
+			     #:callback (request-callback request)
+			     #:redirects (1- (request-redirects request)))))
+	    ((request-callback request)
+	     ((request-callback request)
+	      status headers (and (not (eq sink (request-stream request)))
+				  (get-output-stream-string sink)))))))
+
+;;; connections
+
+  ;; CONN has finished a request, use it for the next waiting request
+  ;; or make it idle
+  (define (release-connection conn)
+    (let ((host (connection-host conn))
+	  (socket (connection-socket conn)))
+      (connection-reused-set! conn t)
+      (set-socket-receiver socket (connection-receiver conn) nil)
+      (if (queue-empty-p (host-waiting host))
+	  (host-idle-set! host (cons conn (host-idle host)))
+	(send-request conn (dequeue (host-waiting host))))))
+
+  (define (close-connection conn)
+    (let ((socket (connection-socket conn)))
+      (when socket
+	(connection-socket-set! conn nil)
+	(close-socket socket)
+	(forget-connection conn))))
+
+  ;; CONN is no longer open, start any requests that were waiting for
+  ;; a connection to its host
+  (define (forget-connection conn)
+    (let ((host (connection-host conn)))
+      (host-idle-set! host (delq conn (host-idle host)))
+      (host-count-set! host (1- (host-count host)))
+      (unless (queue-empty-p (host-waiting host))
+	(start-request (dequeue (host-waiting host))))))
+
+  ;; Called when the server closes the connection
+  (define (connection-closed conn)
+    (when (connection-socket conn)
+      (let ((request (connection-request conn))
+	    (state (connection-state conn)))
+	(connection-socket-set! conn nil)
+	(connection-request-set! conn nil)
+	(forget-connection conn)
+	(cond ((not request))
+	      ((eq state 'until-close)
+	       (complete-request request))
+	      ((and (eq state 'headers) (connection-reused conn))
+	       ;; the server closed an idle connection as it was being
+	       ;; reused, try again on another
+	       (start-request request))
+	      (t
+	       (fail-request (request-callback request)
+			     (list 'http-error "Connection closed"
+				   (request-host request))))))))
+
+  (define (http-close-connections)
+    "Close all idle HTTP connections."
+    (table-walk (lambda (key host)
+		  (declare (unused key))
+		  (mapc close-connection (host-idle host)))
+		hosts))
+
+;; Tests
+
+  ;; Responses of the test server, by request path
+  (define test-responses
+    `(("/plain" . "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello")
+      ("/chunked" . ,(concat "HTTP/1.1 200 OK\r\n"
+			     "Transfer-Encoding: chunked\r\n\r\n"
+			     "5;ext=1\r\nhello\r\n6\r\n world\r\n"
+			     "0\r\nX-Trailer: t\r\n\r\n"))
+      ("/redirect" . ,(concat "HTTP/1.1 302 Found\r\n"
+			      "Location: chunked\r\n"
+			      "Content-Length: 3\r\n\r\nxyz"))
+      ("/missing" . ,(concat "HTTP/1.1 404 Not Found\r\n"
+			     "Content-Length: 4\r\n\r\ngone"))
+      ("/close" . ,(concat "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n"
+			   "until closed"))))
+
+  ;; Start a server on the loopback interface answering each request
+  ;; from `test-responses'. ACCEPTED is a list whose car is incremented
+  ;; as each connection is made
+  (define (start-test-server accepted)
+    (socket-server "127.0.0.1" nil
+		   (lambda (server)
+		     (let ((client (socket-accept server)))
+		       (rplaca accepted (1+ (car accepted)))
+		       (set-socket-receiver client test-server-receiver
+					    "\r\n\r\n")))))
+
+  (define (test-server-receiver socket)
+    (let ((request (socket-read-until socket "\r\n\r\n")))
+      (when (string-looking-at "GET ([^ ]+)" request)
+	(let ((path (expand-last-match "\\1")))
+	  (write socket (cdr (assoc path test-responses)))
+	  (when (string= path "/close")
+	    (close-socket socket))))))
+
+  (define (self-test)
+    (let* ((accepted (list 0))
+	   (server (start-test-server accepted))
+	   (base (format nil "http://127.0.0.1:%d" (socket-port server))))
+      (unwind-protect
+	  (progn
+	    (let ((result (http-get (concat base "/plain"))))
+	      (test (eql (car result) 200))
+	      (test (equal (cdr (assoc "content-length" (nth 1 result))) "5"))
+	      (test (equal (nth 2 result) "hello")))
+
+	    ;; chunked bodies, with an extension and a trailer
+	    (test (equal (nth 2 (http-get (concat base "/chunked")))
+			 "hello world"))
+	    (let ((stream (make-string-output-stream)))
+	      (test (null (nth 2 (http-get (concat base "/chunked") stream))))
+	      (test (equal (get-output-stream-string stream) "hello world")))
+
+	    ;; redirects are followed to a relative location, discarding
+	    ;; the body of the redirect
+	    (let ((result (http-get (concat base "/redirect"))))
+	      (test (eql (car result) 200))
+	      (test (equal (nth 2 result) "hello world")))
+
+	    (let ((result (http-get (concat base "/missing"))))
+	      (test (eql (car result) 404))
+	      (test (equal (nth 2 result) "gone")))
+
+	    ;; each request so far reused the first connection
+	    (test (eql (car accepted) 1))
+
+	    ;; a body ended by the server closing the connection, after
+	    ;; which a new one is needed
+	    (test (equal (nth 2 (http-get (concat base "/close")))
+			 "until closed"))
+	    (test (eql (car (http-get (concat base "/plain"))) 200))
+	    (test (eql (car accepted) 2))
+
+	    ;; several requests at once are all answered
+	    (let ((results '()))
+	      (do ((i 0 (1+ i)))
+		  ((= i 6))
+		(http-request (concat base "/plain")
+			      #:callback (lambda (status headers body)
+					   (declare (unused headers))
+					   (setq results
+						 (cons (cons status body)
+						       results)))))
+	      (while (< (length results) 6)
+		(accept-process-output 60))
+	      (test (equal results (make-list 6 '(200 . "hello"))))
+	      (test (<= (car accepted) (+ 2 *http-connections-per-host*)))))
+	(http-close-connections)
+	(close-socket server))))
+
+  ;;###autoload
+  (define-self-test 'rep.www.http self-test))
@@ -25,8 +25,8 @@
 ;; Background:
 
 ;; Sen Nagata posted code to do the escaping part of this to the rep
-;; mailing list (<20000424174557J.1000@eccosys.com>). I've rewritten it
-;; to use regexps, and added the decoder.
+;; mailing list (<20000424174557J.1000@eccosys.com>). I added the
+;; decoder; both are now done by native code in rep.data.codecs.
 
 (define-structure rep.www.quote-url
 
@@ -34,28 +34,20 @@
 	    unquote-url)
 
     (open rep
-	  rep.regexp
+	  rep.data.codecs
 	  rep.test.framework)
 
-  (defconst url-meta-re "[^a-zA-Z0-9$_.!~*'(),-]"
-    "A regexp matching a single character that is reserved in the URL spec.
-This is taken from draft-fielding-url-syntax-02.txt -- check your local
-internet drafts directory for a copy.")
-       
+  ;; The characters left unquoted are those not reserved in the URL
+  ;; spec, taken from draft-fielding-url-syntax-02.txt -- check your
+  ;; local internet drafts directory for a copy.
+
   (define (quote-url string)
     "Escape URL meta-characters in STRING."
-    (string-replace url-meta-re
-		    (lambda (s)
-		      (string-upcase
-		       (format nil "%%%02x" (aref s (match-start)))))
-		    string))
+    (url-quote-string string))
 
   (define (unquote-url string)
     "Unescape URL meta-characters in STRING."
-    (string-replace "%([0-9A-Fa-f][0-9A-Fa-f])"
-		    (lambda ()
-		      (string->number (expand-last-match "\\1") 16))
-		    string))
+    (url-unquote-string string))
 
 
 ;; Tests
@@ -68,7 +60,9 @@ internet drafts directory for a copy.")
     (test (string= (unquote-url "http%3A%2F%2Fwww.foo.com%2Fbar.html")
 		   "http://www.foo.com/bar.html"))
     (test (string= (unquote-url "http%3A%2F%2Fwww.foo.com%2F~jsh%2F")
-		   "http://www.foo.com/~jsh/")))
+		   "http://www.foo.com/~jsh/"))
+    (test (string= (quote-url (concat "a b" (make-string 1 233))) "a%20b%E9"))
+    (test (string= (unquote-url "100%+%2g%41%") "100%+%2gA%")))
 
   ;;###autoload
   (define-self-test 'rep.www.quote-url self-test))
@@ -41,148 +41,89 @@
 ;; Things like <?xml version="1.0"?> uses the first form: (?xml
 ;; (version . "1.0"))
 
+;; The text is split into tokens by `xml-read-tokens' (in C), which
+;; reads them from the stream a batch at a time. Instead of building
+;; items, `read-xml-events' can pass each tag and piece of text to a
+;; function as it's read, so that documents of any size can be handled
+;; without keeping them in memory
+
 (define-structure rep.xml.reader
 
     (export make-xml-input
-	    read-xml-item)
+	    read-xml-item
+	    read-xml-events)
 
     (open rep
-	  rep.regexp)
-
-  (defconst token-endings (#\space #\newline #\tab #\> #\= #\/))
-  (defconst whitespace-chars (#\space #\newline #\tab #\return))
+	  rep.xml.tokenizer)
 
+  ;; an input is (STREAM . TOKENS-READ-BUT-NOT-USED)
   (define (make-xml-input input)
-    (cons input (read-char input)))
-
-  (define (next stream)
-    (let ((c (read-char (car stream))))
-      (rplacd stream c)
-      c))
-
-  (define-macro (current stream) `(cdr ,stream))
-
-  (define (eat-whitespace stream)
-    (when (memq (current stream) whitespace-chars)
-      (while (memq (next stream) whitespace-chars))))
-
-  (define (read-string-item stream endings)
-    (let loop ((this (current stream))
-	       (chars '()))
-      (if (or (null this) (memq this endings))
-	  (apply concat (nreverse chars))
-	(loop (next stream) (cons this chars)))))
-
-  (define (substitute-entities string)
-    ;; XXX other entities?
-    (string-replace "&(lt|amp|apos|quot|gt|Auml|auml|Uuml|uuml|Ouml|ouml|szlig);"
-		    (lambda ()
-		      (cdr (assoc (expand-last-match "\\1")
-				  '(("lt" . "<")
-				    ("gt" . ">")
-				    ("Auml" . "Ä")
-				    ("auml" . "ä")
-				    ("Uuml" . "Ü")
-				    ("uuml" . "ü")
-				    ("Ouml" . "Ö")
-				    ("ouml" . "ö")
-				    ("szlig" . "ß")
-				    ("amp" . "&")
-				    ("apos" . "'")
-				    ("quot" . "\"")))))
-		    string))
-
-  (define (read-token stream)
-    (eat-whitespace stream)
-    (intern (read-string-item stream token-endings)))
-
-  (define (read-body-data stream)
-    (substitute-entities (read-string-item stream '(#\<))))
-
-  (define (read-quoted-token stream)
-    (cond ((space-char-p (current stream)) "")
-	  ((not (memq (current stream) '(#\" #\')))
-	   (read-string-item stream token-endings))
-	  (t (let ((delim (list (current stream))))
-	       (next stream)
-	       (prog1
-		   (substitute-entities (read-string-item stream delim))
-		 (next stream))))))
-
-  (define (read-param-list stream)
-      (let loop ((params '()))
-	(eat-whitespace stream)
-	(if (memq (current stream) '(#\? #\/ #\>))
-	    (nreverse params)
-	  (let ((name (read-token stream)))
-	    (eat-whitespace stream)
-	    (or (= (current stream) #\=)
-		(error "Expected '=' character: %s" stream))
-	    (next stream)
-	    (eat-whitespace stream)
-	    (let ((data (read-quoted-token stream)))
-	      (loop (cons (cons name data) params)))))))
-
-  (define (read-question-body stream)
-    (let ((name (read-token stream))
-	  (params (read-param-list stream)))
-      (or (= (next stream) #\>)
-	  (error "Expected '>' character: %s" stream))
-      (next stream)
-      (list (intern (concat #\? (symbol-name name))) params)))
-
-  (define (read-exclam-body stream)
-    (let ((data (substitute-entities (read-string-item stream '(#\>)))))
-      (or (= (current stream) #\>)
-	  (error "Expected '>' character: %s" stream))
-      (next stream)
-      (list '! data)))
-
-  (define (read-tag-body stream)
-    (let ((name (read-token stream))
-	  (params (read-param-list stream)))
-      (cond ((= (current stream) #\/)
-	     (or (= (next stream) #\>)
-		 (error "Expected '>' character: %s" stream))
-	     (next stream)
-	     (list name params))
-	    ((/= (current stream) #\>)
-	     (error "Expected '>' character: %s" stream))
-	    (t (next stream)
-	       (let ((items '()))
-		 (let ((ended
-			(catch 'list-ended
-			  (while (current stream)
-			    (setq items (cons (read-xml-item
-					       stream 'list-ended) items))))))
-		   (or (string= ended name)
-		       (error "Unmatched items: %s, %s" name ended)))
-		 (list* name params (nreverse items)))))))
+    (cons input '()))
+
+  ;; Return the next token from STREAM, or false at the end of it
+  (define (next-token stream)
+    (when (null (cdr stream))
+      (rplacd stream (xml-read-tokens (car stream))))
+    (let ((token (cadr stream)))
+      (rplacd stream (cddr stream))
+      token))
+
+  (define (read-element stream name params)
+    (let ((items '())
+	  token)
+      (while (not (and (consp (setq token (next-token stream)))
+		       (eq (car token) 'end)))
+	(or token (error "Unterminated item: %s" name))
+	(setq items (cons (token-item stream token) items)))
+      (or (eq (nth 1 token) name)
+	  (error "Unmatched items: %s, %s" name (nth 1 token)))
+      (list* name params (nreverse items))))
+
+  (define (token-item stream token #!optional catcher)
+    (cond ((or (null token) (stringp token)) token)
+	  ((eq (car token) 'start)
+	   (read-element stream (nth 1 token) (nth 2 token)))
+	  ((eq (car token) 'empty)
+	   (list (nth 1 token) (nth 2 token)))
+	  ((eq (car token) 'end)
+	   (throw catcher (nth 1 token)))
+	  ;; (?NAME PARAMS) and (! STRING) are items already
+	  (t token)))
 
   (define (read-xml-item stream #!optional catcher)
-    (cond
-     ((null (current stream)) nil)
-
-     ((= (current stream) #\<)
-      (case (next stream)
-	((#\/)
-	 (next stream)
-	 (eat-whitespace stream)
-	 (let ((name (read-token stream)))
-	   (eat-whitespace stream)
-	   (or (= (current stream) #\>)
-	       (error "Expected '>' character: %s" stream))
-	   (next stream)
-	   (throw catcher name)))
-
-	((#\?)
-	 (next stream)
-	 (read-question-body stream))
-
-	((#\!)
-	 (next stream)
-	 (read-exclam-body stream))
-
-	(t (read-tag-body stream))))
-
-     (t (read-body-data stream)))))
+    "Read the next item from the XML input STREAM (created by
+`make-xml-input'), returning false at the end of the stream. If a
+closing tag is read, its name is thrown to CATCHER."
+    (token-item stream (next-token stream) catcher))
+
+  (define (read-xml-events stream #!key start-element end-element text other)
+    "Read the rest of the XML input STREAM (created by `make-xml-input'),
+without building items from it. Instead, as each part of it is read,
+one of the optional functions is called: START-ELEMENT with the name
+and parameter alist of each tag opened, END-ELEMENT with the name of
+each tag closed (empty tags are opened then closed), TEXT with each
+string of character data, and OTHER with each `(?NAME PARAMS)' and
+`(! STRING)' item."
+    (let ((open '())
+	  token)
+      (while (setq token (next-token stream))
+	(cond ((stringp token)
+	       (when text
+		 (text token)))
+	      ((memq (car token) '(start empty))
+	       (when start-element
+		 (start-element (nth 1 token) (nth 2 token)))
+	       (if (eq (car token) 'start)
+		   (setq open (cons (nth 1 token) open))
+		 (when end-element
+		   (end-element (nth 1 token)))))
+	      ((eq (car token) 'end)
+	       (or (eq (nth 1 token) (car open))
+		   (error "Unmatched items: %s, %s" (car open) (nth 1 token)))
+	       (setq open (cdr open))
+	       (when end-element
+		 (end-element (nth 1 token))))
+	      (other
+	       (other token))))
+      (when open
+	(error "Unterminated item: %s" (car open))))))
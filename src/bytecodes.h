@@ -25,7 +25,7 @@
 /* Don't forget to update the version number
  * in lisp/rep/vm/bytecode-defs.jl, too. */
 #define BYTECODE_MAJOR_VERSION 11
-#define BYTECODE_MINOR_VERSION 1
+#define BYTECODE_MINOR_VERSION 3
 
 /* Number of bits encoded in each extra opcode forming the argument. */
 #define ARG_SHIFT    8
@@ -271,6 +271,24 @@
 #define OP_KEYWORD_ARG_ 0xcf
 
 
+/* Superinstructions, each doing the work of a frequently executed
+   sequence of the instructions above in a single dispatch. Only the
+   peephole optimizer emits these. */
+
+#define OP_SLOT_REF_CAR 0xd0		/* push (car slot[pc[0]]) */
+#define OP_SLOT_REF_CDR 0xd1		/* push (cdr slot[pc[0]]) */
+#define OP_DUP_SLOT_SET 0xd2		/* slot[pc[0]] = stk[0] */
+#define OP_EQ_JN 0xd3			/* if (not (eq pop[1] pop[2]))
+					   jmp pc[0,1] */
+
+
+/* Record instructions, see records.c */
+
+#define OP_RECORD_REF 0xd4		/* call-3 %record-ref */
+#define OP_RECORD_SET 0xd5		/* call-4 %record-set */
+#define OP_RECORD_P 0xd6		/* push (%record-p pop[1] pop[2]) */
+
+
 /* Jump opcodes */
 
 #define OP_LAST_BEFORE_JMPS 0xf7
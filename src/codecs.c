@@ -0,0 +1,544 @@
+/* codecs.c -- base64 and URL encoding of strings and streams
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.	If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Commentary:
+
+   The kernels here work on blocks of bytes through lookup tables, so
+   each input byte costs a few loads and stores, where the Lisp code
+   they replace read and wrote a character at a time through streams.
+   Whole output lines of base64 are encoded by a loop with no tests
+   other than its bound, which the compiler is free to unroll.
+
+   The encoders keep their state between blocks, so streams of any
+   size are encoded in a fixed amount of memory. The output is the
+   same as that of the Lisp versions: base64 lines of 76 characters
+   each followed by a newline, then a final newline, and characters
+   outside the base64 alphabet (including padding) are ignored when
+   decoding.
+
+   rep.util.base64 and rep.www.quote-url are built on these. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include <string.h>
+
+/* Bytes of input encoded on each line of base64 output */
+#define LINE_BYTES 57
+#define LINE_CHARS 76
+
+/* Size of the blocks that streams are read in, a multiple of
+   LINE_BYTES so that whole lines are encoded from each */
+#define BLOCK_BYTES (LINE_BYTES * 144)
+
+static const char base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Maps each byte to its base64 value, or to -1 when it isn't in the
+   alphabet */
+static signed char base64_values[256];
+
+/* Non-zero for the bytes that needn't be quoted in a URL, as given
+   by draft-fielding-url-syntax-02.txt */
+static char url_safe[256];
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+/* Maps each byte to its value as a hex digit, or to -1 */
+static signed char hex_values[256];
+
+
+/* Base64 */
+
+struct encoder {
+    unsigned char carry[2];		/* bytes left over from the last block */
+    int ncarry;
+    int col;				/* characters on the current line */
+};
+
+struct decoder {
+    unsigned long reg;
+    int bits;
+};
+
+/* An upper bound on the number of characters that encoding LEN bytes
+   (including any carried over) produces */
+#define ENCODED_MAX(len) (((len) + 2) / 3 * 4 + ((len) + 2) / LINE_BYTES + 8)
+
+static inline char *
+encode_group (const unsigned char *in, char *out)
+{
+    unsigned long reg = (in[0] << 16) | (in[1] << 8) | in[2];
+    out[0] = base64_alphabet[reg >> 18];
+    out[1] = base64_alphabet[(reg >> 12) & 077];
+    out[2] = base64_alphabet[(reg >> 6) & 077];
+    out[3] = base64_alphabet[reg & 077];
+    return out + 4;
+}
+
+/* Encode the LEN bytes at IN to OUT, returning the end of the output.
+   Any bytes that don't make a whole group are kept in E for the next
+   call. */
+static char *
+encode_block (struct encoder *e, const unsigned char *in, size_t len, char *out)
+{
+    const unsigned char *end = in + len;
+
+    if (e->ncarry > 0)
+    {
+	unsigned char group[3];
+	memcpy (group, e->carry, e->ncarry);
+	while (e->ncarry < 3 && in < end)
+	    group[e->ncarry++] = *in++;
+	if (e->ncarry < 3)
+	{
+	    memcpy (e->carry, group, e->ncarry);
+	    return out;
+	}
+	out = encode_group (group, out);
+	e->ncarry = 0;
+	e->col += 4;
+	if (e->col >= LINE_CHARS)
+	{
+	    *out++ = '\n';
+	    e->col = 0;
+	}
+    }
+
+    /* finish the current line a group at a time */
+    while (e->col > 0 && end - in >= 3)
+    {
+	out = encode_group (in, out);
+	in += 3;
+	e->col += 4;
+	if (e->col >= LINE_CHARS)
+	{
+	    *out++ = '\n';
+	    e->col = 0;
+	}
+    }
+
+    /* then whole lines */
+    while (end - in >= LINE_BYTES)
+    {
+	const unsigned char *line_end = in + LINE_BYTES;
+	while (in < line_end)
+	{
+	    out = encode_group (in, out);
+	    in += 3;
+	}
+	*out++ = '\n';
+    }
+
+    while (end - in >= 3)
+    {
+	out = encode_group (in, out);
+	in += 3;
+	e->col += 4;
+    }
+
+    e->ncarry = end - in;
+    memcpy (e->carry, in, e->ncarry);
+    return out;
+}
+
+/* Encode the bytes left in E, padding them to a whole group, and end
+   the output with a newline */
+static char *
+encode_finish (struct encoder *e, char *out)
+{
+    if (e->ncarry == 2)
+    {
+	unsigned long reg = (e->carry[0] << 10) | (e->carry[1] << 2);
+	*out++ = base64_alphabet[reg >> 12];
+	*out++ = base64_alphabet[(reg >> 6) & 077];
+	*out++ = base64_alphabet[reg & 077];
+	*out++ = '=';
+    }
+    else if (e->ncarry == 1)
+    {
+	unsigned long reg = e->carry[0] << 4;
+	*out++ = base64_alphabet[reg >> 6];
+	*out++ = base64_alphabet[reg & 077];
+	*out++ = '=';
+	*out++ = '=';
+    }
+    e->ncarry = 0;
+    *out++ = '\n';
+    return out;
+}
+
+/* Decode the LEN characters at IN to OUT, returning the end of the
+   output, which is at most 3 bytes for each 4 characters */
+static unsigned char *
+decode_block (struct decoder *d, const unsigned char *in, size_t len,
+	      unsigned char *out)
+{
+    const unsigned char *end = in + len;
+    unsigned long reg = d->reg;
+    int bits = d->bits;
+
+    while (in < end)
+    {
+	int v;
+
+	/* four characters from the alphabet make three whole bytes */
+	if (bits == 0)
+	{
+	    while (end - in >= 4)
+	    {
+		int a = base64_values[in[0]], b = base64_values[in[1]];
+		int c = base64_values[in[2]], e = base64_values[in[3]];
+		if ((a | b | c | e) < 0)
+		    break;
+		reg = (a << 18) | (b << 12) | (c << 6) | e;
+		out[0] = reg >> 16;
+		out[1] = reg >> 8;
+		out[2] = reg;
+		out += 3;
+		in += 4;
+	    }
+	    reg = 0;
+	    if (in == end)
+		break;
+	}
+
+	v = base64_values[*in++];
+	if (v >= 0)
+	{
+	    reg = (reg << 6) | v;
+	    bits += 6;
+	    if (bits >= 8)
+	    {
+		bits -= 8;
+		*out++ = reg >> bits;
+		reg &= (1UL << bits) - 1;
+	    }
+	}
+    }
+
+    d->reg = reg;
+    d->bits = bits;
+    return out;
+}
+
+DEFUN("base64-encode-string", Fbase64_encode_string,
+      Sbase64_encode_string, (repv string), rep_Subr1) /*
+::doc:rep.data.codecs#base64-encode-string::
+base64-encode-string STRING
+
+Return a string containing the base64 encoding of the bytes of STRING,
+in lines of 76 characters, each ending with a newline.
+::end:: */
+{
+    struct encoder e = { { 0, 0 }, 0, 0 };
+    long len;
+    repv out;
+    char *end;
+
+    rep_DECLARE1 (string, rep_STRINGP);
+    len = rep_STRING_LEN (string);
+    out = rep_make_string (ENCODED_MAX (len) + 1);
+    if (out == rep_NULL)
+	return rep_mem_error ();
+
+    end = encode_block (&e, (unsigned char *) rep_STR (string),
+			len, rep_STR (out));
+    end = encode_finish (&e, end);
+    *end = 0;
+    rep_set_string_len (out, end - rep_STR (out));
+    return out;
+}
+
+DEFUN("base64-decode-string", Fbase64_decode_string,
+      Sbase64_decode_string, (repv string), rep_Subr1) /*
+::doc:rep.data.codecs#base64-decode-string::
+base64-decode-string STRING
+
+Return a string containing the bytes encoded in base64 by STRING.
+Characters of STRING that aren't part of the base64 alphabet are
+ignored.
+::end:: */
+{
+    struct decoder d = { 0, 0 };
+    long len;
+    repv out;
+    unsigned char *end;
+
+    rep_DECLARE1 (string, rep_STRINGP);
+    len = rep_STRING_LEN (string);
+    out = rep_make_string (len / 4 * 3 + 3 + 1);
+    if (out == rep_NULL)
+	return rep_mem_error ();
+
+    end = decode_block (&d, (unsigned char *) rep_STR (string), len,
+			(unsigned char *) rep_STR (out));
+    *end = 0;
+    rep_set_string_len (out, (char *) end - rep_STR (out));
+    return out;
+}
+
+DEFUN("base64-encode-stream", Fbase64_encode_stream,
+      Sbase64_encode_stream, (repv input, repv output), rep_Subr2) /*
+::doc:rep.data.codecs#base64-encode-stream::
+base64-encode-stream INPUT OUTPUT
+
+Read the input stream INPUT until it ends, writing the base64 encoding
+of its contents to the output stream OUTPUT, in lines of 76
+characters, each ending with a newline. Returns the number of bytes
+read.
+::end:: */
+{
+    struct encoder e = { { 0, 0 }, 0, 0 };
+    unsigned char *in = rep_alloc (BLOCK_BYTES);
+    char *out = rep_alloc (ENCODED_MAX (BLOCK_BYTES + 2));
+    long total = 0, len;
+    repv ret = rep_NULL;
+    char *end;
+
+    if (in == 0 || out == 0)
+    {
+	rep_mem_error ();
+	goto out;
+    }
+
+    while ((len = rep_stream_read (input, (char *) in, BLOCK_BYTES)) > 0)
+    {
+	total += len;
+	end = encode_block (&e, in, len, out);
+	if (end > out)
+	{
+	    rep_stream_puts (output, out, end - out, rep_FALSE);
+	    if (rep_throw_value != rep_NULL)
+		goto out;
+	}
+	rep_TEST_INT;
+	if (rep_INTERRUPTP)
+	    goto out;
+    }
+    if (len < 0)
+	goto out;
+
+    end = encode_finish (&e, out);
+    rep_stream_puts (output, out, end - out, rep_FALSE);
+    if (rep_throw_value != rep_NULL)
+	goto out;
+    ret = rep_make_long_int (total);
+
+out:
+    rep_free (in);
+    rep_free (out);
+    return ret;
+}
+
+DEFUN("base64-decode-stream", Fbase64_decode_stream,
+      Sbase64_decode_stream, (repv input, repv output), rep_Subr2) /*
+::doc:rep.data.codecs#base64-decode-stream::
+base64-decode-stream INPUT OUTPUT
+
+Read the base64 encoded input stream INPUT until it ends, writing the
+bytes it encodes to the output stream OUTPUT. Characters that aren't
+part of the base64 alphabet are ignored. Returns the number of bytes
+written.
+::end:: */
+{
+    struct decoder d = { 0, 0 };
+    unsigned char *in = rep_alloc (BLOCK_BYTES);
+    unsigned char *out = rep_alloc (BLOCK_BYTES / 4 * 3 + 3);
+    long total = 0, len;
+    repv ret = rep_NULL;
+    unsigned char *end;
+
+    if (in == 0 || out == 0)
+    {
+	rep_mem_error ();
+	goto out;
+    }
+
+    while ((len = rep_stream_read (input, (char *) in, BLOCK_BYTES)) > 0)
+    {
+	end = decode_block (&d, in, len, out);
+	total += end - out;
+	if (end > out)
+	{
+	    rep_stream_puts (output, out, end - out, rep_FALSE);
+	    if (rep_throw_value != rep_NULL)
+		goto out;
+	}
+	rep_TEST_INT;
+	if (rep_INTERRUPTP)
+	    goto out;
+    }
+    if (len >= 0)
+	ret = rep_make_long_int (total);
+
+out:
+    rep_free (in);
+    rep_free (out);
+    return ret;
+}
+
+
+/* URL quoting */
+
+DEFUN("url-quote-string", Furl_quote_string,
+      Surl_quote_string, (repv string), rep_Subr1) /*
+::doc:rep.data.codecs#url-quote-string::
+url-quote-string STRING
+
+Return a copy of STRING in which each character that is reserved in
+URLs is replaced by `%' followed by its code as two hexadecimal
+digits. The characters left as they are are the letters and digits,
+and `$-_.!~*'(),'.
+::end:: */
+{
+    const unsigned char *in, *end;
+    long len, extra = 0;
+    repv out;
+    char *ptr;
+
+    rep_DECLARE1 (string, rep_STRINGP);
+    len = rep_STRING_LEN (string);
+    in = (unsigned char *) rep_STR (string);
+    end = in + len;
+
+    while (in < end)
+	extra += !url_safe[*in++];
+    out = rep_make_string (len + extra * 2 + 1);
+    if (out == rep_NULL)
+	return rep_mem_error ();
+
+    in = (unsigned char *) rep_STR (string);
+    ptr = rep_STR (out);
+    while (in < end)
+    {
+	unsigned char c = *in++;
+	if (url_safe[c])
+	    *ptr++ = c;
+	else
+	{
+	    ptr[0] = '%';
+	    ptr[1] = hex_digits[c >> 4];
+	    ptr[2] = hex_digits[c & 15];
+	    ptr += 3;
+	}
+    }
+    *ptr = 0;
+    return out;
+}
+
+DEFUN("url-unquote-string", Furl_unquote_string,
+      Surl_unquote_string, (repv string, repv plus), rep_Subr2) /*
+::doc:rep.data.codecs#url-unquote-string::
+url-unquote-string STRING [PLUS-IS-SPACE]
+
+Return a copy of STRING in which each `%' followed by two hexadecimal
+digits is replaced by the character with that code. When PLUS-IS-SPACE
+is true each `+' is replaced by a space, as in HTML form data.
+::end:: */
+{
+    const unsigned char *in, *end;
+    long len;
+    repv out;
+    unsigned char *ptr;
+
+    rep_DECLARE1 (string, rep_STRINGP);
+    len = rep_STRING_LEN (string);
+    out = rep_make_string (len + 1);
+    if (out == rep_NULL)
+	return rep_mem_error ();
+
+    in = (unsigned char *) rep_STR (string);
+    end = in + len;
+    ptr = (unsigned char *) rep_STR (out);
+    while (in < end)
+    {
+	const unsigned char *pct = memchr (in, '%', end - in);
+	const unsigned char *stop = pct != 0 ? pct : end;
+
+	if (plus != Qnil)
+	{
+	    while (in < stop)
+	    {
+		unsigned char c = *in++;
+		*ptr++ = (c == '+') ? ' ' : c;
+	    }
+	}
+	else
+	{
+	    memcpy (ptr, in, stop - in);
+	    ptr += stop - in;
+	    in = stop;
+	}
+
+	if (pct != 0)
+	{
+	    if (end - pct >= 3 && hex_values[pct[1]] >= 0
+		&& hex_values[pct[2]] >= 0)
+	    {
+		*ptr++ = (hex_values[pct[1]] << 4) | hex_values[pct[2]];
+		in = pct + 3;
+	    }
+	    else
+	    {
+		*ptr++ = '%';
+		in = pct + 1;
+	    }
+	}
+    }
+    *ptr = 0;
+    if (rep_STRING_LEN (out) != (char *) ptr - rep_STR (out))
+	rep_set_string_len (out, (char *) ptr - rep_STR (out));
+    return out;
+}
+
+
+/* init */
+
+void
+rep_codecs_init (void)
+{
+    static const char safe[] = "$-_.!~*'(),";
+    repv tem;
+    int i;
+
+    memset (base64_values, -1, sizeof (base64_values));
+    for (i = 0; i < 64; i++)
+	base64_values[(unsigned char) base64_alphabet[i]] = i;
+
+    memset (hex_values, -1, sizeof (hex_values));
+    for (i = 0; i < 16; i++)
+	hex_values[(unsigned char) hex_digits[i]] = i;
+    for (i = 10; i < 16; i++)
+	hex_values['a' + i - 10] = i;
+
+    for (i = 0; i < 256; i++)
+	url_safe[i] = ((i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z')
+		       || (i >= '0' && i <= '9'));
+    for (i = 0; safe[i] != 0; i++)
+	url_safe[(unsigned char) safe[i]] = 1;
+
+    tem = rep_push_structure ("rep.data.codecs");
+    rep_ADD_SUBR (Sbase64_encode_string);
+    rep_ADD_SUBR (Sbase64_decode_string);
+    rep_ADD_SUBR (Sbase64_encode_stream);
+    rep_ADD_SUBR (Sbase64_decode_stream);
+    rep_ADD_SUBR (Surl_quote_string);
+    rep_ADD_SUBR (Surl_unquote_string);
+    rep_pop_structure (tem);
+}
@@ -58,8 +58,12 @@
 
    Continuations are also used to provide a basic threading
    implementation. Threads are local to each enclosing closed barrier
-   (dynamic root). Each barrier has two thread queues, runnable and
-   suspended. Each thread is just a (primitive) continuation, the
+   (dynamic root). Each barrier has a queue of runnable threads for
+   each priority, a list of suspended threads, and a heap of those
+   suspended threads that will wake after a timeout, ordered by when
+   they do. The active thread isn't in any of these, so switching
+   threads never has to search. Each thread is just a (primitive)
+   continuation, the
    lexical environment, and a forbid-preemption count. The dynamic root
    acts as a serialization point, it will only be crossed when the last
    thread has exited or been deleted.
@@ -91,7 +95,21 @@
    been thrown threw (which deletes all running threads)  ]
 
    The lisp debugger runs in it's own dynamic root, so debugging
-   threads works for free!  */
+   threads works for free!
+
+   Where the system allows it (WITH_THREAD_STACKS), each thread made
+   by make-thread instead gets a stack of its own, and switching
+   threads is just a swapcontext () call, however deep either stack
+   is. Their continuations then only record where the thread's lisp
+   histories are on its real stack, and are never invoked. New threads
+   start from the histories saved when their dynamic root was entered.
+   The thread that was running when the first thread was made keeps
+   using the root's own stack (it's the root's `home'), so when the
+   last thread exits on some other stack, control goes back through
+   the home thread to the root.
+
+   Continuations made by call/cc in a thread with its own stack only
+   copy that stack, and can only be invoked by the same thread.  */
 
 #define _GNU_SOURCE
 #undef DEBUG
@@ -115,12 +133,23 @@ char *alloca ();
 #endif
 
 #include "repint.h"
+#include "probes.h"
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <setjmp.h>
 #include <limits.h>
 
+#ifdef WITH_THREAD_STACKS
+# include <ucontext.h>
+# ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+# endif
+# ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+# endif
+#endif
+
 #ifdef NEED_MEMORY_H
 # include <memory.h>
 #endif
@@ -141,6 +170,11 @@ int rep_thread_lock = 0;
 /* True when the current thread should be preempted soon */
 rep_bool rep_pending_thread_yield;
 
+/* Bytes of stack given to each new thread, when they have their own */
+static int thread_stack_size = 4 * 1024 * 1024;
+
+#define MIN_THREAD_STACK 65536
+
 #ifdef WITH_CONTINUATIONS
 
 #if STACK_DIRECTION == 0
@@ -181,6 +215,11 @@ typedef struct rep_thread_struct rep_thread;
    is saved for each continuation. Only the portion more recent than
    the most recent closed barrier is saved. */
 
+/* Threads with higher priorities (up to THREAD_PRIORITIES - 1) always
+   run in preference to those with lower priorities. */
+#define THREAD_PRIORITIES 8
+#define DEFAULT_PRIORITY 4
+
 struct rep_barrier_struct {
     rep_barrier *next;
     rep_barrier *root;		/* upwards closed barrier */
@@ -189,8 +228,30 @@ struct rep_barrier_struct {
     void (*out)(void *data);
     void *data;
     rep_thread *active;
-    rep_thread *head, *tail;
+    /* Runnable threads other than the active one, in a FIFO queue for
+       each priority. Bit N of RUNNABLE is set when queue N isn't empty */
+    struct { rep_thread *head, *tail; } runq[THREAD_PRIORITIES];
+    unsigned int runnable;
     rep_thread *susp_head, *susp_tail;
+    rep_thread **sleepers;		/* heap of suspended with timeouts */
+    int n_sleepers, sleepers_size;
+#ifdef WITH_THREAD_STACKS
+    /* The thread using this barrier's own stack */
+    rep_thread *home;
+    /* For closed barriers, the state as they were entered; threads
+       with their own stacks start from this. When EXITING is set, the
+       home thread longjmp's to EXIT_POINT as soon as it's resumed */
+    struct rep_Call *call_stack;
+    repv special_bindings;
+    rep_GC_root *gc_roots;
+    rep_GC_n_roots *gc_n_roots;
+    struct rep_saved_regexp_data *regexp_data;
+    struct blocked_op *blocked_ops[op_MAX];
+    repv env, structure;
+    int lisp_depth;
+    jmp_buf exit_point;
+    unsigned int exiting : 1;
+#endif
     short depth;
     unsigned int closed : 1;
     unsigned int targeted : 1;		/* may contain continuations */
@@ -226,12 +287,18 @@ struct rep_continuation_struct {
     repv throw_value;
     rep_bool single_step;
     int lisp_depth;
+#ifdef WITH_THREAD_STACKS
+    /* The thread whose own stack this was made on, or null */
+    rep_thread *thread;
+#endif
 };
 
 #define rep_CONTIN(v)	((rep_continuation *)rep_PTR(v))
 #define rep_CONTINP(v)	rep_CELL16_TYPEP(v, continuation_type ())
 
 #define CF_INVALID	(1 << rep_CELL16_TYPE_BITS)
+/* The saved state of a thread with its own stack; nothing is copied */
+#define CF_LIVE		(1 << (rep_CELL16_TYPE_BITS + 1))
 
 #define CONTIN_MAX_SLOP 4096
 
@@ -249,10 +316,22 @@ struct rep_thread_struct {
     rep_continuation *cont;
     repv env, structure;
     int lock;
-    struct timeval run_at;
-    rep_bool (*poll)(rep_thread *t, void *arg);
-    void *poll_arg;
+    int priority;
+    /* When a suspended thread times out (from rep_utime), or zero if it
+       never does, and its position in the sleepers heap, or -1 */
+    rep_long_long run_at;
+    int sleep_index;
+    /* The thread that this one is waiting to exit, and the chain of
+       threads waiting for the same thread */
+    rep_thread *joining, *next_joiner;
+    rep_thread *joiners;
     repv exit_val;
+#ifdef WITH_THREAD_STACKS
+    ucontext_t context;
+    char *stack;			/* its own stack, or null */
+    size_t stack_size;
+    repv thunk;				/* called when first switched to */
+#endif
 };
 
 #define XTHREADP(v)	rep_CELL16_TYPEP(v, thread_type ())
@@ -265,11 +344,6 @@ struct rep_thread_struct {
 static int thread_type (void);
 static rep_thread *threads;
 
-#define TV_LATER_P(t1, t2)			\
-    (((t1)->tv_sec > (t2)->tv_sec)		\
-     || (((t1)->tv_sec == (t2)->tv_sec)		\
-	 && ((t1)->tv_usec > (t2)->tv_usec)))
-
 DEFSYM(continuation, "continuation");
 
 /* used while longjmp'ing to save accessing a local variable */
@@ -284,12 +358,12 @@ static inline char *
 fixup (char *addr, rep_continuation *c)
 {
 #if STACK_DIRECTION < 0
-    if (addr < c->stack_bottom)
+    if (addr < c->stack_bottom && addr >= c->stack_top)
 	return (addr - c->stack_top) + c->stack_copy;
     else
 	return addr;
 #else
-    if (addr > c->stack_bottom)
+    if (addr > c->stack_bottom && addr <= c->stack_top)
 	return (addr - c->stack_bottom) + c->stack_copy;
     else
 	return addr;
@@ -298,7 +372,36 @@ fixup (char *addr, rep_continuation *c)
 
 #define FIXUP(t,c,addr) ((t) (fixup ((char *) (addr), (c))))
 
+/* Is ADDR within the stack saved by continuation C? (Other threads'
+   stacks needn't be anywhere near it) */
+#define SAVED_P(c, addr)				\
+    (!SP_OLDER_P ((char *) (addr), (c)->stack_bottom)	\
+     && !SP_NEWER_P ((char *) (addr), (c)->stack_top))
+
+#ifdef WITH_THREAD_STACKS
+/* The thread running on a stack of its own in the current dynamic
+   root, or null when control is on the root's own stack */
+static inline rep_thread *
+stack_thread (void)
+{
+    rep_thread *t = root_barrier != 0 ? root_barrier->active : 0;
+    return (t != 0 && t->stack != 0) ? t : 0;
+}
+
+/* The oldest end of thread T's stack */
+static inline char *
+thread_stack_base (rep_thread *t)
+{
+#if STACK_DIRECTION < 0
+    return t->stack + t->stack_size;
+#else
+    return t->stack;
+#endif
+}
+#endif
+
 static void thread_delete (rep_thread *t);
+static void thread_exited (rep_thread *t);
 
 
 /* barriers */
@@ -338,16 +441,53 @@ rep_call_with_barrier (repv (*callback)(repv), repv arg,
     barriers = &b;
 
     if (closed)
+    {
 	root_barrier = &b;
+#ifdef WITH_THREAD_STACKS
+	b.call_stack = rep_call_stack;
+	b.special_bindings = rep_special_bindings;
+	b.gc_roots = rep_gc_root_stack;
+	b.gc_n_roots = rep_gc_n_roots_stack;
+	b.regexp_data = rep_saved_matches;
+	memcpy (b.blocked_ops, rep_blocked_ops, sizeof (b.blocked_ops));
+	b.env = rep_env;
+	b.structure = rep_structure;
+	b.lisp_depth = rep_lisp_depth;
+#endif
+    }
 
     DB(("with-barrier[%s]: in  %p (%d)\n",
 	closed ? "closed" : "open", &b, b.depth));
 
-    ret = callback (arg);
+#ifdef WITH_THREAD_STACKS
+    if (closed && setjmp (b.exit_point))
+    {
+	/* The last thread exited on a stack of its own, then the home
+	   thread dropped whatever it was doing to get here */
+	DB (("back on root stack %p\n", &b));
+	b.exiting = 0;
+	rep_call_stack = b.call_stack;
+	rep_set_special_bindings (b.special_bindings);
+	rep_gc_root_stack = b.gc_roots;
+	rep_gc_n_roots_stack = b.gc_n_roots;
+	rep_saved_matches = b.regexp_data;
+	memcpy (rep_blocked_ops, b.blocked_ops, sizeof (rep_blocked_ops));
+	rep_env = b.env;
+	rep_structure = b.structure;
+	rep_lisp_depth = b.lisp_depth;
+	barriers = &b;
+	root_barrier = &b;
+	rep_throw_value = exit_barrier_cell;
+	ret = rep_NULL;
+    }
+    else
+#endif
+	ret = callback (arg);
 
     if (closed)
     {
 	rep_thread *ptr;
+	int i;
 
     again:
 	if (rep_throw_value == exit_barrier_cell)
@@ -379,12 +519,17 @@ rep_call_with_barrier (repv (*callback)(repv), repv arg,
 	    }
 	}
 
-	for (ptr = b.head; ptr != 0; ptr = ptr->next)
-	    ptr->car |= TF_EXITED;
+	for (i = 0; i < THREAD_PRIORITIES; i++)
+	{
+	    for (ptr = b.runq[i].head; ptr != 0; ptr = ptr->next)
+		thread_exited (ptr);
+	}
 	for (ptr = b.susp_head; ptr != 0; ptr = ptr->next)
-	    ptr->car |= TF_EXITED;
+	    thread_exited (ptr);
 	if (b.active != 0)
-	    b.active->car |= TF_EXITED;
+	    thread_exited (b.active);
+	if (b.sleepers != 0)
+	    rep_free (b.sleepers);
     }
 
     DB(("with-barrier[%s]: out %p (%d)\n",
@@ -544,6 +689,11 @@ primitive_invoke_continuation (rep_continuation *c, repv ret)
     depth = trace_barriers (c, dest_hist);
 
     anc = common_ancestor (barriers, dest_hist, depth);
+#ifdef WITH_THREAD_STACKS
+    /* only the thread that owns a stack can rebuild it */
+    if (c->thread != stack_thread ())
+	anc = 0;
+#endif
     if (anc == 0)
     {
 	DEFSTRING (unreachable, "unreachable continuation");
@@ -634,14 +784,95 @@ execution point of the interpreter.
     depth = trace_barriers (c, dest_hist);
 
     anc = common_ancestor (barriers, dest_hist, depth);
+#ifdef WITH_THREAD_STACKS
+    if (c->thread != stack_thread ())
+	anc = 0;
+#endif
     return anc == 0 ? Qnil : Qt;
 }
 
+static rep_continuation *
+new_continuation (void)
+{
+    rep_continuation *c = rep_ALLOC_CELL (sizeof (rep_continuation));
+    rep_data_after_gc += sizeof (rep_continuation);
+    c->next = continuations;
+    continuations = c;
+    c->stack_copy = 0;
+    return c;
+}
+
+/* Call the `in' functions of the barriers from just inside ANCESTOR to
+   the current position, outermost first, returning RET. */
+static repv
+enter_barriers (rep_barrier *ancestor, repv ret)
+{
+    if (barriers != 0)
+    {
+	int count = barriers->depth - (ancestor ? ancestor->depth : 0);
+	rep_barrier **hist = alloca (sizeof (rep_barrier *) * count);
+	rep_barrier *ptr;
+	int i = 0;
+
+	for (ptr = barriers; ptr != ancestor; ptr = ptr->next)
+	    hist[i++] = ptr;
+	for (i = count - 1; i >= 0; i--)
+	{
+	    ptr = hist[i];
+	    DB (("invoke: inwards through %p (%d)\n", ptr, ptr->depth));
+	    if (ptr->in != 0)
+	    {
+		rep_GC_root gc_ret;
+		rep_PUSHGC (gc_ret, ret);
+		ptr->in (ptr->data);
+		rep_POPGC;
+	    }
+	}
+    }
+    return ret;
+}
+
+/* Record the current position of the lisp histories in C */
+static void
+save_histories (rep_continuation *c)
+{
+    c->barriers = barriers;
+    c->root = root_barrier;
+    c->call_stack = rep_call_stack;
+    c->special_bindings = rep_special_bindings;
+    c->gc_roots = rep_gc_root_stack;
+    c->gc_n_roots = rep_gc_n_roots_stack;
+    c->regexp_data = rep_saved_matches;
+    memcpy (c->blocked_ops, rep_blocked_ops, sizeof (c->blocked_ops));
+    c->throw_value = rep_throw_value;
+    c->single_step = rep_single_step_flag;
+    c->lisp_depth = rep_lisp_depth;
+}
+
+static void
+restore_histories (rep_continuation *c)
+{
+    rep_lisp_depth = c->lisp_depth;
+    rep_single_step_flag = c->single_step;
+    rep_throw_value = c->throw_value;
+    memcpy (rep_blocked_ops, c->blocked_ops, sizeof (rep_blocked_ops));
+    rep_saved_matches = c->regexp_data;
+    rep_gc_n_roots_stack = c->gc_n_roots;
+    rep_gc_root_stack = c->gc_roots;
+    rep_set_special_bindings (c->special_bindings);
+    rep_call_stack = c->call_stack;
+    root_barrier = c->root;
+    barriers = c->barriers;
+}
+
 static repv
 primitive_call_cc (repv (*callback)(rep_continuation *, void *), void *data,
 		   rep_continuation *c)
 {
-    struct rep_saved_regexp_data re_data;
+    /* RE_DATA is a copy of the match data when the continuation was
+       made, which is reinstated whenever it returns; matches made
+       meanwhile go in RE_FRAME */
+    struct rep_saved_regexp_data re_data, re_frame;
     repv ret;
 
     if (root_barrier == 0)
@@ -651,13 +882,7 @@ primitive_call_cc (repv (*callback)(rep_continuation *, void *), void *data,
     }
 
     if (c == 0)
-    {
-	c = rep_ALLOC_CELL (sizeof (rep_continuation));
-	rep_data_after_gc += sizeof (rep_continuation);
-	c->next = continuations;
-	continuations = c;
-	c->stack_copy = 0;
-    }
+	c = new_continuation ();
 
     c->car = continuation_type ();
     
@@ -670,17 +895,7 @@ primitive_call_cc (repv (*callback)(rep_continuation *, void *), void *data,
 	c = invoked_continuation;
 	invoked_continuation = 0;
 
-	rep_lisp_depth = c->lisp_depth;
-	rep_single_step_flag = c->single_step;
-	rep_throw_value = c->throw_value;
-	memcpy (rep_blocked_ops, c->blocked_ops, sizeof (rep_blocked_ops));
-	rep_saved_matches = c->regexp_data;
-	rep_gc_n_roots_stack = c->gc_n_roots;
-	rep_gc_root_stack = c->gc_roots;
-	rep_special_bindings = c->special_bindings;
-	rep_call_stack = c->call_stack;
-	root_barrier = c->root;
-	barriers = c->barriers;
+	restore_histories (c);
 
 	ret = invoked_continuation_ret;
 	invoked_continuation_ret = rep_NULL;
@@ -688,52 +903,27 @@ primitive_call_cc (repv (*callback)(rep_continuation *, void *), void *data,
 	ancestor = invoked_continuation_ancestor;
 	invoked_continuation_ancestor = 0;
 
-	/* handle any `in' barrier functions */
-	if (barriers != 0)
-	{
-	    int count = barriers->depth - (ancestor ? ancestor->depth : 0);
-	    rep_barrier **hist = alloca (sizeof (rep_barrier *) * count);
-	    rep_barrier *ptr;
-	    int i = 0;
-
-	    for (ptr = barriers; ptr != ancestor; ptr = ptr->next)
-		hist[i++] = ptr;
-	    for (i = count - 1; i >= 0; i--)
-	    {
-		ptr = hist[i];
-		DB (("invoke: inwards through %p (%d)\n", ptr, ptr->depth));
-		if (ptr->in != 0)
-		{
-		    rep_GC_root gc_ret;
-		    rep_PUSHGC (gc_ret, ret);
-		    ptr->in (ptr->data);
-		    rep_POPGC;
-		}
-	    }
-	}
+	ret = enter_barriers (ancestor, ret);
 
 	rep_pop_regexp_data ();
+	rep_restore_regexp_data ();
     }
     else
     {
 	/* into call/cc */
 
-	rep_push_regexp_data (&re_data);
+	rep_save_regexp_data (&re_data);
+	rep_push_regexp_data (&re_frame);
 
-	c->barriers = barriers;
-	c->root = root_barrier;
+	save_histories (c);
 	root_barrier->targeted = 1;
-	c->call_stack = rep_call_stack;
-	c->special_bindings = rep_special_bindings;
-	c->gc_roots = rep_gc_root_stack;
-	c->gc_n_roots = rep_gc_n_roots_stack;
-	c->regexp_data = rep_saved_matches;
-	memcpy (c->blocked_ops, rep_blocked_ops, sizeof (c->blocked_ops));
-	c->throw_value = rep_throw_value;
-	c->single_step = rep_single_step_flag;
-	c->lisp_depth = rep_lisp_depth;
 
 	c->stack_bottom = c->root->point;
+#ifdef WITH_THREAD_STACKS
+	c->thread = stack_thread ();
+	if (c->thread != 0)
+	    c->stack_bottom = thread_stack_base (c->thread);
+#endif
 	save_stack (c);
 
 	DB (("call/cc: saved %p; real_size=%lu (%u)\n",
@@ -742,6 +932,7 @@ primitive_call_cc (repv (*callback)(rep_continuation *, void *), void *data,
 	ret = callback (c, data);
 
 	rep_pop_regexp_data ();
+	rep_restore_regexp_data ();
     }
 
     return ret;
@@ -789,62 +980,296 @@ thread_load_environ (rep_thread *t)
     rep_structure = t->structure;
 }
 
+#ifdef WITH_THREAD_STACKS
+
+/* Set when a thread with its own stack has been switched away from
+   for the last time, so that the next thread to run can free it */
+static rep_thread *dead_thread;
+
+static rep_bool
+alloc_stack (rep_thread *t)
+{
+    size_t size = MAX (thread_stack_size, MIN_THREAD_STACK);
+    char *mem;
+#ifdef MAP_ANONYMOUS
+    size_t page = sysconf (_SC_PAGESIZE);
+    /* with a page at the end that faults, so that overflowing the
+       stack can't silently scribble on something else */
+    size = ((size + page - 1) & ~(page - 1)) + page;
+    mem = mmap (0, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+	return rep_FALSE;
+# if STACK_DIRECTION < 0
+    mprotect (mem, page, PROT_NONE);
+# else
+    mprotect (mem + size - page, page, PROT_NONE);
+# endif
+#else
+    mem = rep_alloc (size);
+    if (mem == 0)
+	return rep_FALSE;
+#endif
+    t->stack = mem;
+    t->stack_size = size;
+    return rep_TRUE;
+}
+
+static void
+free_stack (rep_thread *t)
+{
+    if (t->stack != 0)
+    {
+#ifdef MAP_ANONYMOUS
+	munmap (t->stack, t->stack_size);
+#else
+	rep_free (t->stack);
+#endif
+	t->stack = 0;
+    }
+}
+
+/* Point the histories saved in thread state C back at where they
+   were when its root was entered. The running thread's state is kept
+   like this, since the real histories are only saved when it stops. */
+static void
+forget_histories (rep_continuation *c)
+{
+    rep_barrier *root = c->root;
+    c->barriers = root;
+    c->call_stack = root->call_stack;
+    c->special_bindings = Qnil;
+    c->gc_roots = root->gc_roots;
+    c->gc_n_roots = root->gc_n_roots;
+    c->regexp_data = root->regexp_data;
+    memcpy (c->blocked_ops, root->blocked_ops, sizeof (c->blocked_ops));
+    c->throw_value = rep_NULL;
+    c->lisp_depth = root->lisp_depth;
+}
+
+/* Make the state of a thread in the current root, one that starts
+   from the root with the current special bindings */
+static rep_continuation *
+new_thread_state (void)
+{
+    rep_continuation *c = new_continuation ();
+    c->car = continuation_type () | CF_LIVE;
+    c->root = root_barrier;
+    root_barrier->targeted = 1;
+    forget_histories (c);
+    c->special_bindings = rep_special_bindings;
+    c->single_step = rep_single_step_flag;
+    c->stack_top = c->stack_bottom = 0;
+    c->thread = 0;
+    return c;
+}
+
+/* Called on the stack of each thread as it's switched to */
+static void
+thread_resumed (void)
+{
+    if (dead_thread != 0)
+    {
+	thread_exited (dead_thread);
+	dead_thread = 0;
+    }
+    if (root_barrier->exiting)
+	longjmp (root_barrier->exit_point, 1);
+    rep_FORBID;
+    enter_barriers (root_barrier, Qnil);
+    rep_PERMIT;
+}
+
+/* Pass control from thread FROM (the one running) to thread TO, both
+   in the current root. Returns when FROM is switched back to. */
+static void
+switch_thread (rep_thread *from, rep_thread *to)
+{
+    struct rep_saved_regexp_data re_data, re_frame;
+    rep_barrier *ptr;
+
+    /* Threads never share anything inside the root, so there's
+       always the whole way out of FROM's barriers to go */
+    rep_FORBID;
+    for (ptr = barriers; ptr != root_barrier; ptr = ptr->next)
+    {
+	DB (("switch: outwards through %p (%d)\n", ptr, ptr->depth));
+	if (ptr->out != 0)
+	    ptr->out (ptr->data);
+    }
+    rep_PERMIT;
+
+    rep_save_regexp_data (&re_data);
+    rep_push_regexp_data (&re_frame);
+    save_histories (from->cont);
+    if ((from->car & TF_EXITED) && from->stack != 0)
+	dead_thread = from;
+
+    restore_histories (to->cont);
+    forget_histories (to->cont);
+    rep_thread_lock = to->lock;
+    thread_load_environ (to);
+    DB (("switching from thread %p to %p\n", from, to));
+    swapcontext (&from->context, &to->context);
+
+    thread_resumed ();
+    rep_pop_regexp_data ();
+    rep_restore_regexp_data ();
+}
+
+/* Thread T, running on its own stack, is the last to exit from the
+   current root, or has thrown out of it. Resume the root's home thread,
+   so that it can longjmp back out of the barrier on the root's own
+   stack. rep_throw_value has already been set. */
+static void
+leave_thread_stack (rep_thread *t)
+{
+    root_barrier->exiting = 1;
+    switch_thread (t, root_barrier->home);
+    abort ();
+}
+
+#endif /* WITH_THREAD_STACKS */
+
+/* Returns the priority of the best runnable thread in ROOT (not
+   counting the active thread), or -1 if there are none. */
+static inline int
+highest_runnable (rep_barrier *root)
+{
+    int p = THREAD_PRIORITIES - 1;
+    if (root->runnable == 0)
+	return -1;
+    while (!(root->runnable & (1 << p)))
+	p--;
+    return p;
+}
+
+/* Sleeping threads heap */
+
+static inline void
+sleeper_place (rep_barrier *root, rep_thread *t, int i)
+{
+    root->sleepers[i] = t;
+    t->sleep_index = i;
+}
+
+static void
+sleeper_sift_up (rep_barrier *root, int i)
+{
+    rep_thread *t = root->sleepers[i];
+    while (i > 0)
+    {
+	int parent = (i - 1) / 2;
+	if (root->sleepers[parent]->run_at <= t->run_at)
+	    break;
+	sleeper_place (root, root->sleepers[parent], i);
+	i = parent;
+    }
+    sleeper_place (root, t, i);
+}
+
+static void
+sleeper_sift_down (rep_barrier *root, int i)
+{
+    rep_thread *t = root->sleepers[i];
+    while (1)
+    {
+	int child = 2 * i + 1;
+	if (child >= root->n_sleepers)
+	    break;
+	if (child + 1 < root->n_sleepers
+	    && (root->sleepers[child + 1]->run_at
+		< root->sleepers[child]->run_at))
+	    child++;
+	if (t->run_at <= root->sleepers[child]->run_at)
+	    break;
+	sleeper_place (root, root->sleepers[child], i);
+	i = child;
+    }
+    sleeper_place (root, t, i);
+}
+
+static void
+add_sleeper (rep_barrier *root, rep_thread *t)
+{
+    if (root->n_sleepers == root->sleepers_size)
+    {
+	int new_size = MAX (root->sleepers_size * 2, 16);
+	rep_thread **new = rep_realloc (root->sleepers,
+					new_size * sizeof (rep_thread *));
+	if (new == 0)
+	{
+	    /* It'll be woken eventually, when nothing else can run */
+	    t->sleep_index = -1;
+	    return;
+	}
+	root->sleepers = new;
+	root->sleepers_size = new_size;
+    }
+    root->sleepers[root->n_sleepers++] = t;
+    sleeper_sift_up (root, root->n_sleepers - 1);
+}
+
+static void
+remove_sleeper (rep_barrier *root, rep_thread *t)
+{
+    int i = t->sleep_index;
+    t->sleep_index = -1;
+    if (i < --root->n_sleepers)
+    {
+	rep_thread *moved = root->sleepers[root->n_sleepers];
+	sleeper_place (root, moved, i);
+	sleeper_sift_up (root, i);
+	sleeper_sift_down (root, moved->sleep_index);
+    }
+}
+
 static void
 enqueue_thread (rep_thread *t, rep_barrier *root)
 {
     assert (!(t->car & TF_EXITED));
     if (!(t->car & TF_SUSPENDED))
     {
-	t->pred = root->tail;
+	int p = t->priority;
+	t->pred = root->runq[p].tail;
 	if (t->pred != 0)
 	    t->pred->next = t;
-	if (root->head == 0)
-	    root->head = t;
-	root->tail = t;
+	else
+	    root->runq[p].head = t;
+	root->runq[p].tail = t;
+	root->runnable |= 1 << p;
     }
     else
     {
-	rep_thread *ptr = root->susp_head;
-	while (ptr != 0 && TV_LATER_P (&t->run_at, &ptr->run_at))
-	    ptr = ptr->next;
-	if (ptr != 0)
-	{
-	    t->pred = ptr->pred;
-	    if (ptr->pred != 0)
-		ptr->pred->next = t;
-	    else
-		root->susp_head = t;
-	    ptr->pred = t;
-	    t->next = ptr;
-	}
+	t->pred = root->susp_tail;
+	if (t->pred != 0)
+	    t->pred->next = t;
 	else
-	{
-	    t->pred = root->susp_tail;
-	    if (t->pred != 0)
-		t->pred->next = t;
-	    if (root->susp_head == 0)
-		root->susp_head = t;
-	    root->susp_tail = t;
-	}
+	    root->susp_head = t;
+	root->susp_tail = t;
+	if (t->run_at != 0)
+	    add_sleeper (root, t);
     }
 }
 
+/* Remove T from whichever queue contains it. Does nothing for the
+   active thread. */
 static void
 unlink_thread (rep_thread *t)
 {
     rep_barrier *root = t->cont->root;
 
-    if (t->pred != 0)
-	t->pred->next = t->next;
-    if (t->next != 0)
-	t->next->pred = t->pred;
-
     if (!(t->car & TF_SUSPENDED))
     {
-	if (root->head == t)
-	    root->head = t->next;
-	if (root->tail == t)
-	    root->tail = t->pred;
+	int p = t->priority;
+	if (t->pred == 0 && root->runq[p].head != t)
+	    return;
+	if (root->runq[p].head == t)
+	    root->runq[p].head = t->next;
+	if (root->runq[p].tail == t)
+	    root->runq[p].tail = t->pred;
+	if (root->runq[p].head == 0)
+	    root->runnable &= ~(1 << p);
     }
     else
     {
@@ -852,10 +1277,29 @@ unlink_thread (rep_thread *t)
 	    root->susp_head = t->next;
 	if (root->susp_tail == t)
 	    root->susp_tail = t->pred;
+	if (t->sleep_index >= 0)
+	    remove_sleeper (root, t);
     }
+
+    if (t->pred != 0)
+	t->pred->next = t->next;
+    if (t->next != 0)
+	t->next->pred = t->pred;
     t->next = t->pred = 0;
 }
 
+/* Stop T waiting for the thread it's joining to exit. */
+static void
+unlink_joiner (rep_thread *t)
+{
+    rep_thread **ptr = &t->joining->joiners;
+    while (*ptr != t)
+	ptr = &(*ptr)->next_joiner;
+    *ptr = t->next_joiner;
+    t->next_joiner = 0;
+    t->joining = 0;
+}
+
 static void
 thread_wake (rep_thread *t)
 {
@@ -864,51 +1308,83 @@ thread_wake (rep_thread *t)
     assert (!(t->car & TF_EXITED));
 
     unlink_thread (t);
+    if (t->joining != 0)
+	unlink_joiner (t);
     t->car &= ~TF_SUSPENDED;
     enqueue_thread (t, root);
 }
 
+/* Wake the threads in ROOT whose timeouts have passed. */
 static rep_bool
-poll_threads (rep_barrier *root)
+wake_sleepers (rep_barrier *root)
 {
     rep_bool woke_any = rep_FALSE;
-    rep_thread *t, *next;
-    for (t = root->susp_head; t != 0; t = next)
+    if (root->n_sleepers > 0)
     {
-	next = t->next;
-	if (t->poll && t->poll (t, t->poll_arg))
+	rep_long_long now = rep_utime ();
+	while (root->n_sleepers > 0 && root->sleepers[0]->run_at <= now)
 	{
-	    thread_wake (t);
+	    thread_wake (root->sleepers[0]);
 	    woke_any = rep_TRUE;
 	}
     }
     return woke_any;
 }
 
+#ifndef WITH_THREAD_STACKS
 static repv
 inner_thread_invoke (rep_continuation *c, void *data)
 {
     rep_thread *t = data;
     t->cont = c;
-    rep_thread_lock = root_barrier->head->lock;
-    DB (("invoking thread %p\n", root_barrier->head));
-    thread_load_environ (root_barrier->head);
-    primitive_invoke_continuation (root_barrier->head->cont, Qnil);
+    rep_thread_lock = root_barrier->active->lock;
+    DB (("invoking thread %p\n", root_barrier->active));
+    thread_load_environ (root_barrier->active);
+    primitive_invoke_continuation (root_barrier->active->cont, Qnil);
     return rep_NULL;
 }
+#endif
 
+#ifdef WITH_PROBES
+static const char *
+thread_probe_name (rep_thread *t)
+{
+    return (t != 0 && rep_STRINGP (t->name)) ? rep_STR (t->name) : "";
+}
+#endif
+
+/* Switch to the best runnable thread. The current thread must have
+   been queued (or suspended, or deleted) first. */
 static void
 thread_invoke (void)
 {
+    rep_thread *active;
+    int p;
 again:
     if (root_barrier == 0)
 	return;
 
-    if (root_barrier->head != 0)
+    active = root_barrier->active;
+    p = highest_runnable (root_barrier);
+    if (p >= 0)
     {
-	rep_thread *active = root_barrier->active;
-	assert (root_barrier->head != 0);
-	root_barrier->active = root_barrier->head;
+	rep_thread *next = root_barrier->runq[p].head;
+	unlink_thread (next);
+	root_barrier->active = next;
+	if (next != active)
+	    REP_PROBE4 (thread__switch, active, next,
+			thread_probe_name (active), thread_probe_name (next));
+#ifdef WITH_THREAD_STACKS
+	{
+	    rep_thread *from = (active != 0) ? active : root_barrier->home;
+	    if (next != from)
+	    {
+		from->lock = rep_thread_lock;
+		thread_save_environ (from);
+		switch_thread (from, next);
+	    }
+	}
+#else
 	if (active != 0)
 	{
 	    /* save the continuation of this thread,
@@ -919,11 +1395,12 @@ again:
 	}
 	else
 	{
-	    rep_thread_lock = root_barrier->head->lock;
-	    DB (("invoking thread %p\n", root_barrier->head));
-	    thread_load_environ (root_barrier->head);
-	    primitive_invoke_continuation (root_barrier->head->cont, Qnil);
+	    rep_thread_lock = next->lock;
+	    DB (("invoking thread %p\n", next));
+	    thread_load_environ (next);
+	    primitive_invoke_continuation (next->cont, Qnil);
 	}
+#endif
     }
     else
     {
@@ -936,33 +1413,27 @@ again:
 	    rep_CDR (exit_barrier_cell) = rep_throw_value;
 	    rep_throw_value = exit_barrier_cell;
 	    DB (("no more threads, throwing to root..\n"));
+#ifdef WITH_THREAD_STACKS
+	    if (active != 0 && active->stack != 0)
+		leave_thread_stack (active);
+#endif
 	    return;
 	}
-	else if (poll_threads (root_barrier))
+	else if (root_barrier->n_sleepers > 0)
 	{
-	    /* something woke */
+	    rep_thread *b = root_barrier->sleepers[0];
+	    rep_long_long delta = b->run_at - rep_utime ();
+	    DB (("no more threads, sleeping..\n"));
+	    if (delta > 0)
+		rep_sleep_for (delta / 1000000, (delta % 1000000) / 1000);
+	    DB (("..waking thread %p\n", b));
+	    thread_wake (b);
 	    goto again;
 	}
 	else
 	{
-	    rep_thread *b = root_barrier->susp_head;
-	    struct timeval now;
-	    gettimeofday (&now, 0);
-	    DB (("no more threads, sleeping..\n"));
-	    if (TV_LATER_P (&b->run_at, &now))
-	    {
-		struct timeval delta;
-		delta.tv_sec = b->run_at.tv_sec - now.tv_sec;
-		delta.tv_usec = b->run_at.tv_usec - now.tv_usec;
-		while (delta.tv_usec < 0)
-		{
-		    delta.tv_usec += 1000000;
-		    delta.tv_sec--;
-		}
-		rep_sleep_for (delta.tv_sec, delta.tv_usec / 1000);
-	    }
-	    DB (("..waking thread %p\n", b));
-	    thread_wake (b);
+	    /* Nothing will ever wake any of them, so just pick one */
+	    thread_wake (root_barrier->susp_head);
 	    goto again;
 	}
     }
@@ -972,14 +1443,77 @@ static void
 thread_delete (rep_thread *t)
 {
     rep_barrier *root = t->cont->root;
-    rep_thread *active = root->head;
+    rep_thread *active = root->active;
 
     unlink_thread (t);
-    t->car |= TF_EXITED;
+    if (t->joining != 0)
+	unlink_joiner (t);
+    if (active == t)
+	t->car |= TF_EXITED;
+    else
+	thread_exited (t);
+
+    /* Let anyone waiting for T carry on */
+    while (t->joiners != 0)
+    {
+	rep_thread *j = t->joiners;
+	t->joiners = j->next_joiner;
+	j->next_joiner = 0;
+	j->joining = 0;
+	if ((j->car & TF_SUSPENDED) && !(j->car & TF_EXITED))
+	    thread_wake (j);
+    }
+
     if (active == t)
 	thread_invoke ();
 }
 
+/* Mark T as having exited, when it isn't the thread running */
+static void
+thread_exited (rep_thread *t)
+{
+    t->car |= TF_EXITED;
+#ifdef WITH_THREAD_STACKS
+    if (t->stack != 0)
+    {
+	free_stack (t);
+	t->cont->car |= CF_INVALID;
+	t->thunk = Qnil;
+    }
+#endif
+}
+
+#ifdef WITH_THREAD_STACKS
+
+/* The first function called on each thread's own stack */
+static void
+thread_entry (void)
+{
+    rep_thread *t = root_barrier->active;
+    repv ret;
+
+    thread_resumed ();
+    ret = rep_call_lisp0 (t->thunk);
+    t->thunk = Qnil;
+    t->car |= TF_EXITED;
+    if (ret != rep_NULL)
+    {
+	t->exit_val = ret;
+	thread_delete (t);
+    }
+    else
+    {
+	/* exited with a throw, throw out of the dynamic root */
+	rep_CDR (exit_barrier_cell) = rep_throw_value;
+	rep_throw_value = exit_barrier_cell;
+	leave_thread_stack (t);
+    }
+    /* there's nowhere to return to */
+    abort ();
+}
+
+#else /* WITH_THREAD_STACKS */
+
 static repv
 inner_make_thread (rep_continuation *c, void *data)
 {
@@ -989,6 +1523,8 @@ inner_make_thread (rep_continuation *c, void *data)
     return -1;
 }
 
+#endif /* !WITH_THREAD_STACKS */
+
 static rep_thread *
 new_thread (repv name)
 {
@@ -997,8 +1533,9 @@ new_thread (repv name)
     memset (t, 0, sizeof (rep_thread));
     t->car = thread_type ();
     t->name = name;
-    t->poll = 0;
-    t->poll_arg = 0;
+    t->priority = ((root_barrier != 0 && root_barrier->active != 0)
+		   ? root_barrier->active->priority : DEFAULT_PRIORITY);
+    t->sleep_index = -1;
     t->exit_val = rep_NULL;
     t->next_alloc = threads;
     threads = t;
@@ -1013,10 +1550,18 @@ ensure_default_thread (void)
 	/* entering threaded execution. make the default thread */
 	rep_thread *x = new_thread (Qnil);
 	thread_save_environ (x);
+#ifdef WITH_THREAD_STACKS
+	/* it keeps using the root's stack */
+	x->cont = new_thread_state ();
+	root_barrier->home = x;
+#else
 	/* this continuation will never get called,
 	   but it simplifies things.. */
 	if (primitive_call_cc (inner_make_thread, x, 0) != -1)
 	    abort ();
+	/* it's running, so mustn't be queued */
+	unlink_thread (x);
+#endif
 	root_barrier->active = x;
     }
 }
@@ -1024,8 +1569,10 @@ ensure_default_thread (void)
 static rep_thread *
 make_thread (repv thunk, repv name, rep_bool suspended)
 {
+#ifndef WITH_THREAD_STACKS
     repv ret;
     rep_GC_root gc_thunk;
+#endif
     rep_thread *t;
 
     if (root_barrier == 0)
@@ -1038,6 +1585,23 @@ make_thread (repv thunk, repv name, rep_bool suspended)
 
     ensure_default_thread ();
 
+#ifdef WITH_THREAD_STACKS
+    if (!alloc_stack (t))
+    {
+	t->car |= TF_EXITED;
+	rep_mem_error ();
+	return 0;
+    }
+    t->cont = new_thread_state ();
+    t->thunk = thunk;
+    getcontext (&t->context);
+    t->context.uc_stack.ss_sp = t->stack;
+    t->context.uc_stack.ss_size = t->stack_size;
+    t->context.uc_link = 0;
+    makecontext (&t->context, thread_entry, 0);
+    enqueue_thread (t, root_barrier);
+    return t;
+#else
     rep_PUSHGC (gc_thunk, thunk);
     ret = primitive_call_cc (inner_make_thread, t, 0);
     rep_POPGC;
@@ -1061,50 +1625,30 @@ make_thread (repv thunk, repv name, rep_bool suspended)
 	}
 	return 0;
     }
+#endif
 }
 
 static rep_bool
 thread_yield (void)
 {
-    struct timeval now;
-    rep_thread *ptr, *next;
-    rep_thread *old_head;
+    rep_thread *active;
+    int p;
 
     if (root_barrier == 0)
 	return rep_FALSE;
 
-    old_head = root_barrier->head;
     rep_pending_thread_yield = rep_FALSE;
-    if (root_barrier->head && root_barrier->head->next)
-    {
-	rep_thread *old = root_barrier->head;
-	if (old->pred != 0)
-	    old->pred->next = old->next;
-	if (old->next != 0)
-	    old->next->pred = old->pred;
-	root_barrier->head = old->next;
-	old->next = 0;
-	old->pred = root_barrier->tail;
-	old->pred->next = old;
-	root_barrier->tail = old;
-    }
-
-    /* check suspend queue for threads that need waking */
 
-    if (root_barrier->susp_head != 0)
-	gettimeofday (&now, 0);
-    for (ptr = root_barrier->susp_head; ptr != 0; ptr = next)
-    {
-	next = ptr->next;
-	if (TV_LATER_P (&now, &ptr->run_at)
-	    || (ptr->poll && ptr->poll (ptr, ptr->poll_arg)))
-	{
-	    thread_wake (ptr);
-	}
-    }
+    /* check for sleeping threads that need waking */
+    wake_sleepers (root_barrier);
 
-    if (root_barrier->head != old_head)
+    /* Only switch to threads at least as important as this one */
+    active = root_barrier->active;
+    p = highest_runnable (root_barrier);
+    if (p >= 0 && (active == 0 || p >= active->priority))
     {
+	if (active != 0)
+	    enqueue_thread (active, root_barrier);
 	thread_invoke ();
 	return rep_TRUE;
     }
@@ -1113,8 +1657,7 @@ thread_yield (void)
 }
 
 static void
-thread_suspend (rep_thread *t, unsigned long msecs,
-		rep_bool (*poll)(rep_thread *t, void *arg), void *poll_arg)
+thread_suspend (rep_thread *t, unsigned long msecs)
 {
     rep_barrier *root = t->cont->root;
     assert (!(t->car & TF_SUSPENDED));
@@ -1122,32 +1665,28 @@ thread_suspend (rep_thread *t, unsigned long msecs,
 
     unlink_thread (t);
     t->car |= TF_SUSPENDED;
-    if (msecs == 0)
-    {
-	/* XXX assumes twos-complement representation.. but Solaris
-	   XXX has a weird struct timeval.. */
-	t->run_at.tv_sec = ~0UL >> 1;
-	t->run_at.tv_usec = ~0UL >> 1;
-    }
-    else
-    {
-	gettimeofday (&t->run_at, 0);
-	t->run_at.tv_sec += (msecs / 1000);
-	t->run_at.tv_usec += (msecs % 1000) * 1000;
-	if (t->run_at.tv_usec > 1000000)
-	{
-	    t->run_at.tv_sec += t->run_at.tv_usec / 1000000;
-	    t->run_at.tv_usec = t->run_at.tv_usec % 1000000;
-	}
-    }
-    t->poll = poll;
-    t->poll_arg = poll_arg;
+    t->run_at = (msecs == 0) ? 0 : rep_utime () + msecs * 1000;
     t->exit_val = Qnil;
     enqueue_thread (t, root);
     if (root_barrier->active == t)
 	thread_invoke ();
 }
 
+/* Change the priority of T to PRIORITY. */
+static void
+thread_set_priority (rep_thread *t, int priority)
+{
+    rep_barrier *root = t->cont->root;
+    if (!(t->car & TF_SUSPENDED) && root->active != t)
+    {
+	unlink_thread (t);
+	t->priority = priority;
+	enqueue_thread (t, root);
+    }
+    else
+	t->priority = priority;
+}
+
 unsigned long
 rep_max_sleep_for (void)
 {
@@ -1158,20 +1697,15 @@ rep_max_sleep_for (void)
 	   XXX grr.. using ULONG_MAX doesn't work on solaris*/
 	return UINT_MAX;
     }
-    else if (root->head != 0 && root->head->next != 0)
+    else if (root->runnable != 0)
     {
 	/* other threads ready to run, don't sleep */
 	return 0;
     }
-    else if (root->susp_head != 0)
+    else if (root->n_sleepers > 0)
     {
 	/* other threads sleeping, how long until the first wakes? */
-	/* XXX ignores polling */
-	struct timeval now;
-	long msecs;
-	gettimeofday (&now, 0);
-	msecs = ((root->susp_head->run_at.tv_sec - now.tv_sec) * 1000
-		 + (root->susp_head->run_at.tv_usec - now.tv_usec) / 1000);
+	rep_long_long msecs = (root->sleepers[0]->run_at - rep_utime ()) / 1000;
 	return MAX (msecs, 0);
     }
     else
@@ -1184,6 +1718,83 @@ rep_max_sleep_for (void)
 
 /* type hooks */
 
+static void
+mark_barrier_threads (rep_barrier *ptr)
+{
+    rep_thread *t;
+    int i;
+    for (i = 0; i < THREAD_PRIORITIES; i++)
+    {
+	for (t = ptr->runq[i].head; t != 0; t = t->next)
+	    rep_MARKVAL (rep_VAL (t));
+    }
+    for (t = ptr->susp_head; t != 0; t = t->next)
+	rep_MARKVAL (rep_VAL (t));
+    rep_MARKVAL (rep_VAL (ptr->active));
+}
+
+static void
+mark_call (struct rep_Call *lc)
+{
+    rep_MARKVAL(lc->fun);
+    rep_MARKVAL(lc->args);
+    rep_MARKVAL(lc->current_form);
+    rep_MARKVAL(lc->saved_env);
+    rep_MARKVAL(lc->saved_structure);
+}
+
+static void
+mark_regexp_data (struct rep_saved_regexp_data *sd)
+{
+    assert (sd->type ==  rep_reg_obj || sd->type == rep_reg_string
+	    || sd->type == rep_reg_inherit);
+    if(sd->type == rep_reg_obj)
+    {
+	int i;
+	for(i = 0; i < rep_NSUBEXP; i++)
+	{
+	    rep_MARKVAL(sd->matches.obj.startp[i]);
+	    rep_MARKVAL(sd->matches.obj.endp[i]);
+	}
+    }
+    rep_MARKVAL(sd->data);
+}
+
+#ifdef WITH_THREAD_STACKS
+/* Mark the histories of a thread with its own stack, from where it
+   was switched away down to where they join those of its root */
+static void
+mark_live_cont (rep_continuation *c)
+{
+    rep_barrier *root = c->root, *barrier;
+    rep_GC_root *roots;
+    rep_GC_n_roots *nroots;
+    struct rep_Call *calls;
+    struct rep_saved_regexp_data *matches;
+
+    for (barrier = c->barriers;
+	 barrier != 0 && barrier != root; barrier = barrier->next)
+	mark_barrier_threads (barrier);
+    for (roots = c->gc_roots;
+	 roots != 0 && roots != root->gc_roots; roots = roots->next)
+	rep_MARKVAL (*roots->ptr);
+    for (nroots = c->gc_n_roots;
+	 nroots != 0 && nroots != root->gc_n_roots; nroots = nroots->next)
+    {
+	int i;
+	for (i = 0; i < nroots->count; i++)
+	    rep_MARKVAL (nroots->first[i]);
+    }
+    for (calls = c->call_stack;
+	 calls != 0 && calls != root->call_stack; calls = calls->next)
+	mark_call (calls);
+    for (matches = c->regexp_data;
+	 matches != 0 && matches != &rep_base_matches
+	 && matches != root->regexp_data; matches = matches->next)
+	mark_regexp_data (matches);
+}
+#endif
+
 static void
 mark_cont (repv obj)
 {
@@ -1197,27 +1808,32 @@ mark_cont (repv obj)
     rep_MARKVAL (c->throw_value);
     rep_MARKVAL (c->special_bindings);
 
+#ifdef WITH_THREAD_STACKS
+    rep_MARKVAL (rep_VAL (c->thread));
+    if (c->car & CF_LIVE)
+    {
+	/* once invalid the stack has gone */
+	if (!(c->car & CF_INVALID))
+	    mark_live_cont (c);
+	return;
+    }
+#endif
+
     for (barrier = c->barriers;
-	 barrier != 0 && !SP_OLDER_P ((char *) barrier, c->stack_bottom);
+	 barrier != 0 && SAVED_P (c, barrier);
 	 barrier = FIXUP(rep_barrier *, c, barrier)->next)
     {
-	rep_barrier *ptr = FIXUP (rep_barrier *, c, barrier);
-	rep_thread *t;
-	for (t = ptr->head; t != 0; t = t->next)
-	    rep_MARKVAL (rep_VAL (t));
-	for (t = ptr->susp_head; t != 0; t = t->next)
-	    rep_MARKVAL (rep_VAL (t));
-	rep_MARKVAL (rep_VAL (ptr->active));
+	mark_barrier_threads (FIXUP (rep_barrier *, c, barrier));
     }
     for (roots = c->gc_roots;
-	 roots != 0 && !SP_OLDER_P ((char *) roots, c->stack_bottom);
+	 roots != 0 && SAVED_P (c, roots);
 	 roots = FIXUP(rep_GC_root *, c, roots)->next)
     {
 	repv *ptr = FIXUP(rep_GC_root *, c, roots)->ptr;
 	rep_MARKVAL (*FIXUP(repv *, c, ptr));
     }
     for (nroots = c->gc_n_roots;
-	 nroots != 0 && !SP_OLDER_P ((char *) roots, c->stack_bottom);
+	 nroots != 0 && SAVED_P (c, nroots);
 	 nroots = FIXUP(rep_GC_n_roots *, c, nroots)->next)
     {
 	repv *ptr = FIXUP(repv *, c, FIXUP(rep_GC_n_roots *, c, nroots)->first);
@@ -1226,33 +1842,17 @@ mark_cont (repv obj)
 	    rep_MARKVAL (ptr[i]);
     }
     for (calls = c->call_stack;
-	 calls != 0 && !SP_OLDER_P ((char *) calls, c->stack_bottom);
+	 calls != 0 && SAVED_P (c, calls);
 	 calls = FIXUP(struct rep_Call *, c, calls)->next)
     {
-	struct rep_Call *lc = FIXUP(struct rep_Call *, c, calls);
-	rep_MARKVAL(lc->fun);
-	rep_MARKVAL(lc->args);
-	rep_MARKVAL(lc->current_form);
-	rep_MARKVAL(lc->saved_env);
-	rep_MARKVAL(lc->saved_structure);
+	mark_call (FIXUP(struct rep_Call *, c, calls));
     }
     for (matches = c->regexp_data;
-	 matches != 0 && !SP_OLDER_P ((char *) matches, c->stack_bottom);
+	 matches != 0 && matches != &rep_base_matches
+	 && SAVED_P (c, matches);
 	 matches = FIXUP(struct rep_saved_regexp_data *, c, matches)->next)
     {
-	struct rep_saved_regexp_data *sd
-	    = FIXUP(struct rep_saved_regexp_data *, c, matches);
-	assert (sd->type ==  rep_reg_obj || sd->type == rep_reg_string);
-	if(sd->type == rep_reg_obj)
-	{
-	    int i;
-	    for(i = 0; i < rep_NSUBEXP; i++)
-	    {
-		rep_MARKVAL(sd->matches.obj.startp[i]);
-		rep_MARKVAL(sd->matches.obj.endp[i]);
-	    }
-	}
-	rep_MARKVAL(sd->data);
+	mark_regexp_data (FIXUP(struct rep_saved_regexp_data *, c, matches));
     }
 }
 
@@ -1261,14 +1861,7 @@ mark_all (void)
 {
     rep_barrier *ptr;
     for (ptr = barriers; ptr != 0; ptr = ptr->next)
-    {
-	rep_thread *t;
-	for (t = ptr->head; t != 0; t = t->next)
-	    rep_MARKVAL (rep_VAL (t));
-	for (t = ptr->susp_head; t != 0; t = t->next)
-	    rep_MARKVAL (rep_VAL (t));
-	rep_MARKVAL (rep_VAL (ptr->active));
-    }
+	mark_barrier_threads (ptr);
 }
 	
 static void
@@ -1324,6 +1917,9 @@ mark_thread (repv obj)
     rep_MARKVAL (THREAD (obj)->structure);
     rep_MARKVAL (THREAD (obj)->name);
     rep_MARKVAL (THREAD (obj)->exit_val);
+#ifdef WITH_THREAD_STACKS
+    rep_MARKVAL (THREAD (obj)->thunk);
+#endif
 }
 
 static void
@@ -1335,7 +1931,12 @@ sweep_thread (void)
     {
 	rep_thread *next = t->next_alloc;
 	if (!rep_GC_CELL_MARKEDP (rep_VAL (t)))
+	{
+#ifdef WITH_THREAD_STACKS
+	    free_stack (t);
+#endif
 	    rep_FREE_CELL (t);
+	}
 	else
 	{
 	    rep_GC_CLR_CELL (rep_VAL (t));
@@ -1644,7 +2245,7 @@ Returns true if the timeout was reached.
     rep_DECLARE1 (th, THREADP);
     rep_DECLARE2_OPT (msecs, rep_NUMERICP);
     timeout = (msecs == Qnil) ? 1 : rep_get_long_int (msecs);
-    thread_suspend (THREAD (th), timeout, 0, 0);
+    thread_suspend (THREAD (th), timeout);
     no_timeout = THREAD (th)->exit_val;
     THREAD (th)->exit_val = rep_NULL;
     return no_timeout == Qnil ? Qt : Qnil;
@@ -1653,15 +2254,6 @@ Returns true if the timeout was reached.
 #endif
 }
 
-#ifdef WITH_CONTINUATIONS
-static rep_bool
-thread_join_poller (rep_thread *t, void *arg)
-{
-    rep_thread *th = arg;
-    return (th->car & TF_EXITED) ? rep_TRUE : rep_FALSE;
-}
-#endif
-
 DEFUN("thread-join", Fthread_join,
       Sthread_join, (repv th, repv msecs, repv def), rep_Subr3) /*
 ::doc:rep.threads#thread-join::
@@ -1682,13 +2274,18 @@ current dynamic root.
     if (THREADP (self))
     {
 	rep_GC_root gc_th;
-	rep_PUSHGC (gc_th, th);
 	rep_DECLARE2_OPT (msecs, rep_NUMERICP);
-	thread_suspend (THREAD (self),
-			rep_get_long_int (msecs),
-			thread_join_poller, THREAD (th));
+	if (!(THREAD (th)->car & TF_EXITED))
+	{
+	    /* thread_delete () will wake us */
+	    THREAD (self)->joining = THREAD (th);
+	    THREAD (self)->next_joiner = THREAD (th)->joiners;
+	    THREAD (th)->joiners = THREAD (self);
+	    rep_PUSHGC (gc_th, th);
+	    thread_suspend (THREAD (self), rep_get_long_int (msecs));
+	    rep_POPGC;
+	}
 	THREAD (self)->exit_val = rep_NULL;
-	rep_POPGC;
 	if ((THREAD (th)->car & TF_EXITED) && THREAD (th)->exit_val)
 	    return THREAD (th)->exit_val;
     }
@@ -1764,6 +2361,19 @@ Return `t' if THREAD has exited.
 #endif
 }
 
+/* The running thread, or nil before any threads have been used. Unlike
+   current-thread this never makes the default thread, so the profiler
+   may call it when sampling */
+repv
+rep_running_thread (void)
+{
+#ifdef WITH_CONTINUATIONS
+    if (root_barrier != 0 && root_barrier->active != 0)
+	return rep_VAL (root_barrier->active);
+#endif
+    return Qnil;
+}
+
 DEFUN("current-thread", Fcurrent_thread,
       Scurrent_thread, (repv depth), rep_Subr1) /*
 ::doc:rep.threads#current-thread::
@@ -1816,10 +2426,16 @@ Return a list of all threads.
     {
 	repv out = Qnil;
 	rep_thread *ptr;
+	int i;
 	for (ptr = root->susp_tail; ptr != 0; ptr = ptr->pred)
 	    out = Fcons (rep_VAL (ptr), out);
-	for (ptr = root->tail; ptr != 0; ptr = ptr->pred)
-	    out = Fcons (rep_VAL (ptr), out);
+	for (i = 0; i < THREAD_PRIORITIES; i++)
+	{
+	    for (ptr = root->runq[i].tail; ptr != 0; ptr = ptr->pred)
+		out = Fcons (rep_VAL (ptr), out);
+	}
+	if (root->active != 0)
+	    out = Fcons (rep_VAL (root->active), out);
 	return out;
     }
 #else
@@ -1868,6 +2484,65 @@ Return the name of the thread THREAD.
 #endif
 }
 
+DEFUN("thread-priority", Fthread_priority,
+      Sthread_priority, (repv th), rep_Subr1) /*
+::doc:rep.threads#thread-priority::
+thread-priority [THREAD]
+
+Return the scheduling priority of THREAD (or the current thread), an
+integer between zero and seven.
+::end:: */
+{
+#ifdef WITH_CONTINUATIONS
+    if (th == Qnil)
+	th = Fcurrent_thread (Qnil);
+    rep_DECLARE1 (th, XTHREADP);
+    return rep_MAKE_INT (THREAD (th)->priority);
+#else
+    return rep_signal_arg_error (th, 1);
+#endif
+}
+
+DEFUN("set-thread-priority", Fset_thread_priority,
+      Sset_thread_priority, (repv th, repv priority), rep_Subr2) /*
+::doc:rep.threads#set-thread-priority::
+set-thread-priority THREAD PRIORITY
+
+Set the scheduling priority of THREAD (or the current thread) to
+PRIORITY, an integer between zero and seven. A runnable thread is only
+switched to when no thread with a higher priority is runnable. New
+threads inherit the priority of the thread that created them; four is
+the default.
+
+The change takes effect the next time the current thread yields.
+::end:: */
+{
+#ifdef WITH_CONTINUATIONS
+    if (th == Qnil)
+	th = Fcurrent_thread (Qnil);
+    rep_DECLARE1 (th, THREADP);
+    rep_DECLARE (2, priority, rep_INTP (priority) && rep_INT (priority) >= 0
+		 && rep_INT (priority) < THREAD_PRIORITIES);
+    thread_set_priority (THREAD (th), rep_INT (priority));
+    return priority;
+#else
+    return rep_signal_arg_error (th, 1);
+#endif
+}
+
+DEFUN("thread-stack-size", Fthread_stack_size,
+      Sthread_stack_size, (repv arg), rep_Subr1) /*
+::doc:rep.threads#thread-stack-size::
+thread-stack-size [NEW-VALUE]
+
+The number of bytes of stack given to each new thread, on systems where
+threads are given stacks of their own instead of copying them in and
+out of a single stack as they're switched between.
+::end:: */
+{
+    return rep_handle_var_int (arg, &thread_stack_size);
+}
+
 
 /* dl hooks */
 
@@ -1906,5 +2581,8 @@ rep_continuations_init (void)
     rep_ADD_SUBR(Sthread_forbid);
     rep_ADD_SUBR(Sthread_permit);
     rep_ADD_SUBR(Sthread_name);
+    rep_ADD_SUBR(Sthread_priority);
+    rep_ADD_SUBR(Sset_thread_priority);
+    rep_ADD_SUBR(Sthread_stack_size);
     rep_pop_structure (tem);
 }
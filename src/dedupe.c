@@ -0,0 +1,193 @@
+/* dedupe.c -- coalescing identical constants of compiled code
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.	If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Commentary:
+
+   Each compiled function has its own copies of its constants, so the
+   same strings and quoted lists turn up many times over once a few
+   files are loaded. Since literal constants mustn't be modified, the
+   constants vectors of byte-code subrs may share a single copy of
+   each (as Common Lisp lets compile-file coalesce similar constants);
+   only their identity changes.
+
+   Strings, and lists whose leaves are strings, symbols and fixnums,
+   are coalesced. The canonical copies are kept in a weak hash set,
+   open addressed with linear probing, which is rebuilt without the
+   dead entries after each GC. Constants are coalesced as compiled code
+   is read (from fasl data or by the reader) when
+   `dedupe-loaded-constants' is true, and for all the byte-code in the
+   heap by `dedupe-heap' (in values.c). */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include <string.h>
+
+/* Lists with more cells than this aren't worth hashing */
+#define MAX_CONSTANT_CELLS 256
+
+struct canon {
+    repv obj;				/* zero if empty */
+    unsigned long hash;
+};
+
+static struct canon *canon_set;
+static unsigned long canon_size, canon_count;	/* size a power of two */
+
+DEFSYM(dedupe_loaded_constants, "dedupe-loaded-constants");
+
+/* Add the hash of constant X to *H, returning false if X can't be
+   coalesced. *CELLS counts the conses seen, bounding the work done
+   (and stopping at circular lists). */
+static rep_bool
+hash_constant (repv x, unsigned long *h, int *cells)
+{
+    while (rep_CONSP (x))
+    {
+	if (++*cells > MAX_CONSTANT_CELLS
+	    || !hash_constant (rep_CAR (x), h, cells))
+	{
+	    return rep_FALSE;
+	}
+	*h = *h * 31 + 1;
+	x = rep_CDR (x);
+    }
+    if (rep_STRINGP (x))
+    {
+	const unsigned char *p = (const unsigned char *) rep_STR (x);
+	long i, len = rep_STRING_LEN (x);
+	for (i = 0; i < len; i++)
+	    *h = *h * 33 + p[i];
+	return rep_TRUE;
+    }
+    else if (rep_INTP (x) || rep_SYMBOLP (x) || x == Qnil)
+    {
+	/* symbols by address, the collector doesn't move objects */
+	*h = *h * 31 + (unsigned long) x;
+	return rep_TRUE;
+    }
+    else
+	return rep_FALSE;
+}
+
+/* Move the canonical constants to a set of NEW_SIZE slots, dropping
+   those that won't survive the current collection if SWEEP */
+static rep_bool
+canon_rehash (unsigned long new_size, rep_bool sweep)
+{
+    struct canon *set = rep_alloc (sizeof (struct canon) * new_size);
+    unsigned long i;
+    if (set == 0)
+	return rep_FALSE;
+    memset (set, 0, sizeof (struct canon) * new_size);
+    canon_count = 0;
+    for (i = 0; i < canon_size; i++)
+    {
+	unsigned long j;
+	if (canon_set[i].obj == 0
+	    || (sweep && !rep_gc_live_p (canon_set[i].obj)))
+	{
+	    continue;
+	}
+	for (j = canon_set[i].hash & (new_size - 1); set[j].obj != 0;
+	     j = (j + 1) & (new_size - 1))
+	    ;
+	set[j] = canon_set[i];
+	canon_count++;
+    }
+    if (canon_set != 0)
+	rep_free (canon_set);
+    canon_set = set;
+    canon_size = new_size;
+    return rep_TRUE;
+}
+
+static rep_bool
+canon_trace (void)
+{
+    return rep_FALSE;
+}
+
+static void
+canon_clear (void)
+{
+    if (canon_set != 0)
+	canon_rehash (canon_size, rep_TRUE);
+}
+
+/* Return the canonical copy of constant X, which becomes it if there
+   isn't one already. Anything that can't be coalesced is returned
+   unchanged. */
+static repv
+canonical_constant (repv x)
+{
+    unsigned long h = 0, i;
+    int cells = 0;
+
+    if (!(rep_STRINGP (x) || rep_CONSP (x)) || !hash_constant (x, &h, &cells))
+	return x;
+
+    if (2 * (canon_count + 1) > canon_size
+	&& !canon_rehash (canon_size != 0 ? canon_size * 2 : 256, rep_FALSE))
+    {
+	return x;
+    }
+
+    for (i = h & (canon_size - 1); canon_set[i].obj != 0;
+	 i = (i + 1) & (canon_size - 1))
+    {
+	if (canon_set[i].obj == x
+	    || (canon_set[i].hash == h
+		&& rep_TYPE (canon_set[i].obj) == rep_TYPE (x)
+		&& rep_value_cmp (canon_set[i].obj, x) == 0))
+	{
+	    return canon_set[i].obj;
+	}
+    }
+    canon_set[i].obj = x;
+    canon_set[i].hash = h;
+    canon_count++;
+    return x;
+}
+
+/* Replace the constants of byte-code subr COMPILED by their canonical
+   copies. No Lisp data is allocated, so this may be called while
+   walking the heap. */
+void
+rep_dedupe_constants (repv compiled)
+{
+    repv consts = rep_COMPILED_CONSTANTS (compiled);
+    int i;
+
+    if (!rep_VECTORP (consts) || rep_CELL_STATIC_P (consts))
+	return;
+
+    for (i = 0; i < rep_VECT_LEN (consts); i++)
+	rep_VECTI (consts, i) = canonical_constant (rep_VECTI (consts, i));
+}
+
+void
+rep_dedupe_init (void)
+{
+    repv tem = rep_push_structure ("rep.data");
+    rep_INTERN_SPECIAL (dedupe_loaded_constants);
+    Fset (Qdedupe_loaded_constants, Qnil);
+    rep_pop_structure (tem);
+
+    rep_add_weak_hooks (canon_trace, canon_clear);
+}
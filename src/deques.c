@@ -0,0 +1,557 @@
+/* deques.c -- native double-ended queues and ring buffers
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.	If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Commentary:
+
+   A deque holds its elements in a circular array whose size is a
+   power of two, so adding or removing an element at either end is an
+   index update and a store, with no consing. The array doubles in
+   size when full. A deque made with a fixed capacity is a ring
+   buffer: it never grows, adding an element to a full one discards
+   the element at the other end.
+
+   rep.data.queues and rep.data.ring are built on these. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include <string.h>
+
+typedef struct deque_struct deque;
+struct deque_struct {
+    repv car;
+    deque *next;
+    repv *data;
+    unsigned long size;			/* a power of two, or zero */
+    unsigned long head;			/* index of the front element */
+    unsigned long count;
+    unsigned long limit;		/* fixed capacity, or zero */
+};
+
+#define DEQUEP(v) rep_CELL16_TYPEP(v, deque_type)
+#define DEQUE(v)  ((deque *) rep_PTR(v))
+
+/* The slot holding element I of deque D, counting from the front */
+#define SLOT(d, i) ((d)->data[((d)->head + (i)) & ((d)->size - 1)])
+
+#define MIN_SIZE 8
+
+/* The largest power of two that can be an array size without its
+   length in bytes overflowing */
+#define MAX_SIZE ((~0UL / 2 + 1) / sizeof (repv))
+
+static int deque_type;
+static deque *all_deques;
+
+DEFSTRING (deque_empty, "Deque is empty");
+
+/* Make the array of D hold at least SIZE elements, keeping the existing
+   ones in order from the start. Returns false, with no-memory
+   signalled, if that can't be done. */
+static rep_bool
+resize (deque *d, unsigned long size)
+{
+    unsigned long new_size = MIN_SIZE, i;
+    repv *data = 0;
+
+    if (size <= MAX_SIZE)
+    {
+	while (new_size < size)
+	    new_size *= 2;
+	data = rep_alloc (new_size * sizeof (repv));
+    }
+    if (data == 0)
+    {
+	/* the size may have come from Lisp, so don't abort */
+	Fsignal (Qno_memory, Qnil);
+	return rep_FALSE;
+    }
+    for (i = 0; i < d->count; i++)
+	data[i] = SLOT (d, i);
+    if (d->data != 0)
+	rep_free (d->data);
+    rep_data_after_gc += (new_size - d->size) * sizeof (repv);
+    d->data = data;
+    d->size = new_size;
+    d->head = 0;
+    return rep_TRUE;
+}
+
+/* Make room for one more element in D. Returns false if it can't
+   grow; a full ring buffer is left full. */
+static rep_bool
+ensure_room (deque *d)
+{
+    if (d->count < d->size)
+	return rep_TRUE;
+    if (d->limit != 0 && d->count >= d->limit)
+	return rep_TRUE;
+    return resize (d, d->count + 1);
+}
+
+static repv
+make_deque (unsigned long size, unsigned long limit)
+{
+    deque *d = rep_ALLOC_CELL (sizeof (deque));
+    if (d == 0)
+	return rep_mem_error ();
+    d->car = deque_type;
+    d->data = 0;
+    d->size = d->head = d->count = 0;
+    d->limit = limit;
+    if (!resize (d, limit != 0 ? limit : size))
+    {
+	rep_FREE_CELL (d);
+	return rep_NULL;
+    }
+    d->next = all_deques;
+    all_deques = d;
+    rep_data_after_gc += sizeof (deque);
+    return rep_VAL (d);
+}
+
+static repv
+pop_front (deque *d)
+{
+    repv x = d->data[d->head];
+    d->data[d->head] = Qnil;
+    d->head = (d->head + 1) & (d->size - 1);
+    d->count--;
+    return x;
+}
+
+static repv
+pop_back (deque *d)
+{
+    repv x = SLOT (d, d->count - 1);
+    SLOT (d, d->count - 1) = Qnil;
+    d->count--;
+    return x;
+}
+
+static rep_bool
+push_back (deque *d, repv x)
+{
+    if (!ensure_room (d))
+	return rep_FALSE;
+    if (d->limit != 0 && d->count == d->limit)
+	pop_front (d);
+    SLOT (d, d->count) = x;
+    d->count++;
+    return rep_TRUE;
+}
+
+static rep_bool
+push_front (deque *d, repv x)
+{
+    if (!ensure_room (d))
+	return rep_FALSE;
+    if (d->limit != 0 && d->count == d->limit)
+	pop_back (d);
+    d->head = (d->head - 1) & (d->size - 1);
+    d->data[d->head] = x;
+    d->count++;
+    return rep_TRUE;
+}
+
+
+/* type hooks */
+
+static int
+deque_cmp (repv d1, repv d2)
+{
+    unsigned long i;
+    if (!DEQUEP (d1) || !DEQUEP (d2)
+	|| DEQUE (d1)->count != DEQUE (d2)->count)
+	return 1;
+    for (i = 0; i < DEQUE (d1)->count; i++)
+    {
+	int tem = rep_value_cmp (SLOT (DEQUE (d1), i), SLOT (DEQUE (d2), i));
+	if (tem != 0)
+	    return tem;
+    }
+    return 0;
+}
+
+static void
+deque_print (repv stream, repv arg)
+{
+    char buf[64];
+#ifdef HAVE_SNPRINTF
+    snprintf (buf, sizeof (buf), "#<deque %lu>", DEQUE (arg)->count);
+#else
+    sprintf (buf, "#<deque %lu>", DEQUE (arg)->count);
+#endif
+    rep_stream_puts (stream, buf, -1, rep_FALSE);
+}
+
+static void
+deque_mark (repv arg)
+{
+    deque *d = DEQUE (arg);
+    unsigned long i;
+    for (i = 0; i < d->count; i++)
+	rep_MARKVAL (SLOT (d, i));
+}
+
+static void
+deque_sweep (void)
+{
+    deque *x = all_deques;
+    all_deques = 0;
+    while (x != 0)
+    {
+	deque *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (x)))
+	{
+	    if (x->data != 0)
+		rep_free (x->data);
+	    rep_FREE_CELL (x);
+	}
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (x));
+	    x->next = all_deques;
+	    all_deques = x;
+	}
+	x = next;
+    }
+}
+
+
+/* lisp functions */
+
+DEFUN ("make-deque", Fmake_deque, Smake_deque,
+       (repv capacity, repv fixed), rep_Subr2) /*
+::doc:rep.data#make-deque::
+make-deque [CAPACITY] [FIXED]
+
+Return a new, empty, double-ended queue. CAPACITY is the number of
+elements to allocate space for; the deque grows as needed.
+
+If FIXED is true the deque is a ring buffer holding at most CAPACITY
+elements: adding an element to a full ring buffer discards the element
+at the other end.
+::end:: */
+{
+    long size = 0;
+    if (capacity != Qnil)
+    {
+	rep_DECLARE1 (capacity, rep_INTP);
+	size = rep_INT (capacity);
+    }
+    if (size < 0 || (unsigned long) size > MAX_SIZE
+	|| (fixed != Qnil && size == 0))
+    {
+	return rep_signal_arg_error (capacity, 1);
+    }
+    return make_deque (size, fixed != Qnil ? size : 0);
+}
+
+DEFUN ("dequep", Fdequep, Sdequep, (repv arg), rep_Subr1) /*
+::doc:rep.data#dequep::
+dequep ARG
+
+Return `t' if ARG is a deque.
+::end:: */
+{
+    return DEQUEP (arg) ? Qt : Qnil;
+}
+
+DEFUN ("deque-length", Fdeque_length, Sdeque_length,
+       (repv d), rep_Subr1) /*
+::doc:rep.data#deque-length::
+deque-length DEQUE
+
+Return the number of elements in DEQUE.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    return rep_MAKE_INT (DEQUE (d)->count);
+}
+
+DEFUN ("deque-empty-p", Fdeque_empty_p, Sdeque_empty_p,
+       (repv d), rep_Subr1) /*
+::doc:rep.data#deque-empty-p::
+deque-empty-p DEQUE
+
+Return `t' if DEQUE has no elements.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    return DEQUE (d)->count == 0 ? Qt : Qnil;
+}
+
+DEFUN ("deque-capacity", Fdeque_capacity, Sdeque_capacity,
+       (repv d), rep_Subr1) /*
+::doc:rep.data#deque-capacity::
+deque-capacity DEQUE
+
+Return the number of elements that DEQUE can hold if it's a ring
+buffer, or false if it grows as needed.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    return DEQUE (d)->limit != 0 ? rep_MAKE_INT (DEQUE (d)->limit) : Qnil;
+}
+
+DEFUN ("deque-push-back", Fdeque_push_back, Sdeque_push_back,
+       (repv d, repv x), rep_Subr2) /*
+::doc:rep.data#deque-push-back::
+deque-push-back DEQUE OBJECT
+
+Add OBJECT to the back of DEQUE. Returns OBJECT.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    return push_back (DEQUE (d), x) ? x : rep_NULL;
+}
+
+DEFUN ("deque-push-front", Fdeque_push_front, Sdeque_push_front,
+       (repv d, repv x), rep_Subr2) /*
+::doc:rep.data#deque-push-front::
+deque-push-front DEQUE OBJECT
+
+Add OBJECT to the front of DEQUE. Returns OBJECT.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    return push_front (DEQUE (d), x) ? x : rep_NULL;
+}
+
+DEFUN ("deque-pop-front", Fdeque_pop_front, Sdeque_pop_front,
+       (repv d), rep_Subr1) /*
+::doc:rep.data#deque-pop-front::
+deque-pop-front DEQUE
+
+Remove the element at the front of DEQUE and return it. Signals an
+error if DEQUE is empty.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    if (DEQUE (d)->count == 0)
+	return Fsignal (Qerror, rep_list_2 (rep_VAL (&deque_empty), d));
+    return pop_front (DEQUE (d));
+}
+
+DEFUN ("deque-pop-back", Fdeque_pop_back, Sdeque_pop_back,
+       (repv d), rep_Subr1) /*
+::doc:rep.data#deque-pop-back::
+deque-pop-back DEQUE
+
+Remove the element at the back of DEQUE and return it. Signals an
+error if DEQUE is empty.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    if (DEQUE (d)->count == 0)
+	return Fsignal (Qerror, rep_list_2 (rep_VAL (&deque_empty), d));
+    return pop_back (DEQUE (d));
+}
+
+DEFUN ("deque-ref", Fdeque_ref, Sdeque_ref,
+       (repv d, repv index), rep_Subr2) /*
+::doc:rep.data#deque-ref::
+deque-ref DEQUE INDEX
+
+Return element INDEX of DEQUE, the front element being at index zero.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    rep_DECLARE (2, index, rep_INTP (index) && rep_INT (index) >= 0
+		 && (unsigned long) rep_INT (index) < DEQUE (d)->count);
+    return SLOT (DEQUE (d), rep_INT (index));
+}
+
+DEFUN ("deque-set", Fdeque_set, Sdeque_set,
+       (repv d, repv index, repv x), rep_Subr3) /*
+::doc:rep.data#deque-set::
+deque-set DEQUE INDEX OBJECT
+
+Replace element INDEX of DEQUE, counting from zero at the front, with
+OBJECT. Returns OBJECT.
+::end:: */
+{
+    rep_DECLARE1 (d, DEQUEP);
+    rep_DECLARE (2, index, rep_INTP (index) && rep_INT (index) >= 0
+		 && (unsigned long) rep_INT (index) < DEQUE (d)->count);
+    SLOT (DEQUE (d), rep_INT (index)) = x;
+    return x;
+}
+
+DEFUN ("deque->list", Fdeque_to_list, Sdeque_to_list,
+       (repv d), rep_Subr1) /*
+::doc:rep.data#deque->list::
+deque->list DEQUE
+
+Return a new list of the elements of DEQUE, from front to back.
+::end:: */
+{
+    repv lst = Qnil;
+    unsigned long i;
+    rep_DECLARE1 (d, DEQUEP);
+    for (i = DEQUE (d)->count; i > 0; i--)
+    {
+	lst = Fcons (SLOT (DEQUE (d), i - 1), lst);
+	if (lst == rep_NULL)
+	    break;
+    }
+    return lst;
+}
+
+DEFUN ("deque-push-vector", Fdeque_push_vector, Sdeque_push_vector,
+       (repv d, repv vec), rep_Subr2) /*
+::doc:rep.data#deque-push-vector::
+deque-push-vector DEQUE VECTOR
+
+Add each element of VECTOR to the back of DEQUE, in order. Returns
+DEQUE.
+::end:: */
+{
+    deque *x;
+    long i, n;
+
+    rep_DECLARE1 (d, DEQUEP);
+    rep_DECLARE2 (vec, rep_VECTORP);
+    x = DEQUE (d);
+    n = rep_VECT_LEN (vec);
+
+    if (x->limit == 0 && x->count + n > x->size
+	&& !resize (x, x->count + n))
+    {
+	return rep_NULL;
+    }
+    for (i = 0; i < n; i++)
+    {
+	if (!push_back (x, rep_VECTI (vec, i)))
+	    return rep_NULL;
+    }
+    return d;
+}
+
+DEFUN ("deque-pop-vector", Fdeque_pop_vector, Sdeque_pop_vector,
+       (repv d, repv count), rep_Subr2) /*
+::doc:rep.data#deque-pop-vector::
+deque-pop-vector DEQUE [COUNT]
+
+Remove up to COUNT elements from the front of DEQUE, or all of them if
+COUNT isn't given, returning them as a vector from front to back.
+::end:: */
+{
+    deque *x;
+    long i, n;
+    repv vec;
+
+    rep_DECLARE1 (d, DEQUEP);
+    x = DEQUE (d);
+    n = x->count;
+    if (count != Qnil)
+    {
+	rep_DECLARE (2, count, rep_INTP (count) && rep_INT (count) >= 0);
+	n = MIN (n, rep_INT (count));
+    }
+
+    vec = Fmake_vector (rep_MAKE_INT (n), Qnil);
+    if (vec == rep_NULL)
+	return rep_NULL;
+    for (i = 0; i < n; i++)
+	rep_VECTI (vec, i) = pop_front (x);
+    return vec;
+}
+
+DEFUN ("deque-delete", Fdeque_delete, Sdeque_delete,
+       (repv d, repv x), rep_Subr2) /*
+::doc:rep.data#deque-delete::
+deque-delete DEQUE OBJECT
+
+Remove every element of DEQUE that is `eq' to OBJECT. Returns the
+number of elements removed.
+::end:: */
+{
+    deque *q;
+    unsigned long i, j;
+
+    rep_DECLARE1 (d, DEQUEP);
+    q = DEQUE (d);
+    for (i = j = 0; i < q->count; i++)
+    {
+	repv elt = SLOT (q, i);
+	if (elt != x)
+	{
+	    if (i != j)
+		SLOT (q, j) = elt;
+	    j++;
+	}
+    }
+    for (i = j; i < q->count; i++)
+	SLOT (q, i) = Qnil;
+    i = q->count - j;
+    q->count = j;
+    return rep_MAKE_INT (i);
+}
+
+DEFUN ("deque-clear", Fdeque_clear, Sdeque_clear, (repv d), rep_Subr1) /*
+::doc:rep.data#deque-clear::
+deque-clear DEQUE
+
+Remove all elements from DEQUE. Returns DEQUE.
+::end:: */
+{
+    deque *x;
+    unsigned long i;
+
+    rep_DECLARE1 (d, DEQUEP);
+    x = DEQUE (d);
+    for (i = 0; i < x->count; i++)
+	SLOT (x, i) = Qnil;
+    x->count = x->head = 0;
+    return d;
+}
+
+
+/* init */
+
+void
+rep_deques_init (void)
+{
+    repv tem;
+
+    deque_type = rep_register_new_type ("deque", deque_cmp,
+					deque_print, deque_print,
+					deque_sweep, deque_mark,
+					0, 0, 0, 0, 0, 0, 0);
+
+    tem = rep_push_structure ("rep.data");
+    rep_ADD_SUBR (Smake_deque);
+    rep_ADD_SUBR (Sdequep);
+    rep_ADD_SUBR (Sdeque_length);
+    rep_ADD_SUBR (Sdeque_empty_p);
+    rep_ADD_SUBR (Sdeque_capacity);
+    rep_ADD_SUBR (Sdeque_push_back);
+    rep_ADD_SUBR (Sdeque_push_front);
+    rep_ADD_SUBR (Sdeque_pop_front);
+    rep_ADD_SUBR (Sdeque_pop_back);
+    rep_ADD_SUBR (Sdeque_ref);
+    rep_ADD_SUBR (Sdeque_set);
+    rep_ADD_SUBR (Sdeque_to_list);
+    rep_ADD_SUBR (Sdeque_push_vector);
+    rep_ADD_SUBR (Sdeque_pop_vector);
+    rep_ADD_SUBR (Sdeque_delete);
+    rep_ADD_SUBR (Sdeque_clear);
+    rep_pop_structure (tem);
+}
@@ -0,0 +1,672 @@
+/* fasl.c -- Binary format for compiled Lisp files
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* A fasl file holds the same forms as a compiled .jlc file, but in a
+   form that can be decoded without going through the reader. It is
+
+	MAGIC SYMBOL-COUNT SYMBOL... OBJECT...
+
+   where MAGIC is the line `rep-fasl 1', and each SYMBOL is a flags
+   byte (FASL_SYM_KEYWORD or zero) followed by the length and bytes of
+   its name. Each OBJECT is a tag byte, then:
+
+	FASL_INT	the fixnum, zigzag encoded
+	FASL_STRING	the length, then that many bytes
+	FASL_SYMBOL	the index of the symbol in the symbol table
+	FASL_NIL	nothing
+	FASL_LIST	the number of elements N, then N objects, then the
+			final cdr
+	FASL_VECTOR	the length N, then N objects
+	FASL_COMPILED	as FASL_VECTOR, for a byte-code subr
+	FASL_READ	as FASL_STRING, the printed representation of the
+			object, for anything else (floats, bignums,
+			uninterned symbols...)
+
+   All counts and lengths are unsigned integers written seven bits
+   at a time, least significant first, with the top bit of each byte
+   set if more follow. The top-level objects run to the end of the
+   file, and are evaluated in order by `load'. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include <string.h>
+
+enum fasl_tag {
+    FASL_INT = 1,
+    FASL_STRING,
+    FASL_SYMBOL,
+    FASL_NIL,
+    FASL_LIST,
+    FASL_VECTOR,
+    FASL_COMPILED,
+    FASL_READ
+};
+
+#define FASL_SYM_KEYWORD 1
+
+DEFSTRING(invalid_fasl, "Invalid fasl data");
+
+
+/* writing */
+
+struct fasl_writer {
+    unsigned char *data;
+    size_t length, allocated;
+    rep_bool failed;
+
+    /* interned symbols seen, keyed by address, with their indices */
+    struct fasl_sym {
+	repv symbol;
+	unsigned long index;
+    } *syms;
+    unsigned long n_syms, syms_size;
+};
+
+static unsigned char *
+reserve (struct fasl_writer *w, size_t n)
+{
+    if (w->length + n > w->allocated)
+    {
+	size_t size = MAX (w->allocated * 2, w->length + n + 1024);
+	unsigned char *new = rep_realloc (w->data, size);
+	if (new == 0)
+	{
+	    w->failed = rep_TRUE;
+	    return 0;
+	}
+	w->data = new;
+	w->allocated = size;
+    }
+    return w->data + w->length;
+}
+
+static void
+put_bytes (struct fasl_writer *w, const void *bytes, size_t n)
+{
+    unsigned char *ptr = reserve (w, n);
+    if (ptr != 0)
+    {
+	memcpy (ptr, bytes, n);
+	w->length += n;
+    }
+}
+
+static void
+put_byte (struct fasl_writer *w, int byte)
+{
+    unsigned char c = byte;
+    put_bytes (w, &c, 1);
+}
+
+static void
+put_uint (struct fasl_writer *w, unsigned long x)
+{
+    unsigned char buf[sizeof (x) * 8 / 7 + 1];
+    int i = 0;
+    do {
+	buf[i] = x & 0x7f;
+	x >>= 7;
+	if (x != 0)
+	    buf[i] |= 0x80;
+	i++;
+    } while (x != 0);
+    put_bytes (w, buf, i);
+}
+
+static inline rep_bool
+symbol_in_table_p (repv sym)
+{
+    /* uninterned symbols are written in printed form, just as in the
+       text format */
+    return rep_SYM (sym)->next != rep_NULL;
+}
+
+#define SYM_HASH(x, size) (((x) >> 3) & ((size) - 1))
+
+/* Return the entry for symbol SYM in W's table, adding it if
+   necessary, or null if there's no memory. */
+static struct fasl_sym *
+symbol_entry (struct fasl_writer *w, repv sym)
+{
+    unsigned long i;
+    if ((w->n_syms + 1) * 2 > w->syms_size)
+    {
+	unsigned long old_size = w->syms_size, j;
+	unsigned long size = MAX (old_size * 2, 32);
+	struct fasl_sym *new = rep_alloc (size * sizeof (*new)), *old;
+	if (new == 0)
+	{
+	    w->failed = rep_TRUE;
+	    return 0;
+	}
+	memset (new, 0, size * sizeof (*new));
+	for (j = 0; j < old_size; j++)
+	{
+	    if (w->syms[j].symbol != 0)
+	    {
+		i = SYM_HASH (w->syms[j].symbol, size);
+		while (new[i].symbol != 0)
+		    i = (i + 1) & (size - 1);
+		new[i] = w->syms[j];
+	    }
+	}
+	old = w->syms;
+	w->syms = new;
+	w->syms_size = size;
+	rep_free (old);
+    }
+    i = SYM_HASH (sym, w->syms_size);
+    while (w->syms[i].symbol != 0 && w->syms[i].symbol != sym)
+	i = (i + 1) & (w->syms_size - 1);
+    if (w->syms[i].symbol == 0)
+    {
+	w->syms[i].symbol = sym;
+	w->syms[i].index = w->n_syms++;
+    }
+    return &w->syms[i];
+}
+
+/* Add every symbol in OBJ to W's table */
+static void
+collect_symbols (struct fasl_writer *w, repv obj)
+{
+    while (!w->failed)
+    {
+	switch (rep_TYPE (obj))
+	{
+	    int i;
+
+	case rep_Symbol:
+	    if (obj != Qnil && symbol_in_table_p (obj))
+		symbol_entry (w, obj);
+	    return;
+
+	case rep_Cons:
+	    collect_symbols (w, rep_CAR (obj));
+	    obj = rep_CDR (obj);
+	    continue;
+
+	case rep_Vector: case rep_Compiled:
+	    for (i = 0; i < rep_VECT_LEN (obj); i++)
+		collect_symbols (w, rep_VECTI (obj, i));
+	    return;
+
+	default:
+	    return;
+	}
+    }
+}
+
+static void
+write_printed (struct fasl_writer *w, repv obj)
+{
+    repv stream = Fmake_string_output_stream (Qnil, Qnil), string;
+    if (stream == rep_NULL)
+    {
+	w->failed = rep_TRUE;
+	return;
+    }
+    rep_print_val (stream, obj);
+    string = Fget_output_stream_string (stream);
+    if (string == rep_NULL)
+    {
+	w->failed = rep_TRUE;
+	return;
+    }
+    put_byte (w, FASL_READ);
+    put_uint (w, rep_STRING_LEN (string));
+    put_bytes (w, rep_STR (string), rep_STRING_LEN (string));
+}
+
+static void
+write_object (struct fasl_writer *w, repv obj)
+{
+    if (w->failed)
+	return;
+
+    switch (rep_TYPE (obj))
+    {
+	int i, n;
+	repv tem;
+
+    case rep_Int:
+	{
+	    rep_PTR_SIZED_INT x = rep_INT (obj);
+	    put_byte (w, FASL_INT);
+	    put_uint (w, (x < 0) ? ((unsigned long) ~x << 1) | 1
+		      : (unsigned long) x << 1);
+	}
+	break;
+
+    case rep_String:
+	put_byte (w, FASL_STRING);
+	put_uint (w, rep_STRING_LEN (obj));
+	put_bytes (w, rep_STR (obj), rep_STRING_LEN (obj));
+	break;
+
+    case rep_Symbol:
+	if (obj == Qnil)
+	    put_byte (w, FASL_NIL);
+	else if (symbol_in_table_p (obj))
+	{
+	    struct fasl_sym *s = symbol_entry (w, obj);
+	    if (s != 0)
+	    {
+		put_byte (w, FASL_SYMBOL);
+		put_uint (w, s->index);
+	    }
+	}
+	else
+	    write_printed (w, obj);
+	break;
+
+    case rep_Cons:
+	n = 0;
+	for (tem = obj; rep_CONSP (tem); tem = rep_CDR (tem))
+	    n++;
+	put_byte (w, FASL_LIST);
+	put_uint (w, n);
+	for (tem = obj; rep_CONSP (tem); tem = rep_CDR (tem))
+	    write_object (w, rep_CAR (tem));
+	write_object (w, tem);
+	break;
+
+    case rep_Vector: case rep_Compiled:
+	for (i = 0; i < rep_VECT_LEN (obj); i++)
+	{
+	    if (rep_VECTI (obj, i) == rep_NULL)
+	    {
+		/* printed as #<void>, which can't be read back */
+		write_printed (w, obj);
+		return;
+	    }
+	}
+	put_byte (w, rep_VECTORP (obj) ? FASL_VECTOR : FASL_COMPILED);
+	put_uint (w, rep_VECT_LEN (obj));
+	for (i = 0; i < rep_VECT_LEN (obj); i++)
+	    write_object (w, rep_VECTI (obj, i));
+	break;
+
+    default:
+	write_printed (w, obj);
+    }
+}
+
+DEFUN("write-fasl", Fwrite_fasl, Swrite_fasl,
+      (repv stream, repv forms), rep_Subr2) /*
+::doc:rep.io.files#write-fasl::
+write-fasl STREAM FORMS
+
+Write the list of Lisp objects FORMS to STREAM in the binary fasl
+format, which `load' reads more quickly than printed objects. Loading
+the result evaluates each of the FORMS in turn.
+
+If STREAM is false, the data is returned as a string instead (see
+`read-fasl-string').
+::end:: */
+{
+    struct fasl_writer w;
+    repv tem;
+    unsigned long i;
+    repv *table;
+    int written;
+
+    rep_DECLARE2 (forms, rep_LISTP);
+
+    memset (&w, 0, sizeof (w));
+    for (tem = forms; rep_CONSP (tem); tem = rep_CDR (tem))
+	collect_symbols (&w, rep_CAR (tem));
+
+    put_bytes (&w, rep_FASL_MAGIC, sizeof (rep_FASL_MAGIC) - 1);
+    put_uint (&w, w.n_syms);
+
+    /* output the symbols in index order */
+    table = rep_alloc (MAX (w.n_syms, 1) * sizeof (repv));
+    if (table == 0)
+	w.failed = rep_TRUE;
+    else
+    {
+	for (i = 0; i < w.syms_size; i++)
+	{
+	    if (w.syms[i].symbol != 0)
+		table[w.syms[i].index] = w.syms[i].symbol;
+	}
+	for (i = 0; i < w.n_syms; i++)
+	{
+	    repv name = rep_SYM (table[i])->name;
+	    put_byte (&w, rep_KEYWORDP (table[i]) ? FASL_SYM_KEYWORD : 0);
+	    put_uint (&w, rep_STRING_LEN (name));
+	    put_bytes (&w, rep_STR (name), rep_STRING_LEN (name));
+	}
+	rep_free (table);
+    }
+
+    for (tem = forms; rep_CONSP (tem); tem = rep_CDR (tem))
+	write_object (&w, rep_CAR (tem));
+
+    rep_free (w.syms);
+    if (w.failed)
+    {
+	rep_free (w.data);
+	return rep_mem_error ();
+    }
+    if (stream == Qnil)
+    {
+	tem = rep_string_dupn ((char *) w.data, w.length);
+	rep_free (w.data);
+	return tem;
+    }
+    written = rep_stream_puts (stream, w.data, w.length, rep_FALSE);
+    rep_free (w.data);
+    return (written < 0 && rep_throw_value) ? rep_NULL : Qt;
+}
+
+
+/* reading */
+
+static rep_bool
+get_uint (rep_fasl_reader *r, unsigned long *out)
+{
+    unsigned long x = 0;
+    int shift = 0;
+    while (r->ptr < r->end && shift < (int) sizeof (x) * 8)
+    {
+	int c = *r->ptr++;
+	x |= (unsigned long) (c & 0x7f) << shift;
+	if (!(c & 0x80))
+	{
+	    *out = x;
+	    return rep_TRUE;
+	}
+	shift += 7;
+    }
+    return rep_FALSE;
+}
+
+static repv
+bad_fasl (void)
+{
+    return Fsignal (Qerror, rep_LIST_1 (rep_VAL (&invalid_fasl)));
+}
+
+static repv
+read_object (rep_fasl_reader *r)
+{
+    unsigned long n, i;
+    repv obj, *tail;
+    rep_GC_root gc_obj;
+
+    if (r->ptr >= r->end)
+	return bad_fasl ();
+
+    switch (*r->ptr++)
+    {
+    case FASL_INT:
+	if (!get_uint (r, &n))
+	    return bad_fasl ();
+	return rep_MAKE_INT ((n & 1) ? ~(rep_PTR_SIZED_INT) (n >> 1)
+			     : (rep_PTR_SIZED_INT) (n >> 1));
+
+    case FASL_STRING:
+	if (!get_uint (r, &n) || n > (unsigned long) (r->end - r->ptr))
+	    return bad_fasl ();
+	obj = rep_string_dupn ((const char *) r->ptr, n);
+	r->ptr += n;
+	return obj;
+
+    case FASL_SYMBOL:
+	if (!get_uint (r, &n) || n >= (unsigned long) rep_VECT_LEN (r->symbols))
+	    return bad_fasl ();
+	return rep_VECTI (r->symbols, n);
+
+    case FASL_NIL:
+	return Qnil;
+
+    case FASL_LIST:
+	if (!get_uint (r, &n))
+	    return bad_fasl ();
+	obj = Qnil;
+	tail = &obj;
+	rep_PUSHGC (gc_obj, obj);
+	for (i = 0; i <= n; i++)
+	{
+	    repv elt = read_object (r);
+	    if (elt == rep_NULL)
+	    {
+		rep_POPGC;
+		return rep_NULL;
+	    }
+	    if (i < n)
+	    {
+		*tail = Fcons (elt, Qnil);
+		tail = rep_CDRLOC (*tail);
+	    }
+	    else
+		*tail = elt;
+	}
+	rep_POPGC;
+	return obj;
+
+    case FASL_VECTOR:
+    case FASL_COMPILED:
+	{
+	    rep_bool compiled = r->ptr[-1] == FASL_COMPILED;
+	    if (!get_uint (r, &n) || n > (unsigned long) (r->end - r->ptr)
+		|| (compiled && n < rep_COMPILED_MIN_SLOTS))
+	    {
+		return bad_fasl ();
+	    }
+	    obj = compiled ? rep_make_compiled (n) : rep_make_vector (n);
+	    if (obj == rep_NULL)
+		return rep_mem_error ();
+	    for (i = 0; i < n; i++)
+		rep_VECTI (obj, i) = Qnil;
+	    rep_PUSHGC (gc_obj, obj);
+	    for (i = 0; i < n; i++)
+	    {
+		repv elt = read_object (r);
+		if (elt == rep_NULL)
+		{
+		    rep_POPGC;
+		    return rep_NULL;
+		}
+		rep_VECTI (obj, i) = elt;
+	    }
+	    rep_POPGC;
+	    if (compiled && !(rep_STRINGP (rep_COMPILED_CODE (obj))
+			      && rep_VECTORP (rep_COMPILED_CONSTANTS (obj))
+			      && rep_INTP (rep_COMPILED_STACK (obj))))
+	    {
+		return bad_fasl ();
+	    }
+	    if (compiled && r->dedupe)
+		rep_dedupe_constants (obj);
+	    return obj;
+	}
+
+    case FASL_READ:
+	if (!get_uint (r, &n) || n > (unsigned long) (r->end - r->ptr))
+	    return bad_fasl ();
+	obj = rep_string_dupn ((const char *) r->ptr, n);
+	r->ptr += n;
+	if (obj == rep_NULL)
+	    return rep_NULL;
+	obj = Fmake_string_input_stream (obj, Qnil);
+	return obj ? Fread (obj) : rep_NULL;
+
+    default:
+	return bad_fasl ();
+    }
+}
+
+/* Return true if the LENGTH bytes at DATA start with a fasl header */
+rep_bool
+rep_fasl_data_p (const char *data, size_t length)
+{
+    return (length >= sizeof (rep_FASL_MAGIC) - 1
+	    && memcmp (data, rep_FASL_MAGIC, sizeof (rep_FASL_MAGIC) - 1) == 0);
+}
+
+/* Prepare to read the fasl data of LENGTH bytes at DATA, which must
+   stay valid until reading is finished. The symbols are stored in
+   R->symbols, which the caller must protect from GC. Returns false
+   (with an error signalled) if the header is invalid. */
+rep_bool
+rep_fasl_open (rep_fasl_reader *r, const char *data, size_t length)
+{
+    unsigned long n, i;
+
+    r->ptr = (const unsigned char *) data + sizeof (rep_FASL_MAGIC) - 1;
+    r->end = (const unsigned char *) data + length;
+    r->symbols = Qnil;
+    r->dedupe = Fsymbol_value (Qdedupe_loaded_constants, Qt) != Qnil;
+
+    if (!rep_fasl_data_p (data, length) || !get_uint (r, &n)
+	|| n > (unsigned long) (r->end - r->ptr))
+    {
+	bad_fasl ();
+	return rep_FALSE;
+    }
+    r->symbols = rep_make_vector (n);
+    if (r->symbols == rep_NULL)
+    {
+	r->symbols = Qnil;
+	rep_mem_error ();
+	return rep_FALSE;
+    }
+    for (i = 0; i < n; i++)
+	rep_VECTI (r->symbols, i) = Qnil;
+
+    for (i = 0; i < n; i++)
+    {
+	unsigned long len;
+	int flags;
+	repv sym;
+	if (r->ptr >= r->end)
+	    goto bad;
+	flags = *r->ptr++;
+	if (!get_uint (r, &len) || len > (unsigned long) (r->end - r->ptr))
+	    goto bad;
+	sym = rep_intern_chars ((const char *) r->ptr, len,
+				(flags & FASL_SYM_KEYWORD)
+				? rep_keyword_obarray : rep_obarray);
+	if (sym == rep_NULL)
+	    return rep_FALSE;
+	if (flags & FASL_SYM_KEYWORD)
+	    rep_SYM (sym)->car |= rep_SF_KEYWORD;
+	rep_VECTI (r->symbols, i) = sym;
+	r->ptr += len;
+    }
+    return rep_TRUE;
+
+bad:
+    bad_fasl ();
+    return rep_FALSE;
+}
+
+/* Return the next top-level object from R, or null. If there are no
+   more objects, returns null without signalling an error. */
+repv
+rep_fasl_read (rep_fasl_reader *r)
+{
+    if (r->ptr >= r->end)
+	return rep_NULL;
+    return read_object (r);
+}
+
+
+/* Return the list of forms in the LENGTH bytes of fasl data at DATA.
+   These are all decoded before any are evaluated, since the file
+   being loaded may be rewritten meanwhile (e.g. when the compiler is
+   run from rep.user) */
+repv
+rep_read_fasl (const char *data, size_t length)
+{
+    repv forms = Qnil, tem;
+    rep_GC_root gc_symbols, gc_forms;
+    rep_fasl_reader r;
+
+    if (!rep_fasl_open (&r, data, length))
+	return rep_NULL;
+
+    rep_PUSHGC (gc_symbols, r.symbols);
+    rep_PUSHGC (gc_forms, forms);
+    while ((tem = rep_fasl_read (&r)) != rep_NULL)
+	forms = Fcons (tem, forms);
+    rep_POPGC; rep_POPGC;
+    return rep_throw_value ? rep_NULL : Fnreverse (forms);
+}
+
+
+DEFUN("fasl-file-p", Ffasl_file_p, Sfasl_file_p, (repv file), rep_Subr1) /*
+::doc:rep.io.files#fasl-file-p::
+fasl-file-p FILE
+
+Return true if FILE is a local file written by `write-fasl'.
+::end:: */
+{
+    repv local;
+    char *data;
+    size_t length;
+    rep_bool ret;
+
+    rep_DECLARE1 (file, rep_STRINGP);
+    local = Flocal_file_name (file);
+    if (local == rep_NULL || !rep_STRINGP (local))
+	return local ? Qnil : rep_NULL;
+    data = rep_map_file (rep_STR (local), &length);
+    if (data == 0)
+	return Qnil;
+    ret = rep_fasl_data_p (data, length);
+    rep_unmap_file (data, length);
+    return ret ? Qt : Qnil;
+}
+
+DEFUN("read-fasl-string", Fread_fasl_string, Sread_fasl_string,
+      (repv string), rep_Subr1) /*
+::doc:rep.io.files#read-fasl-string::
+read-fasl-string STRING
+
+Return the list of objects encoded in STRING, which holds data written
+by `write-fasl' (e.g. when its STREAM argument is false). Unlike
+`load', the objects are not evaluated.
+::end:: */
+{
+    repv ret;
+    rep_GC_root gc_string;
+
+    rep_DECLARE1 (string, rep_STRINGP);
+
+    rep_PUSHGC (gc_string, string);
+    ret = rep_read_fasl (rep_STR (string), rep_STRING_LEN (string));
+    rep_POPGC;
+    return ret;
+}
+
+void
+rep_fasl_init (void)
+{
+    repv tem = rep_push_structure ("rep.io.files");
+    rep_ADD_SUBR (Swrite_fasl);
+    rep_ADD_SUBR (Sread_fasl_string);
+    rep_ADD_SUBR (Sfasl_file_p);
+    rep_pop_structure (tem);
+}
@@ -34,9 +34,13 @@
    (ffi-apply INTERFACE FN-POINTER ARG-LIST) -> RET-VALUE
      -- calls a function and returns its result
 
+   (ffi-apply-vector INTERFACE FN-POINTER ARG-VECTOR) -> RET-VALUE
+     -- the same, with the arguments in a vector
+
    Apply works by walking the list of arguments converting everything
    into native or structure types. It calls the function then converts
-   any returned value back to lisp data.
+   any returned value back to lisp data. Where each argument goes and
+   how it is converted is worked out when the interface is created.
 
    Question: how to handle `out' parameters? E.g.
 
@@ -77,7 +81,7 @@
 #endif
 
 #ifndef ALIGN /* was in older ffi.h */
-#define ALIGN(v, a)     (((size_t)(v) + (a) - 1) & ~((a) - 1)
+#define ALIGN(v, a)     (((size_t)(v) + (a) - 1) & ~((a) - 1))
 #endif
 
 #if SIZEOF_VOID_P == SIZEOF_LONG
@@ -129,12 +133,29 @@ struct rep_ffi_struct_struct {
 #define SIZEOF_REP_FFI_STRUCT(n) \
     (sizeof (rep_ffi_struct) + (sizeof (ffi_type *) * (n)))
 
+/* Converts VALUE to the C representation of TYPE_ID stored at PTR,
+   returning the address after it, or null after signalling an error. */
+typedef char *rep_ffi_marshaller (unsigned int type_id, repv value, char *ptr);
+
+/* Each interface carries a plan for calling it, made when it is created:
+   the offset of each argument in the argument buffer, the function that
+   converts it, and the VALUES array that ffi_call wants, already pointing
+   into ARENA. ARENA is reused by each call, unless ARENA_BUSY says that
+   a call of the same interface is already marshalling its arguments (a
+   type converter may call back into ffi-apply). */
+
 struct rep_ffi_interface_struct {
     ffi_cif cif;
     ffi_type *ret_type;
     unsigned int n_args;
     ffi_type **arg_types;
     size_t args_size;
+    size_t ret_size;
+    size_t *arg_offsets;
+    rep_ffi_marshaller **arg_marshallers;
+    void **values;
+    char *arena;
+    rep_bool arena_busy;
     unsigned int ret;
     unsigned int args[1];
 };
@@ -142,6 +163,9 @@ struct rep_ffi_interface_struct {
 #define SIZEOF_REP_FFI_INTERFACE(n) \
     (sizeof (rep_ffi_interface) + (sizeof (int) * ((n) - 1)))
 
+/* The arena and return value are aligned to this. */
+#define FFI_ARENA_ALIGN 16
+
 static int n_ffi_types, n_alloc_ffi_types;
 static rep_ffi_type **ffi_types;
 
@@ -535,6 +559,87 @@ rep_ffi_demarshal (unsigned int type_id, char *ptr, repv *value)
     }
 }
 
+/* Converters for the common primitive types, so that marshalling an
+   argument of one of these is a single indirect call. Anything else
+   goes through rep_ffi_marshal. */
+
+static char *
+marshal_int (unsigned int type_id, repv value, char *ptr)
+{
+    *(int *)ptr = (int) (rep_INTP (value)
+			 ? rep_INT (value) : rep_get_long_int (value));
+    return ptr + sizeof (int);
+}
+
+static char *
+marshal_sint32 (unsigned int type_id, repv value, char *ptr)
+{
+    *(int32_t *)ptr = (int32_t) (rep_INTP (value)
+				 ? rep_INT (value) : rep_get_long_int (value));
+    return ptr + sizeof (int32_t);
+}
+
+static char *
+marshal_uint32 (unsigned int type_id, repv value, char *ptr)
+{
+    *(uint32_t *)ptr = (uint32_t) (rep_INTP (value)
+				   ? rep_INT (value) : rep_get_long_int (value));
+    return ptr + sizeof (uint32_t);
+}
+
+static char *
+marshal_double (unsigned int type_id, repv value, char *ptr)
+{
+    *(double *)ptr = (double) rep_get_float (value);
+    return ptr + sizeof (double);
+}
+
+static char *
+marshal_float (unsigned int type_id, repv value, char *ptr)
+{
+    *(float *)ptr = (float) rep_get_float (value);
+    return ptr + sizeof (float);
+}
+
+static char *
+marshal_pointer (unsigned int type_id, repv value, char *ptr)
+{
+    *(void **)ptr = (rep_STRINGP(value)) ? rep_STR (value) : rep_get_pointer (value);
+    return ptr + sizeof (void *);
+}
+
+static rep_ffi_marshaller *
+ffi_marshaller (unsigned int type_id)
+{
+    rep_ffi_type *type = ffi_types[type_id];
+
+    if (type->subtype == rep_FFI_PRIMITIVE)
+    {
+	switch (type->type->type)
+	{
+	case FFI_TYPE_INT:
+	    return marshal_int;
+
+	case FFI_TYPE_SINT32:
+	    return marshal_sint32;
+
+	case FFI_TYPE_UINT32:
+	    return marshal_uint32;
+
+	case FFI_TYPE_DOUBLE:
+	    return marshal_double;
+
+	case FFI_TYPE_FLOAT:
+	    return marshal_float;
+
+	case FFI_TYPE_POINTER:
+	    return marshal_pointer;
+	}
+    }
+
+    return rep_ffi_marshal;
+}
+
 DEFUN ("ffi-struct", Fffi_struct, Sffi_struct, (repv fields), rep_Subr1)
 {
     unsigned int i, n;
@@ -630,6 +735,8 @@ DEFUN ("ffi-interface", Fffi_interface, Sffi_interface,
 {
     unsigned int i, n;
     rep_ffi_interface *s;
+    size_t args_size, ret_size, plan_size;
+    repv tem;
 
     if (ret != Qnil)
 	rep_DECLARE (1, ret, rep_VALID_TYPE_P (ret));
@@ -641,14 +748,56 @@ DEFUN ("ffi-interface", Fffi_interface, Sffi_interface,
     else
 	return rep_signal_arg_error (args, 2);
 
-    s = rep_alloc (SIZEOF_REP_FFI_INTERFACE (n)
-		   + sizeof (ffi_type *) * n);
+    /* Check the types and find the size of the argument buffer first,
+       so that the interface, its plan and its arena are one block. */
+
+    args_size = 0;
+    tem = args;
+    for (i = 0; i < n; i++)
+    {
+	repv elt;
+	ffi_type *type;
+
+	if (rep_VECTORP (args))
+	    elt = rep_VECTI (args, i);
+	else
+	{
+	    elt = rep_CAR (tem);
+	    tem = rep_CDR (tem);
+	}
+
+	if (!rep_VALID_TYPE_P (elt))
+	    return rep_signal_arg_error (args, 2);
+
+	type = ffi_types[rep_INT (elt)]->type;
+	if (type->alignment > 1)
+	    args_size = ALIGN (args_size, type->alignment);
+	args_size += type->size;
+    }
+
+    /* libffi writes small integer results as a whole ffi_arg. */
+    ret_size = ffi_types[(ret != Qnil) ? rep_INT (ret) : 0]->type->size;
+    if (ret_size != 0)
+	ret_size = MAX (ret_size, sizeof (ffi_arg));
+
+    plan_size = ALIGN (SIZEOF_REP_FFI_INTERFACE (n)
+		       + (sizeof (ffi_type *) + sizeof (size_t)
+			  + sizeof (rep_ffi_marshaller *)
+			  + sizeof (void *)) * n, FFI_ARENA_ALIGN);
+
+    s = rep_alloc (plan_size + ALIGN (args_size, FFI_ARENA_ALIGN) + ret_size);
     s->arg_types = (void *) (((char *) s) + SIZEOF_REP_FFI_INTERFACE (n));
+    s->arg_offsets = (void *) (s->arg_types + n);
+    s->arg_marshallers = (void *) (s->arg_offsets + n);
+    s->values = (void *) (s->arg_marshallers + n);
+    s->arena = ((char *) s) + plan_size;
+    s->arena_busy = rep_FALSE;
 
     s->n_args = n;
 
     s->ret = (ret != Qnil) ? rep_INT (ret) : 0;
     s->ret_type = ffi_types[s->ret]->type;
+    s->ret_size = ret_size;
 
     s->args_size = 0;
     for (i = 0; i < n; i++)
@@ -663,18 +812,16 @@ DEFUN ("ffi-interface", Fffi_interface, Sffi_interface,
 	    args = rep_CDR (args);
 	}
 
-	if (!rep_VALID_TYPE_P (elt))
-	{
-	    rep_free (s);
-	    return rep_signal_arg_error (args, 2);
-	}
-
 	s->args[i] = rep_INT (elt);
 	s->arg_types[i] = ffi_types[s->args[i]]->type;
+	s->arg_marshallers[i] = ffi_marshaller (s->args[i]);
 
 	if (s->arg_types[i]->alignment > 1)
 	    s->args_size = ALIGN (s->args_size, s->arg_types[i]->alignment);
 
+	s->arg_offsets[i] = s->args_size;
+	s->values[i] = s->arena + s->args_size;
+
 	s->args_size += s->arg_types[i]->size;
     }
 
@@ -688,72 +835,119 @@ DEFUN ("ffi-interface", Fffi_interface, Sffi_interface,
     return rep_MAKE_INT (ffi_alloc_interface (s));
 }
 
-DEFUN ("ffi-apply", Fffi_apply, Sffi_apply,
-       (repv iface_id, repv ptr, repv args), rep_Subr3)
+/* Call FUNCTION_PTR through IFACE with the arguments in ARGS, a list or
+   a vector (argument number ARGNUM of the calling subr). */
+static repv
+ffi_apply_plan (rep_ffi_interface *iface, void *function_ptr,
+		repv args, int argnum)
 {
-    rep_ffi_interface *iface;
-    void *function_ptr;
+    char *arena, *ret_data = NULL, *heap = NULL;
+    void **values;
+    repv ret_value = rep_undefined_value;
+    repv tem = args;
     rep_GC_root gc_args;
+    unsigned int i;
 
-    rep_DECLARE (1, iface_id, rep_VALID_INTERFACE_P (iface_id));
-    rep_DECLARE (2, ptr, rep_pointerp (ptr));
-
-    iface = ffi_interfaces[rep_INT (iface_id)];
-    function_ptr = rep_get_pointer (ptr);
+    if (rep_VECTORP (args) && rep_VECT_LEN (args) != iface->n_args)
+	return rep_signal_arg_error (args, argnum);
 
-    if (function_ptr != NULL)
+    if (!iface->arena_busy)
     {
-	/* use arrays of doubles to get good alignment. */
-	double _args_data[(iface->args_size >> 3) + 1];
-	double _ret_data[(iface->cif.rtype->size >> 3) + 1];
-	void *values[iface->n_args];
-	char *ret_data = NULL, *args_data = NULL, *args_ptr;
-	repv ret_value = rep_undefined_value;
-	int i;
+	arena = iface->arena;
+	values = iface->values;
+	iface->arena_busy = rep_TRUE;
+    }
+    else
+    {
+	/* A recursive call; leave the outer call's arguments alone. */
+	size_t arena_size = (ALIGN (iface->args_size, FFI_ARENA_ALIGN)
+			     + iface->ret_size);
+	heap = rep_alloc (sizeof (void *) * iface->n_args
+			  + FFI_ARENA_ALIGN + arena_size);
+	values = (void **) heap;
+	arena = (char *) ALIGN (heap + sizeof (void *) * iface->n_args,
+				FFI_ARENA_ALIGN);
+	for (i = 0; i < iface->n_args; i++)
+	    values[i] = arena + iface->arg_offsets[i];
+    }
 
-	if (iface->cif.rtype->size != 0)
-	    ret_data = (char *) _ret_data;
+    if (iface->ret_size != 0)
+	ret_data = arena + ALIGN (iface->args_size, FFI_ARENA_ALIGN);
 
-	args_data = (char *) _args_data;
-	args_ptr = args_data;
+    rep_PUSHGC (gc_args, args);
 
-	rep_PUSHGC (gc_args, args);
+    for (i = 0; i < iface->n_args; i++)
+    {
+	repv elt;
 
-	for (i = 0; i < iface->n_args; i++)
+	if (rep_VECTORP (args))
+	    elt = rep_VECTI (args, i);
+	else if (rep_CONSP (tem))
 	{
-	    repv elt;
+	    elt = rep_CAR (tem);
+	    tem = rep_CDR (tem);
+	}
+	else
+	{
+	    ret_value = rep_signal_arg_error (args, argnum);
+	    goto out;
+	}
 
-	    values[i] = args_ptr;
+	if (iface->arg_marshallers[i] (iface->args[i], elt, values[i]) == NULL)
+	{
+	    ret_value = rep_NULL;
+	    goto out;
+	}
+    }
 
-	    if (!rep_CONSP (args)) {
-		rep_POPGC;
-		return rep_signal_arg_error (args, 3);
-	    }
+    ffi_call (&iface->cif, function_ptr, ret_data, values);
 
-	    elt = rep_CAR (args);
-	    args = rep_CDR (args);
+    if (ret_data != NULL)
+    {
+	if (rep_ffi_demarshal (iface->ret, ret_data, &ret_value) == NULL)
+	    ret_value = rep_NULL;
+    }
 
-	    args_ptr = rep_ffi_marshal (iface->args[i], elt, args_ptr);
-	    if (args_ptr == NULL) {
-		rep_POPGC;
-		return rep_NULL;
-	    }
-	}
+out:
+    rep_POPGC;
+    if (heap != NULL)
+	rep_free (heap);
+    else
+	iface->arena_busy = rep_FALSE;
+    return ret_value;
+}
 
-	rep_POPGC;
+DEFUN ("ffi-apply", Fffi_apply, Sffi_apply,
+       (repv iface_id, repv ptr, repv args), rep_Subr3)
+{
+    void *function_ptr;
 
-	ffi_call (&iface->cif, function_ptr, ret_data, values);
+    rep_DECLARE (1, iface_id, rep_VALID_INTERFACE_P (iface_id));
+    rep_DECLARE (2, ptr, rep_pointerp (ptr));
 
-	if (ret_data != NULL)
-	{
-	    if (rep_ffi_demarshal (iface->ret, ret_data, &ret_value) == NULL)
-		return rep_NULL;
-	}
+    function_ptr = rep_get_pointer (ptr);
+    if (function_ptr == NULL)
+	return rep_signal_arg_error (ptr, 2);
 
-	return ret_value;
-    }
+    return ffi_apply_plan (ffi_interfaces[rep_INT (iface_id)],
+			   function_ptr, args, 3);
+}
 
-    return rep_signal_arg_error (ptr, 2);
+DEFUN ("ffi-apply-vector", Fffi_apply_vector, Sffi_apply_vector,
+       (repv iface_id, repv ptr, repv args), rep_Subr3)
+{
+    void *function_ptr;
+
+    rep_DECLARE (1, iface_id, rep_VALID_INTERFACE_P (iface_id));
+    rep_DECLARE (2, ptr, rep_pointerp (ptr));
+    rep_DECLARE3 (args, rep_VECTORP);
+
+    function_ptr = rep_get_pointer (ptr);
+    if (function_ptr == NULL)
+	return rep_signal_arg_error (ptr, 2);
+
+    return ffi_apply_plan (ffi_interfaces[rep_INT (iface_id)],
+			   function_ptr, args, 3);
 }
 
 DEFUN ("ffi-new", Fffi_new, Sffi_new, (repv type_id, repv count), rep_Subr2)
@@ -879,6 +1073,12 @@ DEFUN ("ffi-apply", Fffi_apply, Sffi_apply,
     return no_libffi_error ();
 }
 
+DEFUN ("ffi-apply-vector", Fffi_apply_vector, Sffi_apply_vector,
+       (repv iface_id, repv ptr, repv args), rep_Subr3)
+{
+    return no_libffi_error ();
+}
+
 DEFUN ("ffi-new", Fffi_new, Sffi_new, (repv type_id, repv count), rep_Subr2)
 {
     return no_libffi_error ();
@@ -1026,6 +1226,7 @@ rep_dl_init (void)
     rep_ADD_SUBR (Sffi_type);
     rep_ADD_SUBR (Sffi_interface);
     rep_ADD_SUBR (Sffi_apply);
+    rep_ADD_SUBR (Sffi_apply_vector);
 
     rep_ADD_SUBR (Sffi_load_library);
     rep_ADD_SUBR (Sffi_lookup_symbol);
@@ -20,11 +20,30 @@
 
 #define _GNU_SOURCE
 
+/* AIX requires this to be the first thing in the file.  */
+#include <config.h>
+#ifdef __GNUC__
+# define alloca __builtin_alloca
+#else
+# if HAVE_ALLOCA_H
+#  include <alloca.h>
+# else
+#  ifdef _AIX
+ #pragma alloca
+#  else
+#   ifndef alloca /* predefined by HP cc +Olibcalls */
+char *alloca ();
+#   endif
+#  endif
+# endif
+#endif
+
 #include "repint.h"
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #ifdef NEED_MEMORY_H
 # include <memory.h>
 #endif
@@ -153,6 +172,12 @@ DEFSYM(append, "append");
 
 DEFSYM(fh_env_key, "fh-env-key");
 
+/* File types returned by directory-files-with-attributes */
+DEFSYM(file, "file");
+DEFSYM(directory, "directory");
+DEFSYM(symlink, "symlink");
+DEFSYM(special, "special");
+
 /* Vector of blocked operations */
 struct blocked_op *rep_blocked_ops[op_MAX];
 
@@ -206,6 +231,224 @@ rep_unbound_file_error(repv file)
     return rep_signal_file_error(rep_list_2(rep_VAL(&unbound_file), file));
 }
 
+/* Literal strings that any file name matching each regexp in
+   file-handler-alist must contain, so that most names are rejected
+   without running the regexps at all. Rebuilt whenever the alist or
+   the regexps in it are replaced. */
+
+#define FILTER_LITS 4
+#define FILTER_LIT_LEN 16
+
+struct handler_filter {
+    repv regexp;
+    /* -1 if nothing is known about the regexp */
+    int nlits;
+    /* True if LIT[0] must start the name */
+    rep_bool anchored;
+    char lit[FILTER_LITS][FILTER_LIT_LEN + 1];
+};
+
+static struct handler_filter *handler_filters;
+static int n_handler_filters, handler_filters_size;
+
+/* End the literal being collected in F, keeping it if it's not empty. */
+static void
+end_filter_lit (struct handler_filter *f, char *run, int *len)
+{
+    if (*len > 0 && f->nlits < FILTER_LITS)
+    {
+	memcpy (f->lit[f->nlits], run, *len);
+	f->lit[f->nlits][*len] = 0;
+	f->nlits++;
+    }
+    *len = 0;
+}
+
+/* Fill in F from the regexp RE, only recording things that are certain.
+   Literals are only taken from the top level of the regexp, and any
+   alternation there makes it unknown. */
+static void
+make_handler_filter (struct handler_filter *f, repv re)
+{
+    char run[FILTER_LIT_LEN + 1];
+    int len = 0, depth = 0;
+    rep_bool last_literal = rep_FALSE, overflow = rep_FALSE;
+    char *p, *start = 0, *after_anchor;
+
+    f->regexp = re;
+    f->nlits = 0;
+    f->anchored = rep_FALSE;
+    if (!rep_STRINGP (re))
+    {
+	f->nlits = -1;
+	return;
+    }
+
+    p = rep_STR (re);
+    if (*p == '^')
+	p++;
+    after_anchor = p;
+    for (; *p != 0; p++)
+    {
+	char *here = p;
+	char c = *p;
+	if (c == '*' || c == '?' || c == '+')
+	{
+	    /* The previous character may not be there */
+	    if (last_literal && c != '+')
+		len--;
+	    if (len == 0)
+		start = 0;
+	}
+	else if (c == '\\' && p[1] != 0 && !isalnum ((unsigned char) p[1]))
+	{
+	    /* An escaped character matches itself */
+	    c = *++p;
+	    if (depth == 0)
+		goto literal;
+	    continue;
+	}
+	else if (c == '(')
+	    depth++;
+	else if (c == ')')
+	{
+	    if (--depth < 0)
+		goto unknown;
+	}
+	else if (c == '|' && depth == 0)
+	    goto unknown;
+	else if (c == '[')
+	{
+	    p++;
+	    if (*p == '^')
+		p++;
+	    if (*p == ']')
+		p++;
+	    while (*p != 0 && *p != ']')
+		p++;
+	    if (*p == 0)
+		goto unknown;
+	}
+	else if (c == '\\' && p[1] != 0)
+	    /* A class of characters, or a word boundary */
+	    p++;
+	else if (depth > 0)
+	{
+	    last_literal = rep_FALSE;
+	    continue;
+	}
+	else if (c != '.' && c != '$' && c != '^')
+	    goto literal;
+
+	/* Anything but a literal character at the top level ends the
+	   current literal */
+	if (f->nlits == 0 && len > 0 && start == after_anchor
+	    && after_anchor != rep_STR (re))
+	    f->anchored = rep_TRUE;
+	end_filter_lit (f, run, &len);
+	overflow = last_literal = rep_FALSE;
+	continue;
+
+    literal:
+	if (len == 0)
+	{
+	    start = here;
+	    overflow = rep_FALSE;
+	}
+	if (len == FILTER_LIT_LEN)
+	{
+	    /* Keep only the part of a long literal that can't be
+	       made optional by a following quantifier */
+	    len--;
+	    overflow = rep_TRUE;
+	}
+	if (!overflow)
+	    run[len++] = c;
+	last_literal = !overflow;
+    }
+    if (depth != 0)
+	goto unknown;
+    if (f->nlits == 0 && len > 0 && start == after_anchor
+	&& after_anchor != rep_STR (re))
+	f->anchored = rep_TRUE;
+    end_filter_lit (f, run, &len);
+    return;
+
+unknown:
+    f->nlits = -1;
+}
+
+/* Make sure handler_filters describes the regexps in LIST. */
+static rep_bool
+update_handler_filters (repv list)
+{
+    int i = 0;
+    rep_bool valid = rep_TRUE;
+    repv tem;
+
+    for (tem = list; rep_CONSP (tem) && rep_CONSP (rep_CAR (tem));
+	 tem = rep_CDR (tem), i++)
+    {
+	if (i >= n_handler_filters
+	    || handler_filters[i].regexp != rep_CAR (rep_CAR (tem)))
+	{
+	    valid = rep_FALSE;
+	    break;
+	}
+    }
+    if (valid && i == n_handler_filters)
+	return rep_TRUE;
+
+    for (; rep_CONSP (tem) && rep_CONSP (rep_CAR (tem)); tem = rep_CDR (tem))
+	i++;
+    if (i > handler_filters_size)
+    {
+	int new_size = MAX (i, 8);
+	struct handler_filter *new_filters
+	    = rep_realloc (handler_filters, new_size * sizeof (*new_filters));
+	if (new_filters == 0)
+	{
+	    n_handler_filters = 0;
+	    return rep_FALSE;
+	}
+	handler_filters = new_filters;
+	handler_filters_size = new_size;
+    }
+    n_handler_filters = i;
+    for (i = 0, tem = list; i < n_handler_filters; i++, tem = rep_CDR (tem))
+	make_handler_filter (&handler_filters[i], rep_CAR (rep_CAR (tem)));
+    return rep_TRUE;
+}
+
+/* True if FILE-NAME can't possibly match the regexp described by F. */
+static inline rep_bool
+handler_filter_rejects (struct handler_filter *f, repv file_name)
+{
+    int i;
+    char *name = rep_STR (file_name);
+    for (i = 0; i < f->nlits; i++)
+    {
+	if (i == 0 && f->anchored)
+	{
+	    if (strncmp (name, f->lit[0], strlen (f->lit[0])) != 0)
+		return rep_TRUE;
+	}
+	else if (f->lit[i][1] == 0
+		 ? strchr (name, f->lit[i][0]) == 0
+		 : strstr (name, f->lit[i]) == 0)
+	    return rep_TRUE;
+    }
+    return rep_FALSE;
+}
+
+static void
+mark_handler_filters (void)
+{
+    int i;
+    for (i = 0; i < n_handler_filters; i++)
+	rep_MARKVAL (handler_filters[i].regexp);
+}
+
 /* Note that this function never returns rep_NULL. It preserves the
    regexp match data throughout. */
 repv
@@ -213,14 +456,36 @@ rep_get_file_handler(repv file_name, int op)
 {
     repv list = Fsymbol_value(Qfile_handler_alist, Qt);
     struct rep_saved_regexp_data matches;
+    rep_bool filtered;
+    int i;
     if(!list)
 	return Qnil;
     rep_DECLARE1(file_name, rep_STRINGP);
+
+    filtered = update_handler_filters(list);
+    if(filtered)
+    {
+	/* The usual case of a local name that no handler could want */
+	for(i = 0; i < n_handler_filters; i++)
+	{
+	    if(!handler_filter_rejects(&handler_filters[i], file_name))
+		break;
+	}
+	if(i == n_handler_filters)
+	    return Qnil;
+    }
+
     rep_push_regexp_data(&matches);
-    while(rep_CONSP(list) && rep_CONSP(rep_CAR(list)))
+    for(i = 0; rep_CONSP(list) && rep_CONSP(rep_CAR(list)); i++)
     {
-	repv tem = Fstring_match(rep_CAR(rep_CAR(list)), file_name,
-				     Qnil, Qnil);
+	repv tem;
+	if(filtered && i < n_handler_filters
+	   && handler_filter_rejects(&handler_filters[i], file_name))
+	{
+	    list = rep_CDR(list);
+	    continue;
+	}
+	tem = Fstring_match(rep_CAR(rep_CAR(list)), file_name, Qnil, Qnil);
 	if(tem && !rep_NILP(tem))
 	{
 	    /* Check that this operation isn't already active. */
@@ -252,20 +517,18 @@ rep_call_file_handler(repv handler, int op, repv sym, int nargs, ...)
 {
     struct blocked_op op_data;
     struct rep_saved_regexp_data matches;
-    repv arg_list = Qnil;
-    repv *ptr = &arg_list;
+    repv *argv = alloca (sizeof (repv) * (nargs + 1));
     repv res;
+    rep_GC_n_roots gc_argv;
     int i;
     va_list args;
 
+    argv[0] = sym;
     va_start(args, nargs);
     for(i = 0; i < nargs; i++)
-    {
-	*ptr = Fcons((repv)va_arg(args, repv), Qnil);
-	ptr = &rep_CDR(*ptr);
-    }
+	argv[i+1] = (repv)va_arg(args, repv);
     va_end(args);
-    arg_list = Fcons(sym, arg_list);
+    rep_PUSHGCN(gc_argv, argv, nargs + 1);
 
     /* before it gets dereferenced */
     op_data.handler = handler;
@@ -293,14 +556,15 @@ rep_call_file_handler(repv handler, int op, repv sym, int nargs, ...)
 	rep_push_regexp_data(&matches);
 	op_data.next = rep_blocked_ops[op];
 	rep_blocked_ops[op] = &op_data;
-	/* handler and arg_list are automatically protected by rep_funcall */
-	res = rep_funcall(handler, arg_list, rep_FALSE);
+	/* handler is automatically protected by rep_call_lispn */
+	res = rep_call_lispn (handler, nargs + 1, argv);
 	rep_blocked_ops[op] = op_data.next;
 	rep_pop_regexp_data();
     }
     else
 	res = rep_NULL;
 
+    rep_POPGCN;
     return res;
 }
 
@@ -658,6 +922,7 @@ mark_input_handlers (void)
     {
 	rep_MARKVAL(x->function);
     }
+    mark_handler_filters ();
 }
 
 
@@ -1110,6 +1375,38 @@ question should be empty.
 				     Qdelete_directory, 1, dir_name);
 }
 
+DEFUN("file-contents-string", Ffile_contents_string,
+      Sfile_contents_string, (repv file), rep_Subr1) /*
+::doc:rep.io.files#file-contents-string::
+file-contents-string FILE-NAME
+
+Return a string containing the entire contents of the file called
+FILE-NAME. A local regular file is read in a single operation.
+::end:: */
+{
+    repv handler, stream, out, res;
+    rep_GC_root gc_stream, gc_out;
+
+    handler = rep_localise_and_get_handler(&file, op_open_file);
+    if(!handler)
+	return handler;
+    if(rep_NILP(handler))
+	return rep_file_contents(file);
+
+    stream = Fopen_file(file, Qread);
+    if(!stream)
+	return stream;
+    out = Fmake_string_output_stream(Qnil, Qnil);
+    if(!out)
+	return out;
+    rep_PUSHGC(gc_stream, stream);
+    rep_PUSHGC(gc_out, out);
+    res = Fcopy_stream(stream, out);
+    Fclose_file(stream);
+    rep_POPGC; rep_POPGC;
+    return res ? Fget_output_stream_string(out) : res;
+}
+
 DEFUN_INT("copy-file", Fcopy_file, Scopy_file, (repv src, repv dst),
 	  rep_Subr2, "fSource file:" rep_DS_NL "FDestination file:") /*
 ::doc:rep.io.files#copy-file::
@@ -1523,6 +1820,141 @@ The list is unsorted.
 				     Qdirectory_files, 1, dir);
 }
 
+/* The handler version of directory-files-with-attributes, built from
+   the simpler file operations. Adds the entries for DIR to LIST,
+   naming them relative to the original directory by prefixing PREFIX. */
+static repv
+handler_directory_attributes (repv dir, repv prefix, repv recursive,
+			      repv regexp, repv list)
+{
+    repv files;
+    rep_GC_root gc_dir, gc_prefix, gc_regexp, gc_list, gc_files;
+
+    files = Fdirectory_files (dir);
+    if (!files)
+	return files;
+
+    rep_PUSHGC (gc_dir, dir);
+    rep_PUSHGC (gc_prefix, prefix);
+    rep_PUSHGC (gc_regexp, regexp);
+    rep_PUSHGC (gc_list, list);
+    rep_PUSHGC (gc_files, files);
+    for (; rep_CONSP (files); files = rep_CDR (files))
+    {
+	repv name = rep_CAR (files), file, rel, type, entry;
+	rep_regexp *re;
+	rep_GC_root gc_file, gc_rel;
+
+	if (!rep_STRINGP (name) || strcmp (rep_STR (name), ".") == 0
+	    || strcmp (rep_STR (name), "..") == 0)
+	    continue;
+
+	rel = rep_concat2 (rep_STR (prefix), rep_STR (name));
+	file = rel ? Fexpand_file_name (name, dir) : rep_NULL;
+	if (!file)
+	{
+	    list = rep_NULL;
+	    break;
+	}
+	rep_PUSHGC (gc_file, file);
+	rep_PUSHGC (gc_rel, rel);
+
+	type = Ffile_symlink_p (file);
+	if (type && rep_NILP (type))
+	{
+	    type = Ffile_directory_p (file);
+	    if (type && rep_NILP (type))
+	    {
+		type = Ffile_regular_p (file);
+		if (type)
+		    type = rep_NILP (type) ? Qspecial : Qfile;
+	    }
+	    else if (type)
+		type = Qdirectory;
+	}
+	else if (type)
+	    type = Qsymlink;
+
+	re = (type && !rep_NILP (regexp)) ? rep_compile_regexp (regexp) : 0;
+	if (type && (rep_NILP (regexp)
+		     || (re != 0 && rep_regexec2 (re, rep_STR (name), 0))))
+	{
+	    repv size = Ffile_size (file);
+	    repv modtime = size ? Ffile_modtime (file) : rep_NULL;
+	    repv modes = modtime ? Ffile_modes (file) : rep_NULL;
+	    entry = modes ? rep_list_5 (rel, type, size, modtime, modes) : 0;
+	    list = entry ? Fcons (entry, list) : rep_NULL;
+	}
+	else if (!type || (!rep_NILP (regexp) && re == 0))
+	    list = rep_NULL;
+
+	if (list && !rep_NILP (recursive) && type == Qdirectory)
+	{
+	    rel = Ffile_name_as_directory (rel);
+	    list = (rel ? handler_directory_attributes (file, rel, recursive,
+							regexp, list)
+		    : rep_NULL);
+	}
+	rep_POPGC; rep_POPGC;
+
+	rep_TEST_INT;
+	if (!list || rep_INTERRUPTP)
+	{
+	    list = rep_NULL;
+	    break;
+	}
+    }
+    rep_POPGC; rep_POPGC; rep_POPGC; rep_POPGC; rep_POPGC;
+    return list;
+}
+
+DEFUN("directory-files-with-attributes", Fdirectory_files_with_attributes,
+      Sdirectory_files_with_attributes,
+      (repv dir, repv recursive, repv regexp), rep_Subr3) /*
+::doc:rep.io.files#directory-files-with-attributes::
+directory-files-with-attributes DIRECTORY [RECURSIVE] [REGEXP]
+
+Return a list describing the files in the directory called DIRECTORY,
+other than `.' and `..'. Each element is a list `(NAME TYPE SIZE
+MODTIME MODES)', where TYPE is one of the symbols `file', `directory',
+`symlink' or `special', and the other values are as returned by
+`file-size', `file-modtime' and `file-modes' (except that symbolic
+links aren't followed). The list is unsorted.
+
+When RECURSIVE is true, the files in each subdirectory are also
+included, with names relative to DIRECTORY; symbolic links to
+directories aren't followed. When REGEXP is a string, only files whose
+names (not including their directories) match it are included, though
+all subdirectories are still searched.
+::end:: */
+{
+    repv handler;
+    rep_GC_root gc_recursive, gc_regexp;
+
+    rep_DECLARE3_OPT(regexp, rep_STRINGP);
+    rep_PUSHGC(gc_recursive, recursive);
+    rep_PUSHGC(gc_regexp, regexp);
+    handler = rep_expand_and_get_handler(&dir, op_directory_files);
+    rep_POPGC; rep_POPGC;
+    if(!handler)
+	return handler;
+    if(rep_NILP(handler))
+    {
+	rep_regexp *re = 0;
+	if(rep_STRINGP(regexp))
+	{
+	    re = rep_compile_regexp(regexp);
+	    if(re == 0)
+		return rep_NULL;
+	}
+	return rep_directory_files_with_attributes(dir, !rep_NILP(recursive),
+						   re);
+    }
+    else
+	return handler_directory_attributes(dir, rep_null_string (),
+					    recursive, regexp, Qnil);
+}
+
 DEFUN("read-symlink", Fread_symlink, Sread_symlink, (repv file), rep_Subr1) /*
 ::doc:rep.io.files#read-symlink::
 read-symlink FILENAME
@@ -1729,6 +2161,8 @@ rep_files_init(void)
 
     rep_INTERN(start); rep_INTERN(end);
     rep_INTERN(read); rep_INTERN(write); rep_INTERN(append);
+    rep_INTERN(file); rep_INTERN(directory);
+    rep_INTERN(symlink); rep_INTERN(special);
 
     rep_INTERN(rep_io_file_handlers);
 
@@ -1762,6 +2196,7 @@ rep_files_init(void)
     rep_ADD_SUBR_INT(Sdelete_file);
     rep_ADD_SUBR_INT(Srename_file);
     rep_ADD_SUBR_INT(Scopy_file);
+    rep_ADD_SUBR(Sfile_contents_string);
     rep_ADD_SUBR_INT(Smake_directory);
     rep_ADD_SUBR_INT(Sdelete_directory);
 
@@ -1782,6 +2217,7 @@ rep_files_init(void)
     rep_ADD_SUBR(Sfile_modes_as_string);
     rep_ADD_SUBR(Sfile_modtime);
     rep_ADD_SUBR(Sdirectory_files);
+    rep_ADD_SUBR(Sdirectory_files_with_attributes);
     rep_ADD_SUBR(Sread_symlink);
     rep_ADD_SUBR(Smake_symlink);
 
@@ -21,6 +21,7 @@
 #define _GNU_SOURCE
 
 #include "repint.h"
+#include "probes.h"
 
 #include <string.h>
 #include <ctype.h>
@@ -34,96 +35,249 @@ int (*rep_regsublen_fun)(int, rep_regsubs *, char *, void *);
 
 /* Compiling regexps. */
 
-/* A linked list is used to store all recently-used regexps in MRU
-   order. At GC the regexps at the tail of the list are freed to
-   satisfy the size limit.
-
-   It might be better to use a hash-table. But by experience it seems
-   that the cache is usually quite small, and therefore searching the
-   list each compilation isn't too bad (and it makes the gc easier).
-
-   Also, the hit-ratio is very good (as I'm typing this, ~0.97) */
+/* Each compiled regexp is kept in a list in MRU order; at GC the
+   regexps at the tail of the list are freed to satisfy the size limit.
+   Lookups go through two hash tables: one keyed by the address of the
+   string the regexp was compiled from, which finds the common case of
+   the same string being used again without hashing its contents, and
+   one keyed by the contents themselves. */
 
 struct cached_regexp {
-    struct cached_regexp *next;
+    struct cached_regexp *next_text;	/* chain in text_buckets */
+    struct cached_regexp *next_string;	/* chain in string_buckets */
+    struct cached_regexp *newer, *older;
+    unsigned long hash;
     repv regexp;
     rep_regexp *compiled;
 };
 
-static struct cached_regexp *cached_regexps;	/* should be a hash table? */
+static struct cached_regexp **text_buckets, **string_buckets;
+static unsigned int n_buckets, n_cached;
+static struct cached_regexp *newest_regexp, *oldest_regexp;
 static int regexp_hits, regexp_misses;
 static int regexp_cache_limit = 1024;
 
+#define INITIAL_BUCKETS 64
+
 DEFSYM(regexp_error, "regexp-error");
 DEFSTRING(err_regexp_error, "Regexp error");
 
+static inline unsigned long
+hash_text (const char *ptr, int len)
+{
+    unsigned long value = 2166136261UL;
+    while (len-- > 0)
+	value = (value ^ (unsigned char) *ptr++) * 16777619UL;
+    return value;
+}
+
+static inline unsigned int
+string_bucket (repv string)
+{
+    return ((string >> 3) * 2654435761UL) & (n_buckets - 1);
+}
+
+static inline unsigned int
+text_bucket (unsigned long hash)
+{
+    return hash & (n_buckets - 1);
+}
+
+/* Make X the most recently used regexp */
+static inline void
+touch_regexp (struct cached_regexp *x)
+{
+    if (x == newest_regexp)
+	return;
+    /* unlink it */
+    x->newer->older = x->older;
+    if (x->older != 0)
+	x->older->newer = x->newer;
+    else
+	oldest_regexp = x->newer;
+    /* then put it at the head */
+    x->newer = 0;
+    x->older = newest_regexp;
+    newest_regexp->newer = x;
+    newest_regexp = x;
+}
+
+/* Rebuild both hash tables with SIZE buckets, a power of two */
+static rep_bool
+resize_buckets (unsigned int size)
+{
+    struct cached_regexp **text, **string, *x;
+    text = rep_alloc (sizeof (struct cached_regexp *) * size);
+    string = rep_alloc (sizeof (struct cached_regexp *) * size);
+    if (text == 0 || string == 0)
+    {
+	if (text != 0)
+	    rep_free (text);
+	if (string != 0)
+	    rep_free (string);
+	return rep_FALSE;
+    }
+    memset (text, 0, sizeof (struct cached_regexp *) * size);
+    memset (string, 0, sizeof (struct cached_regexp *) * size);
+    if (text_buckets != 0)
+    {
+	rep_free (text_buckets);
+	rep_free (string_buckets);
+    }
+    text_buckets = text;
+    string_buckets = string;
+    n_buckets = size;
+    for (x = newest_regexp; x != 0; x = x->older)
+    {
+	unsigned int i = text_bucket (x->hash);
+	x->next_text = text_buckets[i];
+	text_buckets[i] = x;
+	i = string_bucket (x->regexp);
+	x->next_string = string_buckets[i];
+	string_buckets[i] = x;
+    }
+    return rep_TRUE;
+}
+
+/* Unlink X from the cache and free it */
+static void
+remove_regexp (struct cached_regexp *x)
+{
+    struct cached_regexp **ptr;
+    for (ptr = &text_buckets[text_bucket (x->hash)];
+	 *ptr != x; ptr = &(*ptr)->next_text)
+	;
+    *ptr = x->next_text;
+    for (ptr = &string_buckets[string_bucket (x->regexp)];
+	 *ptr != x; ptr = &(*ptr)->next_string)
+	;
+    *ptr = x->next_string;
+    if (x->newer != 0)
+	x->newer->older = x->older;
+    else
+	newest_regexp = x->older;
+    if (x->older != 0)
+	x->older->newer = x->newer;
+    else
+	oldest_regexp = x->newer;
+    n_cached--;
+    free (x->compiled);
+    rep_free (x);
+}
+
 rep_regexp *
 rep_compile_regexp(repv re)
 {
-    struct cached_regexp **x = &cached_regexps;
+    struct cached_regexp *x;
+    unsigned long hash;
     int re_len;
     assert(rep_STRINGP(re));
     re_len = rep_STRING_LEN(re);
-    while(*x != 0)
+
+    if (n_buckets != 0)
     {
-	repv saved_re = (*x)->regexp;
-	assert(rep_STRINGP(saved_re));
-	if(saved_re == re
-	   || (rep_STRING_LEN(saved_re) == re_len
-	       && memcmp(rep_STR(saved_re), rep_STR(re), re_len) == 0))
+	/* the same string as before? */
+	for (x = string_buckets[string_bucket (re)]; x != 0; x = x->next_string)
 	{
-	    /* Found it. Move this node to the head of the list. Then
-	       return the compiled copy. */
-	    struct cached_regexp *this = *x;
-	    if(x != &cached_regexps)
-	    {
-		*x = this->next;
-		this->next = cached_regexps;
-		cached_regexps = this;
-	    }
-	    regexp_hits++;
-	    return this->compiled;
+	    if (x->regexp == re)
+		goto found;
+	}
+    }
+
+    hash = hash_text (rep_STR(re), re_len);
+    if (n_buckets != 0)
+    {
+	/* or one with the same contents? */
+	for (x = text_buckets[text_bucket (hash)]; x != 0; x = x->next_text)
+	{
+	    if (x->hash == hash
+		&& rep_STRING_LEN(x->regexp) == re_len
+		&& memcmp(rep_STR(x->regexp), rep_STR(re), re_len) == 0)
+		goto found;
 	}
-	x = &((*x)->next);
     }
 
     /* No cached copy. Compile it, then add it to the cache. */
     {
-	struct cached_regexp *this;
-	rep_regexp *compiled = rep_regcomp(rep_STR(re));
-	if(compiled != 0)
+	rep_regexp *compiled;
+	unsigned int i;
+
+	if (n_cached >= n_buckets
+	    && !resize_buckets (n_buckets == 0
+				? INITIAL_BUCKETS : n_buckets * 2)
+	    && n_buckets == 0)
 	{
-	    this = rep_alloc(sizeof(struct cached_regexp));
-	    if(this != 0)
-	    {
-		this->regexp = re;
-		this->compiled = compiled;
-		this->next = cached_regexps;
-		cached_regexps = this;
-		regexp_misses++;
-		rep_data_after_gc += (sizeof(struct cached_regexp)
-				  + compiled->regsize);
-		return compiled;
-	    }
+	    return 0;
+	}
+
+#ifdef WITH_PROBES
+	if (REP_PROBE_ENABLED (regexp__compile))
+	{
+	    rep_long_long start = rep_utime ();
+	    compiled = rep_regcomp(rep_STR(re));
+	    REP_PROBE3 (regexp__compile, rep_STR (re),
+			(long) (rep_utime () - start), compiled != 0);
 	}
-	return 0;
+	else
+#endif
+	    compiled = rep_regcomp(rep_STR(re));
+	if(compiled == 0)
+	    return 0;
+	x = rep_alloc(sizeof(struct cached_regexp));
+	if(x == 0)
+	{
+	    free (compiled);
+	    return 0;
+	}
+	x->regexp = re;
+	x->compiled = compiled;
+	x->hash = hash;
+	i = text_bucket (hash);
+	x->next_text = text_buckets[i];
+	text_buckets[i] = x;
+	i = string_bucket (re);
+	x->next_string = string_buckets[i];
+	string_buckets[i] = x;
+	x->newer = 0;
+	x->older = newest_regexp;
+	if (newest_regexp != 0)
+	    newest_regexp->newer = x;
+	else
+	    oldest_regexp = x;
+	newest_regexp = x;
+	n_cached++;
+	regexp_misses++;
+	rep_data_after_gc += (sizeof(struct cached_regexp)
+			      + compiled->regsize);
+	return compiled;
     }
+
+found:
+    touch_regexp (x);
+    regexp_hits++;
+    return x->compiled;
 }
 
+/* Called with each string that rep_string_modified is, so other caches
+   of string contents (in modules, say) can drop it */
+void (*rep_string_modified_fun)(repv string);
+
 /* Remove any cached compilation of STRING from the regexp cache */
 void
 rep_string_modified (repv string)
 {
-    struct cached_regexp **x;
-    for (x = &cached_regexps; *x != 0; x = &((*x)->next))
+    struct cached_regexp *x;
+    if (rep_string_modified_fun != 0)
+	(*rep_string_modified_fun) (string);
+    if (n_buckets == 0)
+	return;
+    for (x = string_buckets[string_bucket (string)]; x != 0; x = x->next_string)
     {
-	if ((*x)->regexp == string)
+	if (x->regexp == string)
 	{
 	    /* found the string, remove it from the cache */
-	    struct cached_regexp *ptr = *x;
-	    *x = ptr->next;
-	    free (ptr->compiled);
-	    rep_free (ptr);
+	    remove_regexp (x);
+	    return;
 	}
     }
 }
@@ -133,63 +287,65 @@ static void
 mark_cached_regexps(void)
 {
     unsigned long total = 0;
-    struct cached_regexp *x = cached_regexps, *xp = 0;
+    struct cached_regexp *x = newest_regexp, *last = 0;
     while(x != 0 && total < regexp_cache_limit)
     {
 	assert(rep_STRINGP(x->regexp));
 	rep_MARKVAL(x->regexp);
 	total += sizeof(struct cached_regexp) + x->compiled->regsize;
-	xp = x;
-	x = x->next;
-    }
-    if(xp != 0)
-    {
-	/* Free all following regexps */
-	x = xp->next;
-	xp->next = 0;
-	while(x != 0)
-	{
-	    xp = x->next;
-	    free(x->compiled);
-	    rep_free(x);
-	    x = xp;
-	}
+	last = x;
+	x = x->older;
     }
+    /* Free all older regexps */
+    while (oldest_regexp != last)
+	remove_regexp (oldest_regexp);
 }
 
 /* Free all cached regexps */
 static void
 release_cached_regexps(void)
 {
-    struct cached_regexp *x = cached_regexps;
-    cached_regexps = 0;
-    while(x != 0)
+    while (oldest_regexp != 0)
+	remove_regexp (oldest_regexp);
+    if (text_buckets != 0)
     {
-	struct cached_regexp *next = x->next;
-	free(x->compiled);
-	rep_free(x);
-	x = next;
+	rep_free (text_buckets);
+	rep_free (string_buckets);
+	text_buckets = string_buckets = 0;
+	n_buckets = 0;
     }
 }
 
 
 /* Storing regexp context. */
 	
-/* Storage for remembering where the last match was.
-   last_match_data is the string or buffer that was matched against.
-   last_matches is a copy of the subexpression data of the last match.  */
-static rep_regtype last_match_type;
-static repv last_match_data;
-static rep_regsubs last_matches;
-
-struct rep_saved_regexp_data *rep_saved_matches;
+/* Storage for remembering where the last match was. Each record holds
+   the string or buffer that was matched against, and a copy of the
+   subexpression data of the match. Matches are stored in the record at
+   the top of the rep_saved_matches stack; but the current match data
+   is that of the first record down the stack whose type isn't
+   rep_reg_inherit. So saving the match data around a call (a hook,
+   say) only needs to push an empty record, and nothing is copied
+   unless something inside the call actually matches.  */
+struct rep_saved_regexp_data rep_base_matches;
+
+struct rep_saved_regexp_data *rep_saved_matches = &rep_base_matches;
+
+static inline struct rep_saved_regexp_data *
+last_match (void)
+{
+    struct rep_saved_regexp_data *sd = rep_saved_matches;
+    while (sd->type == rep_reg_inherit)
+	sd = sd->next;
+    return sd;
+}
 
 void
 rep_update_last_match(repv data, rep_regexp *prog)
 {
-    last_match_type = prog->lasttype;
-    last_match_data = data;
-    memcpy(&last_matches, &prog->matches, sizeof(last_matches));
+    rep_saved_matches->type = prog->lasttype;
+    rep_saved_matches->data = data;
+    memcpy(&rep_saved_matches->matches, &prog->matches, sizeof(rep_regsubs));
 }
 
 /* Called by GC */
@@ -201,17 +357,6 @@ rep_mark_regexp_data(void)
     /* Don't keep too many cached REs through GC. */
     mark_cached_regexps();
 
-    if(last_match_type == rep_reg_obj)
-    {
-	int i;
-	for(i = 0; i < rep_NSUBEXP; i++)
-	{
-	    rep_MARKVAL(last_matches.obj.startp[i]);
-	    rep_MARKVAL(last_matches.obj.endp[i]);
-	}
-    }
-    rep_MARKVAL(last_match_data);
-
     for(sd = rep_saved_matches; sd != 0; sd = sd->next)
     {
 	if(sd->type == rep_reg_obj)
@@ -231,36 +376,61 @@ rep_mark_regexp_data(void)
 void
 rep_set_string_match(repv obj, repv start, repv end)
 {
+    struct rep_saved_regexp_data *sd = rep_saved_matches;
     int i;
-    last_match_data = obj;
-    last_match_type = rep_reg_obj;
-    last_matches.obj.startp[0] = start;
-    last_matches.obj.endp[0] = end;
+    sd->data = obj;
+    sd->type = rep_reg_obj;
+    sd->matches.obj.startp[0] = start;
+    sd->matches.obj.endp[0] = end;
     for(i = 1; i < rep_NSUBEXP; i++)
     {
-	last_matches.obj.startp[i] = rep_NULL;
-	last_matches.obj.endp[i] = rep_NULL;
+	sd->matches.obj.startp[i] = rep_NULL;
+	sd->matches.obj.endp[i] = rep_NULL;
     }
 }
 
+/* Save the current match data in SD, until the matching call to
+   rep_pop_regexp_data. */
 void
 rep_push_regexp_data(struct rep_saved_regexp_data *sd)
 {
-    sd->type = last_match_type;
-    sd->data = last_match_data;
-    memcpy(&sd->matches, &last_matches, sizeof(rep_regsubs));
+    sd->type = rep_reg_inherit;
+    sd->data = Qnil;
     sd->next = rep_saved_matches;
     rep_saved_matches = sd;
 }
 
 void
 rep_pop_regexp_data(void)
+{
+    rep_saved_matches = rep_saved_matches->next;
+}
+
+/* Like rep_push_regexp_data, but also takes a copy of the current
+   match data, for rep_restore_regexp_data to reinstate. Used by
+   continuations, since the records below SD may have changed by the
+   time they're invoked. */
+void
+rep_save_regexp_data(struct rep_saved_regexp_data *sd)
+{
+    struct rep_saved_regexp_data *last = last_match ();
+    sd->type = last->type;
+    sd->data = last->data;
+    memcpy(&sd->matches, &last->matches, sizeof(rep_regsubs));
+    sd->next = rep_saved_matches;
+    rep_saved_matches = sd;
+}
+
+/* Pop the record pushed by rep_save_regexp_data, making its copy the
+   current match data again. */
+void
+rep_restore_regexp_data(void)
 {
     struct rep_saved_regexp_data *sd = rep_saved_matches;
     rep_saved_matches = sd->next;
-    last_match_type = sd->type;
-    last_match_data = sd->data;
-    memcpy(&last_matches, &sd->matches, sizeof(rep_regsubs));
+    rep_saved_matches->type = sd->type;
+    rep_saved_matches->data = sd->data;
+    memcpy(&rep_saved_matches->matches, &sd->matches, sizeof(rep_regsubs));
 }
 
 
@@ -348,13 +518,15 @@ the following escape sequences,
 {
     long len;
     repv string;
+    struct rep_saved_regexp_data *last;
     rep_DECLARE1(template, rep_STRINGP);
-    len = (*rep_regsublen_fun)(last_match_type, &last_matches,
-			       rep_STR(template), rep_PTR(last_match_data));
+    last = last_match ();
+    len = (*rep_regsublen_fun)(last->type, &last->matches,
+			       rep_STR(template), rep_PTR(last->data));
     string = rep_make_string(len);
-    (*rep_regsub_fun)(last_match_type, &last_matches,
+    (*rep_regsub_fun)(last->type, &last->matches,
 		      rep_STR(template), rep_STR(string),
-		      rep_PTR(last_match_data));
+		      rep_PTR(last->data));
     return string;
 }
 
@@ -370,6 +542,7 @@ buffer, or an integer if the last match was in a string (i.e. regexp-match).
 ::end:: */
 {
     long i;
+    struct rep_saved_regexp_data *last;
     rep_DECLARE1_OPT(exp, rep_INTP);
     if(rep_INTP(exp))
     {
@@ -379,17 +552,18 @@ buffer, or an integer if the last match was in a string (i.e. regexp-match).
     }
     else
 	i = 0;
-    if(last_match_type == rep_reg_obj)
+    last = last_match ();
+    if(last->type == rep_reg_obj)
     {
-	if(last_matches.obj.startp[i] != rep_NULL)
-	    return last_matches.obj.startp[i];
+	if(last->matches.obj.startp[i] != rep_NULL)
+	    return last->matches.obj.startp[i];
 	return Qnil;
     }
     else
     {
-	if(last_matches.string.startp[i] == NULL)
+	if(last->matches.string.startp[i] == NULL)
 	    return(Qnil);
-	i = last_matches.string.startp[i] - (char *)rep_STR(last_match_data);
+	i = last->matches.string.startp[i] - (char *)rep_STR(last->data);
 	return(rep_MAKE_INT(i));
     }
 }
@@ -406,6 +580,7 @@ buffer, or an integer if the last match was in a string (i.e. regexp-match).
 ::end:: */
 {
     long i;
+    struct rep_saved_regexp_data *last;
     rep_DECLARE1_OPT(exp, rep_INTP);
     if(rep_INTP(exp))
     {
@@ -415,17 +590,18 @@ buffer, or an integer if the last match was in a string (i.e. regexp-match).
     }
     else
 	i = 0;
-    if(last_match_type == rep_reg_obj)
+    last = last_match ();
+    if(last->type == rep_reg_obj)
     {
-	if(last_matches.obj.endp[i] != rep_NULL)
-	    return last_matches.obj.endp[i];
+	if(last->matches.obj.endp[i] != rep_NULL)
+	    return last->matches.obj.endp[i];
 	return Qnil;
     }
     else
     {
-	if(last_matches.string.endp[i] == NULL)
+	if(last->matches.string.endp[i] == NULL)
 	    return(Qnil);
-	i = last_matches.string.endp[i] - (char *)rep_STR(last_match_data);
+	i = last->matches.string.endp[i] - (char *)rep_STR(last->data);
 	return(rep_MAKE_INT(i));
     }
 }
@@ -517,12 +693,10 @@ Returns (SOFT-LIMIT CURRENT-SIZE CURRENT-ENTRIES HITS MISSES).
     if(rep_INTP(limit) && rep_INT(limit) >= 0)
 	regexp_cache_limit = rep_INT(limit);
 
-    x = cached_regexps;
-    while(x != 0)
+    for (x = newest_regexp; x != 0; x = x->older)
     {
 	current_items++;
 	current_size += sizeof(struct cached_regexp) + x->compiled->regsize;
-	x = x->next;
     }
 
     return rep_list_5(rep_MAKE_INT(regexp_cache_limit),
@@ -530,6 +704,21 @@ Returns (SOFT-LIMIT CURRENT-SIZE CURRENT-ENTRIES HITS MISSES).
 		  rep_MAKE_INT(regexp_hits), rep_MAKE_INT(regexp_misses));
 }	  
 
+DEFUN("regexp-backtrack-limit", Fregexp_backtrack_limit,
+      Sregexp_backtrack_limit, (repv val), rep_Subr1) /*
+::doc:rep.regexp#regexp-backtrack-limit::
+regexp-backtrack-limit [NEW-VALUE]
+
+The number of steps per character of input that the backtracking
+regexp matcher may take before the match is retried by simulating the
+regexp as a nondeterministic automaton, which takes time proportional
+to the length of the input whatever the regexp. Zero means always use
+the automaton.
+::end:: */
+{
+    return rep_handle_var_int (val, &rep_regexp_backtrack_limit);
+}
+
 void
 rep_regerror(char *err)
 {
@@ -547,6 +736,7 @@ rep_find_init(void)
     rep_ADD_SUBR(Smatch_end);
     rep_ADD_SUBR(Squote_regexp);
     rep_ADD_SUBR(Sregexp_cache_control);
+    rep_ADD_SUBR(Sregexp_backtrack_limit);
     rep_pop_structure (tem);
 
     rep_INTERN(regexp_error); rep_ERROR(regexp_error);
@@ -30,28 +30,6 @@ DEFSYM (fluid, "fluid");
 #define FLUID_GLOBAL_VALUE(x) rep_CDR(x)
 
 
-/* from symbols.c */
-
-static inline repv
-inlined_search_special_bindings (repv sym)
-{
-    register repv env;
-    for (env = rep_special_bindings; env != Qnil; env = rep_CDR (env))
-    {
-	if (rep_CAAR(env) == sym)
-	    return rep_CAR (env);
-    }
-    return Qnil;
-}
-
-static repv
-search_special_bindings (repv sym)
-{
-    return inlined_search_special_bindings (sym);
-}
-
-
-
 DEFUN ("make-fluid", Fmake_fluid, Smake_fluid, (repv value), rep_Subr1) /*
 ::doc:rep.lang.interpreter#make-fluid::
 make-fluid [VALUE]
@@ -78,9 +56,9 @@ variable object FLUID.
     repv tem;
     rep_DECLARE1(f, FLUIDP);
 
-    tem = search_special_bindings (f);
+    tem = rep_search_special_bindings (f);
     if (tem != Qnil)
-	return rep_CDR (tem);
+	return rep_BINDING_VALUE (tem);
     else
 	return FLUID_GLOBAL_VALUE (f);
 }
@@ -97,9 +75,9 @@ variable object FLUID to VALUE.
     repv tem;
     rep_DECLARE1(f, FLUIDP);
 
-    tem = search_special_bindings (f);
+    tem = rep_search_special_bindings (f);
     if (tem != Qnil)
-	rep_CDR (tem) = v;
+	rep_BINDING_VALUE (tem) = v;
     else
 	FLUID_GLOBAL_VALUE (f) = v;
     return v;
@@ -120,34 +98,35 @@ signalled.
 ::end:: */
 {
     repv ret;
-    repv old_bindings;
-    rep_GC_root gc_old_bindings;
+    int count = 0;
 
     rep_DECLARE (1, fluids, rep_LISTP (fluids));
     rep_DECLARE (2, values, rep_LISTP (values));
     rep_DECLARE (2, values,
 		 rep_list_length (fluids) == rep_list_length (values));
 
-    old_bindings = rep_special_bindings;
     while (rep_CONSP (fluids) && rep_CONSP (values))
     {
 	repv f = rep_CAR (fluids), v = rep_CAR (values);
-	rep_DECLARE (1, f, FLUIDP (f));
-	rep_special_bindings = Fcons (Fcons (f, v), rep_special_bindings);
+	if (!FLUIDP (f))
+	{
+	    rep_pop_special_bindings (count);
+	    return rep_signal_arg_error (f, 1);
+	}
+	rep_push_special_binding (f, v);
+	count++;
 	fluids = rep_CDR (fluids);
 	values = rep_CDR (values);
 	rep_TEST_INT;
 	if (rep_INTERRUPTP)
 	{
-	    rep_special_bindings = old_bindings;
+	    rep_pop_special_bindings (count);
 	    return rep_NULL;
 	}
     }
 
-    rep_PUSHGC (gc_old_bindings, old_bindings);
     ret = rep_call_lisp0 (thunk);
-    rep_POPGC;
-    rep_special_bindings = old_bindings;
+    rep_pop_special_bindings (count);
     return ret;
 }
 
@@ -0,0 +1,231 @@
+/* handles.c -- resolved function handles for embedding programs
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.	If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Commentary:
+
+   A program calling into Lisp for each of a stream of events would
+   otherwise look up the function's binding every time, e.g.
+
+	rep_call_lisp1 (Fsymbol_value (Qfoo, Qt), event);
+
+   A handle is made once for the symbol and the structure it's to be
+   found in. It remembers the binding, the same way that the inline
+   caches of compiled code do (see OP_REFG in lispmach.h): while
+   rep_structure_stamp is unchanged the binding is still the one the
+   symbol refers to, so getting the function is a comparison and a
+   load. Redefining the function just changes the binding's value, so
+   the handle sees the new definition immediately.
+
+   Handles are malloc'd, and the objects they refer to are protected
+   from GC until rep_free_fun_handle is called. Calls go through
+   rep_call_lispn, so no list of arguments is consed. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+
+#include <string.h>
+
+struct rep_fun_handle_struct {
+    /* SYMBOL is rep_NULL when VALUE is the function itself */
+    repv symbol, structure, value;
+    rep_struct_node *n;
+    unsigned int stamp;
+};
+
+static rep_fun_handle *
+alloc_handle (repv symbol, repv structure, repv value)
+{
+    rep_fun_handle *h = rep_alloc (sizeof (rep_fun_handle));
+    if (h == 0)
+    {
+	rep_mem_error ();
+	return 0;
+    }
+    h->symbol = symbol;
+    h->structure = structure;
+    h->value = value;
+    h->n = 0;
+    h->stamp = 0;
+    rep_mark_static (&h->symbol);
+    rep_mark_static (&h->structure);
+    rep_mark_static (&h->value);
+    return h;
+}
+
+/* Return a handle on the function bound to SYMBOL in STRUCTURE, or in
+   the current structure if STRUCTURE is nil. The binding needn't exist
+   until the handle is used. Returns null (having signalled an error)
+   if the arguments are wrong or memory is exhausted. */
+rep_fun_handle *
+rep_make_fun_handle (repv symbol, repv structure)
+{
+    if (!rep_SYMBOLP (symbol))
+    {
+	rep_signal_arg_error (symbol, 1);
+	return 0;
+    }
+    if (structure == rep_NULL || structure == Qnil)
+	structure = rep_structure;
+    else if (!rep_STRUCTUREP (structure))
+    {
+	rep_signal_arg_error (structure, 2);
+	return 0;
+    }
+    return alloc_handle (symbol, structure, Qnil);
+}
+
+/* Return a handle on the function object FUN itself, e.g. a closure
+   passed to the program by Lisp code, keeping FUN from being GC'd. */
+rep_fun_handle *
+rep_make_fun_handle_for_value (repv fun)
+{
+    return alloc_handle (rep_NULL, Qnil, fun);
+}
+
+/* Intern each of the N strings in NAMES, storing in HANDLES[I] a
+   handle on the function NAMES[I] in STRUCTURE (as for
+   rep_make_fun_handle). Returns false if any couldn't be made; those
+   that were are freed again. */
+rep_bool
+rep_make_fun_handles (int n, const char **names, repv structure,
+		      rep_fun_handle **handles)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+	repv sym = rep_intern_chars (names[i], strlen (names[i]), Qnil);
+	handles[i] = sym ? rep_make_fun_handle (sym, structure) : 0;
+	if (handles[i] == 0)
+	{
+	    while (--i >= 0)
+	    {
+		rep_free_fun_handle (handles[i]);
+		handles[i] = 0;
+	    }
+	    return rep_FALSE;
+	}
+    }
+    return rep_TRUE;
+}
+
+/* Intern each of the N strings in NAMES, storing the symbols in
+   SYMBOLS. As with rep_intern_static, each element of SYMBOLS becomes a
+   GC root, so the array must never be freed. */
+rep_bool
+rep_intern_symbols (int n, const char **names, repv *symbols)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+	symbols[i] = rep_intern_chars (names[i], strlen (names[i]), Qnil);
+	if (symbols[i] == rep_NULL)
+	    return rep_FALSE;
+	rep_mark_static (&symbols[i]);
+    }
+    return rep_TRUE;
+}
+
+void
+rep_free_fun_handle (rep_fun_handle *h)
+{
+    if (h != 0)
+    {
+	rep_unmark_static (&h->symbol);
+	rep_unmark_static (&h->structure);
+	rep_unmark_static (&h->value);
+	rep_free (h);
+    }
+}
+
+static repv
+resolve (rep_fun_handle *h)
+{
+    rep_struct *s = rep_STRUCTURE (h->structure);
+    rep_struct_node *n = rep_lookup_binding (s, h->symbol);
+    if (n == 0)
+	n = rep_search_imports (s, h->symbol);
+    if (n == 0)
+    {
+	h->n = 0;
+	return Fsignal (Qvoid_value, rep_LIST_1 (h->symbol));
+    }
+    h->n = n;
+    h->stamp = rep_structure_stamp;
+    return n->binding;
+}
+
+/* Return the function that handle H currently refers to, or rep_NULL
+   after signalling void-value. */
+repv
+rep_fun_handle_value (rep_fun_handle *h)
+{
+    if (h->symbol == rep_NULL)
+	return h->value;
+    if (h->n != 0 && h->stamp == rep_structure_stamp)
+	return h->n->binding;
+    if (rep_SYM (h->symbol)->car & rep_SF_SPECIAL)
+	/* defvar'd, the value may be dynamically bound */
+	return Fsymbol_value (h->symbol, Qnil);
+    return resolve (h);
+}
+
+/* Call the function of handle H with the ARGC arguments in ARGV,
+   returning its result, or rep_NULL if it exited non-locally. As with
+   rep_call_lispn the contents of ARGV may be overwritten. */
+repv
+rep_call_fun_handle (rep_fun_handle *h, int argc, repv *argv)
+{
+    repv fun = rep_fun_handle_value (h);
+    return fun ? rep_call_lispn (fun, argc, argv) : rep_NULL;
+}
+
+/* Call the function of handle H once for each of COUNT events, each
+   given by ARGC consecutive arguments in ARGV. The result of each call
+   is stored in RESULTS, unless that's null. Stops at the first call
+   that exits non-locally, returning the number of calls that didn't.
+   The argument vector is protected from GC for the duration, and its
+   contents may be overwritten. */
+int
+rep_call_fun_handle_batch (rep_fun_handle *h, int count,
+			   int argc, repv *argv, repv *results)
+{
+    rep_GC_n_roots gc_argv, gc_results;
+    int i;
+
+    if (results != 0)
+    {
+	for (i = 0; i < count; i++)
+	    results[i] = Qnil;
+    }
+
+    rep_PUSHGCN (gc_argv, argv, count * argc);
+    rep_PUSHGCN (gc_results, results, results != 0 ? count : 0);
+    for (i = 0; i < count; i++)
+    {
+	/* looked up each time, in case a call redefines the function */
+	repv fun = rep_fun_handle_value (h);
+	repv result = fun ? rep_call_lispn (fun, argc, argv + i * argc) : 0;
+	if (result == rep_NULL)
+	    break;
+	if (results != 0)
+	    results[i] = result;
+    }
+    rep_POPGCN; rep_POPGCN;
+    return i;
+}
@@ -0,0 +1,361 @@
+/* jitmach.c -- Direct-threaded interpreter for hot compiled functions
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Once a compiled function has been called jit-threshold times, its
+   byte-code string is translated to a vector of words: the address of
+   the code for each instruction in a second copy of the VM (made from
+   lispmach.h with DIRECT_THREADED defined), followed by its operand,
+   already decoded. Dispatching an instruction is then a single load
+   and indirect jump, with no opcode table or argument decoding, and
+   jumps go straight to their destination.
+
+   Every instruction has a translation, so nothing has to be handed
+   back to the byte-code interpreter mid-function; complex instructions
+   (binding, catch, unwind-protect) simply run the same code as they
+   always do. Functions that haven't got hot yet are called in the
+   byte-code interpreter, even from translated code, except for tail
+   calls, where the callee is translated immediately. */
+
+#define _GNU_SOURCE
+
+/* AIX requires this to be the first thing in the file.  */
+#include <config.h>
+#ifdef __GNUC__
+# define alloca __builtin_alloca
+#else
+# if HAVE_ALLOCA_H
+#  include <alloca.h>
+# else
+#  ifdef _AIX
+ #pragma alloca
+#  else
+#   ifndef alloca /* predefined by HP cc +Olibcalls */
+char *alloca ();
+#   endif
+#  endif
+# endif
+#endif
+
+#include "repint.h"
+
+/* Number of calls made to a compiled function before it's translated;
+   zero or less to never translate */
+#ifdef ENABLE_JIT
+int rep_jit_threshold = 100;
+#else
+int rep_jit_threshold = 0;
+#endif
+
+/* All translations, most recent first */
+static rep_jit_code *translations;
+
+/* Marks functions that can't be translated */
+static rep_jit_code untranslatable;
+
+#ifdef ENABLE_JIT
+
+/* pull in the generic interpreter */
+
+#define ASSERT(x)
+
+#define BC_APPLY_SELF 0
+
+#define DIRECT_THREADED 1
+
+/* Calls from translated code to functions that aren't hot yet are
+   passed back to the byte-code interpreter */
+#define APPLY_HOOK(subr, nargs, args)					\
+    if (current_translation (subr) == 0 && !rep_jit_hot_p (subr))	\
+	return rep_interpret_bytecode (subr, nargs, args)
+
+/* The code of each instruction, indexed by opcode */
+static void **jit_labels;
+
+/* Return the translation of compiled function SUBR if it has a usable
+   one, otherwise null. */
+static inline rep_jit_code *
+current_translation (repv subr)
+{
+    rep_ic *ic = rep_COMPILED_IC (subr);
+    /* the code may have been replaced using aset */
+    return ((ic != 0 && ic->jit != 0
+	     && ic->jit->code == rep_COMPILED_CODE (subr)) ? ic->jit : 0);
+}
+
+static rep_jit_code *make_translation (repv subr);
+
+#define jit_translation(subr) \
+    (current_translation (subr) ?: make_translation (subr))
+
+#include "lispmach.h"
+
+
+/* translation */
+
+/* Return the length in bytes of the instruction with opcode OP, storing
+   the number of words its translation takes in *WORDS. */
+static int
+insn_length (int op, int *words)
+{
+    if (op <= OP_LAST_WITH_ARGS)
+    {
+	int arg = op & OP_ARG_MASK;
+	int base = op & OP_OP_MASK;
+
+	/* These have separate code for each embedded argument value;
+	   the others read it from the operand (see SLOT_REF_TAGS) */
+	if (arg < OP_ARG_1BYTE && (base == OP_SLOT_REF || base == OP_SLOT_SET
+				   || base == OP_REFN))
+	    *words = 1;
+	else
+	    *words = 2;
+	return (arg < OP_ARG_1BYTE ? 1 : arg == OP_ARG_1BYTE ? 2 : 3);
+    }
+
+    *words = 2;
+    switch (op)
+    {
+    case OP_PUSHI: case OP_SLOT_REF_CAR:
+    case OP_SLOT_REF_CDR: case OP_DUP_SLOT_SET:
+	return 2;
+
+    case OP_PUSHIWN: case OP_PUSHIWP: case OP_EQ_JN:
+	return 3;
+
+    default:
+	if (op > OP_LAST_BEFORE_JMPS)
+	    return 3;
+
+	/* unknown opcodes keep their value for the error message; they
+	   share the label of OP_LAST_BEFORE_JMPS, which is unused */
+	if (jit_labels[op] != jit_labels[OP_LAST_BEFORE_JMPS])
+	    *words = 1;
+	return 1;
+    }
+}
+
+/* Translate the code of compiled function SUBR, returning null if it
+   can't be done. */
+static rep_jit_code *
+translate (repv subr)
+{
+    repv code = rep_COMPILED_CODE (subr);
+    const unsigned char *bytes = (const unsigned char *) rep_STR (code);
+    int len = rep_STRING_LEN (code);
+    rep_jit_code *jc;
+    int *offsets;
+    int i, n;
+    void **w;
+
+    if (jit_labels == 0)
+	vm (rep_NULL, rep_NULL, rep_NULL, 0, 0, 0, 0, 0);
+
+    offsets = rep_alloc (sizeof (int) * (len + 1));
+    if (offsets == 0)
+	return 0;
+
+    /* Find where each instruction goes, so that jumps can be resolved */
+    i = n = 0;
+    while (i < len)
+    {
+	int words, size = insn_length (bytes[i], &words), j;
+	offsets[i] = n;
+	for (j = 1; j < size && i + j < len; j++)
+	    offsets[i + j] = -1;
+	n += words;
+	i += size;
+    }
+    if (i != len)
+    {
+	/* the last instruction is truncated */
+	rep_free (offsets);
+	return 0;
+    }
+
+    jc = rep_alloc (sizeof (rep_jit_code) + (MAX (n, 1) - 1) * sizeof (void *));
+    if (jc == 0)
+    {
+	rep_free (offsets);
+	return 0;
+    }
+
+    w = jc->insns;
+    for (i = 0; i < len;)
+    {
+	int op = bytes[i], words, size = insn_length (op, &words);
+
+	*w++ = jit_labels[op];
+	if (op > OP_LAST_BEFORE_JMPS || op == OP_EQ_JN)
+	{
+	    int dest = (bytes[i+1] << ARG_SHIFT) | bytes[i+2];
+	    if (dest >= len || offsets[dest] < 0)
+	    {
+		rep_free (jc);
+		rep_free (offsets);
+		return 0;
+	    }
+	    *w++ = jc->insns + offsets[dest];
+	}
+	else if (words == 2)
+	{
+	    unsigned int arg;
+	    if (size == 3)
+		arg = (bytes[i+1] << ARG_SHIFT) | bytes[i+2];
+	    else if (size == 2)
+		arg = bytes[i+1];
+	    else if (op <= OP_LAST_WITH_ARGS)
+		arg = op & OP_ARG_MASK;
+	    else
+		arg = op;
+	    *w++ = (void *) (rep_PTR_SIZED_INT) arg;
+	}
+	i += size;
+    }
+
+    jc->subr = subr;
+    jc->code = code;
+    jc->offsets = offsets;
+    jc->length = n;
+    jc->next = translations;
+    if (jc->next != 0)
+	jc->next->pprev = &jc->next;
+    jc->pprev = &translations;
+    translations = jc;
+    return jc;
+}
+
+/* Translate compiled function SUBR if that hasn't been tried yet,
+   returning its translation or null. */
+static rep_jit_code *
+make_translation (repv subr)
+{
+    rep_ic *ic = subr_inline_caches (subr, rep_COMPILED_CONSTANTS (subr),
+				     rep_TRUE);
+    if (ic == 0)
+	return 0;
+    if (ic->jit == 0)
+    {
+	ic->jit = translate (subr);
+	if (ic->jit == 0)
+	    ic->jit = &untranslatable;
+    }
+    return current_translation (subr);
+}
+
+
+/* interface */
+
+/* Count a call to compiled function SUBR, returning true if it should
+   be run from its translation. */
+rep_bool
+rep_jit_hot_p (repv subr)
+{
+    rep_ic *ic;
+    if (current_translation (subr) != 0)
+	return rep_TRUE;
+    ic = subr_inline_caches (subr, rep_COMPILED_CONSTANTS (subr), rep_TRUE);
+    if (ic == 0 || ic->jit != 0
+	|| rep_jit_threshold <= 0 || ++ic->calls < rep_jit_threshold)
+    {
+	return rep_FALSE;
+    }
+    return make_translation (subr) != 0;
+}
+
+/* Call compiled function SUBR, which rep_jit_hot_p has accepted */
+repv
+rep_jit_apply_bytecode (repv subr, int nargs, repv *args)
+{
+    return interpret_bytecode (subr, nargs, args);
+}
+
+#endif /* ENABLE_JIT */
+
+/* Called when the compiled function owning translation JC is freed */
+void
+rep_jit_free (rep_jit_code *jc)
+{
+    if (jc == &untranslatable)
+	return;
+    *jc->pprev = jc->next;
+    if (jc->next != 0)
+	jc->next->pprev = jc->pprev;
+    rep_free (jc->offsets);
+    rep_free (jc);
+}
+
+DEFUN ("jit-threshold", Fjit_threshold, Sjit_threshold,
+       (repv val), rep_Subr1) /*
+::doc:rep.vm.interpreter#jit-threshold::
+jit-threshold [NEW-VALUE]
+
+The number of times a compiled function is called before it is
+translated to direct-threaded code. Zero means never translate.
+
+Has no effect unless librep was configured with `--enable-jit'.
+::end:: */
+{
+    return rep_handle_var_int (val, &rep_jit_threshold);
+}
+
+DEFUN ("jit-compiled-functions", Fjit_compiled_functions,
+       Sjit_compiled_functions, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#jit-compiled-functions::
+jit-compiled-functions
+
+Return a list of the compiled functions that have been translated to
+direct-threaded code, most recently translated first.
+::end:: */
+{
+    repv out = Qnil;
+    rep_jit_code *jc;
+    for (jc = translations; jc != 0; jc = jc->next)
+	out = Fcons (jc->subr, out);
+    return Fnreverse (out);
+}
+
+DEFUN ("jit-compiled-p", Fjit_compiled_p, Sjit_compiled_p,
+       (repv fun), rep_Subr1) /*
+::doc:rep.vm.interpreter#jit-compiled-p::
+jit-compiled-p FUNCTION
+
+Return true if FUNCTION, a closure or compiled function, has been
+translated to direct-threaded code.
+::end:: */
+{
+    rep_ic *ic;
+    if (rep_FUNARGP (fun))
+	fun = rep_FUNARG (fun)->fun;
+    if (!rep_COMPILEDP (fun))
+	return Qnil;
+    ic = rep_COMPILED_IC (fun);
+    return (ic != 0 && ic->jit != 0 && ic->jit != &untranslatable
+	    && ic->jit->code == rep_COMPILED_CODE (fun)) ? Qt : Qnil;
+}
+
+void
+rep_jitmach_init (void)
+{
+    repv tem = rep_push_structure ("rep.vm.interpreter");
+    rep_ADD_SUBR (Sjit_threshold);
+    rep_ADD_SUBR (Sjit_compiled_functions);
+    rep_ADD_SUBR (Sjit_compiled_p);
+    rep_pop_structure (tem);
+}
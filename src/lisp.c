@@ -39,6 +39,7 @@ char *alloca ();
 #endif
 
 #include "repint.h"
+#include "probes.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -218,22 +219,93 @@ static int current_frame_id (void);
 
 static repv readl (repv, register int *, repv);
 
-static rep_bool read_local_file;
+/* How the stream currently being read is accessed. Local files and
+   string streams are read directly by the reader, without going
+   through rep_stream_getc's dispatch on the stream type */
+enum read_source {
+    read_generic, read_local_file, read_string
+};
+
+static enum read_source read_source;
+
+#define STRING_STREAM_P(s) \
+    (rep_CONSP (s) && rep_INTP (rep_CAR (s)) && rep_STRINGP (rep_CDR (s)))
 
 /* inline common case of reading from local files; this appears to
    decrease startup time by about 25% */
 static inline int
 fast_getc (repv stream)
 {
-    if (read_local_file)
+    switch (read_source)
     {
-	int c = getc (rep_FILE (stream)->file.fh);
+	int c;
+	long i;
+
+    case read_local_file:
+	c = rep_getc (rep_FILE (stream)->file.fh);
 	if (c == '\n')
 	    rep_FILE (stream)->line_number++;
 	return c;
+
+    case read_string:
+	i = rep_INT (rep_CAR (stream));
+	if (i >= rep_STRING_LEN (rep_CDR (stream)))
+	    return EOF;
+	rep_CAR (stream) = rep_MAKE_INT (i + 1);
+	return ((unsigned char *) rep_STR (rep_CDR (stream)))[i];
+
+    default:
+	return rep_stream_getc (stream);
     }
+}
+
+static inline void
+fast_ungetc (repv stream, int c)
+{
+    if (read_source == read_string)
+	rep_CAR (stream) = rep_MAKE_INT (rep_INT (rep_CAR (stream)) - 1);
     else
-	return rep_stream_getc (stream);
+	rep_stream_ungetc (stream, c);
+}
+
+/* When reading a string stream, return a pointer to its next unread
+   byte, storing the number of bytes left in *LEN-P. Otherwise return
+   null. Use string_advance to consume the bytes */
+static inline const char *
+string_remaining (repv stream, long *len_p)
+{
+    if (read_source != read_string)
+	return 0;
+    *len_p = rep_STRING_LEN (rep_CDR (stream)) - rep_INT (rep_CAR (stream));
+    return rep_STR (rep_CDR (stream)) + rep_INT (rep_CAR (stream));
+}
+
+static inline void
+string_advance (repv stream, long n)
+{
+    rep_CAR (stream) = rep_MAKE_INT (rep_INT (rep_CAR (stream)) + n);
+}
+
+/* Skip the rest of a `;' comment, up to and including its end */
+static void
+skip_comment_line (repv strm)
+{
+    long len;
+    const char *ptr = string_remaining (strm, &len);
+    if (ptr != 0)
+    {
+	const char *end = ptr + len, *p = ptr;
+	while (p < end && *p != '\n' && *p != '\f' && *p != '\r')
+	    p++;
+	string_advance (strm, (p - ptr) + (p < end));
+    }
+    else
+    {
+	int c;
+	while ((c = fast_getc (strm)) != EOF
+	       && c != '\n' && c != '\f' && c != '\r')
+	    ;
+    }
 }
 
 static repv
@@ -267,7 +339,7 @@ read_comment (repv strm, int *c_p)
     again:
 	if (c == terminator)
 	{
-	    c = rep_stream_getc (strm);
+	    c = fast_getc (strm);
 	    if (c == EOF || (c == '#' && --depth == 0))
 		break;
 	    else
@@ -275,7 +347,7 @@ read_comment (repv strm, int *c_p)
 	}
 	else if (c == '#')
 	{
-	    c = rep_stream_getc (strm);
+	    c = fast_getc (strm);
 	    if (c == EOF)
 		break;
 	    else if (c == terminator)
@@ -285,7 +357,7 @@ read_comment (repv strm, int *c_p)
 	}
     }
     if (c != EOF)
-	c = rep_stream_getc (strm);
+	c = fast_getc (strm);
     else
     {
 	signal_reader_error (Qpremature_end_of_stream,
@@ -299,10 +371,11 @@ read_list(repv strm, register int *c_p)
 {
     repv result = Qnil;
     repv last = rep_NULL;
-    long start_line = read_local_file ? rep_FILE (strm)->line_number : -1;
+    long start_line = (read_source == read_local_file
+		       ? rep_FILE (strm)->line_number : -1);
     rep_GC_root gc_result;
 
-    *c_p = rep_stream_getc(strm);
+    *c_p = fast_getc(strm);
     rep_PUSHGC(gc_result, result);
     while(result != rep_NULL)
     {
@@ -322,22 +395,17 @@ read_list(repv strm, register int *c_p)
 	    continue;
 
 	case ';':
-	    {
-		register int c;
-		while((c = fast_getc(strm)) != EOF
-		      && c != '\n' && c != '\f' && c != '\r')
-		    ;
-		*c_p = fast_getc(strm);
-		continue;
-	    }
+	    skip_comment_line (strm);
+	    *c_p = fast_getc(strm);
+	    continue;
 
 	case ')':
 	case ']':
-	    *c_p = rep_stream_getc(strm);
+	    *c_p = fast_getc(strm);
 	    goto end;
 
 	case '.':
-	    *c_p = rep_stream_getc(strm);
+	    *c_p = fast_getc(strm);
 	    switch (*c_p)
 	    {
 	    case EOF:
@@ -366,13 +434,13 @@ read_list(repv strm, register int *c_p)
 		continue;
 
 	    default:
-		rep_stream_ungetc (strm, *c_p);
+		fast_ungetc (strm, *c_p);
 		*c_p = '.';
 	    }
 	    goto do_default;
 
 	case '#': {
-		int c = rep_stream_getc (strm);
+		int c = fast_getc (strm);
 		if (c == EOF)
 		    goto end;
 		else if (c == '|')
@@ -383,7 +451,7 @@ read_list(repv strm, register int *c_p)
 			return rep_NULL;
 		    continue;
 		}
-		rep_stream_ungetc (strm, c);
+		fast_ungetc (strm, c);
 	    }
 	    goto do_default;
 
@@ -464,7 +532,7 @@ read_symbol(repv strm, int *c_p, repv obarray)
 
 	case '\\':
 	    radix = 0;
-	    c = rep_stream_getc(strm);
+	    c = fast_getc(strm);
 	    if(c == EOF)
 		return signal_reader_error (Qpremature_end_of_stream,
 					    strm, "After `\\' in identifer");
@@ -473,11 +541,11 @@ read_symbol(repv strm, int *c_p, repv obarray)
 
 	case '|':
 	    radix = 0;
-	    c = rep_stream_getc(strm);
+	    c = fast_getc(strm);
 	    while((c != EOF) && (c != '|') && (i < buflen))	/* XXX */
 	    {
 		buf[i++] = c;
-		c = rep_stream_getc(strm);
+		c = fast_getc(strm);
 	    }
 	    if(c == EOF)
 		return signal_reader_error (Qpremature_end_of_stream,
@@ -656,6 +724,12 @@ done:
 	result = signal_reader_error (Qinvalid_read_syntax, strm,
 				      "Zero length identifier");
     }
+    else if (radix == 10 && exact && !rational && force_exactness == 0
+	     && nfirst < i && rep_parse_fixnum (buf + nfirst, i - nfirst,
+						sign, &result))
+    {
+	/* the most common kind of number */
+    }
     else if (radix > 0 && nfirst < i)
     {
 	/* It was a number of some sort */
@@ -674,14 +748,7 @@ done:
     }
     else
     {
-intern:	rep_set_string_len(buffer, i);
-	result = Ffind_symbol (rep_VAL(buffer), obarray);
-	if (result != rep_NULL && result == Qnil)
-	{
-	    result = Fmake_symbol (rep_string_dupn (buf, i));
-	    if (result != rep_NULL)
-		result = Fintern_symbol (result, obarray);
-	}
+intern:	result = rep_intern_chars (buf, i, obarray);
     }
     *c_p = c;
     return result;
@@ -728,7 +795,7 @@ read_str(repv strm, int *c_p)
 {
     repv result;
     int buflen = 128;
-    int c = rep_stream_getc(strm);
+    int c = fast_getc(strm);
     char *buf = rep_alloc(buflen);
     register char *cur = buf;
     char *bufend = buf + buflen;
@@ -754,16 +821,28 @@ read_str(repv strm, int *c_p)
 	    }
 	    if(c == '\\')
 	    {
-		c = rep_stream_getc(strm);
+		c = fast_getc(strm);
 		if(c == '\n')
 		    /* escaped newline is ignored */
- 		    c = rep_stream_getc(strm);
+ 		    c = fast_getc(strm);
 		else
 		    *cur++ = (char)rep_stream_read_esc(strm, &c);
 	    }
 	    else
 	    {
+		long len;
+		const char *ptr = string_remaining (strm, &len);
 		*cur++ = c;
+		if (ptr != 0)
+		{
+		    /* copy the run of unescaped characters in one go */
+		    const char *end = ptr + MIN (len, bufend - cur), *p = ptr;
+		    while (p < end && *p != '"' && *p != '\\')
+			p++;
+		    memcpy (cur, ptr, p - ptr);
+		    cur += p - ptr;
+		    string_advance (strm, p - ptr);
+		}
 		c = fast_getc(strm);
 	    }
 	}
@@ -772,7 +851,7 @@ read_str(repv strm, int *c_p)
 					  strm, "While reading a string");
 	else
 	{
-	    *c_p = rep_stream_getc(strm);
+	    *c_p = fast_getc(strm);
 	    result = rep_string_dupn(buf, cur - buf);
 	}
 	rep_free(buf);
@@ -787,7 +866,7 @@ skip_chars (repv stream, const char *str, repv ret, int *ptr)
     int c;
     while (*str != 0)
     {
-	c = rep_stream_getc (stream);
+	c = fast_getc (stream);
 	if (c != *str++)
 	{
 	    char buf[256];
@@ -800,7 +879,7 @@ skip_chars (repv stream, const char *str, repv ret, int *ptr)
 	}
     }
 
-    c = rep_stream_getc (stream);
+    c = fast_getc (stream);
     switch (c)
     {
     case EOF:
@@ -842,14 +921,9 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 	    continue;
 
 	case ';':
-	    {
-		register int c;
-		while((c = fast_getc(strm)) != EOF
-		      && c != '\n' && c != '\f' && c != '\r')
-		    ;
-		*c_p = rep_stream_getc(strm);
-		continue;
-	    }
+	    skip_comment_line (strm);
+	    *c_p = fast_getc(strm);
+	    continue;
 
 	case '(':
 	    return read_list(strm, c_p);
@@ -860,7 +934,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 	    form = Fcons(*c_p == '\'' ? Qquote : Qbackquote,
 			    Fcons(Qnil, Qnil));
 	    rep_PUSHGC(gc_form, form);
-	    if((*c_p = rep_stream_getc(strm)) == EOF)
+	    if((*c_p = fast_getc(strm)) == EOF)
 	    {
 		rep_POPGC;
 		return signal_reader_error (Qpremature_end_of_stream,
@@ -878,7 +952,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 	       ,X  => (backquote-unquote X) */
 	    form = Fcons(Qbackquote_unquote, Fcons(Qnil, Qnil));
 	    rep_PUSHGC(gc_form, form);
-	    switch((*c_p = rep_stream_getc(strm)))
+	    switch((*c_p = fast_getc(strm)))
 	    {
 	    case EOF:
 		rep_POPGC;
@@ -887,7 +961,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 
 	    case '@':
 		rep_CAR(form) = Qbackquote_splice;
-		if((*c_p = rep_stream_getc(strm)) == EOF)
+		if((*c_p = fast_getc(strm)) == EOF)
 		{
 		    rep_POPGC;
 		    return signal_reader_error (Qpremature_end_of_stream,
@@ -910,26 +984,26 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 	case '?':
 	    {
 		register int c;
-		switch(c = rep_stream_getc(strm))
+		switch(c = fast_getc(strm))
 		{
 		case EOF:
 		    return signal_reader_error (Qpremature_end_of_stream,
 						strm, "During ? syntax");
 		case '\\':
-		    if((*c_p = rep_stream_getc(strm)) == EOF)
+		    if((*c_p = fast_getc(strm)) == EOF)
 			return signal_reader_error (Qpremature_end_of_stream,
 						    strm, "During ? syntax");
 		    else
 			return rep_MAKE_INT(rep_stream_read_esc(strm, c_p));
 		    break;
 		default:
-		    *c_p = rep_stream_getc(strm);
+		    *c_p = fast_getc(strm);
 		    return rep_MAKE_INT(c);
 		}
 	    }
 
 	case '#':
-	    switch(*c_p = rep_stream_getc(strm))
+	    switch(*c_p = fast_getc(strm))
 	    {
 		int c;
 
@@ -940,7 +1014,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 	    case '\'':
 		form = Fcons(Qfunction, Fcons(Qnil, Qnil));
 		rep_PUSHGC(gc_form, form);
-		if((*c_p = rep_stream_getc(strm)) == EOF)
+		if((*c_p = fast_getc(strm)) == EOF)
 		{
 		    rep_POPGC;
 		    return signal_reader_error (Qpremature_end_of_stream,
@@ -963,10 +1037,18 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 			   && rep_VECTORP (rep_COMPILED_CONSTANTS (vec))
 			   && rep_INTP (rep_COMPILED_STACK (vec)))
 			{
-			    rep_COMPILED(vec)->car = (rep_COMPILED(vec)->car
-						   & ~rep_CELL8_TYPE_MASK)
-						  | rep_Compiled;
-			    return vec;
+			    int i, len = rep_VECT_LEN (vec);
+			    repv fun = rep_make_compiled (len);
+			    if (fun == rep_NULL)
+				return rep_mem_error ();
+			    for (i = 0; i < len; i++)
+				rep_VECTI (fun, i) = rep_VECTI (vec, i);
+			    if (Fsymbol_value (Qdedupe_loaded_constants,
+					       Qt) != Qnil)
+			    {
+				rep_dedupe_constants (fun);
+			    }
+			    return fun;
 			}
 			return signal_reader_error (Qinvalid_read_syntax,
 						    strm, "Invalid bytecode object");
@@ -1003,16 +1085,16 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 
 		    int c2, i;
 
-		    c = rep_stream_getc (strm);
+		    c = fast_getc (strm);
 		    if (c == EOF)
 			return signal_reader_error (Qpremature_end_of_stream,
 						    strm, "During #\\ syntax");
 		    if (!isalpha (c))
 		    {
-			*c_p = rep_stream_getc (strm);
+			*c_p = fast_getc (strm);
 			return rep_MAKE_INT (c);
 		    }
-		    c2 = rep_stream_getc (strm);
+		    c2 = fast_getc (strm);
 		    if (!isalpha (c2) || c2 == EOF)
 		    {
 			*c_p = c2;
@@ -1056,7 +1138,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 			continue;
 		    }
 		}
-		c = rep_stream_getc (strm);
+		c = fast_getc (strm);
 		switch (c)
 		{
 		case 'o': return skip_chars (strm, "ptional", ex_optional, c_p);
@@ -1066,7 +1148,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 		}
 
 	    case ':':
-		rep_stream_ungetc (strm, *c_p);
+		fast_ungetc (strm, *c_p);
 		*c_p = '#';
 		form = read_symbol (strm, c_p, rep_keyword_obarray);
 		if (form && rep_SYMBOLP (form))
@@ -1076,13 +1158,13 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 	    case 't': case 'T':
 	    case 'f': case 'F':
 		form = (tolower (*c_p) == 't') ? rep_scm_t : rep_scm_f;
-		*c_p = rep_stream_getc (strm);
+		*c_p = fast_getc (strm);
 		return form;
 
 	    case 'b': case 'B': case 'o': case 'O':
 	    case 'd': case 'D': case 'x': case 'X':
 	    case 'e': case 'E': case 'i': case 'I':
-		rep_stream_ungetc (strm, *c_p);
+		fast_ungetc (strm, *c_p);
 		*c_p = '#';
 		goto identifier;
 
@@ -1101,7 +1183,7 @@ readl(repv strm, register int *c_p, repv end_of_stream_error)
 		/* foo#bar expands to (structure-ref foo bar)
 		   (this syntax is from Xerox scheme's module system) */
 		repv var;
-		*c_p = rep_stream_getc (strm);
+		*c_p = fast_getc (strm);
 		var = read_symbol (strm, c_p, rep_obarray);
 		if (var != 0)
 		    return rep_list_3 (Qstructure_ref, form, var);
@@ -1121,10 +1203,15 @@ repv
 rep_readl (repv stream, int *c_p)
 {
     repv form;
-    rep_bool old = read_local_file;
-    read_local_file = rep_FILEP (stream) && rep_LOCAL_FILE_P (stream);
+    enum read_source old = read_source;
+    if (rep_FILEP (stream) && rep_LOCAL_FILE_P (stream))
+	read_source = read_local_file;
+    else if (STRING_STREAM_P (stream))
+	read_source = read_string;
+    else
+	read_source = read_generic;
     form = readl (stream, c_p, Qend_of_stream);
-    read_local_file = old;
+    read_source = old;
     return form;
 }
 
@@ -1179,17 +1266,45 @@ copy_to_vector (repv argList, int nargs, repv *args)
     }
 }
 
-static repv
-bind_lambda_list_1 (repv lambdaList, repv *args, int nargs)
+/* Parsed lambda lists
+
+   Interpreted closures are often called many times, so the first time
+   a lambda list is used its parameters are recorded in a struct
+   lambda_info, and cached by the address of the list. Binding the
+   arguments of a later call is then a matter of indexing the arrays of
+   symbols, defaults and keywords.
+
+   The cached lambda lists are marked by the garbage collector, which
+   stops their cells being reused (and the cache giving the wrong
+   parameters for a different list allocated in the same place). */
+
+struct lambda_info {
+    repv lambda_list;
+    int n_required, n_optional, n_key;
+    rep_bool rest;
+    int nvars;
+    /* the parameters' symbols, shared by the frames that bind them
+       (see rep_bind_frame) */
+    repv names;
+    /* for each parameter, its symbol, default value form, and (only
+       for keyword parameters) the keyword matching it */
+    struct {
+	repv sym, def, key;
+    } vars[1];
+};
+
+#define LAMBDA_CACHE_SIZE 512
+#define LAMBDA_CACHE_HASH(x) (((x) >> 3) % LAMBDA_CACHE_SIZE)
+
+static struct lambda_info *lambda_cache[LAMBDA_CACHE_SIZE];
+
+/* Parse LAMBDALIST, returning a newly allocated description of it, or
+   null after signalling an error */
+static struct lambda_info *
+parse_lambda_list (repv lambdaList)
 {
-#define VAR_SYM 0
-#define VAR_VALUE 1
-#define VAR_EVALP 2
-#define VAR_SIZE 3
-#define VAR(i,j) vars[(i) * VAR_SIZE + (j)]
-
-    repv *vars = alloca ((rep_list_length (lambdaList) + 1)
-			 * VAR_SIZE * sizeof (repv));
+    struct lambda_info *info;
+    repv orig = lambdaList;
     int nvars = 0;
 
     enum arg_state {
@@ -1198,8 +1313,17 @@ bind_lambda_list_1 (repv lambdaList, repv *args, int nargs)
 
     enum arg_state state;
 
-    /* Pass 1: traverse the lambda list, recording var-value pairs
-       and whether each value needs to be evaluated or not.. */
+    info = rep_alloc (sizeof (struct lambda_info)
+		      + (rep_list_length (lambdaList) + 1)
+		      * sizeof (info->vars[0]));
+    if (info == 0)
+    {
+	rep_mem_error ();
+	return 0;
+    }
+    info->lambda_list = orig;
+    info->n_required = info->n_optional = info->n_key = 0;
+    info->rest = rep_FALSE;
 
     state = STATE_REQUIRED;
     while (1)
@@ -1217,8 +1341,10 @@ bind_lambda_list_1 (repv lambdaList, repv *args, int nargs)
 		if (argspec == Qamp_optional)
 		    rep_deprecated (&dep, "&optional in lambda list");
 		if (state >= STATE_OPTIONAL) {
-		invalid: return Fsignal (Qinvalid_lambda_list,
-					 rep_LIST_1 (lambdaList));
+		invalid:
+		    rep_free (info);
+		    Fsignal (Qinvalid_lambda_list, rep_LIST_1 (lambdaList));
+		    return 0;
 		}
 		state = STATE_OPTIONAL;
 		continue;
@@ -1252,12 +1378,12 @@ bind_lambda_list_1 (repv lambdaList, repv *args, int nargs)
 
 	if (rep_SYMBOLP (argspec))
 	{
-	    VAR (nvars, VAR_SYM) = argspec;
+	    info->vars[nvars].sym = argspec;
 	    def = Qnil;
 	}
 	else if (rep_CONSP (argspec) && rep_SYMBOLP (rep_CAR (argspec)))
 	{
-	    VAR (nvars, VAR_SYM) = rep_CAR (argspec);
+	    info->vars[nvars].sym = rep_CAR (argspec);
 	    if (rep_CONSP (rep_CDR (argspec)))
 		def = rep_CADR (argspec);
 	    else
@@ -1266,106 +1392,82 @@ bind_lambda_list_1 (repv lambdaList, repv *args, int nargs)
 	else
 	    goto invalid;
 
-	VAR (nvars, VAR_EVALP) = Qnil;
+	info->vars[nvars].def = def;
+	info->vars[nvars].key = Qnil;
 	switch (state)
 	{
-	    repv key;
-	    int i;
-
 	case STATE_REQUIRED:
+	    info->n_required++;
+	    break;
+
 	case STATE_OPTIONAL:
-	    if (nargs > 0)
-	    {
-		VAR (nvars, VAR_VALUE) = *args++;
-		nargs--;
-	    }
-	    else if (state == STATE_OPTIONAL)
-	    {
-		VAR (nvars, VAR_VALUE) = def;
-		VAR (nvars, VAR_EVALP) = Qt;
-	    }
-	    else
-	    {
-		repv fun = rep_call_stack != 0 ? rep_call_stack->fun : Qnil;
-		return Fsignal (Qmissing_arg, rep_list_2 (fun, argspec));
-	    }
+	    info->n_optional++;
 	    break;
 
 	case STATE_KEY:
-	    key = Fmake_keyword (VAR (nvars, VAR_SYM));
-	    VAR (nvars, VAR_VALUE) = def;
-	    VAR (nvars, VAR_EVALP) = Qt;
-	    for (i = 0; i < nargs - 1; i++)
+	    info->vars[nvars].key = Fmake_keyword (info->vars[nvars].sym);
+	    if (info->vars[nvars].key == rep_NULL)
 	    {
-		if (args[i] == key && args[i+1] != rep_NULL)
-		{
-		    VAR (nvars, VAR_VALUE) = args[i+1];
-		    VAR (nvars, VAR_EVALP) = Qnil;
-		    args[i] = args[i+1] = rep_NULL;
-		    break;
-		}
+		rep_free (info);
+		return 0;
 	    }
+	    info->n_key++;
 	    break;
 
 	case STATE_REST:
-	    {
-		repv list = Qnil;
-		repv *ptr = &list;
-		while (nargs > 0)
-		{
-		    if (*args != rep_NULL)
-		    {
-			*ptr = Fcons (*args, Qnil);
-			ptr = rep_CDRLOC (*ptr);
-		    }
-		    args++; nargs--;
-		}
-		VAR (nvars, VAR_VALUE) = list;
-	    }
+	    info->rest = rep_TRUE;
 	    nvars++;
 	    goto out;
-	    break;
 	}
-
 	nvars++;
-
-	rep_TEST_INT;
-	if (rep_INTERRUPTP)
-	    return rep_NULL;
     }
 
 out:
-    /* Pass 2: evaluate any values that need it.. */
+    info->nvars = nvars;
     {
+	repv *syms = alloca ((nvars + 1) * sizeof (repv));
 	int i;
-	rep_GC_n_roots gc_vars;
-	rep_PUSHGCN (gc_vars, vars, nvars * VAR_SIZE);
 	for (i = 0; i < nvars; i++)
+	    syms[i] = info->vars[i].sym;
+	info->names = rep_make_frame_names (syms, nvars);
+    }
+    return info;
+}
+
+/* Return the description of LAMBDALIST, from the cache if possible */
+static inline struct lambda_info *
+lambda_list_info (repv lambdaList)
+{
+    struct lambda_info **slot = &lambda_cache[LAMBDA_CACHE_HASH (lambdaList)];
+    struct lambda_info *info = *slot;
+    if (info == 0 || info->lambda_list != lambdaList)
+    {
+	info = parse_lambda_list (lambdaList);
+	if (info != 0)
 	{
-	    if (VAR (i, VAR_EVALP) != Qnil)
-	    {
-		repv tem = Feval (VAR (i, VAR_VALUE));
-		if (tem == rep_NULL)
-		{
-		    rep_POPGCN;
-		    return rep_NULL;
-		}
-		VAR (i, VAR_VALUE) = tem;
-	    }
+	    if (*slot != 0)
+		rep_free (*slot);
+	    *slot = info;
 	}
-	rep_POPGCN;
     }
+    return info;
+}
 
-    /* Pass 3: instantiate the bindings */
+/* Called by GC */
+void
+rep_mark_lambda_cache (void)
+{
+    int i, j;
+    for (i = 0; i < LAMBDA_CACHE_SIZE; i++)
     {
-	int i;
-	repv boundlist = rep_NEW_FRAME;
-	for (i = 0; i < nvars; i++)
+	struct lambda_info *info = lambda_cache[i];
+	if (info != 0)
 	{
-	    boundlist = rep_bind_symbol (boundlist, VAR (i, VAR_SYM),
-					 VAR (i, VAR_VALUE));
+	    rep_MARKVAL (info->lambda_list);
+	    rep_MARKVAL (info->names);
+	    for (j = 0; j < info->nvars; j++)
+		rep_MARKVAL (info->vars[j].key);
 	}
-	return boundlist;
     }
 }
 
@@ -1380,43 +1482,149 @@ out:
    <optional-param> and <keyword-param> is either <symbol> or (<symbol>
    <default>) where <default> is a constant
 
-   Note that the lambdaList arg isn't protected from gc by this
-   function; it's assumed that this is done by the caller.
+   Note that neither the lambdaList arg nor the ARGS vector is
+   protected from gc by this function; it's assumed that this is done
+   by the caller.
 
    IMPORTANT: this expects the top of the call stack to have the
    saved environments in which arguments need to be evaluated */
 static repv
-bind_lambda_list(repv lambdaList, repv argList)
+bind_lambda_list_1 (repv lambdaList, repv *args, int nargs)
 {
-    repv *argv;
-    int argc;
+    struct lambda_info *info = lambda_list_info (lambdaList);
+    repv names, *values;
+    rep_bool *evalp;
+    int i, nvars, n_positional;
 
-    argc = rep_list_length (argList);
-    argv = alloca (sizeof (repv) * argc);
+    if (info == 0)
+	return rep_NULL;
+
+    /* INFO may be evicted from the cache while the defaults are being
+       evaluated, so keep hold of the parameter names separately */
+    nvars = info->nvars;
+    names = info->names;
+    values = alloca ((nvars + 1) * sizeof (repv));
+    evalp = alloca ((nvars + 1) * sizeof (rep_bool));
 
-    /* Evaluate arguments, and stick them in the evalled_args array */
-    copy_to_vector (argList, argc, argv);
+    /* Pass 1: match the arguments with the parameters, recording
+       whether each value needs to be evaluated or not.. */
 
-    return bind_lambda_list_1 (lambdaList, argv, argc);
+    if (nargs < info->n_required)
+    {
+	repv fun = rep_call_stack != 0 ? rep_call_stack->fun : Qnil;
+	return Fsignal (Qmissing_arg,
+			rep_list_2 (fun, info->vars[nargs].sym));
+    }
+
+    n_positional = info->n_required + info->n_optional;
+    for (i = 0; i < n_positional; i++)
+    {
+	if (i < nargs)
+	{
+	    values[i] = args[i];
+	    evalp[i] = rep_FALSE;
+	}
+	else
+	{
+	    values[i] = info->vars[i].def;
+	    evalp[i] = rep_TRUE;
+	}
+    }
+    if (nargs > n_positional)
+    {
+	args += n_positional;
+	nargs -= n_positional;
+    }
+    else
+	nargs = 0;
+
+    for (; i < n_positional + info->n_key; i++)
+    {
+	repv key = info->vars[i].key;
+	int j;
+	values[i] = info->vars[i].def;
+	evalp[i] = rep_TRUE;
+	for (j = 0; j < nargs - 1; j++)
+	{
+	    if (args[j] == key && args[j+1] != rep_NULL)
+	    {
+		values[i] = args[j+1];
+		evalp[i] = rep_FALSE;
+		args[j] = args[j+1] = rep_NULL;
+		break;
+	    }
+	}
+    }
+
+    if (info->rest)
+    {
+	repv list = Qnil;
+	repv *ptr = &list;
+	while (nargs > 0)
+	{
+	    if (*args != rep_NULL)
+	    {
+		*ptr = Fcons (*args, Qnil);
+		ptr = rep_CDRLOC (*ptr);
+	    }
+	    args++; nargs--;
+	}
+	values[i] = list;
+	evalp[i] = rep_FALSE;
+    }
+
+    rep_TEST_INT;
+    if (rep_INTERRUPTP)
+	return rep_NULL;
+
+    /* Pass 2: evaluate any values that need it.. */
+    {
+	rep_GC_root gc_names;
+	rep_GC_n_roots gc_values;
+	rep_PUSHGC (gc_names, names);
+	rep_PUSHGCN (gc_values, values, nvars);
+	for (i = 0; i < nvars; i++)
+	{
+	    if (evalp[i])
+	    {
+		repv tem = Feval (values[i]);
+		if (tem == rep_NULL)
+		{
+		    rep_POPGCN; rep_POPGC;
+		    return rep_NULL;
+		}
+		values[i] = tem;
+	    }
+	}
+	rep_POPGCN; rep_POPGC;
+    }
+
+    /* Pass 3: instantiate the bindings */
+    return rep_bind_frame (rep_NEW_FRAME, names, values);
 }
 
+/* Call the lambda expression LAMBDAEXP with the ARGC arguments in
+   ARGV, which may be overwritten. Tail calls from the body to other
+   interpreted closures are made from here, reusing ARGV when it's big
+   enough to hold their arguments. */
 static repv
-eval_lambda(repv lambdaExp, repv argList, repv tail_posn)
+eval_lambda(repv lambdaExp, int argc, repv *argv, repv tail_posn)
 {
     repv result;
+    int argv_size = argc;
 again:
     result = rep_NULL;
     lambdaExp = rep_CDR(lambdaExp);
     if(rep_CONSP(lambdaExp))
     {
 	repv boundlist;
-	rep_GC_root gc_lambdaExp, gc_argList;
+	rep_GC_root gc_lambdaExp;
+	rep_GC_n_roots gc_argv;
 
 	rep_PUSHGC(gc_lambdaExp, lambdaExp);
-	rep_PUSHGC(gc_argList, argList);
-	boundlist = bind_lambda_list(rep_CAR(lambdaExp), argList);
-	rep_POPGC; rep_POPGC;
-
+	rep_PUSHGCN(gc_argv, argv, argc);
+	boundlist = bind_lambda_list_1 (rep_CAR(lambdaExp), argv, argc);
+	rep_POPGCN; rep_POPGC;
 	if(boundlist)
 	{
 	    /* The body of the function is only in the tail position
@@ -1443,7 +1651,19 @@ again:
 		{
 		    rep_USE_FUNARG (func);
 		    lambdaExp = rep_FUNARG (func)->fun;
-		    argList = args;
+
+		    /* snap the call stack, ARGV is about to be reused */
+		    rep_call_stack->fun = func;
+		    rep_call_stack->args = args;
+		    rep_call_stack->argv = 0;
+
+		    argc = rep_list_length (args);
+		    if (argc > argv_size)
+		    {
+			argv = alloca (sizeof (repv) * argc);
+			argv_size = argc;
+		    }
+		    copy_to_vector (args, argc, argv);
 		    goto again;
 		}
 		else
@@ -1547,14 +1767,19 @@ DEFUN ("load-autoload", Fload_autoload,
 
 DEFSTRING(max_depth, "max-lisp-depth exceeded, possible infinite recursion?");
 
+/* Call FUN with the ARGC arguments in ARGV, which may be overwritten.
+   ARGLIST is the same arguments as a list, if the caller has one, or
+   void if not; a list is only made when FUN is a subr that needs one.
+   FUN, ARGLIST and ARGV are gc-protected for the duration of the call. */
 static repv
-apply (repv fun, repv arglist, repv tail_posn)
+apply (repv fun, repv arglist, int argc, repv *argv, repv tail_posn)
 {
     int type;
     repv result = rep_NULL;
     struct rep_Call lc;
     repv closure = rep_NULL;
     rep_GC_root gc_fun, gc_args, gc_closure;
+    rep_GC_n_roots gc_argv;
 
     rep_TEST_INT;
     if(rep_INTERRUPTP)
@@ -1569,15 +1794,20 @@ apply (repv fun, repv arglist, repv tail_posn)
     rep_PUSHGC (gc_fun, fun);
     rep_PUSHGC (gc_args, arglist);
     rep_PUSHGC (gc_closure, closure);
+    rep_PUSHGCN (gc_argv, argv, argc);
 
     rep_MAY_YIELD;
 
     lc.fun = fun;
     lc.args = arglist;
     rep_PUSH_CALL (lc);
+    /* the argument list is only consed if a backtrace wants it */
+    lc.argv = argv;
+    lc.argc = argc;
+    REP_PROBE2 (function__entry, rep_probe_name (fun), argc);
 
-    if(rep_data_after_gc >= rep_gc_threshold)
-	Fgarbage_collect (Qnil);
+    if(rep_data_after_gc >= rep_gc_threshold && !rep_collect_garbage ())
+	goto out;
 
 again:
     if (rep_FUNARGP(fun))
@@ -1588,23 +1818,21 @@ again:
     switch(type = rep_TYPE(fun))
     {
 	int i, nargs;
-	repv car, argv[5];
+	repv car, subr_argv[5];
 
     case rep_SubrN:
 	if (closure)
 	    rep_USE_FUNARG(closure);
-	if (!rep_SUBR_VEC_P (fun))
-	    result = rep_SUBRNFUN(fun)(arglist);
+	if (rep_SUBR_VEC_P (fun))
+	    result = rep_SUBRVFUN (fun) (argc, argv);
 	else
 	{
-	    int length;
-	    repv *vec;
-
-	    length = rep_list_length (arglist);
-	    vec = alloca (length * sizeof (repv));
-	    copy_to_vector (arglist, length, vec);
-
-	    result = rep_SUBRVFUN (fun) (length, vec);
+	    if (rep_VOIDP (arglist))
+	    {
+		arglist = Flist (argc, argv);
+		lc.args = arglist;
+	    }
+	    result = rep_SUBRNFUN(fun)(arglist);
 	}
 	break;
 
@@ -1616,59 +1844,49 @@ again:
 
     case rep_Subr1:
 	nargs = 1;
-	argv[0] = Qnil;
 	goto do_subr;
 
     case rep_Subr2:
 	nargs = 2;
-	argv[0] = argv[1] = Qnil;
 	goto do_subr;
 
     case rep_Subr3:
 	nargs = 3;
-	argv[0] = argv[1] = argv[2] = Qnil;
 	goto do_subr;
 
     case rep_Subr4:
 	nargs = 4;
-	argv[0] = argv[1] = argv[2] = argv[3] = Qnil;
 	goto do_subr;
 
     case rep_Subr5:
 	nargs = 5;
-	argv[0] = argv[1] = argv[2] = argv[3] = argv[4] = Qnil;
 	/* FALL THROUGH */
 
     do_subr:
 	for(i = 0; i < nargs; i++)
-	{
-	    if(rep_CONSP(arglist))
-	    {
-		argv[i] = rep_CAR(arglist);
-		arglist = rep_CDR(arglist);
-	    }
-	    else
-		break;
-	}
+	    subr_argv[i] = i < argc ? argv[i] : Qnil;
 	if (closure)
 	    rep_USE_FUNARG(closure);
 	switch(type)
 	{
 	case rep_Subr1:
-	    result = rep_SUBR1FUN(fun)(argv[0]);
+	    result = rep_SUBR1FUN(fun)(subr_argv[0]);
 	    break;
 	case rep_Subr2:
-	    result = rep_SUBR2FUN(fun)(argv[0], argv[1]);
+	    result = rep_SUBR2FUN(fun)(subr_argv[0], subr_argv[1]);
 	    break;
 	case rep_Subr3:
-	    result = rep_SUBR3FUN(fun)(argv[0], argv[1], argv[2]);
+	    result = rep_SUBR3FUN(fun)(subr_argv[0], subr_argv[1],
+				       subr_argv[2]);
 	    break;
 	case rep_Subr4:
-	    result = rep_SUBR4FUN(fun)(argv[0], argv[1], argv[2], argv[3]);
+	    result = rep_SUBR4FUN(fun)(subr_argv[0], subr_argv[1],
+				       subr_argv[2], subr_argv[3]);
 	    break;
 	case rep_Subr5:
-	    result = rep_SUBR5FUN(fun)(argv[0], argv[1], argv[2],
-				    argv[3], argv[4]);
+	    result = rep_SUBR5FUN(fun)(subr_argv[0], subr_argv[1],
+				       subr_argv[2], subr_argv[3],
+				       subr_argv[4]);
 	    break;
 	}
 	break;
@@ -1679,7 +1897,7 @@ again:
 	if(closure && car == Qlambda)
 	{
 	    rep_USE_FUNARG (closure);
-	    result = eval_lambda (fun, arglist, tail_posn);
+	    result = eval_lambda (fun, argc, argv, tail_posn);
 	}
 	else if(closure && car == Qautoload)
 	{
@@ -1699,20 +1917,15 @@ again:
 	/* don't allow unclosed bytecode for security reasons */
 	if (closure)
 	{
-	    int nargs;
-	    repv *args;
 	    repv (*bc_apply) (repv, int, repv *);
 
 	    rep_USE_FUNARG(closure);
 	    bc_apply = rep_STRUCTURE (rep_structure)->apply_bytecode;
 
-	    nargs = rep_list_length (arglist);
-	    args = alloca (sizeof (repv) * nargs);
-	    copy_to_vector (arglist, nargs, args);
 	    if (bc_apply == 0)
-		result = rep_apply_bytecode (fun, nargs, args);
+		result = rep_apply_bytecode (fun, argc, argv);
 	    else
-		result = bc_apply (fun, nargs, args);
+		result = bc_apply (fun, argc, argv);
 	    break;
 	}
 	/* FALL THROUGH */
@@ -1721,6 +1934,7 @@ again:
 	Fsignal(Qinvalid_function, rep_LIST_1(lc.fun));
     }
 
+out:
     /* In case I missed a non-local exit somewhere.  */
     if(rep_throw_value != rep_NULL)
 	result = rep_NULL;
@@ -1737,12 +1951,23 @@ again:
 	}
     }
 
+    REP_PROBE2 (function__return, rep_probe_name (lc.fun), result != rep_NULL);
     rep_POP_CALL(lc);
-    rep_POPGC; rep_POPGC; rep_POPGC;
+    rep_POPGCN; rep_POPGC; rep_POPGC; rep_POPGC;
     rep_lisp_depth--;
     return result;
 }
 
+/* Call FUN with the arguments in the list ARGLIST */
+static repv
+apply_list (repv fun, repv arglist, repv tail_posn)
+{
+    int argc = rep_list_length (arglist);
+    repv *argv = alloca (sizeof (repv) * argc);
+    copy_to_vector (arglist, argc, argv);
+    return apply (fun, arglist, argc, argv, tail_posn);
+}
+
 /* Applies ARGLIST to FUN. If EVAL-ARGS is true, all arguments will be
    evaluated first. Note that both FUN and ARGLIST are gc-protected
    for the duration of this function. */
@@ -1757,13 +1982,13 @@ rep_funcall(repv fun, repv arglist, rep_bool eval_args)
 	rep_POPGC;
     }
 
-    return apply (fun, arglist, Qnil);
+    return apply_list (fun, arglist, Qnil);
 }
 
 repv
 rep_apply (repv fun, repv args)
 {
-    return apply (fun, args, Qnil);
+    return apply_list (fun, args, Qnil);
 }
 
 DEFUN("funcall", Ffuncall, Sfuncall, (repv args), rep_SubrN) /*
@@ -1776,7 +2001,7 @@ Calls FUNCTION with arguments ARGS... and returns the result.
     if(!rep_CONSP(args))
 	return rep_signal_missing_arg(1);
     else
-	return apply(rep_CAR(args), rep_CDR(args), Qnil);
+	return apply_list (rep_CAR(args), rep_CDR(args), Qnil);
 }
 
 DEFUN("apply", Fapply, Sapply, (repv args), rep_SubrN) /*
@@ -1789,27 +2014,40 @@ ie,
    => 21
 ::end:: */
 {
-    repv list = Qnil, *last;
-    last = &list;
-    if(rep_CONSP(args))
+    repv fun, spread, tem, *argv;
+    int argc, n, i;
+
+    if(!rep_CONSP(args))
+	return rep_signal_missing_arg(1);
+    fun = rep_CAR(args);
+    args = rep_CDR(args);
+    if(!rep_CONSP(args))
+	return rep_signal_missing_arg(2);
+
+    /* Spread the arguments into a vector, without consing a new list */
+    argc = 0;
+    for (tem = args; rep_CONSP(rep_CDR(tem)); tem = rep_CDR(tem))
     {
-	while(rep_CONSP(rep_CDR(args)))
-	{
-	    if(!(*last = Fcons(rep_CAR(args), Qnil)))
-		return(rep_NULL);
-	    last = &rep_CDR(*last);
-	    args = rep_CDR(args);
-	    rep_TEST_INT;
-	    if(rep_INTERRUPTP)
-		return(rep_NULL);
-	}
-	if(!rep_NILP(Flistp(rep_CAR(args))))
-	    *last = rep_CAR(args);
-	else
-	    return rep_signal_arg_error (rep_CAR (args), -1);
-	return(Ffuncall(list));
+	argc++;
+	rep_TEST_INT;
+	if(rep_INTERRUPTP)
+	    return rep_NULL;
     }
-    return rep_signal_missing_arg(1);
+    spread = rep_CAR(tem);
+    if(!rep_LISTP(spread))
+	return rep_signal_arg_error (spread, -1);
+    n = argc + rep_list_length (spread);
+    if(rep_INTERRUPTP)
+	return rep_NULL;
+    argv = alloca (sizeof (repv) * n);
+    for (i = 0; i < argc; i++)
+    {
+	argv[i] = rep_CAR(args);
+	args = rep_CDR(args);
+    }
+    for (; i < n; spread = rep_CDR(spread))
+	argv[i++] = rep_CAR(spread);
+    return apply (fun, rep_void_value, n, argv, Qnil);
 }
 
 static repv
@@ -1844,11 +2082,15 @@ eval(repv obj, repv tail_posn)
 
 	    if (ret != rep_NULL)
 	    {
+		int argc = rep_list_length (ret);
+		repv *argv = alloca (sizeof (repv) * argc);
+		copy_to_vector (ret, argc, argv);
+
 		lc.fun = rep_CAR (obj);
 		lc.args = ret;
 		rep_PUSH_CALL (lc);
 
-		ret = eval_lambda (rep_CAR (obj), ret, tail_posn);
+		ret = eval_lambda (rep_CAR (obj), argc, argv, tail_posn);
 
 		rep_POP_CALL (lc);
 	    }
@@ -1927,7 +2169,7 @@ eval(repv obj, repv tail_posn)
 		rep_POPGC;
 
 		if (ret != rep_NULL)
-		    ret = apply (funcobj, ret, tail_posn);
+		    ret = apply_list (funcobj, ret, tail_posn);
 
 		return ret;
 	    }
@@ -1955,9 +2197,12 @@ rep_eval (repv obj, repv tail_posn)
     if(rep_data_after_gc >= rep_gc_threshold)
     {
 	rep_GC_root gc_obj;
+	rep_bool ok;
 	rep_PUSHGC(gc_obj, obj);
-	Fgarbage_collect (Qnil);
+	ok = rep_collect_garbage ();
 	rep_POPGC;
+	if (!ok)
+	    return rep_NULL;
     }
 
     if(!rep_single_step_flag)
@@ -2065,37 +2310,13 @@ one.
     return result;
 }
 
+/* Call FUN with the ARGC arguments in ARGV, without consing a list of
+   them (unless FUN is a subr that takes one). The contents of ARGV may
+   be overwritten by the call. */
 repv
 rep_call_lispn (repv fun, int argc, repv *argv)
 {
-    if (rep_FUNARGP (fun) && rep_COMPILEDP (rep_FUNARG (fun)->fun))
-    {
-	/* Call to bytecode, avoid consing argument list */
-
-	struct rep_Call lc;
-	repv ret;
-	repv (*bc_apply) (repv, int, repv *);
-
-	lc.fun = fun;
-	lc.args = rep_void_value;
-	rep_PUSH_CALL (lc);
-	rep_USE_FUNARG (fun);
-	bc_apply = rep_STRUCTURE (rep_structure)->apply_bytecode;
-	/* if (bc_apply == 0) */
-	    ret = rep_apply_bytecode (rep_FUNARG (fun)->fun, argc, argv);
-	/* else
-	ret = bc_apply (rep_FUNARG (fun)->fun, argc, argv); */
-	rep_POP_CALL (lc);
-	return ret;
-    }
-    else
-    {
-	repv args = Qnil;
-	argv += argc;
-	while (argc-- > 0)
-	    args = Fcons (*(--argv), args);
-	return rep_funcall (fun, args, rep_FALSE);
-    }
+    return apply (fun, rep_void_value, argc, argv, Qnil);
 }
 
 repv
@@ -2511,6 +2732,8 @@ handler.
     if(rep_throw_value)
 	return rep_NULL;
     rep_DECLARE1(error, rep_SYMBOLP);
+    REP_PROBE2 (signal, rep_probe_name (error),
+		rep_CONSP (data) ? rep_probe_name (rep_CAR (data)) : "");
 
     on_error = Fsymbol_value (Qbacktrace_on_error, Qt);
     in_cond = Fsymbol_value(Qin_condition_case, Qt);
@@ -2645,6 +2868,17 @@ current_frame_id (void)
     return i - 1;
 }
 
+/* Return the argument list of call LC, or void if it isn't known. When
+   the call was made from a vector of arguments the list is made the
+   first time it's asked for. */
+static repv
+call_args (struct rep_Call *lc)
+{
+    if (rep_VOIDP (lc->args) && lc->argv != 0)
+	lc->args = Flist (lc->argc, lc->argv);
+    return lc->args;
+}
+
 static struct rep_Call *
 stack_frame_ref (int idx)
 {
@@ -2725,7 +2959,7 @@ ARGLIST had been evaluated or not before being put into the stack.
 
 	    rep_princ_val (strm, function_name);
 
-	    if (rep_VOIDP (lc->args)
+	    if (rep_VOIDP (call_args (lc))
 		|| (rep_STRINGP (function_name)
 		    && strcmp (rep_STR (function_name), "run-byte-code") == 0))
 		rep_stream_puts (strm, " ...", -1, rep_FALSE);
@@ -2774,8 +3008,9 @@ DEFUN ("stack-frame-ref", Fstack_frame_ref,
 
     if (lc != 0)
     {
-	return rep_list_5 (lc->fun, rep_VOIDP (lc->args)
-			   ? rep_undefined_value : lc->args,
+	repv args = call_args (lc);
+	return rep_list_5 (lc->fun, rep_VOIDP (args)
+			   ? rep_undefined_value : args,
 			   lc->current_form ? lc->current_form : Qnil,
 			   lc->saved_env, lc->saved_structure);
     }
@@ -20,8 +20,27 @@
 
 #define _GNU_SOURCE
 
+/* AIX requires this to be the first thing in the file.  */
+#include <config.h>
+#ifdef __GNUC__
+# define alloca __builtin_alloca
+#else
+# if HAVE_ALLOCA_H
+#  include <alloca.h>
+# else
+#  ifdef _AIX
+ #pragma alloca
+#  else
+#   ifndef alloca /* predefined by HP cc +Olibcalls */
+char *alloca ();
+#   endif
+#  endif
+# endif
+#endif
+
 #include "repint.h"
 #include "build.h"
+#include "probes.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -860,9 +879,10 @@ DEFUN("aset", Faset, Saset, (repv array, repv index, repv new), rep_Subr3) /*
 ::doc:rep.data#aset::
 aset ARRAY INDEX NEW-VALUE
 
-Sets element number INDEX (a positive integer) of ARRAY (can be a vector
-or a string) to NEW-VALUE, returning NEW-VALUE. Note that strings
-can only contain characters (ie, integers).
+Sets element number INDEX (a positive integer) of ARRAY (can be a vector,
+a string or a numeric vector) to NEW-VALUE, returning NEW-VALUE. Note
+that strings can only contain characters (ie, integers), and numeric
+vectors only numbers.
 ::end:: */
 {
     rep_DECLARE2(index, rep_INTP);
@@ -875,6 +895,7 @@ can only contain characters (ie, integers).
 	if(rep_INT(index) < rep_STRING_LEN(array))
 	{
 	    rep_DECLARE3(new, rep_INTP);
+	    rep_STRING_UNSHARE (array);
 	    ((unsigned char *)rep_STR(array))[rep_INT(index)] = (unsigned char)rep_INT(new);
 	    rep_string_modified (array);
 	    return(new);
@@ -890,6 +911,15 @@ can only contain characters (ie, integers).
 	    return(new);
 	}
     }
+    else if(rep_NUMERIC_VECTOR_P(array))
+    {
+	if(rep_INT(index) < rep_NV_LEN(array))
+	{
+	    if(!rep_numeric_vector_set(array, rep_INT(index), new))
+		return rep_signal_arg_error(new, 3);
+	    return(new);
+	}
+    }
     else
 	return(rep_signal_arg_error(array, 1));
     return(rep_signal_arg_error(index, 2));
@@ -900,7 +930,7 @@ DEFUN("aref", Faref, Saref, (repv array, repv index), rep_Subr2) /*
 aref ARRAY INDEX
 
 Returns the INDEXth (a non-negative integer) element of ARRAY, which
-can be a vector or a string. INDEX starts at zero.
+can be a vector, a string or a numeric vector. INDEX starts at zero.
 ::end:: */
 {
     rep_DECLARE2(index, rep_INTP);
@@ -916,6 +946,11 @@ can be a vector or a string. INDEX starts at zero.
 	if(rep_INT(index) < rep_VECT_LEN(array))
 	    return(rep_VECTI(array, rep_INT(index)));
     }
+    else if(rep_NUMERIC_VECTOR_P(array))
+    {
+	if(rep_INT(index) < rep_NV_LEN(array))
+	    return rep_numeric_vector_ref(array, rep_INT(index));
+    }
     else
 	return rep_signal_arg_error (array, 1);
     return rep_signal_arg_error (index, 2);
@@ -962,10 +997,10 @@ All indices start at zero.
     {
 	if((rep_INT(end) > slen) || (rep_INT(end) < rep_INT(start)))
 	    return(rep_signal_arg_error(end, 3));
-	return(rep_string_dupn(rep_STR(string) + rep_INT(start), rep_INT(end) - rep_INT(start)));
+	if(rep_INT(end) < slen)
+	    return(rep_string_dupn(rep_STR(string) + rep_INT(start), rep_INT(end) - rep_INT(start)));
     }
-    else
-	return(rep_string_dupn(rep_STR(string) + rep_INT(start), slen - rep_INT(start)));
+    return rep_string_slice(string, rep_INT(start));
 }
 
 DEFUN("concat", Fconcat, Sconcat, (int argc, repv *argv), rep_SubrV) /*
@@ -1107,6 +1142,8 @@ Returns the number of elements in SEQUENCE (a string, list or vector).
 	return(rep_MAKE_INT(i));
 	break;
     default:
+	if (rep_NUMERIC_VECTOR_P(sequence))
+	    return rep_MAKE_INT(rep_NV_LEN(sequence));
 	return rep_signal_arg_error (sequence, 1);
     }
 }
@@ -1139,7 +1176,10 @@ Returns a new sequence whose elements are eq to those in SEQUENCE.
 	}
 	break;
     case rep_Vector: case rep_Compiled:
-	res = rep_make_vector(rep_VECT_LEN(seq));
+	if (rep_COMPILEDP (seq))
+	    res = rep_make_compiled (rep_VECT_LEN(seq));
+	else
+	    res = rep_make_vector(rep_VECT_LEN(seq));
 	if(res)
 	{
 	    int i, len = rep_VECT_LEN(seq);
@@ -1227,34 +1267,16 @@ load_file_exists_p (repv name)
     return tem;
 }
 
-DEFUN ("load-file", Fload_file, Sload_file,
-       (repv name, repv structure), rep_Subr2) /*
-::doc:rep.io.files#load-file::
-load-file FILENAME [STRUCTURE]
-
-Load the file of Lisp forms called FILENAME (no suffixes are added, or
-paths searched). The file is loaded in a null lexical environment,
-within STRUCTURE. The value of the last form evaluated is returned.
-::end:: */
+/* Read and evaluate the forms in STREAM, within STRUCTURE, with
+   `load-filename' bound to NAME. Returns the last value. */
+static repv
+load_stream (repv stream, repv name, repv structure)
 {
-    repv stream, bindings = Qnil, result, tem;
+    repv bindings = Qnil, result, tem;
     rep_GC_root gc_stream, gc_bindings;
     struct rep_Call lc;
     int c;
 
-    if (structure == Qnil)
-	structure = rep_structure;
-
-    rep_DECLARE1 (name, rep_STRINGP);
-    rep_DECLARE2 (structure, rep_STRUCTUREP);
-
-    rep_PUSHGC (gc_stream, name);
-    rep_PUSHGC (gc_bindings, structure);
-    stream = Fopen_file (name, Qread);
-    rep_POPGC; rep_POPGC;
-    if (!stream || !rep_FILEP (stream))
-	return rep_NULL;
-
     bindings = rep_bind_symbol (bindings, Qload_filename, name);
     rep_PUSHGC (gc_stream, stream);
     rep_PUSHGC (gc_bindings, bindings);
@@ -1291,12 +1313,108 @@ out:
 
     rep_PUSHGC (gc_stream, result);
     rep_unbind_symbols (bindings);
-    Fclose_file (stream);
     rep_POPGC;
 
     return result;
 }
 
+/* Evaluate the list of FORMS, as load_stream does. */
+static repv
+load_forms (repv forms, repv name, repv structure)
+{
+    repv bindings = Qnil, result;
+    rep_GC_root gc_forms, gc_bindings;
+    struct rep_Call lc;
+
+    bindings = rep_bind_symbol (bindings, Qload_filename, name);
+    rep_PUSHGC (gc_forms, forms);
+    rep_PUSHGC (gc_bindings, bindings);
+
+    lc.fun = Qnil;
+    lc.args = Qnil;
+    rep_PUSH_CALL (lc);
+    rep_env = Qnil;
+    rep_structure = structure;
+
+    result = Qnil;
+    for (; rep_CONSP (forms); forms = rep_CDR (forms))
+    {
+	rep_TEST_INT;
+	if (rep_INTERRUPTP || !(result = rep_eval (rep_CAR (forms), Qnil)))
+	{
+	    result = rep_NULL;
+	    break;
+	}
+    }
+
+    rep_POP_CALL (lc);
+    rep_POPGC; rep_POPGC;
+
+    rep_PUSHGC (gc_forms, result);
+    rep_unbind_symbols (bindings);
+    rep_POPGC;
+
+    return result;
+}
+
+DEFUN ("load-file", Fload_file, Sload_file,
+       (repv name, repv structure), rep_Subr2) /*
+::doc:rep.io.files#load-file::
+load-file FILENAME [STRUCTURE]
+
+Load the file of Lisp forms called FILENAME (no suffixes are added, or
+paths searched). The file is loaded in a null lexical environment,
+within STRUCTURE. The value of the last form evaluated is returned.
+::end:: */
+{
+    repv stream, result, local;
+    rep_GC_root gc_stream, gc_structure;
+
+    if (structure == Qnil)
+	structure = rep_structure;
+
+    rep_DECLARE1 (name, rep_STRINGP);
+    rep_DECLARE2 (structure, rep_STRUCTUREP);
+
+    rep_PUSHGC (gc_stream, name);
+    rep_PUSHGC (gc_structure, structure);
+
+    /* Compiled files written by `write-fasl' are decoded straight
+       from memory, not through a stream */
+    local = Flocal_file_name (name);
+    if (local != rep_NULL && rep_STRINGP (local))
+    {
+	size_t length;
+	char *data = rep_map_file (rep_STR (local), &length);
+	if (data != 0)
+	{
+	    if (rep_fasl_data_p (data, length))
+	    {
+		repv forms = rep_read_fasl (data, length);
+		rep_unmap_file (data, length);
+		result = forms ? load_forms (forms, name, structure) : rep_NULL;
+		rep_POPGC; rep_POPGC;
+		return result;
+	    }
+	    rep_unmap_file (data, length);
+	}
+    }
+
+    stream = Fopen_file (name, Qread);
+    rep_POPGC; rep_POPGC;
+    if (!stream || !rep_FILEP (stream))
+	return rep_NULL;
+
+    rep_PUSHGC (gc_stream, stream);
+    result = load_stream (stream, name, structure);
+    rep_POPGC;
+
+    rep_PUSHGC (gc_stream, result);
+    Fclose_file (stream);
+    rep_POPGC;
+
+    return result;
+}
 DEFUN ("load-dl-file", Fload_dl_file, Sload_dl_file,
        (repv name, repv structure), rep_Subr2)
 {
@@ -1326,6 +1444,614 @@ DEFUN ("load-dl-file", Fload_dl_file, Sload_dl_file,
     return result;
 }
 
+
+
+/* Images
+
+   An image file holds copies of the Lisp files that `load' found in
+   the load-path, so that a process started with an image doesn't need
+   to search for or open them. Its format is a line `rep-image 1', a
+   line giving the number of files N, then N lines `FILE<TAB>NAME<TAB>
+   LENGTH', then the contents of each file in the same order. FILE is
+   the name given to `load', NAME the file that was actually loaded. */
+
+#define IMAGE_MAGIC "rep-image 1\n"
+
+DEFSTRING(not_an_image, "Not a rep image file");
+
+/* Files loaded from the load-path, most recent first, as a list of
+   (FILE . NAME) */
+static repv loaded_files;
+
+/* The mapped image, and a list of (FILE NAME START LENGTH) describing
+   its contents */
+static char *image_data;
+static size_t image_length;
+static repv image_index;
+
+/* Called before FILE is loaded from NAME. Returns the new element of
+   loaded_files, or nil if FILE was already known. */
+static repv
+note_loaded_file (repv file, repv name)
+{
+    repv tem = Fassoc (file, loaded_files);
+    if (tem && tem == Qnil)
+    {
+	name = Fexpand_file_name (name, Qnil);
+	if (name && rep_STRINGP (name))
+	{
+	    tem = Fcons (Fcopy_sequence (file), name);
+	    loaded_files = Fcons (tem, loaded_files);
+	    return tem;
+	}
+    }
+    return Qnil;
+}
+
+/* Called when loading the file noted as ENTRY failed. This happens
+   while the error is being thrown, so it can't use Fdelq, which gives
+   up when rep_throw_value is set. */
+static void
+forget_loaded_file (repv entry)
+{
+    repv *ptr = &loaded_files;
+    while (rep_CONSP (*ptr))
+    {
+	if (rep_CAR (*ptr) == entry)
+	{
+	    *ptr = rep_CDR (*ptr);
+	    break;
+	}
+	ptr = rep_CDRLOC (*ptr);
+    }
+}
+
+/* Load image entry ENTRY, i.e. (NAME START LENGTH) */
+static repv
+load_image_entry (repv entry, repv structure)
+{
+    repv name = rep_CAR(entry);
+    long start = rep_INT(rep_CADR(entry));
+    long length = rep_INT(rep_CADDR(entry));
+    repv string, stream;
+
+    if (rep_fasl_data_p (image_data + start, length))
+    {
+	repv forms = rep_read_fasl (image_data + start, length);
+	return forms ? load_forms (forms, name, structure) : rep_NULL;
+    }
+
+    string = rep_string_dupn (image_data + start, length);
+    if (string == rep_NULL)
+	return rep_NULL;
+    stream = Fmake_string_input_stream (string, Qnil);
+    if (stream == rep_NULL)
+	return rep_NULL;
+    return load_stream (stream, name, structure);
+}
+
+/* Read the field at *PTR up to the character END, advancing *PTR past
+   it. Returns null if END isn't found before LIMIT. */
+static repv
+image_field (char **ptr, char *limit, int end)
+{
+    char *start = *ptr, *stop = memchr (start, end, limit - start);
+    if (stop == 0)
+	return rep_NULL;
+    *ptr = stop + 1;
+    return rep_string_dupn (start, stop - start);
+}
+
+/* Open the image in the local file NAME. Returns zero if successful,
+   or -1 if the file couldn't be read, -2 if it isn't an image. */
+static int
+open_image (const char *name)
+{
+    repv local, index = Qnil, *tail = &index;
+    char *data, *ptr, *limit;
+    size_t length;
+    long count, offset = 0, i;
+
+    data = rep_map_file (name, &length);
+    if (data == 0)
+	return -1;
+    limit = data + length;
+
+    if (length < sizeof (IMAGE_MAGIC) - 1
+	|| memcmp (data, IMAGE_MAGIC, sizeof (IMAGE_MAGIC) - 1) != 0)
+	goto bad;
+    ptr = data + sizeof (IMAGE_MAGIC) - 1;
+    count = strtol (ptr, &ptr, 10);
+    if (count < 0 || ptr >= limit || *ptr++ != '\n')
+	goto bad;
+
+    for (i = 0; i < count; i++)
+    {
+	repv key, name;
+	long len;
+	key = image_field (&ptr, limit, '\t');
+	if (key == rep_NULL)
+	    goto bad;
+	name = image_field (&ptr, limit, '\t');
+	if (name == rep_NULL)
+	    goto bad;
+	len = strtol (ptr, &ptr, 10);
+	if (len < 0 || len > rep_LISP_MAX_INT
+	    || ptr >= limit || *ptr++ != '\n')
+	    goto bad;
+	*tail = Fcons (rep_list_4 (key, name, rep_MAKE_INT (offset),
+				   rep_MAKE_INT (len)), Qnil);
+	tail = rep_CDRLOC (*tail);
+	offset += len;
+    }
+
+    /* the offsets were relative to the end of the header */
+    if (offset > limit - ptr)
+	goto bad;
+    for (local = index; local != Qnil; local = rep_CDR (local))
+    {
+	repv cell = rep_CDR (rep_CDAR (local));
+	rep_CAR (cell) = rep_MAKE_INT (rep_INT (rep_CAR (cell))
+				       + (ptr - data));
+    }
+
+    if (image_data != 0)
+	rep_unmap_file (image_data, image_length);
+    image_data = data;
+    image_length = length;
+    image_index = index;
+    return 0;
+
+bad:
+    rep_unmap_file (data, length);
+    return -2;
+}
+
+/* Turn the result of open_image (FILE) into t, or an error */
+static repv
+open_image_result (int result, repv file)
+{
+    switch (result)
+    {
+    case 0:
+	return Qt;
+    case -1:
+	return rep_signal_file_error (file);
+    default:
+	return Fsignal (Qerror, rep_list_2 (rep_VAL (&not_an_image), file));
+    }
+}
+
+/* Used for the --image option, before the file handlers are loaded.
+   Returns t, or null with an error signalled if FILE can't be used. */
+repv
+rep_open_image (repv file)
+{
+    return open_image_result (open_image (rep_STR (file)), file);
+}
+
+DEFUN("open-image", Fopen_image, Sopen_image, (repv file), rep_Subr1) /*
+::doc:rep.io.files#open-image::
+open-image FILE
+
+Use the Lisp files stored in the image file FILE (see `dump-image') in
+preference to searching the `load-path'. Any previously opened image is
+closed.
+::end:: */
+{
+    repv local;
+
+    rep_DECLARE1 (file, rep_STRINGP);
+    local = Flocal_file_name (file);
+    if (!local || !rep_STRINGP (local))
+	return local ? rep_signal_file_error (file) : rep_NULL;
+
+    return open_image_result (open_image (rep_STR (local)), file);
+}
+
+DEFUN("dump-image", Fdump_image, Sdump_image, (repv file), rep_Subr1) /*
+::doc:rep.io.files#dump-image::
+dump-image FILE
+
+Write all Lisp files that have been found in the `load-path' by `load'
+so far into the image file FILE. When a later process is started with
+the `--image FILE' option (or calls `open-image'), loading any of these
+files uses the copy in the image; the original files are no longer
+consulted, or even need to exist.
+::end:: */
+{
+    repv local, files, contents = Qnil, tem;
+    rep_GC_root gc_files, gc_contents;
+    FILE *fh;
+    long count = 0;
+
+    rep_DECLARE1 (file, rep_STRINGP);
+    local = Flocal_file_name (file);
+    if (!local || !rep_STRINGP (local))
+	return local ? rep_signal_file_error (file) : rep_NULL;
+
+    /* Read everything first, in the order it was loaded */
+    files = Freverse (loaded_files);
+    rep_PUSHGC (gc_files, files);
+    rep_PUSHGC (gc_contents, contents);
+    for (tem = files; rep_CONSP (tem); tem = rep_CDR (tem))
+    {
+	repv name = rep_CDAR (tem), data = Qnil;
+	repv key = rep_CAAR (tem);
+	repv name_local = Flocal_file_name (name);
+	if (name_local && rep_STRINGP (name_local)
+	    && !strpbrk (rep_STR (key), "\t\n")
+	    && !strpbrk (rep_STR (name), "\t\n"))
+	{
+	    size_t length;
+	    char *mem = rep_map_file (rep_STR (name_local), &length);
+	    if (mem != 0)
+	    {
+		data = rep_string_dupn (mem, length);
+		rep_unmap_file (mem, length);
+		count++;
+	    }
+	}
+	contents = Fcons (data, contents);
+    }
+    contents = Fnreverse (contents);
+    rep_POPGC; rep_POPGC;
+
+    fh = fopen (rep_STR (local), "w");
+    if (fh == 0)
+	return rep_signal_file_error (file);
+
+    fputs (IMAGE_MAGIC, fh);
+    fprintf (fh, "%ld\n", count);
+    for (tem = files, local = contents; rep_CONSP (tem);
+	 tem = rep_CDR (tem), local = rep_CDR (local))
+    {
+	if (rep_STRINGP (rep_CAR (local)))
+	{
+	    fprintf (fh, "%s\t%s\t%ld\n", rep_STR (rep_CAAR (tem)),
+		     rep_STR (rep_CDAR (tem)),
+		     (long) rep_STRING_LEN (rep_CAR (local)));
+	}
+    }
+    for (local = contents; rep_CONSP (local); local = rep_CDR (local))
+    {
+	if (rep_STRINGP (rep_CAR (local)))
+	    fwrite (rep_STR (rep_CAR (local)), 1,
+		    rep_STRING_LEN (rep_CAR (local)), fh);
+    }
+    if (fclose (fh) != 0)
+	return rep_signal_file_error (file);
+
+    return rep_MAKE_INT (count);
+}
+
+
+/* Module indexes
+
+   A directory in the load-path may contain an index of the Lisp files
+   under it, written by rep.util.module-index. `load' uses it instead
+   of probing the directory once for each suffix, and `open-structures'
+   uses the exports it records to open a structure without loading it
+   until one of them is referenced (see structures.c).
+
+   The index is the file `rep-modules' in the directory. Its format is
+   a line `rep-module-index 1', then a line `FILE<TAB>SUFFIXES<TAB>
+   STRUCTURE<TAB>EXPORTS' for each Lisp file, sorted by FILE. FILE is
+   the file's name relative to the directory, without its suffix;
+   SUFFIXES lists the suffixes it exists with, STRUCTURE names the
+   structure it defines and EXPORTS the names that structure exports,
+   separated by spaces. STRUCTURE and EXPORTS are `-' when not known.
+   The file is mapped and searched in place, it isn't parsed. */
+
+#define MODULE_INDEX_FILE "rep-modules"
+#define MODULE_INDEX_MAGIC "rep-module-index 1\n"
+
+struct module_index {
+    struct module_index *next;
+    char *dir;				/* as in load-path */
+    char *file;				/* local name of index */
+    rep_bool indexed;
+    char *data;				/* the mapped file, or null */
+    size_t length;
+};
+
+/* Directories looked at so far */
+static struct module_index *module_indexes;
+
+/* Return the index of load-path directory DIR. If DIR doesn't exist
+   it's treated as having an empty index. Returns null after an error. */
+static struct module_index *
+find_module_index (repv dir)
+{
+    struct module_index *x;
+    repv local;
+
+    for (x = module_indexes; x != 0; x = x->next)
+    {
+	if (strcmp (x->dir, rep_STR (dir)) == 0)
+	    return x;
+    }
+
+    x = rep_alloc (sizeof (struct module_index));
+    if (x == 0)
+	return 0;
+    x->dir = strdup (rep_STR (dir));
+    x->file = 0;
+    x->indexed = rep_FALSE;
+    x->data = 0;
+    x->length = 0;
+    if (x->dir == 0)
+    {
+	rep_free (x);
+	return 0;
+    }
+    x->next = module_indexes;
+    module_indexes = x;
+
+    /* Relative directories depend on the current directory, and
+       remote ones would need a file handler */
+    local = Flocal_file_name (dir);
+    if (local && rep_STRINGP (local) && rep_STR (local)[0] == '/')
+    {
+	size_t len = rep_STRING_LEN (local);
+	x->file = rep_alloc (len + sizeof (MODULE_INDEX_FILE) + 1);
+	if (x->file != 0)
+	{
+	    memcpy (x->file, rep_STR (local), len);
+	    if (len == 0 || x->file[len-1] != '/')
+		x->file[len++] = '/';
+	    strcpy (x->file + len, MODULE_INDEX_FILE);
+	    x->data = rep_map_file (x->file, &x->length);
+	}
+	if (x->data != 0)
+	{
+	    if (x->length >= sizeof (MODULE_INDEX_MAGIC) - 1
+		&& memcmp (x->data, MODULE_INDEX_MAGIC,
+			   sizeof (MODULE_INDEX_MAGIC) - 1) == 0)
+	    {
+		x->indexed = rep_TRUE;
+	    }
+	    else
+	    {
+		rep_unmap_file (x->data, x->length);
+		x->data = 0;
+	    }
+	}
+	else
+	{
+	    repv tem = Ffile_exists_p (local);
+	    if (tem == Qnil)
+		x->indexed = rep_TRUE;
+	}
+    }
+    return x;
+}
+
+/* Return the line of index X describing FILE (LEN bytes), or null. The
+   line extends to the next newline, there's always one. */
+static char *
+module_index_entry (struct module_index *x, const char *file, size_t len)
+{
+    char *lo, *hi;
+
+    if (x->data == 0)
+	return 0;
+    lo = x->data + sizeof (MODULE_INDEX_MAGIC) - 1;
+    hi = x->data + x->length;
+    if (hi > lo && hi[-1] != '\n')
+	return 0;
+
+    while (lo < hi)
+    {
+	char *line = lo + (hi - lo) / 2;
+	char *tab;
+	size_t key_len;
+	int cmp;
+
+	while (line > lo && line[-1] != '\n')
+	    line--;
+	tab = memchr (line, '\t', hi - line);
+	if (tab == 0)
+	    return 0;
+	key_len = tab - line;
+	cmp = memcmp (line, file, MIN (key_len, len));
+	if (cmp == 0)
+	    cmp = (key_len < len) ? -1 : (key_len > len) ? 1 : 0;
+	if (cmp == 0)
+	    return line;
+	else if (cmp > 0)
+	    hi = line;
+	else
+	    lo = (char *) memchr (line, '\n', hi - line) + 1;
+    }
+    return 0;
+}
+
+/* Find field number N of index line LINE, storing its length in *LEN */
+static char *
+module_index_field (char *line, int n, size_t *len)
+{
+    char *end = strchr (line, '\n');
+    while (n-- > 0)
+    {
+	line = memchr (line, '\t', end - line);
+	if (line == 0)
+	{
+	    *len = 0;
+	    return end;
+	}
+	line++;
+    }
+    *len = strcspn (line, "\t\n");
+    return line;
+}
+
+/* Return true if the string STR (LEN bytes) is one of the words
+   in the field FIELD (FIELD-LEN bytes) */
+static rep_bool
+module_index_field_member (char *field, size_t field_len,
+			   const char *str, size_t len)
+{
+    char *end = field + field_len;
+    while (field < end)
+    {
+	char *word_end = memchr (field, ' ', end - field);
+	if (word_end == 0)
+	    word_end = end;
+	if (word_end - field == len && memcmp (field, str, len) == 0)
+	    return rep_TRUE;
+	field = word_end + 1;
+    }
+    return rep_FALSE;
+}
+
+/* Return true if the index could describe FILE: the index only lists
+   files under the directory, with the usual suffixes */
+static rep_bool
+module_index_usable_p (repv file, repv suffixes)
+{
+    const char *s = rep_STR (file);
+    return (s[0] != 0 && s[0] != '/' && s[0] != '~' && s[0] != '.'
+	    && strstr (s, "/.") == 0 && strchr (s, '\n') == 0
+	    && rep_STRINGP (rep_CAR (suffixes))
+	    && strcmp (rep_STR (rep_CAR (suffixes)), ".jl") == 0
+	    && rep_STRINGP (rep_CDR (suffixes))
+	    && strcmp (rep_STR (rep_CDR (suffixes)), ".jlc") == 0);
+}
+
+/* Return true if the index X isn't older than any of the files
+   described by its entry LINE, for FILE */
+static rep_bool
+index_newer_than_files (struct module_index *x, char *line, repv file)
+{
+    repv index_file = rep_string_dup (x->file);
+    rep_GC_root gc_index_file, gc_file;
+    rep_bool ret = rep_TRUE;
+    size_t len;
+    char *field = module_index_field (line, 1, &len);
+
+    if (index_file == rep_NULL)
+	return rep_FALSE;
+    rep_PUSHGC (gc_index_file, index_file);
+    rep_PUSHGC (gc_file, file);
+    while (len > 0 && ret)
+    {
+	size_t word = strcspn (field, " \t\n");
+	repv source = rep_string_dupn (field, word);
+	if (source != rep_NULL)
+	    source = rep_concat2 (rep_STR (file), rep_STR (source));
+	if (source != rep_NULL)
+	    source = Fexpand_file_name (source, rep_string_dup (x->dir));
+	if (source == rep_NULL || !rep_STRINGP (source)
+	    || rep_file_newer_than (source, index_file))
+	    ret = rep_FALSE;
+	if (word < len)
+	    word++;
+	field += word;
+	len -= word;
+    }
+    rep_POPGC; rep_POPGC;
+    return ret;
+}
+
+DEFUN("flush-module-indexes", Fflush_module_indexes,
+      Sflush_module_indexes, (void), rep_Subr0) /*
+::doc:rep.io.files#flush-module-indexes::
+flush-module-indexes
+
+Forget the module indexes of the directories in the `load-path' that
+have been read so far, so that they are read again when next needed.
+::end:: */
+{
+    while (module_indexes != 0)
+    {
+	struct module_index *next = module_indexes->next;
+	if (module_indexes->data != 0)
+	    rep_unmap_file (module_indexes->data, module_indexes->length);
+	free (module_indexes->dir);
+	rep_free (module_indexes->file);
+	rep_free (module_indexes);
+	module_indexes = next;
+    }
+    return Qnil;
+}
+
+/* If the structure called NAME would be loaded from a file described by
+   a module index, and the index records which names it exports and is
+   newer than the file, return the list of those names. Otherwise
+   returns nil, or rep_NULL after an error. */
+repv
+rep_module_index_exports (repv name)
+{
+    repv file, path, suffixes;
+    rep_GC_root gc_file, gc_path, gc_ret;
+    repv ret = Qnil;
+
+    file = Fstructure_file (name);
+    if (!file || !rep_STRINGP (file))
+	return file;
+    suffixes = F_structure_ref (rep_structure, Q_load_suffixes);
+    if (!suffixes || !rep_CONSP (suffixes))
+	suffixes = default_suffixes;
+    if (!module_index_usable_p (file, suffixes)
+	|| (image_index != Qnil && Fassoc (file, image_index) != Qnil))
+	return Qnil;
+
+    path = Fsymbol_value (Qload_path, Qnil);
+    if (!path)
+	return rep_NULL;
+
+    rep_PUSHGC (gc_file, file);
+    rep_PUSHGC (gc_path, path);
+    rep_PUSHGC (gc_ret, ret);
+    for (; rep_CONSP (path); path = rep_CDR (path))
+    {
+	struct module_index *x;
+	char *line, *field;
+	size_t len;
+
+	if (!rep_STRINGP (rep_CAR (path)))
+	    continue;
+	x = find_module_index (rep_CAR (path));
+	if (x == 0 || !x->indexed)
+	    break;
+	line = module_index_entry (x, rep_STR (file), rep_STRING_LEN (file));
+	if (line == 0)
+	    continue;
+
+	field = module_index_field (line, 2, &len);
+	if (len != rep_STRING_LEN (rep_SYM (name)->name)
+	    || memcmp (field, rep_STR (rep_SYM (name)->name), len) != 0)
+	    break;
+
+	/* The exports may have changed since the index was written */
+	if (!index_newer_than_files (x, line, file))
+	    break;
+
+	field = module_index_field (line, 3, &len);
+	if (len == 1 && field[0] == '-')
+	    break;
+	while (len > 0)
+	{
+	    size_t word = strcspn (field, " \t\n");
+	    repv sym = rep_intern_chars (field, word, Qnil);
+	    if (sym == rep_NULL)
+	    {
+		ret = rep_NULL;
+		break;
+	    }
+	    ret = Fcons (sym, ret);
+	    if (word < len)
+		word++;
+	    field += word;
+	    len -= word;
+	}
+	break;
+    }
+    rep_POPGC; rep_POPGC; rep_POPGC;
+    return ret;
+}
+
 DEFUN_INT("load", Fload, Sload, (repv file, repv noerr_p, repv nopath_p, repv nosuf_p, repv unused), rep_Subr5, "fLisp file to load:") /*
 ::doc:rep.io.files#load::
 load FILE [NO-ERROR] [NO-PATH] [NO-SUFFIX]
@@ -1342,6 +2068,10 @@ of FILE. If NO-SUFFIX is non-nil no suffixes are appended to FILE.
 
 If the compiled version is older than it's source code, the source code is
 loaded and a warning is displayed.
+
+A directory in `load-path' containing a module index (see the
+`rep.util.module-index' module) isn't searched, the index says which
+files it contains.
 ::end:: */
 {
     /* Avoid the need to protect these args from GC. */
@@ -1355,9 +2085,34 @@ loaded and a warning is displayed.
     repv suffixes;
     rep_bool trying_dl = rep_FALSE;
 
+    rep_bool use_index;
+
     rep_GC_root gc_file, gc_name, gc_path, gc_dir, gc_try, gc_result, gc_suffixes;
 
     rep_DECLARE1(file, rep_STRINGP);
+
+    if (image_index != Qnil && rep_NILP (nopath_p) && !no_suffix_p)
+    {
+	repv entry = Fassoc (file, image_index);
+	if (entry && rep_CONSP (entry))
+	{
+	    rep_PUSHGC (gc_file, file);
+	    rep_PUSHGC (gc_name, entry);
+	    name = note_loaded_file (file, rep_CADR (entry));
+	    rep_PUSHGC (gc_dir, name);
+	    REP_PROBE2 (load__start, rep_STR (file),
+			rep_probe_name (rep_CADR (entry)));
+	    result = load_image_entry (rep_CDR (entry), rep_structure);
+	    REP_PROBE2 (load__done, rep_STR (file), result != rep_NULL);
+	    if (result == rep_NULL)
+		forget_loaded_file (name);
+	    rep_POPGC; rep_POPGC; rep_POPGC;
+	    if (result == rep_NULL)
+		return rep_NULL;
+	    goto loaded;
+	}
+    }
+
     if(rep_NILP(nopath_p))
     {
 	path = Fsymbol_value(Qload_path, Qnil);
@@ -1370,6 +2125,8 @@ loaded and a warning is displayed.
     suffixes = F_structure_ref (rep_structure, Q_load_suffixes);
     if (!suffixes || !rep_CONSP (suffixes))
 	suffixes = default_suffixes;
+    use_index = (rep_NILP (nopath_p) && !no_suffix_p
+		 && module_index_usable_p (file, suffixes));
 
     rep_PUSHGC(gc_name, name);
     rep_PUSHGC(gc_file, file);
@@ -1382,6 +2139,23 @@ loaded and a warning is displayed.
 research:
     while(rep_NILP(name) && rep_CONSP(path))
     {
+	char *entry = 0;
+	if (use_index && !trying_dl && rep_STRINGP (rep_CAR(path)))
+	{
+	    /* If the directory is indexed, only look for FILE with
+	       the suffixes the index lists, and not at all if it
+	       isn't there */
+	    struct module_index *x = find_module_index (rep_CAR(path));
+	    if (x == 0)
+		goto path_error;
+	    if (x->indexed)
+	    {
+		entry = module_index_entry (x, rep_STR(file),
+					    rep_STRING_LEN(file));
+		if (entry == 0)
+		    goto next;
+	    }
+	}
 	if (rep_STRINGP (rep_CAR(path)))
 	{
 	    dir = Fexpand_file_name (file, rep_CAR(path));
@@ -1419,7 +2193,18 @@ research:
 
 		    if (try && rep_STRINGP (try))
 		    {
-			tem = load_file_exists_p (try);
+			if (entry != 0)
+			{
+			    size_t len;
+			    char *field = module_index_field (entry, 1, &len);
+			    repv sfx = ((i == 0)
+					? rep_CAR(suffixes) : rep_CDR(suffixes));
+			    tem = (module_index_field_member
+				   (field, len, rep_STR(sfx), rep_STRING_LEN(sfx))
+				   ? load_file_exists_p (try) : Qnil);
+			}
+			else
+			    tem = load_file_exists_p (try);
 			if(!tem)
 			    goto path_error;
 			if(tem != Qnil)
@@ -1449,6 +2234,7 @@ research:
 		    name = dir;
 	    }
 	}
+    next:
 	path = rep_CDR(path);
 	rep_TEST_INT;
 	if(rep_INTERRUPTP)
@@ -1483,16 +2269,28 @@ path_error:
     }
 
     rep_PUSHGC (gc_file, file);
+    REP_PROBE2 (load__start, rep_STR (file), rep_STR (name));
 #ifdef HAVE_DYNAMIC_LOADING
     if(trying_dl)
 	result = Fload_dl_file (name, rep_structure);
     else
 #endif
+    {
+	repv entry = Qnil;
+	if (rep_NILP (nopath_p))
+	    entry = note_loaded_file (file, name);
+	rep_PUSHGC (gc_name, entry);
 	result = Fload_file (name, rep_structure);
+	if (result == rep_NULL)
+	    forget_loaded_file (entry);
+	rep_POPGC;
+    }
+    REP_PROBE2 (load__done, rep_STR (file), result != rep_NULL);
     rep_POPGC;
     if (result == rep_NULL)
 	return rep_NULL;
 
+loaded:
     /* Loading succeeded. Look for an applicable item in
        the after-load-alist. */
     if (rep_STRUCTUREP (result) && rep_STRUCTURE (result)->name != Qnil)
@@ -1582,19 +2380,11 @@ Returns t if STRING2 matches the beginning of STRING1, ie,
    => nil
 ::end:: */
 {
-    char *s1, *s2;
     rep_DECLARE1(str1, rep_STRINGP);
     rep_DECLARE2(str2, rep_STRINGP);
-    s1 = rep_STR(str1);
-    s2 = rep_STR(str2);
-    while(*s1 && *s2)
-    {
-	if(*s1++ != *s2++)
-	    return(Qnil);
-    }
-    if(*s1 || (*s1 == *s2))
-	return(Qt);
-    return(Qnil);
+    return (rep_STRING_LEN(str2) <= rep_STRING_LEN(str1)
+	    && memcmp(rep_STR(str1), rep_STR(str2),
+		      rep_STRING_LEN(str2)) == 0) ? Qt : Qnil;
 }
 
 DEFUN("string-equal", Fstring_equal, Sstring_equal, (repv str1, repv str2), rep_Subr2) /*
@@ -1604,18 +2394,11 @@ string-equal STRING1 STRING2
 Returns t if STRING1 and STRING2 are the same, ignoring case.
 ::end:: */
 {
-    char *s1, *s2;
     rep_DECLARE1(str1, rep_STRINGP);
     rep_DECLARE2(str2, rep_STRINGP);
-    s1 = rep_STR(str1);
-    s2 = rep_STR(str2);
-    while(*s1 && *s2)
-    {
-	if (toupper (*s1) != toupper (*s2))
-	    return Qnil;
-	s1++; s2++;
-    }
-    return (*s1 || *s2) ? Qnil : Qt;
+    return (rep_STRING_LEN(str1) == rep_STRING_LEN(str2)
+	    && rep_str_casecmp(rep_STR(str1), rep_STR(str2),
+			       rep_STRING_LEN(str1)) == 0) ? Qt : Qnil;
 }
 
 DEFUN("string-lessp", Fstring_lessp, Sstring_lessp, (repv str1, repv str2), rep_Subr2) /*
@@ -1625,18 +2408,14 @@ string-lessp STRING1 STRING2
 Returns t if STRING1 is `less' than STRING2, ignoring case.
 ::end:: */
 {
-    char *s1, *s2;
+    long len1, len2;
+    int tem;
     rep_DECLARE1(str1, rep_STRINGP);
     rep_DECLARE2(str2, rep_STRINGP);
-    s1 = rep_STR(str1);
-    s2 = rep_STR(str2);
-    while(*s1 && *s2)
-    {
-	if (toupper (*s1) != toupper (*s2))
-	    return (toupper (*s1) < toupper (*s2)) ? Qt : Qnil;
-	s1++; s2++;
-    }
-    return *s2 ? Qt : Qnil;
+    len1 = rep_STRING_LEN(str1);
+    len2 = rep_STRING_LEN(str2);
+    tem = rep_str_casecmp(rep_STR(str1), rep_STR(str2), MIN(len1, len2));
+    return (tem < 0 || (tem == 0 && len1 < len2)) ? Qt : Qnil;
 }
 
 #define APPLY_COMPARISON(op)				\
@@ -1725,6 +2504,239 @@ limited to numbers, it can do strings, positions, marks, etc as well.
     APPLY_COMPARISON(<=)
 }
 
+/* Stable merge sort, for `sort' in rep.data.sort */
+
+typedef struct {
+    repv pred;
+    int fast;			/* one of the SORT_ constants */
+    repv keys;			/* vector of sort keys */
+} sort_state;
+
+enum { SORT_FUNCALL, SORT_LESS, SORT_GREATER, SORT_STRING_LESSP };
+
+static inline int
+sort_value_cmp (repv a, repv b)
+{
+    if (rep_INTP (a) && rep_INTP (b))
+	return (a < b) ? -1 : (a > b);
+    else if (rep_NUMBERP (a) || rep_NUMBERP (b))
+	return rep_compare_numbers (a, b);
+    else
+	return rep_value_cmp (a, b);
+}
+
+/* Returns 1 if the key at index J sorts before the key at index I,
+   0 if not, or -1 if an error occurred. */
+static int
+sort_before (sort_state *s, int j, int i)
+{
+    repv a = rep_VECTI (s->keys, j), b = rep_VECTI (s->keys, i);
+
+    switch (s->fast)
+    {
+    case SORT_LESS:
+	return sort_value_cmp (a, b) < 0;
+
+    case SORT_GREATER:
+	return sort_value_cmp (a, b) > 0;
+
+    case SORT_STRING_LESSP:
+	if (rep_STRINGP (a) && rep_STRINGP (b))
+	{
+	    long len1 = rep_STRING_LEN (a), len2 = rep_STRING_LEN (b);
+	    int tem = rep_str_casecmp (rep_STR (a), rep_STR (b),
+				       MIN (len1, len2));
+	    return tem < 0 || (tem == 0 && len1 < len2);
+	}
+	/* fall through, to signal the error */
+
+    default: {
+	repv res = rep_call_lisp2 (s->pred, a, b);
+	return (res == rep_NULL) ? -1 : (res != Qnil);
+    }
+    }
+}
+
+/* Sort the N indices in IDX, using TMP (also N long) as scratch space.
+   Returns false if an error occurred. */
+static rep_bool
+merge_sort (sort_state *s, int *idx, int *tmp, int n)
+{
+    int mid, i, j, k, r;
+
+    if (n <= 8)
+    {
+	/* insertion sort, also stable */
+	for (i = 1; i < n; i++)
+	{
+	    int x = idx[i];
+	    for (j = i; j > 0; j--)
+	    {
+		r = sort_before (s, x, idx[j-1]);
+		if (r < 0)
+		    return rep_FALSE;
+		if (!r)
+		    break;
+		idx[j] = idx[j-1];
+	    }
+	    idx[j] = x;
+	}
+	return rep_TRUE;
+    }
+
+    mid = n / 2;
+    if (!merge_sort (s, idx, tmp, mid)
+	|| !merge_sort (s, idx + mid, tmp, n - mid))
+    {
+	return rep_FALSE;
+    }
+
+    /* already in order? (common for presorted input) */
+    r = sort_before (s, idx[mid], idx[mid-1]);
+    if (r <= 0)
+	return r == 0;
+
+    memcpy (tmp, idx, mid * sizeof (int));
+    i = 0; j = mid; k = 0;
+    while (i < mid && j < n)
+    {
+	r = sort_before (s, idx[j], tmp[i]);
+	if (r < 0)
+	{
+	    /* put the remaining left half back, so IDX is
+	       still a permutation */
+	    memcpy (idx + k, tmp + i, (mid - i) * sizeof (int));
+	    return rep_FALSE;
+	}
+	idx[k++] = r ? idx[j++] : tmp[i++];
+	rep_TEST_INT;
+	if (rep_INTERRUPTP)
+	{
+	    memcpy (idx + k, tmp + i, (mid - i) * sizeof (int));
+	    return rep_FALSE;
+	}
+    }
+    memcpy (idx + k, tmp + i, (mid - i) * sizeof (int));
+    return rep_TRUE;
+}
+
+DEFUN("%sort", F_sort, S_sort, (repv seq, repv pred, repv key), rep_Subr3) /*
+::doc:rep.data#%sort::
+%sort SEQUENCE [PREDICATE] [KEY]
+
+Stably sort the list or vector SEQUENCE, destructively, returning the
+sorted sequence. PREDICATE defaults to `<'. If KEY is a function it is
+called once on each element, and PREDICATE compares its results. Use
+`sort' instead of calling this directly.
+::end:: */
+{
+    sort_state s;
+    repv items, ret = rep_NULL;
+    rep_GC_root gc_seq, gc_pred, gc_key, gc_items, gc_keys;
+    int n, i, *idx;
+
+    if (rep_VECTORP (seq))
+    {
+	if (!rep_VECTOR_WRITABLE_P (seq))
+	    return Fsignal (Qsetting_constant, rep_LIST_1 (seq));
+	n = rep_VECT_LEN (seq);
+    }
+    else if (rep_LISTP (seq))
+	n = rep_list_length (seq);
+    else
+	return rep_signal_arg_error (seq, 1);
+
+    if (n < 2)
+	return seq;
+
+    if (pred == Qnil || pred == rep_VAL (&Sltthan))
+	s.fast = SORT_LESS;
+    else if (pred == rep_VAL (&Sgtthan))
+	s.fast = SORT_GREATER;
+    else if (pred == rep_VAL (&Sstring_lessp))
+	s.fast = SORT_STRING_LESSP;
+    else
+	s.fast = SORT_FUNCALL;
+    s.pred = pred;
+
+    /* ITEMS holds the elements of a vector, or the cells of a list */
+    items = rep_make_vector (n);
+    if (items == rep_NULL)
+	return rep_NULL;
+    if (rep_VECTORP (seq))
+	memcpy (rep_VECT (items)->array, rep_VECT (seq)->array,
+		n * sizeof (repv));
+    else
+    {
+	repv tem = seq;
+	for (i = 0; i < n; i++)
+	{
+	    if (!rep_CONS_WRITABLE_P (tem))
+		return Fsignal (Qsetting_constant, rep_LIST_1 (tem));
+	    rep_VECTI (items, i) = tem;
+	    tem = rep_CDR (tem);
+	}
+    }
+
+    rep_PUSHGC (gc_seq, seq);
+    rep_PUSHGC (gc_pred, pred);
+    rep_PUSHGC (gc_key, key);
+    rep_PUSHGC (gc_items, items);
+
+    s.keys = rep_make_vector (n);
+    rep_PUSHGC (gc_keys, s.keys);
+    if (s.keys == rep_NULL)
+	goto out;
+    for (i = 0; i < n; i++)
+    {
+	repv elt = rep_VECTI (items, i);
+	if (rep_CONSP (seq))
+	    elt = rep_CAR (elt);
+	rep_VECTI (s.keys, i) = elt;
+    }
+    if (key != Qnil)
+    {
+	for (i = 0; i < n; i++)
+	{
+	    repv k = rep_call_lisp1 (key, rep_VECTI (s.keys, i));
+	    if (k == rep_NULL)
+		goto out;
+	    rep_VECTI (s.keys, i) = k;
+	}
+    }
+
+    idx = rep_alloc (2 * n * sizeof (int));
+    if (idx == 0)
+    {
+	rep_mem_error ();
+	goto out;
+    }
+    for (i = 0; i < n; i++)
+	idx[i] = i;
+
+    if (merge_sort (&s, idx, idx + n, n))
+    {
+	if (rep_VECTORP (seq))
+	{
+	    for (i = 0; i < n; i++)
+		rep_VECTI (seq, i) = rep_VECTI (items, idx[i]);
+	}
+	else
+	{
+	    for (i = 0; i < n - 1; i++)
+		rep_CDR (rep_VECTI (items, idx[i])) = rep_VECTI (items, idx[i+1]);
+	    rep_CDR (rep_VECTI (items, idx[n-1])) = Qnil;
+	    seq = rep_VECTI (items, idx[0]);
+	}
+	ret = seq;
+    }
+    rep_free (idx);
+
+out:
+    rep_POPGC; rep_POPGC; rep_POPGC; rep_POPGC; rep_POPGC;
+    return ret;
+}
+
 DEFUN("null", Fnull, Snull, (repv arg), rep_Subr1) /*
 ::doc:rep.data#null::
 null ARG
@@ -1917,7 +2929,8 @@ returned.
 ::end:: */
 {
     rep_GC_root gc_hook, gc_arg_list, gc_type;
-    repv res = Qnil;
+    repv res = Qnil, *argv;
+    int argc;
     rep_DECLARE2(arg_list, rep_LISTP);
     if(!rep_LISTP(hook))
     {
@@ -1926,12 +2939,19 @@ returned.
 	if(rep_VOIDP(hook) || rep_NILP(hook))
 	    return Qnil;
     }
+    argc = rep_list_length (arg_list);
+    argv = alloca (sizeof (repv) * argc);
     rep_PUSHGC(gc_hook, hook);
     rep_PUSHGC(gc_arg_list, arg_list);
     rep_PUSHGC(gc_type, type);
     while(rep_CONSP(hook))
     {
-	res = Ffuncall(Fcons(rep_CAR(hook), arg_list));
+	/* the call may overwrite the vector, so refill it each time */
+	repv tem = arg_list;
+	int i;
+	for (i = 0; i < argc; i++, tem = rep_CDR (tem))
+	    argv[i] = rep_CAR (tem);
+	res = rep_call_lispn (rep_CAR(hook), argc, argv);
 	hook = rep_CDR(hook);
 	rep_TEST_INT;
 	if(rep_INTERRUPTP)
@@ -2093,6 +3113,7 @@ rep_lispcmds_init(void)
     rep_ADD_SUBR(Sltthan);
     rep_ADD_SUBR(Slethan);
     rep_ADD_SUBR(Snull);
+    rep_ADD_SUBR(S_sort);
     rep_ADD_SUBR(Satom);
     rep_ADD_SUBR(Sconsp);
     rep_ADD_SUBR(Slistp);
@@ -2103,6 +3124,9 @@ rep_lispcmds_init(void)
 
     tem = rep_push_structure ("rep.io.files");
     rep_ADD_SUBR (Sload_file);
+    rep_ADD_SUBR (Sopen_image);
+    rep_ADD_SUBR (Sdump_image);
+    rep_ADD_SUBR (Sflush_module_indexes);
     rep_ADD_SUBR (Sload_dl_file);
     rep_ADD_SUBR_INT(Sload);
     rep_pop_structure (tem);
@@ -2176,4 +3200,9 @@ rep_lispcmds_init(void)
     default_suffixes = Fcons (rep_VAL (&jl), rep_VAL (&jlc));
     rep_mark_static (&default_suffixes);
     rep_INTERN (_load_suffixes);
+
+    loaded_files = Qnil;
+    rep_mark_static (&loaded_files);
+    image_index = Qnil;
+    rep_mark_static (&image_index);
 }
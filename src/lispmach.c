@@ -25,10 +25,8 @@
 /* Define this to check if the compiler gets things right */
 #undef TRUST_NO_ONE
 
-/* Define this to bytecode use histograms */
-#undef BYTECODE_PROFILE
-
-/* Define this to cache top-of-stack in a register (not usually worth it) */
+/* Define this to cache top-of-stack in a register (not usually worth it;
+   on x86-64 it makes some loops faster and others slower) */
 #undef CACHE_TOS
 
 /* AIX requires this to be the first thing in the file.  */
@@ -57,10 +55,6 @@ DEFSYM(bytecode_error, "bytecode-error");
 
 /* pull in the generic interpreter */
 
-#ifdef BYTECODE_PROFILE
-static int bytecode_profile[256];
-#endif
-
 #ifdef TRUST_NO_ONE
 # define ASSERT(x) assert(x)
 #else
@@ -69,6 +63,13 @@ static int bytecode_profile[256];
 
 #define BC_APPLY_SELF 0
 
+#ifdef ENABLE_JIT
+/* Hot functions are run from their translation (see jitmach.c) */
+# define APPLY_HOOK(subr, nargs, args)				\
+    if (rep_jit_threshold > 0 && rep_jit_hot_p (subr))		\
+	return rep_jit_apply_bytecode (subr, nargs, args)
+#endif
+
 #include "lispmach.h"
 
 
@@ -81,6 +82,13 @@ rep_apply_bytecode (repv subr, int nargs, repv *args)
     return inline_apply_bytecode (subr, nargs, args);
 }
 
+/* Like rep_apply_bytecode, but never uses the translation of SUBR */
+repv
+rep_interpret_bytecode (repv subr, int nargs, repv *args)
+{
+    return interpret_bytecode (subr, nargs, args);
+}
+
 DEFUN("run-byte-code", Frun_byte_code, Srun_byte_code,
       (repv code, repv consts, repv stkreq), rep_Subr3)
 {
@@ -101,7 +109,7 @@ DEFUN("run-byte-code", Frun_byte_code, Srun_byte_code,
     b_stkreq = (rep_INT (stkreq) >> 10) & 0x3ff;
     s_stkreq = rep_INT (stkreq) >> 20;
 
-    return vm (code, consts, 0, 0, v_stkreq, b_stkreq, s_stkreq);
+    return vm (rep_NULL, code, consts, 0, 0, v_stkreq, b_stkreq, s_stkreq);
 }
 
 DEFUN("validate-byte-code", Fvalidate_byte_code, Svalidate_byte_code, (repv bc_major, repv bc_minor), rep_Subr2) /*
@@ -163,12 +171,10 @@ Return an object that can be used as the function value of a symbol.
 	    used--;
     }
 
-    vec = Fmake_vector(rep_MAKE_INT(used), Qnil);
+    vec = rep_make_compiled (used);
     if(vec != rep_NULL)
     {
 	int i;
-	rep_COMPILED(vec)->car = ((rep_COMPILED(vec)->car
-				   & ~rep_CELL8_TYPE_MASK) | rep_Compiled);
 	for(i = 0; i < used; i++)
 	    rep_VECTI(vec, i) = obj[i];
     }
@@ -185,25 +191,446 @@ Returns t if ARG is a byte code subroutine (i.e. compiled Lisp code).
     return rep_COMPILEDP(arg) ? Qt : Qnil;
 }
 
-#ifdef BYTECODE_PROFILE
-static void
-print_bytecode_profile (void)
+
+/* dynamic profile of opcode sequences */
+
+/* The rep_PROFILE_ bits of what the VM should log about each
+   instruction it dispatches, zero when it shouldn't */
+int rep_bytecode_profiling;
+
+/* Counts of each pair of opcodes, indexed by FIRST * 256 + SECOND */
+static unsigned int *pair_counts;
+
+/* Counts of opcode triples, an open-addressed table indexed by a hash
+   of the three opcodes packed into KEY. Entries with zero COUNT are
+   empty. Triples that don't fit are dropped. */
+#define TRIPLE_SLOTS 65536
+#define TRIPLE_PROBES 32
+static struct triple_count {
+    unsigned int key, count;
+} *triple_counts;
+
+/* Called by the VM with each opcode OP it dispatches while profiling.
+   HISTORY holds the previous two opcodes of the same activation, or -1
+   when there aren't any. Opcodes with embedded arguments are counted
+   without them. */
+void
+rep_record_bytecode (int *history, int op)
 {
+    if (op <= OP_LAST_WITH_ARGS)
+	op &= OP_OP_MASK;
+    if (pair_counts != 0 && history[1] >= 0)
+    {
+	pair_counts[history[1] * 256 + op]++;
+	if (history[0] >= 0)
+	{
+	    unsigned int key = (history[0] << 16) | (history[1] << 8) | op;
+	    unsigned int i = (key * 2654435761U) >> 16;
+	    int probes;
+	    for (probes = 0; probes < TRIPLE_PROBES; probes++)
+	    {
+		struct triple_count *tc = triple_counts + i;
+		if (tc->count == 0)
+		    tc->key = key;
+		if (tc->key == key)
+		{
+		    tc->count++;
+		    break;
+		}
+		i = (i + 1) & (TRIPLE_SLOTS - 1);
+	    }
+	}
+    }
+    history[0] = history[1];
+    history[1] = op;
+}
+
+DEFUN ("start-bytecode-profiler", Fstart_bytecode_profiler,
+       Sstart_bytecode_profiler, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#start-bytecode-profiler::
+start-bytecode-profiler
+
+Discard any existing bytecode profile, then start counting the pairs
+and triples of opcodes executed by the virtual machine. Only functions
+called after this point are profiled.
+::end:: */
+{
+    if (pair_counts == 0)
+    {
+	pair_counts = rep_alloc (sizeof (unsigned int) * 256 * 256);
+	triple_counts = rep_alloc (sizeof (struct triple_count)
+				   * TRIPLE_SLOTS);
+	if (pair_counts == 0 || triple_counts == 0)
+	{
+	    rep_free (pair_counts);
+	    rep_free (triple_counts);
+	    pair_counts = 0;
+	    triple_counts = 0;
+	    return rep_mem_error ();
+	}
+    }
+    memset (pair_counts, 0, sizeof (unsigned int) * 256 * 256);
+    memset (triple_counts, 0, sizeof (struct triple_count) * TRIPLE_SLOTS);
+    rep_bytecode_profiling |= rep_PROFILE_OPCODES;
+    return Qt;
+}
+
+DEFUN ("stop-bytecode-profiler", Fstop_bytecode_profiler,
+       Sstop_bytecode_profiler, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#stop-bytecode-profiler::
+stop-bytecode-profiler
+
+Stop profiling the opcodes executed by the virtual machine. Functions
+that were already running may continue to add to the profile until
+they return.
+::end:: */
+{
+    rep_bytecode_profiling &= ~rep_PROFILE_OPCODES;
+    return Qt;
+}
+
+DEFUN ("fetch-bytecode-profile", Ffetch_bytecode_profile,
+       Sfetch_bytecode_profile, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#fetch-bytecode-profile::
+fetch-bytecode-profile
+
+Return the most recent bytecode profile, a list of elements
+`((OPCODE...) . COUNT)', one for each pair or triple of opcodes that
+was executed at least once. Opcodes that encode an argument in their
+low bits are recorded with those bits cleared.
+::end:: */
+{
+    repv out = Qnil;
     int i;
-    for (i = 0; i < 256; i++)
-	printf ("%8d %8d\n", i, bytecode_profile[i]);
+    if (pair_counts == 0)
+	return Qnil;
+    for (i = 0; i < 256 * 256; i++)
+    {
+	if (pair_counts[i] != 0)
+	{
+	    repv seq = rep_LIST_2 (rep_MAKE_INT (i >> 8),
+				   rep_MAKE_INT (i & 255));
+	    out = Fcons (Fcons (seq, rep_make_long_uint (pair_counts[i])), out);
+	}
+    }
+    for (i = 0; i < TRIPLE_SLOTS; i++)
+    {
+	struct triple_count *tc = triple_counts + i;
+	if (tc->count != 0)
+	{
+	    repv seq = rep_LIST_3 (rep_MAKE_INT (tc->key >> 16),
+				   rep_MAKE_INT ((tc->key >> 8) & 255),
+				   rep_MAKE_INT (tc->key & 255));
+	    out = Fcons (Fcons (seq, rep_make_long_uint (tc->count)), out);
+	}
+    }
+    return out;
 }
 
-DEFUN ("bytecode-profile", Fbytecode_profile,
-       Sbytecode_profile, (repv reset), rep_Subr1)
+
+/* type feedback
+
+   For each instruction executed at a call site, or an arithmetic,
+   comparison or car/cdr instruction, the types of its operands (as a
+   bitmask of the classes below) and how often it ran, keyed by the
+   byte-code string and the instruction's offset in it. Each entry
+   also records the closure that was running the code when it was
+   first seen, and call sites the function called, or t once there's
+   been more than one. Entries don't keep any of these alive: those
+   whose code dies are removed after each GC, and the others forget
+   whichever closures died. */
+
+enum feedback_type {
+    FB_FIXNUM, FB_BIGNUM, FB_RATIONAL, FB_FLOAT, FB_NIL, FB_CONS,
+    FB_SYMBOL, FB_STRING, FB_VECTOR, FB_CLOSURE, FB_SUBR, FB_BYTECODE,
+    FB_OTHER, FB_NTYPES
+};
+
+static const char *feedback_type_names[FB_NTYPES] = {
+    "fixnum", "bignum", "rational", "float", "nil", "cons", "symbol",
+    "string", "vector", "closure", "subr", "bytecode", "other"
+};
+
+struct feedback {
+    repv code;				/* 0 when the slot is empty */
+    repv fun;				/* 0 or the closure running CODE */
+    repv callee;			/* 0, the function, or Qt */
+    unsigned int pc;
+    unsigned int count;
+    unsigned short types[2];
+};
+
+static struct feedback *feedback;
+static int feedback_size, feedback_used;
+
+static int
+feedback_type (repv v)
 {
-    if (reset != Qnil)
-	memset (bytecode_profile, 0, sizeof (bytecode_profile));
+    if (rep_INTP (v))
+	return FB_FIXNUM;
+    else if (v == Qnil)
+	return FB_NIL;
+    else if (!rep_CELLP (v))
+	return FB_OTHER;
+    else if (rep_CONSP (v))
+	return FB_CONS;
+    else if (rep_NUMBERP (v))
+    {
+	return (rep_NUMBER_FLOAT_P (v) ? FB_FLOAT
+		: rep_NUMBER_RATIONAL_P (v) ? FB_RATIONAL : FB_BIGNUM);
+    }
+    else if (rep_SYMBOLP (v))
+	return FB_SYMBOL;
+    else if (rep_STRINGP (v))
+	return FB_STRING;
+    else if (rep_VECTORP (v))
+	return FB_VECTOR;
+    else if (rep_FUNARGP (v))
+	return FB_CLOSURE;
+    else if (rep_COMPILEDP (v))
+	return FB_BYTECODE;
+    else if (rep_CELL_TYPE (v) >= rep_Subr0 && rep_CELL_TYPE (v) <= rep_SubrN)
+	return FB_SUBR;
     else
-	print_bytecode_profile ();
-    return Qnil;
+	return FB_OTHER;
+}
+
+static inline unsigned int
+feedback_hash (repv code, unsigned int pc)
+{
+    return (((unsigned int) (code >> 3)) * 2654435761U) ^ (pc * 40503U);
+}
+
+static struct feedback *
+feedback_slot (struct feedback *table, int size, repv code, unsigned int pc)
+{
+    unsigned int i = feedback_hash (code, pc) & (size - 1);
+    while (table[i].code != 0
+	   && (table[i].code != code || table[i].pc != pc))
+    {
+	i = (i + 1) & (size - 1);
+    }
+    return table + i;
+}
+
+/* Copy the entries of the table into one of NEW_SIZE slots, dropping
+   those whose code didn't survive the last GC if SWEEP */
+static rep_bool
+feedback_rehash (int new_size, rep_bool sweep)
+{
+    struct feedback *table = rep_alloc (sizeof (struct feedback) * new_size);
+    int i;
+    if (table == 0)
+	return rep_FALSE;
+    memset (table, 0, sizeof (struct feedback) * new_size);
+    feedback_used = 0;
+    for (i = 0; i < feedback_size; i++)
+    {
+	struct feedback *f = feedback + i;
+	if (f->code == 0 || (sweep && !rep_gc_live_p (f->code)))
+	    continue;
+	if (sweep && f->fun != 0 && !rep_gc_live_p (f->fun))
+	    f->fun = 0;
+	if (sweep && f->callee != 0 && f->callee != Qt
+	    && !rep_gc_live_p (f->callee))
+	{
+	    f->callee = Qt;
+	}
+	*feedback_slot (table, new_size, f->code, f->pc) = *f;
+	feedback_used++;
+    }
+    rep_free (feedback);
+    feedback = table;
+    feedback_size = new_size;
+    return rep_TRUE;
+}
+
+/* Called by the VM before executing the instruction at offset PC in
+   the byte-code string CODE, while collecting type feedback. TOP is
+   the top of the stack, which STACKP points to */
+void
+rep_record_type_feedback (repv code, int pc, repv top, repv *stackp)
+{
+    unsigned char *insn = (unsigned char *) rep_STR (code) + pc;
+    int op = insn[0], nargs = -1, nargs_arg = 0;
+    struct feedback *f;
+
+    if (op >= OP_CALL && op < OP_CALL + 8)
+    {
+	nargs_arg = op - OP_CALL;
+	if (nargs_arg == 6)
+	    nargs_arg = insn[1];
+	else if (nargs_arg == 7)
+	    nargs_arg = (insn[1] << ARG_SHIFT) | insn[2];
+    }
+    else switch (op)
+    {
+    case OP_CAR: case OP_CDR: case OP_CAAR: case OP_CADR:
+    case OP_CDAR: case OP_CDDR: case OP_NEG: case OP_INC: case OP_DEC:
+	nargs = 1;
+	break;
+
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_REM:
+    case OP_MOD: case OP_QUOTIENT: case OP_GT: case OP_GE: case OP_LT:
+    case OP_LE: case OP_NUM_EQ: case OP_MAX: case OP_MIN:
+	nargs = 2;
+	break;
+
+    default:
+	return;
+    }
+
+    if (feedback_used * 4 >= feedback_size * 3
+	&& !feedback_rehash (feedback_size * 2, rep_FALSE))
+    {
+	return;
+    }
+
+    f = feedback_slot (feedback, feedback_size, code, pc);
+    if (f->code == 0)
+    {
+	repv fun = rep_call_stack != 0 ? rep_call_stack->fun : Qnil;
+	f->code = code;
+	f->pc = pc;
+	if (rep_FUNARGP (fun) && rep_COMPILEDP (rep_FUNARG (fun)->fun)
+	    && rep_COMPILED_CODE (rep_FUNARG (fun)->fun) == code)
+	{
+	    f->fun = fun;
+	}
+	feedback_used++;
+    }
+    f->count++;
+
+    if (nargs < 0)
+    {
+	/* the function is below its arguments */
+	repv fun = nargs_arg == 0 ? top : stackp[-nargs_arg];
+	f->types[0] |= 1 << feedback_type (fun);
+	if (f->callee == 0)
+	    f->callee = fun;
+	else if (f->callee != fun)
+	    f->callee = Qt;
+    }
+    else if (nargs == 1)
+	f->types[0] |= 1 << feedback_type (top);
+    else
+    {
+	f->types[0] |= 1 << feedback_type (stackp[-1]);
+	f->types[1] |= 1 << feedback_type (top);
+    }
+}
+
+static rep_bool
+feedback_trace (void)
+{
+    return rep_FALSE;
+}
+
+static void
+feedback_clear (void)
+{
+    if (feedback != 0)
+	feedback_rehash (feedback_size, rep_TRUE);
+}
+
+static repv
+feedback_types (unsigned int mask)
+{
+    repv out = Qnil;
+    int i;
+    for (i = FB_NTYPES - 1; i >= 0; i--)
+    {
+	if (mask & (1 << i))
+	    out = Fcons (Fintern (rep_string_dup (feedback_type_names[i]),
+				  Qnil), out);
+    }
+    return out;
+}
+
+DEFUN ("start-type-feedback", Fstart_type_feedback,
+       Sstart_type_feedback, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#start-type-feedback::
+start-type-feedback
+
+Discard any existing type feedback, then start recording the types of
+the operands of each call, arithmetic, comparison and car or cdr
+instruction executed by the virtual machine, and the functions called
+at each call site. Only functions called after this point are
+recorded.
+::end:: */
+{
+    rep_free (feedback);
+    feedback = 0;
+    feedback_size = feedback_used = 0;
+    feedback = rep_alloc (sizeof (struct feedback) * 1024);
+    if (feedback == 0)
+	return rep_mem_error ();
+    memset (feedback, 0, sizeof (struct feedback) * 1024);
+    feedback_size = 1024;
+    rep_bytecode_profiling |= rep_PROFILE_TYPES;
+    return Qt;
+}
+
+DEFUN ("stop-type-feedback", Fstop_type_feedback,
+       Sstop_type_feedback, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#stop-type-feedback::
+stop-type-feedback
+
+Stop recording type feedback. Functions that were already running may
+continue to add to it until they return.
+::end:: */
+{
+    rep_bytecode_profiling &= ~rep_PROFILE_TYPES;
+    return Qt;
+}
+
+DEFUN ("fetch-type-feedback", Ffetch_type_feedback,
+       Sfetch_type_feedback, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#fetch-type-feedback::
+fetch-type-feedback
+
+Return the type feedback recorded since `start-type-feedback', a list
+with an element `(CODE PC OPCODE COUNT TYPES CALLEE FUNCTION)' for each
+instruction recorded. CODE is the byte-code string containing it, PC
+its offset in CODE, OPCODE the instruction (with any embedded argument
+cleared), and COUNT how many times it was executed. FUNCTION is the
+closure whose code CODE is, or nil if that isn't known.
+
+TYPES is a list with the list of types seen for each operand (the
+function, for calls), each type being one of the symbols `fixnum',
+`bignum', `rational', `float', `nil', `cons', `symbol', `string',
+`vector', `closure', `subr', `bytecode' or `other'. For call sites,
+CALLEE is the function called, or t if more than one function has
+been called there; otherwise it's nil.
+::end:: */
+{
+    repv out = Qnil;
+    rep_GC_root gc_out;
+    int i;
+    rep_PUSHGC (gc_out, out);
+    for (i = 0; i < feedback_size; i++)
+    {
+	struct feedback *f = feedback + i;
+	int op, nops;
+	repv types, callee, fun, tail;
+	if (f->code == 0)
+	    continue;
+	op = ((unsigned char *) rep_STR (f->code))[f->pc];
+	if (op <= OP_LAST_WITH_ARGS)
+	    op &= OP_OP_MASK;
+	nops = (op == OP_CALL || f->types[1] == 0) ? 1 : 2;
+	types = feedback_types (f->types[0]);
+	types = (nops == 1 ? rep_LIST_1 (types)
+		 : rep_LIST_2 (types, feedback_types (f->types[1])));
+	callee = f->callee != 0 ? f->callee : Qnil;
+	fun = f->fun != 0 ? f->fun : Qnil;
+	tail = rep_list_5 (rep_MAKE_INT (op), rep_make_long_uint (f->count),
+			   types, callee, fun);
+	out = Fcons (Fcons (f->code, Fcons (rep_MAKE_INT (f->pc), tail)), out);
+    }
+    rep_POPGC;
+    return out;
 }
-#endif
 
 void
 rep_lispmach_init(void)
@@ -213,12 +640,16 @@ rep_lispmach_init(void)
     rep_ADD_SUBR(Svalidate_byte_code);
     rep_ADD_SUBR(Smake_byte_code_subr);
     rep_ADD_SUBR(Sbytecodep);
-#ifdef BYTECODE_PROFILE
-    rep_ADD_SUBR(Sbytecode_profile);
-    atexit (print_bytecode_profile);
-#endif
+    rep_ADD_SUBR(Sstart_bytecode_profiler);
+    rep_ADD_SUBR(Sstop_bytecode_profiler);
+    rep_ADD_SUBR(Sfetch_bytecode_profile);
+    rep_ADD_SUBR(Sstart_type_feedback);
+    rep_ADD_SUBR(Sstop_type_feedback);
+    rep_ADD_SUBR(Sfetch_type_feedback);
     rep_INTERN(bytecode_error); rep_ERROR(bytecode_error);
     rep_pop_structure (tem);
+
+    rep_add_weak_hooks (feedback_trace, feedback_clear);
 }
 
 void
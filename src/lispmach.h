@@ -24,17 +24,24 @@
 /* free macros:
 
 	ASSERT (expr)
-	BYTECODE_PROFILE
 	THREADED_VM
 	CACHE_TOS
 	BC_APPLY_SELF
 	EXTRA_VM_CODE
 	OPTIMIZE_FOR_SPACE
+	DIRECT_THREADED
+	APPLY_HOOK (subr, nargs, args)
+
+   with DIRECT_THREADED, the includer also supplies:
+
+	void **jit_labels;
+	rep_jit_code *jit_translation (repv subr);
 
    defined functions:
 
-	vm (repv code, repv consts, int argc, repv *argv,
+	vm (repv subr, repv code, repv consts, int argc, repv *argv,
 	    int v_stkreq, int b_stkreq, int s_stkreq);
+	interpret_bytecode (repv subr, int nargs, repv *args);
 	inline_apply_bytecode (repv subr, int nargs, repv *args); */
 
 
@@ -43,13 +50,18 @@
 # define THREADED_VM 1
 #endif
 
+#if defined (DIRECT_THREADED) && !defined (THREADED_VM)
+# error "DIRECT_THREADED needs the threaded interpreter"
+#endif
+
 #include "bytecodes.h"
+#include "probes.h"
 #include <string.h>
 
 DEFSTRING(err_bytecode_error, "Byte-code error");
 DEFSTRING(unknown_op, "Unknown lisp opcode");
 
-static repv vm (repv code, repv consts, int argc, repv *argv,
+static repv vm (repv subr, repv code, repv consts, int argc, repv *argv,
 		int v_stkreq, int b_stkreq, int s_stkreq);
 
 #ifndef OPTIMIZE_FOR_SPACE
@@ -95,7 +107,7 @@ inline_unbind (repv item)
 	int lexicals = rep_LEX_BINDINGS (item);
 	int specials = rep_SPEC_BINDINGS (item);
 	rep_env = list_tail (rep_env, lexicals);
-	rep_special_bindings = list_tail (rep_special_bindings, specials);
+	rep_pop_special_bindings (specials);
 	return specials;
     }
     else if (item == Qnil || (rep_CONSP (item) && rep_CAR (item) == Qerror))
@@ -131,15 +143,6 @@ snap_environment (int count)
     return ptr;
 }
 
-static repv
-search_special_bindings (repv sym)
-{
-    register repv env = rep_special_bindings;
-    while (env != Qnil && rep_CAAR(env) != sym)
-	env = rep_CDR(env);
-    return env != Qnil ? rep_CAR(env) : env;
-}
-
 /* Zero out N lisp pointers starting from address S */
 #define repv_bzero(s, n)		\
     do {				\
@@ -192,19 +195,12 @@ list_ref (repv list, int elt)
     do {					\
 	ASSERT (STK_USE <= v_stkreq);		\
 	ASSERT (BIND_USE <= b_stkreq + 1);	\
-	ASSERT (((char *)pc - rep_STR (code)) < rep_STRING_LEN (code)); \
+	ASSERT (PC_IN_CODE_P);			\
     } while (0)
 
-#ifdef BYTECODE_PROFILE
-# define PROFILE_NEXT do { bytecode_profile[*pc]++; } while (0)
-#else
-# define PROFILE_NEXT
-#endif
-
 #define SAFE_NEXT__	\
     do {		\
 	CHECK_NEXT;	\
-	PROFILE_NEXT;	\
 	X_SAFE_NEXT;	\
     } while (0)
 
@@ -214,8 +210,42 @@ list_ref (repv list, int elt)
 # define SAFE_NEXT goto safe_next
 #endif
 
-#define FETCH	    (*pc++)
-#define FETCH2(var) ((var) = (FETCH << ARG_SHIFT), (var) += FETCH)
+#ifndef DIRECT_THREADED
+
+/* PC points into the byte-code string itself */
+# define PC_TYPE	unsigned char
+# define START_PC	((unsigned char *) rep_STR (code))
+# define PC_AT(off)	((unsigned char *) rep_STR (code) + (off))
+# define PC_IN_CODE_P	(((char *)pc - rep_STR (code)) < rep_STRING_LEN (code))
+# define FETCH	    (*pc++)
+# define FETCH2(var) ((var) = (FETCH << ARG_SHIFT), (var) += FETCH)
+# define EMBEDDED_ARG(op) (pc[-1] - (op))
+# define BAD_OPCODE	(pc[-1])
+# define JMP_TARGET	PC_AT ((pc[0] << ARG_SHIFT) | pc[1])
+# define SKIP_JMP_TARGET (pc += 2)
+# define NEXT_OP_IS(op)	(*pc == (op))
+# define TAIL_CALLABLE_P(fun) 1
+
+#else /* !DIRECT_THREADED */
+
+/* PC points into a translation of the byte-code (see jitmach.c): each
+   instruction is the address of its code, followed by its operand
+   (already decoded) if it has one. Jump operands are the address of
+   the destination. */
+# define PC_TYPE	void *
+# define START_PC	((jit_code = jit_translation (subr))->insns)
+# define PC_AT(off)	(jit_code->insns + jit_code->offsets[off])
+# define PC_IN_CODE_P	(pc - jit_code->insns < jit_code->length)
+# define FETCH	    ((unsigned int) (rep_PTR_SIZED_INT) *pc++)
+# define FETCH2(var) ((var) = FETCH)
+# define EMBEDDED_ARG(op) FETCH
+# define BAD_OPCODE	FETCH
+# define JMP_TARGET	((void **) *pc)
+# define SKIP_JMP_TARGET (pc++)
+# define NEXT_OP_IS(op)	(*pc == &&TAG (op))
+# define TAIL_CALLABLE_P(fun) (jit_translation (fun) != 0)
+
+#endif /* DIRECT_THREADED */
 
 #define SYNC_GC				\
     do {				\
@@ -246,12 +276,27 @@ list_ref (repv list, int elt)
    checking TOP (by about 1%) */
 #define ERROR_OCCURRED_P (TOP == rep_NULL)
 
+/* Record the instruction at OPP, which is about to be executed, in
+   the profiles being collected */
+#define PROFILE_INSN(opp)						\
+    do {								\
+	if (rep_bytecode_profiling & rep_PROFILE_OPCODES)		\
+	    rep_record_bytecode (profile_history, *(opp));		\
+	if (rep_bytecode_profiling & rep_PROFILE_TYPES)			\
+	    rep_record_type_feedback (code, (char *) (opp) - rep_STR (code), \
+				      TOP, stackp);			\
+    } while (0)
+
 #ifndef THREADED_VM
 
 /* Non-threaded interpretation, just use a big switch statement in
    a while loop. */
 
-# define BEGIN_DISPATCH fetch: switch (FETCH) {
+# define BEGIN_DISPATCH						\
+    fetch:							\
+	if (rep_bytecode_profiling)				\
+	    PROFILE_INSN (pc);					\
+	switch (FETCH) {
 # define END_DISPATCH }
 
 /* Output the case statement for an instruction OP, with an embedded
@@ -263,7 +308,7 @@ list_ref (repv list, int elt)
 	case op+6:							\
 	    arg = FETCH; goto rep_CONCAT(op_, op);			\
 	case op: case op+1: case op+2: case op+3: case op+4: case op+5:	\
-	    arg = pc[-1] - op;						\
+	    arg = EMBEDDED_ARG (op);					\
 	rep_CONCAT(op_, op): {
 
 # define BEGIN_INSN(op) case op: {
@@ -310,10 +355,14 @@ list_ref (repv list, int elt)
     TAG1(op):				\
 	arg = FETCH; goto TAG(op);	\
     TAG0(op):				\
-	arg = pc[-1] - op;		\
+	arg = EMBEDDED_ARG (op);	\
     BEGIN_INSN(op)
 
-# define X_SAFE_NEXT	goto *cfa[FETCH]
+# ifndef DIRECT_THREADED
+#  define X_SAFE_NEXT	goto *cfa__[FETCH]
+# else
+#  define X_SAFE_NEXT	goto **pc++
+# endif
 # define INLINE_NEXT	if (!ERROR_OCCURRED_P) SAFE_NEXT; else HANDLE_ERROR
 # define NEXT		goto check_error
 # define RETURN		goto quit
@@ -400,8 +449,8 @@ list_ref (repv list, int elt)
  &&TAG(OP_SET), &&TAG(OP_REQUIRED_ARG), &&TAG(OP_OPTIONAL_ARG), &&TAG(OP_REST_ARG), /*C8*/ \
  &&TAG(OP_NOT_ZERO_P), &&TAG(OP_KEYWORD_ARG), &&TAG(OP_OPTIONAL_ARG_), &&TAG(OP_KEYWORD_ARG_),	\
 										\
- &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, /*D0*/	\
- &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
+ &&TAG(OP_SLOT_REF_CAR), &&TAG(OP_SLOT_REF_CDR), &&TAG(OP_DUP_SLOT_SET), &&TAG(OP_EQ_JN), /*D0*/ \
+ &&TAG(OP_RECORD_REF), &&TAG(OP_RECORD_SET), &&TAG(OP_RECORD_P), &&TAG_DEFAULT, \
  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, /*D8*/	\
  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, /*E0*/	\
@@ -451,6 +500,18 @@ list_ref (repv list, int elt)
 #define PC_REG asm("%esi")
 #define SP_REG asm("%edi")
 #endif
+#ifdef __x86_64__
+#define PC_REG asm("%r15")
+#define SP_REG asm("%r14")
+#define SLOTS_REG asm("%r13")
+#define TOS_REG asm("%r12")
+#endif
+#ifdef __aarch64__
+#define PC_REG asm("x19")
+#define SP_REG asm("x20")
+#define SLOTS_REG asm("x21")
+#define TOS_REG asm("x22")
+#endif
 #if defined(PPC) || defined(_POWER) || defined(_IBMR2)
 #define PC_REG asm("26")
 #define SP_REG asm("27")
@@ -492,9 +553,6 @@ list_ref (repv list, int elt)
 #ifndef SLOTS_REG
 #define SLOTS_REG
 #endif
-#ifndef CFA_REG
-#define CFA_REG
-#endif
 #ifndef TOS_REG
 #define TOS_REG
 #endif
@@ -502,19 +560,63 @@ list_ref (repv list, int elt)
 DEFSTRING(max_depth, "max-lisp-depth exceeded, possible infinite recursion?");
 
 static inline repv
-inline_apply_bytecode (repv subr, int nargs, repv *args)
+interpret_bytecode (repv subr, int nargs, repv *args)
 {
-    return vm (rep_COMPILED_CODE (subr), rep_COMPILED_CONSTANTS (subr),
+    return vm (subr, rep_COMPILED_CODE (subr), rep_COMPILED_CONSTANTS (subr),
 	       nargs, args, rep_INT (rep_COMPILED_STACK (subr)) & 0x3ff,
 	       (rep_INT (rep_COMPILED_STACK (subr)) >> 10) & 0x3ff,
 	       rep_INT (rep_COMPILED_STACK (subr) >> 20));
 }
 
+static inline repv
+inline_apply_bytecode (repv subr, int nargs, repv *args)
+{
+#ifdef APPLY_HOOK
+    APPLY_HOOK (subr, nargs, args);
+#endif
+    return interpret_bytecode (subr, nargs, args);
+}
+
+/* Return the inline caches of compiled function SUBR, whose constants
+   are CONSTS, or null if they can't be used. If SUBR has none yet,
+   and ALLOC is true, they're created. */
+static rep_ic *
+subr_inline_caches (repv subr, repv consts, rep_bool alloc)
+{
+    rep_ic *ic;
+    if (subr == rep_NULL)
+	return 0;
+    ic = rep_COMPILED_IC (subr);
+    if (ic == 0 && alloc && rep_COMPILED_CONSTANTS (subr) == consts)
+    {
+	size_t size = rep_IC_SIZE (MAX (rep_VECT_LEN (consts), 1));
+	ic = rep_alloc (size);
+	if (ic == 0)
+	    return 0;
+	memset (ic, 0, size);
+	ic->consts = consts;
+	rep_SET_COMPILED_IC (subr, ic);
+    }
+    /* the constants may have been replaced using aset */
+    return (ic != 0 && ic->consts == consts) ? ic : 0;
+}
+
 static repv
-vm (repv code, repv consts, int argc, repv *argv,
+vm (repv subr, repv code, repv consts, int argc, repv *argv,
     int v_stkreq, int b_stkreq, int s_stkreq)
 {
-    rep_GC_root gc_code, gc_consts;
+#ifdef THREADED_VM
+    /* The code of each instruction, and the table that's actually
+       dispatched through. Keeping the latter at a fixed address (it's
+       only rewritten when profiling starts or stops) means that its
+       address needn't occupy a register. */
+    static void *const insn_labels__[256] = { JUMP_TABLE };
+# ifndef DIRECT_THREADED
+    static void *cfa__[256];
+    static int cfa_profiling__ = -1;
+# endif
+#endif
+    rep_GC_root gc_code, gc_consts, gc_subr;
     /* The `gcv_N' field is only filled in with the stack-size when there's
        a chance of gc.	*/
     rep_GC_n_roots gc_stack, gc_bindstack, gc_slots, gc_argv;
@@ -529,20 +631,53 @@ vm (repv code, repv consts, int argc, repv *argv,
        (including non-variable bindings). */
     int impurity;
 
+    /* inline caches for OP_REFG and OP_SETG, created on first use */
+    rep_ic *ic = subr_inline_caches (subr, consts, rep_FALSE);
+
+    /* the last two opcodes executed, when profiling */
+    int profile_history[2];
+
+#ifdef DIRECT_THREADED
+    /* the translation of CODE being executed */
+    rep_jit_code *jit_code;
+
+    /* Label addresses are only visible in this function, so the
+       translator asks for them by calling it with a null CODE. */
+    if (code == rep_NULL)
+    {
+	jit_labels = (void **) insn_labels__;
+	return Qnil;
+    }
+#endif
+
     if(++rep_lisp_depth > rep_max_lisp_depth)
     {
 	rep_lisp_depth--;
 	return Fsignal(Qerror, rep_LIST_1(rep_VAL(&max_depth)));
     }
 
-    /* When tail-calling we'll only allocate a new stack if the current
+#if defined (THREADED_VM) && !defined (DIRECT_THREADED)
+    if (cfa_profiling__ != rep_bytecode_profiling)
+    {
+	/* When profiling, every opcode is dispatched through
+	   insn_profile first, so that there's no cost when it isn't */
+	int i;
+	for (i = 0; i < 256; i++)
+	    cfa__[i] = rep_bytecode_profiling ? &&insn_profile : insn_labels__[i];
+	cfa_profiling__ = rep_bytecode_profiling;
+    }
+#endif
+
+    /* The stack, bind-stack and slots start out as a single frame.
+       When tail-calling we'll only allocate a new stack if the current
        is too small. (this guarantees bounded space requirements) */
-    stack = alloca (sizeof (repv) * (v_stkreq + 1));
-    bindstack = alloca (sizeof (repv) * (b_stkreq + 1));
-    slots = alloca (sizeof (repv) * (s_stkreq));
+    stack = alloca (sizeof (repv) * (v_stkreq + 1 + b_stkreq + 1 + s_stkreq));
+    bindstack = stack + v_stkreq + 1;
+    slots = bindstack + b_stkreq + 1;
     repv_bzero (slots, s_stkreq);
 
 #ifdef SLOW_GC_PROTECT
+    rep_PUSHGC(gc_subr, subr);
     rep_PUSHGC(gc_code, code);
     rep_PUSHGC(gc_consts, consts);
     rep_PUSHGCN(gc_bindstack, bindstack, 0);
@@ -554,6 +689,7 @@ vm (repv code, repv consts, int argc, repv *argv,
        [ this ordering is known by popping code at end of fn ] */
     gc_code.ptr = &code;
     gc_consts.ptr = &consts;
+    gc_subr.ptr = &subr;
     gc_bindstack.first= bindstack;
     gc_stack.first = stack + 1;
     gc_slots.first = slots;
@@ -562,7 +698,8 @@ vm (repv code, repv consts, int argc, repv *argv,
     gc_argv.count = argc;
 
     gc_code.next = &gc_consts;
-    gc_consts.next = rep_gc_root_stack;
+    gc_consts.next = &gc_subr;
+    gc_subr.next = rep_gc_root_stack;
     rep_gc_root_stack = &gc_code;
 
     gc_bindstack.next = &gc_stack;
@@ -574,7 +711,7 @@ vm (repv code, repv consts, int argc, repv *argv,
     
     /* Jump to this label when tail-calling */
 again: {
-    register unsigned char *pc PC_REG;
+    register PC_TYPE *pc PC_REG;
     register repv *stackp SP_REG;
     register repv *bindp BP_REG;
     register repv *slotp SLOTS_REG;
@@ -595,14 +732,11 @@ again: {
     bindp = bindstack;
     slotp = slots;
     impurity = 0;
-    pc = (unsigned char *) rep_STR(code);
+    pc = START_PC;
+    profile_history[0] = profile_history[1] = -1;
 
     /* Start of the VM fetch-execute sequence. */
     {
-#ifdef THREADED_VM
-	static void *cfa__[256] = { JUMP_TABLE };
-	register void **cfa CFA_REG = cfa__;
-#endif
 	unsigned int arg;
 	repv tmp, tmp2;
 
@@ -633,6 +767,8 @@ again: {
 		goto invalid;
 	    if (rep_CELL8P (tmp))
 	    {
+		/* interpreted functions fire these in apply () */
+		REP_PROBE2 (function__entry, rep_probe_name (lc.fun), arg);
 		switch (rep_CELL8_TYPE (tmp))
 		{
 		case rep_Subr0:
@@ -748,7 +884,8 @@ again: {
 
 			if (bc_apply == BC_APPLY_SELF)	/* calling self */
 			{
-			    if (impurity != 0 || *pc != OP_RETURN)
+			    if (impurity != 0 || !NEXT_OP_IS (OP_RETURN)
+				|| !TAIL_CALLABLE_P (tmp))
 			    {
 				TOP = inline_apply_bytecode (tmp, arg,
 							     stackp+1);
@@ -762,6 +899,7 @@ again: {
 				rep_call_stack = lc.next;
 				rep_call_stack->fun = lc.fun;
 				rep_call_stack->args = lc.args;
+				rep_call_stack->argv = lc.argv;
 
 				/* since impurity==0 there can only be lexical
 				   bindings; these were unbound when switching
@@ -810,8 +948,10 @@ again: {
 				    repv_bzero (slots, s_stkreq);
 				}
 				
+				subr = tmp;
 				code = rep_COMPILED_CODE (tmp);
 				consts = rep_COMPILED_CONSTANTS (tmp);
+				ic = subr_inline_caches (subr, consts, rep_FALSE);
 				gc_bindstack.first = bindstack;
 				gc_stack.first = stack + 1;
 				gc_slots.first = slots;
@@ -836,18 +976,14 @@ again: {
 	    }
 	    else /* !consp */
 	    {
-		/* a call to intepreted code, just cons up the args
-		   and send it to the interpreter.. */
-		POPN(- ((int) arg));
-		for (tmp2 = Qnil; arg-- > 0;)
-		{
-		    repv x; POP1 (x);
-		    tmp2 = Fcons (x, tmp2);
-		}
+		/* a call to intepreted code, pass the args (still
+		   above the top of the stack) to the interpreter.. */
 		rep_POP_CALL (lc);
-		TOP = rep_funcall(TOP, tmp2, rep_FALSE);
+		TOP = rep_call_lispn (TOP, arg, stackp + 1);
 		NEXT;
 	    }
+	    REP_PROBE2 (function__return, rep_probe_name (lc.fun),
+			TOP != rep_NULL);
 	    rep_POP_CALL(lc);
 	    INLINE_NEXT;
 	END_INSN
@@ -940,28 +1076,38 @@ again: {
 	END_INSN
 
 	BEGIN_INSN_WITH_ARG (OP_REFG)
-	    /* this code expanded from F_structure_ref () and lookup ()
-	       in structures.c */
 	    rep_struct *s = rep_STRUCTURE (rep_structure);
 	    rep_struct_node *n;
+	    rep_bool local = rep_TRUE;
 	    repv var;
 	    ASSERT (arg < rep_VECT_LEN (consts));
-	    var = rep_VECT(consts)->array[arg];
-	    if (s->total_buckets != 0)
+	    if (ic != 0)
 	    {
-		for (n = s->buckets[rep_STRUCT_HASH (var, s->total_buckets)];
-		     n != 0; n = n->next)
+		rep_ic_entry *e = &ic->entries[arg];
+		if (e->stamp == rep_structure_stamp && e->s == s)
 		{
-		    if (n->symbol == var)
-		    {
-			PUSH (n->binding);
-			SAFE_NEXT;
-		    }
+		    PUSH (e->n->binding);
+		    SAFE_NEXT;
 		}
 	    }
-	    n = rep_search_imports (s, var);
+	    var = rep_VECT(consts)->array[arg];
+	    n = rep_lookup_binding (s, var);
+	    if (n == 0)
+	    {
+		n = rep_search_imports (s, var);
+		local = rep_FALSE;
+	    }
 	    if (n != 0)
 	    {
+		if (ic != 0 || (ic = subr_inline_caches (subr, consts,
+							 rep_TRUE)) != 0)
+		{
+		    rep_ic_entry *e = &ic->entries[arg];
+		    e->stamp = rep_structure_stamp;
+		    e->local = local;
+		    e->s = s;
+		    e->n = n;
+		}
 		PUSH (n->binding);
 		SAFE_NEXT;
 	    }
@@ -970,10 +1116,36 @@ again: {
 	END_INSN
 
 	BEGIN_INSN_WITH_ARG (OP_SETG)
+	    rep_struct *s = rep_STRUCTURE (rep_structure);
 	    ASSERT (arg < rep_VECT_LEN (consts));
-	    tmp = rep_VECT(consts)->array[arg];
 	    POP1 (tmp2);
-	    Fstructure_set (rep_structure, tmp, tmp2);
+	    /* only the structure's own, mutable, bindings are cached as
+	       local, anything else goes through structure-set */
+	    if (ic != 0 && !rep_VOIDP (tmp2))
+	    {
+		rep_ic_entry *e = &ic->entries[arg];
+		if (e->stamp == rep_structure_stamp && e->s == s && e->local)
+		{
+		    e->n->binding = tmp2;
+		    SAFE_NEXT;
+		}
+	    }
+	    tmp = rep_VECT(consts)->array[arg];
+	    if (Fstructure_set (rep_structure, tmp, tmp2) != rep_NULL
+		&& !rep_VOIDP (tmp2))
+	    {
+		rep_struct_node *n = rep_lookup_binding (s, tmp);
+		if (n != 0 && !n->is_constant
+		    && (ic != 0 || (ic = subr_inline_caches (subr, consts,
+							     rep_TRUE)) != 0))
+		{
+		    rep_ic_entry *e = &ic->entries[arg];
+		    e->stamp = rep_structure_stamp;
+		    e->local = rep_TRUE;
+		    e->s = s;
+		    e->n = n;
+		}
+	    }
 	    SAFE_NEXT;
 	END_INSN
 
@@ -1117,10 +1289,10 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_FLUID_REF)
-	    tmp = search_special_bindings (TOP);
+	    tmp = rep_search_special_bindings (TOP);
 	    if (tmp != Qnil)
 	    {
-		TOP = rep_CDR (tmp);
+		TOP = rep_BINDING_VALUE (tmp);
 		SAFE_NEXT;
 	    }
 	    else if (rep_CONSP (TOP))
@@ -1214,11 +1386,41 @@ again: {
 	END_INSN
 
 	BEGIN_INSN (OP_ASET)
-	    CALL_3(Faset);
+	    /* open-code stores into numeric vectors, which allocate
+	       nothing (the value is unboxed into the vector) */
+	    POP2 (tmp, tmp2);
+	    if (rep_INTP (tmp2) && rep_INT (tmp2) >= 0
+		&& rep_NUMERIC_VECTOR_P (TOP)
+		&& rep_INT (tmp2) < rep_NV_LEN (TOP)
+		&& rep_numeric_vector_set (TOP, rep_INT (tmp2), tmp))
+	    {
+		TOP = tmp;
+		SAFE_NEXT;
+	    }
+	    TOP = Faset (TOP, tmp2, tmp);
+	    NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_AREF)
-	    CALL_2(Faref);
+	    /* open-code vector references; integer elements of
+	       numeric vectors come back as fixnums, unallocated */
+	    POP1 (tmp);
+	    if (rep_INTP (tmp) && rep_INT (tmp) >= 0)
+	    {
+		if (rep_VECTORP (TOP) && rep_INT (tmp) < rep_VECT_LEN (TOP))
+		{
+		    TOP = rep_VECTI (TOP, rep_INT (tmp));
+		    SAFE_NEXT;
+		}
+		else if (rep_NUMERIC_VECTOR_P (TOP)
+			 && rep_INT (tmp) < rep_NV_LEN (TOP))
+		{
+		    TOP = rep_numeric_vector_ref (TOP, rep_INT (tmp));
+		    INLINE_NEXT;
+		}
+	    }
+	    TOP = Faref (TOP, tmp);
+	    NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_LENGTH)
@@ -1228,31 +1430,22 @@ again: {
 	BEGIN_INSN (OP_ADD)
 	    /* open-code fixnum arithmetic */
 	    POP1 (tmp);
-	    tmp2 = TOP;
-	    if (rep_INTP (tmp) && rep_INTP (tmp2))
+	    if (rep_fixnum_add (TOP, tmp, &tmp2))
 	    {
-		long x = rep_INT (tmp2) + rep_INT (tmp);
-		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
-		{
-		    TOP = rep_MAKE_INT (x);
-		    SAFE_NEXT;
-		}
+		TOP = tmp2;
+		SAFE_NEXT;
 	    }
-	    TOP = rep_number_add (tmp2, tmp);
+	    TOP = rep_number_add (TOP, tmp);
 	    INLINE_NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_NEG)
 	    /* open-code fixnum arithmetic */
 	    tmp = TOP;
-	    if (rep_INTP (tmp))
+	    if (rep_fixnum_sub (rep_MAKE_INT (0), tmp, &tmp2))
 	    {
-		long x = - rep_INT (tmp);
-		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
-		{
-		    TOP = rep_MAKE_INT (x);
-		    SAFE_NEXT;
-		}
+		TOP = tmp2;
+		SAFE_NEXT;
 	    }
 	    TOP = rep_number_neg (tmp);
 	    INLINE_NEXT;
@@ -1261,22 +1454,25 @@ again: {
 	BEGIN_INSN (OP_SUB)
 	    /* open-code fixnum arithmetic */
 	    POP1 (tmp);
-	    tmp2 = TOP;
-	    if (rep_INTP (tmp) && rep_INTP (tmp2))
+	    if (rep_fixnum_sub (TOP, tmp, &tmp2))
 	    {
-		long x = rep_INT (tmp2) - rep_INT (tmp);
-		if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT)
-		{
-		    TOP = rep_MAKE_INT (x);
-		    SAFE_NEXT;
-		}
+		TOP = tmp2;
+		SAFE_NEXT;
 	    }
-	    TOP = rep_number_sub (tmp2, tmp);
+	    TOP = rep_number_sub (TOP, tmp);
 	    INLINE_NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_MUL)
-	    CALL_2(rep_number_mul);
+	    /* open-code fixnum arithmetic */
+	    POP1 (tmp);
+	    if (rep_fixnum_mul (TOP, tmp, &tmp2))
+	    {
+		TOP = tmp2;
+		SAFE_NEXT;
+	    }
+	    TOP = rep_number_mul (TOP, tmp);
+	    INLINE_NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_DIV)
@@ -1343,9 +1539,11 @@ again: {
 	BEGIN_INSN (OP_GT)
 	    POP1 (tmp);
 	    tmp2 = TOP;
-	    if (rep_INTP (tmp2) && rep_INTP (tmp))
+	    if (rep_INTP_2 (tmp2, tmp))
 	    {
-		TOP = (rep_INT (tmp2) > rep_INT (tmp)) ? Qt : Qnil;
+		/* the tags are equal, so compare the words directly */
+		TOP = (((rep_PTR_SIZED_INT) tmp2 > (rep_PTR_SIZED_INT) tmp)
+		       ? Qt : Qnil);
 		SAFE_NEXT;
 	    }
 	    else if (rep_NUMBERP (tmp2) || rep_NUMBERP (tmp))
@@ -1363,9 +1561,10 @@ again: {
 	BEGIN_INSN (OP_GE)
 	    POP1 (tmp);
 	    tmp2 = TOP;
-	    if (rep_INTP (tmp2) && rep_INTP (tmp))
+	    if (rep_INTP_2 (tmp2, tmp))
 	    {
-		TOP = (rep_INT (tmp2) >= rep_INT (tmp)) ? Qt : Qnil;
+		TOP = (((rep_PTR_SIZED_INT) tmp2 >= (rep_PTR_SIZED_INT) tmp)
+		       ? Qt : Qnil);
 		SAFE_NEXT;
 	    }
 	    else if (rep_NUMBERP (tmp2) || rep_NUMBERP (tmp))
@@ -1383,9 +1582,10 @@ again: {
 	BEGIN_INSN (OP_LT)
 	    POP1 (tmp);
 	    tmp2 = TOP;
-	    if (rep_INTP (tmp2) && rep_INTP (tmp))
+	    if (rep_INTP_2 (tmp2, tmp))
 	    {
-		TOP = (rep_INT (tmp2) < rep_INT (tmp)) ? Qt : Qnil;
+		TOP = (((rep_PTR_SIZED_INT) tmp2 < (rep_PTR_SIZED_INT) tmp)
+		       ? Qt : Qnil);
 		SAFE_NEXT;
 	    }
 	    else if (rep_NUMBERP (tmp2) || rep_NUMBERP (tmp))
@@ -1403,9 +1603,10 @@ again: {
 	BEGIN_INSN (OP_LE)
 	    POP1 (tmp);
 	    tmp2 = TOP;
-	    if (rep_INTP (tmp2) && rep_INTP (tmp))
+	    if (rep_INTP_2 (tmp2, tmp))
 	    {
-		TOP = (rep_INT (tmp2) <= rep_INT (tmp)) ? Qt : Qnil;
+		TOP = (((rep_PTR_SIZED_INT) tmp2 <= (rep_PTR_SIZED_INT) tmp)
+		       ? Qt : Qnil);
 		SAFE_NEXT;
 	    }
 	    else if (rep_NUMBERP (tmp2) || rep_NUMBERP (tmp))
@@ -1422,14 +1623,10 @@ again: {
 
 	BEGIN_INSN (OP_INC)
 	    tmp = TOP;
-	    if (rep_INTP (tmp))
+	    if (rep_fixnum_add (tmp, rep_MAKE_INT (1), &tmp2))
 	    {
-		long x = rep_INT (tmp) + 1;
-		if (x <= rep_LISP_MAX_INT)
-		{
-		    TOP = rep_MAKE_INT (x);
-		    SAFE_NEXT;
-		}
+		TOP = tmp2;
+		SAFE_NEXT;
 	    }
 	    TOP = Fplus1 (tmp);
 	    NEXT;
@@ -1437,21 +1634,24 @@ again: {
 
 	BEGIN_INSN (OP_DEC)
 	    tmp = TOP;
-	    if (rep_INTP (tmp))
+	    if (rep_fixnum_sub (tmp, rep_MAKE_INT (1), &tmp2))
 	    {
-		long x = rep_INT (tmp) - 1;
-		if (x >= rep_LISP_MIN_INT)
-		{
-		    TOP = rep_MAKE_INT (x);
-		    SAFE_NEXT;
-		}
+		TOP = tmp2;
+		SAFE_NEXT;
 	    }
 	    TOP = Fsub1 (tmp);
 	    NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_ASH)
-	    CALL_2(Fash);
+	    POP1 (tmp);
+	    if (rep_fixnum_ash (TOP, tmp, &tmp2))
+	    {
+		TOP = tmp2;
+		SAFE_NEXT;
+	    }
+	    TOP = Fash (TOP, tmp);
+	    NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_ZEROP)
@@ -1868,9 +2068,10 @@ again: {
 	    POP1 (args);
 	    tmp = TOP;
 	    SYNC_GC;
-	    if (impurity == 0 && *pc == OP_RETURN && rep_FUNARGP (tmp)
+	    if (impurity == 0 && NEXT_OP_IS (OP_RETURN) && rep_FUNARGP (tmp)
 		&& rep_COMPILEDP (rep_FUNARG (tmp)->fun)
-		&& rep_STRUCTURE (rep_FUNARG (tmp)->structure)->apply_bytecode == 0)
+		&& rep_STRUCTURE (rep_FUNARG (tmp)->structure)->apply_bytecode == 0
+		&& TAIL_CALLABLE_P (rep_FUNARG (tmp)->fun))
 	    {
 		/* a doable tail-call */
 		int nargs, i, n_req_v;
@@ -1988,8 +2189,7 @@ again: {
 
 	BEGIN_INSN (OP_FLUID_BIND)
 	    POP2 (tmp, tmp2);
-	    rep_special_bindings = Fcons (Fcons (tmp2, tmp),
-					  rep_special_bindings);
+	    rep_push_special_binding (tmp2, tmp);
 	    BIND_TOP = rep_MARK_SPEC_BINDING (BIND_TOP);
 	    impurity++;
 	    SAFE_NEXT;
@@ -2002,7 +2202,7 @@ again: {
 	BEGIN_INSN (OP_NUM_EQ)
 	    POP1 (tmp);
 	    tmp2 = TOP;
-	    if (rep_INTP (tmp) && rep_INTP (tmp2))
+	    if (rep_INTP_2 (tmp, tmp2))
 	    {
 		TOP = (tmp2 == tmp) ? Qt : Qnil;
 		SAFE_NEXT;
@@ -2114,6 +2314,76 @@ again: {
 	    SAFE_NEXT;
 	END_INSN
 
+	/* Superinstructions */
+
+	BEGIN_INSN (OP_SLOT_REF_CAR)
+	    arg = FETCH;
+	    ASSERT (s_stkreq > arg);
+	    tmp = slotp[arg];
+	    PUSH (rep_CONSP (tmp) ? rep_CAR (tmp) : Qnil);
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_SLOT_REF_CDR)
+	    arg = FETCH;
+	    ASSERT (s_stkreq > arg);
+	    tmp = slotp[arg];
+	    PUSH (rep_CONSP (tmp) ? rep_CDR (tmp) : Qnil);
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_DUP_SLOT_SET)
+	    arg = FETCH;
+	    ASSERT (s_stkreq > arg);
+	    slotp[arg] = TOP;
+	    SAFE_NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_EQ_JN)
+	    POP2 (tmp, tmp2);
+	    if (tmp != tmp2)
+		goto do_jmp;
+	    SKIP_JMP_TARGET;
+	    SAFE_NEXT;
+	END_INSN
+
+	/* Records; the type and index are checked together, only
+	   calling the subr to signal the error */
+
+	BEGIN_INSN (OP_RECORD_REF)
+	    POP2 (tmp, tmp2);
+	    if (rep_RECORD_INDEX_OK_P (TOP, tmp2, tmp))
+	    {
+		TOP = rep_RECORD_SLOT (TOP, rep_INT (tmp));
+		SAFE_NEXT;
+	    }
+	    TOP = F_record_ref (TOP, tmp2, tmp);
+	    NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_RECORD_SET)
+	    /* stack is RECORD TYPE INDEX VALUE */
+	    POP2 (tmp, tmp2);
+	    if (rep_RECORD_INDEX_OK_P (stackp[-1], TOP, tmp2))
+	    {
+		rep_RECORD_SLOT (stackp[-1], rep_INT (tmp2)) = tmp;
+		POP;
+		TOP = tmp;
+		SAFE_NEXT;
+	    }
+	    tmp = F_record_set (stackp[-1], TOP, tmp2, tmp);
+	    POP;
+	    TOP = tmp;
+	    NEXT;
+	END_INSN
+
+	BEGIN_INSN (OP_RECORD_P)
+	    POP1 (tmp);
+	    TOP = (rep_RECORDP (TOP) && rep_RECORD (TOP)->type == tmp
+		   ? Qt : Qnil);
+	    SAFE_NEXT;
+	END_INSN
+
 	/* Jump instructions follow */
 
 	BEGIN_INSN (OP_EJMP)
@@ -2130,7 +2400,7 @@ again: {
 	    POP1 (tmp);
 	    if(rep_NILP(tmp))
 		goto do_jmp;
-	    pc += 2;
+	    SKIP_JMP_TARGET;
 	    SAFE_NEXT;
 	END_INSN
 
@@ -2138,7 +2408,7 @@ again: {
 	    POP1 (tmp);
 	    if(!rep_NILP(tmp))
 		goto do_jmp;
-	    pc += 2;
+	    SKIP_JMP_TARGET;
 	    SAFE_NEXT;
 	END_INSN
 
@@ -2148,7 +2418,7 @@ again: {
 		POP;
 		goto do_jmp;
 	    }
-	    pc += 2;
+	    SKIP_JMP_TARGET;
 	    SAFE_NEXT;
 	END_INSN
 
@@ -2158,7 +2428,7 @@ again: {
 		POP;
 		goto do_jmp;
 	    }
-	    pc += 2;
+	    SKIP_JMP_TARGET;
 	    SAFE_NEXT;
 	END_INSN
 
@@ -2166,7 +2436,7 @@ again: {
 	    if(rep_NILP(TOP))
 		goto do_jmp;
 	    POP;
-	    pc += 2;
+	    SKIP_JMP_TARGET;
 	    SAFE_NEXT;
 	END_INSN
 
@@ -2174,13 +2444,13 @@ again: {
 	    if(!rep_NILP(TOP))
 		goto do_jmp;
 	    POP;
-	    pc += 2;
+	    SKIP_JMP_TARGET;
 	    SAFE_NEXT;
 	END_INSN
 
 	BEGIN_INSN (OP_JMP)
 	do_jmp:
-	    pc = (unsigned char *) rep_STR(code) + ((pc[0] << ARG_SHIFT) | pc[1]);
+	    pc = JMP_TARGET;
 
 	    /* Test if an interrupt occurred... */
 	    rep_TEST_INT;
@@ -2190,8 +2460,9 @@ again: {
 	    SYNC_GC;
 
 	    /* ...or if it's time to gc... */
-	    if(rep_data_after_gc >= rep_gc_threshold)
-		Fgarbage_collect (Qnil);
+	    if(rep_data_after_gc >= rep_gc_threshold
+	       && !rep_collect_garbage ())
+		HANDLE_ERROR;
 
 	    /* ...or time to switch threads */
 	    rep_MAY_YIELD;
@@ -2201,7 +2472,7 @@ again: {
 
 	BEGIN_DEFAULT_INSN
 	    Fsignal(Qbytecode_error, rep_list_2(rep_VAL(&unknown_op),
-						rep_MAKE_INT(pc[-1])));
+						rep_MAKE_INT(BAD_OPCODE)));
 	    HANDLE_ERROR;
 
 #ifdef EXTRA_VM_CODE
@@ -2209,6 +2480,12 @@ again: {
 #endif
 	END_INSN
 
+#if defined (THREADED_VM) && !defined (DIRECT_THREADED)
+    insn_profile:
+	PROFILE_INSN (pc - 1);
+	goto *insn_labels__[pc[-1]];
+#endif
+
 	END_DISPATCH
 	
 	/* Check if the instruction raised an exception. */
@@ -2249,7 +2526,7 @@ again: {
 		    RELOAD;
 		    PUSH(rep_throw_value);
 		    rep_throw_value = rep_NULL;
-		    pc = (unsigned char *) rep_STR(code) + rep_INT(rep_CAR(item));
+		    pc = PC_AT (rep_INT(rep_CAR(item)));
 		    impurity--;
 		    SAFE_NEXT;
 		}
@@ -2278,16 +2555,17 @@ quit:
     /* close the register scope */ }
 
     /* moved to after the execution, to avoid needing to gc protect argv */
-    if(rep_data_after_gc >= rep_gc_threshold)
-	Fgarbage_collect (Qnil);
+    if(rep_data_after_gc >= rep_gc_threshold && !rep_collect_garbage ())
+	code = rep_NULL;
     rep_MAY_YIELD;
 
     rep_lisp_depth--;
 
 #ifdef SLOW_GC_PROTECT
-    rep_POPGCN; rep_POPGCN; rep_POPGCN; rep_POPGCN; rep_POPGC; rep_POPGC;
+    rep_POPGCN; rep_POPGCN; rep_POPGCN; rep_POPGCN;
+    rep_POPGC; rep_POPGC; rep_POPGC;
 #else
-    rep_gc_root_stack = gc_consts.next;
+    rep_gc_root_stack = gc_subr.next;
     rep_gc_n_roots_stack = gc_argv.next;
 #endif
 
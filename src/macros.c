@@ -20,35 +20,111 @@
 
 /* Commentary:
 
-   The idea is to memoize macro expansions, but only until the next
-   garbage collection. This introduces very little memory overhead, two
-   cons cells per expansion (the expansion is around anyway until gc)
-
-   Whether it would be useful to keep expansions around for longer is
-   something that needs to be looked at later..
-
-   It's actually pretty good on its own. E.g. doing (compile-compiler)
-   with all interpreted code gives a miss ratio of about .023  */
+   The idea is to memoize macro expansions. Each entry in the history
+   records a single expansion step: the form, the environment it was
+   expanded in, the expansion, and the (macro . EXPANDER) definition
+   that made it. A step is only reused if the form's car still refers
+   to that same definition, so redefining a macro makes its own
+   expansions ineffective and leaves the rest alone.
+
+   The table is weak in its forms: the GC keeps an entry (and its
+   expansion) for as long as the form itself is reachable, dropping the
+   others. Expansions made by an ENVIRONMENT function can't be checked
+   in this way, so they only last until the next garbage collection.
+
+   It's pretty good on its own. E.g. doing (compile-compiler) with all
+   interpreted code gave a miss ratio of about .023 when the history
+   was cleared at each GC  */
 
 #define _GNU_SOURCE
 
 #include "repint.h"
 #include <string.h>
+#include <stdlib.h>
 #ifdef NEED_MEMORY_H
 # include <memory.h>
 #endif
 
-#define HIST_SIZE 256
-#define HIST_HASH_FN(x) (((x) >> 4) % HIST_SIZE)
+#define HIST_INITIAL_SIZE 1024
+
+#define HIST_HASH_FN(form, env) \
+    ((((unsigned long) (form) >> 3) ^ ((unsigned long) (env) >> 5)) \
+     * 2654435761UL)
+
+typedef struct {
+    repv form;			/* null if the slot is free */
+    repv env;
+    repv macro;			/* null if valid until the next GC */
+    repv expansion;
+    rep_bool traced;		/* used by the GC */
+} hist_entry;
 
-/* Each entry is a chain of cons cells. But note that the last cell's
-   cdr is dotted to ((repv)0) not Qnil */
-static repv history[HIST_SIZE];
+static hist_entry *history;
+static unsigned long hist_size, hist_used;
 
 static int macro_hits, macro_misses;
 
 DEFSYM(macro_environment, "macro-environment");
 
+static inline hist_entry *
+hist_slot (hist_entry *table, unsigned long size, repv form, repv env)
+{
+    unsigned long mask = size - 1;
+    unsigned long i = HIST_HASH_FN (form, env) & mask;
+    while (table[i].form != 0
+	   && (table[i].form != form || table[i].env != env))
+	i = (i + 1) & mask;
+    return table + i;
+}
+
+/* Rebuild the history in a table of SIZE entries, keeping only the
+   entries that KEEP returns true for. */
+static void
+rebuild_history (unsigned long size, rep_bool (*keep)(hist_entry *e))
+{
+    hist_entry *old = history;
+    unsigned long old_size = hist_size, i;
+    hist_entry *table = rep_alloc (size * sizeof (hist_entry));
+
+    if (table == 0)
+    {
+	/* keep the old table, just empty */
+	memset (old, 0, old_size * sizeof (hist_entry));
+	hist_used = 0;
+	return;
+    }
+    memset (table, 0, size * sizeof (hist_entry));
+    hist_used = 0;
+    for (i = 0; i < old_size; i++)
+    {
+	if (old[i].form != 0 && (keep == 0 || keep (old + i)))
+	{
+	    *hist_slot (table, size, old[i].form, old[i].env) = old[i];
+	    hist_used++;
+	}
+    }
+    history = table;
+    hist_size = size;
+    rep_free (old);
+}
+
+static void
+remember_expansion (repv form, repv env, repv macro, repv expansion)
+{
+    hist_entry *e;
+    if (2 * (hist_used + 1) > hist_size)
+	rebuild_history (hist_size * 2, 0);
+    e = hist_slot (history, hist_size, form, env);
+    if (e->form == 0)
+    {
+	e->form = form;
+	e->env = env;
+	hist_used++;
+    }
+    e->macro = macro;
+    e->expansion = expansion;
+}
+
 static inline repv
 symbol_value_in_structure (repv structure, repv sym)
 {
@@ -59,45 +135,33 @@ symbol_value_in_structure (repv structure, repv sym)
     return value;
 }
 
-DEFUN("macroexpand-1", Fmacroexpand_1, Smacroexpand_1,
-      (repv form, repv env), rep_Subr2) /*
-::doc:rep.lang.interpreter#macroexpand-1::
-macroexpand-1 FORM [ENVIRONMENT]
-
-If FORM is a macro call, expand it once and return the resulting form.
-
-If ENVIRONMENT is specified it is a function to call to do the actual
-expansion. Any macro expanders recursively calling macroexpand should
-pass the value of the `macro-environment' variable to this parameter.
-::end:: */
+/* If the cons FORM is a macro call in the structure or null ENV,
+   return the (macro . EXPANDER) pair defining the macro, else nil. */
+static repv
+macro_definition (repv form, repv env)
 {
-    rep_GC_root gc_bindings;
-    repv car, bindings;
-
-    if (!rep_CONSP (form))
-	return form;
-
-    if (env != Qnil && Ffunctionp (env) != Qnil)
-	return rep_call_lisp1 (env, form);
-
-again:
-    car = rep_CAR(form);
-    if(rep_SYMBOLP(car))
+    repv car = rep_CAR (form);
+    if (rep_SYMBOLP (car))
     {
 	if (rep_STRUCTUREP (env))
 	    /* deref the symbol in the module that it appeared in.. */
 	    car = symbol_value_in_structure (env, car);
 	else
 	    car = Fsymbol_value (car, Qt);
-	if (!rep_CONSP(car) || rep_CAR(car) != Qmacro)
-	    return form;
-	car = rep_CDR(car);
     }
-    else if (rep_CONSP(car) && rep_CAR(car) == Qmacro)
-	car = rep_CDR(car);
+    if (rep_CONSP (car) && rep_CAR (car) == Qmacro
+	&& Ffunctionp (rep_CDR (car)) != Qnil)
+	return car;
+    else
+	return Qnil;
+}
 
-    if (Ffunctionp(car) == Qnil)
-	return form;
+/* Expand FORM once using the macro definition DEF */
+static repv
+expand_with (repv def, repv form, repv env)
+{
+    rep_GC_root gc_bindings;
+    repv car = rep_CDR (def), bindings;
 
     if (rep_FUNARGP (car))
     {
@@ -119,7 +183,7 @@ again:
 	    rep_POP_CALL (lc);
 
 	    if (car != rep_NULL)
-		goto again;
+		return Fmacroexpand_1 (form, env);
 	    else
 		return rep_NULL;
 	}
@@ -133,71 +197,198 @@ again:
     return form;
 }
 
-DEFUN("macroexpand", Fmacroexpand, Smacroexpand,
+/* Like Fmacroexpand_1, but consulting and updating the history */
+static repv
+macroexpand_1_cached (repv form, repv env)
+{
+    hist_entry *e;
+    repv def, out;
+    rep_GC_root gc_form, gc_env, gc_def;
+
+    if (!rep_CONSP (form))
+	return form;
+
+    if (env != Qnil && !rep_STRUCTUREP (env) && Ffunctionp (env) != Qnil)
+    {
+	e = hist_slot (history, hist_size, form, env);
+	if (e->form != 0 && e->macro == 0)
+	{
+	    macro_hits++;
+	    return e->expansion;
+	}
+	macro_misses++;
+	rep_PUSHGC (gc_form, form);
+	rep_PUSHGC (gc_env, env);
+	out = rep_call_lisp1 (env, form);
+	rep_POPGC; rep_POPGC;
+	if (out != rep_NULL)
+	    remember_expansion (form, env, 0, out);
+	return out;
+    }
+
+    def = macro_definition (form, env);
+    if (def == Qnil)
+	return form;
+
+    e = hist_slot (history, hist_size, form, env);
+    if (e->form != 0 && e->macro == def)
+    {
+	macro_hits++;
+	return e->expansion;
+    }
+    macro_misses++;
+
+    rep_PUSHGC (gc_form, form);
+    rep_PUSHGC (gc_env, env);
+    rep_PUSHGC (gc_def, def);
+    out = expand_with (def, form, env);
+    rep_POPGC; rep_POPGC; rep_POPGC;
+
+    /* an autoloaded definition will have been replaced */
+    if (out != rep_NULL && rep_CDR (def) != rep_NULL
+	&& !(rep_FUNARGP (rep_CDR (def))
+	     && rep_CONSP (rep_FUNARG (rep_CDR (def))->fun)
+	     && rep_CAR (rep_FUNARG (rep_CDR (def))->fun) == Qautoload))
+	remember_expansion (form, env, def, out);
+    return out;
+}
+
+DEFUN("macroexpand-1", Fmacroexpand_1, Smacroexpand_1,
       (repv form, repv env), rep_Subr2) /*
-::doc:rep.lang.interpreter#macroexpand::
-macroexpand FORM [ENVIRONMENT]
+::doc:rep.lang.interpreter#macroexpand-1::
+macroexpand-1 FORM [ENVIRONMENT]
 
-If FORM is a macro call, expand it until it isn't.
+If FORM is a macro call, expand it once and return the resulting form.
 
 If ENVIRONMENT is specified it is a function to call to do the actual
 expansion. Any macro expanders recursively calling macroexpand should
 pass the value of the `macro-environment' variable to this parameter.
 ::end:: */
 {
-    repv input = form, pred, ptr;
-    rep_GC_root gc_input, gc_pred;
+    repv def;
 
     if (!rep_CONSP (form))
 	return form;
 
-    /* Search the history */
-    ptr = history[HIST_HASH_FN(form)];
-    while (ptr != 0)
-    {
-	if (rep_CAAR (ptr) == form)
-	{
-	    macro_hits++;
-	    return rep_CDAR (ptr);
-	}
-	ptr = rep_CDR (ptr);
-    }
-    macro_misses++;
+    if (env != Qnil && Ffunctionp (env) != Qnil)
+	return rep_call_lisp1 (env, form);
+
+    def = macro_definition (form, env);
+    if (def == Qnil)
+	return form;
+    else
+	return expand_with (def, form, env);
+}
+
+DEFUN("macroexpand", Fmacroexpand, Smacroexpand,
+      (repv form, repv env), rep_Subr2) /*
+::doc:rep.lang.interpreter#macroexpand::
+macroexpand FORM [ENVIRONMENT]
+
+If FORM is a macro call, expand it until it isn't.
+
+If ENVIRONMENT is specified it is a function to call to do the actual
+expansion. Any macro expanders recursively calling macroexpand should
+pass the value of the `macro-environment' variable to this parameter.
+::end:: */
+{
+    repv pred;
+    rep_GC_root gc_pred, gc_env;
 
-    rep_PUSHGC(gc_input, input);
     rep_PUSHGC(gc_pred, pred);
+    rep_PUSHGC(gc_env, env);
     pred = form;
     while (1)
     {
-	form = Fmacroexpand_1 (pred, env);
+	form = macroexpand_1_cached (pred, env);
 	if (form == rep_NULL || form == pred)
 	    break;
 	pred = form;
     }
     rep_POPGC; rep_POPGC;
+    return form;
+}
 
-    if (form != rep_NULL)
-    {
-	/* Cache for future use */
-	unsigned int hash = HIST_HASH_FN(input);
-	history[hash] = Fcons (Fcons (input, form), history[hash]);
-    }
+static rep_bool
+entry_persists (hist_entry *e)
+{
+    return e->macro != 0;
+}
 
-    return form;
+static rep_bool
+entry_live (hist_entry *e)
+{
+    return e->traced;
 }
 
 void
 rep_macros_before_gc (void)
 {
-    /* XXX Perhaps be more discerning? (We would need to arrange some
-       XXX marking then though..) */
-    rep_macros_clear_history ();
+    /* expansions by environment functions can't be validated */
+    rep_bool transient = rep_FALSE;
+    unsigned long i;
+    for (i = 0; i < hist_size && !transient; i++)
+	transient = history[i].form != 0 && history[i].macro == 0;
+    if (transient)
+	rebuild_history (hist_size, entry_persists);
+}
+
+#define LIVEP(v) (rep_INTP (v) || rep_GC_MARKEDP (v))
+
+/* Called by the GC once the roots have been marked (DROP false), and
+   again after the guardians have run (DROP true). Keeps the expansions
+   of reachable forms alive; since that may make more forms reachable,
+   repeat until nothing changes. Finally forget the entries whose forms
+   are dead. */
+void
+rep_mark_macro_history (rep_bool drop)
+{
+    rep_bool changed;
+    unsigned long i;
+
+    if (!drop)
+    {
+	for (i = 0; i < hist_size; i++)
+	    history[i].traced = rep_FALSE;
+    }
+
+    do {
+	changed = rep_FALSE;
+	for (i = 0; i < hist_size; i++)
+	{
+	    hist_entry *e = history + i;
+	    if (e->form != 0 && !e->traced && LIVEP (e->form))
+	    {
+		rep_MARKVAL (e->env);
+		rep_MARKVAL (e->macro);
+		rep_MARKVAL (e->expansion);
+		e->traced = rep_TRUE;
+		changed = rep_TRUE;
+	    }
+	}
+    } while (changed);
+
+    if (drop)
+    {
+	unsigned long size = hist_size, live = 0;
+	for (i = 0; i < hist_size; i++)
+	{
+	    if (history[i].form != 0 && history[i].traced)
+		live++;
+	}
+	if (live == hist_used)
+	    return;
+	while (size > HIST_INITIAL_SIZE && 8 * live < size)
+	    size /= 2;
+	rebuild_history (size, entry_live);
+    }
 }
 
 void
 rep_macros_clear_history (void)
 {
-    memset (history, 0, sizeof (history));
+    memset (history, 0, hist_size * sizeof (hist_entry));
+    hist_used = 0;
 }
 
 void
@@ -208,6 +399,8 @@ rep_macros_init (void)
     rep_ADD_SUBR(Smacroexpand_1);
     rep_INTERN_SPECIAL(macro_environment);
     Fset (Qmacro_environment, Qnil);
+    hist_size = HIST_INITIAL_SIZE;
+    history = rep_alloc (hist_size * sizeof (hist_entry));
     rep_macros_clear_history ();
     rep_pop_structure (tem);
 }
@@ -244,12 +244,20 @@ rep_init_from_dump(char *prog_name, int *argc, char ***argv,
 	rep_macros_init ();
 	rep_lispcmds_init();
 	rep_lispmach_init();
+	rep_jitmach_init();
 	rep_find_init();
+	rep_regset_init();
 	rep_main_init();
 	rep_misc_init();
 	rep_streams_init();
+	rep_strings_init();
 	rep_files_init();
+	rep_fasl_init ();
 	rep_datums_init();
+	rep_records_init();
+	rep_deques_init();
+	rep_codecs_init();
+	rep_dedupe_init();
 	rep_fluids_init();
 	rep_weak_refs_init ();
 	rep_sys_os_init();
@@ -294,14 +302,22 @@ rep_load_environment (repv file)
     };
     const char **ptr;
 
-    repv res = Qnil;
+    repv res = Qnil, image;
     rep_GC_root gc_file;
 
     rep_PUSHGC (gc_file, file);
 
+    /* 0. Open the image given by --image, if any, so that the
+       bootstrap's files come from it */
+
+    if (rep_get_option ("--image", &image))
+	res = rep_open_image (image);
+    else if (rep_throw_value != rep_NULL)
+	res = rep_NULL;
+
     /* 1. Do the rep bootstrap */
 
-    if (rep_dumped_non_constants != rep_NULL)
+    if (res != rep_NULL && rep_dumped_non_constants != rep_NULL)
 	res = Feval (rep_dumped_non_constants);
 
     for (ptr = init; res != rep_NULL && *ptr != 0; ptr++)
@@ -361,7 +377,7 @@ rep_on_idle(long since_last_event)
 	res = rep_TRUE;
     else if(rep_data_after_gc > rep_idle_gc_threshold)
 	/* nothing was saved so try a GC */
-	Fgarbage_collect (Qnil);
+	rep_idle_garbage_collect ();
     else if(!called_hook && depth == 1)
     {
 	repv hook = Fsymbol_value(Qidle_hook, Qt);
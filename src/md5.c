@@ -417,3 +417,241 @@ md5_process_block (buffer, len, ctx)
   ctx->C = C;
   ctx->D = D;
 }
+
+
+#if defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+
+/* The multi-buffer version of md5_process_block: the same steps are
+   applied to one block from each of MD5_LANES messages at once, using
+   GCC's generic vectors (so SSE2, NEON, AltiVec or just plain integer
+   operations, depending on the machine).  */
+
+#define MD5_LANES 4
+
+typedef md5_uint32 md5_vec __attribute__ ((vector_size (MD5_LANES * 4)));
+
+#define VSPLAT(x) ((md5_vec) { (x), (x), (x), (x) })
+
+static md5_uint32
+get_le32 (const unsigned char *p)
+{
+  return (p[0] | ((md5_uint32) p[1] << 8)
+	  | ((md5_uint32) p[2] << 16) | ((md5_uint32) p[3] << 24));
+}
+
+static void
+put_le32 (unsigned char *p, md5_uint32 x)
+{
+  p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+/* Process one 64-byte block from each of BLOCKS, updating the four
+   states in STATE.  */
+static void
+md5_process_lanes (const unsigned char *blocks[MD5_LANES], md5_vec state[4])
+{
+  md5_vec X[16];
+  md5_vec A = state[0];
+  md5_vec B = state[1];
+  md5_vec C = state[2];
+  md5_vec D = state[3];
+  int k;
+
+  for (k = 0; k < 16; k++)
+    X[k] = (md5_vec) { get_le32 (blocks[0] + 4 * k),
+		       get_le32 (blocks[1] + 4 * k),
+		       get_le32 (blocks[2] + 4 * k),
+		       get_le32 (blocks[3] + 4 * k) };
+
+#define VOP(f, a, b, c, d, k, s, T)					\
+      do								\
+	{								\
+	  a += f (b, c, d) + X[k] + VSPLAT (T);				\
+	  a = (a << VSPLAT (s)) | (a >> VSPLAT (32 - s));		\
+	  a += b;							\
+	}								\
+      while (0)
+
+      /* Round 1.  */
+      VOP (FF, A, B, C, D,  0,  7, 0xd76aa478);
+      VOP (FF, D, A, B, C,  1, 12, 0xe8c7b756);
+      VOP (FF, C, D, A, B,  2, 17, 0x242070db);
+      VOP (FF, B, C, D, A,  3, 22, 0xc1bdceee);
+      VOP (FF, A, B, C, D,  4,  7, 0xf57c0faf);
+      VOP (FF, D, A, B, C,  5, 12, 0x4787c62a);
+      VOP (FF, C, D, A, B,  6, 17, 0xa8304613);
+      VOP (FF, B, C, D, A,  7, 22, 0xfd469501);
+      VOP (FF, A, B, C, D,  8,  7, 0x698098d8);
+      VOP (FF, D, A, B, C,  9, 12, 0x8b44f7af);
+      VOP (FF, C, D, A, B, 10, 17, 0xffff5bb1);
+      VOP (FF, B, C, D, A, 11, 22, 0x895cd7be);
+      VOP (FF, A, B, C, D, 12,  7, 0x6b901122);
+      VOP (FF, D, A, B, C, 13, 12, 0xfd987193);
+      VOP (FF, C, D, A, B, 14, 17, 0xa679438e);
+      VOP (FF, B, C, D, A, 15, 22, 0x49b40821);
+      /* Round 2.  */
+      VOP (FG, A, B, C, D,  1,  5, 0xf61e2562);
+      VOP (FG, D, A, B, C,  6,  9, 0xc040b340);
+      VOP (FG, C, D, A, B, 11, 14, 0x265e5a51);
+      VOP (FG, B, C, D, A,  0, 20, 0xe9b6c7aa);
+      VOP (FG, A, B, C, D,  5,  5, 0xd62f105d);
+      VOP (FG, D, A, B, C, 10,  9, 0x02441453);
+      VOP (FG, C, D, A, B, 15, 14, 0xd8a1e681);
+      VOP (FG, B, C, D, A,  4, 20, 0xe7d3fbc8);
+      VOP (FG, A, B, C, D,  9,  5, 0x21e1cde6);
+      VOP (FG, D, A, B, C, 14,  9, 0xc33707d6);
+      VOP (FG, C, D, A, B,  3, 14, 0xf4d50d87);
+      VOP (FG, B, C, D, A,  8, 20, 0x455a14ed);
+      VOP (FG, A, B, C, D, 13,  5, 0xa9e3e905);
+      VOP (FG, D, A, B, C,  2,  9, 0xfcefa3f8);
+      VOP (FG, C, D, A, B,  7, 14, 0x676f02d9);
+      VOP (FG, B, C, D, A, 12, 20, 0x8d2a4c8a);
+      /* Round 3.  */
+      VOP (FH, A, B, C, D,  5,  4, 0xfffa3942);
+      VOP (FH, D, A, B, C,  8, 11, 0x8771f681);
+      VOP (FH, C, D, A, B, 11, 16, 0x6d9d6122);
+      VOP (FH, B, C, D, A, 14, 23, 0xfde5380c);
+      VOP (FH, A, B, C, D,  1,  4, 0xa4beea44);
+      VOP (FH, D, A, B, C,  4, 11, 0x4bdecfa9);
+      VOP (FH, C, D, A, B,  7, 16, 0xf6bb4b60);
+      VOP (FH, B, C, D, A, 10, 23, 0xbebfbc70);
+      VOP (FH, A, B, C, D, 13,  4, 0x289b7ec6);
+      VOP (FH, D, A, B, C,  0, 11, 0xeaa127fa);
+      VOP (FH, C, D, A, B,  3, 16, 0xd4ef3085);
+      VOP (FH, B, C, D, A,  6, 23, 0x04881d05);
+      VOP (FH, A, B, C, D,  9,  4, 0xd9d4d039);
+      VOP (FH, D, A, B, C, 12, 11, 0xe6db99e5);
+      VOP (FH, C, D, A, B, 15, 16, 0x1fa27cf8);
+      VOP (FH, B, C, D, A,  2, 23, 0xc4ac5665);
+      /* Round 4.  */
+      VOP (FI, A, B, C, D,  0,  6, 0xf4292244);
+      VOP (FI, D, A, B, C,  7, 10, 0x432aff97);
+      VOP (FI, C, D, A, B, 14, 15, 0xab9423a7);
+      VOP (FI, B, C, D, A,  5, 21, 0xfc93a039);
+      VOP (FI, A, B, C, D, 12,  6, 0x655b59c3);
+      VOP (FI, D, A, B, C,  3, 10, 0x8f0ccc92);
+      VOP (FI, C, D, A, B, 10, 15, 0xffeff47d);
+      VOP (FI, B, C, D, A,  1, 21, 0x85845dd1);
+      VOP (FI, A, B, C, D,  8,  6, 0x6fa87e4f);
+      VOP (FI, D, A, B, C, 15, 10, 0xfe2ce6e0);
+      VOP (FI, C, D, A, B,  6, 15, 0xa3014314);
+      VOP (FI, B, C, D, A, 13, 21, 0x4e0811a1);
+      VOP (FI, A, B, C, D,  4,  6, 0xf7537e82);
+      VOP (FI, D, A, B, C, 11, 10, 0xbd3af235);
+      VOP (FI, C, D, A, B,  2, 15, 0x2ad7d2bb);
+      VOP (FI, B, C, D, A,  9, 21, 0xeb86d391);
+
+#undef VOP
+
+  state[0] += A;
+  state[1] += B;
+  state[2] += C;
+  state[3] += D;
+}
+
+/* Per message state of md5_buffers.  */
+struct md5_lane
+{
+  size_t msg;			/* index of message, or -1 */
+  const unsigned char *data;
+  size_t nfull;			/* whole blocks in the message */
+  size_t nblocks;		/* including the padding */
+  size_t next;			/* the next block to process */
+  unsigned char tail[128];	/* last bytes of the message, and padding */
+};
+
+void
+md5_buffers (buffers, lens, n, resblocks)
+     const char *const *buffers;
+     const size_t *lens;
+     size_t n;
+     void *resblocks;
+{
+  static const unsigned char idle[64];
+  struct md5_lane lane[MD5_LANES];
+  md5_vec state[4];
+  size_t next_msg = 0;
+  int active, i;
+
+  for (i = 0; i < MD5_LANES; i++)
+    lane[i].msg = (size_t) -1;
+
+  for (;;)
+    {
+      const unsigned char *blocks[MD5_LANES];
+
+      /* Start a new message in each free lane.  */
+      active = 0;
+      for (i = 0; i < MD5_LANES; i++)
+	{
+	  struct md5_lane *l = &lane[i];
+	  if (l->msg == (size_t) -1 && next_msg < n)
+	    {
+	      size_t len = lens[next_msg], rem = len & 63;
+	      md5_uint32 bits0 = len << 3, bits1 = len >> 29;
+	      unsigned char *end;
+
+	      l->msg = next_msg++;
+	      l->data = (const unsigned char *) buffers[l->msg];
+	      l->nfull = len / 64;
+	      l->next = 0;
+	      memcpy (l->tail, l->data + len - rem, rem);
+	      l->tail[rem] = 0x80;
+	      l->nblocks = l->nfull + (rem < 56 ? 1 : 2);
+	      end = l->tail + (l->nblocks - l->nfull) * 64;
+	      memset (l->tail + rem + 1, 0, end - 8 - (l->tail + rem + 1));
+	      put_le32 (end - 8, bits0);
+	      put_le32 (end - 4, bits1);
+
+	      state[0][i] = 0x67452301;
+	      state[1][i] = 0xefcdab89;
+	      state[2][i] = 0x98badcfe;
+	      state[3][i] = 0x10325476;
+	    }
+	  if (l->msg != (size_t) -1)
+	    {
+	      blocks[i] = (l->next < l->nfull
+			   ? l->data + l->next * 64
+			   : l->tail + (l->next - l->nfull) * 64);
+	      active++;
+	    }
+	  else
+	    blocks[i] = idle;
+	}
+      if (active == 0)
+	break;
+
+      md5_process_lanes (blocks, state);
+
+      /* Lanes that have finished their message give up their digest.  */
+      for (i = 0; i < MD5_LANES; i++)
+	{
+	  struct md5_lane *l = &lane[i];
+	  if (l->msg != (size_t) -1 && ++l->next == l->nblocks)
+	    {
+	      unsigned char *out = (unsigned char *) resblocks + l->msg * 16;
+	      put_le32 (out, state[0][i]);
+	      put_le32 (out + 4, state[1][i]);
+	      put_le32 (out + 8, state[2][i]);
+	      put_le32 (out + 12, state[3][i]);
+	      l->msg = (size_t) -1;
+	    }
+	}
+    }
+}
+
+#else /* __GNUC__ */
+
+void
+md5_buffers (buffers, lens, n, resblocks)
+     const char *const *buffers;
+     const size_t *lens;
+     size_t n;
+     void *resblocks;
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    md5_buffer (buffers[i], lens[i], (char *) resblocks + i * 16);
+}
+
+#endif /* __GNUC__ */
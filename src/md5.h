@@ -143,4 +143,10 @@ extern int md5_stream __P ((FILE *stream, void *resblock));
    digest.  */
 extern void *md5_buffer __P ((const char *buffer, size_t len, void *resblock));
 
+/* Compute the MD5 message digests of the N buffers, BUFFERS[I] holding
+   LENS[I] bytes, putting each in the 16 bytes at RESBLOCKS + I * 16.
+   Several buffers are processed at once, where the compiler can.  */
+extern void md5_buffers __P ((const char *const *buffers, const size_t *lens,
+			      size_t n, void *resblocks));
+
 #endif
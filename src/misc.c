@@ -164,7 +164,7 @@ is t, all matching ignores character case.
 ::end:: */
 {
     char *orig, *match = NULL;
-    int matchlen = 0, origlen;
+    long matchlen = 0, origlen;
 
     rep_DECLARE1(existing, rep_STRINGP);
     rep_DECLARE2(arg_list, rep_LISTP);
@@ -175,34 +175,25 @@ is t, all matching ignores character case.
     while(rep_CONSP(arg_list))
     {
 	repv arg = rep_CAR(arg_list);
-	if(rep_STRINGP(arg))
+	if(rep_STRINGP(arg) && rep_STRING_LEN(arg) >= origlen)
 	{
 	    char *tmp = rep_STR(arg);
+	    long len = rep_STRING_LEN(arg);
 	    if((rep_NILP(fold)
-		? strncmp (orig, tmp, origlen)
-		: strncasecmp (orig, tmp, origlen)) == 0)
+		? memcmp (orig, tmp, origlen)
+		: rep_str_casecmp (orig, tmp, origlen)) == 0)
 	    {
 		if(match)
 		{
-		    char *tmp2 = match + origlen;
-		    tmp += origlen;
-		    while(*tmp2 && *tmp)
-		    {
-			if(rep_NILP(fold)
-			   ? (*tmp2 != *tmp)
-			   : (tolower(*tmp2) != tolower(*tmp)))
-			{
-			    break;
-			}
-			tmp2++; tmp++;
-		    }
-		    if((tmp2 - match) < matchlen)
-			matchlen = tmp2 - match;
+		    matchlen = origlen + (rep_str_common_prefix
+					  (match + origlen, tmp + origlen,
+					   MIN(matchlen, len) - origlen,
+					   !rep_NILP(fold)));
 		}
 		else
 		{
 		    match = tmp;
-		    matchlen = strlen(tmp);
+		    matchlen = len;
 		}
 	    }
 	}
@@ -391,6 +382,17 @@ Returns the name of the host which the editor is running on.
     return rep_system_name();
 }
 
+DEFUN("processor-count", Fprocessor_count, Sprocessor_count,
+      (void), rep_Subr0) /*
+::doc:rep.system#processor-count::
+processor-count
+
+Returns the number of processors available to run processes on.
+::end:: */
+{
+    return rep_MAKE_INT (rep_processor_count ());
+}
+
 DEFUN("message", Fmessage, Smessage, (repv string, repv now), rep_Subr2) /*
 ::doc:rep.system#message::
 message STRING [DISPLAY-NOW]
@@ -428,13 +430,11 @@ Note that the STRING really is modified, no copy is made!
     tablen = rep_STRING_LEN(table);
     if(!rep_STRING_WRITABLE_P(string))
 	return(rep_signal_arg_error(string, 1));
+    rep_STRING_UNSHARE (string);
     str = (unsigned char *)rep_STR(string);
     slen = rep_STRING_LEN(string);
-    while(slen-- > 0)
-    {
-	register unsigned char c = *str;
-	*str++ = (c < tablen) ? ((unsigned char *)rep_STR(table))[c] : c;
-    }
+    rep_str_translate ((char *) str, (char *) str, slen,
+		       (unsigned char *) rep_STR(table), tablen);
     rep_string_modified (string);
     return(string);
 }
@@ -627,6 +627,7 @@ rep_misc_init(void)
     rep_ADD_SUBR(Suser_full_name);
     rep_ADD_SUBR(Suser_home_directory);
     rep_ADD_SUBR(Ssystem_name);
+    rep_ADD_SUBR(Sprocessor_count);
     rep_ADD_SUBR(Smessage);
 
     rep_pop_structure (tem);
@@ -48,6 +48,7 @@ char *alloca ();
 #include <limits.h>
 #include <errno.h>
 #include <time.h>
+#include <inttypes.h>
 
 #ifdef HAVE_LOCALE_H
 # include <locale.h>
@@ -63,6 +64,8 @@ char *alloca ();
 
 DEFSTRING(div_zero, "Divide by zero");
 DEFSTRING(domain_error, "Domain error");
+DEFSTRING(default_separators, " \t\n\r,");
+DEFSTRING(default_number_separator, " ");
 
 #if !defined (LONG_LONG_MIN)
 # if defined (LONGLONG_MIN)
@@ -198,6 +201,7 @@ make_number (int type)
     cn->car = rep_Number | type;
     used_numbers++;
     rep_data_after_gc += sizeof (rep_number);
+    rep_ALLOC_SAMPLE (sizeof (rep_number));
     return cn;
 }
 
@@ -905,6 +909,55 @@ parse_integer_to_float (char *buf, unsigned int len, unsigned int radix,
 	    (var) = 0;				\
     } while (0)
 
+#ifdef HAVE_SETLOCALE
+/* True if numbers are already read and printed with a `.' as their
+   decimal point, so there's no need to switch to the C locale */
+static inline rep_bool
+c_numeric_locale_p (void)
+{
+    const char *point = localeconv ()->decimal_point;
+    return point[0] == '.' && point[1] == 0;
+}
+# define ENTER_C_NUMERIC(var)				\
+    do {						\
+	(var) = 0;					\
+	if (!c_numeric_locale_p ())			\
+	    INSTALL_LOCALE (var, LC_NUMERIC, "C");	\
+    } while (0)
+# define LEAVE_C_NUMERIC(var)				\
+    do {						\
+	if ((var) != 0)					\
+	    setlocale (LC_NUMERIC, (var));		\
+    } while (0)
+#else
+# define ENTER_C_NUMERIC(var) do { (var) = 0; } while (0)
+# define LEAVE_C_NUMERIC(var) do { ; } while (0)
+#endif
+
+/* If the LEN characters at BUF are decimal digits whose value (negated
+   if SIGN is negative) is a fixnum, store it in *RESULT and return
+   true. */
+rep_bool
+rep_parse_fixnum (const char *buf, size_t len, int sign, repv *result)
+{
+    const unsigned rep_PTR_SIZED_INT limit
+	= (unsigned rep_PTR_SIZED_INT) rep_LISP_MAX_INT + (sign < 0);
+    unsigned rep_PTR_SIZED_INT value = 0;
+
+    if (len == 0)
+	return rep_FALSE;
+    while (len-- > 0)
+    {
+	unsigned int d = (unsigned char) *buf++ - '0';
+	if (d > 9 || value > (limit - d) / 10)
+	    return rep_FALSE;
+	value = value * 10 + d;
+    }
+    *result = rep_MAKE_INT (sign < 0 ? - (rep_PTR_SIZED_INT) value
+			    : (rep_PTR_SIZED_INT) value);
+    return rep_TRUE;
+}
+
 repv
 rep_parse_number (char *buf, unsigned int len, unsigned int radix, int sign, unsigned int type)
 {
@@ -923,6 +976,12 @@ rep_parse_number (char *buf, unsigned int len, unsigned int radix, int sign, uns
 	unsigned int bits;
 
     case 0:
+	if (radix == 10)
+	{
+	    repv value;
+	    if (rep_parse_fixnum (buf, len, sign, &value))
+		return value;
+	}
 	switch (radix)
 	{
 	case 2:
@@ -1075,14 +1134,9 @@ rep_parse_number (char *buf, unsigned int len, unsigned int radix, int sign, uns
 #endif
 
     case rep_NUMBER_FLOAT:
-#ifdef HAVE_SETLOCALE
-	INSTALL_LOCALE (old_locale, LC_NUMERIC, "C");
-#endif
+	ENTER_C_NUMERIC (old_locale);
 	d = strtod (buf, &tem);
-#ifdef HAVE_SETLOCALE
-	if (old_locale != 0)
-	    setlocale (LC_NUMERIC, old_locale);
-#endif
+	LEAVE_C_NUMERIC (old_locale);
 	if (tem - buf != len)
 	    goto error;
 	f = make_number (rep_NUMBER_FLOAT);
@@ -1093,6 +1147,174 @@ error:
     return rep_NULL;
 }
 
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Write the decimal representation of N to the buffer ending at END,
+   which must have at least rep_FIXNUM_DIGITS bytes before it, two digits
+   at a time. Returns a pointer to its first character; it isn't null
+   terminated. */
+char *
+rep_print_fixnum (char *end, rep_PTR_SIZED_INT n)
+{
+    unsigned rep_PTR_SIZED_INT u = (n < 0 ? - (unsigned rep_PTR_SIZED_INT) n
+				    : (unsigned rep_PTR_SIZED_INT) n);
+    char *ptr = end;
+    while (u >= 100)
+    {
+	const char *pair = digit_pairs + (u % 100) * 2;
+	u /= 100;
+	*--ptr = pair[1];
+	*--ptr = pair[0];
+    }
+    if (u >= 10)
+    {
+	*--ptr = digit_pairs[u * 2 + 1];
+	*--ptr = digit_pairs[u * 2];
+    }
+    else
+	*--ptr = '0' + u;
+    if (n < 0)
+	*--ptr = '-';
+    return ptr;
+}
+
+/* Round the 17 significant digits at DIGITS to N, storing them in OUT,
+   returning the change to the exponent (one if they were all nines) */
+static int
+round_digits (const char *digits, int n, char *out)
+{
+    int i, carry = digits[n] >= '5';
+    for (i = n - 1; i >= 0; i--)
+    {
+	int d = digits[i] - '0' + carry;
+	carry = d > 9;
+	out[i] = carry ? '0' : '0' + d;
+    }
+    if (carry)
+    {
+	out[0] = '1';
+	return 1;
+    }
+    return 0;
+}
+
+/* Print D to the SIZE bytes at BUF with PREC significant digits, or if
+   PREC is negative, with as few as read back as the same value. Either
+   way the result looks like printf's %g conversion. */
+static void
+print_float (char *buf, size_t size, double d, int prec)
+{
+    char *old_locale;
+
+    ENTER_C_NUMERIC (old_locale);
+    if (prec >= 0 || d != d || d - d != 0)
+    {
+	/* explicit precision, NaN or infinity */
+#ifdef HAVE_SNPRINTF
+	snprintf (buf, size, "%.*g", prec < 0 ? 17 : prec, d);
+#else
+	sprintf (buf, "%.*g", prec < 0 ? 17 : prec, d);
+#endif
+    }
+    else
+    {
+	/* Print all 17 digits, then find the fewest (from 15) that
+	   read back as D. The shorter candidates can usually be read
+	   with exact floating point arithmetic, so checking them is
+	   cheaper than printing them */
+	char e[40], digits[18], test[40], *out = buf;
+	int exponent, n, limit, len, point;
+	rep_bool neg = rep_FALSE;
+
+	sprintf (e, "%.16e", d);
+	if (e[0] == '-')
+	    neg = rep_TRUE;
+	digits[0] = e[neg];
+	memcpy (digits + 1, e + neg + 2, 16);
+	digits[17] = 0;
+	exponent = atoi (e + neg + 19);
+
+	/* trailing zeros can be dropped without checking */
+	limit = 17;
+	while (limit > 15 && digits[limit - 1] == '0')
+	    limit--;
+
+	for (n = 15; n < limit; n++)
+	{
+	    char rounded[17];
+	    int exp = exponent + round_digits (digits, n, rounded);
+	    test[0] = rounded[0];
+	    test[1] = '.';
+	    memcpy (test + 2, rounded + 1, n - 1);
+	    test[n + 1] = 'e';
+	    {
+		char exp_buf[rep_FIXNUM_DIGITS];
+		char *start = rep_print_fixnum (exp_buf + sizeof (exp_buf), exp);
+		int exp_len = exp_buf + sizeof (exp_buf) - start;
+		memcpy (test + n + 2, start, exp_len);
+		test[n + 2 + exp_len] = 0;
+	    }
+	    if (strtod (test, 0) == (neg ? -d : d))
+	    {
+		memcpy (digits, rounded, n);
+		exponent = exp;
+		break;
+	    }
+	}
+
+	/* strip trailing zeros */
+	len = n;
+	while (len > 1 && digits[len - 1] == '0')
+	    len--;
+
+	if (neg)
+	    *out++ = '-';
+	/* switch to exponential notation where %.16g would */
+	if (exponent < -4 || exponent >= 16)
+	{
+	    *out++ = digits[0];
+	    if (len > 1)
+	    {
+		*out++ = '.';
+		memcpy (out, digits + 1, len - 1);
+		out += len - 1;
+	    }
+	    sprintf (out, "e%c%02d", exponent < 0 ? '-' : '+', ABS (exponent));
+	}
+	else
+	{
+	    if (exponent < 0)
+	    {
+		*out++ = '0';
+		*out++ = '.';
+		for (point = exponent + 1; point < 0; point++)
+		    *out++ = '0';
+		memcpy (out, digits, len);
+		out += len;
+	    }
+	    else
+	    {
+		point = exponent + 1;
+		for (n = 0; n < MAX (len, point); n++)
+		{
+		    if (n == point)
+			*out++ = '.';
+		    *out++ = n < len ? digits[n] : '0';
+		}
+	    }
+	    *out = 0;
+	}
+    }
+    LEAVE_C_NUMERIC (old_locale);
+
+    /* libc doesn't always add a point */
+    if (!strchr (buf, '.') && !strchr (buf, 'e') && !strchr (buf, 'E'))
+	strcat (buf, ".");
+}
+
 char *
 rep_print_number_to_string (repv obj, int radix, int prec)
 {
@@ -1103,11 +1325,16 @@ rep_print_number_to_string (repv obj, int radix, int prec)
 
     switch (rep_NUMERIC_TYPE (obj))
     {
-	char buf[128], fmt[8], *tem, *old_locale;
+	char buf[128], *tem;
 
     case rep_NUMBER_INT:
 	if (radix == 10)
-	    tem = "%" rep_PTR_SIZED_INT_CONV "d";
+	{
+	    buf[sizeof (buf) - 1] = 0;
+	    out = strdup (rep_print_fixnum (buf + sizeof (buf) - 1,
+					    rep_INT (obj)));
+	    break;
+	}
 	else if (radix == 16)
 	    tem = "%" rep_PTR_SIZED_INT_CONV "x";
 	else if (radix == 8)
@@ -1170,22 +1397,7 @@ rep_print_number_to_string (repv obj, int radix, int prec)
 #endif
 
     case rep_NUMBER_FLOAT:		/* XXX handle radix arg */
-	sprintf (fmt, "%%.%dg", prec < 0 ? 16 : prec);
-#ifdef HAVE_SETLOCALE
-	INSTALL_LOCALE (old_locale, LC_NUMERIC, "C");
-#endif
-#ifdef HAVE_SNPRINTF
-	snprintf(buf, sizeof(buf), fmt, rep_NUMBER(obj,f));
-#else
-	sprintf(buf, fmt, rep_NUMBER(obj,f));
-#endif
-#ifdef HAVE_SETLOCALE
-	if (old_locale != 0)
-	    setlocale (LC_NUMERIC, old_locale);
-#endif
-	/* libc doesn't always add a point */
-	if (!strchr (buf, '.') && !strchr (buf, 'e') && !strchr (buf, 'E'))
-	    strcat (buf, ".");
+	print_float (buf, sizeof (buf), rep_NUMBER (obj,f), prec);
 	out = strdup (buf);
     }
     return out;
@@ -1196,14 +1408,15 @@ number_prin (repv stream, repv obj)
 {
     if (rep_INTP (obj))
     {
-	char buf[64];
-#ifdef HAVE_SNPRINTF
-	snprintf(buf, sizeof(buf),
-		 "%" rep_PTR_SIZED_INT_CONV "d", rep_INT(obj));
-#else
-	sprintf(buf, "%" rep_PTR_SIZED_INT_CONV "d", rep_INT(obj));
-#endif
-	rep_stream_puts(stream, buf, -1, rep_FALSE);
+	char buf[rep_FIXNUM_DIGITS], *ptr;
+	ptr = rep_print_fixnum (buf + sizeof (buf), rep_INT (obj));
+	rep_stream_puts (stream, ptr, buf + sizeof (buf) - ptr, rep_FALSE);
+    }
+    else if (rep_NUMBER_FLOAT_P (obj))
+    {
+	char buf[128];
+	print_float (buf, sizeof (buf), rep_NUMBER (obj,f), -1);
+	rep_stream_puts (stream, buf, -1, rep_FALSE);
     }
     else
     {
@@ -1355,6 +1568,8 @@ repv
 rep_number_add (repv x, repv y)
 {
     repv out;
+    if (rep_fixnum_add (x, y, &out))
+	return out;
     rep_DECLARE1 (x, rep_NUMERICP);
     rep_DECLARE2 (y, rep_NUMERICP);
     out = promote_dup (&x, &y);
@@ -1434,6 +1649,8 @@ repv
 rep_number_sub (repv x, repv y)
 {
     repv out;
+    if (rep_fixnum_sub (x, y, &out))
+	return out;
     rep_DECLARE1 (x, rep_NUMERICP);
     rep_DECLARE2 (y, rep_NUMERICP);
     out = promote_dup (&x, &y);
@@ -1475,6 +1692,8 @@ repv
 rep_number_mul (repv x, repv y)
 {
     repv out;
+    if (rep_fixnum_mul (x, y, &out))
+	return out;
     rep_DECLARE1 (x, rep_NUMERICP);
     rep_DECLARE2 (y, rep_NUMERICP);
     out = promote_dup (&x, &y);
@@ -2084,6 +2303,9 @@ DEFUN("1+", Fplus1, Splus1, (repv num), rep_Subr1) /*
 Return NUMBER plus 1.
 ::end:: */
 {
+    repv out;
+    if (rep_fixnum_add (num, rep_MAKE_INT (1), &out))
+	return out;
     rep_DECLARE1(num, rep_NUMERICP);
     switch (rep_NUMERIC_TYPE (num))
     {
@@ -2128,6 +2350,9 @@ DEFUN("1-", Fsub1, Ssub1, (repv num), rep_Subr1) /*
 Return NUMBER minus 1.
 ::end:: */
 {
+    repv out;
+    if (rep_fixnum_sub (num, rep_MAKE_INT (1), &out))
+	return out;
     rep_DECLARE1(num, rep_NUMERICP);
     switch (rep_NUMERIC_TYPE (num))
     {
@@ -2175,6 +2400,9 @@ the left, a negative COUNT means shift right.
 Both NUMBER and COUNT must be integers.
 ::end:: */
 {
+    repv out;
+    if (rep_fixnum_ash (num, shift, &out))
+	return out;
     rep_DECLARE1(num, rep_INTEGERP);
     rep_DECLARE2(shift, rep_INTEGERP);
 
@@ -2804,30 +3032,18 @@ result to be inexact.
     return foldv (argc, argv, rep_number_min);
 }
 
-DEFUN("string->number", Fstring_to_number,
-      Sstring_to_number, (repv string, repv radix_), rep_Subr2) /*
-::doc:rep.lang.math#string->number::
-string->number STRING [RADIX]
-
-Return the number represented by STRING. If RADIX is specified, the
-number is parsed from that base, otherwise base 10 is assumed.
-::end:: */
+/* Parse the LEN characters at PTR, which must be followed by a null
+   character, as string->number does. Returns rep_NULL if they aren't
+   a number. */
+static repv
+parse_number_string (char *ptr, size_t len, int radix)
 {
     int type = 0;
     int sign = 1;
     int force_exactness = 0;
-    int radix;
-    char *ptr;
+    char *start = ptr;
     repv ret;
 
-    rep_DECLARE1 (string, rep_STRINGP);
-    if (radix_ == Qnil)
-	radix_ = rep_MAKE_INT (10);
-    rep_DECLARE (2, radix_, rep_INTP (radix_) && rep_INT (radix_) > 0);
-
-    ptr = rep_STR (string);
-    radix = rep_INT (radix_);
-
     while (*ptr == '#')
     {
 	switch (ptr[1])
@@ -2857,7 +3073,7 @@ number is parsed from that base, otherwise base 10 is assumed.
 	    break;
 
 	default:
-	    return Qnil;
+	    return rep_NULL;
 	}
 	ptr += 2;
     }
@@ -2868,27 +3084,56 @@ number is parsed from that base, otherwise base 10 is assumed.
 	    sign = -1;
 	ptr++;
     }
+    len -= ptr - start;
+
+    if (radix == 10 && force_exactness == 0)
+    {
+	/* optimize most common case */
+	if (rep_parse_fixnum (ptr, len, sign, &ret))
+	    return ret;
+    }
 
-    if (strchr (ptr, '/'))
+    if (memchr (ptr, '/', len))
 	type = rep_NUMBER_RATIONAL;
     else if (radix == 10)
     {
-	if (strchr (ptr, '.') || strchr (ptr, 'e') || strchr (ptr, 'E'))
+	if (memchr (ptr, '.', len) || memchr (ptr, 'e', len)
+	    || memchr (ptr, 'E', len))
 	    type = rep_NUMBER_FLOAT;
     }
 
-    ret = rep_parse_number (ptr, rep_STRING_LEN (string)
-			    - (ptr - rep_STR (string)), radix, sign, type);
-    if (ret == rep_NULL)
-	ret = Qnil;
-    else if (force_exactness > 0)
-	ret = Finexact_to_exact (ret);
-    else if (force_exactness < 0)
-	ret = Fexact_to_inexact (ret);
-
+    ret = rep_parse_number (ptr, len, radix, sign, type);
+    if (ret != rep_NULL)
+    {
+	if (force_exactness > 0)
+	    ret = Finexact_to_exact (ret);
+	else if (force_exactness < 0)
+	    ret = Fexact_to_inexact (ret);
+    }
     return ret;
 }
 
+DEFUN("string->number", Fstring_to_number,
+      Sstring_to_number, (repv string, repv radix_), rep_Subr2) /*
+::doc:rep.lang.math#string->number::
+string->number STRING [RADIX]
+
+Return the number represented by STRING. If RADIX is specified, the
+number is parsed from that base, otherwise base 10 is assumed.
+::end:: */
+{
+    repv ret;
+
+    rep_DECLARE1 (string, rep_STRINGP);
+    if (radix_ == Qnil)
+	radix_ = rep_MAKE_INT (10);
+    rep_DECLARE (2, radix_, rep_INTP (radix_) && rep_INT (radix_) > 0);
+
+    ret = parse_number_string (rep_STR (string), rep_STRING_LEN (string),
+			       rep_INT (radix_));
+    return ret != rep_NULL ? ret : Qnil;
+}
+
 DEFUN("number->string", Fnumber_to_string,
       Snumber_to_string, (repv z, repv radix), rep_Subr2) /*
 ::doc:rep.lang.math#number->string::
@@ -2905,6 +3150,13 @@ in base 10.
 	radix = rep_MAKE_INT (10);
     rep_DECLARE (2, radix, rep_INTP (radix) && rep_INT (radix) > 0);
 
+    if (rep_INTP (z) && radix == rep_MAKE_INT (10))
+    {
+	char buf[rep_FIXNUM_DIGITS], *ptr;
+	ptr = rep_print_fixnum (buf + sizeof (buf), rep_INT (z));
+	return rep_string_dupn (ptr, buf + sizeof (buf) - ptr);
+    }
+
     out = rep_print_number_to_string (z, rep_INT (radix), -1);
     if (out == 0)
 	return Qnil;
@@ -2913,6 +3165,299 @@ in base 10.
 }
 
 
+/* Bulk conversion */
+
+/* Parse the LEN characters at PTR as a number, copying them to a null
+   terminated buffer first if necessary (BUF of SIZE bytes if it's big
+   enough). Returns nil if they aren't a number. */
+static repv
+parse_number_token (char *ptr, size_t len, int radix, char *buf, size_t size)
+{
+    repv ret;
+    if (radix == 10 && len > 0 && ptr[0] != '#')
+    {
+	/* plain fixnums don't need the copy */
+	int sign = 1;
+	char *digits = ptr;
+	if (*digits == '-' || *digits == '+')
+	    sign = (*digits++ == '-') ? -1 : 1;
+	if (rep_parse_fixnum (digits, len - (digits - ptr), sign, &ret))
+	    return ret;
+    }
+    if (len >= size)
+	buf = alloca (len + 1);
+    memcpy (buf, ptr, len);
+    buf[len] = 0;
+    ret = parse_number_string (buf, len, radix);
+    return ret != rep_NULL ? ret : Qnil;
+}
+
+DEFUN("string->number-vector", Fstring_to_number_vector,
+      Sstring_to_number_vector, (repv source, repv radix, repv separators,
+				 repv start, repv end), rep_Subr5) /*
+::doc:rep.lang.math#string->number-vector::
+string->number-vector SOURCE [RADIX] [SEPARATORS] [START] [END]
+
+Return a vector of the numbers represented by the strings in SOURCE, a
+list or vector, as if by applying `string->number' to each of them.
+Elements that aren't numbers give nil.
+
+Alternatively, SOURCE may be a single string, in which case the numbers
+are the fields of the region of it between START and END, delimited by
+any of the characters in the string SEPARATORS (by default whitespace
+and commas). Runs of separators count as a single one.
+::end:: */
+{
+    char buf[128];
+    repv vec;
+    int i, n;
+
+    if (radix == Qnil)
+	radix = rep_MAKE_INT (10);
+    rep_DECLARE (2, radix, rep_INTP (radix) && rep_INT (radix) > 0);
+
+    if (rep_STRINGP (source))
+    {
+	const char *seps;
+	char *ptr, *limit;
+	rep_PTR_SIZED_INT len = rep_STRING_LEN (source);
+
+	if (separators == Qnil)
+	    separators = rep_VAL (&default_separators);
+	rep_DECLARE3 (separators, rep_STRINGP);
+	if (start == Qnil)
+	    start = rep_MAKE_INT (0);
+	if (end == Qnil)
+	    end = rep_MAKE_INT (len);
+	rep_DECLARE (4, start, rep_INTP (start) && rep_INT (start) >= 0
+		     && rep_INT (start) <= len);
+	rep_DECLARE (5, end, rep_INTP (end) && rep_INT (end) >= rep_INT (start)
+		     && rep_INT (end) <= len);
+
+	/* a table of the separators, then count the fields */
+	{
+	    char is_sep[256];
+	    memset (is_sep, 0, sizeof (is_sep));
+	    for (seps = rep_STR (separators); *seps != 0; seps++)
+		is_sep[(unsigned char) *seps] = 1;
+
+	    limit = rep_STR (source) + rep_INT (end);
+	    n = 0;
+	    for (ptr = rep_STR (source) + rep_INT (start); ptr < limit;)
+	    {
+		while (ptr < limit && is_sep[(unsigned char) *ptr])
+		    ptr++;
+		if (ptr == limit)
+		    break;
+		n++;
+		while (ptr < limit && !is_sep[(unsigned char) *ptr])
+		    ptr++;
+	    }
+
+	    vec = rep_make_vector (n);
+	    i = 0;
+	    for (ptr = rep_STR (source) + rep_INT (start); i < n; i++)
+	    {
+		char *field;
+		while (is_sep[(unsigned char) *ptr])
+		    ptr++;
+		field = ptr;
+		while (ptr < limit && !is_sep[(unsigned char) *ptr])
+		    ptr++;
+		rep_VECTI (vec, i) = parse_number_token (field, ptr - field,
+							 rep_INT (radix),
+							 buf, sizeof (buf));
+	    }
+	}
+	return vec;
+    }
+    else if (rep_CONSP (source) || source == Qnil)
+    {
+	repv lst;
+	n = rep_list_length (source);
+	if (n < 0)
+	    return rep_NULL;
+	vec = rep_make_vector (n);
+	for (i = 0, lst = source; i < n; i++, lst = rep_CDR (lst))
+	{
+	    repv string = rep_CAR (lst);
+	    if (!rep_STRINGP (string))
+		return rep_signal_arg_error (string, 1);
+	    rep_VECTI (vec, i) = parse_number_token (rep_STR (string),
+						     rep_STRING_LEN (string),
+						     rep_INT (radix),
+						     buf, sizeof (buf));
+	}
+	return vec;
+    }
+    else if (rep_VECTORP (source))
+    {
+	n = rep_VECT_LEN (source);
+	vec = rep_make_vector (n);
+	for (i = 0; i < n; i++)
+	{
+	    repv string = rep_VECTI (source, i);
+	    if (!rep_STRINGP (string))
+		return rep_signal_arg_error (string, 1);
+	    rep_VECTI (vec, i) = parse_number_token (rep_STR (string),
+						     rep_STRING_LEN (string),
+						     rep_INT (radix),
+						     buf, sizeof (buf));
+	}
+	return vec;
+    }
+    else
+	return rep_signal_arg_error (source, 1);
+}
+
+/* Append the printed form of number Z in RADIX to the SIZE bytes at
+   OUT, returning the number of bytes used, or -1 if there isn't room. */
+static int
+print_number_into (char *out, size_t size, repv z, int radix)
+{
+    char tem[rep_FIXNUM_DIGITS + 40], *ptr;
+    size_t len;
+    if (rep_INTP (z) && radix == 10)
+    {
+	ptr = rep_print_fixnum (tem + sizeof (tem), rep_INT (z));
+	len = tem + sizeof (tem) - ptr;
+    }
+    else if (!rep_INTP (z) && rep_NUMBER_FLOAT_P (z) && radix == 10)
+    {
+	print_float (tem, sizeof (tem), rep_NUMBER (z, f), -1);
+	ptr = tem;
+	len = strlen (tem);
+    }
+    else
+	return -1;
+    if (len > size)
+	return -1;
+    memcpy (out, ptr, len);
+    return len;
+}
+
+DEFUN("write-numbers", Fwrite_numbers, Swrite_numbers,
+      (repv stream, repv numbers, repv separator, repv radix), rep_Subr4) /*
+::doc:rep.lang.math#write-numbers::
+write-numbers STREAM NUMBERS [SEPARATOR] [RADIX]
+
+Print each of the list or vector of NUMBERS to STREAM as
+`number->string' would, with the string or character SEPARATOR (by
+default a single space) between each pair of them. Returns the number
+of characters written.
+::end:: */
+{
+    char buf[1024], sep_char;
+    const char *sep;
+    int sep_len, n, i, fill = 0, total = 0;
+    repv lst = Qnil;
+    rep_GC_root gc_stream, gc_numbers;
+
+    if (radix == Qnil)
+	radix = rep_MAKE_INT (10);
+    rep_DECLARE (4, radix, rep_INTP (radix) && rep_INT (radix) > 0);
+    if (separator == Qnil)
+	separator = rep_VAL (&default_number_separator);
+    if (rep_INTP (separator))
+    {
+	sep_char = rep_INT (separator);
+	sep = &sep_char;
+	sep_len = 1;
+    }
+    else
+    {
+	rep_DECLARE3 (separator, rep_STRINGP);
+	sep = rep_STR (separator);
+	sep_len = rep_STRING_LEN (separator);
+    }
+
+    if (rep_VECTORP (numbers))
+	n = rep_VECT_LEN (numbers);
+    else if (rep_CONSP (numbers) || numbers == Qnil)
+    {
+	n = rep_list_length (numbers);
+	if (n < 0)
+	    return rep_NULL;
+	lst = numbers;
+    }
+    else
+	return rep_signal_arg_error (numbers, 2);
+
+    rep_PUSHGC (gc_stream, stream);
+    rep_PUSHGC (gc_numbers, numbers);
+    for (i = 0; i < n; i++)
+    {
+	repv z, printed = rep_NULL;
+	int len;
+
+	if (rep_VECTORP (numbers))
+	    z = rep_VECTI (numbers, i);
+	else
+	{
+	    z = rep_CAR (lst);
+	    lst = rep_CDR (lst);
+	}
+	if (!rep_NUMERICP (z))
+	{
+	    rep_signal_arg_error (z, 2);
+	    break;
+	}
+
+	if (i > 0)
+	{
+	    if (fill + sep_len > sizeof (buf))
+	    {
+		rep_stream_puts (stream, buf, fill, rep_FALSE);
+		total += fill;
+		fill = 0;
+	    }
+	    if (sep_len > sizeof (buf))
+	    {
+		rep_stream_puts (stream, (void *) sep, sep_len, rep_FALSE);
+		total += sep_len;
+	    }
+	    else
+	    {
+		memcpy (buf + fill, sep, sep_len);
+		fill += sep_len;
+	    }
+	}
+
+	len = print_number_into (buf + fill, sizeof (buf) - fill,
+				 z, rep_INT (radix));
+	if (len < 0)
+	{
+	    rep_stream_puts (stream, buf, fill, rep_FALSE);
+	    total += fill;
+	    fill = 0;
+	    len = print_number_into (buf, sizeof (buf), z, rep_INT (radix));
+	}
+	if (len < 0)
+	{
+	    /* bignums and non-decimal radices */
+	    printed = Fnumber_to_string (z, radix);
+	    if (printed == rep_NULL)
+		break;
+	    rep_stream_puts (stream, rep_PTR (printed), -1, rep_TRUE);
+	    total += rep_STRING_LEN (printed);
+	}
+	else
+	    fill += len;
+
+	if (rep_INTERRUPTP)
+	    break;
+    }
+    if (fill > 0)
+    {
+	rep_stream_puts (stream, buf, fill, rep_FALSE);
+	total += fill;
+    }
+    rep_POPGC; rep_POPGC;
+
+    return rep_throw_value ? rep_NULL : rep_MAKE_INT (total);
+}
+
+
 /* Random number generation */
 
 #if defined (HAVE_GMP) && defined (HAVE_GMP_RANDINIT) && __GNU_MP__ >= 4
@@ -3048,6 +3593,672 @@ generator is seeded with the current time of day.
 }
 
 
+/* Unboxed numeric vectors */
+
+/* A numeric vector holds its elements as C numbers of a single kind,
+   in a block of their own. Reading a float element still makes a
+   float object, but storing one allocates nothing, and the whole-vector
+   operations below run over the C array without touching the heap.
+
+   The element-wise loops are written so that the compiler can
+   vectorise them; the floating point reductions keep four partial
+   results, since they can't be reordered otherwise. Integer kinds
+   wrap around on overflow, as C's unsigned arithmetic does. */
+
+DEFSYM(f64, "f64");
+DEFSYM(f32, "f32");
+DEFSYM(s32, "s32");
+DEFSYM(s64, "s64");
+DEFSYM(u8, "u8");
+
+int rep_numeric_vector_type;
+
+static rep_numeric_vector *numeric_vectors;
+
+static const size_t nv_sizeofs[rep_NV_KINDS] = {
+    sizeof (double), sizeof (float), sizeof (int32_t),
+    sizeof (int64_t), sizeof (uint8_t)
+};
+
+static repv *nv_kind_syms[rep_NV_KINDS] = {
+    &Qf64, &Qf32, &Qs32, &Qs64, &Qu8
+};
+
+#define NV_F64(v) ((double *) rep_NUMERIC_VECTOR(v)->data)
+#define NV_F32(v) ((float *) rep_NUMERIC_VECTOR(v)->data)
+#define NV_S32(v) ((int32_t *) rep_NUMERIC_VECTOR(v)->data)
+#define NV_S64(v) ((int64_t *) rep_NUMERIC_VECTOR(v)->data)
+#define NV_U8(v)  ((uint8_t *) rep_NUMERIC_VECTOR(v)->data)
+
+#define NV_FLOAT_KIND_P(k) ((k) == rep_NV_F64 || (k) == rep_NV_F32)
+
+static int
+nv_kind (repv sym)
+{
+    int k;
+    for (k = 0; k < rep_NV_KINDS; k++)
+    {
+	if (*nv_kind_syms[k] == sym)
+	    return k;
+    }
+    return -1;
+}
+
+static repv
+make_numeric_vector (int kind, long length)
+{
+    size_t bytes = length * nv_sizeofs[kind];
+    rep_numeric_vector *v = rep_ALLOC_CELL (sizeof (rep_numeric_vector));
+    if (v == 0)
+	return rep_mem_error ();
+    v->data = rep_alloc (bytes != 0 ? bytes : 1);
+    if (v->data == 0)
+    {
+	rep_FREE_CELL (v);
+	return rep_mem_error ();
+    }
+    v->car = rep_numeric_vector_type | (kind << rep_CELL16_TYPE_BITS);
+    v->length = length;
+    v->next = numeric_vectors;
+    numeric_vectors = v;
+    rep_data_after_gc += sizeof (rep_numeric_vector) + bytes;
+    return rep_VAL (v);
+}
+
+/* Return element I of numeric vector VEC; I must be in range. */
+repv
+rep_numeric_vector_ref (repv vec, long i)
+{
+    switch (rep_NV_KIND (vec))
+    {
+    case rep_NV_F64:
+	return rep_make_float (NV_F64 (vec)[i], rep_TRUE);
+    case rep_NV_F32:
+	return rep_make_float (NV_F32 (vec)[i], rep_TRUE);
+    case rep_NV_S32:
+	return rep_make_long_int (NV_S32 (vec)[i]);
+    case rep_NV_S64:
+	return rep_make_longlong_int (NV_S64 (vec)[i]);
+    default:
+	return rep_MAKE_INT (NV_U8 (vec)[i]);
+    }
+}
+
+/* Store number VALUE as element I of numeric vector VEC (I must be in
+   range). Returns false if VALUE isn't a number. */
+rep_bool
+rep_numeric_vector_set (repv vec, long i, repv value)
+{
+    if (!rep_NUMERICP (value))
+	return rep_FALSE;
+    switch (rep_NV_KIND (vec))
+    {
+    case rep_NV_F64:
+	NV_F64 (vec)[i] = rep_get_float (value);
+	break;
+    case rep_NV_F32:
+	NV_F32 (vec)[i] = (float) rep_get_float (value);
+	break;
+    case rep_NV_S32:
+	NV_S32 (vec)[i] = (int32_t) (rep_INTP (value) ? rep_INT (value)
+				     : rep_get_long_int (value));
+	break;
+    case rep_NV_S64:
+	NV_S64 (vec)[i] = (int64_t) (rep_INTP (value) ? rep_INT (value)
+				     : rep_get_longlong_int (value));
+	break;
+    default:
+	NV_U8 (vec)[i] = (uint8_t) (rep_INTP (value) ? rep_INT (value)
+				    : rep_get_long_int (value));
+    }
+    return rep_TRUE;
+}
+
+/* Kernels, one for each kind that needs its own arithmetic. D may be
+   the same array as A or B. */
+
+#define NV_ELEMENTWISE(name, type, expr)				\
+    static void								\
+    name (type *d, const type *a, const type *b, long n)		\
+    {									\
+	long i;								\
+	for (i = 0; i < n; i++)						\
+	    d[i] = expr;						\
+    }
+
+NV_ELEMENTWISE (nv_add_f64, double, a[i] + b[i])
+NV_ELEMENTWISE (nv_add_f32, float, a[i] + b[i])
+NV_ELEMENTWISE (nv_add_s32, int32_t, (uint32_t) a[i] + (uint32_t) b[i])
+NV_ELEMENTWISE (nv_add_s64, int64_t, (uint64_t) a[i] + (uint64_t) b[i])
+NV_ELEMENTWISE (nv_add_u8, uint8_t, a[i] + b[i])
+NV_ELEMENTWISE (nv_mul_f64, double, a[i] * b[i])
+NV_ELEMENTWISE (nv_mul_f32, float, a[i] * b[i])
+NV_ELEMENTWISE (nv_mul_s32, int32_t, (uint32_t) a[i] * (uint32_t) b[i])
+NV_ELEMENTWISE (nv_mul_s64, int64_t, (uint64_t) a[i] * (uint64_t) b[i])
+NV_ELEMENTWISE (nv_mul_u8, uint8_t, a[i] * b[i])
+
+#define NV_SCALE(name, type, ftype, expr)				\
+    static void								\
+    name (type *d, const type *a, ftype f, long n)			\
+    {									\
+	long i;								\
+	for (i = 0; i < n; i++)						\
+	    d[i] = expr;						\
+    }
+
+NV_SCALE (nv_scale_f64, double, double, a[i] * f)
+NV_SCALE (nv_scale_f32, float, float, a[i] * f)
+NV_SCALE (nv_scale_s32, int32_t, uint32_t, (uint32_t) a[i] * f)
+NV_SCALE (nv_scale_s64, int64_t, uint64_t, (uint64_t) a[i] * f)
+NV_SCALE (nv_scale_u8, uint8_t, unsigned int, a[i] * f)
+
+/* Sum of A[i] * B[i], or of A[i] when B is null */
+#define NV_FLOAT_DOT(name, type)					\
+    static double							\
+    name (const type *a, const type *b, long n)				\
+    {									\
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;				\
+	long i = 0;							\
+	if (b != 0)							\
+	{								\
+	    for (; i + 4 <= n; i += 4)					\
+	    {								\
+		s0 += (double) a[i] * b[i];				\
+		s1 += (double) a[i+1] * b[i+1];				\
+		s2 += (double) a[i+2] * b[i+2];				\
+		s3 += (double) a[i+3] * b[i+3];				\
+	    }								\
+	    for (; i < n; i++)						\
+		s0 += (double) a[i] * b[i];				\
+	}								\
+	else								\
+	{								\
+	    for (; i + 4 <= n; i += 4)					\
+	    {								\
+		s0 += a[i];						\
+		s1 += a[i+1];						\
+		s2 += a[i+2];						\
+		s3 += a[i+3];						\
+	    }								\
+	    for (; i < n; i++)						\
+		s0 += a[i];						\
+	}								\
+	return (s0 + s1) + (s2 + s3);					\
+    }
+
+NV_FLOAT_DOT (nv_dot_f64, double)
+NV_FLOAT_DOT (nv_dot_f32, float)
+
+#define NV_INT_DOT(name, type)						\
+    static uint64_t							\
+    name (const type *a, const type *b, long n)				\
+    {									\
+	uint64_t s = 0;							\
+	long i;								\
+	if (b != 0)							\
+	{								\
+	    for (i = 0; i < n; i++)					\
+		s += (uint64_t) a[i] * (uint64_t) b[i];			\
+	}								\
+	else								\
+	{								\
+	    for (i = 0; i < n; i++)					\
+		s += (uint64_t) a[i];					\
+	}								\
+	return s;							\
+    }
+
+NV_INT_DOT (nv_dot_s32, int32_t)
+NV_INT_DOT (nv_dot_s64, int64_t)
+NV_INT_DOT (nv_dot_u8, uint8_t)
+
+/* Index of the smallest (or with MAX, largest) element of A; N > 0 */
+#define NV_EXTREMUM(name, type)						\
+    static long								\
+    name (const type *a, long n, rep_bool max)				\
+    {									\
+	long i, best = 0;						\
+	if (max)							\
+	{								\
+	    for (i = 1; i < n; i++)					\
+	    {								\
+		if (a[i] > a[best])					\
+		    best = i;						\
+	    }								\
+	}								\
+	else								\
+	{								\
+	    for (i = 1; i < n; i++)					\
+	    {								\
+		if (a[i] < a[best])					\
+		    best = i;						\
+	    }								\
+	}								\
+	return best;							\
+    }
+
+NV_EXTREMUM (nv_extremum_f64, double)
+NV_EXTREMUM (nv_extremum_f32, float)
+NV_EXTREMUM (nv_extremum_s32, int32_t)
+NV_EXTREMUM (nv_extremum_s64, int64_t)
+NV_EXTREMUM (nv_extremum_u8, uint8_t)
+
+/* Check the optional DEST argument (number ARGNUM) of an element-wise
+   operation on vectors like A, returning the vector to store into:
+   DEST itself, or a new one if it's nil. */
+static repv
+nv_dest (repv dest, repv a, int argnum)
+{
+    if (dest == Qnil)
+	return make_numeric_vector (rep_NV_KIND (a), rep_NV_LEN (a));
+    else if (!rep_NUMERIC_VECTOR_P (dest)
+	     || rep_NV_KIND (dest) != rep_NV_KIND (a)
+	     || rep_NV_LEN (dest) != rep_NV_LEN (a))
+    {
+	return rep_signal_arg_error (dest, argnum);
+    }
+    else
+	return dest;
+}
+
+static repv
+nv_elementwise (repv a, repv b, repv dest, rep_bool mul)
+{
+    rep_DECLARE1 (a, rep_NUMERIC_VECTOR_P);
+    rep_DECLARE (2, b, rep_NUMERIC_VECTOR_P (b)
+		 && rep_NV_KIND (b) == rep_NV_KIND (a)
+		 && rep_NV_LEN (b) == rep_NV_LEN (a));
+    dest = nv_dest (dest, a, 3);
+    if (dest == rep_NULL)
+	return rep_NULL;
+
+    switch (rep_NV_KIND (a))
+    {
+	long n;
+    case rep_NV_F64:
+	n = rep_NV_LEN (a);
+	(mul ? nv_mul_f64 : nv_add_f64) (NV_F64 (dest), NV_F64 (a),
+					 NV_F64 (b), n);
+	break;
+    case rep_NV_F32:
+	n = rep_NV_LEN (a);
+	(mul ? nv_mul_f32 : nv_add_f32) (NV_F32 (dest), NV_F32 (a),
+					 NV_F32 (b), n);
+	break;
+    case rep_NV_S32:
+	n = rep_NV_LEN (a);
+	(mul ? nv_mul_s32 : nv_add_s32) (NV_S32 (dest), NV_S32 (a),
+					 NV_S32 (b), n);
+	break;
+    case rep_NV_S64:
+	n = rep_NV_LEN (a);
+	(mul ? nv_mul_s64 : nv_add_s64) (NV_S64 (dest), NV_S64 (a),
+					 NV_S64 (b), n);
+	break;
+    case rep_NV_U8:
+	n = rep_NV_LEN (a);
+	(mul ? nv_mul_u8 : nv_add_u8) (NV_U8 (dest), NV_U8 (a),
+				       NV_U8 (b), n);
+	break;
+    }
+    return dest;
+}
+
+/* Sum of the elements of A, or of the products of those of A and B */
+static repv
+nv_dot (repv a, repv b)
+{
+    const void *bd = (b != rep_NULL) ? rep_NUMERIC_VECTOR (b)->data : 0;
+    long n = rep_NV_LEN (a);
+
+    switch (rep_NV_KIND (a))
+    {
+    case rep_NV_F64:
+	return rep_make_float (nv_dot_f64 (NV_F64 (a), bd, n), rep_TRUE);
+    case rep_NV_F32:
+	return rep_make_float (nv_dot_f32 (NV_F32 (a), bd, n), rep_TRUE);
+    case rep_NV_S32:
+	return rep_make_longlong_int ((int64_t) nv_dot_s32 (NV_S32 (a), bd, n));
+    case rep_NV_S64:
+	return rep_make_longlong_int ((int64_t) nv_dot_s64 (NV_S64 (a), bd, n));
+    default:
+	return rep_make_longlong_int ((int64_t) nv_dot_u8 (NV_U8 (a), bd, n));
+    }
+}
+
+static repv
+nv_extremum (repv a, rep_bool max)
+{
+    long n, i;
+
+    rep_DECLARE1 (a, rep_NUMERIC_VECTOR_P);
+    n = rep_NV_LEN (a);
+    if (n == 0)
+	return Qnil;
+
+    switch (rep_NV_KIND (a))
+    {
+    case rep_NV_F64:
+	i = nv_extremum_f64 (NV_F64 (a), n, max);
+	break;
+    case rep_NV_F32:
+	i = nv_extremum_f32 (NV_F32 (a), n, max);
+	break;
+    case rep_NV_S32:
+	i = nv_extremum_s32 (NV_S32 (a), n, max);
+	break;
+    case rep_NV_S64:
+	i = nv_extremum_s64 (NV_S64 (a), n, max);
+	break;
+    default:
+	i = nv_extremum_u8 (NV_U8 (a), n, max);
+    }
+    return rep_numeric_vector_ref (a, i);
+}
+
+DEFUN("make-numeric-vector", Fmake_numeric_vector, Smake_numeric_vector,
+      (repv kind, repv len, repv fill), rep_Subr3) /*
+::doc:rep.lang.math#make-numeric-vector::
+make-numeric-vector KIND LENGTH [FILL]
+
+Return a new numeric vector of LENGTH elements, each initialised to the
+number FILL, or to zero. KIND is one of the symbols `f64', `f32' (double
+and single precision floats), `s32', `s64' (signed integers of that
+many bits) or `u8' (bytes); elements are stored as that C type.
+::end:: */
+{
+    repv vec;
+    long i;
+    int k = nv_kind (kind);
+
+    rep_DECLARE (1, kind, k >= 0);
+    rep_DECLARE (2, len, rep_INTP (len) && rep_INT (len) >= 0);
+    rep_DECLARE3_OPT (fill, rep_NUMERICP);
+
+    vec = make_numeric_vector (k, rep_INT (len));
+    if (vec == rep_NULL)
+	return rep_NULL;
+    if (fill == Qnil || fill == rep_MAKE_INT (0))
+	memset (rep_NUMERIC_VECTOR (vec)->data, 0, rep_INT (len) * nv_sizeofs[k]);
+    else if (rep_INT (len) > 0)
+    {
+	rep_numeric_vector_set (vec, 0, fill);
+	for (i = 1; i < rep_INT (len); i++)
+	{
+	    memcpy ((char *) rep_NUMERIC_VECTOR (vec)->data + i * nv_sizeofs[k],
+		    rep_NUMERIC_VECTOR (vec)->data, nv_sizeofs[k]);
+	}
+    }
+    return vec;
+}
+
+DEFUN("sequence->numeric-vector", Fsequence_to_numeric_vector,
+      Ssequence_to_numeric_vector, (repv kind, repv seq), rep_Subr2) /*
+::doc:rep.lang.math#sequence->numeric-vector::
+sequence->numeric-vector KIND SEQUENCE
+
+Return a new numeric vector of kind KIND (see `make-numeric-vector')
+containing the numbers in the list or vector SEQUENCE.
+::end:: */
+{
+    repv vec;
+    long i, n;
+    int k = nv_kind (kind);
+
+    rep_DECLARE (1, kind, k >= 0);
+    if (rep_VECTORP (seq))
+	n = rep_VECT_LEN (seq);
+    else if (rep_LISTP (seq))
+	n = rep_list_length (seq);
+    else
+	return rep_signal_arg_error (seq, 2);
+
+    vec = make_numeric_vector (k, n);
+    if (vec == rep_NULL)
+	return rep_NULL;
+    for (i = 0; i < n; i++)
+    {
+	repv elt;
+	if (rep_VECTORP (seq))
+	    elt = rep_VECTI (seq, i);
+	else
+	{
+	    elt = rep_CAR (seq);
+	    seq = rep_CDR (seq);
+	}
+	if (!rep_numeric_vector_set (vec, i, elt))
+	    return rep_signal_arg_error (elt, 2);
+    }
+    return vec;
+}
+
+DEFUN("numeric-vector->vector", Fnumeric_vector_to_vector,
+      Snumeric_vector_to_vector, (repv vec), rep_Subr1) /*
+::doc:rep.lang.math#numeric-vector->vector::
+numeric-vector->vector NUMERIC-VECTOR
+
+Return a new vector containing the elements of NUMERIC-VECTOR.
+::end:: */
+{
+    repv out;
+    rep_GC_root gc_out;
+    long i;
+
+    rep_DECLARE1 (vec, rep_NUMERIC_VECTOR_P);
+    out = rep_make_vector (rep_NV_LEN (vec));
+    if (out == rep_NULL)
+	return rep_NULL;
+    for (i = 0; i < rep_NV_LEN (vec); i++)
+	rep_VECTI (out, i) = Qnil;
+    rep_PUSHGC (gc_out, out);
+    for (i = 0; i < rep_NV_LEN (vec); i++)
+    {
+	repv elt = rep_numeric_vector_ref (vec, i);
+	if (elt == rep_NULL)
+	{
+	    out = rep_NULL;
+	    break;
+	}
+	rep_VECTI (out, i) = elt;
+    }
+    rep_POPGC;
+    return out;
+}
+
+DEFUN("numeric-vector-p", Fnumeric_vector_p, Snumeric_vector_p,
+      (repv arg), rep_Subr1) /*
+::doc:rep.lang.math#numeric-vector-p::
+numeric-vector-p ARG
+
+Return true if ARG is a numeric vector.
+::end:: */
+{
+    return rep_NUMERIC_VECTOR_P (arg) ? Qt : Qnil;
+}
+
+DEFUN("numeric-vector-kind", Fnumeric_vector_kind, Snumeric_vector_kind,
+      (repv vec), rep_Subr1) /*
+::doc:rep.lang.math#numeric-vector-kind::
+numeric-vector-kind NUMERIC-VECTOR
+
+Return the symbol naming the kind of elements NUMERIC-VECTOR holds.
+::end:: */
+{
+    rep_DECLARE1 (vec, rep_NUMERIC_VECTOR_P);
+    return *nv_kind_syms[rep_NV_KIND (vec)];
+}
+
+DEFUN("numeric-vector-add", Fnumeric_vector_add, Snumeric_vector_add,
+      (repv a, repv b, repv dest), rep_Subr3) /*
+::doc:rep.lang.math#numeric-vector-add::
+numeric-vector-add A B [DEST]
+
+Add each element of numeric vector B to the corresponding element of
+numeric vector A, which must have the same kind and length. The sums
+are stored in DEST, which may be A or B, or else in a new vector;
+that vector is returned.
+::end:: */
+{
+    return nv_elementwise (a, b, dest, rep_FALSE);
+}
+
+DEFUN("numeric-vector-mul", Fnumeric_vector_mul, Snumeric_vector_mul,
+      (repv a, repv b, repv dest), rep_Subr3) /*
+::doc:rep.lang.math#numeric-vector-mul::
+numeric-vector-mul A B [DEST]
+
+As `numeric-vector-add', but multiply the elements of A and B.
+::end:: */
+{
+    return nv_elementwise (a, b, dest, rep_TRUE);
+}
+
+DEFUN("numeric-vector-scale", Fnumeric_vector_scale, Snumeric_vector_scale,
+      (repv a, repv factor, repv dest), rep_Subr3) /*
+::doc:rep.lang.math#numeric-vector-scale::
+numeric-vector-scale A FACTOR [DEST]
+
+Multiply each element of numeric vector A by the number FACTOR (an
+integer, unless A holds floats), storing the products in DEST (which
+may be A) or else in a new vector. Returns that vector.
+::end:: */
+{
+    long n;
+
+    rep_DECLARE1 (a, rep_NUMERIC_VECTOR_P);
+    rep_DECLARE (2, factor, NV_FLOAT_KIND_P (rep_NV_KIND (a))
+		 ? rep_NUMERICP (factor) : rep_INTEGERP (factor));
+    dest = nv_dest (dest, a, 3);
+    if (dest == rep_NULL)
+	return rep_NULL;
+
+    n = rep_NV_LEN (a);
+    switch (rep_NV_KIND (a))
+    {
+    case rep_NV_F64:
+	nv_scale_f64 (NV_F64 (dest), NV_F64 (a), rep_get_float (factor), n);
+	break;
+    case rep_NV_F32:
+	nv_scale_f32 (NV_F32 (dest), NV_F32 (a), rep_get_float (factor), n);
+	break;
+    case rep_NV_S32:
+	nv_scale_s32 (NV_S32 (dest), NV_S32 (a),
+		      rep_get_longlong_int (factor), n);
+	break;
+    case rep_NV_S64:
+	nv_scale_s64 (NV_S64 (dest), NV_S64 (a),
+		      rep_get_longlong_int (factor), n);
+	break;
+    case rep_NV_U8:
+	nv_scale_u8 (NV_U8 (dest), NV_U8 (a),
+		     rep_get_longlong_int (factor), n);
+	break;
+    }
+    return dest;
+}
+
+DEFUN("numeric-vector-dot", Fnumeric_vector_dot, Snumeric_vector_dot,
+      (repv a, repv b), rep_Subr2) /*
+::doc:rep.lang.math#numeric-vector-dot::
+numeric-vector-dot A B
+
+Return the sum of the products of the corresponding elements of the
+numeric vectors A and B, which must have the same kind and length.
+Floats are accumulated in double precision; integer sums wrap around
+at 64 bits.
+::end:: */
+{
+    rep_DECLARE1 (a, rep_NUMERIC_VECTOR_P);
+    rep_DECLARE (2, b, rep_NUMERIC_VECTOR_P (b)
+		 && rep_NV_KIND (b) == rep_NV_KIND (a)
+		 && rep_NV_LEN (b) == rep_NV_LEN (a));
+    return nv_dot (a, b);
+}
+
+DEFUN("numeric-vector-sum", Fnumeric_vector_sum, Snumeric_vector_sum,
+      (repv a), rep_Subr1) /*
+::doc:rep.lang.math#numeric-vector-sum::
+numeric-vector-sum NUMERIC-VECTOR
+
+Return the sum of the elements of NUMERIC-VECTOR, accumulated as by
+`numeric-vector-dot'.
+::end:: */
+{
+    rep_DECLARE1 (a, rep_NUMERIC_VECTOR_P);
+    return nv_dot (a, rep_NULL);
+}
+
+DEFUN("numeric-vector-min", Fnumeric_vector_min, Snumeric_vector_min,
+      (repv a), rep_Subr1) /*
+::doc:rep.lang.math#numeric-vector-min::
+numeric-vector-min NUMERIC-VECTOR
+
+Return the smallest element of NUMERIC-VECTOR, or false if it's empty.
+::end:: */
+{
+    return nv_extremum (a, rep_FALSE);
+}
+
+DEFUN("numeric-vector-max", Fnumeric_vector_max, Snumeric_vector_max,
+      (repv a), rep_Subr1) /*
+::doc:rep.lang.math#numeric-vector-max::
+numeric-vector-max NUMERIC-VECTOR
+
+Return the largest element of NUMERIC-VECTOR, or false if it's empty.
+::end:: */
+{
+    return nv_extremum (a, rep_TRUE);
+}
+
+static int
+numeric_vector_cmp (repv v1, repv v2)
+{
+    if (rep_NUMERIC_VECTOR_P (v1) && rep_NUMERIC_VECTOR_P (v2)
+	&& rep_NV_KIND (v1) == rep_NV_KIND (v2)
+	&& rep_NV_LEN (v1) == rep_NV_LEN (v2)
+	&& memcmp (rep_NUMERIC_VECTOR (v1)->data, rep_NUMERIC_VECTOR (v2)->data,
+		   rep_NV_LEN (v1) * nv_sizeofs[rep_NV_KIND (v1)]) == 0)
+    {
+	return 0;
+    }
+    else
+	return 1;
+}
+
+static void
+numeric_vector_print (repv stream, repv arg)
+{
+    char buf[64];
+    sprintf (buf, "#<numeric-vector %s %ld>",
+	     rep_STR (rep_SYM (*nv_kind_syms[rep_NV_KIND (arg)])->name),
+	     rep_NV_LEN (arg));
+    rep_stream_puts (stream, buf, -1, rep_FALSE);
+}
+
+static void
+numeric_vector_sweep (void)
+{
+    rep_numeric_vector *x = numeric_vectors;
+    numeric_vectors = 0;
+    while (x != 0)
+    {
+	rep_numeric_vector *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (x)))
+	{
+	    rep_free (x->data);
+	    rep_FREE_CELL (x);
+	}
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (x));
+	    x->next = numeric_vectors;
+	    numeric_vectors = x;
+	}
+	x = next;
+    }
+}
+
+
 /* init */
 
 void
@@ -3062,6 +4273,12 @@ rep_numbers_init (void)
     rep_register_type(rep_Number, "number", number_cmp,
 		      number_prin, number_prin,
 		      number_sweep, 0, 0, 0, 0, 0, 0, 0, 0);
+    rep_numeric_vector_type = rep_register_new_type ("numeric-vector",
+						     numeric_vector_cmp,
+						     numeric_vector_print,
+						     numeric_vector_print,
+						     numeric_vector_sweep,
+						     0, 0, 0, 0, 0, 0, 0, 0);
 
     number_sizeofs[0] = sizeof (rep_number_z);
     number_sizeofs[1] = sizeof (rep_number_q);
@@ -3072,6 +4289,12 @@ rep_numbers_init (void)
 				 / number_sizeofs[i]);
     }
 
+    rep_INTERN(f64);
+    rep_INTERN(f32);
+    rep_INTERN(s32);
+    rep_INTERN(s64);
+    rep_INTERN(u8);
+
     tem = rep_push_structure ("rep.lang.math");
     rep_ADD_SUBR(Splus);
     rep_ADD_SUBR(Sminus);
@@ -3115,7 +4338,21 @@ rep_numbers_init (void)
     rep_ADD_SUBR(Smin);
     rep_ADD_SUBR(Sstring_to_number);
     rep_ADD_SUBR(Snumber_to_string);
+    rep_ADD_SUBR(Sstring_to_number_vector);
+    rep_ADD_SUBR(Swrite_numbers);
     rep_ADD_SUBR(Srandom);
+    rep_ADD_SUBR(Smake_numeric_vector);
+    rep_ADD_SUBR(Ssequence_to_numeric_vector);
+    rep_ADD_SUBR(Snumeric_vector_to_vector);
+    rep_ADD_SUBR(Snumeric_vector_p);
+    rep_ADD_SUBR(Snumeric_vector_kind);
+    rep_ADD_SUBR(Snumeric_vector_add);
+    rep_ADD_SUBR(Snumeric_vector_mul);
+    rep_ADD_SUBR(Snumeric_vector_scale);
+    rep_ADD_SUBR(Snumeric_vector_dot);
+    rep_ADD_SUBR(Snumeric_vector_sum);
+    rep_ADD_SUBR(Snumeric_vector_min);
+    rep_ADD_SUBR(Snumeric_vector_max);
     rep_pop_structure (tem);
 
     tem = rep_push_structure ("rep.data");
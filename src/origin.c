@@ -23,56 +23,109 @@
 #define _GNU_SOURCE
 
 #include "repint.h"
-
-typedef struct origin_item origin_item;
-struct origin_item {
-    origin_item *next;
-    repv form;
-    repv file;
-    long line;
+#include <string.h>
+
+/* The origins of forms are kept per cons block: each block that holds
+   a recorded form has a table of (cell, file, line) entries, eight
+   bytes each. Nothing here keeps the forms alive; instead the GC calls
+   rep_sweep_origins once marking is complete, and entries whose cells
+   weren't marked are dropped, so there's no per-form work other than
+   that. File names are shared between entries through the files
+   array, so each table entry only needs its index. */
+
+typedef struct origin_entry origin_entry;
+struct origin_entry {
+    unsigned short cell;		/* index of the cons in its block */
+    unsigned short file;		/* index into files[] */
+    unsigned int line;
 };
 
-#define BLOCK_SIZE (4084 / sizeof (struct origin_item))
-
-typedef struct origin_block origin_block;
-struct origin_block {
-    origin_block *next;
-    struct origin_item items[BLOCK_SIZE];
+typedef struct origin_table origin_table;
+struct origin_table {
+    origin_table *next;
+    rep_cell_block_header *block;
+    int used, size;
+    origin_entry *entries;
 };
 
-static origin_item *free_list;
-static origin_block *block_list;
-static repv guardian;
+typedef struct origin_file origin_file;
+struct origin_file {
+    repv name;
+    unsigned long refs;			/* zero if the slot is free */
+};
 
 rep_bool rep_record_origins;
 
-#define HASH_SIZE 1024
-#define HASH(x) (((x) >> 3) % HASH_SIZE)
+#define HASH_SIZE 256
+#define HASH(b) ((((repv) (b)) / rep_CELLBLK_BYTES) % HASH_SIZE)
+
+#define INITIAL_ENTRIES 32
+#define MAX_FILES 65536
+
+static origin_table *buckets[HASH_SIZE];
+
+/* the table most recently added to, forms are read in runs */
+static origin_table *last_table;
 
-static origin_item *buckets[HASH_SIZE];
+static origin_file *files;
+static int files_used, files_size;
 
-static void
-new_item_block (void)
+static int
+file_index (repv name)
 {
-    origin_block *b;
-    int i;
-    b = rep_alloc (sizeof (origin_block));
-    for (i = 0; i < (BLOCK_SIZE - 1); i++)
-	b->items[i].next = &(b->items[i+1]);
-    b->items[i].next = free_list;
-    free_list = &(b->items[0]);
-
-    b->next = block_list;
-    block_list = b;
+    int i, free_slot = -1;
+    for (i = files_used - 1; i >= 0; i--)
+    {
+	if (files[i].refs == 0)
+	    free_slot = i;
+	else if (files[i].name == name)
+	    return i;
+    }
+    if (free_slot >= 0)
+	i = free_slot;
+    else
+    {
+	if (files_used == files_size)
+	{
+	    int new_size = files_size == 0 ? 16 : files_size * 2;
+	    if (new_size > MAX_FILES)
+		return -1;
+	    if (files == 0)
+		files = rep_alloc (new_size * sizeof (origin_file));
+	    else
+		files = rep_realloc (files, new_size * sizeof (origin_file));
+	    files_size = new_size;
+	}
+	i = files_used++;
+    }
+    files[i].name = name;
+    files[i].refs = 0;
+    return i;
+}
+
+static origin_table *
+find_table (rep_cell_block_header *block)
+{
+    origin_table *t;
+    for (t = buckets[HASH (block)]; t != 0; t = t->next)
+    {
+	if (t->block == block)
+	    return t;
+    }
+    return 0;
 }
 
 void
 rep_record_origin (repv form, repv stream, long start_line)
 {
-    origin_item *item;
+    rep_cell_block_header *block;
+    origin_table *t;
+    origin_entry *e;
+    int file;
 
     if (!rep_record_origins
 	|| !rep_CONSP (form)
+	|| !rep_CONS_WRITABLE_P (form)
 	|| !rep_FILEP (stream)
 	|| (rep_FILE (stream)->car & rep_LFF_BOGUS_LINE_NUMBER) != 0)
     {
@@ -80,21 +133,39 @@ rep_record_origin (repv form, repv stream, long start_line)
 	return;
     }
 
-    if (free_list == 0)
-	new_item_block ();
-
-    item = free_list;
-    free_list = item->next;
-
-    item->form = form;
-    item->file = rep_FILE (stream)->name;
-    item->line = (start_line > 0
-		  ? start_line : rep_FILE (stream)->line_number);
+    file = file_index (rep_FILE (stream)->name);
+    if (file < 0)
+	return;
 
-    item->next = buckets[HASH (form)];
-    buckets[HASH (form)] = item;
+    block = rep_CELLBLK_HEADER (form);
+    t = last_table;
+    if (t == 0 || t->block != block)
+    {
+	t = find_table (block);
+	if (t == 0)
+	{
+	    t = rep_alloc (sizeof (origin_table));
+	    t->block = block;
+	    t->used = 0;
+	    t->size = INITIAL_ENTRIES;
+	    t->entries = rep_alloc (t->size * sizeof (origin_entry));
+	    t->next = buckets[HASH (block)];
+	    buckets[HASH (block)] = t;
+	}
+	last_table = t;
+    }
+    if (t->used == t->size)
+    {
+	t->size *= 2;
+	t->entries = rep_realloc (t->entries,
+				  t->size * sizeof (origin_entry));
+    }
 
-    Fprimitive_guardian_push (guardian, form);
+    e = t->entries + t->used++;
+    e->cell = rep_CELLBLK_INDEX (form);
+    e->file = file;
+    e->line = (start_line > 0 ? start_line : rep_FILE (stream)->line_number);
+    files[file].refs++;
 }
 
 DEFUN ("call-with-lexical-origins", Fcall_with_lexical_origins,
@@ -113,7 +184,8 @@ DEFUN ("call-with-lexical-origins", Fcall_with_lexical_origins,
 DEFUN ("lexical-origin", Flexical_origin,
        Slexical_origin, (repv form), rep_Subr1)
 {
-    origin_item *item;
+    rep_cell_block_header *block;
+    origin_table *t;
 
     if (rep_FUNARGP (form))
 	form = rep_FUNARG (form)->fun;
@@ -121,10 +193,20 @@ DEFUN ("lexical-origin", Flexical_origin,
     if (!rep_CONSP (form))
 	return Qnil;
 
-    for (item = buckets[HASH (form)]; item != 0; item = item->next)
+    block = rep_CELLBLK_HEADER (form);
+    t = find_table (block);
+    if (t != 0)
     {
-	if (item->form == form)
-	    return Fcons (item->file, rep_make_long_int (item->line));
+	unsigned short cell = rep_CELLBLK_INDEX (form);
+	int i;
+	for (i = t->used - 1; i >= 0; i--)
+	{
+	    if (t->entries[i].cell == cell)
+	    {
+		origin_entry *e = t->entries + i;
+		return Fcons (files[e->file].name, rep_make_long_int (e->line));
+	    }
+	}
     }
 
     /* no direct hit, scan into the list */
@@ -143,35 +225,57 @@ void
 rep_mark_origins (void)
 {
     int i;
-    rep_MARKVAL (guardian);
-    for (i = 0; i < HASH_SIZE; i++)
+    for (i = 0; i < files_used; i++)
     {
-	origin_item *item;
-	for (item = buckets[i]; item != 0; item = item->next)
-	    rep_MARKVAL (item->file);
+	if (files[i].refs != 0)
+	    rep_MARKVAL (files[i].name);
     }
 }
 
-DEFUN ("origin-after-gc", Forigin_after_gc, Sorigin_after_gc, (void), rep_Subr0)
+/* Called by the GC after marking, before the cons blocks are swept:
+   forget the origins of forms that weren't marked. */
+void
+rep_sweep_origins (void)
 {
-    repv form;
-    while ((form = Fprimitive_guardian_pop (guardian)) != Qnil)
+    int i;
+    for (i = 0; i < HASH_SIZE; i++)
     {
-	origin_item **ptr = buckets + HASH (form);
+	origin_table **ptr = buckets + i;
 	while (*ptr != 0)
 	{
-	    if ((*ptr)->form == form)
+	    origin_table *t = *ptr;
+	    repv base = rep_VAL (t->block);
+	    int j, used = 0;
+	    for (j = 0; j < t->used; j++)
 	    {
-		origin_item *item = *ptr;
-		*ptr = item->next;
-		item->next = free_list;
-		free_list = item;
+		origin_entry *e = t->entries + j;
+		repv form = base + e->cell * sizeof (rep_cons);
+		if (rep_GC_CONS_MARKEDP (form))
+		    t->entries[used++] = *e;
+		else
+		    files[e->file].refs--;
 	    }
-	    else
-		ptr = &(*ptr)->next;
+	    t->used = used;
+	    if (used == 0)
+	    {
+		*ptr = t->next;
+		rep_free (t->entries);
+		rep_free (t);
+		continue;
+	    }
+	    if (used * 4 < t->size && t->size > INITIAL_ENTRIES)
+	    {
+		t->size /= 2;
+		t->entries = rep_realloc (t->entries,
+					  t->size * sizeof (origin_entry));
+	    }
+	    ptr = &t->next;
 	}
     }
-    return Qnil;
+    last_table = 0;
+
+    while (files_used > 0 && files[files_used - 1].refs == 0)
+	files_used--;
 }
 
 void
@@ -179,13 +283,6 @@ rep_origin_init (void)
 {
     repv tem;
 
-    guardian = Fmake_primitive_guardian ();
-
-    tem = Fsymbol_value (Qafter_gc_hook, Qt);
-    if (rep_VOIDP (tem))
-	tem = Qnil;
-    Fset (Qafter_gc_hook, Fcons (rep_VAL(&Sorigin_after_gc), tem));
-
     tem = rep_push_structure ("rep.lang.debug");
     rep_ADD_SUBR(Scall_with_lexical_origins);
     rep_ADD_SUBR(Slexical_origin);
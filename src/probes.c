@@ -0,0 +1,74 @@
+/* probes.c -- semaphores of the static tracepoints
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.	If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* See probes.h. The tools find each semaphore through the note that
+   <sys/sdt.h> emits for the probe, and expect it in the .probes
+   section. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+#include "probes.h"
+
+#ifdef WITH_PROBES
+
+#define SEMAPHORE(name) \
+    volatile unsigned short librep_##name##_semaphore \
+	__attribute__ ((section (".probes")))
+
+SEMAPHORE (gc__start);
+SEMAPHORE (gc__done);
+SEMAPHORE (function__entry);
+SEMAPHORE (function__return);
+SEMAPHORE (signal);
+SEMAPHORE (load__start);
+SEMAPHORE (load__done);
+SEMAPHORE (thread__switch);
+SEMAPHORE (regexp__compile);
+
+/* A name for OBJ to pass as a probe's string argument: the name of a
+   symbol, named closure or subr, the contents of a string, or an empty
+   string for anything else. */
+const char *
+rep_probe_name (repv obj)
+{
+    switch (rep_TYPE (obj))
+    {
+    case rep_Symbol:
+	return rep_STR (rep_SYM (obj)->name);
+
+    case rep_String:
+	return rep_STR (obj);
+
+    case rep_Funarg:
+	return (rep_STRINGP (rep_FUNARG (obj)->name)
+		? rep_STR (rep_FUNARG (obj)->name) : "");
+
+    case rep_Subr0: case rep_Subr1: case rep_Subr2: case rep_Subr3:
+    case rep_Subr4: case rep_Subr5: case rep_SubrN: case rep_SF:
+	return rep_STR (rep_XSUBR (obj)->name);
+
+    case rep_Cons:
+	return rep_CAR (obj) == Qlambda ? "lambda" : "";
+
+    default:
+	return "";
+    }
+}
+
+#endif /* WITH_PROBES */
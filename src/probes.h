@@ -0,0 +1,102 @@
+/* probes.h -- static tracepoints for tracing the interpreter
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.	If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* When configured with --enable-probes, the librep provider's probes
+   are placed using <sys/sdt.h>, the systemtap/DTrace USDT interface,
+   so that tools like bpftrace, perf and stap can attach to a running
+   process. Each probe has a semaphore, which the tools increment while
+   attached; the probe's arguments are only evaluated when it's
+   non-zero, so a probe nothing is attached to costs a load and a
+   branch. Without --enable-probes the macros expand to nothing.
+
+   A probe named foo__bar here is librep:foo-bar to the tools. To add
+   one, declare and define its semaphore in this file and probes.c, and
+   document it under Debugging in man/lang.texi. */
+
+#ifndef REP_PROBES_H
+#define REP_PROBES_H
+
+#ifdef WITH_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+extern volatile unsigned short librep_gc__start_semaphore;
+extern volatile unsigned short librep_gc__done_semaphore;
+extern volatile unsigned short librep_function__entry_semaphore;
+extern volatile unsigned short librep_function__return_semaphore;
+extern volatile unsigned short librep_signal_semaphore;
+extern volatile unsigned short librep_load__start_semaphore;
+extern volatile unsigned short librep_load__done_semaphore;
+extern volatile unsigned short librep_thread__switch_semaphore;
+extern volatile unsigned short librep_regexp__compile_semaphore;
+
+extern const char *rep_probe_name (repv obj);
+
+#define REP_PROBE_ENABLED(name) \
+    __builtin_expect (librep_##name##_semaphore != 0, 0)
+
+#define REP_PROBE0(name)						\
+    do {								\
+	if (REP_PROBE_ENABLED (name))					\
+	    STAP_PROBE (librep, name);					\
+    } while (0)
+
+#define REP_PROBE1(name, a)						\
+    do {								\
+	if (REP_PROBE_ENABLED (name))					\
+	    STAP_PROBE1 (librep, name, a);				\
+    } while (0)
+
+#define REP_PROBE2(name, a, b)						\
+    do {								\
+	if (REP_PROBE_ENABLED (name))					\
+	    STAP_PROBE2 (librep, name, a, b);				\
+    } while (0)
+
+#define REP_PROBE3(name, a, b, c)					\
+    do {								\
+	if (REP_PROBE_ENABLED (name))					\
+	    STAP_PROBE3 (librep, name, a, b, c);			\
+    } while (0)
+
+#define REP_PROBE4(name, a, b, c, d)					\
+    do {								\
+	if (REP_PROBE_ENABLED (name))					\
+	    STAP_PROBE4 (librep, name, a, b, c, d);			\
+    } while (0)
+
+#define REP_PROBE6(name, a, b, c, d, e, f)				\
+    do {								\
+	if (REP_PROBE_ENABLED (name))					\
+	    STAP_PROBE6 (librep, name, a, b, c, d, e, f);		\
+    } while (0)
+
+#else /* WITH_PROBES */
+
+#define REP_PROBE_ENABLED(name) 0
+#define REP_PROBE0(name) do { } while (0)
+#define REP_PROBE1(name, a) do { } while (0)
+#define REP_PROBE2(name, a, b) do { } while (0)
+#define REP_PROBE3(name, a, b, c) do { } while (0)
+#define REP_PROBE4(name, a, b, c, d) do { } while (0)
+#define REP_PROBE6(name, a, b, c, d, e, f) do { } while (0)
+
+#endif /* !WITH_PROBES */
+
+#endif /* REP_PROBES_H */
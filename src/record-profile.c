@@ -23,9 +23,20 @@
 /* Commentary:
 
    Hook into the interrupt-checking code to record the current
-   backtrace statistics. Uses SIGPROF to tell the lisp system when it
-   should interrupt (can't run the profiler off the signal itself,
-   since data would need to be allocated from the signal handler) */
+   backtrace. Uses SIGPROF to tell the lisp system when it should
+   interrupt (can't run the profiler off the signal itself, since data
+   would need to be allocated from the signal handler)
+
+   Each backtrace is added to a trie of call stacks, see below. When
+   measuring wall-clock time rather than CPU time, each sample is
+   weighted by the real time since the previous one, and samples are
+   also taken either side of waiting for input (see
+   rep_wait_sample_fun), so time spent blocked is attributed to the
+   functions that were waiting
+
+   The allocation profiler works the same way, except that the
+   interrupt is requested every N bytes allocated, from the hook the
+   allocators call (see rep_ALLOC_SAMPLE) */
 
 #define _GNU_SOURCE
 
@@ -50,6 +61,8 @@ char *alloca ();
 #include "repint.h"
 #include <signal.h>
 #include <time.h>
+#include <limits.h>
+#include <string.h>
 
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
@@ -59,13 +72,21 @@ char *alloca ();
 # include <sys/time.h>
 #endif
 
-static repv profile_table;
-static rep_bool profiling;
+static rep_bool profiling, wall_clock;
+static rep_long_long last_sample;	/* microseconds, when wall_clock */
+static void (*saved_wait_sample_fun)(void);
 
 static void (*chained_test_interrupt)(void);
 
 static int profile_interval = 10;		/* microseconds */
 
+static repv alloc_profile_table, alloc_stack;
+static rep_bool alloc_profiling;
+static int alloc_frames, alloc_pending;
+static void (*saved_alloc_sample_fun)(void);
+
+static int alloc_profile_interval = 65536;	/* bytes */
+
 
 /* SIGPROF handling */
 
@@ -103,81 +124,518 @@ clear_timer (void)
 
 /* profile recording */
 
+/* Add one sample of WEIGHT for function FUN to TABLE, unless it has
+   already been seen in this backtrace. LOCAL is true when FUN is the
+   innermost frame. */
 static void
-test_interrupt (void)
+record_function (repv table, repv fun, rep_bool local, int weight,
+		 repv *seen, int *seen_i)
 {
-    if (profiling)
+    repv name, tem;
+    int j;
+
+    switch (rep_TYPE (fun))
     {
-	repv *seen = alloca (rep_max_lisp_depth * sizeof (repv));
-	struct rep_Call *c;
-	int seen_i = 0;
-	for (c = rep_call_stack; c != 0 && c->fun != Qnil; c = c->next)
+    case rep_Subr0: case rep_Subr1: case rep_Subr2: case rep_Subr3:
+    case rep_Subr4: case rep_Subr5: case rep_SubrN:
+	name = rep_XSUBR (fun)->name;
+	break;
+
+    case rep_Funarg:
+	name = rep_FUNARG (fun)->name;
+	break;
+
+    default:
+	return;
+    }
+    if (!rep_STRINGP (name))
+	return;
+
+    name = Fintern (name, Qnil);
+    for (j = 0; j < *seen_i; j++)
+    {
+	if (seen[j] == name)
+	    return;
+    }
+
+    tem = F_structure_ref (table, name);
+    if (rep_VOIDP (tem))
+	tem = Fcons (rep_MAKE_INT (0), rep_MAKE_INT (0));
+    if (local)
+	rep_CAR (tem) = rep_MAKE_INT (rep_INT (rep_CAR (tem)) + weight);
+    rep_CDR (tem) = rep_MAKE_INT (rep_INT (rep_CDR (tem)) + weight);
+    Fstructure_define (table, name, tem);
+
+    seen[(*seen_i)++] = name;
+}
+
+
+/* call-stack recording
+
+   The profile is a trie of the call stacks seen: the root has a child
+   for each thread sampled (nil for the main thread before any others
+   exist), each of those a child for each outermost function called in
+   that thread, and so on. Each node counts the samples whose
+   innermost function it is.
+
+   The nodes live in a C array and refer to their functions (and
+   threads) by indices into the vector profile_objects, which keeps
+   them alive; a hash table maps each object to its index. So taking
+   a sample walks rep_call_stack and the trie, but neither interns
+   names nor looks anything up in structures. Children are linked in
+   a list, moving each found to the front, since most calls from a
+   node are made to the same few functions. */
+
+struct stack_node {
+    int object;			/* index in profile_objects */
+    int parent, child, sibling;	/* -1 terminated */
+    unsigned long self;
+};
+
+static struct stack_node *nodes;
+static int nodes_used, nodes_size;
+
+static repv profile_objects;
+static int objects_used;
+
+static int *object_hash;	/* indices, or -1 */
+static int object_hash_size;
+
+/* indices of the frames of the sample being taken */
+static int *frames;
+static int frames_size;
+
+static void
+free_profile (void)
+{
+    rep_free (nodes);
+    rep_free (object_hash);
+    rep_free (frames);
+    nodes = 0;
+    object_hash = frames = 0;
+    nodes_used = nodes_size = objects_used = 0;
+    object_hash_size = frames_size = 0;
+    profile_objects = rep_NULL;
+}
+
+static rep_bool
+init_profile (void)
+{
+    free_profile ();
+    nodes_size = 1024;
+    object_hash_size = 256;
+    frames_size = 128;
+    nodes = rep_alloc (nodes_size * sizeof (struct stack_node));
+    object_hash = rep_alloc (object_hash_size * sizeof (int));
+    frames = rep_alloc (frames_size * sizeof (int));
+    profile_objects = Fmake_vector (rep_MAKE_INT (128), Qnil);
+    if (nodes == 0 || object_hash == 0 || frames == 0
+	|| profile_objects == rep_NULL)
+    {
+	free_profile ();
+	return rep_FALSE;
+    }
+    memset (object_hash, -1, object_hash_size * sizeof (int));
+    nodes[0].object = -1;
+    nodes[0].parent = nodes[0].child = nodes[0].sibling = -1;
+    nodes[0].self = 0;
+    nodes_used = 1;
+    return rep_TRUE;
+}
+
+static inline unsigned int
+object_slot (repv obj, int size)
+{
+    return (((unsigned long) obj >> 3) * 2654435761U) & (size - 1);
+}
+
+/* Return the index of OBJ in profile_objects, adding it if necessary,
+   or -1 if there's no memory */
+static int
+object_index (repv obj)
+{
+    unsigned int i = object_slot (obj, object_hash_size);
+    int idx;
+
+    while ((idx = object_hash[i]) >= 0)
+    {
+	if (rep_VECTI (profile_objects, idx) == obj)
+	    return idx;
+	i = (i + 1) & (object_hash_size - 1);
+    }
+
+    if (objects_used == rep_VECT_LEN (profile_objects))
+    {
+	repv new = Fmake_vector (rep_MAKE_INT (objects_used * 2), Qnil);
+	if (new == rep_NULL)
+	    return -1;
+	memcpy (rep_VECT (new)->array, rep_VECT (profile_objects)->array,
+		objects_used * sizeof (repv));
+	profile_objects = new;
+    }
+    if ((objects_used + 1) * 2 > object_hash_size)
+    {
+	int size = object_hash_size * 2, j;
+	int *hash = rep_alloc (size * sizeof (int));
+	if (hash == 0)
+	    return -1;
+	memset (hash, -1, size * sizeof (int));
+	for (j = 0; j < objects_used; j++)
 	{
-	    repv name;
-	    switch (rep_TYPE (c->fun))
-	    {
-	    case rep_Subr0: case rep_Subr1: case rep_Subr2: case rep_Subr3:
-	    case rep_Subr4: case rep_Subr5: case rep_SubrN:
-		name = rep_XSUBR (c->fun)->name;
-		break;
+	    unsigned int k = object_slot (rep_VECTI (profile_objects, j), size);
+	    while (hash[k] >= 0)
+		k = (k + 1) & (size - 1);
+	    hash[k] = j;
+	}
+	rep_free (object_hash);
+	object_hash = hash;
+	object_hash_size = size;
+	i = object_slot (obj, size);
+	while (object_hash[i] >= 0)
+	    i = (i + 1) & (size - 1);
+    }
 
-	    case rep_Funarg:
-		name = rep_FUNARG (c->fun)->name;
-		break;
+    idx = objects_used++;
+    rep_VECTI (profile_objects, idx) = obj;
+    object_hash[i] = idx;
+    return idx;
+}
 
-	    default:
-		continue;
-	    }
-	    if (rep_STRINGP (name))
+/* Return the child of node PARENT for object index OBJECT, adding it
+   if necessary, or -1 if there's no memory */
+static int
+child_node (int parent, int object)
+{
+    int prev = -1, n;
+
+    for (n = nodes[parent].child; n >= 0; prev = n, n = nodes[n].sibling)
+    {
+	if (nodes[n].object == object)
+	{
+	    if (prev >= 0)
 	    {
-		repv tem;
-		int j;
-
-		name = Fintern (name, Qnil);
-		for (j = 0; j < seen_i; j++)
-		{
-		    if (seen[j] == name)
-			goto skip;
-		}
-
-		tem = F_structure_ref (profile_table, name);
-		if (rep_VOIDP (tem))
-		    tem = Fcons (rep_MAKE_INT (0), rep_MAKE_INT (0));
-		if (c == rep_call_stack)
-		    rep_CAR (tem) = rep_MAKE_INT (rep_INT (rep_CAR (tem)) + 1);
-		rep_CDR (tem) = rep_MAKE_INT (rep_INT (rep_CDR (tem)) + 1);
-		Fstructure_define (profile_table, name, tem);
-
-		seen[seen_i++] = name;
+		nodes[prev].sibling = nodes[n].sibling;
+		nodes[n].sibling = nodes[parent].child;
+		nodes[parent].child = n;
 	    }
-	skip: {}
+	    return n;
+	}
+    }
+
+    if (nodes_used == nodes_size)
+    {
+	struct stack_node *new = rep_realloc (nodes, nodes_size * 2
+					      * sizeof (struct stack_node));
+	if (new == 0)
+	    return -1;
+	nodes = new;
+	nodes_size *= 2;
+    }
+    n = nodes_used++;
+    nodes[n].object = object;
+    nodes[n].parent = parent;
+    nodes[n].child = -1;
+    nodes[n].self = 0;
+    nodes[n].sibling = nodes[parent].child;
+    nodes[parent].child = n;
+    return n;
+}
+
+static inline rep_bool
+sampled_function_p (repv fun)
+{
+    switch (rep_TYPE (fun))
+    {
+    case rep_Subr0: case rep_Subr1: case rep_Subr2: case rep_Subr3:
+    case rep_Subr4: case rep_Subr5: case rep_SubrN: case rep_Funarg:
+	return rep_TRUE;
+
+    default:
+	return rep_FALSE;
+    }
+}
+
+/* Add the current call stack to the trie, with WEIGHT samples */
+static void
+record_sample (unsigned long weight)
+{
+    struct rep_Call *c;
+    int n = 0, node;
+
+    for (c = rep_call_stack; c != 0 && c->fun != Qnil; c = c->next)
+    {
+	if (!sampled_function_p (c->fun))
+	    continue;
+	if (n == frames_size)
+	{
+	    int *new = rep_realloc (frames, frames_size * 2 * sizeof (int));
+	    if (new == 0)
+		return;
+	    frames = new;
+	    frames_size *= 2;
 	}
+	frames[n] = object_index (c->fun);
+	if (frames[n] < 0)
+	    return;
+	n++;
+    }
+
+    node = object_index (rep_running_thread ());
+    node = node >= 0 ? child_node (0, node) : -1;
+    while (node >= 0 && n > 0)
+	node = child_node (node, frames[--n]);
+    if (node >= 0)
+	nodes[node].self += weight;
+}
+
+/* The number of samples the next one should count as */
+static unsigned long
+sample_weight (void)
+{
+    rep_long_long now, elapsed;
+    if (!wall_clock)
+	return 1;
+    now = rep_utime ();
+    elapsed = now - last_sample;
+    last_sample = now;
+    return elapsed > profile_interval ? elapsed / profile_interval : 1;
+}
+
+static void
+wait_sample (void)
+{
+    if (profiling && wall_clock)
+	record_sample (sample_weight ());
+    if (saved_wait_sample_fun != 0)
+	(*saved_wait_sample_fun) ();
+}
+
+/* Fill in TOTALS, the weight of the samples in each node's subtree.
+   Nodes are always made after their parents */
+static void
+subtree_totals (unsigned long *totals)
+{
+    int i;
+    for (i = 0; i < nodes_used; i++)
+	totals[i] = nodes[i].self;
+    for (i = nodes_used - 1; i > 0; i--)
+	totals[nodes[i].parent] += totals[i];
+}
+
+/* The name of FUN as a symbol, or nil */
+static repv
+function_name (repv fun)
+{
+    repv name = (rep_FUNARGP (fun) ? rep_FUNARG (fun)->name
+		 : rep_XSUBR (fun)->name);
+    return rep_STRINGP (name) ? Fintern (name, Qnil) : Qnil;
+}
+
+static void record_allocations (void);
+
+static void
+test_interrupt (void)
+{
+    if (profiling)
+    {
+	record_sample (sample_weight ());
 	set_timer ();
     }
+    if (alloc_frames > 0)
+	record_allocations ();
     (*chained_test_interrupt) ();
 }
 
 
+/* allocation profiling
+
+   The allocators count down alloc_profile_interval bytes then call
+   alloc_sample. That can't touch the heap (we're inside the allocator),
+   so it copies the functions on the call stack into alloc_stack, a
+   preallocated vector, and forces an interrupt. The backtrace is then
+   added to alloc_profile_table by test_interrupt. */
+
+static void
+alloc_sample (void)
+{
+    int bytes = alloc_profile_interval - rep_alloc_sample_countdown;
+    rep_alloc_sample_countdown = alloc_profile_interval;
+
+    if (!alloc_profiling || alloc_stack == rep_NULL)
+	return;
+
+    alloc_pending += bytes / alloc_profile_interval;
+    if (alloc_frames == 0)
+    {
+	struct rep_Call *c;
+	int n = 0, max = rep_VECT_LEN (alloc_stack);
+	for (c = rep_call_stack; c != 0 && c->fun != Qnil && n < max;
+	     c = c->next)
+	{
+	    rep_VECTI (alloc_stack, n++) = c->fun;
+	}
+	alloc_frames = n;
+	if (n == 0)
+	    alloc_pending = 0;
+	else
+	    rep_test_int_counter = rep_test_int_period;
+    }
+}
+
+static void
+record_allocations (void)
+{
+    int n = alloc_frames, weight = alloc_pending, seen_i = 0, i;
+    repv *seen = alloca (n * sizeof (repv));
+
+    /* frames stay captured while recording, so that allocations made
+       here don't overwrite them; they are dropped afterwards */
+    for (i = 0; i < n; i++)
+    {
+	record_function (alloc_profile_table, rep_VECTI (alloc_stack, i),
+			 i == 0, weight, seen, &seen_i);
+    }
+    for (i = 0; i < n; i++)
+	rep_VECTI (alloc_stack, i) = Qnil;
+    alloc_frames = 0;
+    alloc_pending = 0;
+}
+
+
 /* interface */
 
-DEFUN ("start-profiler", Fstart_profiler, Sstart_profiler, (void), rep_Subr0)
+DEFUN ("start-profiler", Fstart_profiler, Sstart_profiler,
+       (repv wall), rep_Subr1)
 {
-    profile_table = Fmake_structure (Qnil, Qnil, Qnil, Qnil);
-    profiling = rep_TRUE;
+    if (!init_profile ())
+	return rep_mem_error ();
+    wall_clock = (wall != Qnil);
+    last_sample = rep_utime ();
+    if (!profiling)
+    {
+	saved_wait_sample_fun = rep_wait_sample_fun;
+	rep_wait_sample_fun = wait_sample;
+	profiling = rep_TRUE;
+    }
     set_timer ();
     return Qt;
 }
 
 DEFUN ("stop-profiler", Fstop_profiler, Sstop_profiler, (void), rep_Subr0)
 {
-    profiling = rep_FALSE;
-    clear_timer ();
+    if (profiling)
+    {
+	profiling = rep_FALSE;
+	rep_wait_sample_fun = saved_wait_sample_fun;
+	clear_timer ();
+    }
     return Qt;
 }
 
+/* A structure mapping the name of each function sampled to the number
+   of samples that were in it (SELF) and that were in it or its
+   callees (TOTAL), as (SELF . TOTAL) */
 DEFUN ("fetch-profile", Ffetch_profile, Sfetch_profile, (void), rep_Subr0)
 {
-    return profile_table ? profile_table : Qnil;
+    repv table, *names;
+    unsigned long *totals;
+    rep_GC_root gc_table;
+    int i;
+
+    if (nodes == 0)
+	return Qnil;
+
+    totals = rep_alloc (nodes_used * sizeof (unsigned long));
+    names = rep_alloc (objects_used * sizeof (repv));
+    if (totals == 0 || names == 0)
+    {
+	rep_free (totals);
+	rep_free (names);
+	return rep_mem_error ();
+    }
+    subtree_totals (totals);
+    for (i = 0; i < objects_used; i++)
+    {
+	repv obj = rep_VECTI (profile_objects, i);
+	names[i] = sampled_function_p (obj) ? function_name (obj) : Qnil;
+    }
+
+    table = Fmake_structure (Qnil, Qnil, Qnil, Qnil);
+    rep_PUSHGC (gc_table, table);
+    for (i = 1; i < nodes_used; i++)
+    {
+	repv name = names[nodes[i].object], tem;
+	int p;
+	if (name == Qnil || nodes[i].parent == 0)
+	    continue;
+	tem = F_structure_ref (table, name);
+	if (rep_VOIDP (tem))
+	{
+	    tem = Fcons (rep_MAKE_INT (0), rep_MAKE_INT (0));
+	    Fstructure_define (table, name, tem);
+	}
+	rep_CAR (tem) = rep_MAKE_INT (rep_INT (rep_CAR (tem)) + nodes[i].self);
+	/* recursive calls are only counted once */
+	for (p = nodes[i].parent; nodes[p].parent > 0; p = nodes[p].parent)
+	{
+	    if (names[nodes[p].object] == name)
+		break;
+	}
+	if (nodes[p].parent <= 0)
+	    rep_CDR (tem) = rep_MAKE_INT (rep_INT (rep_CDR (tem)) + totals[i]);
+    }
+    rep_POPGC;
+
+    rep_free (totals);
+    rep_free (names);
+    return table;
+}
+
+static repv
+call_tree (int node, unsigned long *totals)
+{
+    repv children = Qnil, out;
+    rep_GC_root gc_children;
+    int n;
+
+    rep_PUSHGC (gc_children, children);
+    for (n = nodes[node].child; n >= 0; n = nodes[n].sibling)
+	children = Fcons (call_tree (n, totals), children);
+    rep_POPGC;
+
+    out = Fcons (rep_VECTI (profile_objects, nodes[node].object),
+		 Fcons (rep_make_long_uint (nodes[node].self),
+			Fcons (rep_make_long_uint (totals[node]), children)));
+    return out;
+}
+
+/* A list with an element (THREAD SELF TOTAL CALLS...) for each thread
+   sampled, where THREAD is nil for the main thread before any others
+   were made. Each of CALLS is (FUNCTION SELF TOTAL CALLS...) for a
+   function called from its parent. SELF is the number of samples taken
+   in a function when it was called from its parent, TOTAL that
+   including its callees. */
+DEFUN ("fetch-call-tree", Ffetch_call_tree, Sfetch_call_tree,
+       (void), rep_Subr0)
+{
+    repv out = Qnil;
+    unsigned long *totals;
+    rep_GC_root gc_out;
+    int n;
+
+    if (nodes == 0)
+	return Qnil;
+
+    totals = rep_alloc (nodes_used * sizeof (unsigned long));
+    if (totals == 0)
+	return rep_mem_error ();
+    subtree_totals (totals);
+    rep_PUSHGC (gc_out, out);
+    for (n = nodes[0].child; n >= 0; n = nodes[n].sibling)
+	out = Fcons (call_tree (n, totals), out);
+    rep_POPGC;
+    rep_free (totals);
+    return out;
 }
 
 DEFUN ("profile-interval", Fprofile_interval,
@@ -189,6 +647,55 @@ DEFUN ("profile-interval", Fprofile_interval,
     return ret;
 }
 
+DEFUN ("start-allocation-profiler", Fstart_allocation_profiler,
+       Sstart_allocation_profiler, (void), rep_Subr0)
+{
+    alloc_profile_table = Fmake_structure (Qnil, Qnil, Qnil, Qnil);
+    alloc_stack = Fmake_vector (rep_MAKE_INT (rep_max_lisp_depth), Qnil);
+    alloc_frames = alloc_pending = 0;
+    if (!alloc_profiling)
+    {
+	saved_alloc_sample_fun = rep_alloc_sample_fun;
+	rep_alloc_sample_fun = alloc_sample;
+	alloc_profiling = rep_TRUE;
+    }
+    rep_alloc_sample_countdown = alloc_profile_interval;
+    return Qt;
+}
+
+DEFUN ("stop-allocation-profiler", Fstop_allocation_profiler,
+       Sstop_allocation_profiler, (void), rep_Subr0)
+{
+    if (alloc_profiling)
+    {
+	alloc_profiling = rep_FALSE;
+	rep_alloc_sample_fun = saved_alloc_sample_fun;
+	rep_alloc_sample_countdown = INT_MAX;
+	alloc_frames = alloc_pending = 0;
+	alloc_stack = rep_NULL;
+    }
+    return Qt;
+}
+
+DEFUN ("fetch-allocation-profile", Ffetch_allocation_profile,
+       Sfetch_allocation_profile, (void), rep_Subr0)
+{
+    return alloc_profile_table ? alloc_profile_table : Qnil;
+}
+
+DEFUN ("allocation-profile-interval", Fallocation_profile_interval,
+       Sallocation_profile_interval, (repv arg), rep_Subr1)
+{
+    repv ret = rep_MAKE_INT (alloc_profile_interval);
+    if (rep_INTP (arg) && rep_INT (arg) > 0)
+    {
+	alloc_profile_interval = rep_INT (arg);
+	if (alloc_profiling)
+	    rep_alloc_sample_countdown = alloc_profile_interval;
+    }
+    return ret;
+}
+
 
 /* init */
 
@@ -200,8 +707,15 @@ rep_dl_init (void)
     rep_ADD_SUBR (Sstart_profiler);
     rep_ADD_SUBR (Sstop_profiler);
     rep_ADD_SUBR (Sfetch_profile);
+    rep_ADD_SUBR (Sfetch_call_tree);
     rep_ADD_SUBR (Sprofile_interval);
-    rep_mark_static (&profile_table);
+    rep_ADD_SUBR (Sstart_allocation_profiler);
+    rep_ADD_SUBR (Sstop_allocation_profiler);
+    rep_ADD_SUBR (Sfetch_allocation_profile);
+    rep_ADD_SUBR (Sallocation_profile_interval);
+    rep_mark_static (&profile_objects);
+    rep_mark_static (&alloc_profile_table);
+    rep_mark_static (&alloc_stack);
 
 #ifdef HAVE_SETITIMER
     signal (SIGPROF, SIG_IGN);
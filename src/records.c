@@ -0,0 +1,231 @@
+/* records.c -- native record objects
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.	If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Commentary:
+
+   These are the objects that rep.data.records builds its record types
+   on. Each record is a single block holding a pointer to its type
+   descriptor followed by its slots, so an accessor is one type check
+   and one load; the VM open-codes %record-ref, %record-set and
+   %record-p (see lispmach.h).
+
+   The type descriptor is whatever object the caller passes, it's only
+   compared with `eq'. When it's a vector [NAME FIELDS DISCLOSER], as
+   rep.data.records makes it, it's also used to print the record. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+
+int rep_record_type;
+
+static rep_record *records;
+
+/* Largest number of slots, the count is stored above the type code */
+#define MAX_RECORD_SLOTS \
+    ((1L << (sizeof (repv) * 8 - rep_CELL16_TYPE_BITS - 1)) - 1)
+
+static repv
+make_record (repv type, int nslots)
+{
+    rep_record *r = rep_ALLOC_CELL (sizeof (rep_record)
+				    + (nslots - 1) * sizeof (repv));
+    int i;
+    if (r == 0)
+	return rep_mem_error ();
+    r->car = rep_record_type | ((repv) nslots << rep_CELL16_TYPE_BITS);
+    r->type = type;
+    for (i = 0; i < nslots; i++)
+	r->slots[i] = Qnil;
+    r->next = records;
+    records = r;
+    rep_data_after_gc += sizeof (rep_record) + nslots * sizeof (repv);
+    return rep_VAL (r);
+}
+
+
+/* type hooks */
+
+static int
+record_cmp (repv r1, repv r2)
+{
+    int i;
+    if (!rep_RECORDP (r1) || !rep_RECORDP (r2)
+	|| rep_RECORD (r1)->type != rep_RECORD (r2)->type
+	|| rep_RECORD_LEN (r1) != rep_RECORD_LEN (r2))
+	return 1;
+    for (i = 0; i < rep_RECORD_LEN (r1); i++)
+    {
+	int tem = rep_value_cmp (rep_RECORD_SLOT (r1, i),
+				 rep_RECORD_SLOT (r2, i));
+	if (tem != 0)
+	    return tem;
+    }
+    return 0;
+}
+
+static void
+record_print (repv stream, repv arg)
+{
+    repv type = rep_RECORD (arg)->type;
+    if (rep_VECTORP (type) && rep_VECT_LEN (type) >= 3)
+    {
+	repv discloser = rep_VECTI (type, 2);
+	if (discloser != Qnil)
+	{
+	    repv out = rep_call_lisp1 (discloser, arg);
+	    if (out == rep_NULL)
+		return;
+	    if (rep_STRINGP (out))
+		rep_stream_puts (stream, rep_PTR (out), -1, rep_TRUE);
+	    else
+		rep_print_val (stream, out);
+	}
+	else
+	{
+	    rep_stream_puts (stream, "#<", -1, rep_FALSE);
+	    rep_princ_val (stream, rep_VECTI (type, 0));
+	    rep_stream_putc (stream, '>');
+	}
+    }
+    else
+	rep_stream_puts (stream, "#<record>", -1, rep_FALSE);
+}
+
+static void
+record_mark (repv r)
+{
+    int i;
+    rep_MARKVAL (rep_RECORD (r)->type);
+    for (i = 0; i < rep_RECORD_LEN (r); i++)
+	rep_MARKVAL (rep_RECORD_SLOT (r, i));
+}
+
+static void
+record_sweep (void)
+{
+    rep_record *x = records;
+    records = 0;
+    while (x != 0)
+    {
+	rep_record *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (x)))
+	    rep_FREE_CELL (x);
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (x));
+	    x->next = records;
+	    records = x;
+	}
+	x = next;
+    }
+}
+
+
+/* lisp functions */
+
+DEFUN ("%make-record", F_make_record,
+       S_make_record, (int argc, repv *argv), rep_SubrV) /*
+::doc:rep.data#%make-record::
+%make-record TYPE VALUES...
+
+Return a new record of type TYPE (an arbitrary object) with one slot
+for each of VALUES, initialized from them in order.
+::end:: */
+{
+    repv r;
+    int i;
+
+    if (argc < 1)
+	return rep_signal_missing_arg (1);
+    if (argc - 1 > MAX_RECORD_SLOTS)
+	return rep_signal_arg_error (argv[argc - 1], argc);
+
+    r = make_record (argv[0], argc - 1);
+    if (r != rep_NULL)
+    {
+	for (i = 1; i < argc; i++)
+	    rep_RECORD_SLOT (r, i - 1) = argv[i];
+    }
+    return r;
+}
+
+DEFUN ("%record-ref", F_record_ref, S_record_ref,
+       (repv record, repv type, repv index), rep_Subr3) /*
+::doc:rep.data#%record-ref::
+%record-ref RECORD TYPE INDEX
+
+Return the contents of slot INDEX of RECORD, which must be a record of
+type TYPE.
+::end:: */
+{
+    rep_DECLARE (1, record, rep_RECORDP (record)
+		 && rep_RECORD (record)->type == type);
+    rep_DECLARE (3, index, rep_INTP (index) && rep_INT (index) >= 0
+		 && rep_INT (index) < rep_RECORD_LEN (record));
+    return rep_RECORD_SLOT (record, rep_INT (index));
+}
+
+DEFUN ("%record-set", F_record_set, S_record_set,
+       (repv record, repv type, repv index, repv value), rep_Subr4) /*
+::doc:rep.data#%record-set::
+%record-set RECORD TYPE INDEX VALUE
+
+Store VALUE in slot INDEX of RECORD, which must be a record of type
+TYPE. Returns VALUE.
+::end:: */
+{
+    rep_DECLARE (1, record, rep_RECORDP (record)
+		 && rep_RECORD (record)->type == type);
+    rep_DECLARE (3, index, rep_INTP (index) && rep_INT (index) >= 0
+		 && rep_INT (index) < rep_RECORD_LEN (record));
+    rep_RECORD_SLOT (record, rep_INT (index)) = value;
+    return value;
+}
+
+DEFUN ("%record-p", F_record_p, S_record_p,
+       (repv arg, repv type), rep_Subr2) /*
+::doc:rep.data#%record-p::
+%record-p ARG TYPE
+
+Return `t' if ARG is a record of type TYPE.
+::end:: */
+{
+    return (rep_RECORDP (arg) && rep_RECORD (arg)->type == type) ? Qt : Qnil;
+}
+
+
+/* init */
+
+void
+rep_records_init (void)
+{
+    repv tem;
+
+    rep_record_type = rep_register_new_type ("record", record_cmp,
+					     record_print, record_print,
+					     record_sweep, record_mark,
+					     0, 0, 0, 0, 0, 0, 0);
+
+    tem = rep_push_structure ("rep.data");
+    rep_ADD_SUBR (S_make_record);
+    rep_ADD_SUBR (S_record_ref);
+    rep_ADD_SUBR (S_record_set);
+    rep_ADD_SUBR (S_record_p);
+    rep_pop_structure (tem);
+}
@@ -70,6 +70,7 @@ static long	regsize;	/* Code size. */
 /*
  * Forward declarations for regcomp()'s friends. 
  */
+static int	regfirst(char *, unsigned char *, int);
 static char    *reg(int, int *);
 static char    *regbranch(int *);
 static char    *regpiece(int *);
@@ -148,33 +149,47 @@ rep_regcomp(char *exp)
     r->reganch = 0;
     r->regmust = NULL;
     r->regmlen = 0;
+    r->regprefix = NULL;
+    r->regplen = 0;
     r->regsize = sizeof(rep_regexp) + (unsigned)regsize;
     scan = r->program + 1;	/* First BRANCH. */
+
+    /* jsh -- the set of characters a match can start with, if it
+       can't be empty */
+    memset(r->regfirst, 0, sizeof(r->regfirst));
+    r->regfirstp = regfirst(scan, r->regfirst, 0);
+
     if (OP(regnext(scan)) == END) {	/* Only one top-level choice. */
 	scan = OPERAND(scan);
 
 	/* Starting-point info. */
-	if (OP(scan) == EXACTLY)
+	if (OP(scan) == EXACTLY) {
 	    r->regstart = UCHARAT(OPERAND(scan));
-	else if (OP(scan) == BOL)
+	    r->regprefix = OPERAND(scan);
+	    r->regplen = strlen(OPERAND(scan));
+	} else if (OP(scan) == BOL)
 	    r->reganch++;
 
 	/*
-	 * If there's something expensive in the r.e., find the longest
-	 * literal string that must appear and make it the regmust.  Resolve
-	 * ties in favor of later strings, since the regstart check works
-	 * with the beginning of the r.e. and avoiding duplication
-	 * strengthens checking.  Not a strong reason, but sufficient in the
-	 * absence of others.
+	 * Find the longest literal string that must appear and make it
+	 * the regmust.  Resolve ties in favor of later strings, since the
+	 * regstart check works with the beginning of the r.e. and avoiding
+	 * duplication strengthens checking.  Not a strong reason, but
+	 * sufficient in the absence of others.
+	 *
+	 * jsh -- this used to be done only if there's something expensive
+	 * in the r.e.; but a failed search for the string is much cheaper
+	 * than a failed match at each position
 	 */
-	if (flags & SPSTART) {
-	    longest = NULL;
-	    len = 0;
-	    for (; scan != NULL; scan = regnext(scan))
-		if (OP(scan) == EXACTLY && strlen(OPERAND(scan)) >= len) {
-		    longest = OPERAND(scan);
-		    len = strlen(OPERAND(scan));
-		}
+	longest = NULL;
+	len = 0;
+	for (; scan != NULL; scan = regnext(scan))
+	    if (OP(scan) == EXACTLY && strlen(OPERAND(scan)) >= len) {
+		longest = OPERAND(scan);
+		len = strlen(OPERAND(scan));
+	    }
+	/* An unanchored search for the prefix finds this anyway */
+	if (longest != r->regprefix || r->reganch) {
 	    r->regmust = longest;
 	    r->regmlen = len;
 	}
@@ -188,6 +203,90 @@ rep_regcomp(char *exp)
     return (r);
 }
 
+/*
+ * - regfirst - add the characters that the program from NODE can start
+ *   by matching to the bit set SET, returning false if it could match
+ *   the empty string (or it's too complicated to tell)
+ */
+static int
+regfirst(char *node, unsigned char *set, int depth)
+{
+    int c;
+
+    for (; node != NULL; node = regnext(node)) {
+	if (depth++ > 64)
+	    return 0;
+
+	switch (OP(node)) {
+	case BOL: case EOL: case WEDGE: case NWEDGE:
+	case NOTHING: case BACK:
+	    break;
+
+	case BRANCH:
+	    if (OP(regnext(node)) != BRANCH)
+		return regfirst(OPERAND(node), set, depth);
+	    for (; node != NULL && OP(node) == BRANCH; node = regnext(node)) {
+		if (!regfirst(OPERAND(node), set, depth))
+		    return 0;
+	    }
+	    return 1;
+
+	case STAR: case NGSTAR:
+	    if (!regfirst(OPERAND(node), set, depth))
+		return 0;
+	    break;
+
+	case PLUS: case NGPLUS:
+	    return regfirst(OPERAND(node), set, depth);
+
+	case EXACTLY:
+	    c = UCHARAT(OPERAND(node));
+	    set[c / 8] |= 1 << (c % 8);
+	    return 1;
+
+	case ANYOF: {
+	    char *p;
+	    for (p = OPERAND(node); *p != '\0'; p++) {
+		c = UCHARAT(p);
+		set[c / 8] |= 1 << (c % 8);
+	    }
+	    return 1;
+	}
+
+	case ANYBUT: case WORD: case NWORD: case WSPC: case NWSPC:
+	case DIGI: case NDIGI:
+	    for (c = 1; c < 256; c++) {
+		int in;
+		switch (OP(node)) {
+		case ANYBUT:
+		    in = strchr(OPERAND(node), c) == NULL;
+		    break;
+		case WORD: case NWORD:
+		    in = (c == '_' || isalnum(c)) == (OP(node) == WORD);
+		    break;
+		case WSPC: case NWSPC:
+		    in = (isspace(c) != 0) == (OP(node) == WSPC);
+		    break;
+		default:
+		    in = (isdigit(c) != 0) == (OP(node) == DIGI);
+		}
+		if (in)
+		    set[c / 8] |= 1 << (c % 8);
+	    }
+	    return 1;
+
+	default:
+	    if (OP(node) > OPEN && OP(node) < OPEN + rep_NSUBEXP)
+		break;
+	    if (OP(node) > CLOSE && OP(node) < CLOSE + rep_NSUBEXP)
+		break;
+	    /* END, ANY */
+	    return 0;
+	}
+    }
+    return 0;
+}
+
 /*
  * - reg - regular expression, i.e. main body or parenthesized thing
  *
@@ -654,23 +753,36 @@ regoptail(char *p, char *val)
  */
 
 /*
- * Global work variables for regexec().
+ * Work variables for regexec(). Each match has its own set, on the
+ * stack of its caller, so matching is reentrant.
  */
-static char    *reginput;	/* String-input pointer. */
-static char    *regbol;		/* Beginning of input, for ^ check. */
-static char   **regstartp;	/* Pointer to startp array. */
-static char   **regendp;	/* Ditto for endp. */
-static char	regnocase;	/* Ignore case when string-matching. */
-static int	regnest;	/* depth of recursion */
+typedef struct regexec_state {
+    char    *input;		/* String-input pointer. */
+    char    *bol;		/* Beginning of input, for ^ check. */
+    char   **startp;		/* Pointer to startp array. */
+    char   **endp;		/* Ditto for endp. */
+    char     nocase;		/* Ignore case when string-matching. */
+    int	     nest;		/* depth of recursion */
+    long     steps;		/* steps left before giving up */
+    char    *steps_string;	/* string the budget was extended for */
+    int	     overflow;		/* set when giving up */
+} regexec_state;
 
 int rep_regexp_max_depth = 2048;
 
+/* Number of steps per input character that the backtracking matcher
+   may take before the match is handed to rep_regexec_nfa, which takes
+   linear time however bad the pattern. Zero means always use the NFA */
+int rep_regexp_backtrack_limit = 32;
+
 /*
  * Forwards.
  */
-static int	regtry(rep_regexp *, char *);
-static int	regmatch(char *);
-static int	regrepeat(char *);
+static int	backtrack_exec(regexec_state *, rep_regexp *, char *, int);
+static int	regmust_present(rep_regexp *, char *, int);
+static int	regtry(regexec_state *, rep_regexp *, char *);
+static int	regmatch(regexec_state *, char *);
+static int	regrepeat(regexec_state *, char *);
 
 #ifdef DEBUG
 int		regnarrate = 0;
@@ -687,9 +799,7 @@ char		*regprop(char *);
 int
 rep_regexec2(rep_regexp *prog, char *string, int eflags)
 {
-    register char  *s;
-    /* For REG_NOCASE and strpbrk()  */
-    static char mat[3] = "xX";
+    regexec_state rs;
 
     /* Be paranoid... */
     if (prog == NULL || string == NULL) {
@@ -702,80 +812,174 @@ rep_regexec2(rep_regexp *prog, char *string, int eflags)
 	return (0);
     }
 
+    if (rep_regexp_backtrack_limit <= 0)
+	return (regmust_present(prog, string, eflags & rep_REG_NOCASE)
+		&& rep_regexec_nfa(prog, string, eflags, 0));
+    if (backtrack_exec(&rs, prog, string, eflags))
+	return 1;
+    else if (rs.overflow)
+	return rep_regexec_nfa(prog, string, eflags, 0);
+    else
+	return 0;
+}
+
+/* Set the number of steps the backtracking matcher may take on STRING
+   before giving up. Enough for short strings to begin with; if they
+   run out, it's extended once by the actual length of the string */
+static inline void
+init_regsteps(regexec_state *rs, char *string)
+{
+    rs->steps = 256L * rep_regexp_backtrack_limit;
+    rs->steps_string = string;
+    rs->overflow = 0;
+}
+
+/* Called when the step budget runs out, returns true if it could be
+   extended */
+static int
+extend_regsteps(regexec_state *rs)
+{
+    if (rs->steps_string != NULL) {
+	rs->steps = ((long) strlen(rs->steps_string) + 1)
+		   * rep_regexp_backtrack_limit;
+	rs->steps_string = NULL;
+	if (rs->steps > 0)
+	    return 1;
+    }
+    rs->overflow = 1;
+    return 0;
+}
+
+static int
+backtrack_exec(regexec_state *rs, rep_regexp *prog, char *string, int eflags)
+{
+    register char  *s;
+
+    init_regsteps(rs, string);
+
     /* jsh -- Check for REG_NOCASE, means ignore case in string matches.  */
-    regnocase = ((eflags & rep_REG_NOCASE) != 0);
+    rs->nocase = ((eflags & rep_REG_NOCASE) != 0);
 
     /* If there is a "must appear" string, look for it. */
-    if (prog->regmust != NULL)
+    if (!regmust_present(prog, string, rs->nocase))
+	return (0);
+
+    /* Mark beginning of line for ^ . */
+    /* jsh -- if REG_NOTBOL is set then set the bol to something absurd
+       to guarantee ^ doesn't match */
+    rs->bol = (eflags & rep_REG_NOTBOL) ? "" : string;
+
+    /* Simplest case:  anchored match need be tried only once. */
+    if (prog->reganch)
+	return (regtry(rs, prog, string));
+
+    /* Messy cases:  unanchored match. */
+    s = string;
+    if (prog->regplen > 0 || prog->regfirstp)
     {
-	s = string;
-	if(regnocase)
+	/* We know something about how it must start. */
+	while ((s = rep_regexp_next_start(prog, s, rs->nocase)) != NULL)
 	{
-	    mat[0] = tolower(UCHARAT(prog->regmust));
-	    mat[1] = toupper(UCHARAT(prog->regmust));
-	    while ((s = strpbrk(s, mat)) != NULL)
-	    {
-		if(strncasecmp(s, prog->regmust, prog->regmlen) == 0)
-		    break;	    /* Found it. */
-		s++;
-	    }
+	    if (regtry(rs, prog, s))
+		return (1);
+	    s++;
+	}
+    }
+    else
+	/* We don't -- general case. */
+	do {
+	    if (regtry(rs, prog, s))
+		return (1);
+	} while (*s++ != '\0');
+
+    /* Failure. */
+    return (0);
+}
+
+/*
+ * - regmust_present - true unless STRING doesn't contain the literal
+ *   string that every match of PROG does
+ */
+static int
+regmust_present(rep_regexp *prog, char *string, int nocase)
+{
+    char *s = string;
+    if (prog->regmust == NULL)
+	return 1;
+    if (!nocase)
+	return strstr(s, prog->regmust) != NULL;
+    else
+    {
+	char mat[3];
+	mat[0] = tolower(UCHARAT(prog->regmust));
+	mat[1] = toupper(UCHARAT(prog->regmust));
+	mat[2] = '\0';
+	while ((s = strpbrk(s, mat)) != NULL)
+	{
+	    if (strncasecmp(s, prog->regmust, prog->regmlen) == 0)
+		return 1;
+	    s++;
+	}
+	return 0;
+    }
+}
+
+/*
+ * - regexp_next_start - return the first position in STRING at which a
+ *   match of PROG could start, or NULL if there's none. Only useful if
+ *   PROG has a literal prefix or a set of first characters.
+ */
+char *
+rep_regexp_next_start(rep_regexp *prog, char *s, int nocase)
+{
+    if (prog->regplen > 0)
+    {
+	char *prefix = prog->regprefix;
+	if (!nocase)
+	{
+	    if (prog->regplen == 1)
+		return strchr(s, prefix[0]);
+	    else
+		return strstr(s, prefix);
 	}
 	else
 	{
-	    while ((s = strchr(s, prog->regmust[0])) != NULL)
+	    int lower = tolower(UCHARAT(prefix)), upper = toupper(lower);
+	    for (; *s != '\0'; s++)
 	    {
-		if(strncmp(s, prog->regmust, prog->regmlen) == 0)
-		    break;	    /* Found it. */
-		s++;
+		if ((UCHARAT(s) == lower || UCHARAT(s) == upper)
+		    && strncasecmp(s, prefix, prog->regplen) == 0)
+		    return s;
 	    }
+	    return NULL;
 	}
-	if (s == NULL)		/* Not present. */
-	    return (0);
     }
-    /* Mark beginning of line for ^ . */
-    /* jsh -- if REG_NOTBOL is set then set regbol to something absurd
-       to guarantee ^ doesn't match */
-    regbol = (eflags & rep_REG_NOTBOL) ? "" : string;
-
-    /* Simplest case:  anchored match need be tried only once. */
-    if (prog->reganch)
-	return (regtry(prog, string));
-
-    /* Messy cases:  unanchored match. */
-    s = string;
-    if (prog->regstart != '\0')
+    else if (prog->regfirstp)
     {
-	/* We know what char it must start with. */
-	if(regnocase)
+	unsigned char *set = prog->regfirst;
+#define IN_FIRST(c) (set[(c) / 8] & (1 << ((c) % 8)))
+	if (!nocase)
 	{
-	    mat[0] = tolower(prog->regstart);
-	    mat[1] = toupper(prog->regstart);
-	    while((s = strpbrk(s, mat)) != NULL)
+	    for (; *s != '\0'; s++)
 	    {
-		if(regtry(prog, s))
-		    return (1);
-		s++;
+		if (IN_FIRST(UCHARAT(s)))
+		    return s;
 	    }
 	}
 	else
 	{
-	    while((s = strchr(s, prog->regstart)) != NULL)
+	    for (; *s != '\0'; s++)
 	    {
-		if(regtry(prog, s))
-		    return (1);
-		s++;
+		int c = UCHARAT(s);
+		if (IN_FIRST(c) || IN_FIRST(tolower(c)) || IN_FIRST(toupper(c)))
+		    return s;
 	    }
 	}
+#undef IN_FIRST
+	return NULL;
     }
     else
-	/* We don't -- general case. */
-	do {
-	    if (regtry(prog, s))
-		return (1);
-	} while (*s++ != '\0');
-
-    /* Failure. */
-    return (0);
+	return s;
 }
 
 /*
@@ -785,31 +989,46 @@ rep_regexec2(rep_regexp *prog, char *string, int eflags)
 int
 rep_regmatch_string(rep_regexp *prog, char *string, int eflags)
 {
+    regexec_state rs;
+
+    if (rep_regexp_backtrack_limit <= 0)
+	return rep_regexec_nfa(prog, string, eflags, 1);
+
+    init_regsteps(&rs, string);
+
     /* Check for REG_NOCASE, means ignore case in string matches.  */
-    regnocase = ((eflags & rep_REG_NOCASE) != 0);
+    rs.nocase = ((eflags & rep_REG_NOCASE) != 0);
 
     /* Mark beginning of line for ^ . */
-    /* jsh -- if REG_NOTBOL is set then set regbol to something absurd
+    /* jsh -- if REG_NOTBOL is set then set the bol to something absurd
        to guarantee ^ doesn't match */
-    regbol = (eflags & rep_REG_NOTBOL) ? "" : string;
+    rs.bol = (eflags & rep_REG_NOTBOL) ? "" : string;
 
-    return regtry(prog, string);
+    if (regtry(&rs, prog, string))
+	return 1;
+    else if (rs.overflow)
+	return rep_regexec_nfa(prog, string, eflags, 1);
+    else
+	return 0;
 }
 
 /*
  * - regtry - try match at specific point
  */
 static int			/* 0 failure, 1 success */
-regtry(rep_regexp *prog, char *string)
+regtry(regexec_state *rs, rep_regexp *prog, char *string)
 {
     register int    i;
     register char **sp;
     register char **ep;
 
-    reginput = string;
-    regstartp = prog->matches.string.startp;
-    regendp = prog->matches.string.endp;
-    regnest = 0;
+    if (rs->overflow)
+	return 0;
+
+    rs->input = string;
+    rs->startp = prog->matches.string.startp;
+    rs->endp = prog->matches.string.endp;
+    rs->nest = 0;
 
     sp = prog->matches.string.startp;
     ep = prog->matches.string.endp;
@@ -817,9 +1036,9 @@ regtry(rep_regexp *prog, char *string)
 	*sp++ = NULL;
 	*ep++ = NULL;
     }
-    if (regmatch(prog->program + 1)) {
-	regstartp[0] = string;
-	regendp[0] = reginput;
+    if (regmatch(rs, prog->program + 1)) {
+	rs->startp[0] = string;
+	rs->endp[0] = rs->input;
 	prog->lasttype = rep_reg_string;
 	return (1);
     } else
@@ -828,12 +1047,12 @@ regtry(rep_regexp *prog, char *string)
 
 /* get around the insane number of return statements in regmatch () */
 static inline int
-nested_regmatch (char *prog)
+nested_regmatch (regexec_state *rs, char *prog)
 {
     int ret;
-    regnest++;
-    ret = regmatch (prog);
-    regnest--;
+    rs->nest++;
+    ret = regmatch (rs, prog);
+    rs->nest--;
     return ret;
 }
 
@@ -847,15 +1066,15 @@ nested_regmatch (char *prog)
  * whether the rest of the match failed) by a loop instead of by recursion.
  */
 static int			/* 0 failure, 1 success */
-regmatch(char *prog)
+regmatch(regexec_state *rs, char *prog)
 {
     register char  *scan;	/* Current node. */
     char	   *next;	/* Next node. */
 
-    if (regnest >= rep_regexp_max_depth)
+    if (rs->nest >= rep_regexp_max_depth)
     {
-	/* recursion overload, bail out */
-	rep_regerror ("stack overflow");
+	/* recursion overload, let the NFA do it */
+	rs->overflow = 1;
 	return 0;
     }
 
@@ -871,54 +1090,57 @@ regmatch(char *prog)
 #endif
 	next = regnext(scan);
 
+	if (--rs->steps < 0 && !extend_regsteps(rs))
+	    return 0;
+
 	switch (OP(scan)) {
 	case BOL:
-	    if (reginput != regbol)
+	    if (rs->input != rs->bol)
 		return (0);
 	    break;
 	case EOL:
-	    if (*reginput != '\0')
+	    if (*rs->input != '\0')
 		return (0);
 	    break;
 	case ANY:
-	    if (*reginput == '\0')
+	    if (*rs->input == '\0')
 		return (0);
-	    reginput++;
+	    rs->input++;
 	    break;
 	case EXACTLY:{
 		register int	len;
 		register char  *opnd;
 		opnd = OPERAND(scan);
-		if(regnocase)
+		if(rs->nocase)
 		{
 		    /* Inline the first character, for speed. */
-		    if(toupper(UCHARAT(opnd)) != toupper(UCHARAT(reginput)))
+		    if(toupper(UCHARAT(opnd)) != toupper(UCHARAT(rs->input)))
 			return (0);
 		    len = strlen(opnd);
-		    if(len > 1 && strncasecmp(opnd, reginput, len) != 0)
+		    if(len > 1 && strncasecmp(opnd, rs->input, len) != 0)
 			return (0);
 		}
 		else
 		{
 		    /* Inline the first character, for speed. */
-		    if(*opnd != *reginput)
+		    if(*opnd != *rs->input)
 			return (0);
 		    len = strlen(opnd);
-		    if(len > 1 && strncmp(opnd, reginput, len) != 0)
+		    if(len > 1 && strncmp(opnd, rs->input, len) != 0)
 			return (0);
 		}
-		reginput += len;
+		rs->input += len;
 	    }
 	    break;
 	case ANYOF:
-	    if (*reginput == '\0' || strchr(OPERAND(scan), *reginput) == NULL)
+	    if (*rs->input == '\0' || strchr(OPERAND(scan), *rs->input) == NULL)
 		return (0);
-	    reginput++;
+	    rs->input++;
 	    break;
 	case ANYBUT:
-	    if (*reginput == '\0' || strchr(OPERAND(scan), *reginput) != NULL)
+	    if (*rs->input == '\0' || strchr(OPERAND(scan), *rs->input) != NULL)
 		return (0);
-	    reginput++;
+	    rs->input++;
 	    break;
 	case NOTHING:
 	    break;
@@ -937,15 +1159,15 @@ regmatch(char *prog)
 		register char  *save;
 
 		no = OP(scan) - OPEN;
-		save = reginput;
+		save = rs->input;
 
-		if (nested_regmatch(next)) {
+		if (nested_regmatch(rs, next)) {
 		    /*
 		     * Don't set startp if some later invocation of the same
 		     * parentheses already has.
 		     */
-		    if (regstartp[no] == NULL)
-			regstartp[no] = save;
+		    if (rs->startp[no] == NULL)
+			rs->startp[no] = save;
 		    return (1);
 		} else
 		    return (0);
@@ -964,15 +1186,15 @@ regmatch(char *prog)
 		register char  *save;
 
 		no = OP(scan) - CLOSE;
-		save = reginput;
+		save = rs->input;
 
-		if (nested_regmatch(next)) {
+		if (nested_regmatch(rs, next)) {
 		    /*
 		     * Don't set endp if some later invocation of the same
 		     * parentheses already has.
 		     */
-		    if (regendp[no] == NULL)
-			regendp[no] = save;
+		    if (rs->endp[no] == NULL)
+			rs->endp[no] = save;
 		    return (1);
 		} else
 		    return (0);
@@ -985,10 +1207,10 @@ regmatch(char *prog)
 		    next = OPERAND(scan);	/* Avoid recursion. */
 		else {
 		    do {
-			save = reginput;
-			if (nested_regmatch(OPERAND(scan)))
+			save = rs->input;
+			if (nested_regmatch(rs, OPERAND(scan)))
 			    return (1);
-			reginput = save;
+			rs->input = save;
 			scan = regnext(scan);
 		    } while (scan != NULL && OP(scan) == BRANCH);
 		    return (0);
@@ -1010,21 +1232,22 @@ regmatch(char *prog)
 		nextch = '\0';
 		if (OP(next) == EXACTLY)
 		    nextch = UCHARAT(OPERAND(next));
-		if(regnocase)
+		if(rs->nocase)
 		    nextch = toupper(nextch);
 		min = (OP(scan) == STAR) ? 0 : 1;
-		save = reginput;
-		no = regrepeat(OPERAND(scan));
+		save = rs->input;
+		no = regrepeat(rs, OPERAND(scan));
+		rs->steps -= no;
 		while (no >= min) {
 		    /* If it could work, try it. */
 		    if (nextch == '\0'
-			|| (regnocase ? toupper(UCHARAT(reginput))
-			    : *reginput) == nextch)
-			if (nested_regmatch(next))
+			|| (rs->nocase ? toupper(UCHARAT(rs->input))
+			    : *rs->input) == nextch)
+			if (nested_regmatch(rs, next))
 			    return (1);
 		    /* Couldn't or didn't -- back up. */
 		    no--;
-		    reginput = save + no;
+		    rs->input = save + no;
 		}
 		return (0);
 	    }
@@ -1043,18 +1266,19 @@ regmatch(char *prog)
 		nextch = '\0';
 		if (OP(next) == EXACTLY)
 		    nextch = UCHARAT(OPERAND(next));
-		if(regnocase)
+		if(rs->nocase)
 		    nextch = toupper(nextch);
 		no = (OP(scan) == NGSTAR) ? 0 : 1;
-		save = reginput;
-		max = regrepeat(OPERAND(scan));
+		save = rs->input;
+		max = regrepeat(rs, OPERAND(scan));
+		rs->steps -= max;
 		while (no <= max) {
-		    reginput = save + no;
+		    rs->input = save + no;
 		    /* If it could work, try it. */
 		    if (nextch == '\0'
-			|| (regnocase ? toupper(UCHARAT(reginput))
-			    : *reginput) == nextch)
-			if (nested_regmatch(next))
+			|| (rs->nocase ? toupper(UCHARAT(rs->input))
+			    : *rs->input) == nextch)
+			if (nested_regmatch(rs, next))
 			    return (1);
 		    /* Couldn't or didn't -- move up. */
 		    no++;
@@ -1063,49 +1287,50 @@ regmatch(char *prog)
 	    }
 	    break;
 	case WORD:
-	    if (*reginput != '_' && !isalnum (UCHARAT(reginput)))
+	    if (*rs->input != '_' && !isalnum (UCHARAT(rs->input)))
 		return 0;
-	    reginput++;
+	    rs->input++;
 	    break;
 	case NWORD:
-	    if (*reginput == '_' || isalnum (UCHARAT(reginput)))
+	    if (*rs->input == '\0'
+		|| *rs->input == '_' || isalnum (UCHARAT(rs->input)))
 		return 0;
-	    reginput++;
+	    rs->input++;
 	    break;
 	case WSPC:
-	    if (!isspace (UCHARAT(reginput)))
+	    if (!isspace (UCHARAT(rs->input)))
 		return 0;
-	    reginput++;
+	    rs->input++;
 	    break;
 	case NWSPC:
-	    if (isspace (UCHARAT(reginput)))
+	    if (*rs->input == '\0' || isspace (UCHARAT(rs->input)))
 		return 0;
-	    reginput++;
+	    rs->input++;
 	    break;
 	case DIGI:
-	    if (!isdigit (UCHARAT(reginput)))
+	    if (!isdigit (UCHARAT(rs->input)))
 		return 0;
-	    reginput++;
+	    rs->input++;
 	    break;
 	case NDIGI:
-	    if (isdigit (UCHARAT(reginput)))
+	    if (*rs->input == '\0' || isdigit (UCHARAT(rs->input)))
 		return 0;
-	    reginput++;
+	    rs->input++;
 	    break;
 	case WEDGE:
-	    if (reginput == regbol || *reginput == '\0'
-		|| ((reginput[-1] == '_' || isalnum (UCHARAT(reginput - 1)))
-		    && (*reginput != '_' && !isalnum (UCHARAT(reginput))))
-		|| ((reginput[-1] != '_' && !isalnum (UCHARAT(reginput - 1)))
-		    && (*reginput == '_' || isalnum (UCHARAT(reginput)))))
+	    if (rs->input == rs->bol || *rs->input == '\0'
+		|| ((rs->input[-1] == '_' || isalnum (UCHARAT(rs->input - 1)))
+		    && (*rs->input != '_' && !isalnum (UCHARAT(rs->input))))
+		|| ((rs->input[-1] != '_' && !isalnum (UCHARAT(rs->input - 1)))
+		    && (*rs->input == '_' || isalnum (UCHARAT(rs->input)))))
 		break;
 	    return 0;
 	case NWEDGE:
-	    if (!(reginput == regbol || *reginput == '\0'
-		  || ((reginput[-1] == '_' || isalnum (UCHARAT(reginput - 1)))
-		      && (*reginput != '_' && !isalnum (UCHARAT(reginput))))
-		  || ((reginput[-1] != '_' && !isalnum (UCHARAT(reginput - 1)))
-		      && (*reginput == '_' || isalnum (UCHARAT(reginput))))))
+	    if (!(rs->input == rs->bol || *rs->input == '\0'
+		  || ((rs->input[-1] == '_' || isalnum (UCHARAT(rs->input - 1)))
+		      && (*rs->input != '_' && !isalnum (UCHARAT(rs->input))))
+		  || ((rs->input[-1] != '_' && !isalnum (UCHARAT(rs->input - 1)))
+		      && (*rs->input == '_' || isalnum (UCHARAT(rs->input))))))
 		break;
 	    return 0;
 	case END:
@@ -1132,20 +1357,20 @@ regmatch(char *prog)
  * - regrepeat - repeatedly match something simple, report how many
  */
 static int
-regrepeat(char *p)
+regrepeat(regexec_state *rs, char *p)
 {
     int count;
     register char  *scan;
     register char  *opnd;
 
-    scan = reginput;
+    scan = rs->input;
     opnd = OPERAND(p);
     switch (OP(p)) {
     case ANY:
 	scan += strlen(scan);
 	break;
     case EXACTLY:
-	if(regnocase)
+	if(rs->nocase)
 	{
 	    while(toupper(UCHARAT(opnd)) == toupper(UCHARAT(scan))) {
 		scan++;
@@ -1204,8 +1429,8 @@ regrepeat(char *p)
 	break;
     }
 
-    count = scan - reginput;
-    reginput = scan;
+    count = scan - rs->input;
+    rs->input = scan;
 
     return count;
 }
@@ -0,0 +1,416 @@
+/* regnfa.c -- Linear-time regexp matching
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* The program made by rep_regcomp is a nondeterministic automaton, so
+   instead of backtracking through it (as regexp.c does), this runs all
+   of its possible paths in step over the input, one character at a
+   time. At each position there's a list of threads, each waiting at a
+   node that consumes a character, in the order the backtracking
+   matcher would try them; a thread whose node accepts the character is
+   advanced through the following nodes that don't consume anything
+   (branches, parentheses, anchors) and added to the list for the next
+   position, unless a higher priority thread already got there. Since
+   no state is ever in a list twice, matching takes time proportional
+   to the length of the input times the size of the program, whatever
+   the pattern, and gives the same result (including parenthesized
+   subexpressions) as the backtracking matcher.
+
+   Each thread's state is identified by its offset in the program: the
+   node itself for character classes and STAR, each character of an
+   EXACTLY string's operand for that string, and the byte after a PLUS
+   node once it has matched its first character. All state lives on the
+   stack of rep_regexec_nfa, so it's reentrant. */
+
+#define _GNU_SOURCE
+
+/* AIX requires this to be the first thing in the file.  */
+#include <config.h>
+#ifdef __GNUC__
+# define alloca __builtin_alloca
+#else
+# if HAVE_ALLOCA_H
+#  include <alloca.h>
+# else
+#  ifdef _AIX
+ #pragma alloca
+#  else
+#   ifndef alloca /* predefined by HP cc +Olibcalls */
+char *alloca ();
+#   endif
+#  endif
+# endif
+#endif
+
+#define rep_NEED_REGEXP_INTERNALS
+#include "repint.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#define UCHARAT(p) ((int)*(unsigned char *)(p))
+
+/* Largest amount of thread storage allocated on the stack */
+#define MAX_ALLOCA 16384
+
+/* Values of a thread's SUB field, besides the index of the next
+   character of an EXACTLY string */
+#define SUB_NODE	-1		/* waiting at the node itself */
+#define SUB_LOOP	-2		/* a PLUS that has matched once */
+
+typedef struct {
+    int n;
+    char **nodes;		/* node of each thread */
+    short *subs;		/* and where in it */
+    char **caps;		/* NCAPS saved positions of each thread */
+} thread_list;
+
+typedef struct {
+    char *program;
+    char *bol;
+    rep_bool nocase;
+    int ncaps;			/* 2 * number of subexpressions */
+    unsigned int gen;
+    unsigned int *seen;		/* generation each state was last added */
+    rep_bool matched, cut;
+    char **match;		/* positions of the best match so far */
+} nfa;
+
+#define next_node rep_regnext_node
+#define word_char_p rep_regword_char_p
+
+static inline rep_bool
+at_word_edge (nfa *m, char *pos)
+{
+    return (pos == m->bol || *pos == 0
+	    || word_char_p (UCHARAT (pos - 1)) != word_char_p (UCHARAT (pos)));
+}
+
+#define char_equal(m, a, b) rep_regchar_equal (a, b, (m)->nocase)
+#define node_accepts(m, node, c) rep_regnode_accepts (node, c, (m)->nocase)
+
+/* Add a thread waiting at NODE (and SUB) to list L, unless there's
+   already one */
+static inline void
+add_state (nfa *m, thread_list *l, char *node, int sub, char **caps)
+{
+    int id = (node - m->program) + (sub == SUB_NODE ? 0
+				     : sub == SUB_LOOP ? 1 : 3 + sub);
+    if (m->seen[id] != m->gen)
+    {
+	m->seen[id] = m->gen;
+	l->nodes[l->n] = node;
+	l->subs[l->n] = sub;
+	memcpy (l->caps + l->n * m->ncaps, caps, sizeof (char *) * m->ncaps);
+	l->n++;
+    }
+}
+
+/* Follow the nodes that don't consume input from NODE at position POS,
+   adding the threads they lead to to L in priority order. CAPS is
+   modified while doing so but restored before returning. */
+static void
+add_thread (nfa *m, thread_list *l, char *node, char *pos, char **caps)
+{
+    while (node != 0 && !m->cut)
+    {
+	int op = OP (node);
+
+	switch (op)
+	{
+	case END:
+	    /* a match, better than anything lower in the list */
+	    m->matched = rep_TRUE;
+	    memcpy (m->match, caps, sizeof (char *) * m->ncaps);
+	    m->match[1] = pos;
+	    m->cut = rep_TRUE;
+	    return;
+
+	case BOL:
+	    if (pos != m->bol)
+		return;
+	    break;
+
+	case EOL:
+	    if (*pos != 0)
+		return;
+	    break;
+
+	case WEDGE:
+	    if (!at_word_edge (m, pos))
+		return;
+	    break;
+
+	case NWEDGE:
+	    if (at_word_edge (m, pos))
+		return;
+	    break;
+
+	case NOTHING: case BACK:
+	    break;
+
+	case BRANCH: {
+	    int id = node - m->program;
+	    if (m->seen[id] == m->gen)
+		return;
+	    m->seen[id] = m->gen;
+	    if (OP (next_node (node)) != BRANCH)
+	    {
+		node = OPERAND (node);
+		continue;
+	    }
+	    do {
+		add_thread (m, l, OPERAND (node), pos, caps);
+		node = next_node (node);
+	    } while (node != 0 && OP (node) == BRANCH);
+	    return;
+	}
+
+	case STAR:
+	    add_state (m, l, node, SUB_NODE, caps);
+	    node = next_node (node);
+	    continue;
+
+	case NGSTAR:
+	    add_thread (m, l, next_node (node), pos, caps);
+	    if (!m->cut)
+		add_state (m, l, node, SUB_NODE, caps);
+	    return;
+
+	case EXACTLY:
+	    add_state (m, l, node, 0, caps);
+	    return;
+
+	default:
+	    if ((op > OPEN && op < OPEN + rep_NSUBEXP)
+		|| (op > CLOSE && op < CLOSE + rep_NSUBEXP))
+	    {
+		int i = (op < CLOSE ? 2 * (op - OPEN) : 2 * (op - CLOSE) + 1);
+		if (i < m->ncaps)
+		{
+		    char *old = caps[i];
+		    caps[i] = pos;
+		    add_thread (m, l, next_node (node), pos, caps);
+		    caps[i] = old;
+		    return;
+		}
+		break;
+	    }
+	    /* PLUS, NGPLUS, or a single character class */
+	    add_state (m, l, node, SUB_NODE, caps);
+	    return;
+	}
+	node = next_node (node);
+    }
+}
+
+/* Continue a PLUS or NGPLUS node that has matched at least once */
+static inline void
+add_loop (nfa *m, thread_list *l, char *node, char *pos, char **caps)
+{
+    if (OP (node) == PLUS)
+    {
+	add_state (m, l, node, SUB_LOOP, caps);
+	add_thread (m, l, next_node (node), pos, caps);
+    }
+    else
+    {
+	add_thread (m, l, next_node (node), pos, caps);
+	if (!m->cut)
+	    add_state (m, l, node, SUB_LOOP, caps);
+    }
+}
+
+/* Advance the thread waiting at NODE and SUB, with saved positions
+   CAPS, over the character C at POS, adding its successors to L */
+static inline void
+step_thread (nfa *m, thread_list *l, char *node, int sub,
+	     char *pos, int c, char **caps)
+{
+    switch (OP (node))
+    {
+    case STAR: case NGSTAR:
+	if (node_accepts (m, OPERAND (node), c))
+	    add_thread (m, l, node, pos + 1, caps);
+	break;
+
+    case PLUS: case NGPLUS:
+	if (node_accepts (m, OPERAND (node), c))
+	    add_loop (m, l, node, pos + 1, caps);
+	break;
+
+    case EXACTLY: {
+	char *string = OPERAND (node);
+	if (char_equal (m, UCHARAT (string + sub), c))
+	{
+	    if (string[sub + 1] != 0)
+		add_state (m, l, node, sub + 1, caps);
+	    else
+		add_thread (m, l, next_node (node), pos + 1, caps);
+	}
+	break;
+    }
+
+    default:
+	if (node_accepts (m, node, c))
+	    add_thread (m, l, next_node (node), pos + 1, caps);
+    }
+}
+
+/* Return the number of subexpressions (including the whole match)
+   that PROG can set */
+static int
+count_subexps (rep_regexp *prog)
+{
+    char *node = prog->program + 1;
+    int n = 1;
+    while (OP (node) != END)
+    {
+	int op = OP (node);
+	if (op > OPEN && op < OPEN + rep_NSUBEXP && op - OPEN + 1 > n)
+	    n = op - OPEN + 1;
+	node += 3;
+	if (op == ANYOF || op == ANYBUT || op == EXACTLY)
+	    node += strlen (node) + 1;
+    }
+    return n;
+}
+
+/* Search for (or if ANCHORED, only try at the start of STRING) a match
+   of PROG, which has the same meaning as the backtracking matcher's
+   rep_regexec2 and rep_regmatch_string. */
+int
+rep_regexec_nfa (rep_regexp *prog, char *string, int eflags,
+		 rep_bool anchored)
+{
+    int size = prog->regsize - sizeof (rep_regexp) + 1;
+    int nstates = size + 3, bytes, i;
+    thread_list lists[2], *clist = &lists[0], *nlist = &lists[1], *tem;
+    char *pos, **caps;
+    void *storage;
+    nfa m;
+
+    m.program = prog->program;
+    m.bol = (eflags & rep_REG_NOTBOL) ? 0 : string;
+    m.nocase = (eflags & rep_REG_NOCASE) != 0;
+    m.ncaps = 2 * count_subexps (prog);
+    m.matched = m.cut = rep_FALSE;
+    m.gen = 1;
+
+    if (prog->reganch && m.bol == 0)
+	return 0;
+    if (prog->reganch)
+	anchored = rep_TRUE;
+
+    /* One list entry per state, at most, in each of the two lists */
+    bytes = (nstates * sizeof (unsigned int)
+	     + 2 * nstates * (sizeof (char *) + sizeof (short)
+			      + m.ncaps * sizeof (char *))
+	     + 2 * m.ncaps * sizeof (char *));
+    if (bytes <= MAX_ALLOCA)
+	storage = alloca (bytes);
+    else
+    {
+	storage = malloc (bytes);
+	if (storage == 0)
+	{
+	    rep_regerror ("out of space");
+	    return 0;
+	}
+    }
+
+    /* pointers first, for alignment */
+    caps = storage;
+    m.match = caps + m.ncaps;
+    for (i = 0; i < 2; i++)
+    {
+	lists[i].caps = m.match + m.ncaps + i * nstates * m.ncaps;
+	lists[i].nodes = lists[0].caps + 2 * nstates * m.ncaps + i * nstates;
+	lists[i].n = 0;
+    }
+    m.seen = (unsigned int *) (lists[0].nodes + 2 * nstates);
+    lists[0].subs = (short *) (m.seen + nstates);
+    lists[1].subs = lists[0].subs + nstates;
+    memset (m.seen, 0, nstates * sizeof (unsigned int));
+
+    for (pos = string;; pos++)
+    {
+	int c = UCHARAT (pos);
+
+	/* start a new thread here, after all those started earlier */
+	if (!m.matched && (!anchored || pos == string))
+	{
+	    if (clist->n == 0 && !anchored
+		&& (prog->regplen > 0 || prog->regfirstp))
+	    {
+		/* skip to where a match could start */
+		pos = rep_regexp_next_start (prog, pos, m.nocase);
+		if (pos == 0)
+		    break;
+		c = UCHARAT (pos);
+	    }
+	    for (i = 0; i < m.ncaps; i++)
+		caps[i] = 0;
+	    caps[0] = pos;
+	    m.cut = rep_FALSE;
+	    add_thread (&m, clist, prog->program + 1, pos, caps);
+	}
+
+	if (clist->n == 0 && (m.matched || anchored))
+	    break;
+	if (c == 0)
+	    break;
+
+	m.gen++;
+	m.cut = rep_FALSE;
+	nlist->n = 0;
+	for (i = 0; i < clist->n && !m.cut; i++)
+	{
+	    step_thread (&m, nlist, clist->nodes[i], clist->subs[i],
+			 pos, c, clist->caps + i * m.ncaps);
+	}
+
+	tem = clist;
+	clist = nlist;
+	nlist = tem;
+    }
+
+    if (m.matched)
+    {
+	for (i = 0; i < rep_NSUBEXP; i++)
+	{
+	    if (2 * i < m.ncaps)
+	    {
+		prog->matches.string.startp[i] = m.match[2 * i];
+		prog->matches.string.endp[i] = m.match[2 * i + 1];
+	    }
+	    else
+	    {
+		prog->matches.string.startp[i] = 0;
+		prog->matches.string.endp[i] = 0;
+	    }
+	}
+	prog->lasttype = rep_reg_string;
+    }
+
+    if (bytes > MAX_ALLOCA)
+	free (storage);
+    return m.matched;
+}
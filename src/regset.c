@@ -0,0 +1,1114 @@
+/* regset.c -- Matching many regexps in one pass
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* A regexp set finds which of a list of regexps match a string, in a
+   single pass over it, however many regexps there are.
+
+   Patterns with no special characters are plain strings, and are
+   found using the Aho-Corasick algorithm: a trie of all the strings,
+   in which each node also links to the node for the longest suffix of
+   its string that's in the trie, so the trie can be followed one
+   character at a time without ever backing up.
+
+   The others are compiled as usual, then run together as one
+   deterministic automaton. Each of its states is a set of positions
+   in the programs of the regexps (see regnfa.c for what a position
+   is), along with whether the previous character was a word
+   character, so that \b can be decided. Since building the whole
+   automaton can take exponential space, each transition is only
+   worked out when it's first followed, then cached in the state. If
+   there get to be too many states they're all thrown away and the
+   process starts again. */
+
+#define _GNU_SOURCE
+
+/* AIX requires this to be the first thing in the file.  */
+#include <config.h>
+#ifdef __GNUC__
+# define alloca __builtin_alloca
+#else
+# if HAVE_ALLOCA_H
+#  include <alloca.h>
+# else
+#  ifdef _AIX
+ #pragma alloca
+#  else
+#   ifndef alloca /* predefined by HP cc +Olibcalls */
+char *alloca ();
+#   endif
+#  endif
+# endif
+#endif
+
+#define rep_NEED_REGEXP_INTERNALS
+#include "repint.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#define UCHARAT(p) ((int)*(unsigned char *)(p))
+
+/* Most states kept by each set before starting again */
+#define MAX_STATES 1024
+
+/* The kinds of position, besides the index of the next character of
+   an EXACTLY string (which is never zero for a pending position) */
+#define SUB_NODE	-1		/* waiting at this node */
+#define SUB_LOOP	-2		/* a PLUS that has matched once */
+#define SUB_EXPLORE	-3		/* about to reach this node */
+
+/* Flags of a state */
+#define STATE_BOL	1		/* at the beginning of the line */
+#define STATE_WORD	2		/* last character was a word char */
+
+typedef struct {
+    char *node;
+    int sub;
+    int prog;
+} set_item;
+
+typedef struct dfa_state dfa_state;
+struct dfa_state {
+    dfa_state *hash_next;
+    dfa_state *next[256];	/* null until worked out */
+    int *matches[256];		/* patterns matched before each char */
+    int *end_matches;		/* and at the end of the string */
+    rep_bool end_done;
+    unsigned long hash;
+    int flags;
+    int nitems;
+    set_item items[1];
+};
+
+typedef struct ac_node ac_node;
+struct ac_node {
+    ac_node *children, *sibling;
+    ac_node *fail;		/* longest proper suffix in the trie */
+    ac_node *output;		/* nearest suffix ending a pattern */
+    int *patterns;		/* -1 terminated, or null */
+    int c;
+};
+
+typedef struct rep_regset_struct rep_regset;
+struct rep_regset_struct {
+    repv car;
+    rep_regset *next;
+    repv patterns;		/* vector of strings */
+    rep_bool nocase;
+
+    ac_node *root;
+    ac_node *root_next[256];
+
+    int nprogs;
+    rep_regexp **progs;
+    int *prog_pattern;		/* index of each prog in PATTERNS */
+    int *prog_base;		/* first position number of each prog */
+    int npositions;
+    unsigned int *seen, *pending_seen, gen;
+    set_item *consuming, *pending;
+    int nconsuming, npending;
+    int *found;			/* scratch list of matched patterns */
+    int nfound;
+
+    /* for each character, the progs that may match starting with it
+       (-1 terminated); for NUL, those that may match the empty string */
+    int *starters[256];
+
+    dfa_state **buckets;	/* MAX_STATES of them */
+    int nstates;
+    int steps;			/* transitions followed since last flush */
+
+    /* When states are being made faster than they're reused, the
+       automaton is run without keeping them, in this state, for this
+       many characters */
+    dfa_state *scratch;
+    int uncached;
+};
+
+#define REGSETP(v)	rep_CELL16_TYPEP (v, regset_type)
+#define REGSET(v)	((rep_regset *) rep_PTR (v))
+
+static int regset_type;
+static rep_regset *regsets;
+
+
+/* Aho-Corasick */
+
+static ac_node *
+ac_child (ac_node *n, int c)
+{
+    for (n = n->children; n != 0 && n->c != c; n = n->sibling)
+	;
+    return n;
+}
+
+static ac_node *
+ac_new_node (int c)
+{
+    ac_node *n = rep_alloc (sizeof (ac_node));
+    if (n != 0)
+    {
+	memset (n, 0, sizeof (*n));
+	n->c = c;
+    }
+    return n;
+}
+
+static void
+ac_free (ac_node *n)
+{
+    while (n != 0)
+    {
+	ac_node *next = n->sibling;
+	ac_free (n->children);
+	if (n->patterns != 0)
+	    rep_free (n->patterns);
+	rep_free (n);
+	n = next;
+    }
+}
+
+static rep_bool
+add_int (int **list, int value)
+{
+    int n = 0, *tem;
+    if (*list != 0)
+	while ((*list)[n] >= 0)
+	    n++;
+    tem = rep_realloc (*list, sizeof (int) * (n + 2));
+    if (tem == 0)
+	return rep_FALSE;
+    tem[n] = value;
+    tem[n + 1] = -1;
+    *list = tem;
+    return rep_TRUE;
+}
+
+/* Add the LEN bytes at STRING to the trie as pattern number INDEX */
+static rep_bool
+ac_add (rep_regset *set, const char *string, int len, int index)
+{
+    ac_node *n = set->root;
+    int i;
+    for (i = 0; i < len; i++)
+    {
+	int c = UCHARAT (string + i);
+	ac_node *child;
+	if (set->nocase)
+	    c = tolower (c);
+	child = ac_child (n, c);
+	if (child == 0)
+	{
+	    child = ac_new_node (c);
+	    if (child == 0)
+		return rep_FALSE;
+	    child->sibling = n->children;
+	    n->children = child;
+	}
+	n = child;
+    }
+    return add_int (&n->patterns, index);
+}
+
+/* Fill in the suffix links, breadth first from the root */
+static rep_bool
+ac_link (rep_regset *set)
+{
+    ac_node **queue, *n, *child;
+    int count = 0, head = 0, tail = 0, c;
+
+    /* count the nodes */
+    queue = rep_alloc (sizeof (ac_node *));
+    if (queue == 0)
+	return rep_FALSE;
+    queue[tail++] = set->root;
+    while (head < tail)
+    {
+	n = queue[head++];
+	count++;
+	for (child = n->children; child != 0; child = child->sibling)
+	{
+	    ac_node **tem = rep_realloc (queue, sizeof (ac_node *) * (tail + 1));
+	    if (tem == 0)
+	    {
+		rep_free (queue);
+		return rep_FALSE;
+	    }
+	    queue = tem;
+	    queue[tail++] = child;
+	}
+    }
+
+    set->root->fail = 0;
+    for (head = 0; head < tail; head++)
+    {
+	n = queue[head];
+	for (child = n->children; child != 0; child = child->sibling)
+	{
+	    ac_node *f = n->fail;
+	    while (f != 0 && ac_child (f, child->c) == 0)
+		f = f->fail;
+	    child->fail = (f != 0) ? ac_child (f, child->c) : set->root;
+	    child->output = (child->fail->patterns != 0
+			     ? child->fail : child->fail->output);
+	}
+    }
+    rep_free (queue);
+
+    for (c = 0; c < 256; c++)
+    {
+	set->root_next[c] = ac_child (set->root, c);
+	if (set->root_next[c] == 0)
+	    set->root_next[c] = set->root;
+    }
+    return rep_TRUE;
+}
+
+/* Call FOUND for each pattern in the trie occurring in STRING */
+static void
+ac_scan (rep_regset *set, const char *string, void (*found) (int, void *),
+	 void *data)
+{
+    ac_node *n = set->root;
+    const char *ptr;
+    for (ptr = string; *ptr != 0; ptr++)
+    {
+	int c = UCHARAT (ptr);
+	ac_node *out;
+	if (set->nocase)
+	    c = tolower (c);
+	if (n == set->root)
+	    n = set->root_next[c];
+	else
+	{
+	    ac_node *child;
+	    while ((child = ac_child (n, c)) == 0 && n != set->root)
+		n = n->fail;
+	    n = (child != 0) ? child : set->root_next[c];
+	}
+	for (out = (n->patterns != 0 ? n : n->output);
+	     out != 0; out = out->output)
+	{
+	    int *p;
+	    for (p = out->patterns; *p >= 0; p++)
+		found (*p, data);
+	}
+    }
+}
+
+
+/* Lazily built automaton */
+
+static inline int
+position_number (rep_regset *set, const set_item *item)
+{
+    int offset = item->node - set->progs[item->prog]->program;
+    switch (item->sub)
+    {
+    case SUB_NODE: case SUB_EXPLORE:
+	return set->prog_base[item->prog] + offset;
+    case SUB_LOOP:
+	return set->prog_base[item->prog] + offset + 1;
+    default:
+	return set->prog_base[item->prog] + offset + 3 + item->sub;
+    }
+}
+
+static inline void
+add_consuming (rep_regset *set, int prog, char *node, int sub)
+{
+    set_item item;
+    int id;
+    item.node = node;
+    item.sub = sub;
+    item.prog = prog;
+    id = position_number (set, &item);
+    if (set->seen[id] != set->gen)
+    {
+	set->seen[id] = set->gen;
+	set->consuming[set->nconsuming++] = item;
+    }
+}
+
+static inline void
+add_pending (rep_regset *set, int prog, char *node, int sub)
+{
+    set_item item;
+    int id;
+    item.node = node;
+    item.sub = sub;
+    item.prog = prog;
+    id = position_number (set, &item);
+    if (set->pending_seen[id] != set->gen)
+    {
+	set->pending_seen[id] = set->gen;
+	set->pending[set->npending++] = item;
+    }
+}
+
+static inline void
+add_found (rep_regset *set, int pattern)
+{
+    int i;
+    for (i = 0; i < set->nfound; i++)
+    {
+	if (set->found[i] == pattern)
+	    return;
+    }
+    set->found[set->nfound++] = pattern;
+}
+
+/* Follow the nodes of program PROG from NODE that don't consume input,
+   given the state FLAGS and the next character C (zero at the end),
+   collecting the positions that consume it */
+static void
+explore (rep_regset *set, int prog, char *node, int flags, int c)
+{
+    while (node != 0)
+    {
+	int op = OP (node);
+	switch (op)
+	{
+	case END:
+	    add_found (set, set->prog_pattern[prog]);
+	    return;
+
+	case BOL:
+	    if (!(flags & STATE_BOL))
+		return;
+	    break;
+
+	case EOL:
+	    if (c != 0)
+		return;
+	    break;
+
+	case WEDGE: case NWEDGE: {
+	    rep_bool edge = ((flags & STATE_BOL) || c == 0
+			     || (((flags & STATE_WORD) != 0)
+				 != (rep_regword_char_p (c) != 0)));
+	    if (edge != (op == WEDGE))
+		return;
+	    break;
+	}
+
+	case NOTHING: case BACK:
+	    break;
+
+	case BRANCH: {
+	    int id = set->prog_base[prog] + (node - set->progs[prog]->program);
+	    if (set->seen[id] == set->gen)
+		return;
+	    set->seen[id] = set->gen;
+	    if (OP (rep_regnext_node (node)) == BRANCH)
+	    {
+		do {
+		    explore (set, prog, OPERAND (node), flags, c);
+		    node = rep_regnext_node (node);
+		} while (node != 0 && OP (node) == BRANCH);
+		return;
+	    }
+	    node = OPERAND (node);
+	    continue;
+	}
+
+	case STAR: case NGSTAR:
+	    add_consuming (set, prog, node, SUB_NODE);
+	    break;
+
+	case EXACTLY:
+	    add_consuming (set, prog, node, 0);
+	    return;
+
+	default:
+	    if ((op > OPEN && op < OPEN + rep_NSUBEXP)
+		|| (op > CLOSE && op < CLOSE + rep_NSUBEXP))
+		break;
+	    /* PLUS, NGPLUS, or a single character class */
+	    add_consuming (set, prog, node, SUB_NODE);
+	    return;
+	}
+	node = rep_regnext_node (node);
+    }
+}
+
+/* Collect the positions of STATE waiting for the character C (zero at
+   the end of the string), and the patterns that have matched */
+static void
+close_state (rep_regset *set, dfa_state *state, int c)
+{
+    int i, *p;
+
+    set->gen++;
+    set->nconsuming = 0;
+    set->nfound = 0;
+
+    /* a match may start anywhere */
+    for (p = set->starters[c]; *p >= 0; p++)
+    {
+	if (!set->progs[*p]->reganch || (state->flags & STATE_BOL))
+	    explore (set, *p, set->progs[*p]->program + 1, state->flags, c);
+    }
+
+    for (i = 0; i < state->nitems; i++)
+    {
+	set_item *item = &state->items[i];
+	switch (item->sub)
+	{
+	case SUB_EXPLORE:
+	    explore (set, item->prog, item->node, state->flags, c);
+	    break;
+
+	case SUB_LOOP:
+	    add_consuming (set, item->prog, item->node, SUB_LOOP);
+	    explore (set, item->prog, rep_regnext_node (item->node),
+		     state->flags, c);
+	    break;
+
+	default:
+	    add_consuming (set, item->prog, item->node, item->sub);
+	}
+    }
+}
+
+/* Advance the positions collected by close_state over C */
+static void
+step_positions (rep_regset *set, int c)
+{
+    int i;
+    set->npending = 0;
+    for (i = 0; i < set->nconsuming; i++)
+    {
+	set_item *item = &set->consuming[i];
+	char *node = item->node;
+	switch (OP (node))
+	{
+	case STAR: case NGSTAR:
+	    if (rep_regnode_accepts (OPERAND (node), c, set->nocase))
+		add_pending (set, item->prog, node, SUB_EXPLORE);
+	    break;
+
+	case PLUS: case NGPLUS:
+	    if (rep_regnode_accepts (OPERAND (node), c, set->nocase))
+		add_pending (set, item->prog, node, SUB_LOOP);
+	    break;
+
+	case EXACTLY: {
+	    char *string = OPERAND (node);
+	    if (rep_regchar_equal (UCHARAT (string + item->sub),
+				   c, set->nocase))
+	    {
+		if (string[item->sub + 1] != 0)
+		    add_pending (set, item->prog, node, item->sub + 1);
+		else
+		    add_pending (set, item->prog, rep_regnext_node (node),
+				 SUB_EXPLORE);
+	    }
+	    break;
+	}
+
+	default:
+	    if (rep_regnode_accepts (node, c, set->nocase))
+		add_pending (set, item->prog, rep_regnext_node (node),
+			     SUB_EXPLORE);
+	}
+    }
+}
+
+static int
+compare_items (const void *a, const void *b)
+{
+    const set_item *x = a, *y = b;
+    if (x->node != y->node)
+	return x->node < y->node ? -1 : 1;
+    return x->sub - y->sub;
+}
+
+static void
+free_states (rep_regset *set)
+{
+    int i;
+    for (i = 0; i < MAX_STATES; i++)
+    {
+	dfa_state *s = set->buckets[i];
+	while (s != 0)
+	{
+	    dfa_state *next = s->hash_next;
+	    int c;
+	    for (c = 0; c < 256; c++)
+	    {
+		if (s->matches[c] != 0)
+		    rep_free (s->matches[c]);
+	    }
+	    if (s->end_matches != 0)
+		rep_free (s->end_matches);
+	    rep_free (s);
+	    s = next;
+	}
+	set->buckets[i] = 0;
+    }
+    set->nstates = 0;
+}
+
+/* Return the state with FLAGS and the pending positions, making it if
+   necessary. Returns null if out of memory */
+static dfa_state *
+intern_state (rep_regset *set, int flags)
+{
+    unsigned long hash = flags;
+    dfa_state *s;
+    int i;
+
+    qsort (set->pending, set->npending, sizeof (set_item), compare_items);
+    for (i = 0; i < set->npending; i++)
+	hash = hash * 31 + position_number (set, &set->pending[i]);
+
+    for (s = set->buckets[hash % MAX_STATES]; s != 0; s = s->hash_next)
+    {
+	if (s->hash == hash && s->flags == flags
+	    && s->nitems == set->npending
+	    && memcmp (s->items, set->pending,
+		       sizeof (set_item) * set->npending) == 0)
+	    return s;
+    }
+
+    if (set->nstates >= MAX_STATES)
+	free_states (set);
+
+    s = rep_alloc (sizeof (dfa_state)
+		   + sizeof (set_item) * (MAX (set->npending, 1) - 1));
+    if (s == 0)
+	return 0;
+    memset (s, 0, sizeof (dfa_state));
+    s->hash = hash;
+    s->flags = flags;
+    s->nitems = set->npending;
+    memcpy (s->items, set->pending, sizeof (set_item) * set->npending);
+    s->hash_next = set->buckets[hash % MAX_STATES];
+    set->buckets[hash % MAX_STATES] = s;
+    set->nstates++;
+    return s;
+}
+
+/* Return a copy of the patterns found by close_state */
+static int *
+found_list (rep_regset *set)
+{
+    int *list;
+    if (set->nfound == 0)
+	return 0;
+    list = rep_alloc (sizeof (int) * (set->nfound + 1));
+    if (list != 0)
+    {
+	memcpy (list, set->found, sizeof (int) * set->nfound);
+	list[set->nfound] = -1;
+    }
+    return list;
+}
+
+/* Make the scratch state hold the pending positions */
+static dfa_state *
+load_scratch (rep_regset *set, int flags)
+{
+    dfa_state *s = set->scratch;
+    s->flags = flags;
+    s->nitems = set->npending;
+    memcpy (s->items, set->pending, sizeof (set_item) * set->npending);
+    return s;
+}
+
+static inline void
+report (int *list, void (*found) (int, void *), void *data)
+{
+    for (; list != 0 && *list >= 0; list++)
+	found (*list, data);
+}
+
+/* Call FOUND for each regexp (not plain string) in SET matching STRING,
+   whose first character is preceded by PREV, or -1 if it's the
+   beginning of the line. Returns false if out of memory */
+static rep_bool
+dfa_scan (rep_regset *set, const char *string, int prev,
+	  void (*found) (int, void *), void *data)
+{
+    dfa_state *state;
+    const char *ptr;
+    int flags = (prev < 0 ? STATE_BOL
+		 : rep_regword_char_p (prev) ? STATE_WORD : 0);
+
+    set->npending = 0;
+    state = (set->uncached > 0
+	     ? load_scratch (set, flags) : intern_state (set, flags));
+    if (state == 0)
+	return rep_FALSE;
+
+    for (ptr = string; *ptr != 0; ptr++)
+    {
+	int c = UCHARAT (ptr);
+	dfa_state *next;
+
+	flags = rep_regword_char_p (c) ? STATE_WORD : 0;
+	if (state == set->scratch)
+	{
+	    close_state (set, state, c);
+	    set->found[set->nfound] = -1;
+	    report (set->found, found, data);
+	    step_positions (set, c);
+	    state = (--set->uncached > 0
+		     ? load_scratch (set, flags) : intern_state (set, flags));
+	    if (state == 0)
+		return rep_FALSE;
+	    continue;
+	}
+
+	next = state->next[c];
+	set->steps++;
+	if (next == 0)
+	{
+	    int *matches;
+	    close_state (set, state, c);
+	    matches = found_list (set);
+	    step_positions (set, c);
+	    if (set->nstates >= MAX_STATES)
+	    {
+		/* STATE is about to be freed. If few of the states were
+		   used more than once, caching them isn't worth it */
+		report (matches, found, data);
+		if (matches != 0)
+		    rep_free (matches);
+		free_states (set);
+		if (set->steps < 4 * MAX_STATES)
+		    set->uncached = 64 * MAX_STATES;
+		set->steps = 0;
+		state = (set->uncached > 0
+			 ? load_scratch (set, flags)
+			 : intern_state (set, flags));
+		if (state == 0)
+		    return rep_FALSE;
+		continue;
+	    }
+	    next = intern_state (set, flags);
+	    if (next == 0)
+		return rep_FALSE;
+	    state->next[c] = next;
+	    state->matches[c] = matches;
+	}
+	report (state->matches[c], found, data);
+	state = next;
+    }
+
+    if (state == set->scratch)
+    {
+	close_state (set, state, 0);
+	set->found[set->nfound] = -1;
+	report (set->found, found, data);
+    }
+    else
+    {
+	if (!state->end_done)
+	{
+	    close_state (set, state, 0);
+	    state->end_matches = found_list (set);
+	    state->end_done = rep_TRUE;
+	}
+	report (state->end_matches, found, data);
+    }
+    return rep_TRUE;
+}
+
+
+/* Lisp interface */
+
+/* True if the regexp STRING matches only itself, storing the string it
+   matches in *LITERAL (a malloc'd copy of *LEN bytes) */
+static rep_bool
+literal_regexp_p (repv string, char **literal, int *len)
+{
+    const char *ptr = rep_STR (string);
+    char *out;
+    if (rep_STRING_LEN (string) == 0)
+	return rep_FALSE;
+    out = rep_alloc (rep_STRING_LEN (string) + 1);
+    if (out == 0)
+	return rep_FALSE;
+    *literal = out;
+    while (*ptr != 0)
+    {
+	if (strchr ("^$.[()|?+*", *ptr) != 0)
+	    break;
+	else if (*ptr == '\\')
+	{
+	    if (ptr[1] == 0 || strchr ("wWsSdDbB", ptr[1]) != 0)
+		break;
+	    ptr++;
+	}
+	*out++ = *ptr++;
+    }
+    if (*ptr != 0)
+    {
+	rep_free (*literal);
+	return rep_FALSE;
+    }
+    *len = out - *literal;
+    return rep_TRUE;
+}
+
+static void
+free_regset (rep_regset *set)
+{
+    int i;
+    if (set->buckets != 0)
+    {
+	free_states (set);
+	rep_free (set->buckets);
+    }
+    for (i = 0; i < set->nprogs; i++)
+	free (set->progs[i]);
+    if (set->progs != 0)
+	rep_free (set->progs);
+    if (set->prog_pattern != 0)
+	rep_free (set->prog_pattern);
+    if (set->prog_base != 0)
+	rep_free (set->prog_base);
+    if (set->seen != 0)
+	rep_free (set->seen);
+    if (set->pending_seen != 0)
+	rep_free (set->pending_seen);
+    if (set->consuming != 0)
+	rep_free (set->consuming);
+    if (set->pending != 0)
+	rep_free (set->pending);
+    if (set->found != 0)
+	rep_free (set->found);
+    if (set->scratch != 0)
+	rep_free (set->scratch);
+    for (i = 0; i < 256; i++)
+    {
+	if (set->starters[i] != 0)
+	    rep_free (set->starters[i]);
+    }
+    ac_free (set->root);
+}
+
+static rep_bool
+can_start_with (rep_regexp *prog, int c, rep_bool nocase)
+{
+#define IN_FIRST(c) (prog->regfirst[(c) / 8] & (1 << ((c) % 8)))
+    if (!prog->regfirstp)
+	return rep_TRUE;
+    else if (c == 0)
+	return rep_FALSE;
+    else
+	return (IN_FIRST (c)
+		|| (nocase && (IN_FIRST (tolower (c)) || IN_FIRST (toupper (c)))));
+#undef IN_FIRST
+}
+
+static rep_bool
+build_starters (rep_regset *set)
+{
+    int c, i, n;
+    for (c = 0; c < 256; c++)
+    {
+	set->starters[c] = rep_alloc (sizeof (int) * (set->nprogs + 1));
+	if (set->starters[c] == 0)
+	    return rep_FALSE;
+	n = 0;
+	for (i = 0; i < set->nprogs; i++)
+	{
+	    if (can_start_with (set->progs[i], c, set->nocase))
+		set->starters[c][n++] = i;
+	}
+	set->starters[c][n] = -1;
+    }
+    return rep_TRUE;
+}
+
+/* Fill in SET from its vector of patterns, returning false if a regexp
+   couldn't be compiled (having signalled an error) */
+static rep_bool
+build_regset (rep_regset *set)
+{
+    int n = rep_VECT_LEN (set->patterns), i, literals = 0;
+
+    set->root = ac_new_node (0);
+    set->progs = rep_alloc (sizeof (rep_regexp *) * MAX (n, 1));
+    set->prog_pattern = rep_alloc (sizeof (int) * MAX (n, 1));
+    set->prog_base = rep_alloc (sizeof (int) * MAX (n, 1));
+    set->found = rep_alloc (sizeof (int) * (n + 1));
+    set->buckets = rep_alloc (sizeof (dfa_state *) * MAX_STATES);
+    if (set->root == 0 || set->progs == 0 || set->prog_pattern == 0
+	|| set->prog_base == 0 || set->found == 0 || set->buckets == 0)
+    {
+	rep_mem_error ();
+	return rep_FALSE;
+    }
+    memset (set->buckets, 0, sizeof (dfa_state *) * MAX_STATES);
+
+    for (i = 0; i < n; i++)
+    {
+	repv re = rep_VECTI (set->patterns, i);
+	char *literal;
+	int len;
+	if (literal_regexp_p (re, &literal, &len))
+	{
+	    rep_bool ok = ac_add (set, literal, len, i);
+	    rep_free (literal);
+	    if (!ok)
+	    {
+		rep_mem_error ();
+		return rep_FALSE;
+	    }
+	    literals++;
+	}
+	else
+	{
+	    rep_regexp *prog = rep_regcomp (rep_STR (re));
+	    if (prog == 0)
+		return rep_FALSE;
+	    set->prog_pattern[set->nprogs] = i;
+	    set->prog_base[set->nprogs] = set->npositions;
+	    set->npositions += prog->regsize - sizeof (rep_regexp) + 4;
+	    set->progs[set->nprogs++] = prog;
+	}
+    }
+
+    if (literals > 0 && !ac_link (set))
+    {
+	rep_mem_error ();
+	return rep_FALSE;
+    }
+
+    if (set->nprogs > 0)
+    {
+	int np = set->npositions;
+	set->seen = rep_alloc (sizeof (unsigned int) * np);
+	set->pending_seen = rep_alloc (sizeof (unsigned int) * np);
+	set->consuming = rep_alloc (sizeof (set_item) * np);
+	set->pending = rep_alloc (sizeof (set_item) * np);
+	set->scratch = rep_alloc (sizeof (dfa_state) + sizeof (set_item) * np);
+	if (set->seen == 0 || set->pending_seen == 0 || set->consuming == 0
+	    || set->pending == 0 || set->scratch == 0 || !build_starters (set))
+	{
+	    rep_mem_error ();
+	    return rep_FALSE;
+	}
+	memset (set->seen, 0, sizeof (unsigned int) * np);
+	memset (set->pending_seen, 0, sizeof (unsigned int) * np);
+    }
+    return rep_TRUE;
+}
+
+DEFUN("make-regexp-set", Fmake_regexp_set, Smake_regexp_set,
+      (repv patterns, repv nocasep), rep_Subr2) /*
+::doc:rep.regexp#make-regexp-set::
+make-regexp-set PATTERNS [IGNORE-CASE-P]
+
+Return a regexp set made from the list or vector of regexp strings
+PATTERNS, for use with `regexp-set-match'. When IGNORE-CASE-P is
+non-nil the case of matched strings is ignored (though as with
+`string-match', character classes are case-significant).
+::end:: */
+{
+    rep_regset *set;
+    repv vec;
+    rep_GC_root gc_vec;
+    int i;
+
+    if (rep_CONSP (patterns) || patterns == Qnil)
+    {
+	repv len = Flength (patterns);
+	if (len == rep_NULL)
+	    return rep_NULL;
+	vec = rep_make_vector (rep_INT (len));
+	for (i = 0; vec != rep_NULL && rep_CONSP (patterns); i++)
+	{
+	    rep_VECTI (vec, i) = rep_CAR (patterns);
+	    patterns = rep_CDR (patterns);
+	}
+    }
+    else if (rep_VECTORP (patterns))
+	vec = Fcopy_sequence (patterns);
+    else
+	return rep_signal_arg_error (patterns, 1);
+    if (vec == rep_NULL)
+	return rep_NULL;
+    for (i = 0; i < rep_VECT_LEN (vec); i++)
+    {
+	if (!rep_STRINGP (rep_VECTI (vec, i)))
+	    return rep_signal_arg_error (rep_VECTI (vec, i), 1);
+    }
+
+    set = rep_ALLOC_CELL (sizeof (rep_regset));
+    if (set == 0)
+	return rep_mem_error ();
+    rep_data_after_gc += sizeof (rep_regset);
+    memset (set, 0, sizeof (rep_regset));
+    set->car = regset_type;
+    set->patterns = vec;
+    set->nocase = !rep_NILP (nocasep);
+    set->next = regsets;
+    regsets = set;
+
+    rep_PUSHGC (gc_vec, vec);
+    if (!build_regset (set))
+    {
+	rep_POPGC;
+	/* leave it for the GC to free */
+	return rep_NULL;
+    }
+    rep_POPGC;
+    return rep_VAL (set);
+}
+
+DEFUN("regexp-set-p", Fregexp_set_p, Sregexp_set_p, (repv arg), rep_Subr1) /*
+::doc:rep.regexp#regexp-set-p::
+regexp-set-p ARG
+
+Return t if ARG is a regexp set.
+::end:: */
+{
+    return REGSETP (arg) ? Qt : Qnil;
+}
+
+struct scan_result {
+    char *matched;		/* flag for each pattern */
+    int lowest;
+};
+
+static void
+record_match (int pattern, void *data)
+{
+    struct scan_result *r = data;
+    r->matched[pattern] = 1;
+    if (r->lowest < 0 || pattern < r->lowest)
+	r->lowest = pattern;
+}
+
+DEFUN("regexp-set-match", Fregexp_set_match, Sregexp_set_match,
+      (repv set, repv string, repv start, repv all), rep_Subr4) /*
+::doc:rep.regexp#regexp-set-match::
+regexp-set-match REGEXP-SET STRING [START] [ALL]
+
+Return the index of the first regexp, in the list that REGEXP-SET was
+made from, that matches some part of STRING (from the character START,
+if given), or nil if none do. If ALL is non-nil, return the list of
+the indices of all the regexps that match, in increasing order.
+
+The match data isn't changed.
+::end:: */
+{
+    rep_regset *s;
+    struct scan_result r;
+    const char *ptr;
+    int n, i;
+
+    rep_DECLARE1 (set, REGSETP);
+    rep_DECLARE2 (string, rep_STRINGP);
+    rep_DECLARE3_OPT (start, rep_INTP);
+    if (rep_INTP (start)
+	&& (rep_INT (start) < 0 || rep_INT (start) > rep_STRING_LEN (string)))
+    {
+	return rep_signal_arg_error (start, 3);
+    }
+
+    s = REGSET (set);
+    n = rep_VECT_LEN (s->patterns);
+    ptr = rep_STR (string) + (rep_INTP (start) ? rep_INT (start) : 0);
+
+    r.matched = alloca (MAX (n, 1));
+    memset (r.matched, 0, n);
+    r.lowest = -1;
+
+    if (s->root->children != 0)
+	ac_scan (s, ptr, record_match, &r);
+    if (s->nprogs > 0
+	&& !dfa_scan (s, ptr, ptr == rep_STR (string) ? -1 : UCHARAT (ptr - 1),
+		      record_match, &r))
+    {
+	return rep_mem_error ();
+    }
+
+    if (rep_NILP (all))
+	return r.lowest >= 0 ? rep_MAKE_INT (r.lowest) : Qnil;
+    else
+    {
+	repv out = Qnil;
+	for (i = n - 1; i >= 0; i--)
+	{
+	    if (r.matched[i])
+		out = Fcons (rep_MAKE_INT (i), out);
+	}
+	return out;
+    }
+}
+
+static void
+regset_mark (repv val)
+{
+    rep_MARKVAL (REGSET (val)->patterns);
+}
+
+static void
+regset_sweep (void)
+{
+    rep_regset *x = regsets;
+    regsets = 0;
+    while (x != 0)
+    {
+	rep_regset *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (x)))
+	{
+	    free_regset (x);
+	    rep_FREE_CELL (x);
+	}
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (x));
+	    x->next = regsets;
+	    regsets = x;
+	}
+	x = next;
+    }
+}
+
+static void
+regset_print (repv stream, repv arg)
+{
+    char buf[64];
+    snprintf (buf, sizeof (buf), "#<regexp-set %d>",
+	      (int) rep_VECT_LEN (REGSET (arg)->patterns));
+    rep_stream_puts (stream, buf, -1, rep_FALSE);
+}
+
+void
+rep_regset_init (void)
+{
+    repv tem;
+    regset_type = rep_register_new_type ("regexp-set", 0, regset_print,
+					 regset_print, regset_sweep,
+					 regset_mark, 0, 0, 0, 0, 0, 0, 0);
+    tem = rep_push_structure ("rep.regexp");
+    rep_ADD_SUBR (Smake_regexp_set);
+    rep_ADD_SUBR (Sregexp_set_p);
+    rep_ADD_SUBR (Sregexp_set_match);
+    rep_pop_structure (tem);
+}
@@ -27,6 +27,18 @@
 
 #include "md5.h"
 
+typedef struct md5_context_struct {
+    repv car;
+    struct md5_context_struct *next;
+    struct md5_ctx ctx;
+} md5_context;
+
+static int md5_context_type;
+static md5_context *md5_contexts;
+
+#define MD5_CONTEXT(v)	((md5_context *) rep_PTR (v))
+#define MD5_CONTEXTP(v)	rep_CELL16_TYPEP (v, md5_context_type)
+
 static repv
 digest_to_repv (char digest[16])
 {
@@ -41,8 +53,10 @@ digest_to_repv (char digest[16])
 
     for (i = 0; i < 16; i++)
     {
-	hex_digest[i*2] = hex_digits[digest[i] & 15];
-	hex_digest[i*2+1] = hex_digits[digest[i] >> 4];
+	/* Bytes above 127 would index before hex_digits if signed */
+	unsigned char byte = digest[i];
+	hex_digest[i*2] = hex_digits[byte & 15];
+	hex_digest[i*2+1] = hex_digits[byte >> 4];
     }
 
     return rep_parse_number (hex_digest, 32, 16, 1, 0);
@@ -92,11 +106,225 @@ the local filing system). The returned integer will have no more than
     return digest_to_repv (digest);
 }
 
+DEFUN ("md5-strings", Fmd5_strings, Smd5_strings, (repv strings), rep_Subr1) /*
+::doc:rep.util.md5#md5-strings::
+md5-strings VECTOR
+
+Return a vector of the MD5 message digests of each of the strings in
+VECTOR, as `md5-string' would. Several strings are digested at once,
+so this is faster than calling `md5-string' on each.
+::end:: */
+{
+    const char **buffers;
+    size_t *lens;
+    unsigned char *digests;
+    repv out = Qnil;
+    long i, n;
+
+    rep_DECLARE1 (strings, rep_VECTORP);
+    n = rep_VECT_LEN (strings);
+    for (i = 0; i < n; i++)
+    {
+	if (!rep_STRINGP (rep_VECTI (strings, i)))
+	    return rep_signal_arg_error (rep_VECTI (strings, i), 1);
+    }
+    if (n == 0)
+	return Fmake_vector (rep_MAKE_INT (0), Qnil);
+
+    buffers = rep_alloc (n * sizeof (char *));
+    lens = rep_alloc (n * sizeof (size_t));
+    digests = rep_alloc (n * 16);
+    if (buffers != 0 && lens != 0 && digests != 0)
+    {
+	rep_GC_root gc_out;
+	for (i = 0; i < n; i++)
+	{
+	    buffers[i] = rep_STR (rep_VECTI (strings, i));
+	    lens[i] = rep_STRING_LEN (rep_VECTI (strings, i));
+	}
+	md5_buffers (buffers, lens, n, digests);
+
+	out = Fmake_vector (rep_MAKE_INT (n), Qnil);
+	rep_PUSHGC (gc_out, out);
+	for (i = 0; out && i < n; i++)
+	{
+	    repv d = digest_to_repv ((char *) digests + i * 16);
+	    if (d == rep_NULL)
+		out = rep_NULL;
+	    else
+		rep_VECTI (out, i) = d;
+	}
+	rep_POPGC;
+    }
+    else
+	out = rep_mem_error ();
+
+    rep_free (buffers);
+    rep_free (lens);
+    rep_free (digests);
+    return out;
+}
+
+DEFUN ("make-md5-context", Fmake_md5_context,
+       Smake_md5_context, (void), rep_Subr0) /*
+::doc:rep.util.md5#make-md5-context::
+make-md5-context
+
+Return a new MD5 context, to which data may be added by `md5-update'. The
+digest of all the data added so far is returned by `md5-final'.
+::end:: */
+{
+    md5_context *c = rep_ALLOC_CELL (sizeof (md5_context));
+    if (c == 0)
+	return rep_mem_error ();
+    rep_data_after_gc += sizeof (md5_context);
+    c->car = md5_context_type;
+    md5_init_ctx (&c->ctx);
+    c->next = md5_contexts;
+    md5_contexts = c;
+    return rep_VAL (c);
+}
+
+DEFUN ("md5-update", Fmd5_update, Smd5_update,
+       (repv context, repv data), rep_Subr2) /*
+::doc:rep.util.md5#md5-update::
+md5-update MD5-CONTEXT DATA
+
+Add DATA to the bytes digested by MD5-CONTEXT. DATA may be a string, or
+an input stream that is read until its end. Returns MD5-CONTEXT.
+::end:: */
+{
+    struct md5_ctx *ctx;
+
+    rep_DECLARE1 (context, MD5_CONTEXTP);
+    ctx = &MD5_CONTEXT (context)->ctx;
+
+    if (rep_STRINGP (data))
+	md5_process_bytes (rep_STR (data), rep_STRING_LEN (data), ctx);
+    else if (rep_FILEP (data) && rep_LOCAL_FILE_P (data)
+	     && rep_FILE (data)->file.fh != 0)
+    {
+	FILE *fh = rep_FILE (data)->file.fh;
+	char buf[BUFSIZ];
+	size_t n;
+	while ((n = fread (buf, 1, sizeof (buf), fh)) > 0)
+	{
+	    md5_process_bytes (buf, n, ctx);
+	    rep_TEST_INT;
+	    if (rep_INTERRUPTP)
+		return rep_NULL;
+	}
+	/* The lines read weren't counted */
+	rep_FILE (data)->car |= rep_LFF_BOGUS_LINE_NUMBER;
+	if (ferror (fh))
+	    return rep_signal_file_error (data);
+    }
+    else
+    {
+	rep_GC_root gc_context, gc_data;
+	char buf[BUFSIZ];
+	int c, i = 0;
+	rep_PUSHGC (gc_context, context);
+	rep_PUSHGC (gc_data, data);
+	while ((c = rep_stream_getc (data)) != EOF)
+	{
+	    buf[i++] = c;
+	    if (i == sizeof (buf))
+	    {
+		md5_process_bytes (buf, i, ctx);
+		i = 0;
+		rep_TEST_INT;
+		if (rep_INTERRUPTP)
+		    break;
+	    }
+	}
+	rep_POPGC; rep_POPGC;
+	if (rep_INTERRUPTP)
+	    return rep_NULL;
+	md5_process_bytes (buf, i, ctx);
+    }
+    return context;
+}
+
+DEFUN ("md5-final", Fmd5_final, Smd5_final, (repv context), rep_Subr1) /*
+::doc:rep.util.md5#md5-final::
+md5-final MD5-CONTEXT
+
+Return the integer representing the MD5 message digest of the data
+added to MD5-CONTEXT, as `md5-string' would. More data may still be
+added to MD5-CONTEXT afterwards.
+::end:: */
+{
+    struct md5_ctx ctx;
+    char digest[16];
+
+    rep_DECLARE1 (context, MD5_CONTEXTP);
+    ctx = MD5_CONTEXT (context)->ctx;
+    md5_finish_ctx (&ctx, digest);
+    return digest_to_repv (digest);
+}
+
+DEFUN ("md5-context-p", Fmd5_context_p,
+       Smd5_context_p, (repv arg), rep_Subr1) /*
+::doc:rep.util.md5#md5-context-p::
+md5-context-p ARG
+
+Returns t if ARG is an MD5 context (created by `make-md5-context').
+::end:: */
+{
+    return MD5_CONTEXTP (arg) ? Qt : Qnil;
+}
+
+
+
+static void
+md5_context_sweep (void)
+{
+    md5_context *x = md5_contexts;
+    md5_contexts = 0;
+    while (x != 0)
+    {
+	md5_context *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (x)))
+	    rep_FREE_CELL (x);
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (x));
+	    x->next = md5_contexts;
+	    md5_contexts = x;
+	}
+	x = next;
+    }
+}
+
+static void
+md5_context_mark (repv val)
+{
+}
+
+static void
+md5_context_print (repv stream, repv arg)
+{
+    rep_stream_puts (stream, "#<md5-context>", -1, rep_FALSE);
+}
+
 repv
 rep_dl_init (void)
 {
-    repv tem = rep_push_structure ("rep.util.md5");
+    repv tem;
+    md5_context_type = rep_register_new_type ("md5-context", rep_ptr_cmp,
+					      md5_context_print,
+					      md5_context_print,
+					      md5_context_sweep,
+					      md5_context_mark,
+					      0, 0, 0, 0, 0, 0, 0);
+    tem = rep_push_structure ("rep.util.md5");
     rep_ADD_SUBR(Smd5_string);
     rep_ADD_SUBR(Smd5_local_file);
+    rep_ADD_SUBR(Smd5_strings);
+    rep_ADD_SUBR(Smake_md5_context);
+    rep_ADD_SUBR(Smd5_update);
+    rep_ADD_SUBR(Smd5_final);
+    rep_ADD_SUBR(Smd5_context_p);
     return rep_pop_structure (tem);
 }
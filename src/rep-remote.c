@@ -71,7 +71,7 @@
 #define S_ISSOCK(mode)  (((mode) & S_IFMT) == S_IFSOCK)
 #endif
 
-#define PROTOCOL_VERSION 1
+#define PROTOCOL_VERSION 2
 
 
 /* trivia */
@@ -87,20 +87,129 @@ x_perror (char *fmt, ...)
     exit (10);
 }
 
+/* All I/O goes through these buffers. Output is only flushed when
+   there's no more input waiting, so that the replies to a batch of
+   pipelined requests leave in as few writes as possible. */
+
+#define IO_BUFSIZ 65536
+
+static char in_buf[IO_BUFSIZ];
+static int in_pos, in_len;
+
+static char out_buf[IO_BUFSIZ];
+static int out_len;
+
+static void
+write_all (char *buf, long length)
+{
+    while (length > 0)
+    {
+	long this = write (1, buf, length);
+	if (this < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    x_perror ("write");
+	}
+	buf += this;
+	length -= this;
+    }
+}
+
+static void
+flush_output (void)
+{
+    if (out_len > 0)
+    {
+	write_all (out_buf, out_len);
+	out_len = 0;
+    }
+}
+
+static void
+send_bytes (char *buf, long length)
+{
+    if (out_len + length > IO_BUFSIZ)
+    {
+	flush_output ();
+	if (length > IO_BUFSIZ)
+	{
+	    write_all (buf, length);
+	    return;
+	}
+    }
+    memcpy (out_buf + out_len, buf, length);
+    out_len += length;
+}
+
+static int
+fill_input (void)
+{
+    flush_output ();
+    do {
+	in_len = read (0, in_buf, IO_BUFSIZ);
+    } while (in_len < 0 && errno == EINTR);
+    in_pos = 0;
+    if (in_len <= 0)
+    {
+	in_len = 0;
+	return 0;
+    }
+    return 1;
+}
+
+/* Read up to LENGTH bytes into BUF, taking any that are already
+   buffered first. Returns the number of bytes read, zero at EOF */
+static long
+read_some (char *buf, long length)
+{
+    long this;
+    if (in_pos == in_len)
+    {
+	if (length >= IO_BUFSIZ)
+	{
+	    flush_output ();
+	    do {
+		this = read (0, buf, length);
+	    } while (this < 0 && errno == EINTR);
+	    return this < 0 ? 0 : this;
+	}
+	if (!fill_input ())
+	    return 0;
+    }
+    this = in_len - in_pos;
+    if (this > length)
+	this = length;
+    memcpy (buf, in_buf + in_pos, this);
+    in_pos += this;
+    return this;
+}
+
+static void
+read_bytes (char *buf, long length, char *what)
+{
+    while (length > 0)
+    {
+	long this = read_some (buf, length);
+	if (this == 0)
+	    x_perror (what);
+	buf += this;
+	length -= this;
+    }
+}
+
 static void
 send_char (char c)
 {
-    if (write (1, &c, 1) != 1)
-	x_perror ("send_char");
+    send_bytes (&c, 1);
 }    
 
 static int
 read_char (void)
 {
-    char c;
-    if (read (0, &c, 1) != 1)
+    if (in_pos == in_len && !fill_input ())
 	return EOF;
-    return c;
+    return (unsigned char) in_buf[in_pos++];
 }
 
 static void
@@ -108,16 +217,14 @@ send_long (long value)
 {
     char lbuf[10];
     sprintf (lbuf, "%08lx", value);
-    if (write (1, lbuf, 8) != 8)
-	x_perror ("send_long");
+    send_bytes (lbuf, 8);
 }
 
 static long
 read_long ()
 {
     char lbuf[10];
-    if (read (0, lbuf, 8) != 8)
-	x_perror ("read_long");
+    read_bytes (lbuf, 8, "read_long");
     lbuf[8] = 0;
     return strtol (lbuf, 0, 16);
 }
@@ -127,8 +234,7 @@ send_string (char *string)
 {
     long length = strlen (string);
     send_long (length);
-    if (write (1, string, length) != length)
-	x_perror ("send_string");
+    send_bytes (string, length);
 }
 
 static char *
@@ -136,8 +242,7 @@ read_string ()
 {
     long length = read_long ();
     char *buf = malloc (length + 1);
-    if (read (0, buf, length) != length)
-	x_perror ("read_string");
+    read_bytes (buf, length, "read_string");
     buf[length] = 0;
     return buf;
 }
@@ -245,61 +350,63 @@ static void
 do_get (int argc, char **argv)
 {
     struct stat st;
+    int fd;
     assert (argc == 1);
-    if (stat (argv[0], &st) == 0 && S_ISREG (st.st_mode))
+    if (stat (argv[0], &st) != 0 || !S_ISREG (st.st_mode))
+	send_errno (EISDIR);		/* ?? */
+    else if ((fd = open (argv[0], O_RDONLY)) < 0)
+	send_errno (errno);
+    else
     {
-	FILE *fh = fopen (argv[0], "r");
-	if (fh != 0)
+	unsigned long size = st.st_size;
+	send_success ();
+	send_long (size);
+	flush_output ();
+	while (size > 0)
 	{
-	    unsigned long size = st.st_size;
-	    send_success ();
-	    send_long (size);
-	    while (size > 0)
-	    {
-		char buf[BUFSIZ];
-		int this = (size > BUFSIZ ? BUFSIZ : size);
-		this = fread (buf, 1, this, fh);
-		if (this == 0)
-		    x_perror ("get-read");
-		if (write (1, buf, this) != this)
-		    x_perror ("get-write");
-		size -= this;
-	    }
-	    fclose (fh);
+	    char buf[IO_BUFSIZ];
+	    long this = (size > IO_BUFSIZ ? IO_BUFSIZ : size);
+	    this = read (fd, buf, this);
+	    if (this < 0 && errno == EINTR)
+		continue;
+	    if (this <= 0)
+		x_perror ("get-read");
+	    write_all (buf, this);
+	    size -= this;
 	}
-	else
-	    send_errno (errno);
+	close (fd);
     }
-    else
-	send_errno (EISDIR);		/* ?? */
 }
 
 static void
 do_put (int argc, char **argv)
 {
     FILE *fh;
+    long todo;
+    int error;
     assert (argc == 1);
     fh = fopen (argv[0], "w");
+    error = errno;
+    /* The data follows the command whether or not the file could be
+       opened, so it always has to be consumed */
+    todo = read_long ();
+    while (todo > 0)
+    {
+	char buf[IO_BUFSIZ];
+	long this = read_some (buf, todo > IO_BUFSIZ ? IO_BUFSIZ : todo);
+	if (this == 0)
+	    x_perror ("put-read");
+	if (fh != 0 && fwrite (buf, 1, this, fh) != this)
+	    x_perror ("put-write");
+	todo -= this;
+    }
     if (fh != 0)
     {
-	long size = read_long ();
-	long todo = size;
-	while (todo > 0)
-	{
-	    char buf[BUFSIZ];
-	    int this = (todo > BUFSIZ ? BUFSIZ : todo);
-	    this = read (0, buf, this);
-	    if (this < 0)
-		x_perror ("put-read");
-	    if (fwrite (buf, 1, this, fh) != this)
-		x_perror ("put-write");
-	    todo -= this;
-	}
 	fclose (fh);
 	send_success ();
     }
     else
-	send_errno (errno);	    
+	send_errno (error);
 }
 
 static void
@@ -358,9 +465,9 @@ do_cp (int argc, char **argv)
 	    if(fstat(srcf, &statb) == 0)
 		chmod(argv[1], statb.st_mode);
 	    do {
-		char buf[BUFSIZ];
+		char buf[IO_BUFSIZ];
 		int wr;
-		rd = read(srcf, buf, BUFSIZ);
+		rd = read(srcf, buf, IO_BUFSIZ);
 		if(rd < 0)
 		    x_perror ("copy-read");
 		wr = write(dstf, buf, rd);
@@ -510,9 +617,21 @@ main (int argc, char **argv)
 	int command, nargs, i;
 
 	command = read_char ();
+	if (command == '#')
+	{
+	    /* #TAG COMMAND: echo the tag in front of COMMAND's reply,
+	       so that a client with several requests in flight can
+	       match up the replies */
+	    send_char ('#');
+	    send_long (read_long ());
+	    command = read_char ();
+	}
 	nargs = read_char ();
 	if (command == EOF || nargs == EOF)
+	{
+	    flush_output ();
 	    return 0;
+	}
 	assert (nargs < 64);
 
 	for (i = 0; i < nargs; i++)
@@ -566,6 +685,7 @@ main (int argc, char **argv)
 	    break;
 
 	case 'Q':			/* quit */
+	    flush_output ();
 	    return 0;
 
 	case '\n': case '\r':		/* ignored */
@@ -225,8 +225,9 @@ typedef struct {
 #define rep_CDR(v)	(rep_CONS(v)->cdr)
 #define rep_CDRLOC(v)	(&(rep_CONS(v)->cdr))
 
-/* Get the cdr when GC is in progress. */
-#define rep_GCDR(v)	(rep_CDR(v) & ~rep_VALUE_CONS_MARK_BIT)
+/* Get the cdr when GC is in progress. Mark bits are no longer stored
+   in the cdr, so this is the same as rep_CDR. */
+#define rep_GCDR(v)	rep_CDR(v)
 
 /* True if cons cell V is mutable (i.e. not read-only). */
 #define rep_CONS_WRITABLE_P(v) \
@@ -278,6 +279,12 @@ typedef struct rep_type_struct {
     /* When non-null, a function to ``unbind'' OBJ, the result of
        the earlier bind call. */
     void (*unbind)(repv obj);
+
+    /* When non-null, returns the file descriptor that output to the
+       stream OBJ may be written to directly, after sending anything
+       it has buffered, or -1 if there isn't one. Not an argument of
+       rep_register_new_type (); set it in the type afterwards. */
+    int (*fd)(repv obj);
 } rep_type;
 
 /* Each type of Lisp object has a type code associated with it.
@@ -389,6 +396,19 @@ typedef struct rep_string_struct {
    are made from C string-constants and usually in read-only storage. */
 #define rep_STRING_WRITABLE_P(s) (!rep_CELL_STATIC_P(s))
 
+/* Strings are marked in their block's bitmap, so the cell mark bit is
+   free to flag strings whose characters are shared: either a slice
+   pointing into another string's data, or a string that has slices.
+   Anything writing into a string's characters must unshare it first. */
+#define rep_STRING_SHARED_BIT	rep_CELL_MARK_BIT
+#define rep_STRING_SHARED_P(s)	(rep_STRING(s)->car & rep_STRING_SHARED_BIT)
+
+#define rep_STRING_UNSHARE(s)			\
+    do {					\
+	if (rep_STRING_SHARED_P (s))		\
+	    rep_string_unshare (s);		\
+    } while (0)
+
 /* Define a variable V, containing a static string S. This must be cast
    to a repv via the rep_VAL() macro when using. */
 #define DEFSTRING(v, s)					\
@@ -409,7 +429,7 @@ typedef struct rep_string_struct {
 /* symbol object, actual allocated as a tuple */
 typedef struct {
     repv car;				/* bits 8->11 are flags */
-    repv next;				/* next symbol in rep_obarray bucket */
+    repv next;				/* name's hash once interned, or null */
     repv name;
 } rep_symbol;
 
@@ -444,6 +464,10 @@ typedef struct {
 
 #define rep_SF_LITERAL	(1 << (rep_CELL8_TYPE_BITS + 8))
 
+/* Set while the symbol has a dynamic binding in rep_special_bindings,
+   i.e. while it has an entry in the value cell table in symbols.c */
+#define rep_SF_BOUND	(1 << (rep_CELL8_TYPE_BITS + 9))
+
 #define rep_SYM(v)		((rep_symbol *)rep_PTR(v))
 #define rep_SYMBOLP(v)		rep_CELL8_TYPEP(v, rep_Symbol)
 
@@ -673,31 +697,74 @@ typedef struct rep_funarg_struct {
 #define rep_GC_SET_CELL(v)	(rep_PTR(v)->car |= rep_CELL_MARK_BIT)
 #define rep_GC_CLR_CELL(v)	(rep_PTR(v)->car &= ~rep_CELL_MARK_BIT)
 
+/* Cons cells and string headers are allocated in blocks of
+   rep_CELLBLK_BYTES bytes, aligned to that size. Their mark bits are
+   kept in a bitmap in the header of the block (one bit per two-word
+   slot, counting from the start of the block), so that marking and
+   sweeping never need to write to the live cells themselves. */
+
+#define rep_CELLBLK_SLOTS	1024
+#define rep_CELLBLK_BYTES	(rep_CELLBLK_SLOTS * sizeof (rep_cons))
+
+typedef struct rep_cell_block_header_struct {
+    void *next;
+    void *base;				/* address to pass to free () */
+    repv mark[rep_CELLBLK_SLOTS / rep_VALUE_BITS];
+} rep_cell_block_header;
+
+/* Number of slots at the start of each block taken by the header. */
+#define rep_CELLBLK_HEADER_SLOTS \
+    ((sizeof (rep_cell_block_header) + sizeof (rep_cons) - 1) \
+     / sizeof (rep_cons))
+
+#define rep_CELLBLK_HEADER(v) \
+    ((rep_cell_block_header *) ((v) & ~(repv) (rep_CELLBLK_BYTES - 1)))
+#define rep_CELLBLK_INDEX(v) \
+    (((v) & (rep_CELLBLK_BYTES - 1)) / sizeof (rep_cons))
+#define rep_CELLBLK_MARK_WORD(v) \
+    (rep_CELLBLK_HEADER(v)->mark[rep_CELLBLK_INDEX(v) / rep_VALUE_BITS])
+#define rep_CELLBLK_MARK_BIT(v) \
+    (rep_VALUE_CONST(1) << (rep_CELLBLK_INDEX(v) % rep_VALUE_BITS))
+
 /* gc macros for cons values */
-#define rep_GC_CONS_MARKEDP(v)	(rep_CDR(v) & rep_VALUE_CONS_MARK_BIT)
-#define rep_GC_SET_CONS(v)	(rep_CDR(v) |= rep_VALUE_CONS_MARK_BIT)
-#define rep_GC_CLR_CONS(v)	(rep_CDR(v) &= ~rep_VALUE_CONS_MARK_BIT)
+#define rep_GC_CONS_MARKEDP(v) \
+    (rep_CELLBLK_MARK_WORD(v) & rep_CELLBLK_MARK_BIT(v))
+#define rep_GC_SET_CONS(v) \
+    (rep_CELLBLK_MARK_WORD(v) |= rep_CELLBLK_MARK_BIT(v))
+#define rep_GC_CLR_CONS(v) \
+    (rep_CELLBLK_MARK_WORD(v) &= ~rep_CELLBLK_MARK_BIT(v))
+
+/* gc macros for string values; static strings are never collected
+   so they count as being marked */
+#define rep_GC_STRING_MARKEDP(v) \
+    (rep_CELL_STATIC_P(v) || rep_GC_CONS_MARKEDP(v))
+#define rep_GC_SET_STRING(v)	rep_GC_SET_CONS(v)
 
 /* True when cell V has been marked. */
-#define rep_GC_MARKEDP(v) \
-    (rep_CELL_CONS_P(v) ? rep_GC_CONS_MARKEDP(v) : rep_GC_CELL_MARKEDP(v))
+#define rep_GC_MARKEDP(v)						\
+    (rep_CELL_CONS_P(v)							\
+     ? (!rep_CONS_WRITABLE_P(v) || rep_GC_CONS_MARKEDP(v))		\
+     : rep_CELL8_TYPE(v) == rep_String ? rep_GC_STRING_MARKEDP(v)	\
+     : rep_GC_CELL_MARKEDP(v))
 
 /* Set the mark bit of cell V. */
-#define rep_GC_SET(v)		\
-    do {			\
-	if(rep_CELLP(v))	\
-	    rep_GC_SET_CELL(v);	\
-	else			\
-	    rep_GC_SET_CONS(v);	\
+#define rep_GC_SET(v)				\
+    do {					\
+	if(rep_CELL_CONS_P(v))			\
+	    rep_GC_SET_CONS(v);			\
+	else if(rep_STRINGP(v))			\
+	    rep_GC_SET_STRING(v);		\
+	else					\
+	    rep_GC_SET_CELL(v);			\
     } while(0)
 
 /* Clear the mark bit of cell V. */
-#define rep_GC_CLR(v)		\
-    do {			\
-	if(rep_CELLP(v))	\
-	    rep_GC_CLR_CELL(v);	\
-	else			\
-	    rep_GC_CLR_CONS(v);	\
+#define rep_GC_CLR(v)				\
+    do {					\
+	if(rep_CELL_CONS_P(v) || rep_STRINGP(v))	\
+	    rep_GC_CLR_CONS(v);			\
+	else					\
+	    rep_GC_CLR_CELL(v);			\
     } while(0)
 
 /* Recursively mark object V. */
@@ -932,4 +999,9 @@ extern repv Qnil;
 
 #define rep_TIMEP(v) rep_CONSP(v)
 
+
+/* Resolved function handles for calling Lisp from C (see handles.c) */
+
+typedef struct rep_fun_handle_struct rep_fun_handle;
+
 #endif /* REP_LISP_H */
@@ -12,7 +12,8 @@
 
 typedef enum rep_regtype {
     rep_reg_string = 0,
-    rep_reg_obj
+    rep_reg_obj,
+    rep_reg_inherit		/* saved data: use the next record's */
 } rep_regtype;
 
 typedef union rep_regsubs {
@@ -34,6 +35,10 @@ typedef struct rep_regexp {
 	char reganch;		/* Internal use only. */
 	char *regmust;		/* Internal use only. */
 	int regmlen;		/* Internal use only. */
+	char *regprefix;	/* Internal use only. */
+	int regplen;		/* Internal use only. */
+	char regfirstp;		/* Internal use only. */
+	unsigned char regfirst[32]; /* Internal use only. */
 	int regsize;		/* actual size of regexp structure */
 	char program[1];	/* Unwarranted chumminess with compiler. */
 } rep_regexp;
@@ -58,8 +63,11 @@ struct rep_saved_regexp_data {
 extern rep_regexp *rep_regcomp(char *);
 extern int rep_regexec2(rep_regexp *, char *, int);
 extern int rep_regmatch_string(rep_regexp *, char *, int);
+extern int rep_regexec_nfa(rep_regexp *, char *, int, int);
+extern char *rep_regexp_next_start(rep_regexp *, char *, int);
 
 extern int rep_regexp_max_depth;
+extern int rep_regexp_backtrack_limit;
 
 
 /* Only include the internal stuff if it's explicitly requested, since
@@ -159,6 +167,64 @@ extern int rep_regexp_max_depth;
  */
 #define	MAGIC	0234
 
+/* Helpers for the matchers that interpret the program directly */
+
+#include <ctype.h>
+#include <string.h>
+
+static inline char *
+rep_regnext_node (char *p)
+{
+    int offset = NEXT (p);
+    if (offset == 0)
+	return 0;
+    return OP (p) == BACK ? p - offset : p + offset;
+}
+
+static inline int
+rep_regword_char_p (int c)
+{
+    return c == '_' || isalnum (c);
+}
+
+static inline int
+rep_regchar_equal (int a, int b, int nocase)
+{
+    return a == b || (nocase && toupper (a) == toupper (b));
+}
+
+/* True if the single-character node NODE accepts C, which isn't the
+   terminating null */
+static inline int
+rep_regnode_accepts (char *node, int c, int nocase)
+{
+    switch (OP (node))
+    {
+    case ANY:
+	return 1;
+    case EXACTLY:
+	return rep_regchar_equal (*(unsigned char *) OPERAND (node), c, nocase);
+    case ANYOF:
+	return strchr (OPERAND (node), c) != 0;
+    case ANYBUT:
+	return strchr (OPERAND (node), c) == 0;
+    case WORD:
+	return rep_regword_char_p (c);
+    case NWORD:
+	return !rep_regword_char_p (c);
+    case WSPC:
+	return isspace (c) != 0;
+    case NWSPC:
+	return !isspace (c);
+    case DIGI:
+	return isdigit (c) != 0;
+    case NDIGI:
+	return !isdigit (c);
+    default:
+	return 0;
+    }
+}
+
 #endif /* rep_NEED_REGEXP_INTERNALS */
 
 #endif /* REP_REGEXP_H */
@@ -28,6 +28,14 @@
 #define inline
 #endif
 
+/* from codecs.c */
+extern repv Fbase64_encode_string (repv);
+extern repv Fbase64_decode_string (repv);
+extern repv Fbase64_encode_stream (repv, repv);
+extern repv Fbase64_decode_stream (repv, repv);
+extern repv Furl_quote_string (repv);
+extern repv Furl_unquote_string (repv, repv);
+
 /* from continuations.c */
 extern int rep_thread_lock;
 extern rep_bool rep_pending_thread_yield;
@@ -48,10 +56,14 @@ extern repv Ftheadp (repv arg);
 extern repv Fthread_suspended_p (repv thread);
 extern repv Fthread_exited_p (repv thread);
 extern repv Fcurrent_thread (repv depth);
+extern repv rep_running_thread (void);
 extern repv Fall_threads (repv depth);
 extern repv Fthread_forbid (void);
 extern repv Fthread_permit (void);
 extern repv Fthread_name (repv th);
+extern repv Fthread_priority (repv th);
+extern repv Fset_thread_priority (repv th, repv priority);
+extern repv Fthread_stack_size (repv arg);
 extern unsigned long rep_max_sleep_for (void);
 
 /* from datums.c */
@@ -61,6 +73,24 @@ extern repv Fdatum_ref (repv, repv);
 extern repv Fdatum_set (repv, repv, repv);
 extern repv Fhas_type_p (repv, repv);
 
+/* from deques.c */
+extern repv Fmake_deque (repv, repv);
+extern repv Fdequep (repv);
+extern repv Fdeque_length (repv);
+extern repv Fdeque_empty_p (repv);
+extern repv Fdeque_capacity (repv);
+extern repv Fdeque_push_back (repv, repv);
+extern repv Fdeque_push_front (repv, repv);
+extern repv Fdeque_pop_front (repv);
+extern repv Fdeque_pop_back (repv);
+extern repv Fdeque_ref (repv, repv);
+extern repv Fdeque_set (repv, repv, repv);
+extern repv Fdeque_to_list (repv);
+extern repv Fdeque_push_vector (repv, repv);
+extern repv Fdeque_pop_vector (repv, repv);
+extern repv Fdeque_delete (repv, repv);
+extern repv Fdeque_clear (repv);
+
 /* from debug-buffer.c */
 extern void *rep_db_alloc(char *name, int size);
 extern void rep_db_free(void *db);
@@ -113,6 +143,7 @@ extern repv Frename_file(repv, repv);
 extern repv Fmake_directory(repv);
 extern repv Fdelete_directory(repv);
 extern repv Fcopy_file(repv, repv);
+extern repv Ffile_contents_string(repv);
 extern repv Ffile_readable_p(repv file);
 extern repv Ffile_writable_p(repv file);
 extern repv Ffile_executable_p(repv file);
@@ -128,6 +159,8 @@ extern repv Fset_file_modes(repv file, repv modes);
 extern repv Ffile_modes_as_string(repv file);
 extern repv Ffile_modtime(repv file);
 extern repv Fdirectory_files(repv dir);
+extern repv Fdirectory_files_with_attributes(repv dir, repv recursive,
+					     repv regexp);
 extern repv Fread_symlink(repv file);
 extern repv Fmake_symlink(repv file, repv contents);
 extern repv Fstdin_file(void);
@@ -143,6 +176,7 @@ extern void rep_pop_regexp_data(void);
 extern void rep_update_last_match(repv data, rep_regexp *prog);
 extern void rep_set_string_match(repv obj, repv start, repv end);
 extern void (*rep_regsub_fun)(int, rep_regsubs *, char *, char *, void *);
+extern void (*rep_string_modified_fun)(repv string);
 extern int (*rep_regsublen_fun)(int, rep_regsubs *, char *, void *);
 extern repv Qregexp_error;
 extern repv Fstring_match(repv re, repv str, repv start, repv nocasep);
@@ -153,14 +187,40 @@ extern repv Fmatch_start(repv exp);
 extern repv Fmatch_end(repv exp);
 extern repv Fquote_regexp(repv str);
 extern repv Fregexp_cache_control(repv limit);
+extern repv Fregexp_backtrack_limit(repv val);
 extern void rep_regerror(char *err);
 
+/* from records.c */
+extern repv F_make_record (int, repv *);
+extern repv F_record_ref (repv, repv, repv);
+extern repv F_record_set (repv, repv, repv, repv);
+extern repv F_record_p (repv, repv);
+
+/* from regset.c */
+extern repv Fmake_regexp_set(repv patterns, repv nocasep);
+extern repv Fregexp_set_p(repv arg);
+extern repv Fregexp_set_match(repv set, repv string, repv start, repv all);
+
 /* from fluids.c */
 extern repv Fmake_fluid (repv);
 extern repv Ffluid_ref (repv);
 extern repv Ffluid_set (repv, repv);
 extern repv Fwith_fluids (repv, repv, repv);
 
+/* from handles.c */
+extern rep_fun_handle *rep_make_fun_handle (repv symbol, repv structure);
+extern rep_fun_handle *rep_make_fun_handle_for_value (repv fun);
+extern rep_bool rep_make_fun_handles (int n, const char **names,
+				      repv structure,
+				      rep_fun_handle **handles);
+extern rep_bool rep_intern_symbols (int n, const char **names,
+				    repv *symbols);
+extern void rep_free_fun_handle (rep_fun_handle *h);
+extern repv rep_fun_handle_value (rep_fun_handle *h);
+extern repv rep_call_fun_handle (rep_fun_handle *h, int argc, repv *argv);
+extern int rep_call_fun_handle_batch (rep_fun_handle *h, int count,
+				      int argc, repv *argv, repv *results);
+
 /* from lisp.c */
 extern repv rep_load_autoload(repv);
 extern repv rep_funcall(repv fun, repv arglist, rep_bool eval_args);
@@ -254,10 +314,13 @@ extern repv Fcond(repv, repv);
 extern repv Fapply(repv);
 extern repv Fload(repv file, repv noerr_p, repv nopath_p,
 		  repv nosuf_p, repv in_env);
+extern repv Fopen_image(repv file);
+extern repv Fdump_image(repv file);
 extern repv Fequal(repv, repv);
 extern repv Feq(repv, repv);
 extern repv Fstring_head_eq(repv, repv);
 extern repv Fnull(repv);
+extern repv F_sort(repv, repv, repv);
 extern repv Fatom(repv);
 extern repv Fconsp(repv);
 extern repv Flistp(repv);
@@ -281,6 +344,7 @@ extern repv Fmake_byte_code_subr(repv args);
 
 /* from macros.c */
 extern repv Fmacroexpand(repv, repv);
+extern repv Fmacroexpand_1(repv, repv);
 
 /* from main.c */
 extern void rep_init(char *prog_name, int *argc, char ***argv,
@@ -340,6 +404,7 @@ extern repv Fuser_login_name(void);
 extern repv Fuser_full_name(repv arg);
 extern repv Fuser_home_directory(repv user);
 extern repv Fsystem_name(void);
+extern repv Fprocessor_count(void);
 extern repv Fmessage(repv string, repv now);
 extern repv Frandom(repv arg);
 extern repv Ftranslate_string(repv string, repv table);
@@ -412,6 +477,20 @@ extern repv Fexact_to_inexact(repv);
 extern repv Finexact_to_exact(repv);
 extern repv Fnumerator(repv);
 extern repv Fdenominator(repv);
+extern repv Fstring_to_number_vector(repv, repv, repv, repv, repv);
+extern repv Fwrite_numbers(repv, repv, repv, repv);
+extern repv Fmake_numeric_vector(repv, repv, repv);
+extern repv Fsequence_to_numeric_vector(repv, repv);
+extern repv Fnumeric_vector_to_vector(repv);
+extern repv Fnumeric_vector_p(repv);
+extern repv Fnumeric_vector_kind(repv);
+extern repv Fnumeric_vector_add(repv, repv, repv);
+extern repv Fnumeric_vector_mul(repv, repv, repv);
+extern repv Fnumeric_vector_scale(repv, repv, repv);
+extern repv Fnumeric_vector_dot(repv, repv);
+extern repv Fnumeric_vector_sum(repv);
+extern repv Fnumeric_vector_min(repv);
+extern repv Fnumeric_vector_max(repv);
 
 /* from streams.c */
 extern repv Qformat_hooks_alist;
@@ -420,6 +499,7 @@ extern int rep_stream_ungetc(repv, int);
 extern int rep_stream_putc(repv, int);
 extern int rep_stream_puts(repv, void *, int, rep_bool);
 extern int rep_stream_read_esc(repv, int *);
+extern long rep_stream_read(repv, char *, long);
 extern repv Fwrite(repv stream, repv data, repv len);
 extern repv Fread_char(repv stream);
 extern repv Fpeek_char(repv stream);
@@ -431,8 +511,10 @@ extern repv Fprint(repv, repv);
 extern repv Fprin1(repv, repv);
 extern repv Fprinc(repv, repv);
 extern repv Fformat(repv);
+extern repv Fcompile_format(repv);
 extern repv Fmake_string_input_stream(repv string, repv start);
-extern repv Fmake_string_output_stream(void);
+extern repv Fmake_string_output_stream(repv limit, repv sink);
+extern repv Fflush_string_output_stream(repv strm);
 extern repv Fget_output_stream_string(repv strm);
 extern repv Finput_stream_p(repv arg);
 extern repv Foutput_stream_p(repv arg);
@@ -442,6 +524,7 @@ extern repv rep_undefined_value;
 extern repv (*rep_deref_local_symbol_fun)(repv sym);
 extern repv (*rep_set_local_symbol_fun)(repv sym, repv val);
 extern void rep_intern_static(repv *, repv);
+extern repv rep_intern_chars(const char *str, size_t len, repv ob);
 extern repv rep_call_with_closure (repv closure,
 				   repv (*fun)(repv arg), repv arg);
 extern repv rep_bind_symbol(repv, repv, repv);
@@ -487,6 +570,12 @@ extern repv Vobarray(repv val);
 extern repv Fmake_keyword (repv in);
 extern repv Fkeywordp (repv arg);
 
+/* from strings.c */
+extern repv Fstring_index (repv string, repv ch, repv start, repv end);
+extern repv Fstring_search (repv needle, repv string, repv start,
+			    repv nocasep);
+extern repv Fstring_count (repv item, repv string, repv start, repv end);
+
 /* from structures.c */
 extern repv rep_structure;
 extern repv Fmake_binding_immutable (repv);
@@ -549,6 +638,8 @@ extern repv rep_box_string (char *ptr, long len);
 extern repv rep_make_string(long);
 extern repv rep_string_dupn(const char *, long);
 extern repv rep_string_dup(const char *);
+extern repv rep_string_slice (repv string, long start);
+extern void rep_string_unshare (repv string);
 extern repv rep_concat2(char *, char *);
 extern repv rep_concat3(char *, char *, char *);
 extern repv rep_concat4(char *s1, char *s2, char *s3, char *s4);
@@ -563,14 +654,25 @@ extern repv Fmake_primitive_guardian (void);
 extern repv Fprimitive_guardian_push (repv g, repv obj);
 extern repv Fprimitive_guardian_pop (repv g);
 extern void rep_mark_static(repv *);
+extern void rep_unmark_static(repv *);
 extern void rep_mark_value(repv);
+extern rep_bool rep_gc_live_p (repv v);
+extern void rep_add_weak_hooks (rep_bool (*trace) (void),
+				void (*clear) (void));
 extern repv Fcons(repv, repv);
 extern rep_GC_root *rep_gc_root_stack;
 extern rep_GC_n_roots *rep_gc_n_roots_stack;
 extern repv Vgarbage_threshold(repv val);
 extern repv Vidle_garbage_threshold(repv val);
 extern repv Fgarbage_collect(repv noStats);
+extern repv Fheap_limit(repv val);
+extern repv Fgarbage_release_threshold(repv val);
+extern repv Fmemory_usage(void);
+extern repv Fdedupe_heap(void);
+extern repv Qmemory_exhausted;
 extern int rep_data_after_gc, rep_gc_threshold, rep_idle_gc_threshold;
+extern int rep_alloc_sample_countdown;
+extern void (*rep_alloc_sample_fun)(void);
 extern rep_bool rep_in_gc;
 
 #ifdef rep_HAVE_UNIX
@@ -590,14 +692,20 @@ extern unsigned long rep_getpid (void);
 extern void (*rep_register_input_fd_fun)(int fd, void (*callback)(int fd));
 extern void (*rep_deregister_input_fd_fun)(int fd);
 extern void rep_add_event_loop_callback (rep_bool (*callback)(void));
+extern void rep_add_after_fork_callback (void (*callback)(void));
+extern void rep_isolate_forked_child (void);
 extern void rep_sleep_for(long secs, long msecs);
 extern void rep_register_input_fd(int fd, void (*callback)(int fd));
 extern void rep_deregister_input_fd(int fd);
+extern rep_bool rep_register_output_fd (int fd, void (*callback)(int fd));
+extern void rep_deregister_output_fd (int fd);
+extern void rep_output_needs_dispatch (void);
 extern void rep_map_inputs (void (*fun)(int fd, void (*callback)(int)));
 extern void rep_mark_input_pending(int fd);
 extern void rep_unix_set_fd_nonblocking(int fd);
 extern void rep_unix_set_fd_blocking(int fd);
 extern void rep_unix_set_fd_cloexec(int fd);
+extern rep_bool rep_unix_wait_for_output(int fd);
 extern void rep_sig_restart(int sig, rep_bool flag);
 extern repv rep_event_loop(void);
 extern repv rep_sit_for(unsigned long timeout_msecs);
@@ -623,6 +731,7 @@ extern void rep_print_allocations(void);
 
 extern void (*rep_redisplay_fun)(void);
 extern long (*rep_wait_for_input_fun)(void *inputs, unsigned long timeout_msecs);
+extern void (*rep_wait_sample_fun)(void);
 extern int rep_input_timeout_secs;
 extern repv Funix_print_allocations(void);
 
@@ -655,6 +764,10 @@ extern repv Fprocess_error_stream(repv proc);
 extern repv Fset_process_error_stream(repv proc, repv stream);
 extern repv Fprocess_function(repv proc);
 extern repv Fset_process_function(repv proc, repv fn);
+extern repv Fprocess_write_function(repv proc);
+extern repv Fset_process_write_function(repv proc, repv fn);
+extern repv Fprocess_output_pending(repv proc);
+extern repv Fprocess_output_high_water(repv arg);
 extern repv Fprocess_dir(repv proc);
 extern repv Fset_process_dir(repv proc, repv dir);
 extern repv Fprocess_connection_type(repv proc);
@@ -150,6 +150,72 @@ gdbm-delete DBM KEY
     return gdbm_delete (rep_DBM(dbm)->dbm, dkey) == 0 ? Qt : Qnil;
 }
 
+DEFUN("gdbm-begin-batch", Fgdbm_begin_batch, Sgdbm_begin_batch,
+      (repv dbm), rep_Subr1) /*
+::doc:rep.io.db.gdbm#gdbm-begin-batch::
+gdbm-begin-batch DBM
+
+Start a batch of changes to DBM, ended by `gdbm-commit'. Since gdbm
+never waits for its writes to reach the disk (unless asked to), this
+does nothing but check DBM; it exists so that code may treat gdbm and
+sdbm databases alike.
+::end:: */
+{
+    rep_DECLARE1 (dbm, rep_DBMP);
+    return Qt;
+}
+
+DEFUN("gdbm-commit", Fgdbm_commit, Sgdbm_commit, (repv dbm), rep_Subr1) /*
+::doc:rep.io.db.gdbm#gdbm-commit::
+gdbm-commit DBM
+
+Return once everything written to DBM is on disk.
+::end:: */
+{
+    rep_DECLARE1 (dbm, rep_DBMP);
+    if (rep_DBM(dbm)->access != Qread)
+	gdbm_sync (rep_DBM(dbm)->dbm);
+    return Qt;
+}
+
+DEFUN("gdbm-load", Fgdbm_load, Sgdbm_load,
+      (repv dbm, repv pairs, repv flags), rep_Subr3) /*
+::doc:rep.io.db.gdbm#gdbm-load::
+gdbm-load DBM PAIRS [FLAGS]
+
+Store each `(KEY . VALUE)' element of the list PAIRS in DBM, as by
+`gdbm-store' with FLAGS, then call `gdbm-commit'. Returns the number of
+pairs stored.
+::end:: */
+{
+    repv tem;
+    long stored = 0;
+    int dflags;
+
+    rep_DECLARE1 (dbm, rep_DBMP);
+    rep_DECLARE2 (pairs, rep_LISTP);
+    for (tem = pairs; rep_CONSP(tem); tem = rep_CDR(tem))
+    {
+	repv pair = rep_CAR(tem);
+	if (!rep_CONSP(pair) || !rep_STRINGP(rep_CAR(pair))
+	    || !rep_STRINGP(rep_CDR(pair)))
+	    return rep_signal_arg_error (pair, 2);
+    }
+    dflags = (flags == Qinsert ? GDBM_INSERT : GDBM_REPLACE);
+    for (tem = pairs; rep_CONSP(tem); tem = rep_CDR(tem))
+    {
+	datum dkey, dvalue;
+	dkey.dptr = rep_STR (rep_CAR(rep_CAR(tem)));
+	dkey.dsize = rep_STRING_LEN (rep_CAR(rep_CAR(tem)));
+	dvalue.dptr = rep_STR (rep_CDR(rep_CAR(tem)));
+	dvalue.dsize = rep_STRING_LEN (rep_CDR(rep_CAR(tem)));
+	if (gdbm_store (rep_DBM(dbm)->dbm, dkey, dvalue, dflags) == 0)
+	    stored++;
+    }
+    Fgdbm_commit (dbm);
+    return rep_make_long_int (stored);
+}
+
 DEFUN("gdbm-walk", Fgdbm_walk, Sgdbm_walk, (repv fun, repv dbm), rep_Subr2) /*
 ::doc:rep.io.db.gdbm#gdbm-walk::
 gdbm-walk FUN DBM
@@ -257,6 +323,9 @@ rep_dl_init (void)
     rep_ADD_SUBR(Sgdbm_fetch);
     rep_ADD_SUBR(Sgdbm_store);
     rep_ADD_SUBR(Sgdbm_delete);
+    rep_ADD_SUBR(Sgdbm_begin_batch);
+    rep_ADD_SUBR(Sgdbm_commit);
+    rep_ADD_SUBR(Sgdbm_load);
     rep_ADD_SUBR(Sgdbm_walk);
     rep_ADD_SUBR(Sgdbmp);
     return rep_pop_structure (tem);
@@ -40,6 +40,14 @@
 #define POS(x)   MAX(x, 0)
 #define ABS(x)   MAX(x, -(x))
 
+/* Reading a local file stream character by character; there's no need
+   for stdio to lock each FILE for us */
+#ifdef HAVE_GETC_UNLOCKED
+# define rep_getc(fh) getc_unlocked (fh)
+#else
+# define rep_getc(fh) getc (fh)
+#endif
+
 #define rep_INTERNAL 1
 #include "rep.h"
 
@@ -120,6 +128,8 @@ struct rep_struct_node_struct {
     unsigned int is_exported : 1;
 };
 
+typedef struct rep_import_table_struct rep_import_table;
+
 /* structure encapsulating a single namespace */
 typedef struct rep_struct_struct rep_struct;
 struct rep_struct_struct {
@@ -132,6 +142,10 @@ struct rep_struct_struct {
     repv imports;
     repv accessible;
 
+    /* When sealed, every binding imported through IMPORTS, or null if
+       it hasn't been built since the imports last changed */
+    rep_import_table *import_table;
+
     /* A list of the special variables that may be accessed in this
        environment, or Qt to denote all specials. */
     repv special_env;
@@ -155,10 +169,66 @@ extern int rep_structure_type;
 /* If set, bindings can be created by setq et al. */
 #define rep_STF_SET_BINDS	(1 << (rep_CELL16_TYPE_BITS + 2))
 
+/* If set, imported bindings are found through IMPORT_TABLE. */
+#define rep_STF_SEALED		(1 << (rep_CELL16_TYPE_BITS + 3))
+
 #define rep_SPECIAL_ENV   (rep_STRUCTURE(rep_structure)->special_env)
 
 #define rep_STRUCT_HASH(x,n) (((x) >> 3) % (n))
 
+/* Incremented whenever a binding is created or deleted, or a binding's
+   visibility or mutability changes. Inline caches holding resolved
+   bindings are only valid while it keeps the value they recorded. */
+extern unsigned int rep_structure_stamp;
+
+/* Inline cache for a global reference in compiled code: the binding
+   found in structure S while rep_structure_stamp was STAMP. LOCAL is
+   set if N is S's own binding (not imported). */
+typedef struct rep_ic_entry_struct {
+    unsigned int stamp;
+    unsigned int local;
+    rep_struct *s;
+    rep_struct_node *n;
+} rep_ic_entry;
+
+/* Direct-threaded translation of the byte-code string CODE of the
+   compiled function SUBR (see jitmach.c). INSNS holds LENGTH words;
+   OFFSETS maps each byte offset in CODE to an index into INSNS. */
+typedef struct rep_jit_code_struct rep_jit_code;
+struct rep_jit_code_struct {
+    rep_jit_code *next, **pprev;
+    repv subr, code;
+    int *offsets;
+    int length;
+    void *insns[1];
+};
+
+/* The inline caches of a compiled function, one for each element of
+   its constant vector CONSTS. Hangs off the hidden slot of the
+   compiled object (see rep_COMPILED_IC). CALLS counts the calls made
+   to the function, JIT is its translation once it has one. */
+typedef struct rep_ic_struct {
+    repv consts;
+    unsigned int calls;
+    rep_jit_code *jit;
+    rep_ic_entry entries[1];
+} rep_ic;
+
+#define rep_IC_SIZE(n) (sizeof (rep_ic) + ((n) - 1) * sizeof (rep_ic_entry))
+
+/* Compiled objects (made by rep_make_compiled) have one slot beyond
+   their visible length, holding their rep_ic, or null. The slot is a
+   repv, so the pointer is converted to and from it, not type-punned. */
+#define rep_COMPILED_IC(v) \
+    ((rep_ic *) rep_VECTI (v, rep_VECT_LEN (v)))
+#define rep_SET_COMPILED_IC(v, ic) \
+    (rep_VECTI (v, rep_VECT_LEN (v)) = rep_VAL (ic))
+
+/* Bits of rep_bytecode_profiling, what the VM records before it
+   executes each instruction (see lispmach.c) */
+#define rep_PROFILE_OPCODES	1
+#define rep_PROFILE_TYPES	2
+
 
 /* binding tracking */
 
@@ -168,6 +238,14 @@ extern int rep_structure_type;
 #define rep_SPEC_BINDINGS(x)		(rep_INT(x) >> 16)
 #define rep_NEW_FRAME			rep_MAKE_INT(0)
 
+/* Each element of rep_special_bindings is (VAR VALUE . PREVIOUS),
+   where VAR is a symbol or a fluid, and PREVIOUS is the binding of VAR
+   that this one shadows (or nil). Only change the list through the
+   functions in symbols.c, they keep the symbols' value cells in step */
+#define rep_BINDING_VAR(b)		rep_CAR(b)
+#define rep_BINDING_VALUE(b)		rep_CAR(rep_CDR(b))
+#define rep_BINDING_PREVIOUS(b)		rep_CDR(rep_CDR(b))
+
 #define rep_USE_FUNARG(f)				\
     do {						\
 	rep_env = rep_FUNARG(f)->env;			\
@@ -187,7 +265,9 @@ extern int rep_structure_type;
 struct rep_Call {
     struct rep_Call *next;
     repv fun;
-    repv args;
+    repv args;				/* void if not known (yet) */
+    repv *argv;				/* if non-null, ARGS is made from */
+    int argc;				/* these when first needed */
     repv current_form;			/* used for debugging, set by progn */
     repv saved_env;
     repv saved_structure;
@@ -195,6 +275,7 @@ struct rep_Call {
 
 #define rep_PUSH_CALL(lc)		\
     do {				\
+	(lc).argv = 0;			\
 	(lc).current_form = rep_NULL;	\
 	(lc).saved_env = rep_env;	\
 	(lc).saved_structure = rep_structure; \
@@ -212,34 +293,212 @@ struct rep_Call {
 
 /* guardians */
 
+/* Both sets of objects are kept in malloc'd arrays, not lists, so
+   that guarding an object allocates nothing in the Lisp heap and the
+   GC can test the accessible objects with a single linear scan. The
+   inaccessible objects are a queue, popped from HEAD. */
 typedef struct rep_guardian_struct {
     repv car;
     struct rep_guardian_struct *next;
-    repv accessible;
-    repv inaccessible;
+    repv *accessible;
+    int accessible_count, accessible_size;
+    repv *inaccessible;
+    int inaccessible_head, inaccessible_count, inaccessible_size;
 } rep_guardian;
 
 
+/* numeric vectors (see numbers.c) */
+
+/* Element kinds, stored above the type code in the car */
+enum rep_nv_kind {
+    rep_NV_F64 = 0, rep_NV_F32, rep_NV_S32, rep_NV_S64, rep_NV_U8,
+    rep_NV_KINDS
+};
+
+typedef struct rep_numeric_vector_struct {
+    repv car;
+    struct rep_numeric_vector_struct *next;
+    long length;
+    void *data;
+} rep_numeric_vector;
+
+#define rep_NUMERIC_VECTOR(v)	((rep_numeric_vector *) rep_PTR(v))
+#define rep_NUMERIC_VECTOR_P(v)	rep_CELL16_TYPEP(v, rep_numeric_vector_type)
+#define rep_NV_KIND(v)		(rep_NUMERIC_VECTOR(v)->car >> rep_CELL16_TYPE_BITS)
+#define rep_NV_LEN(v)		(rep_NUMERIC_VECTOR(v)->length)
+
+
+/* records (see records.c) */
+
+/* The number of slots is stored above the type code in the car */
+typedef struct rep_record_struct {
+    repv car;
+    struct rep_record_struct *next;
+    repv type;
+    repv slots[1];
+} rep_record;
+
+#define rep_RECORD(v)		((rep_record *) rep_PTR(v))
+#define rep_RECORDP(v)		rep_CELL16_TYPEP(v, rep_record_type)
+#define rep_RECORD_LEN(v)	((long) (rep_RECORD(v)->car >> rep_CELL16_TYPE_BITS))
+#define rep_RECORD_SLOT(v, i)	(rep_RECORD(v)->slots[i])
+
+/* True if R is a record of type T with a slot at fixnum I */
+#define rep_RECORD_INDEX_OK_P(r, t, i)					\
+    (rep_RECORDP (r) && rep_RECORD (r)->type == (t) && rep_INTP (i)	\
+     && (unsigned long) rep_INT (i) < (unsigned long) rep_RECORD_LEN (r))
+
+
+/* fasl files (see fasl.c) */
+
+#define rep_FASL_MAGIC "rep-fasl 1\n"
+
+typedef struct {
+    const unsigned char *ptr, *end;
+    repv symbols;
+    rep_bool dedupe;		/* coalesce constants of byte-code */
+} rep_fasl_reader;
+
+
 /* cons' */
 
-#define rep_CONSBLK_SIZE	1022		/* ~8k */
+/* ~1000 cells, 8k or 16k depending on word size */
+#define rep_CONSBLK_SIZE	(rep_CELLBLK_SLOTS - rep_CELLBLK_HEADER_SLOTS)
 
-/* Structure of cons allocation blocks */
+/* Structure of cons allocation blocks. These are aligned to
+   rep_CELLBLK_BYTES, see rep_lisp.h */
 typedef struct rep_cons_block_struct {
     union {
-	struct rep_cons_block_struct *p;
+	rep_cell_block_header h;
 	/* ensure that the following cons cell is aligned to at
 	   least sizeof (rep_cons) (for the dcache) */
-	rep_cons dummy;
-    } next;
+	rep_cons dummy[rep_CELLBLK_HEADER_SLOTS];
+    } hdr;
     rep_cons cons[rep_CONSBLK_SIZE];
 } rep_cons_block;
 
+#define rep_CONSBLK_NEXT(cb) ((rep_cons_block *) (cb)->hdr.h.next)
+
 
 /* prototypes */
 
 #include "repint_subrs.h"
 
+/* Called by the allocators with the number of bytes just allocated.
+   When the allocation-sampling countdown expires rep_alloc_sample_fun
+   is called; it must not allocate, and must reset the countdown. */
+#define rep_ALLOC_SAMPLE(bytes)						\
+    do {								\
+	if ((rep_alloc_sample_countdown -= (bytes)) <= 0)		\
+	    (*rep_alloc_sample_fun) ();					\
+    } while (0)
+
+/* Fixnum arithmetic on tagged values. Each of these returns true and
+   sets *OUT if X and Y are both fixnums and so is the result, otherwise
+   the caller must take the generic path. A fixnum N is stored as 4N+2,
+   so the sum, difference or product of the tagged words overflows
+   exactly when the result doesn't fit in a fixnum. */
+
+#define rep_INTP_2(x, y) ((((x) & (y)) & rep_VALUE_IS_INT) != 0)
+
+/* rep_subrs.h defines `inline' away, so spell it the GNU way or every
+   file that includes this one but not the helpers would warn */
+#ifdef __GNUC__
+# define rep_FIXNUM_INLINE static __inline__
+#else
+# define rep_FIXNUM_INLINE static
+#endif
+
+rep_FIXNUM_INLINE rep_bool
+rep_fixnum_add (repv x, repv y, repv *out)
+{
+    rep_PTR_SIZED_INT r;
+    if (!rep_INTP_2 (x, y))
+	return rep_FALSE;
+#ifdef HAVE_BUILTIN_OVERFLOW
+    if (__builtin_add_overflow ((rep_PTR_SIZED_INT) x,
+				(rep_PTR_SIZED_INT) y - rep_VALUE_IS_INT, &r))
+	return rep_FALSE;
+#else
+    r = rep_INT (x) + rep_INT (y);
+    if (r < rep_LISP_MIN_INT || r > rep_LISP_MAX_INT)
+	return rep_FALSE;
+    r = rep_MAKE_INT (r);
+#endif
+    *out = (repv) r;
+    return rep_TRUE;
+}
+
+rep_FIXNUM_INLINE rep_bool
+rep_fixnum_sub (repv x, repv y, repv *out)
+{
+    rep_PTR_SIZED_INT r;
+    if (!rep_INTP_2 (x, y))
+	return rep_FALSE;
+#ifdef HAVE_BUILTIN_OVERFLOW
+    if (__builtin_sub_overflow ((rep_PTR_SIZED_INT) x,
+				(rep_PTR_SIZED_INT) y - rep_VALUE_IS_INT, &r))
+	return rep_FALSE;
+#else
+    r = rep_INT (x) - rep_INT (y);
+    if (r < rep_LISP_MIN_INT || r > rep_LISP_MAX_INT)
+	return rep_FALSE;
+    r = rep_MAKE_INT (r);
+#endif
+    *out = (repv) r;
+    return rep_TRUE;
+}
+
+rep_FIXNUM_INLINE rep_bool
+rep_fixnum_mul (repv x, repv y, repv *out)
+{
+    rep_PTR_SIZED_INT r;
+    if (!rep_INTP_2 (x, y))
+	return rep_FALSE;
+#ifdef HAVE_BUILTIN_OVERFLOW
+    if (__builtin_mul_overflow (rep_INT (x),
+				(rep_PTR_SIZED_INT) y - rep_VALUE_IS_INT, &r))
+	return rep_FALSE;
+    r += rep_VALUE_IS_INT;
+#else
+    /* only accept products that can't possibly overflow */
+# define rep_FIXNUM_HALF \
+    (rep_VALUE_CONST(1) << ((rep_LISP_INT_BITS - 1) / 2))
+    if (rep_INT (x) >= rep_FIXNUM_HALF || rep_INT (x) <= -rep_FIXNUM_HALF
+	|| rep_INT (y) >= rep_FIXNUM_HALF || rep_INT (y) <= -rep_FIXNUM_HALF)
+	return rep_FALSE;
+    r = rep_MAKE_INT (rep_INT (x) * rep_INT (y));
+# undef rep_FIXNUM_HALF
+#endif
+    *out = (repv) r;
+    return rep_TRUE;
+}
+
+/* Shift fixnum X left by COUNT bits (right if negative) */
+rep_FIXNUM_INLINE rep_bool
+rep_fixnum_ash (repv x, repv count, repv *out)
+{
+    rep_PTR_SIZED_INT n, c;
+    if (!rep_INTP_2 (x, count))
+	return rep_FALSE;
+    n = rep_INT (x);
+    c = rep_INT (count);
+    if (c <= 0)
+    {
+	/* shifting by the full width is undefined */
+	n = (c > -rep_LISP_INT_BITS) ? n >> -c : (n < 0 ? -1 : 0);
+    }
+    else
+    {
+	if (c >= rep_LISP_INT_BITS - 1
+	    || n > (rep_LISP_MAX_INT >> c) || n < (rep_LISP_MIN_INT >> c))
+	    return rep_FALSE;
+	n = n * ((rep_PTR_SIZED_INT) 1 << c);
+    }
+    *out = rep_MAKE_INT (n);
+    return rep_TRUE;
+}
+
 /* If using GCC, make inline_Fcons be Fcons that only takes a procedure
    call when the heap needs to grow. */
 
@@ -254,6 +513,7 @@ inline_Fcons (repv x, repv y)
     rep_cons_freelist = rep_CONS (c->cdr);
     rep_used_cons++;
     rep_data_after_gc += sizeof(rep_cons);
+    rep_ALLOC_SAMPLE (sizeof (rep_cons));
 
     c->car = (x);
     c->cdr = (y);
@@ -22,6 +22,9 @@
 #ifndef REPINT_SUBRS_H
 #define REPINT_SUBRS_H
 
+/* from codecs.c */
+extern void rep_codecs_init (void);
+
 /* from continuations.c */
 extern void rep_continuations_init (void);
 
@@ -29,17 +32,42 @@ extern void rep_continuations_init (void);
 extern void rep_pre_datums_init (void);
 extern void rep_datums_init (void);
 
+/* from dedupe.c */
+extern repv Qdedupe_loaded_constants;
+extern void rep_dedupe_constants (repv compiled);
+extern void rep_dedupe_init (void);
+
+/* from deques.c */
+extern void rep_deques_init (void);
+
+/* from fasl.c */
+extern repv Fwrite_fasl (repv stream, repv forms);
+extern rep_bool rep_fasl_data_p (const char *data, size_t length);
+extern rep_bool rep_fasl_open (rep_fasl_reader *r, const char *data,
+			       size_t length);
+extern repv rep_fasl_read (rep_fasl_reader *r);
+extern repv rep_read_fasl (const char *data, size_t length);
+extern repv Fread_fasl_string (repv string);
+extern void rep_fasl_init (void);
+
 /* from files.c */
+extern repv Qfile, Qdirectory, Qsymlink, Qspecial;
 extern void rep_files_init(void);
 extern void rep_files_kill(void);
 
 /* from find.c */
 extern struct rep_saved_regexp_data *rep_saved_matches;
+extern struct rep_saved_regexp_data rep_base_matches;
 extern void rep_string_modified (repv string);
 extern void rep_mark_regexp_data(void);
+extern void rep_save_regexp_data(struct rep_saved_regexp_data *sd);
+extern void rep_restore_regexp_data(void);
 extern void rep_find_init(void);
 extern void rep_find_kill(void);
 
+/* from regset.c */
+extern void rep_regset_init (void);
+
 /* from fluids.c */
 extern void rep_fluids_init (void);
 
@@ -52,6 +80,7 @@ extern void rep_string_princ(repv, repv);
 extern void rep_string_print(repv, repv);
 extern repv rep_copy_list(repv);
 extern rep_bool rep_compare_error(repv error, repv handler);
+extern void rep_mark_lambda_cache (void);
 extern void rep_lisp_init(void);
 extern rep_bool rep_single_step_flag;
 
@@ -60,7 +89,10 @@ extern rep_xsubr Slambda;
 extern repv Qload_filename;
 extern repv Fcall_with_exception_handler (repv, repv);
 extern void rep_lispcmds_init(void);
+extern repv Flist (int argc, repv *argv);
 extern repv Flist_star (int argc, repv *argv);
+extern repv rep_open_image (repv file);
+extern repv rep_module_index_exports (repv name);
 extern repv Fnconc_ (int argc, repv *argv);
 extern repv Fappend (int argc, repv *argv);
 extern repv Fvector (int argc, repv *argv);
@@ -76,15 +108,28 @@ extern repv Flethan (int, repv *);
 extern repv Qbytecode_error;
 extern repv Frun_byte_code(repv code, repv consts, repv stkreq);
 extern repv rep_apply_bytecode (repv subr, int nargs, repv *args);
+extern repv rep_interpret_bytecode (repv subr, int nargs, repv *args);
+extern int rep_bytecode_profiling;
+extern void rep_record_bytecode (int *history, int op);
+extern void rep_record_type_feedback (repv code, int pc, repv top,
+				      repv *stackp);
 extern void rep_lispmach_init(void);
 extern void rep_lispmach_kill(void);
 
+/* from jitmach.c */
+extern int rep_jit_threshold;
+extern rep_bool rep_jit_hot_p (repv subr);
+extern repv rep_jit_apply_bytecode (repv subr, int nargs, repv *args);
+extern void rep_jit_free (rep_jit_code *jc);
+extern void rep_jitmach_init (void);
+
 /* from main.c */
 extern char *rep_stack_bottom;
 extern void rep_deprecated (rep_bool *seen, const char *desc);
 
 /* from macros.c */
 extern void rep_macros_before_gc (void);
+extern void rep_mark_macro_history (rep_bool drop);
 extern void rep_macros_clear_history (void);
 extern void rep_macros_init (void);
 
@@ -100,7 +145,14 @@ extern void rep_misc_init(void);
 /* from numbers.c */
 extern repv rep_parse_number (char *buf, unsigned int len, unsigned int radix,
 			      int sign, unsigned int type);
+extern rep_bool rep_parse_fixnum (const char *buf, size_t len, int sign,
+				  repv *result);
+#define rep_FIXNUM_DIGITS 24
+extern char *rep_print_fixnum (char *end, rep_PTR_SIZED_INT n);
 extern void rep_numbers_init (void);
+extern int rep_numeric_vector_type;
+extern repv rep_numeric_vector_ref (repv vec, long i);
+extern rep_bool rep_numeric_vector_set (repv vec, long i, repv value);
 extern repv Fplus(int, repv *);
 extern repv Fminus(int, repv *);
 extern repv Fproduct(int, repv *);
@@ -117,8 +169,13 @@ extern rep_bool rep_record_origins;
 extern void rep_record_origin (repv form, repv stream, long start_line);
 extern repv Flexical_origin (repv form);
 extern void rep_mark_origins (void);
+extern void rep_sweep_origins (void);
 extern void rep_origin_init (void);
 
+/* from records.c */
+extern int rep_record_type;
+extern void rep_records_init (void);
+
 /* from regsub.c */
 extern void rep_default_regsub(int, rep_regsubs *, char *, char *, void *);
 extern int rep_default_regsublen(int, rep_regsubs *, char *, void *);
@@ -126,12 +183,25 @@ extern int rep_default_regsublen(int, rep_regsubs *, char *, void *);
 /* from streams.c */
 extern void rep_streams_init(void);
 
+/* from strings.c */
+extern char *rep_str_find_char (const char *s, size_t len, int c);
+extern size_t rep_str_count_char (const char *s, size_t len, int c);
+extern int rep_str_casecmp (const char *a, const char *b, size_t len);
+extern size_t rep_str_common_prefix (const char *a, const char *b,
+				     size_t len, rep_bool fold);
+extern char *rep_str_search (const char *hay, size_t hlen,
+			     const char *needle, size_t nlen, rep_bool fold);
+extern void rep_str_translate (char *dst, const char *src, size_t len,
+			       const unsigned char *table, size_t tablen);
+extern void rep_strings_init (void);
+
 /* from structures.c */
 extern repv rep_default_structure, rep_specials_structure;
 extern repv Qfeatures, Q_structures, Q_meta, Qrep, Q_specials,
     Q_user_structure, Qrep_structures, Qrep_lang_interpreter,
     Qrep_vm_interpreter, Qexternal, Qinternal;
 extern rep_struct_node *rep_search_imports (rep_struct *s, repv var);
+extern rep_struct_node *rep_lookup_binding (rep_struct *s, repv var);
 extern repv Fmake_structure (repv, repv, repv, repv);
 extern repv F_structure_ref (repv, repv);
 extern repv Fstructure_set (repv, repv, repv);
@@ -139,6 +209,7 @@ extern repv Fstructure_define (repv, repv, repv);
 extern repv Fstructure_bound_p (repv, repv);
 extern repv Fexternal_structure_ref (repv, repv);
 extern repv Fintern_structure (repv);
+extern repv Fstructure_file (repv);
 extern repv Fget_structure (repv);
 extern repv Fexport_binding (repv var);
 extern repv rep_get_initial_special_value (repv sym);
@@ -153,6 +224,12 @@ extern void rep_symbols_init(void);
 extern int rep_allocated_funargs, rep_used_funargs;
 extern repv Freal_set (repv var, repv value);
 extern repv rep_bind_special (repv oldList, repv symbol, repv newVal);
+extern repv rep_make_frame_names (repv *syms, int n);
+extern repv rep_bind_frame (repv oldList, repv names, repv *values);
+extern void rep_push_special_binding (repv var, repv value);
+extern void rep_pop_special_bindings (int count);
+extern void rep_set_special_bindings (repv bindings);
+extern repv rep_search_special_bindings (repv var);
 
 /* from tuples.c */
 extern int rep_allocated_tuples, rep_used_tuples;
@@ -167,6 +244,9 @@ extern rep_cons *rep_cons_freelist;
 extern int rep_allocated_cons, rep_used_cons;
 extern rep_cons *rep_allocate_cons (void);
 extern void rep_cons_free(repv);
+extern repv rep_make_compiled (int len);
+extern void rep_idle_garbage_collect (void);
+extern rep_bool rep_collect_garbage (void);
 extern void rep_pre_values_init (void);
 extern void rep_values_init(void);
 extern void rep_values_kill (void);
@@ -200,7 +280,9 @@ extern repv rep_delete_file(repv file);
 extern repv rep_rename_file(repv old, repv new_);
 extern repv rep_make_directory(repv dir);
 extern repv rep_delete_directory(repv dir);
+extern long rep_copy_fd (int in_fd, int out_fd, long offset, long length);
 extern repv rep_copy_file(repv src, repv dst);
+extern repv rep_file_contents (repv file);
 extern repv rep_file_readable_p(repv file);
 extern repv rep_file_writable_p(repv file);
 extern repv rep_file_executable_p(repv file);
@@ -218,16 +300,23 @@ extern repv rep_set_file_modes(repv file, repv modes);
 extern repv rep_file_modes_as_string(repv file);
 extern repv rep_file_modtime(repv file);
 extern repv rep_directory_files(repv dir_name);
+extern repv rep_directory_files_with_attributes (repv dir_name,
+						 rep_bool recursive,
+						 rep_regexp *re);
 extern repv rep_read_symlink (repv file);
 extern repv rep_make_symlink (repv file, repv contents);
 extern repv rep_getpwd(void);
 extern repv rep_structure_file (repv in);
+extern void *rep_map_file (const char *name, size_t *length);
+extern void rep_unmap_file (void *data, size_t length);
 
 /* from unix_main.c */
 extern repv rep_user_login_name(void);
 extern repv rep_user_full_name(void);
 extern repv rep_user_home_directory(repv user);
 extern repv rep_system_name(void);
+extern int rep_processor_count(void);
+extern long rep_resident_set_size(void);
 extern void rep_pre_sys_os_init(void);
 extern void rep_sys_os_init(void);
 extern void rep_sys_os_kill(void);
@@ -10,6 +10,7 @@
 #include "rep.h"
 #include "sdbm.h"
 #include <fcntl.h>
+#include <stdlib.h>
 
 static int dbm_type;
 
@@ -29,26 +30,56 @@ static rep_dbm *dbm_chain;
 
 DEFSYM(insert, "insert");
 DEFSYM(replace, "replace");
+DEFSYM(mmap, "mmap");
+DEFSYM(page_size, "page-size");
+DEFSYM(cache_pages, "cache-pages");
 
-DEFUN("sdbm-open", Fsdbm_open, Ssdbm_open, (repv file, repv flags, repv mode),
-      rep_Subr3) /*
+DEFUN("sdbm-open", Fsdbm_open, Ssdbm_open,
+      (repv file, repv flags, repv mode, repv options), rep_Subr4) /*
 ::doc:rep.io.db.sdbm#sdbm-open::
-sdbm-open PATH ACCESS-TYPE [MODE]
+sdbm-open PATH ACCESS-TYPE [MODE] [OPTIONS]
+
+OPTIONS is a list whose elements may be `mmap', to map a database
+opened for reading into memory, `(page-size . BYTES)', the size of the
+pages of a newly created database (a power of two from 1024 to 65536),
+or `(cache-pages . COUNT)', the number of pages to keep in memory.
 ::end:: */
 {
-    int uflags, umode;
+    int uflags, umode, pagsiz = PBLKSIZ, ncache = NCACHE, dflags = 0;
     rep_dbm *dbm;
-    rep_GC_root gc_flags, gc_mode;
+    rep_GC_root gc_flags, gc_mode, gc_options;
 
     rep_PUSHGC(gc_flags, flags);
     rep_PUSHGC(gc_mode, mode);
+    rep_PUSHGC(gc_options, options);
     file = Flocal_file_name (file);
-    rep_POPGC; rep_POPGC;
+    rep_POPGC; rep_POPGC; rep_POPGC;
 
     if (!file)
 	return file;
     rep_DECLARE1(file, rep_STRINGP);
     rep_DECLARE2(flags, rep_SYMBOLP);
+    rep_DECLARE4_OPT(options, rep_LISTP);
+
+    for (; rep_CONSP(options); options = rep_CDR(options))
+    {
+	repv opt = rep_CAR(options);
+	if (opt == Qmmap)
+	    dflags |= SDBM_MMAP;
+	else if (rep_CONSP(opt) && rep_CAR(opt) == Qpage_size
+		 && rep_INTP(rep_CDR(opt)))
+	{
+	    pagsiz = rep_INT(rep_CDR(opt));
+	    if (pagsiz < PBLKSIZ || pagsiz > PBLKMAX
+		|| (pagsiz & (pagsiz - 1)) != 0)
+		return rep_signal_arg_error (opt, 4);
+	}
+	else if (rep_CONSP(opt) && rep_CAR(opt) == Qcache_pages
+		 && rep_INTP(rep_CDR(opt)) && rep_INT(rep_CDR(opt)) > 0)
+	    ncache = rep_INT(rep_CDR(opt));
+	else
+	    return rep_signal_arg_error (opt, 4);
+    }
 
     uflags = (flags == Qwrite ? O_RDWR | O_CREAT | O_TRUNC
 	      : (flags == Qappend ? O_RDWR | O_CREAT : O_RDONLY));
@@ -61,7 +92,8 @@ sdbm-open PATH ACCESS-TYPE [MODE]
     dbm->path = file;
     dbm->access = flags;
     dbm->mode = rep_MAKE_INT(umode);
-    dbm->dbm = sdbm_open (rep_STR(file), uflags, umode);
+    dbm->dbm = sdbm_open_tuned (rep_STR(file), uflags, umode,
+				pagsiz, ncache, dflags);
     if (dbm->dbm != 0)
     {
 	dbm->next = dbm_chain;
@@ -134,7 +166,7 @@ sdbm-delete DBM KEY
     rep_DECLARE1 (dbm, rep_DBMP);
     rep_DECLARE2 (key, rep_STRINGP);
     dkey.dptr = rep_STR (key);
-    dkey.dsize = rep_STRING_LEN (key) + 1;
+    dkey.dsize = rep_STRING_LEN (key);
     return sdbm_delete (rep_DBM(dbm)->dbm, dkey) == 0 ? Qt : Qnil;
 }
 
@@ -166,6 +198,244 @@ sdbm-nextkey DBM
 	return rep_string_dupn (dkey.dptr, dkey.dsize);
 }
 
+DEFUN("sdbm-begin-batch", Fsdbm_begin_batch, Ssdbm_begin_batch,
+      (repv dbm), rep_Subr1) /*
+::doc:rep.io.db.sdbm#sdbm-begin-batch::
+sdbm-begin-batch DBM
+
+Start a batch of changes to DBM. Until `sdbm-commit' is called, changed
+pages are kept in memory while there is room for them in its cache,
+then written once. If the batch isn't committed (or DBM closed) some
+changes may be lost and others kept.
+::end:: */
+{
+    rep_DECLARE1 (dbm, rep_DBMP);
+    if (sdbm_begin (rep_DBM(dbm)->dbm) < 0)
+	return rep_signal_file_error (rep_DBM(dbm)->path);
+    return Qt;
+}
+
+DEFUN("sdbm-commit", Fsdbm_commit, Ssdbm_commit, (repv dbm), rep_Subr1) /*
+::doc:rep.io.db.sdbm#sdbm-commit::
+sdbm-commit DBM
+
+End the current batch of changes to DBM, if any, writing all the pages
+it changed, and return once everything written to DBM is on disk.
+::end:: */
+{
+    rep_DECLARE1 (dbm, rep_DBMP);
+    if (sdbm_commit (rep_DBM(dbm)->dbm) < 0)
+	return rep_signal_file_error (rep_DBM(dbm)->path);
+    return Qt;
+}
+
+struct load_pair {
+    unsigned long hash;
+    unsigned long order;
+    long index;
+    repv pair;
+};
+
+static int
+compare_load_pairs (const void *a, const void *b)
+{
+    const struct load_pair *x = a, *y = b;
+    if (x->order != y->order)
+	return x->order < y->order ? -1 : 1;
+    /* so the last of several pairs with the same key is stored last */
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Pairs are stored in chunks, each no bigger than what came before.
+   A key is on the page selected by the low bits of its hash, so sorting
+   each chunk by those bits of the mask of the pages already in the
+   database puts the keys of each page together. (Sorting by more bits
+   would give pages keys that can't be split between two pages.) */
+#define LOAD_CHUNK 4096
+
+static void
+sort_load_chunk (SDBM *db, struct load_pair *v, long n)
+{
+    long pages = sdbm_npages (db);
+    unsigned long mask = 0;
+    long i;
+    while (((mask << 1) | 1) < pages)
+	mask = (mask << 1) | 1;
+    for (i = 0; i < n; i++)
+	v[i].order = v[i].hash & mask;
+    qsort (v, n, sizeof (struct load_pair), compare_load_pairs);
+}
+
+DEFUN("sdbm-load", Fsdbm_load, Ssdbm_load,
+      (repv dbm, repv pairs, repv flags), rep_Subr3) /*
+::doc:rep.io.db.sdbm#sdbm-load::
+sdbm-load DBM PAIRS [FLAGS]
+
+Store each `(KEY . VALUE)' element of the list PAIRS in DBM, as by
+`sdbm-store' with FLAGS. The pairs are stored in the order of the pages
+they belong on, and unless a batch is already in progress, as a batch
+that is then committed. Returns the number of pairs stored (those not
+stored have keys already in DBM, when FLAGS is `insert').
+::end:: */
+{
+    struct load_pair *v;
+    repv tem;
+    long n = 0, i, stored = 0, chunk_end = 0;
+    int dflags, err = 0;
+    SDBM *db;
+    rep_bool batch;
+
+    rep_DECLARE1 (dbm, rep_DBMP);
+    rep_DECLARE2 (pairs, rep_LISTP);
+    db = rep_DBM(dbm)->dbm;
+    for (tem = pairs; rep_CONSP(tem); tem = rep_CDR(tem))
+    {
+	repv pair = rep_CAR(tem);
+	if (!rep_CONSP(pair) || !rep_STRINGP(rep_CAR(pair))
+	    || !rep_STRINGP(rep_CDR(pair)))
+	    return rep_signal_arg_error (pair, 2);
+	n++;
+    }
+    if (n == 0)
+	return rep_MAKE_INT (0);
+
+    v = malloc (n * sizeof (struct load_pair));
+    if (v == 0)
+	return rep_mem_error ();
+    for (i = 0, tem = pairs; i < n; i++, tem = rep_CDR(tem))
+    {
+	repv key = rep_CAR(rep_CAR(tem));
+	v[i].pair = rep_CAR(tem);
+	v[i].hash = sdbm_hash (rep_STR(key), rep_STRING_LEN(key));
+	v[i].index = i;
+    }
+
+    batch = !sdbm_batchp (db);
+    if (batch && sdbm_begin (db) < 0)
+	err = 1;
+    dflags = (flags == Qinsert ? SDBM_INSERT : SDBM_REPLACE);
+    for (i = 0; i < n && !err; i++)
+    {
+	datum dkey, dvalue;
+	int rc;
+	if (i == chunk_end)
+	{
+	    chunk_end = i + (i < LOAD_CHUNK ? LOAD_CHUNK : i);
+	    if (chunk_end > n)
+		chunk_end = n;
+	    sort_load_chunk (db, v + i, chunk_end - i);
+	}
+	dkey.dptr = rep_STR (rep_CAR(v[i].pair));
+	dkey.dsize = rep_STRING_LEN (rep_CAR(v[i].pair));
+	dvalue.dptr = rep_STR (rep_CDR(v[i].pair));
+	dvalue.dsize = rep_STRING_LEN (rep_CDR(v[i].pair));
+	rc = sdbm_store (db, dkey, dvalue, dflags);
+	if (rc == 0)
+	    stored++;
+	else if (rc < 0)
+	    err = 1;
+    }
+    free (v);
+    if (batch && sdbm_commit (db) < 0)
+	err = 1;
+    if (err)
+	return rep_signal_file_error (rep_DBM(dbm)->path);
+    return rep_make_long_int (stored);
+}
+
+struct walk_data {
+    repv dbm;
+    SDBM *db;
+    repv fun;
+    repv result;
+    rep_bool fold;
+};
+
+static int
+walk_pair (datum key, datum val, void *arg)
+{
+    struct walk_data *d = arg;
+    repv k = rep_string_dupn (key.dptr, key.dsize);
+    repv v = rep_string_dupn (val.dptr, val.dsize);
+
+    if (d->fold)
+	d->result = rep_call_lisp3 (d->fun, k, v, d->result);
+    else if (rep_call_lisp2 (d->fun, k, v) == rep_NULL)
+	d->result = rep_NULL;
+
+    /* stop if FUN closed the database, the walk is using its pages */
+    return d->result == rep_NULL || rep_DBM(d->dbm)->dbm != d->db;
+}
+
+static repv
+walk_dbm (struct walk_data *d)
+{
+    rep_GC_root gc_dbm, gc_fun, gc_result;
+    int rc;
+
+    rep_PUSHGC (gc_dbm, d->dbm);
+    rep_PUSHGC (gc_fun, d->fun);
+    rep_PUSHGC (gc_result, d->result);
+    d->db = rep_DBM(d->dbm)->dbm;
+    rc = sdbm_walk (d->db, walk_pair, d);
+    rep_POPGC; rep_POPGC; rep_POPGC;
+
+    if (rc < 0 && d->result != rep_NULL)
+	return rep_signal_file_error (rep_DBM(d->dbm)->path);
+    return d->result;
+}
+
+DEFUN("sdbm-walk", Fsdbm_walk, Ssdbm_walk, (repv fun, repv dbm), rep_Subr2) /*
+::doc:rep.io.db.sdbm#sdbm-walk::
+sdbm-walk FUN DBM
+
+Call (FUN KEY VALUE) for each key and value stored in DBM, reading its
+pages in large blocks. Changing DBM from FUN may cause some keys to be
+missed, or seen twice.
+::end:: */
+{
+    struct walk_data d;
+    rep_DECLARE2 (dbm, rep_DBMP);
+    d.dbm = dbm;
+    d.fun = fun;
+    d.result = Qnil;
+    d.fold = rep_FALSE;
+    return walk_dbm (&d);
+}
+
+DEFUN("sdbm-fold", Fsdbm_fold, Ssdbm_fold,
+      (repv fun, repv seed, repv dbm), rep_Subr3) /*
+::doc:rep.io.db.sdbm#sdbm-fold::
+sdbm-fold FUNCTION SEED DBM
+
+Call (FUNCTION KEY VALUE RESULT) for each key and value stored in DBM,
+where RESULT is SEED for the first call and the value of the previous
+call after that. Returns the value of the last call, or SEED if DBM is
+empty.
+::end:: */
+{
+    struct walk_data d;
+    rep_DECLARE3 (dbm, rep_DBMP);
+    d.dbm = dbm;
+    d.fun = fun;
+    d.result = seed;
+    d.fold = rep_TRUE;
+    return walk_dbm (&d);
+}
+
+DEFUN("sdbm-page-size", Fsdbm_page_size, Ssdbm_page_size,
+      (repv dbm), rep_Subr1) /*
+::doc:rep.io.db.sdbm#sdbm-page-size::
+sdbm-page-size DBM
+
+Return the size in bytes of the pages of DBM. No key and value stored
+in it may be larger than this, less a few bytes.
+::end:: */
+{
+    rep_DECLARE1 (dbm, rep_DBMP);
+    return rep_MAKE_INT (sdbm_pagsiz (rep_DBM(dbm)->dbm));
+}
+
 DEFUN("sdbm-rdonly", Fsdbm_rdonly, Ssdbm_rdonly, (repv dbm), rep_Subr1) /*
 ::doc:rep.io.db.sdbm#sdbm-rdonly::
 sdbm-rdonly DBM
@@ -255,6 +525,9 @@ rep_dl_init (void)
 				      0, 0, 0, 0, 0, 0, 0);
     rep_INTERN (insert);
     rep_INTERN (replace);
+    rep_INTERN (mmap);
+    rep_INTERN (page_size);
+    rep_INTERN (cache_pages);
 
     tem = rep_push_structure ("rep.io.db.sdbm");
     /* ::alias:sdbm rep.io.db.sdbm:: */
@@ -266,6 +539,12 @@ rep_dl_init (void)
     rep_ADD_SUBR(Ssdbm_delete);
     rep_ADD_SUBR(Ssdbm_firstkey);
     rep_ADD_SUBR(Ssdbm_nextkey);
+    rep_ADD_SUBR(Ssdbm_begin_batch);
+    rep_ADD_SUBR(Ssdbm_commit);
+    rep_ADD_SUBR(Ssdbm_load);
+    rep_ADD_SUBR(Ssdbm_walk);
+    rep_ADD_SUBR(Ssdbm_fold);
+    rep_ADD_SUBR(Ssdbm_page_size);
     rep_ADD_SUBR(Ssdbm_rdonly);
     rep_ADD_SUBR(Ssdbm_error);
     rep_ADD_SUBR(Ssdbmp);
@@ -61,6 +61,9 @@ static repv safe_apply_bytecode (repv subr, int nargs, repv *args);
 #define OPTIMIZE_FOR_SPACE 1
 #define BE_PARANOID 1
 
+/* the probes' semaphores are in librep, not this module */
+#undef WITH_PROBES
+
 #include "lispmach.h"
 
 
@@ -93,7 +96,7 @@ DEFUN("safe-run-byte-code", Fsafe_run_byte_code, Ssafe_run_byte_code,
     b_stkreq = (rep_INT (stkreq) >> 10) & 0x3ff;
     s_stkreq = rep_INT (stkreq) >> 20;
 
-    return vm (code, consts, 0, 0, v_stkreq, b_stkreq, s_stkreq);
+    return vm (rep_NULL, code, consts, 0, 0, v_stkreq, b_stkreq, s_stkreq);
 }
 
 DEFUN("safe-validate-byte-code", Fsafe_validate_byte_code,
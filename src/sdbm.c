@@ -20,6 +20,7 @@
 #include <memory.h>
 #endif
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -28,6 +29,14 @@
 #include <stdlib.h>
 #endif
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#if defined (HAVE_MMAP) && defined (HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#define USE_MMAP 1
+#endif
+
 #ifndef NULL
 #define NULL	0
 #endif
@@ -40,6 +49,18 @@ static int setdbit (SDBM *, long);
 static int getpage (SDBM *, long);
 static datum getnext (SDBM *);
 static int makroom (SDBM *, long, int);
+static int loadpage (SDBM *, long);
+static int putpage (SDBM *, long, char *);
+static int rdblock (int, char *, int, long);
+static struct sdbm_page *findpage (SDBM *, long);
+static void tagpage (SDBM *, struct sdbm_page *, long);
+static void usepage (SDBM *, struct sdbm_page *);
+static char *cachepage (SDBM *, long, char *);
+static int flushpage (SDBM *, struct sdbm_page *);
+static int flushcache (SDBM *);
+#ifdef USE_MMAP
+static void mapfiles (SDBM *, struct stat *);
+#endif
 
 /*
  * useful macros
@@ -48,8 +69,16 @@ static int makroom (SDBM *, long, int);
 #define exhash(item)	sdbm_hash((item).dptr, (item).dsize)
 #define ioerr(db)	((db)->flags |= SDBM_IOERR)
 
-#define OFF_PAG(off)	(long) (off) * PBLKSIZ
-#define OFF_DIR(off)	(long) (off) * DBLKSIZ
+#define OFF_PAG(off)	(long) (off) * db->pblksiz
+#define OFF_DIR(off)	((long) (off) * DBLKSIZ + db->dirbase)
+
+/*
+ * databases with other than PBLKSIZ pages start their dirfile with a
+ * block holding this (a real bitmap can't start with a zero byte
+ * unless it is all zeros), followed by the page size.
+ */
+#define DIRMAGIC	"\0sdbm page size "
+#define DIRMAGICLEN	(sizeof (DIRMAGIC) - 1)
 
 static long masks[] = {
 	000000000000, 000000000001, 000000000003, 000000000007,
@@ -96,15 +125,141 @@ register int mode;
 	return db;
 }
 
+/*
+ * as sdbm_open, but a new database has pages of PBLKSIZ bytes (a power
+ * of two from PBLKSIZ to PBLKMAX), NCACHE pages are kept in memory,
+ * and with SDBM_MMAP in OPTIONS a read-only database is mapped instead
+ */
+SDBM *
+sdbm_open_tuned(file, flags, mode, pblksiz, ncache, options)
+register char *file;
+register int flags;
+register int mode;
+int pblksiz;
+int ncache;
+int options;
+{
+	register SDBM *db;
+	register char *dirname;
+	register char *pagname;
+	register int n;
+
+	if (file == NULL || !*file)
+		return errno = EINVAL, (SDBM *) NULL;
+
+	n = strlen(file) * 2 + strlen(DIRFEXT) + strlen(PAGFEXT) + 2;
+	if ((dirname = malloc((unsigned) n)) == NULL)
+		return errno = ENOMEM, (SDBM *) NULL;
+
+	dirname = strcat(strcpy(dirname, file), DIRFEXT);
+	pagname = strcpy(dirname + strlen(dirname) + 1, file);
+	pagname = strcat(pagname, PAGFEXT);
+
+	db = sdbm_prep_tuned(dirname, pagname, flags, mode,
+			     pblksiz, ncache, options);
+	free((char *) dirname);
+	return db;
+}
+
 SDBM *
 sdbm_prep(dirname, pagname, flags, mode)
 char *dirname;
 char *pagname;
 int flags;
 int mode;
+{
+	return sdbm_prep_tuned(dirname, pagname, flags, mode,
+			       PBLKSIZ, NCACHE, 0);
+}
+
+/*
+ * free everything but the db itself
+ */
+static void
+freebufs(db)
+register SDBM *db;
+{
+	if (db->cache != NULL) {
+		int i;
+		for (i = 0; i < db->ncache; i++)
+			free(db->cache[i].data);
+		free((char *) db->cache);
+	}
+	free((char *) db->bucket);
+	free(db->twin);
+	free(db->scratch);
+#ifdef USE_MMAP
+	if (db->pagmap != NULL)
+		(void) munmap(db->pagmap, db->pagmaplen);
+	if (db->dirmap != NULL)
+		(void) munmap(db->dirmap, db->dirmaplen);
+#endif
+}
+
+/*
+ * find the page size of an existing database, or record the size of
+ * a new one. Returns zero on failure.
+ */
+static int
+dirheader(db, dstat, pblksiz)
+register SDBM *db;
+struct stat *dstat;
+int pblksiz;
+{
+	char blk[DBLKSIZ];
+	struct stat pstat;
+
+	db->pblksiz = PBLKSIZ;
+	db->dirbase = 0;
+
+	if (dstat->st_size > 0) {
+		if (rdblock(db->dirf, blk, DBLKSIZ, 0) < 0)
+			return 0;
+		if (blk[0] == 0 && memcmp(blk, DIRMAGIC, DIRMAGICLEN) == 0) {
+			db->pblksiz = atoi(blk + DIRMAGICLEN);
+			db->dirbase = DBLKSIZ;
+			if (db->pblksiz < PBLKSIZ || db->pblksiz > PBLKMAX
+			    || (db->pblksiz & (db->pblksiz - 1)) != 0)
+				return errno = EINVAL, 0;
+		}
+		return 1;
+	}
+/*
+ * an empty dirfile with a non-empty pagfile is a database with a
+ * single page of the default size
+ */
+	if (pblksiz == PBLKSIZ || sdbm_rdonly(db)
+	    || fstat(db->pagf, &pstat) != 0 || pstat.st_size > 0)
+		return 1;
+
+	if (pblksiz < PBLKSIZ || pblksiz > PBLKMAX
+	    || (pblksiz & (pblksiz - 1)) != 0)
+		return errno = EINVAL, 0;
+
+	(void) memset(blk, 0, DBLKSIZ);
+	(void) memcpy(blk, DIRMAGIC, DIRMAGICLEN);
+	(void) sprintf(blk + DIRMAGICLEN, "%d", pblksiz);
+	if (pwrite(db->dirf, blk, DBLKSIZ, 0) != DBLKSIZ)
+		return 0;
+	dstat->st_size = DBLKSIZ;
+	db->pblksiz = pblksiz;
+	db->dirbase = DBLKSIZ;
+	return 1;
+}
+
+SDBM *
+sdbm_prep_tuned(dirname, pagname, flags, mode, pblksiz, ncache, options)
+char *dirname;
+char *pagname;
+int flags;
+int mode;
+int pblksiz;
+int ncache;
+int options;
 {
 	register SDBM *db;
 	struct stat dstat;
+	int i;
 
 	if ((db = (SDBM *) malloc(sizeof(SDBM))) == NULL)
 		return errno = ENOMEM, (SDBM *) NULL;
@@ -113,6 +268,14 @@ int mode;
         db->hmask = 0;
         db->blkptr = 0;
         db->keyptr = 0;
+	db->cache = NULL;
+	db->ncache = ncache > 0 ? ncache : 1;
+	db->bucket = NULL;
+	for (db->nbucket = 1; db->nbucket < db->ncache; db->nbucket <<= 1)
+		;
+	db->twin = db->scratch = NULL;
+	db->pagmap = db->dirmap = NULL;
+	db->pagmaplen = db->dirmaplen = 0;
 /*
  * adjust user flags so that WRONLY becomes RDWR, 
  * as required by this package. Also set our internal
@@ -132,22 +295,58 @@ int mode;
 /*
  * need the dirfile size to establish max bit number.
  */
-			if (fstat(db->dirf, &dstat) == 0) {
+			if (fstat(db->dirf, &dstat) == 0
+			    && dirheader(db, &dstat, pblksiz)
+			    && (db->cache = (struct sdbm_page *)
+				calloc(db->ncache, sizeof(struct sdbm_page)))
+			    != NULL
+			    && (db->bucket = (struct sdbm_page **)
+				calloc(db->nbucket, sizeof(struct sdbm_page *)))
+			    != NULL) {
 /*
  * zero size: either a fresh database, or one with a single,
  * unsplit data page: dirpage is all zeros.
  */
-				db->dirbno = (!dstat.st_size) ? 0 : -1;
+				db->dirbno = (dstat.st_size == db->dirbase)
+					? 0 : -1;
 				db->pagbno = -1;
-				db->maxbno = dstat.st_size * BYTESIZ;
-
-				(void) memset(db->pagbuf, 0, PBLKSIZ);
+				db->maxbno = (dstat.st_size - db->dirbase)
+					* BYTESIZ;
 				(void) memset(db->dirbuf, 0, DBLKSIZ);
+
+				for (i = 0; i < db->ncache; i++) {
+					db->cache[i].blkno = -1;
+					db->cache[i].newer = (i > 0)
+						? &db->cache[i - 1] : NULL;
+					db->cache[i].older = (i < db->ncache - 1)
+						? &db->cache[i + 1] : NULL;
+					db->cache[i].data
+						= calloc(1, db->pblksiz);
+					if (db->cache[i].data == NULL)
+						goto nomem;
+				}
+				db->mru = &db->cache[0];
+				db->lru = &db->cache[db->ncache - 1];
+				db->pagbuf = db->cache[0].data;
+				if (!sdbm_rdonly(db)) {
+					db->twin = malloc(db->pblksiz);
+					db->scratch = malloc(db->pblksiz);
+					if (db->twin == NULL
+					    || db->scratch == NULL)
+						goto nomem;
+				}
+#ifdef USE_MMAP
+				if (sdbm_rdonly(db) && (options & SDBM_MMAP))
+					mapfiles(db, &dstat);
+#endif
 			/*
 			 * success
 			 */
 				return db;
+			nomem:
+				errno = ENOMEM;
 			}
+			freebufs(db);
 			(void) close(db->dirf);
 		}
 		(void) close(db->pagf);
@@ -156,6 +355,38 @@ int mode;
 	return (SDBM *) NULL;
 }
 
+#ifdef USE_MMAP
+/*
+ * map the files of a read-only database, if possible. Pages past the
+ * end of the mapping are still read into the cache.
+ */
+static void
+mapfiles(db, dstat)
+register SDBM *db;
+struct stat *dstat;
+{
+	struct stat pstat;
+	void *map;
+
+	if (fstat(db->pagf, &pstat) != 0 || pstat.st_size < db->pblksiz)
+		return;
+	map = mmap(0, pstat.st_size, PROT_READ, MAP_SHARED, db->pagf, 0);
+	if (map == MAP_FAILED)
+		return;
+	db->pagmap = map;
+	db->pagmaplen = pstat.st_size;
+
+	if (dstat->st_size > db->dirbase) {
+		map = mmap(0, dstat->st_size, PROT_READ, MAP_SHARED,
+			   db->dirf, 0);
+		if (map != MAP_FAILED) {
+			db->dirmap = map;
+			db->dirmaplen = dstat->st_size;
+		}
+	}
+}
+#endif
+
 void
 sdbm_close(db)
 register SDBM *db;
@@ -163,6 +394,8 @@ register SDBM *db;
 	if (db == NULL)
 		errno = EINVAL;
 	else {
+		(void) flushcache(db);
+		freebufs(db);
 		(void) close(db->dirf);
 		(void) close(db->pagf);
 		free((char *) db);
@@ -178,7 +411,7 @@ datum key;
 		return errno = EINVAL, nullitem;
 
 	if (getpage(db, exhash(key)))
-		return sdbm_getpair(db->pagbuf, key);
+		return sdbm_getpair(db->pagbuf, key, db->pblksiz);
 
 	return ioerr(db), nullitem;
 }
@@ -194,13 +427,12 @@ datum key;
 		return errno = EPERM, -1;
 
 	if (getpage(db, exhash(key))) {
-		if (!sdbm_delpair(db->pagbuf, key))
+		if (!sdbm_delpair(db->pagbuf, key, db->pblksiz))
 			return -1;
 /*
  * update the page file
  */
-		if (lseek(db->pagf, OFF_PAG(db->pagbno), SEEK_SET) < 0
-		    || write(db->pagf, db->pagbuf, PBLKSIZ) < 0)
+		if (!putpage(db, db->pagbno, db->pagbuf))
 			return ioerr(db), -1;
 
 		return 0;
@@ -228,7 +460,7 @@ int flags;
 /*
  * is the pair too big (or too small) for this database ??
  */
-	if (need < 0 || need > PAIRMAX)
+	if (need < 0 || need > PAIRMAXN(db->pblksiz))
 		return errno = EINVAL, -1;
 
 	if (getpage(db, (hash = exhash(key)))) {
@@ -237,25 +469,24 @@ int flags;
  * first. If it is not there, ignore.
  */
 		if (flags == SDBM_REPLACE)
-			(void) sdbm_delpair(db->pagbuf, key);
+			(void) sdbm_delpair(db->pagbuf, key, db->pblksiz);
 #ifdef SEEDUPS
-		else if (sdbm_duppair(db->pagbuf, key))
+		else if (sdbm_duppair(db->pagbuf, key, db->pblksiz))
 			return 1;
 #endif
 /*
  * if we do not have enough room, we have to split.
  */
-		if (!sdbm_fitpair(db->pagbuf, need))
+		if (!sdbm_fitpair(db->pagbuf, need, db->pblksiz))
 			if (!makroom(db, hash, need))
 				return ioerr(db), -1;
 /*
  * we have enough room or split is successful. insert the key,
  * and update the page file.
  */
-		(void) sdbm_putpair(db->pagbuf, key, val);
+		(void) sdbm_putpair(db->pagbuf, key, val, db->pblksiz);
 
-		if (lseek(db->pagf, OFF_PAG(db->pagbno), SEEK_SET) < 0
-		    || write(db->pagf, db->pagbuf, PBLKSIZ) < 0)
+		if (!putpage(db, db->pagbno, db->pagbuf))
 			return ioerr(db), -1;
 	/*
 	 * success
@@ -278,16 +509,16 @@ long hash;
 int need;
 {
 	long newp;
-	char twin[PBLKSIZ];
 	char *pag = db->pagbuf;
-	char *new = twin;
+	char *new = db->twin;
 	register int smax = SPLTMAX;
 
 	do {
 /*
  * split the current page
  */
-		(void) sdbm_splpage(pag, new, db->hmask + 1);
+		(void) sdbm_splpage(pag, new, db->hmask + 1, db->scratch,
+				    db->pblksiz);
 /*
  * address of the new page
  */
@@ -302,14 +533,33 @@ int need;
  * here, as dbm_store will do so, after it inserts the incoming pair.
  */
 		if (hash & (db->hmask + 1)) {
-			if (lseek(db->pagf, OFF_PAG(db->pagbno), SEEK_SET) < 0
-			    || write(db->pagf, db->pagbuf, PBLKSIZ) < 0)
+			if (!putpage(db, db->pagbno, db->pagbuf))
 				return 0;
+		/*
+		 * in a batch the new page gets a cache page of its own,
+		 * the old one still has to be written
+		 */
+			if (sdbm_batchp(db)
+			    && (pag = cachepage(db, newp, new)) != NULL)
+				db->pagbuf = pag;
+			else {
+		/*
+		 * the cached page becomes the new one
+		 */
+				struct sdbm_page *p;
+				pag = db->pagbuf;
+				if ((p = findpage(db, newp)) != NULL)
+					tagpage(db, p, -1);
+				if ((p = findpage(db, db->pagbno)) != NULL) {
+					if (!flushpage(db, p))
+						return 0;
+					tagpage(db, p, newp);
+				}
+				(void) memcpy(pag, new, db->pblksiz);
+			}
 			db->pagbno = newp;
-			(void) memcpy(pag, new, PBLKSIZ);
 		}
-		else if (lseek(db->pagf, OFF_PAG(newp), SEEK_SET) < 0
-			 || write(db->pagf, new, PBLKSIZ) < 0)
+		else if (!putpage(db, newp, new))
 			return 0;
 
 		if (!setdbit(db, db->curbit))
@@ -317,7 +567,7 @@ int need;
 /*
  * see if we have enough room now
  */
-		if (sdbm_fitpair(pag, need))
+		if (sdbm_fitpair(pag, need, db->pblksiz))
 			return 1;
 /*
  * try again... update curbit and hmask as getpage would have
@@ -329,8 +579,7 @@ int need;
 			((hash & (db->hmask + 1)) ? 2 : 1);
 		db->hmask |= db->hmask + 1;
 
-		if (lseek(db->pagf, OFF_PAG(db->pagbno), SEEK_SET) < 0
-		    || write(db->pagf, db->pagbuf, PBLKSIZ) < 0)
+		if (!putpage(db, db->pagbno, db->pagbuf))
 			return 0;
 
 	} while (--smax);
@@ -358,10 +607,8 @@ register SDBM *db;
 /*
  * start at page 0
  */
-	if (lseek(db->pagf, OFF_PAG(0), SEEK_SET) < 0
-	    || read(db->pagf, db->pagbuf, PBLKSIZ) < 0)
+	if (loadpage(db, 0) < 0)
 		return ioerr(db), nullitem;
-	db->pagbno = 0;
 	db->blkptr = 0;
 	db->keyptr = 0;
 
@@ -405,22 +652,288 @@ register long hash;
  * note: this lookaside cache has about 10% hit rate.
  */
 	if (pagb != db->pagbno) { 
+		if (loadpage(db, pagb) < 0)
+			return 0;
+		if (!sdbm_chkpage(db->pagbuf, db->pblksiz))
+			return db->pagbno = -1, 0;
+
+		debug(("pag read: %d\n", pagb));
+	}
+	return 1;
+}
+
+/*
+ * read LEN bytes at OFF of FD into BUF, zeroing what is past the end
+ * of the file. returns the number of bytes read, or -1
+ */
+static int
+rdblock(fd, buf, len, off)
+int fd;
+char *buf;
+int len;
+long off;
+{
+	int done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, buf + done, len - done, off + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+	if (done < len)
+		(void) memset(buf + done, 0, len - done);
+	return done;
+}
+
+/*
+ * make page BLKNO the current page, from the map or the cache if
+ * possible, else reading it into the least recently used cache page.
+ * returns the number of bytes read from the file (the page size if it
+ * was already in memory, zero past the end of the file) or -1
+ */
+static int
+loadpage(db, blkno)
+register SDBM *db;
+long blkno;
+{
+	register struct sdbm_page *p;
+	int n;
+
+	if (db->pagmap != NULL && OFF_PAG(blkno + 1) <= db->pagmaplen) {
+		db->pagbuf = db->pagmap + OFF_PAG(blkno);
+		db->pagbno = blkno;
+		return db->pblksiz;
+	}
+
+	if ((p = findpage(db, blkno)) != NULL) {
+		usepage(db, p);
+		db->pagbuf = p->data;
+		db->pagbno = blkno;
+		return db->pblksiz;
+	}
+	p = db->lru;
+	if (!flushpage(db, p))
+		return -1;
 /*
  * note: here, we assume a "hole" is read as 0s.
- * if not, must zero pagbuf first.
  */
-		if (lseek(db->pagf, OFF_PAG(pagb), SEEK_SET) < 0
-		    || read(db->pagf, db->pagbuf, PBLKSIZ) < 0)
-			return 0;
-		if (!sdbm_chkpage(db->pagbuf))
-			return 0;
-		db->pagbno = pagb;
+	tagpage(db, p, -1);
+	if ((n = rdblock(db->pagf, p->data, db->pblksiz, OFF_PAG(blkno))) < 0)
+		return -1;
+	tagpage(db, p, blkno);
+	usepage(db, p);
+	db->pagbuf = p->data;
+	db->pagbno = blkno;
+	return n;
+}
 
-		debug(("pag read: %d\n", pagb));
+static struct sdbm_page *
+findpage(db, blkno)
+register SDBM *db;
+long blkno;
+{
+	register struct sdbm_page *p;
+
+	for (p = db->bucket[blkno & (db->nbucket - 1)]; p != NULL; p = p->next)
+		if (p->blkno == blkno)
+			return p;
+	return NULL;
+}
+
+/*
+ * make P hold page BLKNO
+ */
+static void
+tagpage(db, p, blkno)
+register SDBM *db;
+register struct sdbm_page *p;
+long blkno;
+{
+	register struct sdbm_page **q;
+
+	if (p->blkno >= 0) {
+		for (q = &db->bucket[p->blkno & (db->nbucket - 1)]; *q != p;
+		     q = &(*q)->next)
+			;
+		*q = p->next;
+	}
+	p->blkno = blkno;
+	p->dirty = 0;
+	if (blkno >= 0) {
+		q = &db->bucket[blkno & (db->nbucket - 1)];
+		p->next = *q;
+		*q = p;
+	}
+}
+
+/*
+ * make P the most recently used page
+ */
+static void
+usepage(db, p)
+register SDBM *db;
+register struct sdbm_page *p;
+{
+	if (p == db->mru)
+		return;
+	p->newer->older = p->older;
+	if (p->older != NULL)
+		p->older->newer = p->newer;
+	else
+		db->lru = p->newer;
+	p->newer = NULL;
+	p->older = db->mru;
+	db->mru->newer = p;
+	db->mru = p;
+}
+
+/*
+ * write BUF as page BLKNO, also updating or dropping any copy of it
+ * in the cache. in a batch the page is only marked as changed, if it
+ * can be kept in the cache
+ */
+static int
+putpage(db, blkno, buf)
+register SDBM *db;
+long blkno;
+char *buf;
+{
+	register struct sdbm_page *p = findpage(db, blkno);
+
+	if (sdbm_batchp(db)) {
+		if (p != NULL && p->data == buf) {
+			p->dirty = 1;
+			return 1;
+		}
+		if (cachepage(db, blkno, buf) != NULL)
+			return 1;
+		p = findpage(db, blkno);
 	}
+	if (pwrite(db->pagf, buf, db->pblksiz, OFF_PAG(blkno))
+	    != db->pblksiz)
+		return 0;
+	if (p != NULL && p->data != buf)
+		tagpage(db, p, -1);
 	return 1;
 }
 
+/*
+ * in a batch, copy BUF into the cache as changed page BLKNO, replacing
+ * any page but the current one. returns the copy, or NULL
+ */
+static char *
+cachepage(db, blkno, buf)
+register SDBM *db;
+long blkno;
+char *buf;
+{
+	register struct sdbm_page *p = findpage(db, blkno);
+
+	if (p == NULL) {
+		p = db->lru;
+		if (p->data == db->pagbuf)
+			p = p->newer;
+		if (p == NULL || !flushpage(db, p))
+			return NULL;
+		tagpage(db, p, blkno);
+	}
+	usepage(db, p);
+	(void) memcpy(p->data, buf, db->pblksiz);
+	p->dirty = 1;
+	return p->data;
+}
+
+/*
+ * write cached page P if it was changed in a batch
+ */
+static int
+flushpage(db, p)
+register SDBM *db;
+register struct sdbm_page *p;
+{
+	if (p->dirty && p->blkno >= 0) {
+		if (pwrite(db->pagf, p->data, db->pblksiz, OFF_PAG(p->blkno))
+		    != db->pblksiz)
+			return ioerr(db), 0;
+	}
+	p->dirty = 0;
+	return 1;
+}
+
+static int
+flushcache(db)
+register SDBM *db;
+{
+	register int i;
+	int ok = 1;
+
+	if (db->cache == NULL)
+		return 1;
+	for (i = 0; i < db->ncache; i++) {
+		if (!flushpage(db, &db->cache[i]))
+			ok = 0;
+	}
+	return ok;
+}
+
+/*
+ * the number of pages in the database, including any still only in
+ * the cache
+ */
+long
+sdbm_npages(db)
+register SDBM *db;
+{
+	struct stat st;
+	long n = 0;
+	int i;
+
+	if (fstat(db->pagf, &st) == 0)
+		n = st.st_size / db->pblksiz;
+	for (i = 0; i < db->ncache; i++) {
+		if (db->cache[i].blkno >= n)
+			n = db->cache[i].blkno + 1;
+	}
+	return n;
+}
+
+/*
+ * start a batch of changes
+ */
+int
+sdbm_begin(db)
+register SDBM *db;
+{
+	if (db == NULL)
+		return errno = EINVAL, -1;
+	if (sdbm_rdonly(db))
+		return errno = EPERM, -1;
+	db->flags |= SDBM_BATCH;
+	return 0;
+}
+
+/*
+ * write the pages changed in a batch and wait until they, and any
+ * earlier writes, are on disk
+ */
+int
+sdbm_commit(db)
+register SDBM *db;
+{
+	if (db == NULL)
+		return errno = EINVAL, -1;
+	db->flags &= ~SDBM_BATCH;
+	if (!flushcache(db))
+		return -1;
+	if (fsync(db->pagf) < 0 || fsync(db->dirf) < 0)
+		return ioerr(db), -1;
+	return 0;
+}
+
 static int
 getdbit(db, dbit)
 register SDBM *db;
@@ -432,9 +945,11 @@ register long dbit;
 	c = dbit / BYTESIZ;
 	dirb = c / DBLKSIZ;
 
+	if (db->dirmap != NULL && db->dirbase + c < db->dirmaplen)
+		return db->dirmap[db->dirbase + c] & (1 << dbit % BYTESIZ);
+
 	if (dirb != db->dirbno) {
-		if (lseek(db->dirf, OFF_DIR(dirb), SEEK_SET) < 0
-		    || read(db->dirf, db->dirbuf, DBLKSIZ) < 0)
+		if (rdblock(db->dirf, db->dirbuf, DBLKSIZ, OFF_DIR(dirb)) < 0)
 			return 0;
 		db->dirbno = dirb;
 
@@ -456,8 +971,7 @@ register long dbit;
 	dirb = c / DBLKSIZ;
 
 	if (dirb != db->dirbno) {
-		if (lseek(db->dirf, OFF_DIR(dirb), SEEK_SET) < 0
-		    || read(db->dirf, db->dirbuf, DBLKSIZ) < 0)
+		if (rdblock(db->dirf, db->dirbuf, DBLKSIZ, OFF_DIR(dirb)) < 0)
 			return 0;
 		db->dirbno = dirb;
 
@@ -469,8 +983,7 @@ register long dbit;
 	if (dbit >= db->maxbno)
 		db->maxbno += DBLKSIZ * BYTESIZ;
 
-	if (lseek(db->dirf, OFF_DIR(dirb), SEEK_SET) < 0
-	    || write(db->dirf, db->dirbuf, DBLKSIZ) < 0)
+	if (pwrite(db->dirf, db->dirbuf, DBLKSIZ, OFF_DIR(dirb)) != DBLKSIZ)
 		return 0;
 
 	return 1;
@@ -488,24 +1001,100 @@ register SDBM *db;
 
 	for (;;) {
 		db->keyptr++;
-		key = sdbm_getnkey(db->pagbuf, db->keyptr);
+		if (db->pagbno != db->blkptr && loadpage(db, db->blkptr) <= 0)
+			break;
+		key = sdbm_getnkey(db->pagbuf, db->keyptr, db->pblksiz);
 		if (key.dptr != NULL)
 			return key;
 /*
  * we either run out, or there is nothing on this page..
- * try the next one... If we lost our position on the
- * file, we will have to seek.
+ * try the next one...
  */
 		db->keyptr = 0;
-		if (db->pagbno != db->blkptr++)
-			if (lseek(db->pagf, OFF_PAG(db->blkptr), SEEK_SET) < 0)
-				break;
-		db->pagbno = db->blkptr;
-		if (read(db->pagf, db->pagbuf, PBLKSIZ) <= 0)
+		if (loadpage(db, ++db->blkptr) <= 0)
 			break;
-		if (!sdbm_chkpage(db->pagbuf))
+		if (!sdbm_chkpage(db->pagbuf, db->pblksiz))
 			break;
 	}
 
 	return ioerr(db), nullitem;
 }
+
+/*
+ * call FN with each key and value in the database, and ARG, until it
+ * returns non-zero, reading many pages at a time. If FN changes the
+ * database some pairs may be missed, or seen twice. FN may close the
+ * database if it then returns non-zero. returns the last value of FN,
+ * or -1 on error
+ */
+#define WALKSIZ (256 * 1024)
+
+int
+sdbm_walk(db, fn, arg)
+register SDBM *db;
+int (*fn) (datum, datum, void *);
+void *arg;
+{
+	char *buf = NULL;
+	long blkno = 0;
+	int pblksiz, chunk, rc = 0;
+
+	if (db == NULL)
+		return errno = EINVAL, -1;
+
+	if (!flushcache(db))
+		return -1;
+
+	pblksiz = db->pblksiz;
+	chunk = pblksiz < WALKSIZ ? WALKSIZ / pblksiz : 1;
+	if (db->pagmap == NULL
+	    && (buf = malloc((size_t) chunk * pblksiz)) == NULL)
+		return errno = ENOMEM, -1;
+
+	while (rc == 0) {
+		char *pages;
+		int n, i;
+
+		if (db->pagmap != NULL) {
+			if (OFF_PAG(blkno) >= db->pagmaplen)
+				break;
+			pages = db->pagmap + OFF_PAG(blkno);
+			n = (db->pagmaplen - OFF_PAG(blkno)) / pblksiz;
+			if (n > chunk)
+				n = chunk;
+		}
+		else {
+			n = rdblock(db->pagf, buf, chunk * pblksiz,
+				    OFF_PAG(blkno));
+			if (n < 0) {
+				rc = -1;
+				break;
+			}
+			n = (n + pblksiz - 1) / pblksiz;
+			pages = buf;
+		}
+		if (n == 0)
+			break;
+		blkno += n;
+
+		for (i = 0; i < n && rc == 0; i++) {
+			char *pag = pages + (long) i * pblksiz;
+			int num;
+			if (!sdbm_chkpage(pag, pblksiz)) {
+				rc = -1;
+				errno = EIO;
+				break;
+			}
+			for (num = 1; rc == 0; num++) {
+				datum key = sdbm_getnkey(pag, num, pblksiz);
+				datum val;
+				if (key.dptr == NULL)
+					break;
+				val = sdbm_getpair(pag, key, pblksiz);
+				rc = (*fn) (key, val, arg);
+			}
+		}
+	}
+	free(buf);
+	return rc;
+}
@@ -5,13 +5,28 @@
  * status: public domain. 
  */
 #define DBLKSIZ 4096
-#define PBLKSIZ 1024
+#define PBLKSIZ 1024			/* default page size */
 #define PAIRMAX 1008			/* arbitrary on PBLKSIZ-N */
+#define PBLKMAX 65536			/* page offsets are unsigned shorts */
+#define PAIRMAXN(pblksiz) ((pblksiz) - (PBLKSIZ - PAIRMAX))
+#define NCACHE	16			/* default number of cached pages */
 #define SPLTMAX	10			/* maximum allowed splits */
 					/* for a single insertion */
 #define DIRFEXT	".dir"
 #define PAGFEXT	".pag"
 
+/*
+ * a page held in memory; the least recently used one is replaced
+ */
+struct sdbm_page {
+	long blkno;		       /* page number, or -1 if unused */
+	int dirty;		       /* changed since written, in a batch */
+	char *data;
+	struct sdbm_page *newer;       /* list from most recently used */
+	struct sdbm_page *older;
+	struct sdbm_page *next;	       /* next page in the same bucket */
+};
+
 typedef struct {
 	int dirf;		       /* directory file descriptor */
 	int pagf;		       /* page file descriptor */
@@ -23,24 +38,46 @@ typedef struct {
 	int keyptr;		       /* current key for nextkey */
 	long blkno;		       /* current page to read/write */
 	long pagbno;		       /* current page in pagbuf */
-	char pagbuf[PBLKSIZ];	       /* page file block buffer */
+	char *pagbuf;		       /* current page (cached or mapped) */
 	long dirbno;		       /* current block in dirbuf */
 	char dirbuf[DBLKSIZ];	       /* directory file block buffer */
+	int pblksiz;		       /* size of each page */
+	long dirbase;		       /* bytes before the dirfile bitmap */
+	int ncache;		       /* number of pages in cache */
+	struct sdbm_page *cache;
+	struct sdbm_page *mru;	       /* most recently used page */
+	struct sdbm_page *lru;	       /* least recently used page */
+	struct sdbm_page **bucket;     /* cached pages by page number */
+	long nbucket;		       /* a power of two */
+	char *twin;		       /* new page when splitting */
+	char *scratch;		       /* old page when splitting */
+	char *pagmap;		       /* read-only mapping of pagfile */
+	long pagmaplen;
+	char *dirmap;		       /* read-only mapping of dirfile */
+	long dirmaplen;
 } SDBM;
 
 #define SDBM_RDONLY	0x1	       /* data base open read-only */
 #define SDBM_IOERR	0x2	       /* data base I/O error */
+#define SDBM_BATCH	0x4	       /* changed pages are written later */
+
+/*
+ * options to sdbm_open_tuned
+ */
+#define SDBM_MMAP	0x1	       /* map the files when read-only */
 
 /*
  * utility macros
  */
 #define sdbm_rdonly(db)		((db)->flags & SDBM_RDONLY)
 #define sdbm_error(db)		((db)->flags & SDBM_IOERR)
+#define sdbm_batchp(db)		((db)->flags & SDBM_BATCH)
 
 #define sdbm_clearerr(db)	((db)->flags &= ~SDBM_IOERR)  /* ouch */
 
 #define sdbm_dirfno(db)	((db)->dirf)
 #define sdbm_pagfno(db)	((db)->pagf)
+#define sdbm_pagsiz(db)	((db)->pblksiz)
 
 typedef struct {
 	char *dptr;
@@ -66,8 +103,26 @@ extern int sdbm_store (SDBM *, datum, datum, int);
 extern datum sdbm_firstkey (SDBM *);
 extern datum sdbm_nextkey (SDBM *);
 
+/*
+ * extensions: choosing the page size (when the database is created),
+ * cache size and options; and calling a function for every pair,
+ * until it returns non-zero
+ */
+extern SDBM *sdbm_open_tuned (char *, int, int, int, int, int);
+extern int sdbm_walk (SDBM *, int (*)(datum, datum, void *), void *);
+
+/*
+ * batches: between sdbm_begin and sdbm_commit changed pages are only
+ * written when they leave the cache; sdbm_commit writes the rest and
+ * syncs the files
+ */
+extern int sdbm_begin (SDBM *);
+extern int sdbm_commit (SDBM *);
+extern long sdbm_npages (SDBM *);
+
 /*
  * other
  */
 extern SDBM *sdbm_prep (char *, char *, int, int);
+extern SDBM *sdbm_prep_tuned (char *, char *, int, int, int, int, int);
 extern long sdbm_hash (char *, int);
@@ -20,7 +20,7 @@
 /* 
  * forward 
  */
-static int seepair (char *, int, char *, int);
+static int seepair (char *, int, char *, int, int);
 
 /*
  * page format:
@@ -43,16 +43,17 @@ static int seepair (char *, int, char *, int);
  */
 
 int
-sdbm_fitpair(pag, need)
+sdbm_fitpair(pag, need, pblk)
 char *pag;
 int need;
+int pblk;
 {
 	register int n;
 	register int off;
 	register int free;
-	register short *ino = (short *) pag;
+	register unsigned short *ino = (unsigned short *) pag;
 
-	off = ((n = ino[0]) > 0) ? ino[n] : PBLKSIZ;
+	off = ((n = ino[0]) > 0) ? ino[n] : pblk;
 	free = off - (n + 1) * sizeof(short);
 	need += 2 * sizeof(short);
 
@@ -62,16 +63,17 @@ int need;
 }
 
 void
-sdbm_putpair(pag, key, val)
+sdbm_putpair(pag, key, val, pblk)
 char *pag;
 datum key;
 datum val;
+int pblk;
 {
 	register int n;
 	register int off;
-	register short *ino = (short *) pag;
+	register unsigned short *ino = (unsigned short *) pag;
 
-	off = ((n = ino[0]) > 0) ? ino[n] : PBLKSIZ;
+	off = ((n = ino[0]) > 0) ? ino[n] : pblk;
 /*
  * enter the key first
  */
@@ -91,19 +93,20 @@ datum val;
 }
 
 datum
-sdbm_getpair(pag, key)
+sdbm_getpair(pag, key, pblk)
 char *pag;
 datum key;
+int pblk;
 {
 	register int i;
 	register int n;
 	datum val;
-	register short *ino = (short *) pag;
+	register unsigned short *ino = (unsigned short *) pag;
 
 	if ((n = ino[0]) == 0)
 		return nullitem;
 
-	if ((i = seepair(pag, n, key.dptr, key.dsize)) == 0)
+	if ((i = seepair(pag, n, key.dptr, key.dsize, pblk)) == 0)
 		return nullitem;
 
 	val.dptr = pag + ino[i + 1];
@@ -113,29 +116,32 @@ datum key;
 
 #ifdef SEEDUPS
 int
-sdbm_duppair(pag, key)
+sdbm_duppair(pag, key, pblk)
 char *pag;
 datum key;
+int pblk;
 {
-	register short *ino = (short *) pag;
-	return ino[0] > 0 && seepair(pag, ino[0], key.dptr, key.dsize) > 0;
+	register unsigned short *ino = (unsigned short *) pag;
+	return ino[0] > 0
+		&& seepair(pag, ino[0], key.dptr, key.dsize, pblk) > 0;
 }
 #endif
 
 datum
-sdbm_getnkey(pag, num)
+sdbm_getnkey(pag, num, pblk)
 char *pag;
 int num;
+int pblk;
 {
 	datum key;
 	register int off;
-	register short *ino = (short *) pag;
+	register unsigned short *ino = (unsigned short *) pag;
 
 	num = num * 2 - 1;
 	if (ino[0] == 0 || num > ino[0])
 		return nullitem;
 
-	off = (num > 1) ? ino[num - 1] : PBLKSIZ;
+	off = (num > 1) ? ino[num - 1] : pblk;
 
 	key.dptr = pag + ino[num];
 	key.dsize = off - ino[num];
@@ -144,18 +150,19 @@ int num;
 }
 
 int
-sdbm_delpair(pag, key)
+sdbm_delpair(pag, key, pblk)
 char *pag;
 datum key;
+int pblk;
 {
 	register int n;
 	register int i;
-	register short *ino = (short *) pag;
+	register unsigned short *ino = (unsigned short *) pag;
 
 	if ((n = ino[0]) == 0)
 		return 0;
 
-	if ((i = seepair(pag, n, key.dptr, key.dsize)) == 0)
+	if ((i = seepair(pag, n, key.dptr, key.dsize, pblk)) == 0)
 		return 0;
 /*
  * found the key. if it is the last entry
@@ -166,7 +173,7 @@ datum key;
  */
 	if (i < n - 1) {
 		register int m;
-		register char *dst = pag + (i == 1 ? PBLKSIZ : ino[i - 1]);
+		register char *dst = pag + (i == 1 ? pblk : ino[i - 1]);
 		register char *src = pag + ino[i + 1];
 		register int   zoo = dst - src;
 
@@ -216,15 +223,16 @@ datum key;
  * return 0 if not found.
  */
 static int
-seepair(pag, n, key, siz)
+seepair(pag, n, key, siz, pblk)
 char *pag;
 register int n;
 register char *key;
 register int siz;
+int pblk;
 {
 	register int i;
-	register int off = PBLKSIZ;
-	register short *ino = (short *) pag;
+	register int off = pblk;
+	register unsigned short *ino = (unsigned short *) pag;
 
 	for (i = 1; i < n; i += 2) {
 		if (siz == off - ino[i] &&
@@ -236,22 +244,23 @@ register int siz;
 }
 
 void
-sdbm_splpage(pag, new, sbit)
+sdbm_splpage(pag, new, sbit, cur, pblk)
 char *pag;
 char *new;
 long sbit;
+char *cur;			/* scratch space for a page */
+int pblk;
 {
 	datum key;
 	datum val;
 
 	register int n;
-	register int off = PBLKSIZ;
-	char cur[PBLKSIZ];
-	register short *ino = (short *) cur;
+	register int off = pblk;
+	register unsigned short *ino = (unsigned short *) cur;
 
-	(void) memcpy(cur, pag, PBLKSIZ);
-	(void) memset(pag, 0, PBLKSIZ);
-	(void) memset(new, 0, PBLKSIZ);
+	(void) memcpy(cur, pag, pblk);
+	(void) memset(pag, 0, pblk);
+	(void) memset(new, 0, pblk);
 
 	n = ino[0];
 	for (ino++; n > 0; ino += 2) {
@@ -262,15 +271,16 @@ long sbit;
 /*
  * select the page pointer (by looking at sbit) and insert
  */
-		(void) sdbm_putpair((exhash(key) & sbit) ? new : pag, key, val);
+		(void) sdbm_putpair((exhash(key) & sbit) ? new : pag, key, val,
+				    pblk);
 
 		off = ino[1];
 		n -= 2;
 	}
 
-	debug(("%d split %d/%d\n", ((short *) cur)[0] / 2, 
-	       ((short *) new)[0] / 2,
-	       ((short *) pag)[0] / 2));
+	debug(("%d split %d/%d\n", ((unsigned short *) cur)[0] / 2, 
+	       ((unsigned short *) new)[0] / 2,
+	       ((unsigned short *) pag)[0] / 2));
 }
 
 /*
@@ -280,18 +290,19 @@ long sbit;
  * this could be made more rigorous.
  */
 int
-sdbm_chkpage(pag)
+sdbm_chkpage(pag, pblk)
 char *pag;
+int pblk;
 {
 	register int n;
 	register int off;
-	register short *ino = (short *) pag;
+	register unsigned short *ino = (unsigned short *) pag;
 
-	if ((n = ino[0]) < 0 || n > PBLKSIZ / sizeof(short))
+	if ((n = ino[0]) > pblk / sizeof(short))
 		return 0;
 
 	if (n > 0) {
-		off = PBLKSIZ;
+		off = pblk;
 		for (ino++; n > 0; ino += 2) {
 			if (ino[0] > off || ino[1] > off ||
 			    ino[1] > ino[0])
@@ -1,10 +1,10 @@
-extern int sdbm_fitpair (char *, int);
-extern void  sdbm_putpair (char *, datum, datum);
-extern datum	sdbm_getpair (char *, datum);
-extern int  sdbm_delpair (char *, datum);
-extern int  sdbm_chkpage (char *);
-extern datum sdbm_getnkey (char *, int);
-extern void sdbm_splpage (char *, char *, long);
+extern int sdbm_fitpair (char *, int, int);
+extern void  sdbm_putpair (char *, datum, datum, int);
+extern datum	sdbm_getpair (char *, datum, int);
+extern int  sdbm_delpair (char *, datum, int);
+extern int  sdbm_chkpage (char *, int);
+extern datum sdbm_getnkey (char *, int, int);
+extern void sdbm_splpage (char *, char *, long, char *, int);
 #ifdef SEEDUPS
-extern int sdbm_duppair (char *, datum);
+extern int sdbm_duppair (char *, datum, int);
 #endif
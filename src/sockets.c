@@ -31,6 +31,8 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
@@ -63,12 +65,28 @@ struct rep_socket_struct {
     repv addr, port;
     repv p_addr, p_port;
     repv stream, sentinel;
+
+    /* Output not yet written */
+    char *obuf;
+    size_t olen, osize;
+
+    /* When RECEIVER is a function, input is collected in IBUF (bytes
+       ISTART to ISTART+ILEN) until FRAME matches. FRAME is a delimiter
+       string, a byte count, or false for any input. ISCANNED bytes are
+       known not to contain the delimiter. IGENERATION counts the
+       changes made by the receiver. */
+    repv receiver, frame;
+    char *ibuf;
+    size_t istart, ilen, isize, iscanned;
+    unsigned long igeneration;
 };
 
 #define IS_ACTIVE		(1 << (rep_CELL16_TYPE_BITS + 0))
 #define IS_REGISTERED		(1 << (rep_CELL16_TYPE_BITS + 1))
+#define IS_FLUSHING		(1 << (rep_CELL16_TYPE_BITS + 2))
 #define SOCKET_IS_ACTIVE(s)	((s)->car & IS_ACTIVE)
 #define SOCKET_IS_REGISTERED(s)	((s)->car & IS_REGISTERED)
+#define SOCKET_IS_FLUSHING(s)	((s)->car & IS_FLUSHING)
 
 #define SOCKETP(x)		rep_CELL16_TYPEP (x, socket_type)
 #define SOCKET(x)		((rep_socket *) rep_PTR (x))
@@ -76,6 +94,8 @@ struct rep_socket_struct {
 #define ACTIVE_SOCKET_P(x)	(SOCKETP (x) \
 				 && (SOCKET_IS_ACTIVE (SOCKET (x))))
 
+static rep_bool flush_socket (rep_socket *s, rep_bool signal);
+
 
 /* data structure management */
 
@@ -92,6 +112,12 @@ make_socket_ (int sock_fd, int namespace, int style)
     s->addr = rep_NULL;
     s->p_addr = rep_NULL;
     s->sentinel = s->stream = Qnil;
+    s->obuf = 0;
+    s->olen = s->osize = 0;
+    s->receiver = s->frame = Qnil;
+    s->ibuf = 0;
+    s->istart = s->ilen = s->isize = s->iscanned = 0;
+    s->igeneration = 0;
 
     s->next = socket_list;
     socket_list = s;
@@ -116,6 +142,18 @@ make_socket (int namespace, int style)
 static void
 shutdown_socket (rep_socket *s)
 {
+    if (SOCKET_IS_FLUSHING (s))
+    {
+	rep_deregister_output_fd (s->sock);
+	s->car &= ~IS_FLUSHING;
+    }
+    if (s->obuf != 0)
+    {
+	rep_free (s->obuf);
+	s->obuf = 0;
+	s->olen = s->osize = 0;
+    }
+
     if (s->sock >= 0)
     {
 	close (s->sock);
@@ -144,6 +182,8 @@ delete_socket (rep_socket *s)
     if (SOCKET_IS_ACTIVE (s))
 	shutdown_socket (s);
 
+    if (s->ibuf != 0)
+	rep_free (s->ibuf);
     rep_FREE_CELL (s);
 }
 
@@ -162,6 +202,113 @@ socket_for_fd (int fd)
 
 /* clients */
 
+/* Make room in the input buffer of S for at least NEED more bytes. */
+static rep_bool
+reserve_input (rep_socket *s, size_t need)
+{
+    if (s->istart + s->ilen + need <= s->isize)
+	return rep_TRUE;
+
+    if (s->istart > 0)
+    {
+	memmove (s->ibuf, s->ibuf + s->istart, s->ilen);
+	s->istart = 0;
+    }
+    if (s->ilen + need > s->isize)
+    {
+	size_t new_size = MAX (s->isize * 2, 4096);
+	char *new;
+	while (new_size < s->ilen + need)
+	    new_size *= 2;
+	new = (s->ibuf == 0 ? rep_alloc (new_size)
+	       : rep_realloc (s->ibuf, new_size));
+	if (new == 0)
+	    return rep_FALSE;
+	s->ibuf = new;
+	s->isize = new_size;
+    }
+    return rep_TRUE;
+}
+
+/* Return the length of the first complete frame in the input buffer
+   of S, or -1 if there isn't one yet. */
+static long
+input_frame_length (rep_socket *s)
+{
+    if (rep_INTP (s->frame))
+	return s->ilen >= (size_t) rep_INT (s->frame) ? rep_INT (s->frame) : -1;
+    else if (rep_STRINGP (s->frame))
+    {
+	size_t dlen = rep_STRING_LEN (s->frame);
+	size_t from = s->iscanned >= dlen ? s->iscanned - dlen + 1 : 0;
+	char *found;
+	if (dlen == 0)
+	    return 0;
+	found = rep_str_search (s->ibuf + s->istart + from, s->ilen - from,
+				rep_STR (s->frame), dlen, rep_FALSE);
+	if (found == 0)
+	{
+	    s->iscanned = s->ilen;
+	    return -1;
+	}
+	return (found - (s->ibuf + s->istart)) + dlen;
+    }
+    else
+	return s->ilen > 0 ? (long) s->ilen : -1;
+}
+
+/* Remove LEN bytes from the front of the input buffer of S, returning
+   them as a string. */
+static repv
+take_input (rep_socket *s, size_t len)
+{
+    repv str = rep_string_dupn (s->ibuf + s->istart, len);
+    s->istart += len;
+    s->ilen -= len;
+    s->iscanned = 0;
+    if (s->ilen == 0)
+	s->istart = 0;
+    s->igeneration++;
+    return str;
+}
+
+/* Call the receiver of S while there are complete frames that it's
+   consuming. */
+static void
+deliver_input_frames (rep_socket *s)
+{
+    while (s->receiver != Qnil && rep_throw_value == rep_NULL
+	   && input_frame_length (s) >= 0)
+    {
+	unsigned long generation = s->igeneration;
+	if (rep_call_lisp1 (s->receiver, rep_VAL (s)) == rep_NULL
+	    || s->igeneration == generation)
+	{
+	    break;
+	}
+    }
+}
+
+/* Read everything available from S into its input buffer. Returns the
+   result of the last read. */
+static int
+read_into_buffer (rep_socket *s)
+{
+    int actual;
+    do {
+	if (!reserve_input (s, 4096))
+	{
+	    errno = ENOMEM;
+	    return -1;
+	}
+	actual = read (s->sock, s->ibuf + s->istart + s->ilen,
+		       s->isize - (s->istart + s->ilen));
+	if (actual > 0)
+	    s->ilen += actual;
+    } while (actual > 0 || (actual < 0 && errno == EINTR));
+    return actual;
+}
+
 static void
 client_socket_output (int fd)
 {
@@ -171,6 +318,25 @@ client_socket_output (int fd)
 
     DB (("client_socket_output for %d\n", fd));
 
+    if (s->receiver != Qnil)
+    {
+	rep_GC_root gc_s;
+	repv sock = rep_VAL (s);
+	int read_errno;
+	actual = read_into_buffer (s);
+	read_errno = errno;
+	rep_PUSHGC (gc_s, sock);
+	deliver_input_frames (s);
+	rep_POPGC;
+	if (SOCKET_IS_ACTIVE (s)
+	    && (actual == 0 || (actual < 0 && read_errno != EWOULDBLOCK
+				&& read_errno != EAGAIN)))
+	{
+	    shutdown_socket_and_call_sentinel (s);
+	}
+	return;
+    }
+
     do {
 	actual = read (fd, buf, 1024);
 	if (actual > 0)
@@ -420,11 +586,20 @@ DEFUN ("close-socket", Fclose_socket, Sclose_socket, (repv sock), rep_Subr1) /*
 ::doc:rep.io.sockets#close-socket::
 close-socket SOCKET
 
-Shutdown the connection associate with SOCKET. Note that this does not
-cause the SENTINEL function associated with SOCKET to run.
+Shutdown the connection associate with SOCKET, after sending any
+buffered output. Note that this does not cause the SENTINEL function
+associated with SOCKET to run.
 ::end:: */
 {
     rep_DECLARE (1, sock, SOCKETP (sock));
+    if (SOCKET_IS_ACTIVE (SOCKET (sock)))
+    {
+	/* Don't let a failed flush call the sentinel */
+	repv sentinel = SOCKET (sock)->sentinel;
+	SOCKET (sock)->sentinel = Qnil;
+	flush_socket (SOCKET (sock), rep_FALSE);
+	SOCKET (sock)->sentinel = sentinel;
+    }
     shutdown_socket (SOCKET (sock));
     return Qnil;
 }
@@ -625,6 +800,170 @@ returns false.
 	     1, &SOCKET (sock)->sock));
 }
 
+DEFUN ("set-socket-receiver", Fset_socket_receiver, Sset_socket_receiver,
+       (repv sock, repv fun, repv frame), rep_Subr3) /*
+::doc:rep.io.sockets#set-socket-receiver::
+set-socket-receiver SOCKET FUNCTION [FRAME]
+
+Collect input arriving on SOCKET in a buffer instead of copying it to
+the socket's output stream, calling FUNCTION with SOCKET as its only
+argument whenever the buffer holds a complete frame. FUNCTION should
+remove the frame using `socket-read-until' or `socket-read-bytes'; it
+is called again for as long as it keeps doing so (or changing the
+framing) and further frames are available.
+
+FRAME may be a string, a frame is then everything up to and including
+the next occurrence of it, or an integer, the number of bytes in each
+frame. If FRAME is false, any input makes a frame. This function may
+be called from within FUNCTION to change how the next frame is found.
+
+If FUNCTION is false, input is copied to the output stream of SOCKET
+again, any data still buffered can be read with `socket-read-bytes'.
+::end:: */
+{
+    rep_socket *s;
+    rep_DECLARE (1, sock, SOCKETP (sock));
+    rep_DECLARE (3, frame, rep_NILP (frame)
+		 || (rep_STRINGP (frame) && rep_STRING_LEN (frame) > 0)
+		 || (rep_INTP (frame) && rep_INT (frame) > 0));
+    s = SOCKET (sock);
+    s->receiver = fun;
+    s->frame = frame;
+    s->iscanned = 0;
+    s->igeneration++;
+    return fun;
+}
+
+DEFUN ("socket-read-until", Fsocket_read_until, Ssocket_read_until,
+       (repv sock, repv delim), rep_Subr2) /*
+::doc:rep.io.sockets#socket-read-until::
+socket-read-until SOCKET DELIMITER
+
+Remove and return the input buffered for SOCKET up to and including the
+first occurrence of the string DELIMITER, or return false if DELIMITER
+hasn't arrived yet. See `set-socket-receiver'.
+::end:: */
+{
+    rep_socket *s;
+    char *found;
+    rep_DECLARE (1, sock, SOCKETP (sock));
+    rep_DECLARE2 (delim, rep_STRINGP);
+    s = SOCKET (sock);
+    if (s->ilen == 0)
+	return Qnil;
+    if (delim == s->frame || Fequal (delim, s->frame) != Qnil)
+    {
+	long len = input_frame_length (s);
+	return len >= 0 ? take_input (s, len) : Qnil;
+    }
+    found = rep_str_search (s->ibuf + s->istart, s->ilen,
+			    rep_STR (delim), rep_STRING_LEN (delim), rep_FALSE);
+    if (found == 0)
+	return Qnil;
+    return take_input (s, (found - (s->ibuf + s->istart))
+		       + rep_STRING_LEN (delim));
+}
+
+DEFUN ("socket-read-bytes", Fsocket_read_bytes, Ssocket_read_bytes,
+       (repv sock, repv count), rep_Subr2) /*
+::doc:rep.io.sockets#socket-read-bytes::
+socket-read-bytes SOCKET [COUNT]
+
+Remove and return the next COUNT bytes of input buffered for SOCKET,
+or false if fewer than COUNT bytes have arrived. If COUNT is undefined,
+return all buffered input (or false if there is none). See
+`set-socket-receiver'.
+::end:: */
+{
+    rep_socket *s;
+    rep_DECLARE (1, sock, SOCKETP (sock));
+    rep_DECLARE (2, count, rep_NILP (count)
+		 || (rep_INTP (count) && rep_INT (count) >= 0));
+    s = SOCKET (sock);
+    if (rep_INTP (count))
+    {
+	if (s->ilen < (size_t) rep_INT (count))
+	    return Qnil;
+	return take_input (s, rep_INT (count));
+    }
+    else
+	return s->ilen > 0 ? take_input (s, s->ilen) : Qnil;
+}
+
+DEFUN ("socket-fork", Fsocket_fork, Ssocket_fork,
+       (repv fun, repv stream, repv sentinel), rep_Subr3) /*
+::doc:rep.io.sockets#socket-fork::
+socket-fork FUNCTION [STREAM] [SENTINEL]
+
+Start a new process running a copy of this Lisp system, connected to
+this one by a pair of sockets, and return this process's end of the
+connection. The new process calls FUNCTION with its own end as the
+only argument, then exits, successfully unless FUNCTION raised an
+error.
+
+The new process doesn't share any of the sockets, subprocesses or
+pending timers of this one, and doesn't unwind any of the dynamic
+state it inherited when it exits. Nothing needs to wait for it.
+
+STREAM and SENTINEL are used as for `socket-local-client'.
+::end:: */
+{
+    int fds[2];
+    pid_t pid;
+    rep_socket *s;
+
+    if (socketpair (AF_LOCAL, SOCK_STREAM, 0, fds) != 0)
+	return rep_signal_file_error (Qnil);
+
+    /* Or buffered output would be written by both processes */
+    fflush (0);
+
+    pid = fork ();
+    if (pid == 0)
+    {
+	repv ret;
+
+	/* Fork again so that init reaps the process, not us */
+	pid = fork ();
+	if (pid != 0)
+	    _exit (pid < 0 ? 1 : 0);
+
+	close (fds[0]);
+	rep_isolate_forked_child ();
+
+	s = make_socket_ (fds[1], PF_LOCAL, SOCK_STREAM);
+	rep_unix_set_fd_nonblocking (s->sock);
+	rep_register_input_fd (s->sock, client_socket_output);
+	s->car |= IS_REGISTERED;
+
+	ret = rep_call_lisp1 (fun, rep_VAL (s));
+	if (SOCKET_IS_ACTIVE (s))
+	    flush_socket (s, rep_FALSE);
+	fflush (0);
+	_exit (ret != rep_NULL ? 0 : 1);
+    }
+
+    close (fds[1]);
+    if (pid < 0)
+    {
+	int saved_errno = errno;
+	close (fds[0]);
+	errno = saved_errno;
+	return rep_signal_file_error (Qnil);
+    }
+
+    while (waitpid (pid, 0, 0) < 0 && errno == EINTR)
+	;
+
+    s = make_socket_ (fds[0], PF_LOCAL, SOCK_STREAM);
+    rep_unix_set_fd_nonblocking (s->sock);
+    rep_register_input_fd (s->sock, client_socket_output);
+    s->car |= IS_REGISTERED;
+    s->stream = stream;
+    s->sentinel = sentinel;
+    return rep_VAL (s);
+}
+
 DEFUN ("socketp", Fsocketp, Ssocketp, (repv arg), rep_Subr1) /*
 ::doc:rep.io.sockets#socketp::
 socketp ARG
@@ -638,27 +977,162 @@ Return true if ARG is an unclosed socket object.
 
 /* type hooks */
 
+/* Output buffering
+
+   Output to a socket is collected in its obuf and written using as few
+   system calls as possible: as soon as OUTPUT-LOW-WATER bytes are
+   waiting, or otherwise the next time librep waits for input (the
+   socket is registered with the event loop, which calls
+   socket_writable () once it can be written to), or when explicitly
+   flushed. Writes that can't be completed immediately leave the rest
+   of the data buffered; only when more than OUTPUT-HIGH-WATER bytes are
+   waiting does the writer block until the buffer has drained to
+   OUTPUT-LOW-WATER. */
+
+static int output_low_water = 4096;
+static int output_high_water = 65536;
+
 DEFSTRING (inactive_socket, "Inactive socket");
 
+/* Append LEN bytes from DATA to the output buffer of S. */
 static rep_bool
-poll_for_input (int fd)
+buffer_output (rep_socket *s, const char *data, size_t len)
 {
-    fd_set inputs;
-    int ready;
+    if (s->olen + len > s->osize)
+    {
+	size_t new_size = MAX (s->osize * 2, 1024);
+	char *new;
+	while (new_size < s->olen + len)
+	    new_size *= 2;
+	new = (s->obuf == 0 ? rep_alloc (new_size)
+	       : rep_realloc (s->obuf, new_size));
+	if (new == 0)
+	    return rep_FALSE;
+	s->obuf = new;
+	s->osize = new_size;
+    }
+    memcpy (s->obuf + s->olen, data, len);
+    s->olen += len;
+    return rep_TRUE;
+}
+
+/* Write as much of the buffered output of S followed by LEN bytes from
+   DATA as possible without blocking, buffering the rest. Returns false
+   after an error has shut S down, signalling it if SIGNAL is true. */
+static rep_bool
+push_output (rep_socket *s, const char *data, size_t len, rep_bool signal)
+{
+    struct iovec iov[2];
+    int n = 0;
+    ssize_t actual;
+
+    if (s->olen > 0)
+    {
+	iov[n].iov_base = s->obuf;
+	iov[n].iov_len = s->olen;
+	n++;
+    }
+    if (len > 0)
+    {
+	iov[n].iov_base = (char *) data;
+	iov[n].iov_len = len;
+	n++;
+    }
+    if (n == 0)
+	return rep_TRUE;
 
-    FD_ZERO (&inputs);
-    FD_SET (fd, &inputs);
-    ready = select (FD_SETSIZE, 0, &inputs, 0, 0);
+    do {
+	actual = writev (s->sock, iov, n);
+    } while (actual < 0 && errno == EINTR);
 
-    return ready == 1;
+    if (actual < 0)
+    {
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    goto error;
+	actual = 0;
+    }
+
+    if ((size_t) actual >= s->olen)
+    {
+	actual -= s->olen;
+	s->olen = 0;
+	data += actual;
+	len -= actual;
+    }
+    else
+    {
+	memmove (s->obuf, s->obuf + actual, s->olen - actual);
+	s->olen -= actual;
+    }
+
+    if (len > 0 && !buffer_output (s, data, len))
+    {
+	errno = ENOMEM;
+	goto error;
+    }
+    return rep_TRUE;
+
+error:
+    if (signal)
+	rep_signal_file_error (rep_VAL (s));
+    shutdown_socket_and_call_sentinel (s);
+    return rep_FALSE;
 }
 
-/* Returns the number of bytes actually written. */
-static unsigned int
-blocking_write (rep_socket *s, char *data, unsigned int bytes)
+/* Write all buffered output of S, blocking if necessary. */
+static rep_bool
+flush_socket (rep_socket *s, rep_bool signal)
+{
+    while (SOCKET_IS_ACTIVE (s) && s->olen > 0)
+    {
+	if (!push_output (s, 0, 0, signal))
+	    return rep_FALSE;
+	if (s->olen > 0 && !rep_unix_wait_for_output (s->sock))
+	{
+	    if (signal)
+		rep_signal_file_error (rep_VAL (s));
+	    shutdown_socket_and_call_sentinel (s);
+	    return rep_FALSE;
+	}
+    }
+    return rep_TRUE;
+}
+
+static void
+socket_writable (int fd)
 {
-    unsigned int done = 0;
+    rep_socket *s = socket_for_fd (fd);
+
+    DB (("socket_writable for %d\n", fd));
 
+    if (push_output (s, 0, 0, rep_FALSE) && s->olen == 0)
+    {
+	rep_deregister_output_fd (fd);
+	s->car &= ~IS_FLUSHING;
+    }
+}
+
+/* Make sure that buffered output of S will be written eventually. */
+static rep_bool
+schedule_flush (rep_socket *s)
+{
+    if (s->olen > 0 && !SOCKET_IS_FLUSHING (s))
+    {
+	if (rep_register_output_fd (s->sock, socket_writable))
+	    s->car |= IS_FLUSHING;
+	else
+	{
+	    /* Whoever is running the event loop can't tell us */
+	    return flush_socket (s, rep_TRUE);
+	}
+    }
+    return rep_TRUE;
+}
+
+/* Returns the number of bytes actually written. */
+static int
+socket_write (rep_socket *s, const char *data, size_t bytes)
+{
     if (!SOCKET_IS_ACTIVE (s))
     {
 	Fsignal (Qfile_error, rep_list_2 (rep_VAL (&inactive_socket),
@@ -666,42 +1140,99 @@ blocking_write (rep_socket *s, char *data, unsigned int bytes)
 	return -1;
     }
 
-    do {
-	int actual = write (s->sock, data + done, bytes - done);
-	if (actual < 0)
+    if (s->olen + bytes < (size_t) output_low_water)
+    {
+	if (!buffer_output (s, data, bytes))
 	{
-	    if (errno == EAGAIN || errno == EWOULDBLOCK)
-	    {
-		if (!poll_for_input (s->sock))
-		    goto error;
-	    }
-	    else if (errno != EINTR)
-		goto error;
+	    rep_mem_error ();
+	    return -1;
 	}
-	else
-	    done += actual;
-    } while (done < bytes);
+    }
+    else
+    {
+	if (!push_output (s, data, bytes, rep_TRUE))
+	    return -1;
 
-    return done;
+	while (s->olen > (size_t) output_high_water)
+	{
+	    /* Too much waiting, block until it drains */
+	    do {
+		if (!rep_unix_wait_for_output (s->sock))
+		{
+		    rep_signal_file_error (rep_VAL (s));
+		    shutdown_socket_and_call_sentinel (s);
+		    return -1;
+		}
+		if (!push_output (s, 0, 0, rep_TRUE))
+		    return -1;
+	    } while (s->olen > (size_t) output_low_water);
+	}
+    }
 
-error:
-    rep_signal_file_error (rep_VAL (s));
-    shutdown_socket_and_call_sentinel (s);
-    return -1;
+    if (!schedule_flush (s))
+	return -1;
+
+    return bytes;
 }
 
 static int
 socket_putc (repv stream, int c)
 {
     char data = c;
-    return blocking_write (SOCKET (stream), &data, 1);
+    return socket_write (SOCKET (stream), &data, 1);
 }
 
 static int
 socket_puts (repv stream, void *data, int len, rep_bool is_lisp)
 {
     char *buf = is_lisp ? rep_STR(data) : data;
-    return blocking_write (SOCKET (stream), buf, len);
+    return socket_write (SOCKET (stream), buf, len);
+}
+
+static int
+socket_fd (repv stream)
+{
+    rep_socket *s = SOCKET (stream);
+    if (!SOCKET_IS_ACTIVE (s) || !flush_socket (s, rep_TRUE))
+	return -1;
+    return s->sock;
+}
+
+DEFUN ("socket-flush", Fsocket_flush, Ssocket_flush, (repv sock), rep_Subr1) /*
+::doc:rep.io.sockets#socket-flush::
+socket-flush SOCKET
+
+Write any output to SOCKET that is still buffered, waiting until it has
+all been sent.
+::end:: */
+{
+    rep_DECLARE (1, sock, ACTIVE_SOCKET_P (sock));
+    return flush_socket (SOCKET (sock), rep_TRUE) ? Qt : rep_NULL;
+}
+
+DEFUN ("socket-output-low-water", Fsocket_output_low_water,
+       Ssocket_output_low_water, (repv arg), rep_Subr1) /*
+::doc:rep.io.sockets#socket-output-low-water::
+socket-output-low-water [NEW-VALUE]
+
+Output to sockets is collected until this many bytes are waiting, or
+until librep next waits for input, before it is sent.
+::end:: */
+{
+    return rep_handle_var_int (arg, &output_low_water);
+}
+
+DEFUN ("socket-output-high-water", Fsocket_output_high_water,
+       Ssocket_output_high_water, (repv arg), rep_Subr1) /*
+::doc:rep.io.sockets#socket-output-high-water::
+socket-output-high-water [NEW-VALUE]
+
+When more than this many bytes of output to a socket can't be sent
+immediately, writing to the socket waits until no more than
+`socket-output-low-water' bytes remain unsent.
+::end:: */
+{
+    return rep_handle_var_int (arg, &output_high_water);
 }
 
 static void
@@ -710,6 +1241,8 @@ socket_mark (repv val)
     rep_MARKVAL (SOCKET (val)->addr);
     rep_MARKVAL (SOCKET (val)->stream);
     rep_MARKVAL (SOCKET (val)->sentinel);
+    rep_MARKVAL (SOCKET (val)->receiver);
+    rep_MARKVAL (SOCKET (val)->frame);
 }
 
 static void
@@ -752,6 +1285,29 @@ socket_print (repv stream, repv arg)
 
 /* dl hooks */
 
+/* A forked child closes its copies of the parent's sockets, so that
+   their peers still see them close when the parent closes them. */
+static void
+sockets_after_fork (void)
+{
+    rep_socket *s;
+    for (s = socket_list; s != 0; s = s->next)
+    {
+	if (SOCKET_IS_ACTIVE (s))
+	{
+	    if (s->obuf != 0)
+	    {
+		rep_free (s->obuf);
+		s->obuf = 0;
+		s->olen = s->osize = 0;
+	    }
+	    close (s->sock);
+	    s->sock = -1;
+	    s->car &= ~(IS_ACTIVE | IS_REGISTERED | IS_FLUSHING);
+	}
+    }
+}
+
 repv
 rep_dl_init (void)
 {
@@ -761,6 +1317,7 @@ rep_dl_init (void)
 					 socket_print, socket_sweep,
 					 socket_mark, socket_mark_active,
 					 0, 0, socket_putc, socket_puts, 0, 0);
+    rep_get_data_type (socket_type)->fd = socket_fd;
 
     rep_ADD_SUBR (Ssocket_local_client);
     rep_ADD_SUBR (Ssocket_local_server);
@@ -774,9 +1331,17 @@ rep_dl_init (void)
     rep_ADD_SUBR (Ssocket_peer_port);
     rep_ADD_SUBR (Saccept_socket_output_1);
     rep_ADD_SUBR (Ssocketp);
+    rep_ADD_SUBR (Ssocket_flush);
+    rep_ADD_SUBR (Sset_socket_receiver);
+    rep_ADD_SUBR (Ssocket_read_until);
+    rep_ADD_SUBR (Ssocket_read_bytes);
+    rep_ADD_SUBR (Ssocket_fork);
+    rep_ADD_SUBR (Ssocket_output_low_water);
+    rep_ADD_SUBR (Ssocket_output_high_water);
 
     rep_register_process_input_handler (client_socket_output);
     rep_register_process_input_handler (server_socket_output);
+    rep_add_after_fork_callback (sockets_after_fork);
 
     return rep_pop_structure (tem);
 }
@@ -786,6 +1351,11 @@ rep_dl_kill (void)
 {
     rep_socket *s;
     for (s = socket_list; s != 0; s = s->next)
+    {
+	s->sentinel = Qnil;
+	if (SOCKET_IS_ACTIVE (s))
+	    flush_socket (s, rep_FALSE);
 	shutdown_socket (s);
+    }
     socket_list = 0;
 }
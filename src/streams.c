@@ -60,6 +60,7 @@ char *alloca ();
 
 #include <string.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <ctype.h>
 #include <stdlib.h>
 
@@ -123,7 +124,7 @@ rep_stream_getc(repv stream)
 	    if(rep_NILP(rep_FILE(stream)->name))
 		c = EOF;
 	    else if(rep_LOCAL_FILE_P(stream))
-		c = getc(rep_FILE(stream)->file.fh);
+		c = rep_getc(rep_FILE(stream)->file.fh);
 	    else
 		c = rep_stream_getc (rep_FILE(stream)->file.stream);
 
@@ -232,6 +233,7 @@ top:
 	    && rep_STRING_WRITABLE_P(args) && rep_INTP (rep_CDR (stream)))
 	{
 	    int actuallen = rep_INT (rep_CDR (stream));
+	    rep_STRING_UNSHARE (args);
 	    len = rep_STRING_LEN (args);
 	    if (len + 1 >= actuallen)
 	    {
@@ -346,6 +348,7 @@ top:
 	    && rep_STRING_WRITABLE_P (args) && rep_INTP (rep_CDR (stream)))
 	{
 	    int actuallen = rep_INT (rep_CDR (stream));
+	    rep_STRING_UNSHARE (args);
 	    len = rep_STRING_LEN (args);
 	    newlen = len + bufLen + 1;
 	    if (actuallen <= newlen)
@@ -610,6 +613,47 @@ characters are available returns nil.
 	return Qnil;
 }
 
+/* Read up to LEN characters from STREAM into BUF, returning the number
+   read, which is less than LEN only at the end of the stream, or -1 if
+   an error was signalled. Local files and string streams are read in
+   one go, other streams a character at a time. */
+long
+rep_stream_read (repv stream, char *buf, long len)
+{
+    long actual = 0;
+    int c;
+
+    if (rep_NILP (stream)
+	&& !(stream = Fsymbol_value (Qstandard_input, Qnil)))
+	return -1;
+
+    if (rep_FILEP (stream) && rep_LOCAL_FILE_P (stream))
+    {
+	actual = fread (buf, sizeof (char), len, rep_FILE (stream)->file.fh);
+
+	/* XXX one possibility is to scan for newlines in the buffer.. */
+	rep_FILE (stream)->car |= rep_LFF_BOGUS_LINE_NUMBER;
+	return actual;
+    }
+    else if (rep_CONSP (stream) && rep_INTP (rep_CAR (stream))
+	     && rep_STRINGP (rep_CDR (stream)))
+    {
+	long start = rep_INT (rep_CAR (stream));
+	actual = rep_STRING_LEN (rep_CDR (stream)) - start;
+	if (actual > len)
+	    actual = len;
+	if (actual <= 0)
+	    return 0;
+	memcpy (buf, rep_STR (rep_CDR (stream)) + start, actual);
+	rep_CAR (stream) = rep_MAKE_INT (start + actual);
+	return actual;
+    }
+
+    while (actual < len && (c = rep_stream_getc (stream)) != EOF)
+	buf[actual++] = c;
+    return rep_throw_value == rep_NULL ? actual : -1;
+}
+
 DEFUN("read-chars", Fread_chars, Sread_chars,
       (repv stream, repv count), rep_Subr2) /*
 ::doc:rep.io.streams#read-chars::
@@ -622,28 +666,13 @@ that point. If no characters are read, nil will be returned.
 ::end:: */
 {
     char *buf;
-    int len;
+    long len;
     rep_DECLARE2 (count, rep_INTP);
     buf = alloca (rep_INT (count));
-    if (rep_FILEP (stream) && rep_LOCAL_FILE_P (stream))
-    {
-	/* Special case for local file streams. */
-	len = fread (buf, sizeof (char), rep_INT (count),
-		     rep_FILE (stream)->file.fh);
-
-	/* XXX one possibility is to scan for newlines in the buffer.. */
-	rep_FILE (stream)->car |= rep_LFF_BOGUS_LINE_NUMBER;
-    }
-    else
-    {
-	int c;
-	len = 0;
-	while (len < rep_INT(count) && (c = rep_stream_getc (stream)) != EOF)
-	{
-	    buf[len++] = c;
-	}
-    }
-    if (len > 0)
+    len = rep_stream_read (stream, buf, rep_INT (count));
+    if (len < 0)
+	return rep_NULL;
+    else if (len > 0)
 	return rep_string_dupn (buf, len);
     else
 	return Qnil;
@@ -662,6 +691,22 @@ characters can be read, return nil.
     int bufsize = 500, offset = 0;
     char *oldbuf = 0;
 
+    if (rep_CONSP (stream) && rep_INTP (rep_CAR (stream))
+        && rep_STRINGP (rep_CDR (stream)))
+    {
+        /* String streams can be scanned for the newline directly */
+        long start = rep_INT (rep_CAR (stream));
+        long len = rep_STRING_LEN (rep_CDR (stream)) - start;
+        const char *str = rep_STR (rep_CDR (stream)) + start;
+        const char *nl = len > 0 ? memchr (str, '\n', len) : 0;
+        if (nl != 0)
+            len = nl - str + 1;
+        if (len <= 0)
+            return Qnil;
+        rep_CAR (stream) = rep_MAKE_INT (start + len);
+        return rep_string_dupn (str, len);
+    }
+
     while (1)
     {
         char
@@ -707,17 +752,96 @@ characters can be read, return nil.
     }
 }
 
+/* Return the file descriptor that output to STREAM can be written to
+   directly, having first flushed anything it has buffered, or -1. */
+static int
+stream_output_fd (repv stream)
+{
+    if (!rep_CELLP (stream))
+	return -1;
+    else if (rep_FILEP (stream))
+    {
+	if (rep_NILP (rep_FILE (stream)->name) || !rep_LOCAL_FILE_P (stream)
+	    || fflush (rep_FILE (stream)->file.fh) != 0)
+	    return -1;
+	return fileno (rep_FILE (stream)->file.fh);
+    }
+    else if (rep_CELL16P (stream))
+    {
+	rep_type *t = rep_get_data_type (rep_TYPE (stream));
+	if (t->fd != 0)
+	    return (t->fd) (stream);
+    }
+    return -1;
+}
+
+/* When SOURCE is a local regular file and DEST writes to a file
+   descriptor, copy the rest of SOURCE without reading it into Lisp.
+   Returns the number of bytes copied, or -1 if nothing was tried (or
+   an error was signalled). */
+static long
+copy_file_stream (repv source, repv dest)
+{
+    FILE *fh;
+    struct stat st;
+    long offset, done;
+    int out_fd;
+
+    if (!rep_FILEP (source) || rep_NILP (rep_FILE (source)->name)
+	|| !rep_LOCAL_FILE_P (source))
+	return -1;
+
+    fh = rep_FILE (source)->file.fh;
+    if (fstat (fileno (fh), &st) != 0 || !S_ISREG (st.st_mode))
+	return -1;
+
+    /* This includes any characters stdio has already read ahead
+       or been given back with ungetc */
+    offset = ftell (fh);
+    if (offset < 0 || offset >= st.st_size)
+	return -1;
+
+    out_fd = stream_output_fd (dest);
+    if (out_fd < 0)
+	return -1;
+
+    done = rep_copy_fd (fileno (fh), out_fd, offset, st.st_size - offset);
+    if (done < 0)
+    {
+	rep_signal_file_error (dest);
+	return -1;
+    }
+    fseek (fh, offset + done, SEEK_SET);
+    rep_FILE (source)->car |= rep_LFF_BOGUS_LINE_NUMBER;
+    return done;
+}
+
 DEFUN("copy-stream", Fcopy_stream, Scopy_stream, (repv source, repv dest), rep_Subr2) /*
 ::doc:rep.io.streams#copy-stream::
 copy-stream SOURCE-STREAM DEST-STREAM
 
 Copy all characters from SOURCE-STREAM to DEST-STREAM until an EOF is
 read. Returns the number of characters copied.
+
+When SOURCE-STREAM is a file and DEST-STREAM a file, socket or process,
+the characters are copied by the operating system, in large blocks.
 ::end:: */
 {
-    int len = 0, c;
+    long len = 0;
+    int c;
     char buf[BUFSIZ+1];
     int i = 0;
+
+    len = copy_file_stream (source, dest);
+    if (len < 0)
+    {
+	if (rep_throw_value != rep_NULL)
+	    return rep_NULL;
+	len = 0;
+    }
+    else if (rep_INTERRUPTP)
+	return rep_NULL;
+
     while ((c = rep_stream_getc (source)) != EOF)
     {
 	if (i == BUFSIZ)
@@ -737,7 +861,7 @@ read. Returns the number of characters copied.
 	buf[i] = 0;
 	rep_stream_puts (dest, buf, i, rep_FALSE);
     }
-    return !rep_INTERRUPTP ? rep_MAKE_INT (len) : rep_NULL;
+    return !rep_INTERRUPTP ? rep_make_long_int (len) : rep_NULL;
 }
 
 DEFUN("read", Fread, Sread, (repv stream), rep_Subr1) /*
@@ -820,6 +944,443 @@ are printed around strings.
     return !rep_INTERRUPTP ? obj : rep_NULL;
 }
 
+/* Compiled format strings
+
+   The control string is parsed into a list of directives, each holding
+   the literal text preceding it, and its flags. Fformat caches the
+   compiled forms of the strings it's given (they're usually constants,
+   so the same object each time), checking that the string's contents
+   haven't changed. */
+
+struct format_directive {
+    int text_start, text_len;	/* literal text before the directive */
+    int arg;			/* index of the argument used */
+    int field_width, precision;
+    char conversion;
+    char leading_char;
+    unsigned int text_only : 1;	/* no conversion, trailing text */
+    unsigned int left_justify : 1;
+    unsigned int truncate_field : 1;
+    unsigned int pad_zeros : 1;
+};
+
+typedef struct rep_format_struct rep_format;
+
+struct rep_format_struct {
+    repv car;
+    rep_format *next;
+    repv string;		/* private copy of the control string */
+    int n_directives;
+    struct format_directive directives[1];
+};
+
+#define FORMATP(v)	rep_CELL16_TYPEP (v, format_type)
+#define FORMAT(v)	((rep_format *) rep_PTR (v))
+
+static int format_type;
+static rep_format *formats;
+
+#define FORMAT_CACHE_SIZE 64
+
+static struct format_cache_entry {
+    repv string;		/* compared, never dereferenced */
+    repv format;
+} format_cache[FORMAT_CACHE_SIZE];
+
+/* Parse the control string STRING, returning a new format object */
+static repv
+compile_format (repv string)
+{
+    const char *start = rep_STR (string), *fmt = start, *last_fmt = start;
+    int n = 1, this_arg = 0;
+    struct format_directive *d;
+    rep_format *f;
+    repv copy;
+    char c;
+
+    /* every `%' is at most one directive */
+    while ((fmt = strchr (fmt, '%')) != 0)
+	n++, fmt++;
+
+    copy = rep_string_dupn (start, rep_STRING_LEN (string));
+    if (copy == rep_NULL)
+	return rep_NULL;
+
+    f = rep_ALLOC_CELL (sizeof (rep_format)
+			+ (n - 1) * sizeof (struct format_directive));
+    if (f == 0)
+	return rep_mem_error ();
+    rep_data_after_gc += (sizeof (rep_format)
+			  + (n - 1) * sizeof (struct format_directive));
+    f->car = format_type;
+    f->string = copy;
+    f->next = formats;
+    formats = f;
+    d = f->directives;
+    fmt = start;
+
+    while ((c = *fmt++))
+    {
+	if (c == '%')
+	{
+	    const char *tem;
+
+	    memset (d, 0, sizeof (*d));
+	    d->text_start = last_fmt - start;
+	    d->text_len = fmt - last_fmt - 1;
+
+	    /* Parse the `n$' prefix */
+	    tem = fmt;
+	    while (isdigit ((unsigned char) *tem))
+		tem++;
+	    if (*tem == '$')
+	    {
+		int arg = atoi (fmt);
+		if (arg > 0)
+		{
+		    this_arg = arg - 1;
+		    fmt = tem + 1;
+		}
+	    }
+
+	    /* Then scan for flags */
+	    c = *fmt++;
+	    while (1)
+	    {
+		switch (c)
+		{
+		case '-':
+		    d->left_justify = 1; break;
+
+		case '^':
+		    d->truncate_field = 1; break;
+
+		case '0':
+		    d->pad_zeros = 1; break;
+
+		case '+': case ' ':
+		    d->leading_char = c;
+		    break;
+
+		default:
+		    goto parse_field_width;
+		}
+		c = *fmt++;
+	    }
+
+	    /* Now look for the field width */
+	parse_field_width:
+	    while(isdigit (c))
+	    {
+		d->field_width = d->field_width * 10 + (c - '0');
+		c = *fmt++;
+	    }
+
+	    /* Now precision */
+	    if (c == '.')
+	    {
+		c = *fmt++;
+		while (c && isdigit (c))
+		{
+		    d->precision = d->precision * 10 + (c - '0');
+		    c = *fmt++;
+		}
+	    }
+	    else
+		d->precision = -1;
+
+	    /* Finally, the format specifier */
+	    d->conversion = c;
+	    if (c != '%')
+		d->arg = this_arg++;
+	    d++;
+	    last_fmt = fmt;
+
+	    if (c == 0)
+	    {
+		/* a `%' at the very end, which is an error */
+		last_fmt = 0;
+		break;
+	    }
+	}
+    }
+
+    if (last_fmt != 0)
+    {
+	memset (d, 0, sizeof (*d));
+	d->text_start = last_fmt - start;
+	d->text_len = fmt - last_fmt - 1;
+	d->text_only = 1;
+	d++;
+    }
+    f->n_directives = d - f->directives;
+    return rep_VAL (f);
+}
+
+/* Return the compiled form of format string STRING */
+static repv
+cached_format (repv string)
+{
+    struct format_cache_entry *e
+	= &format_cache[(rep_PTR_SIZED_INT) string / sizeof (rep_string)
+			% FORMAT_CACHE_SIZE];
+    if (e->string != string || e->format == rep_NULL
+	|| (rep_STRING_LEN (FORMAT (e->format)->string)
+	    != rep_STRING_LEN (string))
+	|| memcmp (rep_STR (FORMAT (e->format)->string),
+		   rep_STR (string), rep_STRING_LEN (string)) != 0)
+    {
+	repv f = compile_format (string);
+	if (f == rep_NULL)
+	    return f;
+	e->string = string;
+	e->format = f;
+    }
+    return e->format;
+}
+
+/* Write the result of formatting the list of ARGS using the format
+   object FORMAT to STREAM. Returns false if an error occurred. */
+static rep_bool
+apply_format (repv stream, repv format, repv args)
+{
+    rep_format *f = FORMAT (format);
+    const char *text = rep_STR (f->string);
+    repv extra_formats = rep_NULL, *argv;
+    rep_GC_root gc_extra_formats;
+    int i, nargs;
+    rep_bool ok = rep_FALSE;
+
+    nargs = rep_list_length (args);
+    if (nargs < 0)
+	return rep_FALSE;
+    argv = alloca (sizeof (repv) * (nargs + 1));
+    for (i = 0; i < nargs; i++)
+    {
+	argv[i] = rep_CAR (args);
+	args = rep_CDR (args);
+    }
+
+    rep_PUSHGC (gc_extra_formats, extra_formats);
+
+    for (i = 0; i < f->n_directives && !rep_INTERRUPTP; i++)
+    {
+	struct format_directive *d = &f->directives[i];
+	char c = d->conversion, leading_char = d->leading_char;
+	repv val, fun;
+	rep_bool free_str = rep_FALSE;
+	int radix, len, actual_len;
+	char buf[256], *ptr;
+
+	if (d->text_len > 0)
+	{
+	    rep_stream_puts (stream, (char *) text + d->text_start,
+			     d->text_len, rep_FALSE);
+	    if (rep_INTERRUPTP)
+		goto exit;
+	}
+
+	if (d->text_only)
+	    continue;
+	else if (c == '%')
+	{
+	    rep_stream_putc (stream, '%');
+	    continue;
+	}
+
+	val = d->arg < nargs ? argv[d->arg] : Qnil;
+
+	switch (c)
+	{
+	case 'c':
+	    rep_stream_putc (stream, rep_INT (val));
+	    break;
+
+	case 'x': case 'X':
+	    radix = 16;
+	    goto do_number;
+
+	case 'o':
+	    radix = 8;
+	    goto do_number;
+
+	case 'd':
+	    radix = 10;
+	do_number:
+	    if (rep_INTP (val))
+	    {
+		/* as rep_print_number_to_string, without calling
+		   printf or copying the result */
+		rep_PTR_SIZED_INT n = rep_INT (val);
+		ptr = buf + sizeof (buf);
+		*--ptr = 0;
+		if (radix == 10)
+		    ptr = rep_print_fixnum (ptr, n);
+		else
+		{
+		    unsigned long u = n;
+		    do {
+			*--ptr = "0123456789abcdef"[u % radix];
+			u /= radix;
+		    } while (u != 0);
+		}
+	    }
+	    else
+	    {
+		ptr = rep_print_number_to_string (val, radix, d->precision);
+		if (ptr == 0)
+		    break;
+		free_str = rep_TRUE;
+	    }
+	    len = strlen (ptr);
+	    goto string_out;
+
+	case 's':
+	unquoted:
+	    if (!rep_STRINGP (val)
+		|| (d->left_justify && d->field_width == 0))
+	    {
+		rep_princ_val (stream, val);
+		break;
+	    }
+	    ptr = rep_STR (val);
+	    len = rep_STRING_LEN (val);
+
+	string_out:
+	    actual_len = len;
+	    if (leading_char)
+	    {
+		if (*ptr != '-')
+		    actual_len++;
+		else
+		    leading_char = 0;
+	    }
+	    if (d->field_width == 0 || actual_len >= d->field_width)
+	    {
+		if (leading_char)
+		    rep_stream_putc (stream, leading_char);
+		rep_stream_puts (stream, ptr, d->truncate_field
+				 ? (d->field_width - (leading_char != 0))
+				 : len, rep_FALSE);
+	    }
+	    else
+	    {
+		char pad[256];
+		int slen = MIN (d->field_width - actual_len, sizeof (pad));
+		memset (pad, !d->pad_zeros ? ' ' : '0', slen);
+		if (d->left_justify)
+		{
+		    if (leading_char)
+			rep_stream_putc (stream, leading_char);
+		    rep_stream_puts (stream, ptr, len, rep_FALSE);
+		}
+		rep_stream_puts (stream, pad, slen, rep_FALSE);
+		if (!d->left_justify)
+		{
+		    if (leading_char)
+			rep_stream_putc (stream, leading_char);
+		    rep_stream_puts (stream, ptr, len, rep_FALSE);
+		}
+	    }
+	    if (free_str)
+		free (ptr);
+	    break;
+
+	case 'S':
+	    rep_print_val (stream, val);
+	    break;
+
+	default:
+	    if (extra_formats == rep_NULL)
+		extra_formats = Fsymbol_value (Qformat_hooks_alist, Qt);
+	    if (rep_CONSP (extra_formats)
+		&& (fun = Fassq (rep_MAKE_INT (c), extra_formats))
+		&& rep_CONSP (fun))
+	    {
+		val = rep_call_lisp1 (rep_CDR (fun), val);
+		if (val == rep_NULL)
+		    goto exit;
+		else
+		{
+		    if (val == Qnil)
+			val = rep_null_string ();
+		    goto unquoted;
+		}
+	    }
+	    else
+	    {
+		DEFSTRING (err, "Unknown format conversion");
+		Fsignal (Qerror, rep_list_2 (rep_VAL (&err),
+					     rep_MAKE_INT (c)));
+		goto exit;
+	    }
+	}
+    }
+    ok = !rep_INTERRUPTP;
+
+exit:
+    rep_POPGC;
+    return ok;
+}
+
+static void
+format_mark (repv val)
+{
+    rep_MARKVAL (FORMAT (val)->string);
+}
+
+static void
+format_mark_cache (void)
+{
+    int i;
+    for (i = 0; i < FORMAT_CACHE_SIZE; i++)
+    {
+	if (format_cache[i].format != rep_NULL)
+	    rep_MARKVAL (format_cache[i].format);
+    }
+}
+
+static void
+format_sweep (void)
+{
+    rep_format *x = formats;
+    formats = 0;
+    while (x != 0)
+    {
+	rep_format *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (x)))
+	    rep_FREE_CELL (x);
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL (x));
+	    x->next = formats;
+	    formats = x;
+	}
+	x = next;
+    }
+}
+
+static void
+format_print (repv stream, repv arg)
+{
+    rep_stream_puts (stream, "#<format ", -1, rep_FALSE);
+    rep_print_val (stream, FORMAT (arg)->string);
+    rep_stream_putc (stream, '>');
+}
+
+DEFUN("compile-format", Fcompile_format, Scompile_format,
+      (repv string), rep_Subr1) /*
+::doc:rep.io.streams#compile-format::
+compile-format FORMAT-STRING
+
+Return a format object that may be given to `format' in place of the
+string FORMAT-STRING, without it being parsed each time.
+::end:: */
+{
+    rep_DECLARE1 (string, rep_STRINGP);
+    return compile_format (string);
+}
+
 DEFUN("format", Fformat, Sformat, (repv args), rep_SubrN) /*
 ::doc:rep.io.streams#format::
 format STREAM FORMAT-STRING ARGS...
@@ -865,14 +1426,14 @@ as if by the `s' conversion.
 
 Note that the FIELD-WIDTH and all flags currently have no effect on the
 `S' conversion, (or the `s' conversion when the ARG isn't a string).
+
+FORMAT-STRING may also be a format object created by `compile-format'.
 ::end:: */
 {
-    char *fmt, *last_fmt;
     rep_bool make_string;
-    repv stream, format, extra_formats = rep_NULL;
-    rep_GC_root gc_stream, gc_format, gc_args, gc_extra_formats;
-    char c;
-    int this_arg = 0;
+    repv stream, format;
+    rep_GC_root gc_stream, gc_format, gc_args;
+    rep_bool ok;
 
     if (!rep_CONSP (args))
 	return rep_signal_missing_arg (1);
@@ -890,273 +1451,263 @@ Note that the FIELD-WIDTH and all flags currently have no effect on the
 	return rep_signal_missing_arg (2);
     format = rep_CAR (args);
     args = rep_CDR (args);
-    rep_DECLARE2 (format, rep_STRINGP);
-    fmt = rep_STR (format);
+    if (!FORMATP (format))
+    {
+	rep_DECLARE2 (format, rep_STRINGP);
+	format = cached_format (format);
+	if (format == rep_NULL)
+	    return rep_NULL;
+    }
 
     rep_PUSHGC (gc_stream, stream);
     rep_PUSHGC (gc_format, format);
     rep_PUSHGC (gc_args, args);
-    rep_PUSHGC (gc_extra_formats, extra_formats);
 
-    last_fmt = fmt;
-    while ((c = *fmt++) && !rep_INTERRUPTP)
+    ok = apply_format (stream, format, args);
+    if (ok && make_string)
     {
-	if (c == '%')
+	if (rep_STRING_LEN (rep_CAR (stream)) != rep_INT (rep_CDR (stream)))
 	{
-	    rep_bool left_justify = rep_FALSE, truncate_field = rep_FALSE;
-	    rep_bool pad_zeros = rep_FALSE;
-	    char leading_char = 0;
-	    int field_width = 0, precision = 0;
-	    char *tem;
+	    /* Truncate the stream to it's actual length. */
+	    stream = Fcopy_sequence (rep_CAR (stream));
+	}
+	else
+	    stream = rep_CAR (stream);
+    }
 
-	    if (last_fmt != fmt - 1)
-	    {
-		rep_stream_puts (stream, last_fmt,
-				 fmt - last_fmt - 1, rep_FALSE);
-		if (rep_INTERRUPTP)
-		    goto exit;
-	    }
+    rep_POPGC; rep_POPGC; rep_POPGC;
 
-	    /* Parse the `n$' prefix */
-	    tem = fmt;
-	    while (1)
-	    {
-		switch (*tem++)
-		{
-		    int arg;
-
-		case '0': case '1': case '2': case '3': case '4':
-		case '5': case '6': case '7': case '8': case '9':
-		    break;
+    return ok ? stream : rep_NULL;
+}
 
-		case '$':
-		    arg = atoi (fmt);
-		    if (arg > 0)
-		    {
-			this_arg = arg - 1;
-			fmt = tem;
-		    }
-		    goto parse_flags;
+DEFUN("make-string-input-stream", Fmake_string_input_stream, Smake_string_input_stream, (repv string, repv start), rep_Subr2) /*
+::doc:rep.io.streams#make-string-input-stream::
+make-string-input-stream STRING [START]
 
-		default:
-		    goto parse_flags;
-		}
-	    }
+Returns a input stream, it will supply, in order, the characters in STRING,
+starting from START (or the beginning of the string).
+::end:: */
+{
+    rep_DECLARE1 (string, rep_STRINGP);
+    return (Fcons (rep_INTP (start) ? start : rep_MAKE_INT (0), string));
+}
 
-	parse_flags:
-	    /* Then scan for flags */
-	    c = *fmt++;
-	    while (1)
-	    {
-		switch (c)
-		{
-		case '-':
-		    left_justify = rep_TRUE; break;
+/* String output streams
 
-		case '^':
-		    truncate_field = rep_TRUE; break;
+   These accumulate their output in a list of separately allocated
+   chunks, each twice the size of the last (up to a limit), so that
+   appending never copies what's already been written. The chunks are
+   only joined when get-output-stream-string is called. If a sink
+   stream is given, the contents are written to it whenever they reach
+   a given size. */
 
-		case '0':
-		    pad_zeros = rep_TRUE; break;
+#define MIN_CHUNK_SIZE 64
+#define MAX_CHUNK_SIZE 65536
 
-		case '+': case ' ':
-		    leading_char = c;
-		    break;
+struct chunk {
+    struct chunk *next;
+    size_t used, size;
+    char data[1];
+};
 
-		default:
-		    goto parse_field_width;
-		}
-		c = *fmt++;
-	    }
+typedef struct chunked_stream_struct chunked_stream;
 
-	    /* Now look for the field width */
-	parse_field_width:
-	    while(isdigit (c))
-	    {
-		field_width = field_width * 10 + (c - '0');
-		c = *fmt++;
-	    }
+struct chunked_stream_struct {
+    repv car;
+    chunked_stream *next;
+    struct chunk *first, *last;
+    size_t length;		/* total bytes in chunks */
+    size_t limit;		/* flush to SINK when LENGTH reaches this */
+    repv sink;
+};
 
-	    /* Now precision */
-	    if (c == '.')
-	    {
-		c = *fmt++;
-		while (c && isdigit (c))
-		{
-		    precision = precision * 10 + (c - '0');
-		    c = *fmt++;
-		}
-	    }
-	    else
-		precision = -1;
+#define CHUNKED_STREAMP(v)	rep_CELL16_TYPEP (v, chunked_stream_type)
+#define CHUNKED_STREAM(v)	((chunked_stream *) rep_PTR (v))
 
-	    /* Finally, the format specifier */
-	    if(c == '%')
-		rep_stream_putc (stream, '%');
-	    else
-	    {
-		repv fun;
-		repv val = Fnth (rep_MAKE_INT (this_arg), args);
-		rep_bool free_str = rep_FALSE;
+static int chunked_stream_type;
+static chunked_stream *chunked_streams;
 
-		if (val == rep_NULL)
-		    goto exit;
+static void
+free_chunks (chunked_stream *s)
+{
+    struct chunk *c = s->first;
+    while (c != 0)
+    {
+	struct chunk *next = c->next;
+	rep_free (c);
+	c = next;
+    }
+    s->first = s->last = 0;
+    s->length = 0;
+}
 
-		switch (c)
-		{
-		    int radix, len, actual_len;
-		    char buf[256], *ptr;
+/* Add a chunk to S large enough for at least LENGTH bytes */
+static struct chunk *
+add_chunk (chunked_stream *s, size_t length)
+{
+    size_t size = s->last != 0 ? s->last->size * 2 : MIN_CHUNK_SIZE;
+    struct chunk *c;
+    if (size > MAX_CHUNK_SIZE)
+	size = MAX_CHUNK_SIZE;
+    if (size < length)
+	size = length;
+    c = rep_alloc (sizeof (struct chunk) + size - 1);
+    if (c == 0)
+	return 0;
+    c->next = 0;
+    c->used = 0;
+    c->size = size;
+    if (s->last != 0)
+	s->last->next = c;
+    else
+	s->first = c;
+    s->last = c;
+    return c;
+}
 
-		case 'c':
-		    rep_stream_putc (stream, rep_INT (val));
-		    break;
+/* Write the contents of S to its sink, then empty it. Returns false if
+   an error occurred */
+static rep_bool
+flush_chunks (chunked_stream *s)
+{
+    repv stream = rep_VAL (s);
+    rep_GC_root gc_stream;
+    rep_bool ok = rep_TRUE;
 
-		case 'x': case 'X':
-		    radix = 16;
-		    goto do_number;
-
-		case 'o':
-		    radix = 8;
-		    goto do_number;
-
-		case 'd':
-		    radix = 10;
-		do_number:
-		    ptr = rep_print_number_to_string (val, radix, precision);
-		    if (ptr == 0)
-			break;
-		    free_str = rep_TRUE;
-		    len = strlen (ptr);
-		    goto string_out;
-
-		case 's':
-		unquoted:
-		    if (!rep_STRINGP (val)
-			|| (left_justify && field_width == 0))
-		    {
-			rep_princ_val (stream, val);
-			break;
-		    }
-		    ptr = rep_STR (val);
-		    len = rep_STRING_LEN (val);
-
-		string_out:
-		    actual_len = len;
-		    if (leading_char)
-		    {
-			if (*ptr != '-')
-			    actual_len++;
-			else
-			    leading_char = 0;
-		    }
-		    if (field_width == 0 || actual_len >= field_width)
-		    {
-			if (leading_char)
-			    rep_stream_putc (stream, leading_char);
-			rep_stream_puts (stream, ptr, truncate_field
-					 ? (field_width - (leading_char != 0))
-					 : len, rep_FALSE);
-		    }
-		    else
-		    {
-			int slen = MIN (field_width - actual_len, sizeof (buf));
-			memset (buf, !pad_zeros ? ' ' : '0', slen);
-			if (left_justify)
-			{
-			    if (leading_char)
-				rep_stream_putc (stream, leading_char);
-			    rep_stream_puts (stream, ptr, len, rep_FALSE);
-			}
-			rep_stream_puts (stream, buf, slen, rep_FALSE);
-			if (!left_justify)
-			{
-			    if (leading_char)
-				rep_stream_putc (stream, leading_char);
-			    rep_stream_puts (stream, ptr, len, rep_FALSE);
-			}
-		    }
-		    if (free_str)
-			free (ptr);
-		    break;
+    rep_PUSHGC (gc_stream, stream);
+    while (s->first != 0)
+    {
+	struct chunk *c = s->first;
+	s->first = c->next;
+	if (s->first == 0)
+	    s->last = 0;
+	s->length -= c->used;
+	if (ok && c->used > 0
+	    && rep_stream_puts (s->sink, c->data, c->used, rep_FALSE) == 0)
+	{
+	    ok = rep_FALSE;
+	}
+	rep_free (c);
+    }
+    rep_POPGC;
+    return ok;
+}
 
-		case 'S':
-		    rep_print_val (stream, val);
-		    break;
+static int
+chunked_stream_puts (repv stream, void *data, int length, rep_bool lisp_obj_p)
+{
+    chunked_stream *s = CHUNKED_STREAM (stream);
+    char *buf = lisp_obj_p ? rep_STR (data) : data;
+    int todo = length;
 
-		default:
-		    if (extra_formats == rep_NULL)
-		    {
-			extra_formats
-			    = Fsymbol_value (Qformat_hooks_alist, Qt);
-		    }
-		    if (rep_CONSP (extra_formats)
-			&& (fun = Fassq (rep_MAKE_INT (c), extra_formats))
-			&& rep_CONSP (fun))
-		    {
-			val = rep_call_lisp1 (rep_CDR (fun), val);
-			if (val == rep_NULL)
-			    goto exit;
-			else
-			{
-			    if (val == Qnil)
-				val = rep_null_string ();
-			    goto unquoted;
-			}
-		    }
-		    else
-		    {
-			DEFSTRING (err, "Unknown format conversion");
-			Fsignal (Qerror, rep_list_2 (rep_VAL (&err),
-						     rep_MAKE_INT (c)));
-			goto exit;
-		    }
-		}
-		this_arg++;
+    while (todo > 0)
+    {
+	struct chunk *c = s->last;
+	size_t n;
+	if (c == 0 || c->used == c->size)
+	{
+	    c = add_chunk (s, 0);
+	    if (c == 0)
+	    {
+		rep_mem_error ();
+		return length - todo;
 	    }
-	    last_fmt = fmt;
 	}
+	n = MIN ((size_t) todo, c->size - c->used);
+	memcpy (c->data + c->used, buf, n);
+	c->used += n;
+	s->length += n;
+	buf += n;
+	todo -= n;
     }
 
-    if (last_fmt != fmt - 1)
-	rep_stream_puts (stream, last_fmt, fmt - last_fmt - 1, rep_FALSE);
-    if (make_string)
+    if (s->limit > 0 && s->length >= s->limit && !flush_chunks (s))
+	return 0;
+    return length;
+}
+
+static int
+chunked_stream_putc (repv stream, int c)
+{
+    chunked_stream *s = CHUNKED_STREAM (stream);
+    if (s->last != 0 && s->last->used < s->last->size
+	&& (s->limit == 0 || s->length + 1 < s->limit))
     {
-	if (rep_STRING_LEN (rep_CAR (stream)) != rep_INT (rep_CDR (stream)))
+	s->last->data[s->last->used++] = c;
+	s->length++;
+	return 1;
+    }
+    else
+    {
+	char tem = c;
+	return chunked_stream_puts (stream, &tem, 1, rep_FALSE);
+    }
+}
+
+static void
+chunked_stream_mark (repv val)
+{
+    rep_MARKVAL (CHUNKED_STREAM (val)->sink);
+}
+
+static void
+chunked_stream_sweep (void)
+{
+    chunked_stream *x = chunked_streams;
+    chunked_streams = 0;
+    while (x != 0)
+    {
+	chunked_stream *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL (x)))
 	{
-	    /* Truncate the stream to it's actual length. */
-	    stream = Fcopy_sequence (rep_CAR (stream));
+	    free_chunks (x);
+	    rep_FREE_CELL (x);
 	}
 	else
-	    stream = rep_CAR (stream);
+	{
+	    rep_GC_CLR_CELL (rep_VAL (x));
+	    x->next = chunked_streams;
+	    chunked_streams = x;
+	}
+	x = next;
     }
-
-exit:
-    rep_POPGC; rep_POPGC; rep_POPGC; rep_POPGC;
-
-    return !rep_INTERRUPTP ? stream : rep_NULL;
 }
 
-DEFUN("make-string-input-stream", Fmake_string_input_stream, Smake_string_input_stream, (repv string, repv start), rep_Subr2) /*
-::doc:rep.io.streams#make-string-input-stream::
-make-string-input-stream STRING [START]
-
-Returns a input stream, it will supply, in order, the characters in STRING,
-starting from START (or the beginning of the string).
-::end:: */
+static void
+chunked_stream_print (repv stream, repv arg)
 {
-    rep_DECLARE1 (string, rep_STRINGP);
-    return (Fcons (rep_INTP (start) ? start : rep_MAKE_INT (0), string));
+    rep_stream_puts (stream, "#<string-output-stream>", -1, rep_FALSE);
 }
 
-DEFUN("make-string-output-stream", Fmake_string_output_stream, Smake_string_output_stream, (void), rep_Subr0) /*
+DEFUN("make-string-output-stream", Fmake_string_output_stream, Smake_string_output_stream, (repv limit, repv sink), rep_Subr2) /*
 ::doc:rep.io.streams#make-string-output-stream::
-make-string-output-stream
+make-string-output-stream [LIMIT SINK]
 
 Returns an output stream which will accumulate the characters written to
 it for the use of the `get-output-stream-string' function.
+
+If LIMIT and the output stream SINK are given, whenever LIMIT
+characters have accumulated they are written to SINK and discarded.
 ::end:: */
 {
-    return (Fcons (rep_string_dupn ("", 0), rep_MAKE_INT (0)));
+    chunked_stream *s;
+
+    rep_DECLARE (1, limit, rep_NILP (limit) || rep_INTP (limit));
+    if (!rep_NILP (limit) && rep_NILP (sink))
+	return rep_signal_arg_error (sink, 2);
+
+    s = rep_ALLOC_CELL (sizeof (chunked_stream));
+    if (s == 0)
+	return rep_mem_error ();
+    rep_data_after_gc += sizeof (chunked_stream);
+    s->car = chunked_stream_type;
+    s->first = s->last = 0;
+    s->length = 0;
+    s->limit = rep_INTP (limit) ? MAX (rep_INT (limit), 1) : 0;
+    s->sink = rep_INTP (limit) ? sink : Qnil;
+    s->next = chunked_streams;
+    chunked_streams = s;
+    return rep_VAL (s);
 }
 
 DEFUN("get-output-stream-string", Fget_output_stream_string, Sget_output_stream_string, (repv strm), rep_Subr1) /*
@@ -1170,6 +1721,37 @@ return the new characters.
 ::end:: */
 {
     repv string;
+
+    if (CHUNKED_STREAMP (strm))
+    {
+	chunked_stream *s = CHUNKED_STREAM (strm);
+	struct chunk *c;
+	char *ptr;
+
+	if (s->first == 0)
+	    return rep_null_string ();
+	if (s->first->next == 0 && s->first->used < s->first->size)
+	{
+	    /* common case of one chunk */
+	    string = rep_string_dupn (s->first->data, s->first->used);
+	}
+	else
+	{
+	    string = rep_make_string (s->length + 1);
+	    if (string == rep_NULL)
+		return string;
+	    ptr = rep_STR (string);
+	    for (c = s->first; c != 0; c = c->next)
+	    {
+		memcpy (ptr, c->data, c->used);
+		ptr += c->used;
+	    }
+	    *ptr = 0;
+	}
+	free_chunks (s);
+	return string;
+    }
+
     if (!rep_CONSP (strm)
 	|| !rep_STRINGP (rep_CAR(strm))
 	|| !rep_INTP (rep_CDR(strm)))
@@ -1192,6 +1774,21 @@ return the new characters.
     return string;
 }
 
+DEFUN("flush-string-output-stream", Fflush_string_output_stream,
+      Sflush_string_output_stream, (repv strm), rep_Subr1) /*
+::doc:rep.io.streams#flush-string-output-stream::
+flush-string-output-stream STRING-OUTPUT-STREAM
+
+Write any characters accumulated in STRING-OUTPUT-STREAM to the sink
+stream it was created with, then discard them.
+::end:: */
+{
+    rep_DECLARE1 (strm, CHUNKED_STREAMP);
+    if (rep_NILP (CHUNKED_STREAM (strm)->sink))
+	return rep_signal_arg_error (strm, 1);
+    return flush_chunks (CHUNKED_STREAM (strm)) ? Qnil : rep_NULL;
+}
+
 DEFUN("input-stream-p", Finput_stream_p,
       Sinput_stream_p, (repv arg), rep_Subr1) /*
 ::doc:rep.io.streams#input-stream-p::
@@ -1288,7 +1885,18 @@ Returns t if ARG is an output stream.
 void
 rep_streams_init (void)
 {
-    repv tem = rep_push_structure ("rep.io.streams");
+    repv tem;
+    chunked_stream_type = rep_register_new_type ("string-output-stream", 0,
+						 chunked_stream_print,
+						 chunked_stream_print,
+						 chunked_stream_sweep,
+						 chunked_stream_mark, 0,
+						 0, 0, chunked_stream_putc,
+						 chunked_stream_puts, 0, 0);
+    format_type = rep_register_new_type ("format", 0, format_print,
+					 format_print, format_sweep, format_mark,
+					 format_mark_cache, 0, 0, 0, 0, 0, 0);
+    tem = rep_push_structure ("rep.io.streams");
     rep_INTERN_SPECIAL(format_hooks_alist);
     rep_ADD_SUBR(Swrite);
     rep_ADD_SUBR(Sread_char);
@@ -1301,9 +1909,11 @@ rep_streams_init (void)
     rep_ADD_SUBR(Sprin1);
     rep_ADD_SUBR(Sprinc);
     rep_ADD_SUBR(Sformat);
+    rep_ADD_SUBR(Scompile_format);
     rep_ADD_SUBR(Smake_string_input_stream);
     rep_ADD_SUBR(Smake_string_output_stream);
     rep_ADD_SUBR(Sget_output_stream_string);
+    rep_ADD_SUBR(Sflush_string_output_stream);
     rep_ADD_SUBR(Sinput_stream_p);
     rep_ADD_SUBR(Soutput_stream_p);
     rep_pop_structure (tem);
@@ -0,0 +1,415 @@
+/* strings.c -- Searching, comparing and case-converting strings
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* The string primitives that look at every character are built on the
+   kernels here. Searching for a character or a string uses memchr and
+   memmem, which the C library usually implements with whatever vector
+   instructions the processor has. The others work a word at a time:
+   a word holding only ASCII characters can be case-folded or searched
+   with a handful of integer operations on all its bytes at once, and
+   only words containing other characters need looking at a byte at a
+   time. Case folding like this assumes that the locale maps the ASCII
+   letters in the usual way; if it doesn't (in Turkish, say) it's
+   done a byte at a time throughout. */
+
+#define _GNU_SOURCE
+
+#include "repint.h"
+
+#include <string.h>
+#include <ctype.h>
+
+#define UCHARAT(p) ((int)*(unsigned char *)(p))
+
+#define WORD_BYTES	sizeof (unsigned long)
+#define ONES		(~0UL / 0xff)		/* 0x0101... */
+#define HIGHS		(ONES * 0x80)		/* 0x8080... */
+
+/* True if toupper and tolower treat the ASCII characters normally */
+static rep_bool ascii_case_p;
+
+static inline unsigned long
+load_word (const char *p)
+{
+    unsigned long w;
+    memcpy (&w, p, WORD_BYTES);
+    return w;
+}
+
+/* The top bit of each byte of X that's zero */
+static inline unsigned long
+zero_bytes (unsigned long x)
+{
+    return ~(((x & ~HIGHS) + ~HIGHS) | x) & HIGHS;
+}
+
+/* The number of bytes in X with their top bit set (and no others) */
+static inline int
+count_high_bits (unsigned long x)
+{
+    return (int) (((x >> 7) * ONES) >> ((WORD_BYTES - 1) * 8));
+}
+
+/* The top bit of each byte of X, a word of ASCII characters, that's
+   between LOW and HIGH inclusive */
+static inline unsigned long
+bytes_between (unsigned long x, int low, int high)
+{
+    return ((x + ONES * (0x80 - low))
+	    & ~(x + ONES * (0x7f - high)) & HIGHS);
+}
+
+/* Upper and lower case versions of X, a word of ASCII characters */
+static inline unsigned long
+ascii_upcase (unsigned long x)
+{
+    return x ^ (bytes_between (x, 'a', 'z') >> 2);
+}
+
+static inline unsigned long
+ascii_downcase (unsigned long x)
+{
+    return x ^ (bytes_between (x, 'A', 'Z') >> 2);
+}
+
+
+/* Kernels */
+
+/* Return the first occurrence of character C in the LEN bytes at S */
+char *
+rep_str_find_char (const char *s, size_t len, int c)
+{
+    return memchr (s, c, len);
+}
+
+/* Return the number of occurrences of character C in the LEN bytes
+   at S */
+size_t
+rep_str_count_char (const char *s, size_t len, int c)
+{
+    unsigned long pattern = ONES * (c & 0xff);
+    size_t count = 0;
+    while (len >= WORD_BYTES)
+    {
+	count += count_high_bits (zero_bytes (load_word (s) ^ pattern));
+	s += WORD_BYTES;
+	len -= WORD_BYTES;
+    }
+    while (len-- > 0)
+	count += (UCHARAT (s++) == (c & 0xff));
+    return count;
+}
+
+/* Compare the LEN bytes at A and B ignoring case, returning less than,
+   equal to, or greater than zero as with memcmp */
+int
+rep_str_casecmp (const char *a, const char *b, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+	size_t end;
+	if (ascii_case_p && i + WORD_BYTES <= len)
+	{
+	    unsigned long wa = load_word (a + i), wb = load_word (b + i);
+	    if (wa == wb
+		|| (((wa | wb) & HIGHS) == 0
+		    && ascii_upcase (wa) == ascii_upcase (wb)))
+	    {
+		i += WORD_BYTES;
+		continue;
+	    }
+	}
+	/* a byte at a time, to the end of this word */
+	end = MIN (len, i + WORD_BYTES);
+	for (; i < end; i++)
+	{
+	    int ca = toupper (UCHARAT (a + i)), cb = toupper (UCHARAT (b + i));
+	    if (ca != cb)
+		return ca - cb;
+	}
+    }
+    return 0;
+}
+
+/* Return the number of bytes at the start of the LEN bytes at A and B
+   that are the same (ignoring case if FOLD) */
+size_t
+rep_str_common_prefix (const char *a, const char *b, size_t len,
+		       rep_bool fold)
+{
+    size_t i = 0;
+    while (i + WORD_BYTES <= len)
+    {
+	unsigned long wa = load_word (a + i), wb = load_word (b + i);
+	if (wa != wb
+	    && (!fold || !ascii_case_p || ((wa | wb) & HIGHS) != 0
+		|| ascii_upcase (wa) != ascii_upcase (wb)))
+	    break;
+	i += WORD_BYTES;
+    }
+    for (; i < len; i++)
+    {
+	if (fold ? toupper (UCHARAT (a + i)) != toupper (UCHARAT (b + i))
+	    : a[i] != b[i])
+	    break;
+    }
+    return i;
+}
+
+/* Return the first occurrence of the NLEN bytes at NEEDLE in the HLEN
+   bytes at HAY, ignoring case if FOLD, or null */
+char *
+rep_str_search (const char *hay, size_t hlen,
+		const char *needle, size_t nlen, rep_bool fold)
+{
+    const char *end;
+    int upper, lower;
+
+    if (nlen == 0)
+	return (char *) hay;
+    if (nlen > hlen)
+	return 0;
+
+    if (!fold)
+    {
+#ifdef HAVE_MEMMEM
+	return memmem (hay, hlen, needle, nlen);
+#else
+	end = hay + hlen - nlen + 1;
+	while (hay < end
+	       && (hay = memchr (hay, *needle, end - hay)) != 0)
+	{
+	    if (memcmp (hay, needle, nlen) == 0)
+		return (char *) hay;
+	    hay++;
+	}
+	return 0;
+#endif
+    }
+
+    /* look for either case of the first character a word at a time,
+       then check each candidate */
+    upper = toupper (UCHARAT (needle));
+    lower = tolower (UCHARAT (needle));
+    end = hay + hlen - nlen + 1;
+    while (hay < end)
+    {
+	if (end - hay >= (long) WORD_BYTES)
+	{
+	    unsigned long w = load_word (hay);
+	    if ((zero_bytes (w ^ (ONES * upper))
+		 | zero_bytes (w ^ (ONES * lower))) == 0)
+	    {
+		hay += WORD_BYTES;
+		continue;
+	    }
+	}
+	if ((UCHARAT (hay) == upper || UCHARAT (hay) == lower)
+	    && rep_str_casecmp (hay, needle, nlen) == 0)
+	    return (char *) hay;
+	hay++;
+    }
+    return 0;
+}
+
+/* Copy the LEN bytes at SRC to DST (which may be the same), replacing
+   each byte C by the C'th byte of the TABLEN bytes at TABLE, when
+   there is one */
+void
+rep_str_translate (char *dst, const char *src, size_t len,
+		   const unsigned char *table, size_t tablen)
+{
+    enum { other, upcase, downcase } mode = other;
+    size_t i;
+
+    /* is the table just ASCII case conversion? Only worth finding out
+       for longer strings */
+    if (ascii_case_p && len >= 4 * WORD_BYTES && tablen >= 128)
+    {
+	int c;
+	for (c = 0; c < 128 && table[c] == toupper (c); c++)
+	    ;
+	if (c == 128)
+	    mode = upcase;
+	else
+	{
+	    for (c = 0; c < 128 && table[c] == tolower (c); c++)
+		;
+	    if (c == 128)
+		mode = downcase;
+	}
+    }
+
+    i = 0;
+    while (i < len)
+    {
+	size_t end;
+	if (mode != other && i + WORD_BYTES <= len)
+	{
+	    unsigned long w = load_word (src + i);
+	    if ((w & HIGHS) == 0)
+	    {
+		w = (mode == upcase) ? ascii_upcase (w) : ascii_downcase (w);
+		memcpy (dst + i, &w, WORD_BYTES);
+		i += WORD_BYTES;
+		continue;
+	    }
+	}
+	end = (mode != other) ? MIN (len, i + WORD_BYTES) : len;
+	for (; i < end; i++)
+	{
+	    int c = UCHARAT (src + i);
+	    dst[i] = (c < (int) tablen) ? table[c] : c;
+	}
+    }
+}
+
+
+/* Lisp functions */
+
+static rep_bool
+get_region (repv string, repv start, repv end, long *xstart, long *xend)
+{
+    long len = rep_STRING_LEN (string);
+    *xstart = rep_INTP (start) ? rep_INT (start) : 0;
+    *xend = rep_INTP (end) ? rep_INT (end) : len;
+    if (*xstart < 0 || *xstart > len)
+    {
+	rep_signal_arg_error (start, 3);
+	return rep_FALSE;
+    }
+    if (*xend < *xstart || *xend > len)
+    {
+	rep_signal_arg_error (end, 4);
+	return rep_FALSE;
+    }
+    return rep_TRUE;
+}
+
+DEFUN("string-index", Fstring_index, Sstring_index,
+      (repv string, repv ch, repv start, repv end), rep_Subr4) /*
+::doc:rep.data#string-index::
+string-index STRING CHARACTER [START] [END]
+
+Return the position of the first occurrence of CHARACTER in STRING, or
+nil if there isn't one. Only the characters from position START to
+before END are looked at, when given.
+::end:: */
+{
+    long xstart, xend;
+    char *ptr;
+    rep_DECLARE1 (string, rep_STRINGP);
+    rep_DECLARE2 (ch, rep_INTP);
+    rep_DECLARE3_OPT (start, rep_INTP);
+    rep_DECLARE4_OPT (end, rep_INTP);
+    if (!get_region (string, start, end, &xstart, &xend))
+	return rep_NULL;
+    ptr = rep_str_find_char (rep_STR (string) + xstart,
+			     xend - xstart, rep_INT (ch));
+    return ptr != 0 ? rep_MAKE_INT (ptr - rep_STR (string)) : Qnil;
+}
+
+DEFUN("string-search", Fstring_search, Sstring_search,
+      (repv needle, repv string, repv start, repv nocasep), rep_Subr4) /*
+::doc:rep.data#string-search::
+string-search NEEDLE STRING [START] [IGNORE-CASE-P]
+
+Return the position of the first occurrence of the string NEEDLE in
+STRING, from position START if given, or nil if there isn't one. When
+IGNORE-CASE-P is non-nil, the case of characters is ignored. Unlike
+`string-match', NEEDLE is a plain string, not a regexp.
+::end:: */
+{
+    long xstart, xend;
+    char *ptr;
+    rep_DECLARE1 (needle, rep_STRINGP);
+    rep_DECLARE2 (string, rep_STRINGP);
+    rep_DECLARE3_OPT (start, rep_INTP);
+    if (!get_region (string, start, Qnil, &xstart, &xend))
+	return rep_NULL;
+    ptr = rep_str_search (rep_STR (string) + xstart, xend - xstart,
+			  rep_STR (needle), rep_STRING_LEN (needle),
+			  !rep_NILP (nocasep));
+    return ptr != 0 ? rep_MAKE_INT (ptr - rep_STR (string)) : Qnil;
+}
+
+DEFUN("string-count", Fstring_count, Sstring_count,
+      (repv item, repv string, repv start, repv end), rep_Subr4) /*
+::doc:rep.data#string-count::
+string-count ITEM STRING [START] [END]
+
+Return the number of times ITEM, a character or a non-empty string,
+occurs in STRING (between positions START and END, when given).
+Occurrences of a string are counted without overlapping.
+::end:: */
+{
+    long xstart, xend;
+    rep_DECLARE (1, item, rep_INTP (item)
+		 || (rep_STRINGP (item) && rep_STRING_LEN (item) > 0));
+    rep_DECLARE2 (string, rep_STRINGP);
+    rep_DECLARE3_OPT (start, rep_INTP);
+    rep_DECLARE4_OPT (end, rep_INTP);
+    if (!get_region (string, start, end, &xstart, &xend))
+	return rep_NULL;
+    if (rep_INTP (item))
+    {
+	return rep_make_long_uint (rep_str_count_char (rep_STR (string)
+						       + xstart,
+						       xend - xstart,
+						       rep_INT (item)));
+    }
+    else
+    {
+	const char *ptr = rep_STR (string) + xstart;
+	const char *limit = rep_STR (string) + xend;
+	long nlen = rep_STRING_LEN (item);
+	unsigned long count = 0;
+	while ((ptr = rep_str_search (ptr, limit - ptr, rep_STR (item),
+				      nlen, rep_FALSE)) != 0)
+	{
+	    count++;
+	    ptr += nlen;
+	}
+	return rep_make_long_uint (count);
+    }
+}
+
+void
+rep_strings_init (void)
+{
+    repv tem;
+    int c;
+
+    ascii_case_p = rep_TRUE;
+    for (c = 0; c < 128; c++)
+    {
+	int up = (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+	int down = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+	if (toupper (c) != up || tolower (c) != down)
+	    ascii_case_p = rep_FALSE;
+    }
+
+    tem = rep_push_structure ("rep.data");
+    rep_ADD_SUBR (Sstring_index);
+    rep_ADD_SUBR (Sstring_search);
+    rep_ADD_SUBR (Sstring_count);
+    rep_pop_structure (tem);
+}
@@ -84,7 +84,13 @@
 
    Special variables have their own isolated namespace (the structure
    called `%specials') and thus their names can still clash across
-   structures..  */
+   structures..
+
+   When a structure that hasn't been loaded is opened or accessed, and
+   a module index in the load-path records its exports (see lispcmds.c),
+   only its name is added to the importing structure; it's loaded when
+   a search of the imports first looks for one of those exports. The
+   variable `lazy-open-structures' controls this.  */
 
 #define _GNU_SOURCE
 
@@ -133,6 +139,9 @@ repv rep_specials_structure;
 /* the structure namespace */
 static repv rep_structures_structure;
 
+/* Structures opened before being loaded, (NAME . EXPORTS) */
+static repv lazy_structures;
+
 DEFSYM(features, "features");
 DEFSYM(_structures, "%structures");
 DEFSYM(_meta, "%meta");
@@ -143,19 +152,54 @@ DEFSYM(rep_structures, "rep.structures");
 DEFSYM(rep_lang_interpreter, "rep.lang.interpreter");
 DEFSYM(rep_vm_interpreter, "rep.vm.interpreter");
 DEFSYM(external, "external");
+DEFSYM(lazy_open_structures, "lazy-open-structures"); /*
+::doc:lazy-open-structures::
+When true, opening or accessing a structure that hasn't been loaded, but
+whose exports are recorded by a module index in the `load-path', doesn't
+load it until one of its exports is referenced.
+::end:: */
 DEFSYM(local, "local");
+DEFSYM(cache_sets, "sets");
+DEFSYM(cache_associativity, "associativity");
+DEFSYM(cache_hits, "hits");
+DEFSYM(cache_misses, "misses");
+DEFSYM(cache_collisions, "collisions");
+DEFSYM(cache_conflicts, "conflicts");
+DEFSYM(symbol_invalidations, "symbol-invalidations");
+DEFSYM(structure_invalidations, "structure-invalidations");
+DEFSYM(cache_flushes, "flushes");
+DEFSYM(import_table_builds, "import-table-builds");
 
 static rep_struct_node *lookup_or_add (rep_struct *s, repv var);
+static void free_import_table (rep_struct *s);
+
+/* Incremented whenever the set of bindings that could be imported by
+   any structure may have changed (an export is added or removed, or
+   a structure's imports or name change). Import tables of sealed
+   structures are rebuilt when it no longer matches theirs. */
+static unsigned int import_stamp = 1;
+
+static inline void
+imports_changed (void)
+{
+    import_stamp++;
+}
 
 
 /* cached lookups */
 
-#ifdef DEBUG
 /* Hits and misses are obvious. Collisions occur when a miss ejects data
-   from the cache, conflicts when a miss ejects data for the _same_ symbol. */
-static int ref_cache_hits, ref_cache_misses,
+   from the cache, conflicts when a miss ejects data for the _same_ symbol.
+   The others count the calls of each of the invalidation functions. */
+static unsigned long ref_cache_hits, ref_cache_misses,
     ref_cache_collisions, ref_cache_conflicts;
+static unsigned long ref_cache_symbol_invalidations,
+    ref_cache_struct_invalidations, ref_cache_flushes;
 
+/* number of import tables of sealed structures that have been built */
+static unsigned long import_table_builds;
+
+#ifdef DEBUG
 static void
 print_cache_stats (void)
 {
@@ -168,6 +212,9 @@ print_cache_stats (void)
 }
 #endif
 
+/* see repint.h; starts at one so that zeroed caches never match */
+unsigned int rep_structure_stamp = 1;
+
 #if defined SINGLE_DM_CACHE
 
 /* This is a very simple cache; a single direct-mapped table, indexed by
@@ -176,6 +223,9 @@ print_cache_stats (void)
 #define CACHE_SETS 256
 #define CACHE_HASH(x) (((x) >> 4) % CACHE_SETS)
 
+#define cache_sets CACHE_SETS
+#define cache_assoc 1
+
 struct cache_line {
     rep_struct *s;
     rep_struct_node *n;
@@ -189,12 +239,10 @@ enter_cache (rep_struct *s, rep_struct_node *binding)
     unsigned int hash = CACHE_HASH (binding->symbol);
     if (ref_cache[hash].s != 0)
     {
-#ifdef DEBUG
 	if (ref_cache[hash].n->symbol == binding->symbol)
 	    ref_cache_conflicts++;
 	else
 	    ref_cache_collisions++;
-#endif
     }
     ref_cache[hash].s = s;
     ref_cache[hash].n = binding;
@@ -206,16 +254,12 @@ lookup_cache (rep_struct *s, repv var)
     unsigned int hash = CACHE_HASH (var);
     if (ref_cache[hash].s == s && ref_cache[hash].n->symbol == var)
     {
-#ifdef DEBUG
 	ref_cache_hits++;
-#endif
 	return ref_cache[hash].n;
     }
     else
     {
-#ifdef DEBUG
 	ref_cache_misses++;
-#endif
 	return 0;
     }
 }
@@ -223,6 +267,8 @@ lookup_cache (rep_struct *s, repv var)
 static inline void
 cache_invalidate_symbol (repv symbol)
 {
+    rep_structure_stamp++;
+    ref_cache_symbol_invalidations++;
     unsigned int hash = CACHE_HASH (symbol);
     if (ref_cache[hash].s != 0 && ref_cache[hash].n->symbol == symbol)
 	ref_cache[hash].s = 0;
@@ -231,6 +277,8 @@ cache_invalidate_symbol (repv symbol)
 static void
 cache_invalidate_struct (rep_struct *s)
 {
+    rep_structure_stamp++;
+    ref_cache_struct_invalidations++;
     int i;
     for (i = 0; i < CACHE_SETS; i++)
     {
@@ -242,6 +290,9 @@ cache_invalidate_struct (rep_struct *s)
 static inline void
 cache_flush (void)
 {
+    rep_structure_stamp++;
+    ref_cache_flushes++;
+    imports_changed ();
     /* assumes null pointer == all zeros.. */
     memset (ref_cache, 0, sizeof (ref_cache));
 }
@@ -252,9 +303,14 @@ cache_flush (void)
    moving to 4-way set-associative eliminates significant conflict
    misses in most cases. */
 
+/* The number of sets is a power of two, CACHE_SETS unless changed by
+   the REPCACHESETS environment variable or `structure-cache-size' */
 #define CACHE_SETS 128
-#define CACHE_HASH(x) (((x) >> 3) % CACHE_SETS)
+#define CACHE_HASH(x) (((x) >> 3) & (cache_sets - 1))
 #define CACHE_ASSOC 4
+#define MAX_CACHE_SETS 65536
+
+#define cache_assoc CACHE_ASSOC
 
 struct cache_line {
     rep_struct *s;
@@ -262,7 +318,9 @@ struct cache_line {
     int age;
 };
 
-static struct cache_line ref_cache[CACHE_SETS][CACHE_ASSOC];
+static struct cache_line initial_ref_cache[CACHE_SETS][CACHE_ASSOC];
+static struct cache_line (*ref_cache)[CACHE_ASSOC] = initial_ref_cache;
+static int cache_sets = CACHE_SETS;
 static int ref_age;
 
 static inline void
@@ -284,7 +342,6 @@ enter_cache (rep_struct *s, rep_struct_node *binding)
 	}
     }
     assert (oldest_i < CACHE_ASSOC);
-#ifdef DEBUG
     if (ref_cache[hash][oldest_i].s != 0)
     {
 	if (ref_cache[hash][oldest_i].n->symbol == binding->symbol)
@@ -292,7 +349,6 @@ enter_cache (rep_struct *s, rep_struct_node *binding)
 	else
 	    ref_cache_collisions++;
     }
-#endif
     ref_cache[hash][oldest_i].s = s;
     ref_cache[hash][oldest_i].n = binding;
     ref_cache[hash][oldest_i].age = ++ref_age;
@@ -307,22 +363,20 @@ lookup_cache (rep_struct *s, repv var)
     {
 	if (ref_cache[hash][i].s == s && ref_cache[hash][i].n->symbol == var)
 	{
-#ifdef DEBUG
 	    ref_cache_hits++;
-#endif
 	    ref_cache[hash][i].age++;
 	    return ref_cache[hash][i].n;
 	}
     }
-#ifdef DEBUG
     ref_cache_misses++;
-#endif
     return 0;
 }
 
 static inline void
 cache_invalidate_symbol (repv symbol)
 {
+    rep_structure_stamp++;
+    ref_cache_symbol_invalidations++;
     unsigned int hash = CACHE_HASH (symbol);
     int i;
     for (i = 0; i < CACHE_ASSOC; i++)
@@ -338,8 +392,10 @@ cache_invalidate_symbol (repv symbol)
 static void
 cache_invalidate_struct (rep_struct *s)
 {
+    rep_structure_stamp++;
+    ref_cache_struct_invalidations++;
     int i, j;
-    for (i = 0; i < CACHE_SETS; i++)
+    for (i = 0; i < cache_sets; i++)
     {
 	for (j = 0; j < CACHE_ASSOC; j++)
 	{
@@ -352,14 +408,47 @@ cache_invalidate_struct (rep_struct *s)
 static inline void
 cache_flush (void)
 {
+    rep_structure_stamp++;
+    ref_cache_flushes++;
+    imports_changed ();
     /* assumes null pointer == all zeros.. */
-    memset (ref_cache, 0, sizeof (ref_cache));
+    memset (ref_cache, 0, cache_sets * sizeof (ref_cache[0]));
+}
+
+/* Make the cache have SETS sets (rounded up to a power of two),
+   returning false if the memory couldn't be allocated */
+static rep_bool
+resize_cache (int sets)
+{
+    struct cache_line (*new)[CACHE_ASSOC];
+    int n = 1;
+    while (n < sets && n < MAX_CACHE_SETS)
+	n *= 2;
+    if (n == cache_sets)
+	return rep_TRUE;
+    if (n == CACHE_SETS)
+	new = initial_ref_cache;
+    else
+    {
+	new = rep_alloc (n * sizeof (ref_cache[0]));
+	if (new == 0)
+	    return rep_FALSE;
+    }
+    if (ref_cache != initial_ref_cache)
+	rep_free (ref_cache);
+    ref_cache = new;
+    cache_sets = n;
+    cache_flush ();
+    return rep_TRUE;
 }
 
 #else /* SINGLE_SA_CACHE */
 
 /* no cache at all */
 
+#define cache_sets 0
+#define cache_assoc 0
+
 static inline void
 enter_cache (rep_struct *s, rep_struct_node *binding)
 {
@@ -368,29 +457,43 @@ enter_cache (rep_struct *s, rep_struct_node *binding)
 static inline rep_struct_node *
 lookup_cache (rep_struct *s, repv var)
 {
-#ifdef DEBUG
     ref_cache_misses++;
-#endif
     return 0;
 }
 
 static inline void
 cache_invalidate_symbol (repv symbol)
 {
+    rep_structure_stamp++;
+    ref_cache_symbol_invalidations++;
 }
 
 static void
 cache_invalidate_struct (rep_struct *s)
 {
+    rep_structure_stamp++;
+    ref_cache_struct_invalidations++;
 }
 
 static void
 cache_flush (void)
 {
+    rep_structure_stamp++;
+    ref_cache_flushes++;
+    imports_changed ();
 }
 
 #endif /* !SINGLE_DM_CACHE */
 
+#ifndef SINGLE_SA_CACHE
+/* the other caches have a fixed size */
+static rep_bool
+resize_cache (int sets)
+{
+    return rep_TRUE;
+}
+#endif
+
 
 /* type hooks */
 
@@ -419,6 +522,8 @@ free_structure (rep_struct *x)
 {
     int i;
     cache_invalidate_struct (x);
+    imports_changed ();
+    free_import_table (x);
     for (i = 0; i < x->total_buckets; i++)
     {
 	rep_struct_node *n, *next;
@@ -494,8 +599,6 @@ structure_exports_inherited_p (rep_struct *s, repv var)
 static inline rep_struct_node *
 lookup (rep_struct *s, repv var)
 {
-    /* this is also in OP_REFG in lispmach.c */
-
     rep_struct_node *n;
     if (s->total_buckets != 0)
     {
@@ -564,6 +667,8 @@ lookup_or_add (rep_struct *s, repv var)
 	}
 
 	cache_invalidate_symbol (var);
+	if (n->is_exported)
+	    imports_changed ();
     }
     return n;
 }
@@ -580,6 +685,8 @@ remove_binding (rep_struct *s, repv var)
 	    if ((*n)->symbol == var)
 	    {
 		rep_struct_node *next = (*n)->next;
+		if ((*n)->is_exported)
+		    imports_changed ();
 		rep_free (*n);
 		*n = next;
 		cache_invalidate_symbol (var);
@@ -589,15 +696,64 @@ remove_binding (rep_struct *s, repv var)
     }
 }
 
+/* If the structure called NAME was opened lazily and exports VAR, load
+   it and return it; otherwise return nil. */
+static repv
+load_lazy_structure (repv name, repv var)
+{
+    repv *ptr = &lazy_structures;
+    while (rep_CONSP (*ptr))
+    {
+	repv cell = rep_CAR (*ptr);
+	if (rep_CAR (cell) == name)
+	{
+	    repv tem;
+	    for (tem = rep_CDR (cell); rep_CONSP (tem); tem = rep_CDR (tem))
+	    {
+		if (rep_CAR (tem) == var)
+		{
+		    rep_GC_root gc_cell;
+		    *ptr = rep_CDR (*ptr);
+		    rep_PUSHGC (gc_cell, cell);
+		    tem = Fintern_structure (name);
+		    rep_POPGC;
+		    if (!tem || !rep_STRUCTUREP (tem))
+			/* try again next time */
+			lazy_structures = Fcons (cell, lazy_structures);
+		    return tem;
+		}
+	    }
+	    break;
+	}
+	ptr = rep_CDRLOC (*ptr);
+    }
+    return Qnil;
+}
+
+/* Set when lookup_recursively skips a structure that is already being
+   searched, meaning that what was found depends on where the search
+   started */
+static rep_bool exclusion_hit;
+
 /* Scan for a binding of symbol VAR under structure S, or return null. This
    also searches the exports of any structures that S has opened */
 static rep_struct_node *
 lookup_recursively (repv s, repv var)
 {
     if (rep_SYMBOLP (s))
-	s = Fget_structure (s);
+    {
+	repv name = s;
+	s = Fget_structure (name);
+	if (s == Qnil && lazy_structures != Qnil)
+	    s = load_lazy_structure (name, var);
+    }
     if (s && rep_STRUCTUREP (s)
-	&& !(rep_STRUCTURE (s)->car & rep_STF_EXCLUSION))
+	&& (rep_STRUCTURE (s)->car & rep_STF_EXCLUSION))
+    {
+	exclusion_hit = rep_TRUE;
+	return 0;
+    }
+    else if (s && rep_STRUCTUREP (s))
     {
 	rep_struct_node *n;
 	n = lookup (rep_STRUCTURE (s), var);
@@ -613,27 +769,249 @@ lookup_recursively (repv s, repv var)
 	return 0;
 }
 
+/* Return the binding of VAR in S itself, or null. */
 rep_struct_node *
-rep_search_imports (rep_struct *s, repv var)
+rep_lookup_binding (rep_struct *s, repv var)
 {
-    rep_struct_node *n = lookup_cache (s, var);
-    if (n != 0)
-	return n;
+    return lookup (s, var);
+}
+
+/* Search the structures opened by S for an exported binding of VAR,
+   without using any caches */
+static rep_struct_node *
+search_imports_1 (rep_struct *s, repv var)
+{
+    repv imports = s->imports;
+    while (rep_CONSP (imports))
+    {
+	rep_struct_node *n = lookup_recursively (rep_CAR (imports), var);
+	if (n != 0)
+	    return n;
+	imports = rep_CDR (imports);
+    }
+    return 0;
+}
+
+
+/* import tables
+
+   A sealed structure doesn't search its imports for each global
+   variable that misses the reference cache. Instead it keeps a table
+   of every binding it can import, built when first needed, and
+   discarded whenever import_stamp changes. The table is open-addressed
+   and at most half full, so a lookup (hit or, just as important, miss)
+   usually probes a single entry. */
+
+struct rep_import_table_struct {
+    unsigned int stamp;
+    unsigned int size;			/* a power of two */
+    int count;
+    struct import_entry {
+	repv symbol;
+	rep_struct_node *n;
+    } entries[1];
+};
+
+#define IMPORT_HASH(x, size) (((x) >> 3) & ((size) - 1))
+
+/* Symbols that may be importable, collected while building a table.
+   Tables may be built while resolving the bindings of another, so
+   each build has its own. */
+struct candidates {
+    repv *v;
+    int n, size;
+};
+
+static void
+add_candidate (struct candidates *c, repv var)
+{
+    if (c->n == c->size)
+    {
+	int new_size = MAX (c->size * 2, 256);
+	repv *new = rep_realloc (c->v, new_size * sizeof (repv));
+	if (new == 0)
+	    return;
+	c->v = new;
+	c->size = new_size;
+    }
+    c->v[c->n++] = var;
+}
+
+/* Add every symbol that structure S (or its name) may export to C.
+   The table built from them resolves each one to make sure it really
+   is exported, so including extras does no harm. */
+static void
+collect_exports (struct candidates *c, repv s)
+{
+    rep_struct *x;
+    int i;
+
+    if (rep_SYMBOLP (s))
+    {
+	repv name = s;
+	s = Fget_structure (name);
+	if (s == Qnil)
+	{
+	    /* resolving the candidates loads it if necessary */
+	    repv tem = Fassq (name, lazy_structures);
+	    if (tem && rep_CONSP (tem))
+	    {
+		for (tem = rep_CDR (tem); rep_CONSP (tem); tem = rep_CDR (tem))
+		    add_candidate (c, rep_CAR (tem));
+	    }
+	}
+    }
+    if (!s || !rep_STRUCTUREP (s))
+	return;
+    x = rep_STRUCTURE (s);
+    if (x->car & rep_STF_EXCLUSION)
+    {
+	exclusion_hit = rep_TRUE;
+	return;
+    }
+
+    for (i = 0; i < x->total_buckets; i++)
+    {
+	rep_struct_node *n;
+	for (n = x->buckets[i]; n != 0; n = n->next)
+	{
+	    if (n->is_exported)
+		add_candidate (c, n->symbol);
+	}
+    }
+
+    x->car |= rep_STF_EXCLUSION;
+    if (x->car & rep_STF_EXPORT_ALL)
+    {
+	repv tem;
+	for (tem = x->imports; rep_CONSP (tem); tem = rep_CDR (tem))
+	    collect_exports (c, rep_CAR (tem));
+    }
     else
     {
-	repv imports = s->imports;
-	while (rep_CONSP (imports))
+	repv tem;
+	for (tem = x->inherited; rep_CONSP (tem); tem = rep_CDR (tem))
+	    add_candidate (c, rep_CAR (tem));
+    }
+    x->car &= ~rep_STF_EXCLUSION;
+}
+
+static void
+free_import_table (rep_struct *s)
+{
+    if (s->import_table != 0)
+    {
+	rep_free (s->import_table);
+	s->import_table = 0;
+    }
+}
+
+/* Build the import table of structure S. If the table can't be made,
+   S is left without one. */
+static void
+build_import_table (rep_struct *s)
+{
+    rep_import_table *t;
+    struct candidates c;
+    unsigned int size;
+    rep_bool old_hit = exclusion_hit;
+    repv tem;
+    int i;
+
+    free_import_table (s);
+    import_table_builds++;
+
+    exclusion_hit = rep_FALSE;
+    c.v = 0;
+    c.n = c.size = 0;
+    for (tem = s->imports; rep_CONSP (tem); tem = rep_CDR (tem))
+	collect_exports (&c, rep_CAR (tem));
+
+    for (size = 16; size < (unsigned int) c.n * 2; size *= 2)
+	;
+    t = rep_alloc (sizeof (rep_import_table)
+		   + (size - 1) * sizeof (struct import_entry));
+    if (t == 0)
+    {
+	rep_free (c.v);
+	exclusion_hit = old_hit;
+	return;
+    }
+    memset (t->entries, 0, size * sizeof (struct import_entry));
+    t->size = size;
+    t->count = 0;
+
+    for (i = 0; i < c.n; i++)
+    {
+	repv var = c.v[i];
+	unsigned int j = IMPORT_HASH (var, size);
+	while (t->entries[j].symbol != 0 && t->entries[j].symbol != var)
+	    j = (j + 1) & (size - 1);
+	if (t->entries[j].symbol == 0)
 	{
-	    n = lookup_recursively (rep_CAR (imports), var);
+	    rep_struct_node *n = search_imports_1 (s, var);
 	    if (n != 0)
 	    {
-		enter_cache (s, n);
-		return n;
+		t->entries[j].symbol = var;
+		t->entries[j].n = n;
+		t->count++;
 	    }
-	    imports = rep_CDR (imports);
 	}
-	return 0;
     }
+
+    /* A table built from inside another search may be missing bindings
+       that are only reachable through the structures being searched;
+       it can be used for now, but not kept */
+    t->stamp = exclusion_hit ? 0 : import_stamp;
+    exclusion_hit = old_hit || exclusion_hit;
+    rep_free (c.v);
+
+    /* a nested build may have made a table for S meanwhile */
+    free_import_table (s);
+    s->import_table = t;
+}
+
+/* Find the binding of VAR imported by sealed structure S */
+static rep_struct_node *
+search_import_table (rep_struct *s, repv var)
+{
+    rep_import_table *t = s->import_table;
+    unsigned int j;
+
+    if (t == 0 || t->stamp != import_stamp)
+    {
+	build_import_table (s);
+	t = s->import_table;
+	if (t == 0)
+	    return search_imports_1 (s, var);
+    }
+
+    j = IMPORT_HASH (var, t->size);
+    while (t->entries[j].symbol != 0)
+    {
+	if (t->entries[j].symbol == var)
+	    return t->entries[j].n;
+	j = (j + 1) & (t->size - 1);
+    }
+    return 0;
+}
+
+rep_struct_node *
+rep_search_imports (rep_struct *s, repv var)
+{
+    rep_struct_node *n;
+
+    if (s->car & rep_STF_SEALED)
+	return search_import_table (s, var);
+
+    n = lookup_cache (s, var);
+    if (n == 0)
+    {
+	n = search_imports_1 (s, var);
+	if (n != 0)
+	    enter_cache (s, n);
+    }
+    return n;
 }
 
 
@@ -729,6 +1107,7 @@ BODY-THUNK may be modified by this function!
     s->total_buckets = s->total_bindings = 0;
     s->imports = Qnil;
     s->accessible = Qnil;
+    s->import_table = 0;
     s->special_env = Qt;
     if (rep_structure != rep_NULL)
 	s->apply_bytecode = rep_STRUCTURE (rep_structure)->apply_bytecode;
@@ -748,9 +1127,11 @@ BODY-THUNK may be modified by this function!
     {
 	repv tem;
 	s->imports = Fcons (Q_meta, s->imports);
+	imports_changed ();
 	rep_FUNARG (header_thunk)->structure = s_;
 	tem = rep_call_lisp0 (header_thunk);
 	s->imports = Fdelq (Q_meta, s->imports);
+	imports_changed ();
 	if (tem == rep_NULL)
 	    s = 0;
     }
@@ -796,8 +1177,6 @@ Returns a void value if no such binding.
     rep_DECLARE2 (var, rep_SYMBOLP);
     s = rep_STRUCTURE (structure);
 
-    /* this is also in OP_REFG in lispmach.c */
-
     n = lookup (s, var);
     if (n == 0)
 	n = rep_search_imports (s, var);
@@ -1110,6 +1489,29 @@ attempt to load it, but it isn't imported to any module.
 
 DEFSTRING (no_struct, "No such structure");
 
+/* If the structure called NAME needn't be loaded yet, note that it's
+   been opened lazily and return true. Returns false if NAME should be
+   loaded, or rep_NULL after an error. */
+static repv
+open_lazily (repv name)
+{
+    repv tem = Fsymbol_value (Qlazy_open_structures, Qt);
+    if (tem == Qnil || rep_VOIDP (tem))
+	return Qnil;
+    tem = Fget_structure (name);
+    if (tem != Qnil)
+	return Qnil;
+    if (Fassq (name, lazy_structures) != Qnil)
+	return Qt;
+    tem = rep_module_index_exports (name);
+    if (tem && rep_CONSP (tem))
+    {
+	lazy_structures = Fcons (Fcons (name, tem), lazy_structures);
+	return Qt;
+    }
+    return tem;
+}
+
 DEFUN ("open-structures", Fopen_structures,
        Sopen_structures, (repv args), rep_Subr1) /*
 ::doc:rep.structures#open-structures::
@@ -1131,8 +1533,12 @@ named in the list STRUCT-NAMES.
 	{
 	    repv s = rep_CAR (args);
 	    if (rep_SYMBOLP (s))
-		s = Fintern_structure (s);
-	    if (!s || !rep_STRUCTUREP (s))
+	    {
+		s = open_lazily (rep_CAR (args));
+		if (s == Qnil)
+		    s = Fintern_structure (rep_CAR (args));
+	    }
+	    if (!s || (s != Qt && !rep_STRUCTUREP (s)))
 	    {
 		ret = Fsignal (Qerror, rep_list_2 (rep_VAL (&no_struct),
 						   rep_CAR (args)));
@@ -1166,8 +1572,12 @@ named in the list STRUCT-NAMES.
 	repv tem = Fmemq (rep_CAR (args), dst->accessible);
 	if (tem == Qnil)
 	{
-	    repv s = Fintern_structure (rep_CAR (args));
-	    if (s == rep_NULL || !rep_STRUCTUREP (s))
+	    repv s = Qnil;
+	    if (rep_SYMBOLP (rep_CAR (args)))
+		s = open_lazily (rep_CAR (args));
+	    if (s == Qnil)
+		s = Fintern_structure (rep_CAR (args));
+	    if (s == rep_NULL || (s != Qt && !rep_STRUCTUREP (s)))
 	    {
 		ret = Fsignal (Qerror, rep_list_2 (rep_VAL (&no_struct),
 						   rep_CAR (args)));
@@ -1290,6 +1700,71 @@ DEFUN ("structure-stats", Fstructure_stats,
 }
 #endif
 
+DEFUN ("structure-cache-stats", Fstructure_cache_stats,
+       Sstructure_cache_stats, (repv reset), rep_Subr1) /*
+::doc:rep.structures#structure-cache-stats::
+structure-cache-stats [RESET]
+
+Return an association list describing the cache of global variable
+references shared by all structures: its number of `sets' and their
+`associativity', the number of `hits' and `misses', the number of
+misses that evicted a different symbol (`collisions') or the same
+symbol looked up from a different structure (`conflicts'), how often
+entries for a symbol or a whole structure were invalidated
+(`symbol-invalidations' and `structure-invalidations'), the number of
+times the cache was emptied (`flushes'), and how many import tables
+sealed structures have built (`import-table-builds').
+
+If RESET is true, the counts are set to zero after being read.
+::end:: */
+{
+    repv out = Qnil;
+#define PUSH(sym, value) out = Fcons (Fcons (sym, value), out)
+    PUSH (Qimport_table_builds, rep_make_long_uint (import_table_builds));
+    PUSH (Qcache_flushes, rep_make_long_uint (ref_cache_flushes));
+    PUSH (Qstructure_invalidations,
+	  rep_make_long_uint (ref_cache_struct_invalidations));
+    PUSH (Qsymbol_invalidations,
+	  rep_make_long_uint (ref_cache_symbol_invalidations));
+    PUSH (Qcache_conflicts, rep_make_long_uint (ref_cache_conflicts));
+    PUSH (Qcache_collisions, rep_make_long_uint (ref_cache_collisions));
+    PUSH (Qcache_misses, rep_make_long_uint (ref_cache_misses));
+    PUSH (Qcache_hits, rep_make_long_uint (ref_cache_hits));
+    PUSH (Qcache_associativity, rep_MAKE_INT (cache_assoc));
+    PUSH (Qcache_sets, rep_MAKE_INT (cache_sets));
+#undef PUSH
+    if (reset != Qnil)
+    {
+	ref_cache_hits = ref_cache_misses = 0;
+	ref_cache_collisions = ref_cache_conflicts = 0;
+	ref_cache_symbol_invalidations = ref_cache_struct_invalidations = 0;
+	ref_cache_flushes = import_table_builds = 0;
+    }
+    return out;
+}
+
+DEFUN ("structure-cache-size", Fstructure_cache_size,
+       Sstructure_cache_size, (repv sets), rep_Subr1) /*
+::doc:rep.structures#structure-cache-size::
+structure-cache-size [NEW-SETS]
+
+Return the number of sets in the cache of global variable references.
+If NEW-SETS is given, the cache is first emptied and resized to that
+many sets, rounded up to a power of two. The initial size may also be
+given by the REPCACHESETS environment variable.
+::end:: */
+{
+    if (sets != Qnil)
+    {
+	rep_DECLARE1 (sets, rep_INTP);
+	if (rep_INT (sets) < 1)
+	    return rep_signal_arg_error (sets, 1);
+	if (!resize_cache (rep_INT (sets)))
+	    return rep_mem_error ();
+    }
+    return rep_MAKE_INT (cache_sets);
+}
+
 DEFUN ("make-binding-immutable", Fmake_binding_immutable,
        Smake_binding_immutable, (repv var), rep_Subr1) /*
 ::doc:rep.structures#make-binding-immutable::
@@ -1305,6 +1780,7 @@ changed.
     if (n != 0)
     {
 	n->is_constant = 1;
+	rep_structure_stamp++;
 	return var;
     }
     else
@@ -1349,12 +1825,14 @@ Fexport_binding (repv var)
 	{
 	    n->is_exported = 1;
 	    cache_invalidate_symbol (var);
+	    imports_changed ();
 	}
     }
     else if (!structure_exports_inherited_p (s, var))
     {
 	s->inherited = Fcons (var, s->inherited);
 	cache_invalidate_symbol (var);
+	imports_changed ();
     }
 
     return Qnil;
@@ -1554,9 +2032,46 @@ DEFUN("structure-exports-all", Fstructure_exports_all,
 	rep_STRUCTURE (s)->car |= rep_STF_EXPORT_ALL;
     else
 	rep_STRUCTURE (s)->car &= ~rep_STF_EXPORT_ALL;
+    imports_changed ();
+    return s;
+}
+
+DEFUN("structure-seal", Fstructure_seal,
+      Sstructure_seal, (repv s, repv status), rep_Subr2) /*
+::doc:rep.structures#structure-seal::
+structure-seal STRUCTURE STATUS
+
+When STATUS is true, mark that structure object STRUCTURE should
+resolve the bindings it imports using a table of everything exported
+by the structures it opens, instead of searching them. The table is
+built when first needed and rebuilt after any structure's exports or
+imports change, so sealing suits structures whose imports are settled,
+such as compiled modules once loaded. When STATUS is false, the
+structure is unsealed.
+::end:: */
+{
+    rep_DECLARE1 (s, rep_STRUCTUREP);
+    if (status != Qnil)
+	rep_STRUCTURE (s)->car |= rep_STF_SEALED;
+    else
+	rep_STRUCTURE (s)->car &= ~rep_STF_SEALED;
+    free_import_table (rep_STRUCTURE (s));
     return s;
 }
 
+DEFUN("structure-sealed-p", Fstructure_sealed_p,
+      Sstructure_sealed_p, (repv s), rep_Subr1) /*
+::doc:rep.structures#structure-sealed-p::
+structure-sealed-p STRUCTURE
+
+Return true if structure object STRUCTURE has been sealed by
+`structure-seal'.
+::end:: */
+{
+    rep_DECLARE1 (s, rep_STRUCTUREP);
+    return (rep_STRUCTURE (s)->car & rep_STF_SEALED) ? Qt : Qnil;
+}
+
 
 DEFUN("structure-set-binds", Fstructure_set_binds,
       Sstructure_set_binds, (repv s, repv status), rep_Subr2)
@@ -1675,6 +2190,7 @@ void
 rep_structures_init (void)
 {
     repv tem = rep_push_structure ("rep.structures");
+    char *sets;
 
     rep_ADD_SUBR (Smake_structure);
     rep_ADD_SUBR (S_structure_ref);
@@ -1701,10 +2217,14 @@ rep_structures_init (void)
 #ifdef DEBUG
     rep_ADD_SUBR (Sstructure_stats);
 #endif
+    rep_ADD_SUBR (Sstructure_cache_stats);
+    rep_ADD_SUBR (Sstructure_cache_size);
     rep_ADD_SUBR (Smake_binding_immutable);
     rep_ADD_SUBR (Sbinding_immutable_p);
     rep_ADD_SUBR (Sexport_bindings);
     rep_ADD_SUBR (Sstructure_exports_all);
+    rep_ADD_SUBR (Sstructure_seal);
+    rep_ADD_SUBR (Sstructure_sealed_p);
     rep_ADD_SUBR (Sstructure_set_binds);
     rep_ADD_SUBR (Sstructure_install_vm);
 
@@ -1726,11 +2246,29 @@ rep_structures_init (void)
     rep_INTERN (rep_lang_interpreter);
     rep_INTERN (rep_vm_interpreter);
     rep_INTERN (external);
+    rep_INTERN_SPECIAL (lazy_open_structures);
+    Fset (Qlazy_open_structures, Qt);
     rep_INTERN (local);
+    rep_INTERN (cache_sets);
+    rep_INTERN (cache_associativity);
+    rep_INTERN (cache_hits);
+    rep_INTERN (cache_misses);
+    rep_INTERN (cache_collisions);
+    rep_INTERN (cache_conflicts);
+    rep_INTERN (symbol_invalidations);
+    rep_INTERN (structure_invalidations);
+    rep_INTERN (cache_flushes);
+    rep_INTERN (import_table_builds);
+
+    sets = getenv ("REPCACHESETS");
+    if (sets != 0 && atoi (sets) > 0)
+	resize_cache (atoi (sets));
 
     rep_mark_static (&rep_structure);
     rep_mark_static (&rep_default_structure);
     rep_mark_static (&rep_specials_structure);
+    lazy_structures = Qnil;
+    rep_mark_static (&lazy_structures);
     rep_mark_static (&rep_structures_structure);
 
     Fname_structure (rep_default_structure, Qrep);
@@ -47,9 +47,9 @@ char *alloca ();
 #include <stdlib.h>
 #include <assert.h>
 
-/* The number of hash buckets in each rep_obarray, this is a prime number. */
-#define rep_OBSIZE		509
-#define rep_KEY_OBSIZE		127
+/* The initial capacity of the obarrays */
+#define rep_OBSIZE		2048
+#define rep_KEY_OBSIZE		128
 
 #define rep_FUNARGBLK_SIZE	204		/* ~4k */
 
@@ -78,7 +78,7 @@ repv (*rep_set_local_symbol_fun)(repv sym, repv val) = 0;
 rep_ALIGN_CELL(static rep_cell void_object) = { rep_Void };
 repv rep_void_value = rep_VAL(&void_object);
 
-/* The special value which signifies the end of a hash-bucket chain.
+/* The special value which marks an empty slot of an obarray.
    It can be any Lisp object which isn't a symbol.  */
 #define OB_NIL rep_VAL(&void_object)
 
@@ -226,25 +226,180 @@ rep_intern_static(repv *symp, repv name)
 	abort();
 }
 
+/* Obarrays
+
+   An obarray is a two-element vector, [USED TABLE]. TABLE is a vector
+   whose length is a power of two, holding symbols by open addressing
+   (with linear probing) on the hash of their names. Each interned
+   symbol keeps that hash in its `next' slot, as a fixnum, so lookups
+   compare it before the names, and the table can be enlarged without
+   hashing any strings. USED counts the slots that hold either a symbol
+   or the marker left by `unintern'; the table is doubled in size
+   before it gets more than half full. */
+
+/* Stored in the slots of deleted symbols */
+rep_ALIGN_CELL(static rep_cell ob_deleted_object) = { rep_Void };
+#define OB_DELETED rep_VAL(&ob_deleted_object)
+
+#define OB_MIN_SIZE 16
+#define OB_HASH_MASK 0x3fffffff
+
+#define OBARRAYP(v)							\
+    (rep_VECTORP(v) && rep_VECT_LEN(v) == 2				\
+     && rep_INTP(rep_VECTI(v, 0)) && rep_VECTORP(rep_VECTI(v, 1)))
+
+#define OB_USED(ob)	rep_INT(rep_VECTI(ob, 0))
+#define OB_TABLE(ob)	rep_VECTI(ob, 1)
+
+/* Hash the LEN bytes at STR, a word at a time */
 static inline unsigned long
-hash(char *str)
+hash (const char *str, size_t len)
 {
-    register unsigned long value = 0;
-    while(*str)
-	value = (value * 33) + *str++;
-    return(value);
+    unsigned long value = len, word;
+    while (len >= sizeof (word))
+    {
+	memcpy (&word, str, sizeof (word));
+	value = (value ^ word) * 0x9e3779b1UL;
+	value ^= value >> 15;
+	str += sizeof (word);
+	len -= sizeof (word);
+    }
+    if (len > 0)
+    {
+	word = 0;
+	while (len-- > 0)
+	    word = (word << 8) | (unsigned char) *str++;
+	value = (value ^ word) * 0x9e3779b1UL;
+    }
+    value ^= value >> (sizeof (value) * 4);
+    value ^= value >> 13;
+    return value & OB_HASH_MASK;
+}
+
+/* Return the index in the table of obarray OB of the symbol called
+   STR (LEN bytes, hashing to H), or -1 if there isn't one. In that case
+   the index at which such a symbol should be inserted is stored in
+   *FREE, if non-null. */
+static int
+ob_search (repv ob, const char *str, size_t len, unsigned long h, int *free)
+{
+    repv table = OB_TABLE (ob);
+    int mask = rep_VECT_LEN (table) - 1;
+    int i = h & mask, deleted = -1;
+    while (1)
+    {
+	repv sym = rep_VECTI (table, i);
+	if (sym == OB_NIL)
+	{
+	    if (free != 0)
+		*free = (deleted >= 0) ? deleted : i;
+	    return -1;
+	}
+	else if (sym == OB_DELETED)
+	{
+	    if (deleted < 0)
+		deleted = i;
+	}
+	else if ((unsigned long) rep_INT (rep_SYM (sym)->next) == h
+		 && rep_STRING_LEN (rep_SYM (sym)->name) == len
+		 && memcmp (rep_STR (rep_SYM (sym)->name), str, len) == 0)
+	{
+	    return i;
+	}
+	i = (i + 1) & mask;
+    }
+}
+
+/* Replace the table of obarray OB by one with room for at least
+   COUNT symbols. Returns false if it couldn't be allocated. */
+static rep_bool
+ob_resize (repv ob, int count)
+{
+    repv old = OB_TABLE (ob), new;
+    int size = OB_MIN_SIZE, i, used = 0;
+    while (size < count * 2)
+	size *= 2;
+    new = Fmake_vector (rep_MAKE_INT (size), OB_NIL);
+    if (new == rep_NULL)
+	return rep_FALSE;
+    for (i = 0; i < rep_VECT_LEN (old); i++)
+    {
+	repv sym = rep_VECTI (old, i);
+	if (rep_SYMBOLP (sym))
+	{
+	    int j = rep_INT (rep_SYM (sym)->next) & (size - 1);
+	    while (rep_VECTI (new, j) != OB_NIL)
+		j = (j + 1) & (size - 1);
+	    rep_VECTI (new, j) = sym;
+	    used++;
+	}
+    }
+    rep_VECTI (ob, 0) = rep_MAKE_INT (used);
+    rep_VECTI (ob, 1) = new;
+    return rep_TRUE;
+}
+
+/* Store uninterned symbol SYM, whose name hashes to H, in obarray OB.
+   FREE is the index that ob_search returned for it. */
+static repv
+ob_insert (repv ob, repv sym, unsigned long h, int free)
+{
+    int used = OB_USED (ob);
+    if (rep_VECTI (OB_TABLE (ob), free) == OB_NIL)
+    {
+	if ((used + 1) * 2 > rep_VECT_LEN (OB_TABLE (ob)))
+	{
+	    /* count the live symbols; deleted slots are dropped */
+	    repv table = OB_TABLE (ob);
+	    int i, live = 1;
+	    rep_GC_root gc_sym;
+	    for (i = 0; i < rep_VECT_LEN (table); i++)
+	    {
+		if (rep_SYMBOLP (rep_VECTI (table, i)))
+		    live++;
+	    }
+	    rep_PUSHGC (gc_sym, sym);
+	    if (!ob_resize (ob, MAX (live, rep_VECT_LEN (table) / 2)))
+	    {
+		rep_POPGC;
+		return rep_NULL;
+	    }
+	    rep_POPGC;
+	    ob_search (ob, rep_STR (rep_SYM (sym)->name),
+		       rep_STRING_LEN (rep_SYM (sym)->name), h, &free);
+	    used = OB_USED (ob);
+	}
+	rep_VECTI (ob, 0) = rep_MAKE_INT (used + 1);
+    }
+    rep_SYM (sym)->next = rep_MAKE_INT (h);
+    rep_VECTI (OB_TABLE (ob), free) = sym;
+    return sym;
 }
 
 DEFUN("make-obarray", Fmake_obarray, Smake_obarray, (repv size), rep_Subr1) /*
 ::doc:rep.lang.symbols#make-obarray::
 make-obarray SIZE
 
-Creates a new structure for storing symbols in. This is basically a vector
-with a few slight differences (all elements initialised to a special value).
+Creates a new structure for storing symbols in, with initial room for
+about SIZE of them. It grows as needed.
 ::end:: */
 {
+    repv ob, table;
+    rep_GC_root gc_ob;
     rep_DECLARE1(size, rep_INTP);
-    return(Fmake_vector(size, OB_NIL));
+    ob = Fmake_vector (rep_MAKE_INT (2), rep_MAKE_INT (0));
+    if (ob == rep_NULL)
+	return rep_NULL;
+    rep_PUSHGC (gc_ob, ob);
+    table = Fmake_vector (rep_MAKE_INT (0), OB_NIL);
+    if (table != rep_NULL)
+    {
+	rep_VECTI (ob, 1) = table;
+	if (!ob_resize (ob, MAX (rep_INT (size), 0)))
+	    table = rep_NULL;
+    }
+    rep_POPGC;
+    return (table != rep_NULL) ? ob : rep_NULL;
 }
 
 DEFUN("find-symbol", Ffind_symbol, Sfind_symbol, (repv name, repv ob), rep_Subr2) /*
@@ -255,20 +410,13 @@ Returns the symbol with print-name NAME, found by searching OBARRAY (or
 the default `rep_obarray' if nil), or nil if no such symbol exists.
 ::end:: */
 {
-    int vsize;
+    int i;
     rep_DECLARE1(name, rep_STRINGP);
-    if(!rep_VECTORP(ob))
+    if(!OBARRAYP(ob))
 	ob = rep_obarray;
-    if((vsize = rep_VECT_LEN(ob)) == 0)
-	return(Qnil);
-    ob = rep_VECT(ob)->array[hash(rep_STR(name)) % vsize];
-    while(rep_SYMBOLP(ob))
-    {
-	if(!strcmp(rep_STR(name), rep_STR(rep_SYM(ob)->name)))
-	    return(ob);
-	ob = rep_SYM(ob)->next;
-    }
-    return(Qnil);
+    i = ob_search (ob, rep_STR (name), rep_STRING_LEN (name),
+		   hash (rep_STR (name), rep_STRING_LEN (name)), 0);
+    return (i >= 0) ? rep_VECTI (OB_TABLE (ob), i) : Qnil;
 }
 
 DEFSTRING(already_interned, "Symbol is already interned");
@@ -281,21 +429,46 @@ Stores SYMBOL in OBARRAY (or the default). If SYMBOL has already been interned
 somewhere an error is signalled.
 ::end:: */
 {
-    int vsize, hashid;
+    repv name;
+    unsigned long h;
+    int i, free;
     rep_DECLARE1(sym, rep_SYMBOLP);
     if(rep_SYM(sym)->next != rep_NULL)
     {
 	Fsignal(Qerror, rep_list_2(rep_VAL(&already_interned), sym));
 	return rep_NULL;
     }
-    if(!rep_VECTORP(ob))
+    if(!OBARRAYP(ob))
 	ob = rep_obarray;
-    if((vsize = rep_VECT_LEN(ob)) == 0)
-	return rep_NULL;
-    hashid = hash(rep_STR(rep_SYM(sym)->name)) % vsize;
-    rep_SYM(sym)->next = rep_VECT(ob)->array[hashid];
-    rep_VECT(ob)->array[hashid] = sym;
-    return(sym);
+    name = rep_SYM (sym)->name;
+    h = hash (rep_STR (name), rep_STRING_LEN (name));
+    i = ob_search (ob, rep_STR (name), rep_STRING_LEN (name), h, &free);
+    if (i >= 0)
+    {
+	/* SYM shadows the symbol of the same name */
+	rep_SYM (rep_VECTI (OB_TABLE (ob), i))->next = rep_NULL;
+	rep_SYM (sym)->next = rep_MAKE_INT (h);
+	rep_VECTI (OB_TABLE (ob), i) = sym;
+	return sym;
+    }
+    return ob_insert (ob, sym, h, free);
+}
+
+/* Return the symbol in obarray OB (or the default) whose name is the
+   LEN bytes at STR, creating it if necessary. */
+repv
+rep_intern_chars (const char *str, size_t len, repv ob)
+{
+    unsigned long h = hash (str, len);
+    int i, free;
+    repv sym;
+    if (!OBARRAYP (ob))
+	ob = rep_obarray;
+    i = ob_search (ob, str, len, h, &free);
+    if (i >= 0)
+	return rep_VECTI (OB_TABLE (ob), i);
+    sym = Fmake_symbol (rep_string_dupn (str, len));
+    return sym ? ob_insert (ob, sym, h, free) : rep_NULL;
 }
 
 DEFUN("intern", Fintern, Sintern, (repv name, repv ob), rep_Subr2) /*
@@ -307,15 +480,18 @@ Else use `(make-symbol NAME)' to create a new symbol, intern that into the
 OBARRAY, then return it.
 ::end:: */
 {
+    unsigned long h;
+    int i, free;
     repv sym;
     rep_DECLARE1(name, rep_STRINGP);
-    if(!(sym = Ffind_symbol(name, ob)) || (rep_NILP(sym)))
-    {
-	sym = Fmake_symbol(name);
-	if(sym)
-	    return(Fintern_symbol(sym, ob));
-    }
-    return(sym);
+    if(!OBARRAYP(ob))
+	ob = rep_obarray;
+    h = hash (rep_STR (name), rep_STRING_LEN (name));
+    i = ob_search (ob, rep_STR (name), rep_STRING_LEN (name), h, &free);
+    if (i >= 0)
+	return rep_VECTI (OB_TABLE (ob), i);
+    sym = Fmake_symbol (name);
+    return sym ? ob_insert (ob, sym, h, free) : rep_NULL;
 }
 
 DEFUN("unintern", Funintern, Sunintern, (repv sym, repv ob), rep_Subr2) /*
@@ -325,26 +501,16 @@ unintern SYMBOL [OBARRAY]
 Removes SYMBOL from OBARRAY (or the default). Use this with caution.
 ::end:: */
 {
-    repv list;
-    int vsize, hashid;
+    repv name;
+    int i;
     rep_DECLARE1(sym, rep_SYMBOLP);
-    if(!rep_VECTORP(ob))
+    if(!OBARRAYP(ob))
 	ob = rep_obarray;
-    if((vsize = rep_VECT_LEN(ob)) == 0)
-	return rep_NULL;
-    hashid = hash(rep_STR(rep_SYM(sym)->name)) % vsize;
-    list = rep_VECT(ob)->array[hashid];
-    rep_VECT(ob)->array[hashid] = OB_NIL;
-    while(rep_SYMBOLP(list))
-    {
-	repv nxt = rep_SYM(list)->next;
-	if(list != sym)
-	{
-	    rep_SYM(list)->next = rep_VECT(ob)->array[hashid];
-	    rep_VECT(ob)->array[hashid] = rep_VAL(list);
-	}
-	list = nxt;
-    }
+    name = rep_SYM (sym)->name;
+    i = ob_search (ob, rep_STR (name), rep_STRING_LEN (name),
+		   hash (rep_STR (name), rep_STRING_LEN (name)), 0);
+    if (i >= 0 && rep_VECTI (OB_TABLE (ob), i) == sym)
+	rep_VECTI (OB_TABLE (ob), i) = OB_DELETED;
     rep_SYM(sym)->next = rep_NULL;
     return(sym);
 }
@@ -522,34 +688,159 @@ funarg_sweep (void)
     }
 }
 
-/* Returns (SYM . VALUE) if a lexical binding, or nil */
-static repv
+/* The interpreter's lexical environment, rep_env, is a list of
+   bindings, innermost first. Each is either (LEXTAG SYM . VALUE), or a
+   frame binding all lexical parameters of a lambda list at once: a
+   vector [NAMES VALUE-1 ... VALUE-N], where NAMES is the vector
+   [LEXTAG SYM-1 ... SYM-N] shared by all frames of that list. */
+
+#define FRAMEP(v)						\
+    (rep_VECTORP (v) && rep_VECT_LEN (v) > 0			\
+     && rep_VECTORP (rep_VECTI (v, 0))				\
+     && rep_VECTI (rep_VECTI (v, 0), 0) == LEXTAG)
+
+/* Returns the location of the value of the innermost lexical binding
+   of SYM, or null */
+static repv *
 search_environment (repv sym)
 {
     register repv env;
     for (env = rep_env; env != Qnil; env = rep_CDR (env))
     {
-	if (rep_CONSP (rep_CAR (env))
-	    && rep_CAAR(env) == LEXTAG
-	    && rep_CADAR(env) == sym)
+	repv b = rep_CAR (env);
+	if (rep_CONSP (b))
+	{
+	    if (rep_CAR (b) == LEXTAG && rep_CADR (b) == sym)
+		return rep_CDRLOC (rep_CDR (b));
+	}
+	else if (FRAMEP (b))
 	{
-	    return rep_CDAR (env);
+	    /* later parameters of the same name shadow earlier ones */
+	    repv names = rep_VECTI (b, 0);
+	    int i;
+	    for (i = rep_VECT_LEN (names) - 1; i > 0; i--)
+	    {
+		if (rep_VECTI (names, i) == sym)
+		    return &rep_VECTI (b, i);
+	    }
 	}
     }
-    return Qnil;
+    return 0;
 }
 
-/* this is also in lispmach.c and fluids.c */
-static inline repv
-inlined_search_special_bindings (repv sym)
+/* Value cells
+
+   rep_special_bindings is shared between continuations and threads,
+   so it stays the definitive record of the dynamic bindings. But
+   rather than searching it on each reference, every symbol with a
+   binding in the list has its innermost one recorded in this table
+   (and its rep_SF_BOUND bit set). Each binding remembers the one it
+   shadows, so popping it can restore the cell; switching to another
+   list only updates the cells of bindings the two lists don't share.
+
+   All bindings in the table are reachable from rep_special_bindings,
+   so the GC needn't know about it. Fluids have nowhere to keep the
+   bit, so their bindings are still found by searching the list. */
+
+typedef struct {
+    repv symbol;			/* null if the slot is free */
+    repv binding;
+} value_cell;
+
+static value_cell *value_cells;
+static unsigned long value_cells_size, value_cells_used;
+
+#define VALUE_CELLS_INITIAL_SIZE 64
+
+#define VALUE_CELL_HASH(s) (((unsigned long) (s) >> 3) * 2654435761UL)
+
+static inline value_cell *
+find_value_cell (repv sym)
 {
-    register repv env;
-    for (env = rep_special_bindings; env != Qnil; env = rep_CDR (env))
+    unsigned long mask = value_cells_size - 1;
+    unsigned long i = VALUE_CELL_HASH (sym) & mask;
+    while (value_cells[i].symbol != 0 && value_cells[i].symbol != sym)
+	i = (i + 1) & mask;
+    return value_cells + i;
+}
+
+static void
+grow_value_cells (void)
+{
+    value_cell *old = value_cells;
+    unsigned long old_size = value_cells_size, i;
+
+    value_cells_size = old_size * 2;
+    value_cells = rep_alloc (value_cells_size * sizeof (value_cell));
+    if (value_cells == 0)
+	abort ();
+    memset (value_cells, 0, value_cells_size * sizeof (value_cell));
+    for (i = 0; i < old_size; i++)
     {
-	if (rep_CAAR(env) == sym)
-	    return rep_CAR (env);
+	if (old[i].symbol != 0)
+	    *find_value_cell (old[i].symbol) = old[i];
+    }
+    rep_free (old);
+}
+
+/* Remove the table entry at C, moving any later entries of its probe
+   sequence back so that they can still be found. */
+static void
+remove_value_cell (value_cell *c)
+{
+    unsigned long mask = value_cells_size - 1;
+    unsigned long i = c - value_cells, j = i, k;
+    for (;;)
+    {
+	j = (j + 1) & mask;
+	if (value_cells[j].symbol == 0)
+	    break;
+	k = VALUE_CELL_HASH (value_cells[j].symbol) & mask;
+	if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+	    continue;
+	value_cells[i] = value_cells[j];
+	i = j;
+    }
+    value_cells[i].symbol = 0;
+    value_cells[i].binding = 0;
+    value_cells_used--;
+}
+
+/* Make BINDING (or no binding, if nil) the value cell of SYM. */
+static void
+set_value_cell (repv sym, repv binding)
+{
+    if (binding != Qnil)
+    {
+	value_cell *c;
+	if (rep_SYM(sym)->car & rep_SF_BOUND)
+	    c = find_value_cell (sym);
+	else
+	{
+	    if (2 * (value_cells_used + 1) > value_cells_size)
+		grow_value_cells ();
+	    c = find_value_cell (sym);
+	    c->symbol = sym;
+	    value_cells_used++;
+	    rep_SYM(sym)->car |= rep_SF_BOUND;
+	}
+	c->binding = binding;
+    }
+    else if (rep_SYM(sym)->car & rep_SF_BOUND)
+    {
+	remove_value_cell (find_value_cell (sym));
+	rep_SYM(sym)->car &= ~rep_SF_BOUND;
     }
-    return Qnil;
+}
+
+/* Return the innermost dynamic binding of SYM, or nil. */
+static inline repv
+inlined_search_special_bindings (repv sym)
+{
+    if (rep_SYM(sym)->car & rep_SF_BOUND)
+	return find_value_cell (sym)->binding;
+    else
+	return Qnil;
 }
 
 static repv
@@ -558,6 +849,113 @@ search_special_bindings (repv sym)
     return inlined_search_special_bindings (sym);
 }
 
+/* As above, but VAR may also be a fluid. */
+repv
+rep_search_special_bindings (repv var)
+{
+    if (rep_SYMBOLP (var))
+	return inlined_search_special_bindings (var);
+    else
+    {
+	register repv env;
+	for (env = rep_special_bindings; env != Qnil; env = rep_CDR (env))
+	{
+	    if (rep_BINDING_VAR (rep_CAR (env)) == var)
+		return rep_CAR (env);
+	}
+	return Qnil;
+    }
+}
+
+/* Add a new innermost binding of VAR (a symbol or fluid) to VALUE. */
+void
+rep_push_special_binding (repv var, repv value)
+{
+    repv binding;
+    if (rep_SYMBOLP (var))
+    {
+	binding = Fcons (var, Fcons (value,
+				     inlined_search_special_bindings (var)));
+	set_value_cell (var, binding);
+    }
+    else
+	binding = Fcons (var, Fcons (value, Qnil));
+    rep_special_bindings = Fcons (binding, rep_special_bindings);
+}
+
+/* Remove the COUNT innermost dynamic bindings. */
+void
+rep_pop_special_bindings (int count)
+{
+    register repv env = rep_special_bindings;
+    while (count-- > 0)
+    {
+	repv binding = rep_CAR (env);
+	if (rep_SYMBOLP (rep_BINDING_VAR (binding)))
+	    set_value_cell (rep_BINDING_VAR (binding),
+			    rep_BINDING_PREVIOUS (binding));
+	env = rep_CDR (env);
+    }
+    rep_special_bindings = env;
+}
+
+/* Make BINDINGS the list of dynamic bindings, e.g. when switching
+   threads or continuations. Only the bindings above the tail shared
+   by the old and new lists have their value cells changed. */
+void
+rep_set_special_bindings (repv bindings)
+{
+    repv old = rep_special_bindings, common, env;
+    int old_len = 0, new_len = 0, i;
+    repv *added;
+
+    if (bindings == old)
+	return;
+
+    for (env = old; env != Qnil; env = rep_CDR (env))
+	old_len++;
+    for (env = bindings; env != Qnil; env = rep_CDR (env))
+	new_len++;
+
+    common = old;
+    env = bindings;
+    for (i = old_len; i > new_len; i--)
+	common = rep_CDR (common);
+    for (i = new_len; i > old_len; i--)
+	env = rep_CDR (env);
+    while (common != env)
+    {
+	common = rep_CDR (common);
+	env = rep_CDR (env);
+    }
+
+    /* Unwinding from the innermost binding leaves each cell holding
+       what the outermost unwound binding of its symbol shadowed */
+    for (env = old; env != common; env = rep_CDR (env))
+    {
+	repv binding = rep_CAR (env);
+	if (rep_SYMBOLP (rep_BINDING_VAR (binding)))
+	    set_value_cell (rep_BINDING_VAR (binding),
+			    rep_BINDING_PREVIOUS (binding));
+    }
+
+    /* ..but rewinding has to work outwards-in */
+    new_len = 0;
+    for (env = bindings; env != common; env = rep_CDR (env))
+	new_len++;
+    added = alloca (new_len * sizeof (repv));
+    i = 0;
+    for (env = bindings; env != common; env = rep_CDR (env))
+	added[i++] = rep_CAR (env);
+    while (i-- > 0)
+    {
+	if (rep_SYMBOLP (rep_BINDING_VAR (added[i])))
+	    set_value_cell (rep_BINDING_VAR (added[i]), added[i]);
+    }
+
+    rep_special_bindings = bindings;
+}
+
 static inline int
 inlined_search_special_environment (repv sym)
 {
@@ -612,8 +1010,7 @@ rep_bind_special (repv oldList, repv symbol, repv newVal)
 {
     if (inlined_search_special_environment (symbol))
     {
-	rep_special_bindings = Fcons (Fcons (symbol, newVal),
-				      rep_special_bindings);
+	rep_push_special_binding (symbol, newVal);
 	oldList = rep_MARK_SPEC_BINDING (oldList);
     }
     else
@@ -643,7 +1040,50 @@ rep_bind_symbol(repv oldList, repv symbol, repv newVal)
     return oldList;
 }
 
-/* Undoes what the above function does. Returns the number of special
+/* Return the vector of names used by frames binding the N symbols
+   SYMS (see search_environment). */
+repv
+rep_make_frame_names (repv *syms, int n)
+{
+    repv names = rep_make_vector (n + 1);
+    int i;
+    rep_VECTI (names, 0) = LEXTAG;
+    for (i = 0; i < n; i++)
+	rep_VECTI (names, i + 1) = syms[i];
+    return names;
+}
+
+/* Bind each symbol in the frame names NAMES to the corresponding
+   member of VALUES, the lexical ones in a single new frame, saving
+   the old bindings in OLDLIST as rep_bind_symbol does. Returns the
+   new version of OLDLIST. */
+repv
+rep_bind_frame (repv oldList, repv names, repv *values)
+{
+    int i, n = rep_VECT_LEN (names) - 1;
+    repv frame;
+
+    if (oldList == Qnil)
+	oldList = rep_NEW_FRAME;
+    if (n == 0)
+	return oldList;
+
+    /* Special variables get a slot too, but it's never looked at,
+       since they're never searched for lexically */
+    frame = rep_make_vector (n + 1);
+    rep_VECTI (frame, 0) = names;
+    for (i = 0; i < n; i++)
+    {
+	repv sym = rep_VECTI (names, i + 1);
+	rep_VECTI (frame, i + 1) = values[i];
+	if (rep_SYM(sym)->car & rep_SF_SPECIAL)
+	    oldList = rep_bind_special (oldList, sym, values[i]);
+    }
+    rep_env = Fcons (frame, rep_env);
+    return rep_MARK_LEX_BINDING (oldList);
+}
+
+/* Undoes what the above functions do. Returns the number of special
    bindings undone. */
 int
 rep_unbind_symbols(repv oldList)
@@ -664,12 +1104,7 @@ rep_unbind_symbols(repv oldList)
 	    tem = rep_CDR (tem);
 	rep_env = tem;
 
-	tem = rep_special_bindings;
-	for (i = specials; i > 0; i--)
-	{
-	    tem = rep_CDR (tem);
-	}
-	rep_special_bindings = tem;
+	rep_pop_special_bindings (specials);
 
 	assert (rep_special_bindings != rep_void_value);
 	assert (rep_env != rep_void_value);
@@ -861,7 +1296,7 @@ values look for one of those first.
 	    {
 		repv tem = inlined_search_special_bindings (sym);
 		if (tem != Qnil)
-		    val = rep_CDR (tem);
+		    val = rep_BINDING_VALUE (tem);
 		else
 		    val = F_structure_ref (rep_specials_structure, sym);
 	    }
@@ -870,9 +1305,9 @@ values look for one of those first.
     else
     {
 	/* lexical variable */
-	repv tem = search_environment (sym);
-	if (tem != Qnil)
-	    val = rep_CDR(tem);
+	repv *tem = search_environment (sym);
+	if (tem != 0)
+	    val = *tem;
 	else
 	    val = F_structure_ref (rep_structure, sym);
     }
@@ -905,7 +1340,7 @@ SYMBOL in buffers or windows which do not have their own local value.
 	{
 	    repv tem = search_special_bindings (sym);
 	    if (tem != Qnil)
-		val = rep_CDR (tem);
+		val = rep_BINDING_VALUE (tem);
 	    else
 		val = F_structure_ref (rep_specials_structure, sym);
 	}
@@ -947,7 +1382,7 @@ do_set (repv sym, repv val, repv (*setter)(repv st, repv var, repv val))
 	    }
 	    tem = inlined_search_special_bindings (sym);
 	    if (tem != Qnil)
-		rep_CDR (tem) = val;
+		rep_BINDING_VALUE (tem) = val;
 	    else
 		val = Fstructure_define (rep_specials_structure, sym, val);
 	}
@@ -957,9 +1392,9 @@ do_set (repv sym, repv val, repv (*setter)(repv st, repv var, repv val))
     else
     {
 	/* lexical binding */
-	repv tem = search_environment (sym);
-	if (tem != Qnil)
-	    rep_CDR(tem) = val;
+	repv *tem = search_environment (sym);
+	if (tem != 0)
+	    *tem = val;
 	else
 	    val = setter (rep_structure, sym, val);
     }
@@ -1003,7 +1438,7 @@ Sets the default value of SYMBOL to VALUE, then returns VALUE.
 
 	    tem = search_special_bindings (sym);
 	    if (tem != Qnil)
-		rep_CDR (tem) = val;
+		rep_BINDING_VALUE (tem) = val;
 	    else
 		val = Fstructure_define (rep_specials_structure, sym, val);
 	}
@@ -1055,7 +1490,7 @@ Returns t if SYMBOL has a default value.
     {
 	repv tem = search_special_bindings (sym);
 	if (tem != Qnil)
-	    return rep_VOIDP (rep_CDR (tem)) ? Qnil : Qt;
+	    return rep_VOIDP (rep_BINDING_VALUE (tem)) ? Qnil : Qt;
 	else
 	{
 	    tem = F_structure_ref (rep_specials_structure, sym);
@@ -1276,37 +1711,36 @@ is non-nil it is considered a match.
 {
     rep_regexp *prog;
     rep_DECLARE1(re, rep_STRINGP);
-    if(!rep_VECTORP(ob))
+    if(!OBARRAYP(ob))
 	ob = rep_obarray;
     prog = rep_regcomp(rep_STR(re));
     if(prog)
     {
 	repv last = Qnil;
-	int i, len = rep_VECT_LEN(ob);
-	rep_GC_root gc_last, gc_ob, gc_pred;
+	/* PRED may intern symbols, replacing the table, so this walks
+	   the table as it is now */
+	repv table = OB_TABLE(ob);
+	int i, len = rep_VECT_LEN(table);
+	rep_GC_root gc_last, gc_table, gc_pred;
 	rep_PUSHGC(gc_last, last);
-	rep_PUSHGC(gc_ob, ob);
+	rep_PUSHGC(gc_table, table);
 	rep_PUSHGC(gc_pred, pred);
 	for(i = 0; i < len; i++)
 	{
-	    repv chain = rep_VECT(ob)->array[i];
-	    while(rep_SYMBOLP(chain))
+	    repv sym = rep_VECTI(table, i);
+	    if(rep_SYMBOLP(sym)
+	       && rep_regexec(prog, rep_STR(rep_SYM(sym)->name)))
 	    {
-		if(rep_regexec(prog, rep_STR(rep_SYM(chain)->name)))
+		if(pred && !rep_NILP(pred))
 		{
-		    if(pred && !rep_NILP(pred))
+		    repv tmp;
+		    if(!(tmp = rep_funcall(pred, rep_LIST_1(sym), rep_FALSE))
+		       || rep_NILP(tmp))
 		    {
-			repv tmp;
-			if(!(tmp = rep_funcall(pred, rep_LIST_1(chain), rep_FALSE))
-			   || rep_NILP(tmp))
-			{
-			    goto next;
-			}
+			continue;
 		    }
-		    last = Fcons(chain, last);
 		}
-next:
-		chain = rep_SYM(chain)->next;
+		last = Fcons(sym, last);
 	    }
 	}
 	rep_POPGC; rep_POPGC; rep_POPGC;
@@ -1383,7 +1817,7 @@ obarray [NEW-VALUE]
 {
     if(val != Qnil)
     {
-	rep_DECLARE1(val, rep_VECTORP);
+	rep_DECLARE1(val, OBARRAYP);
 	rep_obarray = val;
     }
     return rep_obarray;
@@ -1461,6 +1895,9 @@ rep_symbols_init(void)
 
     rep_USE_DEFAULT_ENV;
     rep_special_bindings = Qnil;
+    value_cells_size = VALUE_CELLS_INITIAL_SIZE;
+    value_cells = rep_alloc (value_cells_size * sizeof (value_cell));
+    memset (value_cells, 0, value_cells_size * sizeof (value_cell));
     rep_mark_static (&rep_env);
     rep_mark_static (&rep_special_bindings);
 
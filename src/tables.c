@@ -33,22 +33,73 @@
 
 typedef unsigned rep_PTR_SIZED_INT hash_value;
 
-typedef struct node_struct node;
-struct node_struct {
-    node *next;
+/* Tables use open addressing. The slots are split into groups of
+   GROUP_WIDTH; each slot has a control byte, either CTRL_EMPTY,
+   CTRL_DELETED, or (when in use) the low seven bits of its hash. A
+   lookup scans a whole group of control bytes at once for its tag
+   (with SSE2 where available), only comparing keys whose tags match,
+   and stops at the first group that contains an empty slot. Groups
+   are probed quadratically. */
+
+#define GROUP_WIDTH 16
+#define MIN_SLOTS GROUP_WIDTH
+#define MAX_SLOTS (1 << 30)
+
+/* The most entries a table can hold, at its maximum load of 7/8 */
+#define MAX_ENTRIES ((MAX_SLOTS / 8) * 7)
+
+#define CTRL_EMPTY ((unsigned char) 0x80)
+#define CTRL_DELETED ((unsigned char) 0xfe)
+#define CTRL_FULLP(c) (((c) & 0x80) == 0)
+
+/* Number of old slots moved to the new array by each modification,
+   while a table is being grown */
+#define MIGRATE_SLOTS 64
+
+#define HASH_TAG(h) ((unsigned char) ((h) & 0x7f))
+#define HASH_GROUP(h) ((h) >> 7)
+
+typedef struct slot_struct slot;
+struct slot_struct {
     repv key, value;
     hash_value hash;
 };
 
+/* How keys are compared. The builtin predicates are called directly,
+   anything else through Lisp. */
+enum table_kind {
+    KIND_LISP = 0, KIND_EQ, KIND_EQL, KIND_EQUAL
+};
+
 typedef struct table_struct table;
 struct table_struct {
     repv car;
     table *next;
-    int total_buckets, total_nodes;
-    node **buckets;
+    int total_slots, total_nodes, total_deleted;
+    unsigned char *ctrl;		/* total_slots control bytes */
+    slot *slots;			/* follows ctrl in the same block */
+
+    /* While growing, the previous slot array. Its entries are moved
+       across a few at a time, starting from slot migrate_pos; old_nodes
+       of them (included in total_nodes) remain. */
+    int old_total, old_nodes, migrate_pos;
+    unsigned char *old_ctrl;
+    slot *old_slots;
+
+    /* incremented whenever entries move between slots */
+    unsigned int layout;
+
     repv hash_fun;
     repv compare_fun;
-    repv guardian;			/* non-null if a weak table */
+    enum table_kind kind;
+
+    /* Weak tables are ephemerons: each value is only kept while its
+       key is reachable from elsewhere. When a weak table is marked it
+       goes on the weak_marked list, with the number of its entries
+       whose keys weren't yet marked. */
+    rep_bool weak;
+    int unresolved;
+    table *next_weak;
 };
 
 #define TABLEP(v) rep_CELL16_TYPEP(v, table_type)
@@ -57,46 +108,172 @@ struct table_struct {
 static int table_type;
 static table *all_tables;
 
+/* weak tables marked during the current GC */
+static table *weak_tables_marked;
+
+/* Memo caches, see below */
+typedef struct memo_entry_struct memo_entry;
+typedef struct memo_struct memo;
+
+static int memo_type;
+static memo *all_memos;
+static memo *weak_memos_marked;
+
 /* ensure X is +ve and in an int */
 #define TRUNC(x) (((x) << (rep_VALUE_INT_SHIFT+1)) >> (rep_VALUE_INT_SHIFT+1))
 
+extern rep_xsubr Seq, Seql, Sequal;
+
+
+/* control-byte groups */
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+typedef unsigned int group_mask;
+
+/* Return a mask with bit I set for each byte I in group G equal to TAG. */
+static inline group_mask
+group_match (const unsigned char *g, unsigned char tag)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128 ((const __m128i *) g);
+    return _mm_movemask_epi8 (_mm_cmpeq_epi8 (ctrl, _mm_set1_epi8 (tag)));
+#else
+    group_mask mask = 0;
+    int i;
+    for (i = 0; i < GROUP_WIDTH; i++)
+    {
+	if (g[i] == tag)
+	    mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+/* Return a mask of the empty or deleted slots in group G. */
+static inline group_mask
+group_match_free (const unsigned char *g)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) g));
+#else
+    group_mask mask = 0;
+    int i;
+    for (i = 0; i < GROUP_WIDTH; i++)
+    {
+	if (!CTRL_FULLP (g[i]))
+	    mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+static inline int
+lowest_bit (group_mask mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz (mask);
+#else
+    int i = 0;
+    while ((mask & 1) == 0)
+	mask >>= 1, i++;
+    return i;
+#endif
+}
+
+/* Spread the bits of a fixnum hash code over the whole word, so that
+   both the tag and the group index are usable even for eq-hash, whose
+   low bits are mostly constant. */
+static inline hash_value
+mix_hash (hash_value h)
+{
+    h *= (hash_value) 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> (rep_PTR_SIZED_INT_BITS / 2));
+}
+
 
 /* type hooks */
 
-static void
-table_mark (repv val)
+/* Mark the value of each entry of weak table T whose key has been
+   marked, counting the others in T->unresolved. Returns true if any
+   value wasn't already marked. */
+static rep_bool
+trace_weak_slots (table *t, unsigned char *ctrl, slot *slots,
+		  int start, int end)
 {
+    rep_bool changed = rep_FALSE;
     int i;
-    for (i = 0; i < TABLE(val)->total_buckets; i++)
+    for (i = start; i < end; i++)
     {
-	node *n;
-	for (n = TABLE(val)->buckets[i]; n != 0; n = n->next)
+	if (CTRL_FULLP (ctrl[i]))
 	{
-	    if (!TABLE(val)->guardian)
-		rep_MARKVAL(n->key);
-	    rep_MARKVAL(n->value);
+	    if (!rep_gc_live_p (slots[i].key))
+		t->unresolved++;
+	    else if (!rep_gc_live_p (slots[i].value))
+	    {
+		rep_MARKVAL (slots[i].value);
+		changed = rep_TRUE;
+	    }
 	}
     }
-    rep_MARKVAL(TABLE(val)->hash_fun);
-    rep_MARKVAL(TABLE(val)->compare_fun);
-    rep_MARKVAL(TABLE(val)->guardian);
+    return changed;
+}
+
+static rep_bool
+trace_weak_table (table *t)
+{
+    rep_bool changed;
+    t->unresolved = 0;
+    changed = trace_weak_slots (t, t->ctrl, t->slots, 0, t->total_slots);
+    if (t->old_total > 0)
+    {
+	changed |= trace_weak_slots (t, t->old_ctrl, t->old_slots,
+				     t->migrate_pos, t->old_total);
+    }
+    return changed;
 }
 
 static void
-free_table (table *x)
+table_mark (repv val)
 {
+    table *t = TABLE(val);
     int i;
-    for (i = 0; i < x->total_buckets; i++)
+    rep_MARKVAL(t->hash_fun);
+    rep_MARKVAL(t->compare_fun);
+    if (t->weak)
+    {
+	trace_weak_table (t);
+	t->next_weak = weak_tables_marked;
+	weak_tables_marked = t;
+	return;
+    }
+    for (i = 0; i < t->total_slots; i++)
     {
-	node *n, *next;
-	for (n = x->buckets[i]; n != 0; n = next)
+	if (CTRL_FULLP (t->ctrl[i]))
 	{
-	    next = n->next;
-	    rep_free (n);
+	    rep_MARKVAL(t->slots[i].key);
+	    rep_MARKVAL(t->slots[i].value);
 	}
     }
-    if (x->total_buckets > 0)
-	rep_free (x->buckets);
+    for (i = t->migrate_pos; i < t->old_total; i++)
+    {
+	if (CTRL_FULLP (t->old_ctrl[i]))
+	{
+	    rep_MARKVAL(t->old_slots[i].key);
+	    rep_MARKVAL(t->old_slots[i].value);
+	}
+    }
+}
+
+static void
+free_table (table *x)
+{
+    if (x->total_slots > 0)
+	rep_free (x->ctrl);
+    if (x->old_total > 0)
+	rep_free (x->old_ctrl);
     rep_FREE_CELL (x);
 }
 
@@ -230,20 +407,27 @@ implies (= (equal-hash X) (equal-hash Y)).
 
 /* table functions */
 
+static rep_bool start_resize (table *t, int new_size);
+static int size_for_count (int count);
+
 DEFUN("make-table", Fmake_table, Smake_table,
-      (repv hash_fun, repv cmp_fun, repv is_weak), rep_Subr3) /*
+      (repv hash_fun, repv cmp_fun, repv size, repv is_weak), rep_Subr4) /*
 ::doc:rep.data.tables#make-table::
-make-table HASH-FUNCTION COMPARE-FUNCTION
+make-table HASH-FUNCTION COMPARE-FUNCTION [SIZE]
 
 Create and return a new hash table. When storing and referencing keys
 it will use the function HASH-FUNCTION to map keys to hash codes
 (positive fixnums), and the predicate function COMPARE-FUNCTION to
 compare two keys (should return true if the keys are considered equal).
+
+If SIZE is given, the table is created with room for that many entries.
 ::end:: */
 {
     table *tab;
     rep_DECLARE(1, hash_fun, Ffunctionp (hash_fun) != Qnil);
     rep_DECLARE(2, cmp_fun, Ffunctionp (cmp_fun) != Qnil);
+    rep_DECLARE(3, size, size == Qnil || (rep_INTP (size) && rep_INT (size) >= 0
+					  && rep_INT (size) <= MAX_ENTRIES));
 
     tab = rep_ALLOC_CELL (sizeof (table));
     rep_data_after_gc += sizeof (table);
@@ -252,17 +436,39 @@ compare two keys (should return true if the keys are considered equal).
     all_tables = tab;
     tab->hash_fun = hash_fun;
     tab->compare_fun = cmp_fun;
-    tab->total_buckets = 0;
+    tab->total_slots = 0;
     tab->total_nodes = 0;
-    tab->guardian = (is_weak == Qnil) ? rep_NULL : Fmake_primitive_guardian ();
+    tab->total_deleted = 0;
+    tab->ctrl = 0;
+    tab->slots = 0;
+    tab->old_total = tab->old_nodes = tab->migrate_pos = 0;
+    tab->old_ctrl = 0;
+    tab->old_slots = 0;
+    tab->layout = 0;
+    tab->weak = (is_weak != Qnil);
+    tab->unresolved = 0;
+    tab->next_weak = 0;
+
+    if (cmp_fun == rep_VAL(&Seq))
+	tab->kind = KIND_EQ;
+    else if (cmp_fun == rep_VAL(&Seql))
+	tab->kind = KIND_EQL;
+    else if (cmp_fun == rep_VAL(&Sequal))
+	tab->kind = KIND_EQUAL;
+    else
+	tab->kind = KIND_LISP;
+
+    if (size != Qnil && rep_INT (size) > 0
+	&& !start_resize (tab, size_for_count (rep_INT (size))))
+	return rep_NULL;
 
     return rep_VAL(tab);
 }
 
 DEFUN("make-weak-table", Fmake_weak_table, Smake_weak_table,
-      (repv hash_fun, repv cmp_fun), rep_Subr2) /*
+      (repv hash_fun, repv cmp_fun, repv size), rep_Subr3) /*
 ::doc:rep.data.tables#make-weak-table::
-make-weak-table HASH-FUNCTION COMPARE-FUNCTION
+make-weak-table HASH-FUNCTION COMPARE-FUNCTION [SIZE]
 
 Similar to `make-table, except that key-value pairs stored in the table
 are said to be ``weakly keyed''. That is, they are only retained in the
@@ -273,7 +479,7 @@ the key is stored in the table is not considered good enough to prevent
 it being garbage collected.
 ::end:: */
 {
-    return Fmake_table (hash_fun, cmp_fun, Qt);
+    return Fmake_table (hash_fun, cmp_fun, size, Qt);
 }
 
 DEFUN("tablep", Ftablep, Stablep, (repv arg), rep_Subr1) /*
@@ -290,12 +496,12 @@ static hash_value
 hash_key (repv tab, repv key)
 {
     repv hash;
-    if (TABLE(tab)->hash_fun == rep_VAL(&Sstring_hash))
+    if (TABLE(tab)->hash_fun == rep_VAL(&Seq_hash))
+	hash = Feq_hash (key);
+    else if (TABLE(tab)->hash_fun == rep_VAL(&Sstring_hash))
 	hash = Fstring_hash (key);
     else if (TABLE(tab)->hash_fun == rep_VAL(&Ssymbol_hash))
 	hash = Fsymbol_hash (key);
-    else if (TABLE(tab)->hash_fun == rep_VAL(&Seq_hash))
-	hash = Feq_hash (key);
     else if (TABLE(tab)->hash_fun == rep_VAL(&Sequal_hash))
 	hash = Fequal_hash (key, Qnil);
     else
@@ -305,13 +511,7 @@ hash_key (repv tab, repv key)
 	hash = rep_call_lisp1 (TABLE(tab)->hash_fun, key);
 	rep_POPGC;
     }
-    return rep_INT(hash);
-}
-
-static inline int
-hash_key_to_bin (repv tab, hash_value hash)
-{
-    return hash % TABLE(tab)->total_buckets;
+    return mix_hash (rep_INTP (hash) ? rep_INT(hash) : 0);
 }
 
 static inline rep_bool
@@ -319,30 +519,323 @@ compare (repv tab, repv val1, repv val2)
 {
     repv ret;
     rep_GC_root gc_tab;
-    rep_PUSHGC (gc_tab, tab);
-    ret = rep_call_lisp2 (TABLE(tab)->compare_fun, val1, val2);
-    rep_POPGC;
-    return ret != Qnil;
+    switch (TABLE(tab)->kind)
+    {
+    case KIND_EQ:
+	return val1 == val2;
+
+    case KIND_EQL:
+	return val1 == val2 || Feql (val1, val2) != Qnil;
+
+    case KIND_EQUAL:
+	return val1 == val2 || rep_value_cmp (val1, val2) == 0;
+
+    default:
+	rep_PUSHGC (gc_tab, tab);
+	ret = rep_call_lisp2 (TABLE(tab)->compare_fun, val1, val2);
+	rep_POPGC;
+	return ret != Qnil;
+    }
 }
 
-static node *
-lookup (repv tab, repv key)
+/* Search the LEN slots at CTRL and SLOTS for KEY, whose hash is HV.
+   Returns the index of its slot, -1 if it isn't there, or -2 if a Lisp
+   compare function moved the table's entries meanwhile. */
+static int
+probe (repv tab, unsigned char *ctrl, slot *slots, int len,
+       repv key, hash_value hv)
 {
-    hash_value hv;
-    node *ptr;
-    int index;
-    if (TABLE(tab)->total_buckets == 0)
-	return 0;
-    hv = hash_key (tab, key);
-    index = hash_key_to_bin (tab, hv);
-    for (ptr = TABLE(tab)->buckets[index]; ptr != 0; ptr = ptr->next)
+    table *t = TABLE(tab);
+    unsigned int layout = t->layout;
+    unsigned char tag = HASH_TAG (hv);
+    unsigned int groups_mask = len / GROUP_WIDTH - 1;
+    unsigned int group = HASH_GROUP (hv) & groups_mask;
+    unsigned int step;
+
+    for (step = 0; step <= groups_mask; step++)
     {
-	if (ptr->hash == hv && compare (tab, key, ptr->key))
-	    return ptr;
+	unsigned char *g = ctrl + group * GROUP_WIDTH;
+	group_mask mask = group_match (g, tag);
+	while (mask != 0)
+	{
+	    int i = group * GROUP_WIDTH + lowest_bit (mask);
+	    if (slots[i].hash == hv)
+	    {
+		if (t->kind == KIND_EQ)
+		{
+		    if (slots[i].key == key)
+			return i;
+		}
+		else
+		{
+		    rep_bool same = compare (tab, key, slots[i].key);
+		    if (t->layout != layout)
+			return -2;
+		    if (same)
+			return i;
+		}
+	    }
+	    mask &= mask - 1;
+	}
+	if (group_match (g, CTRL_EMPTY) != 0)
+	    break;
+	group = (group + step + 1) & groups_mask;
+    }
+    return -1;
+}
+
+/* Return the slot in TAB holding KEY (with hash HV), or null. Stores a
+   pointer to the slot's control byte in *CTRLP. */
+static slot *
+lookup (repv tab, repv key, hash_value hv, unsigned char **ctrlp)
+{
+    table *t = TABLE(tab);
+    int i;
+
+again:
+    if (t->total_slots > 0)
+    {
+	i = probe (tab, t->ctrl, t->slots, t->total_slots, key, hv);
+	if (i == -2)
+	    goto again;
+	else if (i >= 0)
+	{
+	    *ctrlp = t->ctrl + i;
+	    return t->slots + i;
+	}
+    }
+    if (t->old_total > 0)
+    {
+	i = probe (tab, t->old_ctrl, t->old_slots, t->old_total, key, hv);
+	if (i == -2)
+	    goto again;
+	else if (i >= 0)
+	{
+	    *ctrlp = t->old_ctrl + i;
+	    return t->old_slots + i;
+	}
     }
     return 0;
 }
 
+/* Return the index of a free slot in the current array of T for a new
+   key with hash HV, marking it used. There must be a free slot. */
+static int
+claim_slot (table *t, hash_value hv)
+{
+    unsigned int groups_mask = t->total_slots / GROUP_WIDTH - 1;
+    unsigned int group = HASH_GROUP (hv) & groups_mask;
+    unsigned int step = 0;
+    while (1)
+    {
+	group_mask mask = group_match_free (t->ctrl + group * GROUP_WIDTH);
+	if (mask != 0)
+	{
+	    int i = group * GROUP_WIDTH + lowest_bit (mask);
+	    if (t->ctrl[i] == CTRL_DELETED)
+		t->total_deleted--;
+	    t->ctrl[i] = HASH_TAG (hv);
+	    return i;
+	}
+	group = (group + ++step) & groups_mask;
+    }
+}
+
+/* Move up to COUNT of T's old slots into its current array. */
+static void
+migrate_slots (table *t, int count)
+{
+    int end = MIN (t->migrate_pos + count, t->old_total), i;
+    for (i = t->migrate_pos; i < end; i++)
+    {
+	if (CTRL_FULLP (t->old_ctrl[i]))
+	{
+	    int j = claim_slot (t, t->old_slots[i].hash);
+	    t->slots[j] = t->old_slots[i];
+	    /* not empty, since later entries may have probed past it */
+	    t->old_ctrl[i] = CTRL_DELETED;
+	    t->old_nodes--;
+	}
+    }
+    t->migrate_pos = end;
+    if (end == t->old_total)
+    {
+	rep_free (t->old_ctrl);
+	t->old_ctrl = 0;
+	t->old_slots = 0;
+	t->old_total = t->old_nodes = t->migrate_pos = 0;
+    }
+    t->layout++;
+}
+
+/* Give T a new, empty, slot array of NEW_SIZE slots (a power of two, at
+   least MIN_SLOTS). The existing entries are moved into it gradually
+   by later modifications, so that no single call pays for rehashing
+   the whole table. If the array can't be allocated, signals an error
+   and returns false, leaving T as it was. */
+static rep_bool
+start_resize (table *t, int new_size)
+{
+    size_t bytes = new_size * (sizeof (unsigned char) + sizeof (slot));
+    unsigned char *ctrl = rep_alloc (bytes);
+
+    if (ctrl == 0)
+    {
+	/* the size may have come from Lisp, so don't abort */
+	Fsignal (Qno_memory, Qnil);
+	return rep_FALSE;
+    }
+
+    if (t->old_total > 0)
+	migrate_slots (t, t->old_total);
+
+    if (t->total_nodes > 0)
+    {
+	t->old_ctrl = t->ctrl;
+	t->old_slots = t->slots;
+	t->old_total = t->total_slots;
+	t->old_nodes = t->total_nodes;
+	t->migrate_pos = 0;
+    }
+    else if (t->total_slots > 0)
+	rep_free (t->ctrl);
+
+    t->ctrl = ctrl;
+    rep_data_after_gc += bytes;
+    t->slots = (slot *) (t->ctrl + new_size);
+    memset (t->ctrl, CTRL_EMPTY, new_size);
+    t->total_slots = new_size;
+    t->total_deleted = 0;
+    t->layout++;
+
+    if (t->old_total > 0)
+	migrate_slots (t, MIGRATE_SLOTS);
+    return rep_TRUE;
+}
+
+/* Return the number of slots needed to hold COUNT entries. */
+static int
+size_for_count (int count)
+{
+    int size = MIN_SLOTS;
+    while (size < MAX_SLOTS && (size / 8) * 7 < count)
+	size *= 2;
+    return size;
+}
+
+/* Called before each modification of T: continue any migration, then
+   make room for one more key. Keeps the load of the current array
+   (including deleted slots) below 7/8, doubling it when at least half
+   its slots would be live. Returns false if an error was signalled. */
+static inline rep_bool
+prepare_modification (table *t, rep_bool inserting)
+{
+    if (t->old_total > 0)
+	migrate_slots (t, MIGRATE_SLOTS);
+    if (inserting)
+    {
+	int live = t->total_nodes - t->old_nodes;
+	if (t->total_nodes >= MAX_ENTRIES)
+	{
+	    Fsignal (Qno_memory, Qnil);
+	    return rep_FALSE;
+	}
+	if ((live + t->total_deleted + 1) * 8 > t->total_slots * 7)
+	{
+	    int new_size = t->total_slots;
+	    if (new_size == 0)
+		new_size = MIN_SLOTS;
+	    else if ((t->total_nodes + 1) * 2 > new_size)
+		new_size *= 2;
+	    return start_resize (t, new_size);
+	}
+    }
+    return rep_TRUE;
+}
+
+static void
+remove_entry (table *t, unsigned char *ctrl, slot *s)
+{
+    s->key = s->value = Qnil;
+    t->total_nodes--;
+    if (t->old_total > 0 && ctrl >= t->old_ctrl
+	&& ctrl < t->old_ctrl + t->old_total)
+    {
+	*ctrl = CTRL_DELETED;
+	t->old_nodes--;
+    }
+    else
+    {
+	/* A probe stops at the first group with an empty slot, so if
+	   this slot's group already has one, nothing can probe past it */
+	unsigned char *g = t->ctrl + ((ctrl - t->ctrl) & ~(GROUP_WIDTH - 1));
+	if (group_match (g, CTRL_EMPTY) != 0)
+	    *ctrl = CTRL_EMPTY;
+	else
+	{
+	    *ctrl = CTRL_DELETED;
+	    t->total_deleted++;
+	}
+    }
+}
+
+/* Set KEY (with hash HV) to VALUE in TAB. Returns false if an error
+   was signalled. */
+static rep_bool
+insert (repv tab, repv key, hash_value hv, repv value)
+{
+    unsigned char *ctrl;
+    slot *s = lookup (tab, key, hv, &ctrl);
+    if (s == 0)
+    {
+	table *t = TABLE(tab);
+	if (!prepare_modification (t, rep_TRUE))
+	    return rep_FALSE;
+	s = t->slots + claim_slot (t, hv);
+	s->key = key;
+	s->hash = hv;
+	t->total_nodes++;
+    }
+    s->value = value;
+    return rep_TRUE;
+}
+
+/* Step *CURSOR (initially zero) to the next entry of T, returning its
+   slot, or null when there are no more. Safe against the table being
+   modified between calls, though entries may then be missed. */
+static slot *
+next_entry (table *t, int *cursor)
+{
+    int i = *cursor;
+    for (; i < t->total_slots; i++)
+    {
+	if (CTRL_FULLP (t->ctrl[i]))
+	{
+	    *cursor = i + 1;
+	    return t->slots + i;
+	}
+    }
+    for (; i - t->total_slots < t->old_total; i++)
+    {
+	if (CTRL_FULLP (t->old_ctrl[i - t->total_slots]))
+	{
+	    *cursor = i + 1;
+	    return t->old_slots + (i - t->total_slots);
+	}
+    }
+    *cursor = i;
+    return 0;
+}
+
+/* Ensure T has room for EXTRA more entries. Returns false if an error
+   was signalled. */
+static rep_bool
+reserve_extra (table *t, int extra)
+{
+    int size = size_for_count (t->total_nodes + extra);
+    return size <= t->total_slots || start_resize (t, size);
+}
+
 DEFUN("table-ref", Ftable_ref, Stable_ref, (repv tab, repv key), rep_Subr2) /*
 ::doc:rep.data.tables#table-ref::
 table-ref TABLE KEY
@@ -351,10 +844,13 @@ Return the value stored in hash table TABLE indexed by object KEY.
 Returns false if no such value exists.
 ::end:: */
 {
-    node *n;
+    unsigned char *ctrl;
+    slot *s;
     rep_DECLARE1(tab, TABLEP);
-    n = lookup (tab, key);
-    return n ? n->value : Qnil;
+    if (TABLE(tab)->total_nodes == 0)
+	return Qnil;
+    s = lookup (tab, key, hash_key (tab, key), &ctrl);
+    return s ? s->value : Qnil;
 }
 
 DEFUN("table-bound-p", Ftable_bound_p,
@@ -366,10 +862,11 @@ Returns true if the hash table TABLE contains a value associated with
 KEY.
 ::end:: */
 {
-    node *n;
+    unsigned char *ctrl;
     rep_DECLARE1(tab, TABLEP);
-    n = lookup (tab, key);
-    return n ? Qt : Qnil;
+    if (TABLE(tab)->total_nodes == 0)
+	return Qnil;
+    return lookup (tab, key, hash_key (tab, key), &ctrl) ? Qt : Qnil;
 }
 
 DEFUN("table-set", Ftable_set, Stable_set,
@@ -380,64 +877,8 @@ table-set TABLE KEY VALUE
 Associate VALUE with KEY in hash table TABLE. Returns VALUE.
 ::end:: */
 {
-    node *n;
     rep_DECLARE1(tab, TABLEP);
-    n = lookup (tab, key);
-    if (n == 0)
-    {
-	int bin;
-	n = rep_alloc (sizeof (node));
-	rep_data_after_gc += sizeof (node);
-	n->key = key;
-	n->value = value;
-	n->hash = hash_key (tab, key);
-	TABLE(tab)->total_nodes++;
-	if (TABLE(tab)->total_nodes >= 2 * TABLE(tab)->total_buckets)
-	{
-	    int old_size, new_size, i;
-	    node **new_bins, **old_bins;
-
-	    old_bins = TABLE(tab)->buckets;
-	    old_size = TABLE(tab)->total_buckets;
-
-	    /* The (misguided?) idea is to set number of buckets as
-	        (2^N) - 1, then increase N each time we get twice as
-		many keys as buckets. Start at N=5 */
-
-	    if (old_size == 0)
-		new_size = 31;
-	    else
-		new_size = (old_size + 1) * 2 - 1;
-
-	    new_bins = rep_alloc (sizeof (node *) * new_size);
-	    rep_data_after_gc += sizeof (node *) * new_size;
-	    memset (new_bins, 0, sizeof (node *) * new_size);
-
-	    TABLE(tab)->buckets = new_bins;
-	    TABLE(tab)->total_buckets = new_size;
-	    for (i = 0; i < old_size; i++)
-	    {
-		node *ptr, *next;
-		for (ptr = old_bins[i]; ptr != 0; ptr = next)
-		{
-		    int index = hash_key_to_bin (tab, ptr->hash);
-		    next = ptr->next;
-		    ptr->next = new_bins[index];
-		    new_bins[index] = ptr;
-		}
-	    }
-
-	    if (old_size > 0)
-		rep_free (old_bins);
-	}
-	bin = hash_key_to_bin (tab, n->hash);
-	n->next = TABLE(tab)->buckets[bin];
-	TABLE(tab)->buckets[bin] = n;
-	if (TABLE(tab)->guardian)
-	    Fprimitive_guardian_push (TABLE(tab)->guardian, n->key);
-    }
-    n->value = value;
-    return value;
+    return insert (tab, key, hash_key (tab, key), value) ? value : rep_NULL;
 }
 
 DEFUN("table-unset", Ftable_unset, Stable_unset,
@@ -448,28 +889,38 @@ table-unset TABLE KEY
 Remove any value stored in TABLE associated with KEY.
 ::end:: */
 {
-    node *n;
+    unsigned char *ctrl;
+    slot *s;
     rep_DECLARE1(tab, TABLEP);
-    n = lookup (tab, key);
-    if (n != 0)
+    if (TABLE(tab)->total_nodes == 0)
+	return Qnil;
+    prepare_modification (TABLE(tab), rep_FALSE);
+    s = lookup (tab, key, hash_key (tab, key), &ctrl);
+    if (s != 0)
     {
-	int bin = hash_key_to_bin (tab, n->hash);
-	node **ptr;
-	for (ptr = &(TABLE(tab)->buckets[bin]);
-	     *ptr != 0; ptr = &((*ptr)->next))
-	{
-	    if (*ptr == n)
-	    {
-		*ptr = n->next;
-		rep_free (n);
-		TABLE(tab)->total_nodes--;
-		return Qt;
-	    }
-	}
+	remove_entry (TABLE(tab), ctrl, s);
+	return Qt;
     }
     return Qnil;
 }
 
+DEFUN("table-reserve", Ftable_reserve, Stable_reserve,
+      (repv tab, repv count), rep_Subr2) /*
+::doc:rep.data.tables#table-reserve::
+table-reserve TABLE COUNT
+
+Make room in TABLE for at least COUNT entries, so that it won't need to
+grow until more than that are stored. Returns TABLE.
+::end:: */
+{
+    rep_DECLARE1(tab, TABLEP);
+    rep_DECLARE(2, count, rep_INTP (count) && rep_INT (count) >= 0
+		&& rep_INT (count) <= MAX_ENTRIES);
+    if (!reserve_extra (TABLE(tab), rep_INT (count) - TABLE(tab)->total_nodes))
+	return rep_NULL;
+    return tab;
+}
+
 DEFUN("table-walk", Ftable_walk, Stable_walk,
       (repv fun, repv tab), rep_Subr2) /*
 ::doc:rep.data.tables#table-walk::
@@ -480,24 +931,261 @@ each pair, the function is called with arguments `(KEY VALUE)'.
 ::end:: */
 {
     rep_GC_root gc_tab, gc_fun;
-    int i;
+    int cursor = 0;
+    slot *s;
 
     rep_DECLARE1(tab, TABLEP);
     rep_PUSHGC (gc_tab, tab);
     rep_PUSHGC (gc_fun, fun);
 
-    for (i = 0; i < TABLE(tab)->total_buckets; i++)
+    /* FUN may modify the table, so re-read it each time round */
+    while ((s = next_entry (TABLE(tab), &cursor)) != 0)
+    {
+	if (!rep_call_lisp2 (fun, s->key, s->value))
+	    break;
+    }
+
+    rep_POPGC; rep_POPGC;
+    return rep_throw_value ? rep_NULL : Qnil;
+}
+
+DEFUN("table-fold", Ftable_fold, Stable_fold,
+      (repv fun, repv seed, repv tab), rep_Subr3) /*
+::doc:rep.data.tables#table-fold::
+table-fold FUNCTION SEED TABLE
+
+Call FUNCTION for every key-value pair stored in hash table TABLE, with
+arguments `(KEY VALUE RESULT)', where RESULT is SEED for the first pair
+and the value of the previous call for the others. Returns the value of
+the last call, or SEED if TABLE is empty.
+::end:: */
+{
+    rep_GC_n_roots gc_args;
+    repv args[3];
+    int cursor = 0;
+    slot *s;
+
+    rep_DECLARE3(tab, TABLEP);
+    args[0] = fun; args[1] = seed; args[2] = tab;
+    rep_PUSHGCN (gc_args, args, 3);
+
+    while ((s = next_entry (TABLE(tab), &cursor)) != 0)
+    {
+	seed = rep_call_lisp3 (fun, s->key, s->value, seed);
+	if (seed == rep_NULL)
+	    break;
+	args[1] = seed;
+    }
+
+    rep_POPGCN;
+    return seed;
+}
+
+/* Return a vector of WHAT from TAB: the keys or values (when WHAT is
+   0 or 1), or both interleaved (when 2). */
+static repv
+table_to_vector (repv tab, int what)
+{
+    table *t = TABLE(tab);
+    int cursor = 0, i = 0;
+    repv vec = rep_make_vector (what == 2 ? t->total_nodes * 2
+				: t->total_nodes);
+    slot *s;
+    if (vec == rep_NULL)
+	return rep_mem_error ();
+    /* nothing below can call Lisp, so the table can't change under us */
+    while ((s = next_entry (t, &cursor)) != 0)
     {
-	node *n;
-	for (n = TABLE(tab)->buckets[i]; n != 0; n = n->next)
+	if (what != 1)
+	    rep_VECTI (vec, i++) = s->key;
+	if (what != 0)
+	    rep_VECTI (vec, i++) = s->value;
+    }
+    return vec;
+}
+
+DEFUN("table-keys", Ftable_keys, Stable_keys, (repv tab), rep_Subr1) /*
+::doc:rep.data.tables#table-keys::
+table-keys TABLE
+
+Return a vector containing all keys stored in hash table TABLE, in no
+particular order.
+::end:: */
+{
+    rep_DECLARE1(tab, TABLEP);
+    return table_to_vector (tab, 0);
+}
+
+DEFUN("table-values", Ftable_values, Stable_values, (repv tab), rep_Subr1) /*
+::doc:rep.data.tables#table-values::
+table-values TABLE
+
+Return a vector containing all values stored in hash table TABLE, in
+the same order as the keys returned by `table-keys'.
+::end:: */
+{
+    rep_DECLARE1(tab, TABLEP);
+    return table_to_vector (tab, 1);
+}
+
+DEFUN("table->vector", Ftable_to_vector, Stable_to_vector,
+      (repv tab), rep_Subr1) /*
+::doc:rep.data.tables#table->vector::
+table->vector TABLE
+
+Return a vector `[KEY0 VALUE0 KEY1 VALUE1 ...]' of the pairs stored in
+hash table TABLE. The result can be passed to `table-load'.
+::end:: */
+{
+    rep_DECLARE1(tab, TABLEP);
+    return table_to_vector (tab, 2);
+}
+
+DEFUN("table->alist", Ftable_to_alist, Stable_to_alist,
+      (repv tab), rep_Subr1) /*
+::doc:rep.data.tables#table->alist::
+table->alist TABLE
+
+Return a list of `(KEY . VALUE)' pairs, one for each entry of hash
+table TABLE.
+::end:: */
+{
+    repv ret = Qnil;
+    int cursor = 0;
+    slot *s;
+    rep_DECLARE1(tab, TABLEP);
+    while ((s = next_entry (TABLE(tab), &cursor)) != 0)
+	ret = Fcons (Fcons (s->key, s->value), ret);
+    return ret;
+}
+
+DEFUN("table-load", Ftable_load, Stable_load,
+      (repv tab, repv data), rep_Subr2) /*
+::doc:rep.data.tables#table-load::
+table-load TABLE DATA
+
+Store all key-value pairs from DATA in hash table TABLE, replacing any
+existing values of the same keys. DATA is either an association list,
+or a vector `[KEY0 VALUE0 KEY1 VALUE1 ...]'. Returns TABLE.
+::end:: */
+{
+    rep_GC_n_roots gc_args;
+    repv args[2];
+    int count;
+
+    rep_DECLARE1(tab, TABLEP);
+    if (rep_VECTORP (data))
+	count = rep_VECT_LEN (data) / 2;
+    else if (rep_LISTP (data))
+	count = rep_list_length (data);
+    else
+	return rep_signal_arg_error (data, 2);
+
+    if (!reserve_extra (TABLE(tab), count))
+	return rep_NULL;
+
+    args[0] = tab; args[1] = data;
+    rep_PUSHGCN (gc_args, args, 2);
+    if (rep_VECTORP (data))
+    {
+	int i;
+	for (i = 0; i < count * 2 && !rep_throw_value; i += 2)
 	{
-	    if (!rep_call_lisp2 (fun, n->key, n->value))
+	    repv key = rep_VECTI (data, i);
+	    if (!insert (tab, key, hash_key (tab, key), rep_VECTI (data, i + 1)))
 		break;
 	}
     }
+    else
+    {
+	repv lst;
+	for (lst = data; rep_CONSP (lst) && !rep_throw_value;
+	     lst = rep_CDR (lst))
+	{
+	    repv cell = rep_CAR (lst);
+	    if (rep_CONSP (cell)
+		&& !insert (tab, rep_CAR (cell), hash_key (tab, rep_CAR (cell)),
+			    rep_CDR (cell)))
+		break;
+	}
+    }
+    rep_POPGCN;
+    return rep_throw_value ? rep_NULL : tab;
+}
 
-    rep_POPGC; rep_POPGC;
-    return rep_throw_value ? rep_NULL : Qnil;
+DEFUN("table-merge", Ftable_merge, Stable_merge,
+      (repv dest, repv src), rep_Subr2) /*
+::doc:rep.data.tables#table-merge::
+table-merge DEST SOURCE
+
+Store every key-value pair of hash table SOURCE in hash table DEST,
+replacing any existing values of the same keys. Returns DEST.
+::end:: */
+{
+    rep_GC_n_roots gc_args;
+    repv args[2];
+    rep_bool same_hash;
+    int cursor = 0;
+    slot *s;
+
+    rep_DECLARE1(dest, TABLEP);
+    rep_DECLARE2(src, TABLEP);
+    if (dest == src)
+	return dest;
+
+    /* keys can keep their hash codes if both tables compute them
+       the same way */
+    same_hash = TABLE(dest)->hash_fun == TABLE(src)->hash_fun;
+    if (!reserve_extra (TABLE(dest), TABLE(src)->total_nodes))
+	return rep_NULL;
+
+    args[0] = dest; args[1] = src;
+    rep_PUSHGCN (gc_args, args, 2);
+    while (!rep_throw_value && (s = next_entry (TABLE(src), &cursor)) != 0)
+    {
+	repv key = s->key, value = s->value;
+	if (!insert (dest, key, same_hash ? s->hash : hash_key (dest, key),
+		     value))
+	    break;
+    }
+    rep_POPGCN;
+    return rep_throw_value ? rep_NULL : dest;
+}
+
+DEFUN("table-ref-vector", Ftable_ref_vector, Stable_ref_vector,
+      (repv tab, repv keys, repv def), rep_Subr3) /*
+::doc:rep.data.tables#table-ref-vector::
+table-ref-vector TABLE KEYS [DEFAULT]
+
+Return a vector of the values stored in hash table TABLE for each of the
+keys in the vector KEYS. Keys with no value give DEFAULT, or false.
+::end:: */
+{
+    rep_GC_n_roots gc_args;
+    repv args[4];
+    int i, len;
+
+    rep_DECLARE1(tab, TABLEP);
+    rep_DECLARE2(keys, rep_VECTORP);
+    len = rep_VECT_LEN (keys);
+    args[0] = tab; args[1] = keys; args[3] = def;
+    args[2] = rep_make_vector (len);
+    if (args[2] == rep_NULL)
+	return rep_mem_error ();
+
+    rep_PUSHGCN (gc_args, args, 4);
+    for (i = 0; i < len && !rep_throw_value; i++)
+    {
+	repv key = rep_VECTI (keys, i);
+	unsigned char *ctrl;
+	slot *s = (TABLE(tab)->total_nodes == 0 ? 0
+		   : lookup (tab, key, hash_key (tab, key), &ctrl));
+	rep_VECTI (args[2], i) = s ? s->value : args[3];
+    }
+    for (; i < len; i++)
+	rep_VECTI (args[2], i) = Qnil;
+    rep_POPGCN;
+    return rep_throw_value ? rep_NULL : args[2];
 }
 
 DEFUN ("table-size", Ftable_size, Stable_size,
@@ -512,26 +1200,544 @@ Returns the number of items currently stored in TABLE.
     return rep_make_long_int (TABLE (tab)->total_nodes);
 }
 
-DEFUN("tables-after-gc", Ftables_after_gc, Stables_after_gc, (void), rep_Subr0)
+/* memo caches
+
+   These hold the results of calling a function, indexed by the
+   arguments it was called with, for rep.util.memoize. The arguments
+   are hashed and compared in place, so a lookup allocates nothing,
+   and a miss copies them into the new entry.
+
+   Entries are chained from a power-of-two array of buckets, and also
+   kept on a list in order of use, so that when the cache has a maximum
+   size the least recently used entry can be evicted. When the cache
+   has a time-to-live, entries older than that are recomputed when next
+   used.
+
+   Weak caches compare arguments with `eq', and each of their entries
+   is an ephemeron keyed on its first argument, as weak tables are on
+   their keys: once that is garbage collected, the entry is removed.
+   They are meant for caches keyed on objects. */
+
+struct memo_entry_struct {
+    memo_entry *chain;			/* next in bucket */
+    memo_entry *newer, *older;		/* use order */
+    hash_value hash;
+    rep_long_long expires;		/* rep_utime, if the cache has a ttl */
+    repv value;
+    int nargs;
+    repv args[1];
+};
+
+struct memo_struct {
+    repv car;
+    memo *next;
+    repv function;
+    rep_bool weak;
+    int unresolved;			/* as for tables */
+    memo *next_weak;
+    memo_entry **buckets;
+    int total_buckets, total_entries;
+    int max_entries;			/* zero if unbounded */
+    rep_long_long ttl;			/* microseconds, or zero */
+    memo_entry *newest, *oldest;
+    unsigned long hits, misses, evictions, expirations;
+};
+
+#define MEMOP(v) rep_CELL16_TYPEP(v, memo_type)
+#define MEMO(v)  ((memo *) rep_PTR(v))
+
+DEFSYM(size, "size");
+DEFSYM(hits, "hits");
+DEFSYM(misses, "misses");
+DEFSYM(evictions, "evictions");
+DEFSYM(expirations, "expirations");
+
+static hash_value
+memo_hash (memo *m, int argc, repv *argv)
+{
+    hash_value hv = argc;
+    int i;
+    if (m->weak)
+    {
+	/* only the first argument, so that it alone finds the entries
+	   to remove when it's collected */
+	return mix_hash (argc > 0 ? rep_INT (Feq_hash (argv[0])) : 0);
+    }
+    for (i = 0; i < argc; i++)
+	hv = hv * 31 + rep_INT (Fequal_hash (argv[i], Qnil));
+    return mix_hash (hv);
+}
+
+static inline rep_bool
+memo_entry_matches (memo *m, memo_entry *e, hash_value hv,
+		    int argc, repv *argv)
+{
+    int i;
+    if (e->hash != hv || e->nargs != argc)
+	return rep_FALSE;
+    for (i = 0; i < argc; i++)
+    {
+	if (e->args[i] != argv[i]
+	    && (m->weak || rep_value_cmp (e->args[i], argv[i]) != 0))
+	    return rep_FALSE;
+    }
+    return rep_TRUE;
+}
+
+static memo_entry *
+memo_lookup (memo *m, hash_value hv, int argc, repv *argv)
+{
+    memo_entry *e;
+    if (m->total_buckets == 0)
+	return 0;
+    for (e = m->buckets[hv & (m->total_buckets - 1)]; e != 0; e = e->chain)
+    {
+	if (memo_entry_matches (m, e, hv, argc, argv))
+	    return e;
+    }
+    return 0;
+}
+
+static void
+memo_unlink_use (memo *m, memo_entry *e)
+{
+    if (e->newer != 0)
+	e->newer->older = e->older;
+    else
+	m->newest = e->older;
+    if (e->older != 0)
+	e->older->newer = e->newer;
+    else
+	m->oldest = e->newer;
+}
+
+static void
+memo_link_newest (memo *m, memo_entry *e)
+{
+    e->newer = 0;
+    e->older = m->newest;
+    if (m->newest != 0)
+	m->newest->newer = e;
+    else
+	m->oldest = e;
+    m->newest = e;
+}
+
+static void
+memo_remove (memo *m, memo_entry *e)
+{
+    memo_entry **ptr = &m->buckets[e->hash & (m->total_buckets - 1)];
+    while (*ptr != e)
+	ptr = &(*ptr)->chain;
+    *ptr = e->chain;
+    memo_unlink_use (m, e);
+    m->total_entries--;
+    rep_free (e);
+}
+
+/* Double the number of buckets in M. Returns false (with an error
+   signalled) if they can't be allocated, leaving M as it was. */
+static rep_bool
+memo_grow (memo *m)
+{
+    int new_total = m->total_buckets == 0 ? 16 : m->total_buckets * 2;
+    memo_entry **new_buckets = rep_alloc (new_total * sizeof (memo_entry *));
+    int i;
+    if (new_buckets == 0)
+    {
+	Fsignal (Qno_memory, Qnil);
+	return rep_FALSE;
+    }
+    memset (new_buckets, 0, new_total * sizeof (memo_entry *));
+    for (i = 0; i < m->total_buckets; i++)
+    {
+	memo_entry *e = m->buckets[i];
+	while (e != 0)
+	{
+	    memo_entry *next = e->chain;
+	    e->chain = new_buckets[e->hash & (new_total - 1)];
+	    new_buckets[e->hash & (new_total - 1)] = e;
+	    e = next;
+	}
+    }
+    if (m->total_buckets > 0)
+	rep_free (m->buckets);
+    rep_data_after_gc += (new_total - m->total_buckets) * sizeof (memo_entry *);
+    m->buckets = new_buckets;
+    m->total_buckets = new_total;
+    return rep_TRUE;
+}
+
+/* Store VALUE as the result for ARGV in M. Returns false if an error
+   was signalled. */
+static rep_bool
+memo_insert (memo *m, hash_value hv, int argc, repv *argv, repv value)
+{
+    size_t bytes = sizeof (memo_entry) + (argc - 1) * sizeof (repv);
+    memo_entry *e;
+    int i;
+
+    if (m->max_entries > 0 && m->total_entries >= m->max_entries)
+    {
+	memo_remove (m, m->oldest);
+	m->evictions++;
+    }
+    if (m->total_entries >= m->total_buckets && !memo_grow (m))
+	return rep_FALSE;
+
+    e = rep_alloc (argc > 0 ? bytes : sizeof (memo_entry));
+    if (e == 0)
+    {
+	Fsignal (Qno_memory, Qnil);
+	return rep_FALSE;
+    }
+    rep_data_after_gc += bytes;
+    e->hash = hv;
+    e->expires = m->ttl > 0 ? rep_utime () + m->ttl : 0;
+    e->value = value;
+    e->nargs = argc;
+    for (i = 0; i < argc; i++)
+	e->args[i] = argv[i];
+    e->chain = m->buckets[hv & (m->total_buckets - 1)];
+    m->buckets[hv & (m->total_buckets - 1)] = e;
+    memo_link_newest (m, e);
+    m->total_entries++;
+    return rep_TRUE;
+}
+
+static void
+memo_clear (memo *m)
 {
-    table *x;
-    for (x = all_tables; x != 0; x = x->next)
+    memo_entry *e = m->newest;
+    while (e != 0)
     {
-	if (x->guardian)
+	memo_entry *next = e->older;
+	rep_free (e);
+	e = next;
+    }
+    m->newest = m->oldest = 0;
+    if (m->total_buckets > 0)
+	memset (m->buckets, 0, m->total_buckets * sizeof (memo_entry *));
+    m->total_entries = 0;
+}
+
+/* Mark the rest of each entry of weak cache M whose first argument
+   has been marked. Returns true if anything new was marked. */
+static rep_bool
+trace_weak_memo (memo *m)
+{
+    rep_bool changed = rep_FALSE;
+    memo_entry *e;
+    m->unresolved = 0;
+    for (e = m->newest; e != 0; e = e->older)
+    {
+	int i;
+	if (e->nargs > 0 && !rep_gc_live_p (e->args[0]))
+	{
+	    m->unresolved++;
+	    continue;
+	}
+	for (i = 1; i < e->nargs; i++)
 	{
-	    repv key;
-	    while ((key = Fprimitive_guardian_pop (x->guardian)) != Qnil)
+	    if (!rep_gc_live_p (e->args[i]))
 	    {
-		rep_GC_root gc_key;
-		rep_PUSHGC (gc_key, key);
-		Ftable_unset (rep_VAL (x), key);
-		rep_POPGC;
+		rep_MARKVAL (e->args[i]);
+		changed = rep_TRUE;
 	    }
 	}
+	if (!rep_gc_live_p (e->value))
+	{
+	    rep_MARKVAL (e->value);
+	    changed = rep_TRUE;
+	}
     }
+    return changed;
+}
+
+static void
+memo_mark (repv val)
+{
+    memo *m = MEMO(val);
+    memo_entry *e;
+    rep_MARKVAL (m->function);
+    if (m->weak)
+    {
+	trace_weak_memo (m);
+	m->next_weak = weak_memos_marked;
+	weak_memos_marked = m;
+	return;
+    }
+    for (e = m->newest; e != 0; e = e->older)
+    {
+	int i;
+	for (i = 0; i < e->nargs; i++)
+	    rep_MARKVAL (e->args[i]);
+	rep_MARKVAL (e->value);
+    }
+}
+
+static void
+memo_sweep (void)
+{
+    memo *x = all_memos;
+    all_memos = 0;
+    while (x != 0)
+    {
+	memo *next = x->next;
+	if (!rep_GC_CELL_MARKEDP (rep_VAL(x)))
+	{
+	    memo_clear (x);
+	    if (x->total_buckets > 0)
+		rep_free (x->buckets);
+	    rep_FREE_CELL (x);
+	}
+	else
+	{
+	    rep_GC_CLR_CELL (rep_VAL(x));
+	    x->next = all_memos;
+	    all_memos = x;
+	}
+	x = next;
+    }
+}
+
+static void
+memo_print (repv stream, repv arg)
+{
+    rep_stream_puts (stream, "#<memo-cache ", -1, rep_FALSE);
+    rep_princ_val (stream, MEMO(arg)->function);
+    rep_stream_putc (stream, '>');
+}
+
+DEFUN("make-memo-cache", Fmake_memo_cache, Smake_memo_cache,
+      (repv fun, repv max_size, repv ttl, repv weak), rep_Subr4) /*
+::doc:rep.data.tables#make-memo-cache::
+make-memo-cache FUNCTION [MAX-SIZE] [TTL] [WEAK]
+
+Create and return a cache of the results of FUNCTION, for use with
+`memo-cache-call'.
+
+If MAX-SIZE is a positive fixnum, at most that many results are kept,
+the least recently used being discarded first. If TTL is a positive
+number, results more than that many seconds old are recomputed.
+
+If WEAK is true, arguments are compared using `eq' instead of `equal',
+and each result is only kept while its first argument has not been
+garbage collected.
+::end:: */
+{
+    memo *m;
+    rep_DECLARE(1, fun, Ffunctionp (fun) != Qnil);
+    rep_DECLARE(2, max_size, max_size == Qnil
+		|| (rep_INTP (max_size) && rep_INT (max_size) > 0));
+    rep_DECLARE(3, ttl, ttl == Qnil
+		|| (rep_NUMERICP (ttl) && rep_get_float (ttl) > 0));
+
+    m = rep_ALLOC_CELL (sizeof (memo));
+    rep_data_after_gc += sizeof (memo);
+    m->car = memo_type;
+    m->next = all_memos;
+    all_memos = m;
+    m->function = fun;
+    m->weak = (weak != Qnil);
+    m->unresolved = 0;
+    m->next_weak = 0;
+    m->buckets = 0;
+    m->total_buckets = m->total_entries = 0;
+    m->max_entries = (max_size == Qnil) ? 0 : rep_INT (max_size);
+    m->ttl = (ttl == Qnil) ? 0 : (rep_long_long) (rep_get_float (ttl) * 1e6);
+    if (ttl != Qnil && m->ttl == 0)
+	m->ttl = 1;
+    m->newest = m->oldest = 0;
+    m->hits = m->misses = m->evictions = m->expirations = 0;
+    return rep_VAL(m);
+}
+
+DEFUN("memo-cache-call", Fmemo_cache_call, Smemo_cache_call,
+      (int argc, repv *argv), rep_SubrV) /*
+::doc:rep.data.tables#memo-cache-call::
+memo-cache-call CACHE ARGS...
+
+Return the result of applying the function of memo cache CACHE to
+ARGS, calling it only if that result isn't already stored in CACHE.
+::end:: */
+{
+    repv cache, value;
+    memo *m;
+    memo_entry *e;
+    hash_value hv;
+    rep_GC_root gc_cache;
+
+    if (argc < 1)
+	return rep_signal_missing_arg (1);
+    cache = argv[0];
+    rep_DECLARE1(cache, MEMOP);
+    m = MEMO(cache);
+    argc--; argv++;
+
+    hv = memo_hash (m, argc, argv);
+    e = memo_lookup (m, hv, argc, argv);
+    if (e != 0)
+    {
+	if (m->ttl == 0 || rep_utime () < e->expires)
+	{
+	    m->hits++;
+	    if (m->newest != e)
+	    {
+		memo_unlink_use (m, e);
+		memo_link_newest (m, e);
+	    }
+	    return e->value;
+	}
+	memo_remove (m, e);
+	m->expirations++;
+    }
+
+    m->misses++;
+    rep_PUSHGC (gc_cache, cache);
+    value = rep_call_lispn (m->function, argc, argv);
+    rep_POPGC;
+    if (value == rep_NULL)
+	return rep_NULL;
+
+    /* the function may itself have stored this result */
+    e = memo_lookup (m, hv, argc, argv);
+    if (e != 0)
+    {
+	e->value = value;
+	e->expires = m->ttl > 0 ? rep_utime () + m->ttl : 0;
+    }
+    else if (!memo_insert (m, hv, argc, argv, value))
+	return rep_NULL;
+    return value;
+}
+
+DEFUN("memo-cache-clear", Fmemo_cache_clear, Smemo_cache_clear,
+      (repv cache), rep_Subr1) /*
+::doc:rep.data.tables#memo-cache-clear::
+memo-cache-clear CACHE
+
+Discard all results stored in memo cache CACHE.
+::end:: */
+{
+    rep_DECLARE1(cache, MEMOP);
+    memo_clear (MEMO(cache));
     return Qnil;
 }
 
+DEFUN("memo-cache-stats", Fmemo_cache_stats, Smemo_cache_stats,
+      (repv cache, repv reset), rep_Subr2) /*
+::doc:rep.data.tables#memo-cache-stats::
+memo-cache-stats CACHE [RESET]
+
+Return an association list describing memo cache CACHE: the number of
+results it holds (`size'), the number of calls that found their result
+(`hits') and that had to call the function (`misses'), and how many
+results were discarded to make room (`evictions') or because they had
+expired (`expirations').
+
+If RESET is true, the counts are set to zero after being read.
+::end:: */
+{
+    memo *m;
+    repv out = Qnil;
+    rep_DECLARE1(cache, MEMOP);
+    m = MEMO(cache);
+#define PUSH(sym, value) out = Fcons (Fcons (sym, value), out)
+    PUSH (Qexpirations, rep_make_long_uint (m->expirations));
+    PUSH (Qevictions, rep_make_long_uint (m->evictions));
+    PUSH (Qmisses, rep_make_long_uint (m->misses));
+    PUSH (Qhits, rep_make_long_uint (m->hits));
+    PUSH (Qsize, rep_MAKE_INT (m->total_entries));
+#undef PUSH
+    if (reset != Qnil)
+	m->hits = m->misses = m->evictions = m->expirations = 0;
+    return out;
+}
+
+DEFUN("memo-cache-p", Fmemo_cache_p, Smemo_cache_p, (repv arg), rep_Subr1) /*
+::doc:rep.data.tables#memo-cache-p::
+memo-cache-p ARG
+
+Return true if ARG is a memo cache.
+::end:: */
+{
+    return MEMOP(arg) ? Qt : Qnil;
+}
+
+/* weak hooks for the GC, see values.c */
+
+static rep_bool
+tables_trace_weak (void)
+{
+    rep_bool changed = rep_FALSE;
+    table *t;
+    memo *m;
+    for (t = weak_tables_marked; t != 0; t = t->next_weak)
+    {
+	if (t->unresolved > 0 && trace_weak_table (t))
+	    changed = rep_TRUE;
+    }
+    for (m = weak_memos_marked; m != 0; m = m->next_weak)
+    {
+	if (m->unresolved > 0 && trace_weak_memo (m))
+	    changed = rep_TRUE;
+    }
+    return changed;
+}
+
+static void
+clear_weak_slots (table *t, unsigned char *ctrl, slot *slots,
+		  int start, int end)
+{
+    int i;
+    for (i = start; i < end; i++)
+    {
+	if (CTRL_FULLP (ctrl[i]) && !rep_gc_live_p (slots[i].key))
+	    remove_entry (t, ctrl + i, slots + i);
+    }
+}
+
+/* Remove the entries of the weak tables and caches marked by this GC
+   whose keys weren't. Only those that had unresolved entries after
+   the last trace need to be looked at. */
+static void
+tables_clear_weak (void)
+{
+    table *t;
+    memo *m;
+    for (t = weak_tables_marked; t != 0; t = t->next_weak)
+    {
+	if (t->unresolved > 0)
+	{
+	    clear_weak_slots (t, t->ctrl, t->slots, 0, t->total_slots);
+	    if (t->old_total > 0)
+	    {
+		clear_weak_slots (t, t->old_ctrl, t->old_slots,
+				  t->migrate_pos, t->old_total);
+	    }
+	    /* entries have gone from under any probe in progress */
+	    t->layout++;
+	}
+    }
+    weak_tables_marked = 0;
+    for (m = weak_memos_marked; m != 0; m = m->next_weak)
+    {
+	if (m->unresolved > 0)
+	{
+	    memo_entry *e = m->newest;
+	    while (e != 0)
+	    {
+		memo_entry *next = e->older;
+		if (e->nargs > 0 && !rep_gc_live_p (e->args[0]))
+		    memo_remove (m, e);
+		e = next;
+	    }
+	}
+    }
+    weak_memos_marked = 0;
+}
+
 
 /* dl hooks */
 
@@ -542,10 +1748,15 @@ rep_dl_init (void)
     table_type = rep_register_new_type ("table", 0, table_print, table_print,
 					table_sweep, table_mark,
 					0, 0, 0, 0, 0, 0, 0);
-    tem = Fsymbol_value (Qafter_gc_hook, Qt);
-    if (rep_VOIDP (tem))
-	tem = Qnil;
-    Fset (Qafter_gc_hook, Fcons (rep_VAL(&Stables_after_gc), tem));
+    memo_type = rep_register_new_type ("memo-cache", 0, memo_print,
+				       memo_print, memo_sweep, memo_mark,
+				       0, 0, 0, 0, 0, 0, 0);
+    rep_INTERN(size);
+    rep_INTERN(hits);
+    rep_INTERN(misses);
+    rep_INTERN(evictions);
+    rep_INTERN(expirations);
+    rep_add_weak_hooks (tables_trace_weak, tables_clear_weak);
 
     tem = rep_push_structure ("rep.data.tables");
     /* ::alias:tables rep.data.tables:: */
@@ -563,6 +1774,19 @@ rep_dl_init (void)
     rep_ADD_SUBR(Stable_unset);
     rep_ADD_SUBR(Stable_walk);
     rep_ADD_SUBR(Stable_size);
-    rep_ADD_INTERNAL_SUBR(Stables_after_gc);
+    rep_ADD_SUBR(Stable_reserve);
+    rep_ADD_SUBR(Stable_fold);
+    rep_ADD_SUBR(Stable_keys);
+    rep_ADD_SUBR(Stable_values);
+    rep_ADD_SUBR(Stable_to_vector);
+    rep_ADD_SUBR(Stable_to_alist);
+    rep_ADD_SUBR(Stable_load);
+    rep_ADD_SUBR(Stable_merge);
+    rep_ADD_SUBR(Stable_ref_vector);
+    rep_ADD_SUBR(Smake_memo_cache);
+    rep_ADD_SUBR(Smemo_cache_call);
+    rep_ADD_SUBR(Smemo_cache_clear);
+    rep_ADD_SUBR(Smemo_cache_stats);
+    rep_ADD_SUBR(Smemo_cache_p);
     return rep_pop_structure (tem);
 }
@@ -51,6 +51,12 @@ char *alloca ();
 # include <sys/time.h>
 #endif
 
+#if defined (HAVE_SYS_TIMERFD_H) && defined (HAVE_TIMERFD_CREATE) \
+    && defined (HAVE_CLOCK_GETTIME)
+# include <sys/timerfd.h>
+# define USE_TIMERFD
+#endif
+
 static int timer_type;
 
 #define TIMER(v)  ((Lisp_Timer *)rep_PTR(v))
@@ -58,66 +64,97 @@ static int timer_type;
 
 typedef struct lisp_timer {
     repv car;
-    struct lisp_timer *next;
     struct lisp_timer *next_alloc;
     repv function;
     long secs, msecs;
-    long rel_secs, rel_msecs;
+    /* The interval in nanoseconds, and when it ends */
+    rep_long_long period, deadline;
+    /* Position in timer_heap, or -1 if not pending */
+    int index;
     unsigned int fired : 1;
-    unsigned int deleted : 1;
 } Lisp_Timer;
 
 /* List of all allocated timer objects, linked through next_alloc field */
 static Lisp_Timer *allocated_timers;
 
-/* List of all pending timers, linked through next field. Only ever
-   touch this variable if SIGALRM is blocked! */
-static Lisp_Timer *timer_chain;
+/* All pending timers, as a binary heap ordered by deadline, so that
+   timers can be started and stopped in logarithmic time. */
+static Lisp_Timer **timer_heap;
+static int timer_count, timer_heap_size;
 
-/* Pipe used to trigger the input callback */
+#ifdef USE_TIMERFD
+/* Becomes readable when the first deadline has passed */
+static int timer_fd = -1;
+#else
+/* Pipe used to trigger the input callback from the SIGALRM handler */
 static int pipe_fds[2];
+#endif
 
-/* Contains SIGALRM */
-static sigset_t alrm_sigset;
 
 
+/* Returns the current time in nanoseconds, from a clock that is never
+   set backwards if possible. */
+static rep_long_long
+current_nsecs (void)
+{
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+	return (rep_long_long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return rep_utime () * 1000;
+}
 
+#ifndef USE_TIMERFD
 static RETSIGTYPE
 timer_signal_handler (int sig)
 {
     int dummy = 0;
-    Lisp_Timer *t = timer_chain;
-    assert (t != 0);
-    t->rel_secs = t->rel_msecs = 0;
-    while (t != 0 && t->rel_secs == 0 && t->rel_msecs == 0)
-    {
-	t->fired = 1;
-	t = t->next;
-    }
     write (pipe_fds[1], &dummy, sizeof (dummy));
 }
+#endif
 
-/* only call with SIGALRM blocked */
+/* Arrange for timer_fd_handler () to be called when the first timer
+   in the heap expires. */
 static void
 setup_next_timer (void)
 {
-    if (timer_chain != 0
-	&& (timer_chain->rel_secs > 0 || timer_chain->rel_msecs > 0))
+#ifdef USE_TIMERFD
+    struct itimerspec it;
+    it.it_interval.tv_sec = it.it_interval.tv_nsec = 0;
+    if (timer_count > 0)
     {
-#ifdef HAVE_SETITIMER
-	struct itimerval it, tem;
-	it.it_interval.tv_usec = 0;
-	it.it_interval.tv_sec = 0;
-	it.it_value.tv_usec = timer_chain->rel_msecs * 1000;
-	it.it_value.tv_sec = timer_chain->rel_secs;
-	setitimer (ITIMER_REAL, &it, &tem);
+	/* An all-zero value would disarm the timer */
+	rep_long_long when = MAX (timer_heap[0]->deadline, 1);
+	it.it_value.tv_sec = when / 1000000000;
+	it.it_value.tv_nsec = when % 1000000000;
+    }
+    else
+	it.it_value.tv_sec = it.it_value.tv_nsec = 0;
+    timerfd_settime (timer_fd, TFD_TIMER_ABSTIME, &it, 0);
 #else
-	alarm (timer_chain->secs);
-#endif
+    if (timer_count > 0)
+    {
+	rep_long_long usecs = (timer_heap[0]->deadline
+			       - current_nsecs ()) / 1000;
+	usecs = MAX (usecs, 1);
+# ifdef HAVE_SETITIMER
+	{
+	    struct itimerval it, tem;
+	    it.it_interval.tv_usec = 0;
+	    it.it_interval.tv_sec = 0;
+	    it.it_value.tv_usec = usecs % 1000000;
+	    it.it_value.tv_sec = usecs / 1000000;
+	    setitimer (ITIMER_REAL, &it, &tem);
+	}
+# else
+	alarm ((usecs + 999999) / 1000000);
+# endif
 	signal (SIGALRM, timer_signal_handler);
     }
     else
 	signal (SIGALRM, SIG_IGN);
+#endif
 }
 
 static inline void
@@ -135,98 +172,168 @@ fix_time (long *secs, long *msecs)
     }
 }
 
+/* Set the interval of T from SECS and MSECS, either of which may be
+   undefined. MSECS may have a fractional part. */
+static void
+set_interval (Lisp_Timer *t, repv secs, repv msecs)
+{
+    t->secs = rep_get_long_int (secs);
+    t->period = (rep_long_long) t->secs * 1000000000;
+    if (rep_INTP (msecs) || !rep_NUMERICP (msecs))
+    {
+	t->msecs = rep_get_long_int (msecs);
+	t->period += (rep_long_long) t->msecs * 1000000;
+    }
+    else
+    {
+	double ms = rep_get_float (msecs);
+	t->msecs = (long) ms;
+	t->period += (rep_long_long) (ms * 1e6);
+    }
+    fix_time (&t->secs, &t->msecs);
+}
+
+static inline void
+heap_place (Lisp_Timer *t, int i)
+{
+    timer_heap[i] = t;
+    t->index = i;
+}
+
+static void
+sift_up (int i)
+{
+    Lisp_Timer *t = timer_heap[i];
+    while (i > 0)
+    {
+	int parent = (i - 1) / 2;
+	if (timer_heap[parent]->deadline <= t->deadline)
+	    break;
+	heap_place (timer_heap[parent], i);
+	i = parent;
+    }
+    heap_place (t, i);
+}
+
+static void
+sift_down (int i)
+{
+    Lisp_Timer *t = timer_heap[i];
+    while (1)
+    {
+	int child = 2 * i + 1;
+	if (child >= timer_count)
+	    break;
+	if (child + 1 < timer_count
+	    && timer_heap[child + 1]->deadline < timer_heap[child]->deadline)
+	    child++;
+	if (t->deadline <= timer_heap[child]->deadline)
+	    break;
+	heap_place (timer_heap[child], i);
+	i = child;
+    }
+    heap_place (t, i);
+}
+
 static void
 insert_timer (Lisp_Timer *t)
 {
-    sigset_t old;
-    sigprocmask (SIG_BLOCK, &alrm_sigset, &old);
-    if (t->secs > 0 || t->msecs > 0)
+    t->fired = 0;
+    if (t->period > 0)
     {
-	Lisp_Timer **x;
-	t->rel_secs = t->secs;
-	t->rel_msecs = t->msecs;
-	t->fired = 0;
-	t->deleted = 0;
-	x = &timer_chain;
-	while (*x != 0
-	       && ((*x)->rel_secs < t->rel_secs
-		   || ((*x)->rel_secs == t->rel_secs
-		       && (*x)->rel_msecs <= t->rel_msecs)))
+	if (timer_count == timer_heap_size)
 	{
-	    t->rel_msecs -= (*x)->rel_msecs;
-	    t->rel_secs -= (*x)->rel_secs;
-	    fix_time (&t->rel_secs, &t->rel_msecs);
-	    x = &((*x)->next);
+	    int new_size = MAX (timer_heap_size * 2, 64);
+	    Lisp_Timer **new = rep_realloc (timer_heap,
+					    new_size * sizeof (Lisp_Timer *));
+	    if (new == 0)
+	    {
+		rep_mem_error ();
+		return;
+	    }
+	    timer_heap = new;
+	    timer_heap_size = new_size;
 	}
-	if (*x != 0)
-	{
-	    (*x)->rel_msecs -= t->rel_msecs;
-	    (*x)->rel_secs -= t->rel_secs;
-	    fix_time (&(*x)->rel_secs, &(*x)->rel_msecs);
-	}
-	t->next = *x;
-	*x = t;
-	if (timer_chain == t)
+	t->deadline = current_nsecs () + t->period;
+	timer_heap[timer_count++] = t;
+	sift_up (timer_count - 1);
+	if (timer_heap[0] == t)
 	    setup_next_timer ();
     }
-    sigprocmask (SIG_SETMASK, &old, 0);
 }
 
 static void
 delete_timer (Lisp_Timer *t)
 {
-    Lisp_Timer **x;
-    sigset_t old;
-
-    sigprocmask (SIG_BLOCK, &alrm_sigset, &old);
-    t->deleted = 1;
-    x = &timer_chain;
-    while (*x != 0 && (*x) != t)
-	x = &((*x)->next);
-    if (*x == t)
+    t->fired = 0;
+    if (t->index >= 0)
     {
-	if (t->next != 0)
+	int i = t->index;
+	rep_bool first = (i == 0);
+	t->index = -1;
+	if (i < --timer_count)
 	{
-	    t->next->rel_msecs += t->rel_msecs;
-	    t->next->rel_secs += t->rel_secs;
-	    fix_time (&t->next->rel_secs, &t->next->rel_msecs);
+	    Lisp_Timer *moved = timer_heap[timer_count];
+	    heap_place (moved, i);
+	    sift_up (i);
+	    sift_down (moved->index);
 	}
-	t->rel_secs = t->rel_msecs = 0;
-	*x = t->next;
-	if (x == &timer_chain)
+	if (first)
 	    setup_next_timer ();
     }
-    sigprocmask (SIG_SETMASK, &old, 0);
+}
+
+/* Remove and return the first timer. */
+static Lisp_Timer *
+pop_timer (void)
+{
+    Lisp_Timer *t = timer_heap[0];
+    t->index = -1;
+    if (--timer_count > 0)
+    {
+	heap_place (timer_heap[timer_count], 0);
+	sift_down (0);
+    }
+    return t;
 }
 
 static void
 timer_fd_handler (int fd)
 {
-    int dummy;
     int ready, i;
     repv *timers;
     rep_GC_n_roots gc_timers;
-    Lisp_Timer *t;
-    sigset_t old;
+    rep_long_long now;
 
+#ifdef USE_TIMERFD
+    unsigned long long expirations;
+    read (fd, &expirations, sizeof (expirations));
+#else
+    int dummy;
     read (pipe_fds[0], &dummy, sizeof (dummy));
-    sigprocmask (SIG_BLOCK, &alrm_sigset, &old);
+#endif
+
+    now = current_nsecs ();
     ready = 0;
-    for (t = timer_chain; t != 0 && t->fired; t = t->next)
-	ready++;
-    timers = alloca (sizeof (repv) * ready);
-    for (i = 0; i < ready; i++)
+    timers = 0;
+    while (timer_count > 0 && timer_heap[0]->deadline <= now)
     {
-	timers[i] = rep_VAL(timer_chain);
-	timer_chain = timer_chain->next;
+	if (ready == 0)
+	    timers = alloca (sizeof (repv) * timer_count);
+	timers[ready] = rep_VAL (pop_timer ());
+	TIMER (timers[ready])->fired = 1;
+	ready++;
     }
     setup_next_timer ();
-    sigprocmask (SIG_SETMASK, &old, 0);
     rep_PUSHGCN(gc_timers, timers, ready);
     for (i = 0; i < ready; i++)
     {
-	if (!TIMER(timers[i])->deleted)
+	/* Earlier callbacks may have stopped or restarted it */
+	if (TIMER(timers[i])->fired)
+	{
+	    TIMER(timers[i])->fired = 0;
 	    rep_call_lisp1 (TIMER(timers[i])->function, timers[i]);
+	}
     }
     rep_POPGCN;
 }
@@ -240,7 +347,8 @@ DEFUN("make-timer", Fmake_timer, Smake_timer,
 make-timer FUNCTION [SECONDS] [MILLISECONDS]
 
 Create and return a new one-shot timer object. After SECONDS*1000 +
-MILLISECONDS milliseconds FUNCTION will be called.
+MILLISECONDS milliseconds FUNCTION will be called. MILLISECONDS may be
+fractional.
 
 Note that the timer will only fire _once_, use the `set-timer' function
 to re-enable it.
@@ -250,9 +358,8 @@ to re-enable it.
     rep_data_after_gc += sizeof (Lisp_Timer);
     t->car = timer_type;
     t->function = fun;
-    t->secs = rep_get_long_int (secs);
-    t->msecs = rep_get_long_int (msecs);
-    fix_time (&t->secs, &t->msecs);
+    t->index = -1;
+    set_interval (t, secs, msecs);
     t->next_alloc = allocated_timers;
     allocated_timers = t;
     insert_timer (t);
@@ -288,11 +395,7 @@ duration. Otherwise, the existing values are preserved.
     rep_DECLARE3_OPT(msecs, rep_NUMERICP);
     delete_timer (TIMER(timer));
     if (secs != Qnil || msecs != Qnil)
-    {
-	TIMER(timer)->secs = rep_get_long_int (secs);
-	TIMER(timer)->msecs = rep_get_long_int (msecs);
-	fix_time (&TIMER (timer)->secs, &TIMER (timer)->msecs);
-    }
+	set_interval (TIMER(timer), secs, msecs);
     insert_timer (TIMER(timer));
     return timer;
 }
@@ -309,16 +412,9 @@ timer_mark (repv val)
 static void
 timer_mark_active (void)
 {
-    Lisp_Timer *t;
-    sigset_t old;
-    sigprocmask (SIG_BLOCK, &alrm_sigset, &old);
-    t = timer_chain;
-    while (t != 0)
-    {
-	rep_MARKVAL (rep_VAL(t));
-	t = t->next;
-    }
-    sigprocmask (SIG_SETMASK, &old, 0);
+    int i;
+    for (i = 0; i < timer_count; i++)
+	rep_MARKVAL (rep_VAL(timer_heap[i]));
 }
 
 static void
@@ -357,6 +453,32 @@ timer_print (repv stream, repv arg)
 
 /* DL hooks */
 
+/* A forked child mustn't run its parent's timers, nor share its
+   timer fd (which the core has stopped watching) */
+static void
+timers_after_fork (void)
+{
+    int i;
+    for (i = 0; i < timer_count; i++)
+	timer_heap[i]->index = -1;
+    timer_count = 0;
+#ifdef USE_TIMERFD
+    if (timer_fd >= 0)
+	close (timer_fd);
+    timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd >= 0)
+	rep_register_input_fd (timer_fd, timer_fd_handler);
+#else
+    close (pipe_fds[0]);
+    close (pipe_fds[1]);
+    pipe (pipe_fds);
+    rep_register_input_fd (pipe_fds[0], timer_fd_handler);
+# ifdef rep_HAVE_UNIX
+    rep_unix_set_fd_cloexec (pipe_fds[1]);
+# endif
+#endif
+}
+
 repv
 rep_dl_init (void)
 {
@@ -364,14 +486,21 @@ rep_dl_init (void)
     timer_type = rep_register_new_type ("timer", 0, timer_print, timer_print,
 					timer_sweep, timer_mark,
 					timer_mark_active, 0, 0, 0, 0, 0, 0);
+#ifdef USE_TIMERFD
+    timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd >= 0)
+	rep_register_input_fd (timer_fd, timer_fd_handler);
+    else
+	return rep_signal_file_error (Qnil);
+#else
     pipe (pipe_fds);
     rep_register_input_fd (pipe_fds[0], timer_fd_handler);
-#ifdef rep_HAVE_UNIX
+# ifdef rep_HAVE_UNIX
     rep_unix_set_fd_cloexec (pipe_fds[1]);
-#endif
-    sigemptyset (&alrm_sigset);
-    sigaddset (&alrm_sigset, SIGALRM);
+# endif
     rep_sig_restart (SIGALRM, rep_TRUE);
+#endif
+    rep_add_after_fork_callback (timers_after_fork);
 
     tem = rep_push_structure ("rep.io.timers");
     /* ::alias:timers rep.io.timers:: */
@@ -385,8 +514,23 @@ rep_dl_init (void)
 void
 rep_dl_kill (void)
 {
+#ifdef USE_TIMERFD
+    if (timer_fd >= 0)
+    {
+	rep_deregister_input_fd (timer_fd);
+	close (timer_fd);
+	timer_fd = -1;
+    }
+#else
     rep_deregister_input_fd (pipe_fds[0]);
     close (pipe_fds[0]);
     close (pipe_fds[1]);
     signal (SIGALRM, SIG_IGN);
+#endif
+    if (timer_heap != 0)
+    {
+	rep_free (timer_heap);
+	timer_heap = 0;
+	timer_count = timer_heap_size = 0;
+    }
 }
@@ -24,6 +24,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/stat.h>
 
 #ifdef HAVE_FCNTL_H
@@ -34,6 +35,11 @@
 # include <unistd.h>
 #endif
 
+#if defined (HAVE_MMAP) && defined (HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
+
 #if HAVE_DIRENT_H
 # include <dirent.h>
 # define NAMLEN(dirent) strlen((dirent)->d_name)
@@ -51,10 +57,21 @@
 # endif
 #endif
 
+#if defined (HAVE_SENDFILE) && defined (HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+#endif
+
 #ifndef PATH_MAX
 # define PATH_MAX 256
 #endif
 
+#ifndef O_DIRECTORY
+# define O_DIRECTORY 0
+#endif
+
+/* Bytes copied by each system call in rep_copy_fd () */
+#define COPY_CHUNK (1024 * 1024)
+
 #ifndef S_ISLNK
 #define S_ISLNK(mode)  (((mode) & S_IFMT) == S_IFLNK)
 #endif
@@ -324,6 +341,112 @@ rep_delete_directory(repv dir)
 	return rep_signal_file_error(dir);
 }
 
+/* Copy data from IN_FD to OUT_FD. When LENGTH isn't negative,
+   IN_FD is a regular file and LENGTH bytes starting at OFFSET are
+   copied without moving its file position, letting the kernel do the
+   copying if it can; otherwise IN_FD is read from its current position
+   until end of file. OUT_FD may be non-blocking. Returns the number of
+   bytes copied (fewer than LENGTH if the file shrank, or if
+   interrupted), or -1 with errno set. */
+long
+rep_copy_fd (int in_fd, int out_fd, long offset, long length)
+{
+    static char *buf;
+    long done = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+    rep_bool try_copy_range = length >= 0;
+#endif
+#if defined (HAVE_SENDFILE) && defined (HAVE_SYS_SENDFILE_H)
+    rep_bool try_sendfile = length >= 0;
+#endif
+
+    while (length < 0 || done < length)
+    {
+	size_t chunk = COPY_CHUNK;
+	ssize_t n = -1;
+
+	if (length >= 0 && (long) chunk > length - done)
+	    chunk = length - done;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (try_copy_range)
+	{
+	    loff_t from = offset + done;
+	    n = copy_file_range (in_fd, &from, out_fd, 0, chunk, 0);
+	    if (n < 0 && errno != EINTR && errno != EAGAIN)
+	    {
+		/* Only works between files on some file systems,
+		   and not for appending */
+		try_copy_range = rep_FALSE;
+		continue;
+	    }
+	}
+	else
+#endif
+#if defined (HAVE_SENDFILE) && defined (HAVE_SYS_SENDFILE_H)
+	if (try_sendfile)
+	{
+	    off_t from = offset + done;
+	    n = sendfile (out_fd, in_fd, &from, chunk);
+	    if (n < 0 && errno != EINTR && errno != EAGAIN)
+	    {
+		try_sendfile = rep_FALSE;
+		continue;
+	    }
+	}
+	else
+#endif
+	{
+	    ssize_t wrote = 0;
+	    if (buf == 0)
+	    {
+		buf = rep_alloc (COPY_CHUNK);
+		if (buf == 0)
+		{
+		    errno = ENOMEM;
+		    return -1;
+		}
+	    }
+	    do {
+		n = (length >= 0 ? pread (in_fd, buf, chunk, offset + done)
+		     : read (in_fd, buf, chunk));
+	    } while (n < 0 && errno == EINTR);
+	    if (n < 0)
+		return -1;
+	    while (wrote < n)
+	    {
+		ssize_t w = write (out_fd, buf + wrote, n - wrote);
+		if (w >= 0)
+		    wrote += w;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+		    if (!rep_unix_wait_for_output (out_fd))
+			return -1;
+		}
+		else if (errno != EINTR)
+		    return -1;
+	    }
+	}
+
+	if (n == 0)
+	    break;
+	else if (n > 0)
+	    done += n;
+	else if (errno == EAGAIN)
+	{
+	    if (!rep_unix_wait_for_output (out_fd))
+		return -1;
+	}
+	else if (errno != EINTR)
+	    return -1;
+
+	rep_TEST_INT_SLOW;
+	if (rep_INTERRUPTP)
+	    break;
+    }
+    return done;
+}
+
 repv
 rep_copy_file(repv src, repv dst)
 {
@@ -336,26 +459,19 @@ rep_copy_file(repv src, repv dst)
 	if(dstf != -1)
 	{
 	    struct stat statb;
-	    int rd;
+	    long length = -1;
 	    if(fstat(srcf, &statb) == 0)
+	    {
 		chmod(rep_STR(dst), statb.st_mode);
-	    do {
-		char buf[BUFSIZ];
-		int wr;
-		rd = read(srcf, buf, BUFSIZ);
-		if(rd < 0)
-		{
-		    res = rep_signal_file_error(src);
-		    break;
-		}
-		wr = write(dstf, buf, rd);
-		if(wr != rd)
-		{
-		    res = rep_signal_file_error(dst);
-		    break;
-		}
-	    } while(rd != 0);
-	    close(dstf);
+		if(S_ISREG(statb.st_mode))
+		    length = statb.st_size;
+	    }
+	    if(rep_copy_fd(srcf, dstf, 0, length) < 0)
+		res = rep_signal_file_error(errno == EBADF ? dst : src);
+	    else if(rep_INTERRUPTP)
+		res = rep_NULL;
+	    if(close(dstf) != 0 && res == Qt)
+		res = rep_signal_file_error(dst);
 	}
 	else
 	    res = rep_signal_file_error(dst);
@@ -366,6 +482,57 @@ rep_copy_file(repv src, repv dst)
     return res;
 }
 
+/* Return a string containing everything in the local file called FILE.
+   Regular files are read in a single call, into a string of their size. */
+repv
+rep_file_contents (repv file)
+{
+    struct stat st;
+    repv string;
+    long size, length = 0;
+    int fd = open (rep_STR (file), O_RDONLY);
+    if (fd < 0)
+	return rep_signal_file_error (file);
+
+    size = (fstat (fd, &st) == 0 && S_ISREG (st.st_mode)
+	    && st.st_size > 0) ? st.st_size : BUFSIZ;
+    string = rep_make_string (size + 1);
+    if (string == rep_NULL)
+	string = rep_mem_error ();
+    while (string != rep_NULL)
+    {
+	ssize_t n = read (fd, rep_STR (string) + length, size - length);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	else if (n < 0)
+	{
+	    string = rep_signal_file_error (file);
+	    break;
+	}
+	else if (n == 0)
+	    break;
+	length += n;
+	if (length == size)
+	{
+	    /* Not a regular file, or it grew since stat was called */
+	    repv bigger = rep_make_string (size * 2 + 1);
+	    if (bigger != rep_NULL)
+		memcpy (rep_STR (bigger), rep_STR (string), length);
+	    else
+		bigger = rep_mem_error ();
+	    string = bigger;
+	    size *= 2;
+	}
+    }
+    close (fd);
+    if (string != rep_NULL)
+    {
+	rep_STR (string)[length] = 0;
+	rep_set_string_len (string, length);
+    }
+    return string;
+}
+
 repv
 rep_file_readable_p(repv file)
 {
@@ -588,6 +755,161 @@ rep_make_symlink (repv file, repv contents)
 	return rep_signal_file_error (file);
 }
 
+/* State of directory-files-with-attributes while it walks a tree.
+   PATH holds the name of the directory being read, with a trailing
+   slash; the names returned start at PATH + BASE. */
+struct dir_walk {
+    char *path;
+    size_t base, size;
+    rep_bool recursive;
+    rep_regexp *re;
+    repv list;
+};
+
+static repv
+file_type (mode_t mode)
+{
+    if (S_ISREG (mode))
+	return Qfile;
+    else if (S_ISDIR (mode))
+	return Qdirectory;
+    else if (S_ISLNK (mode))
+	return Qsymlink;
+    else
+	return Qspecial;
+}
+
+/* Add an entry to W->list for each file in DIR, whose name is in
+   W->path up to LEN. Unless a file's name matches W->re (or the walk
+   is recursive and the directory entry doesn't say whether the file is
+   a directory), it isn't stat'd. Returns false if an error was
+   signalled. */
+static rep_bool
+walk_directory (struct dir_walk *w, DIR *dir, size_t len)
+{
+    struct dirent *de;
+    while ((de = readdir (dir)) != 0)
+    {
+	char *name = de->d_name;
+	size_t namelen = NAMLEN (de);
+	rep_bool wanted, is_dir = rep_FALSE, known = rep_FALSE;
+	struct stat st;
+
+	if (name[0] == '.'
+	    && (namelen == 1 || (namelen == 2 && name[1] == '.')))
+	    continue;
+
+	if (len + namelen + 2 > w->size)
+	{
+	    size_t new_size = MAX (w->size * 2, len + namelen + 2);
+	    char *new_path = rep_realloc (w->path, new_size);
+	    if (new_path == 0)
+	    {
+		rep_mem_error ();
+		return rep_FALSE;
+	    }
+	    w->path = new_path;
+	    w->size = new_size;
+	}
+	memcpy (w->path + len, name, namelen + 1);
+
+	wanted = w->re == 0 || rep_regexec2 (w->re, name, 0);
+
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+	if (de->d_type != DT_UNKNOWN)
+	{
+	    is_dir = de->d_type == DT_DIR;
+	    known = rep_TRUE;
+	}
+#endif
+	if (wanted || (w->recursive && !known))
+	{
+#ifdef HAVE_FSTATAT
+	    if (fstatat (dirfd (dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+#else
+	    if (lstat (w->path, &st) != 0)
+#endif
+		/* Deleted since being read */
+		continue;
+	    is_dir = S_ISDIR (st.st_mode);
+	}
+
+	if (wanted)
+	{
+	    repv entry = rep_list_5 (rep_string_dupn (w->path + w->base,
+						      len + namelen - w->base),
+				     file_type (st.st_mode),
+				     rep_make_long_uint (st.st_size),
+				     rep_MAKE_TIME (st.st_mtime),
+				     rep_MAKE_INT (st.st_mode & 07777));
+	    w->list = Fcons (entry, w->list);
+	}
+
+	if (w->recursive && is_dir)
+	{
+	    DIR *sub;
+#if defined (HAVE_OPENAT) && defined (HAVE_FDOPENDIR)
+	    int fd = openat (dirfd (dir), name, O_RDONLY | O_DIRECTORY);
+	    sub = fd >= 0 ? fdopendir (fd) : 0;
+	    if (sub == 0 && fd >= 0)
+		close (fd);
+#else
+	    sub = opendir (w->path);
+#endif
+	    /* Subdirectories that can't be read are skipped */
+	    if (sub != 0)
+	    {
+		rep_bool ok;
+		w->path[len + namelen] = '/';
+		ok = walk_directory (w, sub, len + namelen + 1);
+		closedir (sub);
+		if (!ok)
+		    return rep_FALSE;
+	    }
+	}
+
+	rep_TEST_INT_SLOW;
+	if (rep_INTERRUPTP)
+	    return rep_FALSE;
+    }
+    return rep_TRUE;
+}
+
+repv
+rep_directory_files_with_attributes (repv dir_name, rep_bool recursive,
+				     rep_regexp *re)
+{
+    struct dir_walk w;
+    DIR *dir;
+    rep_bool ok;
+
+    if (*rep_STR (dir_name) == 0)
+	dir_name = rep_VAL (&dot);
+    dir = opendir (rep_STR (dir_name));
+    if (dir == 0)
+	return rep_signal_file_error (dir_name);
+
+    w.base = rep_STRING_LEN (dir_name);
+    w.size = w.base + 256;
+    w.path = rep_alloc (w.size);
+    if (w.path == 0)
+    {
+	closedir (dir);
+	return rep_mem_error ();
+    }
+    memcpy (w.path, rep_STR (dir_name), w.base);
+    if (w.path[w.base - 1] != '/')
+	w.path[w.base++] = '/';
+    w.recursive = recursive;
+    w.re = re;
+    w.list = Qnil;
+
+    ok = walk_directory (&w, dir, w.base);
+    closedir (dir);
+    rep_free (w.path);
+    return ok ? w.list : rep_NULL;
+}
+
 repv
 rep_getpwd(void)
 {
@@ -612,6 +934,62 @@ rep_getpwd(void)
 }
 
 
+/* Map the contents of the local file NAME into memory, read-only.
+   Returns null on failure, otherwise stores the size of the file in
+   *LENGTH. The memory must be released by rep_unmap_file (). */
+void *
+rep_map_file (const char *name, size_t *length)
+{
+    struct stat st;
+    void *data;
+    int fd = open (name, O_RDONLY);
+    if (fd < 0)
+	return 0;
+    if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode))
+    {
+	close (fd);
+	return 0;
+    }
+#ifdef USE_MMAP
+    data = mmap (0, st.st_size > 0 ? st.st_size : 1,
+		 PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+	data = 0;
+#else
+    data = rep_alloc (st.st_size > 0 ? st.st_size : 1);
+    if (data != 0)
+    {
+	size_t done = 0;
+	while (done < (size_t) st.st_size)
+	{
+	    ssize_t n = read (fd, (char *) data + done, st.st_size - done);
+	    if (n <= 0)
+	    {
+		rep_free (data);
+		data = 0;
+		break;
+	    }
+	    done += n;
+	}
+    }
+#endif
+    close (fd);
+    if (data != 0)
+	*length = st.st_size;
+    return data;
+}
+
+void
+rep_unmap_file (void *data, size_t length)
+{
+#ifdef USE_MMAP
+    munmap (data, length > 0 ? length : 1);
+#else
+    rep_free (data);
+#endif
+}
+
+
 /* module name conversion */
 
 repv
@@ -63,6 +63,11 @@ void (*rep_redisplay_fun)(void);
 long (*rep_wait_for_input_fun)(void *inputs, unsigned long timeout_msecs);
 int rep_input_timeout_secs = 1;
 
+/* When non-null, called just before and after blocking for input or
+   sleeping, so that a wall-clock profiler can account for the time
+   spent waiting */
+void (*rep_wait_sample_fun)(void);
+
 
 /* Support functions */
 
@@ -114,7 +119,11 @@ rep_sleep_for(long secs, long msecs)
     struct timeval timeout;
     timeout.tv_sec = secs + msecs / 1000;
     timeout.tv_usec = (msecs % 1000) * 1000;
+    if (rep_wait_sample_fun != 0)
+	(*rep_wait_sample_fun) ();
     select(FD_SETSIZE, NULL, NULL, NULL, &timeout);
+    if (rep_wait_sample_fun != 0)
+	(*rep_wait_sample_fun) ();
 }
 
 repv
@@ -254,21 +263,107 @@ rep_system_name(void)
     return system_name;
 }
 
+int
+rep_processor_count (void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+    if (n > 0)
+	return n;
+#endif
+    return 1;
+}
+
+/* The resident set size of the process in bytes, or -1 if it can't be
+   found (only Linux-like /proc filesystems are understood) */
+long
+rep_resident_set_size (void)
+{
+    long size, resident = -1;
+    FILE *fh = fopen ("/proc/self/statm", "r");
+    if (fh != 0)
+    {
+	if (fscanf (fh, "%ld %ld", &size, &resident) != 2)
+	    resident = -1;
+	fclose (fh);
+    }
+#ifdef HAVE_GETPAGESIZE
+    return resident < 0 ? -1 : resident * getpagesize ();
+#else
+    return resident < 0 ? -1 : resident * 4096;
+#endif
+}
+
 
 /* Main input loop */
 
-/* This is the set of fds we're waiting for input from. */
-static fd_set input_fdset;
+/* Registered input fds are waited for using the kernel's event
+   notification mechanism where one is available (epoll or kqueue), so
+   that each wakeup only costs as much as the number of ready fds.
+   Otherwise, and when waiting for a subset of the registered fds
+   (e.g. accept-process-output for one process), poll() or select() is
+   used instead. Only the select() fallback is limited to FD_SETSIZE.
+
+   Fds may also be registered for output, their callbacks are called
+   from within the waits whenever the fd can be written to. These are
+   for flushing buffered output and shouldn't do much else. */
+
+#if !defined (USE_SELECT) && defined (HAVE_POLL) && defined (HAVE_POLL_H)
+# define USE_POLL
+# include <poll.h>
+#endif
+
+#if defined (USE_EPOLL)
+# include <sys/epoll.h>
+#elif defined (USE_KQUEUE)
+# include <sys/types.h>
+# include <sys/event.h>
+#endif
+
+/* The most fds returned by one wait; any others are still ready the
+   next time round. */
+#define MAX_READY 64
+
+typedef struct {
+    /* Called when input is available, null if the fd isn't registered */
+    void (*action)(int fd);
+
+    /* Called when the fd can be written to, null if not registered
+       for output */
+    void (*out_action)(int fd);
+
+    /* Positions of the fd in input_fds[] and output_fds[] */
+    int index, out_index;
+
+    /* Set when the fd has input read but not yet handled */
+    unsigned int pending : 1;
+
+    /* Set for fds the kernel poller refuses to watch (regular files
+       under epoll); like select() these are always ready */
+    unsigned int always_ready : 1;
+} input_slot;
+
+/* Indexed by fd */
+static input_slot *input_slots;
+static int input_slots_size;
+
+/* The registered fds, in no particular order */
+static int *input_fds;
+static int input_fd_count, input_fds_size;
+
+/* The fds registered for output */
+static int *output_fds;
+static int output_fd_count, output_fds_size;
 
-/* For every bit set in unix_fd_read_set there should be a corresponding
-   function in here that will be called when input becomes available.
-   -- Is this really such a good idea, it's a lot of wasted space.. */
-static void (*input_actions[FD_SETSIZE])(int);
+/* The fds with their pending flag set */
+static int *pending_fds;
+static int input_pending_count, pending_fds_size;
 
-/* A bit set in this array means that the corresponding fd has input read
-   but not yet handled. */
-static fd_set input_pending;
-static int input_pending_count;
+static int always_ready_count;
+
+#if defined (USE_EPOLL) || defined (USE_KQUEUE)
+static int poller_fd = -1;
+#endif
 
 void (*rep_register_input_fd_fun)(int fd, void (*callback)(int fd)) = 0;
 void (*rep_deregister_input_fd_fun)(int fd) = 0;
@@ -277,11 +372,139 @@ void (*rep_deregister_input_fd_fun)(int fd) = 0;
 static int next_event_loop_callback;
 static rep_bool (*event_loop_callbacks[MAX_EVENT_LOOP_CALLBACKS])(void);
 
+#define MAX_FORK_CALLBACKS 16
+static int next_fork_callback;
+static void (*fork_callbacks[MAX_FORK_CALLBACKS])(void);
+
+/* Make sure that the array *PTR, of *SIZE elements each ELT-SIZE bytes
+   long, has room for at least NEED elements. New elements are zeroed. */
+static rep_bool
+grow_array (void **ptr, int *size, int need, size_t elt_size)
+{
+    int new_size;
+    char *new;
+
+    if (need <= *size)
+	return rep_TRUE;
+
+    new_size = *size > 0 ? *size : 32;
+    while (new_size < need)
+	new_size *= 2;
+
+    if (*ptr == 0)
+	new = rep_alloc (new_size * elt_size);
+    else
+	new = rep_realloc (*ptr, new_size * elt_size);
+    if (new == 0)
+	return rep_FALSE;
+
+    memset (new + *size * elt_size, 0, (new_size - *size) * elt_size);
+    *ptr = new;
+    *size = new_size;
+    return rep_TRUE;
+}
+
+#define GROW_ARRAY(array, size, need) \
+    grow_array ((void **) &(array), &(size), (need), sizeof (*(array)))
+
+#define WATCH_INPUT	1
+#define WATCH_OUTPUT	2
+
+static int
+watched_events (int fd)
+{
+    return ((input_slots[fd].action != 0 ? WATCH_INPUT : 0)
+	    | (input_slots[fd].out_action != 0 ? WATCH_OUTPUT : 0));
+}
+
+/* Tell the kernel poller that FD was being watched for OLD-EVENTS and
+   should now be watched for NEW-EVENTS. */
+static void
+poller_update (int fd, int old_events, int new_events)
+{
+#if defined (USE_EPOLL)
+    struct epoll_event ev;
+    if (poller_fd < 0 && new_events != 0)
+	poller_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (poller_fd < 0 || input_slots[fd].always_ready)
+	return;
+    memset (&ev, 0, sizeof (ev));
+    ev.events = (((new_events & WATCH_INPUT) ? EPOLLIN : 0)
+		 | ((new_events & WATCH_OUTPUT) ? EPOLLOUT : 0));
+    ev.data.fd = fd;
+    if (new_events == 0)
+    {
+	/* Errors are expected here, the fd may already be closed */
+	epoll_ctl (poller_fd, EPOLL_CTL_DEL, fd, &ev);
+    }
+    else if (old_events != 0)
+	epoll_ctl (poller_fd, EPOLL_CTL_MOD, fd, &ev);
+    else if (epoll_ctl (poller_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+	/* EEXIST if a dup of a closed fd is still being watched */
+	if (errno == EEXIST)
+	    epoll_ctl (poller_fd, EPOLL_CTL_MOD, fd, &ev);
+	else if (errno == EPERM)
+	{
+	    input_slots[fd].always_ready = 1;
+	    always_ready_count++;
+	}
+    }
+#elif defined (USE_KQUEUE)
+    struct kevent kev[2];
+    int n = 0;
+    if (poller_fd < 0 && new_events != 0)
+    {
+	poller_fd = kqueue ();
+	if (poller_fd >= 0)
+	    rep_unix_set_fd_cloexec (poller_fd);
+    }
+    if (poller_fd < 0)
+	return;
+    if ((old_events ^ new_events) & WATCH_INPUT)
+    {
+	EV_SET (&kev[n], fd, EVFILT_READ,
+		(new_events & WATCH_INPUT) ? EV_ADD : EV_DELETE, 0, 0, 0);
+	n++;
+    }
+    if ((old_events ^ new_events) & WATCH_OUTPUT)
+    {
+	EV_SET (&kev[n], fd, EVFILT_WRITE,
+		(new_events & WATCH_OUTPUT) ? EV_ADD : EV_DELETE, 0, 0, 0);
+	n++;
+    }
+    /* Deleting filters of closed fds fails, which is fine */
+    if (n > 0)
+	kevent (poller_fd, kev, n, 0, 0, 0);
+#endif
+}
+
 void
 rep_register_input_fd(int fd, void (*callback)(int fd))
 {
-    FD_SET(fd, &input_fdset);
-    input_actions[fd] = callback;
+    input_slot *slot;
+
+    if (!GROW_ARRAY (input_slots, input_slots_size, fd + 1))
+    {
+	rep_mem_error ();
+	return;
+    }
+    slot = &input_slots[fd];
+    if (slot->action == 0)
+    {
+	if (!GROW_ARRAY (input_fds, input_fds_size, input_fd_count + 1))
+	{
+	    rep_mem_error ();
+	    return;
+	}
+	int old_events = watched_events (fd);
+	slot->index = input_fd_count;
+	input_fds[input_fd_count++] = fd;
+	slot->action = callback;
+	poller_update (fd, old_events, watched_events (fd));
+    }
+    else
+	slot->action = callback;
 
     if (rep_register_input_fd_fun != 0)
 	(*rep_register_input_fd_fun) (fd, callback);
@@ -289,34 +512,121 @@ rep_register_input_fd(int fd, void (*callback)(int fd))
     rep_unix_set_fd_cloexec(fd);
 }
 
+static void
+clear_input_pending (int fd)
+{
+    int i;
+    input_slots[fd].pending = 0;
+    for (i = 0; i < input_pending_count; i++)
+    {
+	if (pending_fds[i] == fd)
+	{
+	    pending_fds[i] = pending_fds[--input_pending_count];
+	    break;
+	}
+    }
+}
+
 void
 rep_deregister_input_fd(int fd)
 {
-    FD_CLR(fd, &input_fdset);
-    input_actions[fd] = NULL;
+    if (fd < input_slots_size && input_slots[fd].action != 0)
+    {
+	input_slot *slot = &input_slots[fd];
+	int old_events = watched_events (fd);
+	int last = input_fds[--input_fd_count];
+	input_fds[slot->index] = last;
+	input_slots[last].index = slot->index;
+	slot->action = 0;
+	if (slot->pending)
+	    clear_input_pending (fd);
+	if (slot->always_ready)
+	{
+	    slot->always_ready = 0;
+	    always_ready_count--;
+	}
+	poller_update (fd, old_events, watched_events (fd));
+    }
 
     if (rep_deregister_input_fd_fun != 0)
 	(*rep_deregister_input_fd_fun) (fd);
 }
 
+/* Arrange for CALLBACK to be called whenever FD can be written to.
+   Returns false if that isn't possible, i.e. when an embedder has
+   taken over waiting for input. */
+rep_bool
+rep_register_output_fd (int fd, void (*callback)(int fd))
+{
+    input_slot *slot;
+
+    if (rep_wait_for_input_fun != 0)
+	return rep_FALSE;
+
+    if (!GROW_ARRAY (input_slots, input_slots_size, fd + 1))
+	return rep_FALSE;
+    slot = &input_slots[fd];
+    if (slot->out_action == 0)
+    {
+	int old_events = watched_events (fd);
+	if (!GROW_ARRAY (output_fds, output_fds_size, output_fd_count + 1))
+	    return rep_FALSE;
+	slot->out_index = output_fd_count;
+	output_fds[output_fd_count++] = fd;
+	slot->out_action = callback;
+	poller_update (fd, old_events, watched_events (fd));
+    }
+    else
+	slot->out_action = callback;
+    return rep_TRUE;
+}
+
+/* Set by an output callback that has made work for the event loop
+   callbacks, so that they're run without waiting for more input. */
+static rep_bool output_wants_dispatch;
+
 void
-rep_map_inputs (void (*fun)(int fd, void (*callback)(int)))
+rep_output_needs_dispatch (void)
 {
-    int i;
-    for (i = 0; i < FD_SETSIZE; i++)
+    output_wants_dispatch = rep_TRUE;
+}
+
+void
+rep_deregister_output_fd (int fd)
+{
+    if (fd < input_slots_size && input_slots[fd].out_action != 0)
     {
-	if (input_actions[i] != 0)
-	    fun (i, input_actions[i]);
+	input_slot *slot = &input_slots[fd];
+	int old_events = watched_events (fd);
+	int last = output_fds[--output_fd_count];
+	output_fds[slot->out_index] = last;
+	input_slots[last].out_index = slot->out_index;
+	slot->out_action = 0;
+	poller_update (fd, old_events, watched_events (fd));
     }
 }
 
+void
+rep_map_inputs (void (*fun)(int fd, void (*callback)(int)))
+{
+    int i;
+    for (i = 0; i < input_fd_count; i++)
+	fun (input_fds[i], input_slots[input_fds[i]].action);
+}
+
 void
 rep_mark_input_pending(int fd)
 {
-    if(!FD_ISSET(fd, &input_pending))
+    if (!GROW_ARRAY (input_slots, input_slots_size, fd + 1)
+	|| !GROW_ARRAY (pending_fds, pending_fds_size, input_pending_count + 1))
     {
-	FD_SET(fd, &input_pending);
-	input_pending_count++;
+	rep_mem_error ();
+	return;
+    }
+    if(!input_slots[fd].pending)
+    {
+	input_slots[fd].pending = 1;
+	pending_fds[input_pending_count++] = fd;
     }    
 }
 
@@ -345,6 +655,30 @@ rep_unix_set_fd_cloexec(int fd)
 	fcntl(fd, F_SETFD, tem | FD_CLOEXEC);
 }
 
+/* Block until FD can be written to. Returns false on error. */
+rep_bool
+rep_unix_wait_for_output(int fd)
+{
+    int ready;
+#ifdef USE_POLL
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    do {
+	ready = poll (&pfd, 1, -1);
+    } while (ready < 0 && errno == EINTR);
+#else
+    fd_set outputs;
+    do {
+	FD_ZERO(&outputs);
+	FD_SET(fd, &outputs);
+	ready = select(fd + 1, 0, &outputs, 0, 0);
+    } while (ready < 0 && errno == EINTR);
+#endif
+    return ready == 1;
+}
+
 /* Turns on or off restarted system calls for SIG */
 void
 rep_sig_restart(int sig, rep_bool flag)
@@ -382,6 +716,45 @@ rep_add_event_loop_callback (rep_bool (*callback)(void))
     event_loop_callbacks [next_event_loop_callback++] = callback;
 }
 
+/* Arrange for CALLBACK to be called by rep_isolate_forked_child (). It
+   should release whatever the module shares with the parent process. */
+void
+rep_add_after_fork_callback (void (*callback)(void))
+{
+    if (next_fork_callback == MAX_FORK_CALLBACKS)
+	abort ();
+    fork_callbacks [next_fork_callback++] = callback;
+}
+
+/* Called in a child process created by fork () that will carry on
+   running Lisp code, to stop it watching the fds it inherited. The
+   fds themselves are left open, except those closed by the callbacks
+   registered with rep_add_after_fork_callback (). */
+void
+rep_isolate_forked_child (void)
+{
+    int i;
+
+#if defined (USE_EPOLL)
+    /* The epoll instance is shared with the parent, so changing its
+       interest list here would break the parent's event loop */
+    if (poller_fd >= 0)
+	close (poller_fd);
+#endif
+#if defined (USE_EPOLL) || defined (USE_KQUEUE)
+    /* kqueues aren't inherited at all */
+    poller_fd = -1;
+#endif
+
+    if (input_slots != 0)
+	memset (input_slots, 0, input_slots_size * sizeof (input_slot));
+    input_fd_count = output_fd_count = 0;
+    input_pending_count = always_ready_count = 0;
+
+    for (i = 0; i < next_fork_callback; i++)
+	fork_callbacks[i] ();
+}
+
 rep_bool
 rep_proc_periodically (void)
 {
@@ -395,94 +768,346 @@ rep_proc_periodically (void)
     return ret;
 }
 
-/* Wait for input for no longer than TIMEOUT-MSECS for input fds defined
-   by INPUTS. If input arrived return the number of ready fds, with the
-   actual fds defined by the fdset INPUTS. Return zero if the timeout
-   was reached. */
+/* True if FD is one of the NFDS fds in FDS, or when FDS is null, if it
+   is registered. */
+static rep_bool
+input_wanted_p (int fd, const int *fds, int nfds)
+{
+    if (fds == 0)
+	return fd < input_slots_size && input_slots[fd].action != 0;
+    else
+    {
+	int i;
+	for (i = 0; i < nfds; i++)
+	{
+	    if (fds[i] == fd)
+		return rep_TRUE;
+	}
+	return rep_FALSE;
+    }
+}
+
+/* Store up to MAX-READY of the wanted fds that can be handled without
+   waiting in READY. Returns the number stored. */
 static int
-wait_for_input(fd_set *inputs, unsigned long timeout_msecs)
+collect_pending_input (const int *fds, int nfds, int *ready, int max_ready)
 {
-    fd_set copy;
-    int ready = -1;
+    int i, count = 0;
 
-    if(input_pending_count > 0)
+    for (i = 0; i < input_pending_count && count < max_ready; i++)
     {
-	/* Check the pending inputs first.. */
-	fd_set out;
-	int i, count = 0, seen = 0;
-	for(i = 0; seen < input_pending_count && i < FD_SETSIZE; i++)
+	if (input_wanted_p (pending_fds[i], fds, nfds))
+	    ready[count++] = pending_fds[i];
+    }
+
+    if (always_ready_count > 0)
+    {
+	for (i = 0; i < input_fd_count && count < max_ready; i++)
 	{
-	    if(FD_ISSET(i, &input_pending))
+	    int fd = input_fds[i];
+	    if (input_slots[fd].always_ready && !input_slots[fd].pending
+		&& input_wanted_p (fd, fds, nfds))
 	    {
-		seen++;
-		if(FD_ISSET(i, inputs))
-		{
-		    if(count == 0)
-			FD_ZERO(&out);
-		    FD_SET(i, &out);
-		    count++;
-		}
+		ready[count++] = fd;
 	    }
 	}
-	if(count > 0)
+    }
+
+    return count;
+}
+
+/* Call the output callbacks of the N fds in FDS. */
+static void
+dispatch_output (const int *fds, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+	/* Earlier callbacks may have deregistered this fd */
+	if (input_slots[fds[i]].out_action != 0)
+	    input_slots[fds[i]].out_action (fds[i]);
+    }
+}
+
+/* Wait no longer than MSECS for input on the NFDS fds in FDS, or for
+   any fd registered for output to become writable. Stores up to
+   MAX-READY of the fds with input in READY, returning their number, or
+   zero if there was none, or -1 for an error. The output callbacks of
+   the writable fds are called, *OUTPUTS is set to their number. */
+static int
+poll_fds (const int *fds, int nfds, int *ready, int max_ready, int msecs,
+	  int *outputs)
+{
+    int out_ready[MAX_READY];
+    int n, i, count = 0, out_count = 0;
+#ifdef USE_POLL
+    struct pollfd stack_pfds[MAX_READY], *pfds = stack_pfds;
+    int total = nfds + output_fd_count;
+
+    if (total > MAX_READY)
+    {
+	pfds = rep_alloc (total * sizeof (struct pollfd));
+	if (pfds == 0)
 	{
-	    memcpy(inputs, &out, sizeof(out));
-	    return count;
+	    errno = ENOMEM;
+	    return -1;
+	}
+    }
+    for (i = 0; i < nfds; i++)
+    {
+	pfds[i].fd = fds[i];
+	pfds[i].events = POLLIN;
+	pfds[i].revents = 0;
+    }
+    for (i = 0; i < output_fd_count; i++)
+    {
+	pfds[nfds + i].fd = output_fds[i];
+	pfds[nfds + i].events = POLLOUT;
+	pfds[nfds + i].revents = 0;
+    }
+
+    n = poll (pfds, total, msecs);
+
+    for (i = 0; n > 0 && i < nfds && count < max_ready; i++)
+    {
+	if (pfds[i].revents != 0)
+	    ready[count++] = fds[i];
+    }
+    for (i = nfds; n > 0 && i < total && out_count < MAX_READY; i++)
+    {
+	if (pfds[i].revents != 0)
+	    out_ready[out_count++] = pfds[i].fd;
+    }
+    if (pfds != stack_pfds)
+	rep_free (pfds);
+#else
+    fd_set set, out_set;
+    struct timeval timeout;
+    int max_fd = -1;
+
+    FD_ZERO (&set);
+    for (i = 0; i < nfds; i++)
+    {
+	if (fds[i] < FD_SETSIZE)
+	{
+	    FD_SET (fds[i], &set);
+	    max_fd = MAX (max_fd, fds[i]);
+	}
+    }
+    FD_ZERO (&out_set);
+    for (i = 0; i < output_fd_count; i++)
+    {
+	if (output_fds[i] < FD_SETSIZE)
+	{
+	    FD_SET (output_fds[i], &out_set);
+	    max_fd = MAX (max_fd, output_fds[i]);
+	}
+    }
+    timeout.tv_sec = msecs / 1000;
+    timeout.tv_usec = (msecs % 1000) * 1000;
+
+    n = select (max_fd + 1, &set, &out_set, NULL, &timeout);
+
+    for (i = 0; n > 0 && i < nfds && count < max_ready; i++)
+    {
+	if (fds[i] < FD_SETSIZE && FD_ISSET (fds[i], &set))
+	    ready[count++] = fds[i];
+    }
+    for (i = 0; n > 0 && i < output_fd_count && out_count < MAX_READY; i++)
+    {
+	if (output_fds[i] < FD_SETSIZE && FD_ISSET (output_fds[i], &out_set))
+	    out_ready[out_count++] = output_fds[i];
+    }
+#endif
+    dispatch_output (out_ready, out_count);
+    *outputs = out_count;
+    return n > 0 ? count : n;
+}
+
+/* Wait no longer than MSECS for input on any registered fd, otherwise
+   like poll_fds (). */
+static int
+poller_wait (int *ready, int max_ready, int msecs, int *outputs)
+{
+#if defined (USE_EPOLL)
+    if (poller_fd >= 0)
+    {
+	struct epoll_event events[MAX_READY];
+	int out_ready[MAX_READY];
+	int i, n, count = 0, out_count = 0;
+
+	n = epoll_wait (poller_fd, events, MIN (max_ready, MAX_READY), msecs);
+	for (i = 0; i < n; i++)
+	{
+	    int fd = events[i].data.fd;
+	    if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		&& input_slots[fd].action != 0)
+	    {
+		ready[count++] = fd;
+	    }
+	    if ((events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		&& input_slots[fd].out_action != 0)
+	    {
+		out_ready[out_count++] = fd;
+	    }
+	}
+	dispatch_output (out_ready, out_count);
+	*outputs = out_count;
+	return n > 0 ? count : n;
+    }
+#elif defined (USE_KQUEUE)
+    if (poller_fd >= 0)
+    {
+	struct kevent events[MAX_READY];
+	int out_ready[MAX_READY];
+	struct timespec timeout;
+	int i, n, count = 0, out_count = 0;
+
+	timeout.tv_sec = msecs / 1000;
+	timeout.tv_nsec = (msecs % 1000) * 1000000;
+	n = kevent (poller_fd, 0, 0, events,
+		    MIN (max_ready, MAX_READY), &timeout);
+	for (i = 0; i < n; i++)
+	{
+	    if (events[i].filter == EVFILT_WRITE)
+		out_ready[out_count++] = events[i].ident;
+	    else
+		ready[count++] = events[i].ident;
 	}
+	dispatch_output (out_ready, out_count);
+	*outputs = out_count;
+	return n > 0 ? count : n;
+    }
+#endif
+    return poll_fds (input_fds, input_fd_count, ready, max_ready, msecs,
+		     outputs);
+}
+
+/* Call rep_wait_for_input_fun, which wants an fd_set of inputs. */
+static int
+wait_using_hook (const int *fds, int nfds, int *ready, int max_ready,
+		 unsigned long timeout_msecs)
+{
+    fd_set set;
+    int i, n, count = 0;
+
+    if (fds == 0)
+    {
+	fds = input_fds;
+	nfds = input_fd_count;
+    }
+
+    FD_ZERO (&set);
+    for (i = 0; i < nfds; i++)
+    {
+	if (fds[i] < FD_SETSIZE)
+	    FD_SET (fds[i], &set);
+    }
+
+    n = (*rep_wait_for_input_fun) (&set, timeout_msecs);
+
+    for (i = 0; n > 0 && i < nfds && count < max_ready; i++)
+    {
+	if (fds[i] < FD_SETSIZE && FD_ISSET (fds[i], &set))
+	    ready[count++] = fds[i];
+    }
+    return n > 0 ? count : n;
+}
+
+/* Wait for input for no longer than TIMEOUT-MSECS for the NFDS input
+   fds in FDS, or for all registered fds if FDS is null. If input
+   arrived store (up to MAX-READY of) the fds with input in READY, and
+   return their number. Return zero if the timeout was reached. */
+static int
+wait_for_input(const int *fds, int nfds, int *ready, int max_ready,
+	       unsigned long timeout_msecs)
+{
+    int count = -1;
+
+    if(input_pending_count > 0 || always_ready_count > 0)
+    {
+	/* Check the pending inputs first.. */
+	count = collect_pending_input (fds, nfds, ready, max_ready);
+	if (count > 0)
+	    return count;
+	count = -1;
     }
 
     /* Allow embedders to override this part of the function. */
 
     if (rep_wait_for_input_fun != 0)
-	return (*rep_wait_for_input_fun) (inputs, timeout_msecs);
+	return wait_using_hook (fds, nfds, ready, max_ready, timeout_msecs);
 
     /* Break the timeout into one-second chunks, then check for
-       interrupt between each call to select. */
+       interrupt between each wait. */
     do {
-	struct timeval timeout;
+	rep_long_long started = rep_utime ();
+	int outputs = 0;
 	unsigned long max_sleep = rep_max_sleep_for ();
 	unsigned long this_timeout_msecs = MIN (timeout_msecs,
 					 rep_input_timeout_secs * 1000);
 	unsigned long actual_timeout_msecs = MIN (this_timeout_msecs, max_sleep);
 
-	timeout.tv_sec = actual_timeout_msecs / 1000;
-	timeout.tv_usec = (actual_timeout_msecs % 1000) * 1000;
-	memcpy (&copy, inputs, sizeof (copy));
-
-	/* Dont test for interrupts before the first call to select() */
-	if (ready == 0)
+	/* Dont test for interrupts before the first wait */
+	if (count == 0)
 	{
 	    rep_TEST_INT_SLOW;
 	    if (rep_INTERRUPTP)
 		break;
 	}
 
-	/* Don't want select() to restart after a SIGCHLD or SIGALRM;
+	/* Don't want the wait to restart after a SIGCHLD or SIGALRM;
 	   there may be a notification to dispatch.  */
 	rep_sig_restart(SIGCHLD, rep_FALSE);
 	rep_sig_restart(SIGALRM, rep_FALSE);
-	ready = select(FD_SETSIZE, &copy, NULL, NULL, &timeout);
+	if (rep_wait_sample_fun != 0)
+	    (*rep_wait_sample_fun) ();
+	if (fds == 0)
+	{
+	    count = poller_wait (ready, max_ready, actual_timeout_msecs,
+				 &outputs);
+	}
+	else
+	{
+	    count = poll_fds (fds, nfds, ready, max_ready,
+			      actual_timeout_msecs, &outputs);
+	}
+	if (rep_wait_sample_fun != 0)
+	    (*rep_wait_sample_fun) ();
 	rep_sig_restart(SIGALRM, rep_TRUE);
 	rep_sig_restart(SIGCHLD, rep_TRUE);
 
-	if (ready == 0 && actual_timeout_msecs < this_timeout_msecs)
+	if (count == 0 && outputs > 0)
+	{
+	    /* Only output was handled, keep waiting for the rest of
+	       the time */
+	    unsigned long elapsed = (rep_utime () - started) / 1000;
+	    if (rep_throw_value != rep_NULL || output_wants_dispatch)
+	    {
+		output_wants_dispatch = rep_FALSE;
+		break;
+	    }
+	    timeout_msecs -= MIN (elapsed, timeout_msecs);
+	    continue;
+	}
+
+	if (count == 0 && actual_timeout_msecs < this_timeout_msecs)
 	{
 	    Fthread_suspend (Qnil, rep_MAKE_INT (this_timeout_msecs
 						 - actual_timeout_msecs));
 	}
 	
 	timeout_msecs -= this_timeout_msecs;
-    } while (ready == 0 && timeout_msecs > 0);
+    } while (count == 0 && timeout_msecs > 0);
 
-    memcpy (inputs, &copy, sizeof (copy));
-    return ready;
+    return count;
 }
 
-/* Handle the READY fds with pending input (defined by fdset INPUTS).
+/* Handle the READY fds with pending input (stored in READY-FDS).
    Return true if the display might require updating. Returns immediately
    if a Lisp error has occurred. */
 static rep_bool
-handle_input(fd_set *inputs, int ready)
+handle_input(const int *ready_fds, int ready)
 {
     static long idle_period;
     rep_bool refreshp = rep_FALSE;
@@ -493,21 +1118,19 @@ handle_input(fd_set *inputs, int ready)
 
 	idle_period = 0;
 
-	for(i = 0; i < FD_SETSIZE && ready > 0 && !rep_INTERRUPTP; i++)
+	for(i = 0; i < ready && !rep_INTERRUPTP; i++)
 	{
-	    if(FD_ISSET(i, inputs))
+	    int fd = ready_fds[i];
+
+	    /* Earlier callbacks may have deregistered this fd */
+	    if (fd >= input_slots_size)
+		continue;
+	    if (input_slots[fd].pending)
+		clear_input_pending (fd);
+	    if (input_slots[fd].action != NULL)
 	    {
-		ready--;
-		if(FD_ISSET(i, &input_pending))
-		{
-		    FD_CLR(i, &input_pending);
-		    input_pending_count--;
-		}
-		if(input_actions[i] != NULL)
-		{
-		    input_actions[i](i);
-		    refreshp = rep_TRUE;
-		}
+		input_slots[fd].action (fd);
+		refreshp = rep_TRUE;
 	    }
 	}
     }
@@ -539,13 +1162,13 @@ rep_event_loop(void)
     {
 	int ready;
 	rep_bool refreshp = rep_FALSE;
-	fd_set copy;
+	int ready_fds[MAX_READY];
 
 	if (rep_throw_value == rep_NULL)
 	{
-	    memcpy(&copy, &input_fdset, sizeof(copy));
-	    ready = wait_for_input(&copy, rep_input_timeout_secs * 1000);
-	    refreshp = handle_input(&copy, ready);
+	    ready = wait_for_input(0, 0, ready_fds, MAX_READY,
+				   rep_input_timeout_secs * 1000);
+	    refreshp = handle_input(ready_fds, ready);
 	}
 
 	/* Check for exceptional conditions. */
@@ -567,18 +1190,32 @@ rep_event_loop(void)
 repv
 rep_sit_for(unsigned long timeout_msecs)
 {
-    fd_set copy;
+    int ready_fds[MAX_READY];
     int ready;
     if(timeout_msecs != 0 && rep_redisplay_fun != 0)
 	(*rep_redisplay_fun)();
-    memcpy(&copy, &input_fdset, sizeof(copy));
-    ready = wait_for_input(&copy, timeout_msecs);
+    ready = wait_for_input(0, 0, ready_fds, MAX_READY, timeout_msecs);
     if(rep_INTERRUPTP)
 	return rep_NULL;
     else
 	return (ready > 0) ? Qnil : Qt;
 }
 
+/* Wait for input on the NFDS fds in FDS, and handle it. */
+static repv
+accept_input (const int *fds, int nfds, unsigned long timeout_msecs)
+{
+    int ready_fds[MAX_READY];
+    int ready;
+    ready = wait_for_input(fds, nfds, ready_fds, MAX_READY, timeout_msecs);
+    if(ready > 0 && !rep_INTERRUPTP)
+	handle_input(ready_fds, ready);
+    if(rep_INTERRUPTP)
+	return rep_NULL;
+    else
+	return ready > 0 ? Qnil : Qt;
+}
+
 /* Wait TIMEOUT_MSECS for input, ignoring any input fds that would
    invoke any callback function except CALLBACKS. Return Qnil if any
    input was serviced, Qt if the timeout expired, rep_NULL for an error. */
@@ -586,31 +1223,31 @@ repv
 rep_accept_input_for_callbacks (unsigned long timeout_msecs, int ncallbacks,
 				void (**callbacks)(int))
 {
-    fd_set copy;
-    int ready, i;
-    FD_ZERO(&copy);
-    for(i = 0; i < FD_SETSIZE; i++)
+    int stack_fds[MAX_READY] = { 0 }, *fds = stack_fds;
+    int nfds = 0, i;
+    repv ret;
+    if (input_fd_count > MAX_READY)
+    {
+	fds = rep_alloc (input_fd_count * sizeof (int));
+	if (fds == 0)
+	    return rep_mem_error ();
+    }
+    for(i = 0; i < input_fd_count; i++)
     {
-	if(FD_ISSET(i, &input_fdset))
+	int j;
+	for (j = 0; j < ncallbacks; j++)
 	{
-	    int j;
-	    for (j = 0; j < ncallbacks; j++)
+	    if (input_slots[input_fds[i]].action == callbacks[j])
 	    {
-		if (input_actions[i] == callbacks[j])
-		{
-		    FD_SET(i, &copy);
-		    break;
-		}
+		fds[nfds++] = input_fds[i];
+		break;
 	    }
 	}
     }
-    ready = wait_for_input(&copy, timeout_msecs);
-    if(ready > 0 && !rep_INTERRUPTP)
-	handle_input(&copy, ready);
-    if(rep_INTERRUPTP)
-	return rep_NULL;
-    else
-	return ready > 0 ? Qnil : Qt;
+    ret = accept_input (fds, nfds, timeout_msecs);
+    if (fds != stack_fds)
+	rep_free (fds);
+    return ret;
 }
 
 /* Wait TIMEOUT_MSECS for input from the NFDS file descriptors stored in FDS.
@@ -619,21 +1256,24 @@ rep_accept_input_for_callbacks (unsigned long timeout_msecs, int ncallbacks,
 repv
 rep_accept_input_for_fds (unsigned long timeout_msecs, int nfds, int *fds)
 {
-    fd_set copy;
-    int ready, i;
-    FD_ZERO(&copy);
+    int stack_fds[MAX_READY] = { 0 }, *wanted = stack_fds;
+    int nwanted = 0, i;
+    repv ret;
+    if (nfds > MAX_READY)
+    {
+	wanted = rep_alloc (nfds * sizeof (int));
+	if (wanted == 0)
+	    return rep_mem_error ();
+    }
     for(i = 0; i < nfds; i++)
     {
-	if(FD_ISSET(fds[i], &input_fdset))
-	    FD_SET(fds[i], &copy);
+	if(input_wanted_p (fds[i], 0, 0))
+	    wanted[nwanted++] = fds[i];
     }
-    ready = wait_for_input(&copy, timeout_msecs);
-    if(ready > 0 && !rep_INTERRUPTP)
-	handle_input(&copy, ready);
-    if(rep_INTERRUPTP)
-	return rep_NULL;
-    else
-	return ready > 0 ? Qnil : Qt;
+    ret = accept_input (wanted, nwanted, timeout_msecs);
+    if (wanted != stack_fds)
+	rep_free (wanted);
+    return ret;
 }
 
 /* obsolete, for compatibility only */
@@ -646,10 +1286,8 @@ rep_accept_input(unsigned long timeout_msecs, void (*callback)(int))
 rep_bool
 rep_poll_input(int fd)
 {
-    fd_set in;
-    FD_ZERO(&in);
-    FD_SET(fd, &in);
-    return wait_for_input(&in, 0);
+    int ready;
+    return wait_for_input(&fd, 1, &ready, 1, 0) > 0;
 }
 
 
@@ -872,9 +1510,6 @@ usr_signal_handler (int sig)
 void
 rep_pre_sys_os_init(void)
 {
-    FD_ZERO(&input_fdset);
-    FD_ZERO(&input_pending);
-
     /* First the error signals */
 #ifndef IGNORE_FATAL_SIGNALS
 #ifdef SIGFPE
@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef NEED_MEMORY_H
 # include <memory.h>
@@ -78,6 +79,11 @@
 # endif
 #endif
 
+#if defined (HAVE_SPAWN_H) && defined (HAVE_POSIX_SPAWNP)
+# include <spawn.h>
+# define USE_POSIX_SPAWN
+#endif
+
 #ifdef ENVIRON_UNDECLARED
   extern char **environ;
 #endif
@@ -93,6 +99,10 @@ struct Proc
     struct Proc *pr_Next;
     /* Chain of all processes waiting to be notified of a change of state. */
     struct Proc *pr_NotifyNext;
+    /* Chain of active processes whose pids hash to the same bucket. */
+    struct Proc *pr_PidNext;
+    /* Chain of processes whose write function is waiting to be called. */
+    struct Proc *pr_DrainNext;
     pid_t	pr_Pid;
     /* pr_Stdin is where we write, pr_Stdout where we read, they may be the
        same.  pr_Stderr is only used with pipes--it may be a separate
@@ -106,12 +116,19 @@ struct Proc
     repv	pr_Args;
     repv	pr_Dir;
     repv	pr_ConnType;
+    /* Input for the process that couldn't be written to pr_Stdin yet,
+       and the function to call once it all has been. */
+    char	*pr_OutBuf;
+    size_t	pr_OutLen, pr_OutSize;
+    repv	pr_WriteFun;
 };
 
 /* Status is two bits above the type code (presently 8->9) */
 #define PR_ACTIVE  (1 << (rep_CELL16_TYPE_BITS + 0))	/* active, may be stopped */
 #define PR_STOPPED (2 << (rep_CELL16_TYPE_BITS + 1))	/* stopped */
 #define PR_DEAD    0
+#define PR_FLUSHING (1 << (rep_CELL16_TYPE_BITS + 3)) /* waiting on pr_Stdin */
+#define PR_DRAIN_QUEUED (1 << (rep_CELL16_TYPE_BITS + 4))
 #define PR_RUNNING PR_ACTIVE
 
 #define PR_ACTIVE_P(p)  ((p)->pr_Car & PR_ACTIVE)
@@ -148,8 +165,26 @@ DEFSYM(socketpair, "socketpair");
 
 static struct Proc *process_chain;
 static struct Proc *notify_chain;
+static struct Proc *drain_chain;
 static int process_run_count;
 
+/* Writing to a process without a write function waits once more than
+   this many bytes of its input are queued. */
+static int output_high_water = 65536;
+
+/* Maps each fd being read from by the event loop to its process, so
+   that dispatching input doesn't have to search process_chain. */
+static struct Proc **fd_table;
+static int fd_table_size;
+
+/* Hash table of all active processes, keyed by pid. Used to find
+   reaped children and to mark the processes that are running. The
+   number of buckets is a power of two, grown as processes start. */
+static struct Proc **pid_table;
+static unsigned int pid_table_size, pid_table_count;
+
+#define PID_BUCKET(pid) ((unsigned int) (pid) & (pid_table_size - 1))
+
 static int process_type;
 
 /* Set to rep_TRUE by the SIGCHLD handler */
@@ -182,21 +217,148 @@ sigchld_handler(int sig)
 	(*rep_sigchld_fun) ();
 }
 
+static void
+set_fd_proc(int fd, struct Proc *pr)
+{
+    if(fd >= fd_table_size)
+    {
+	int new_size = fd_table_size ? fd_table_size : 64;
+	struct Proc **new_table;
+	while(new_size <= fd)
+	    new_size *= 2;
+	new_table = rep_realloc(fd_table, new_size * sizeof(struct Proc *));
+	memset(new_table + fd_table_size, 0,
+	       (new_size - fd_table_size) * sizeof(struct Proc *));
+	fd_table = new_table;
+	fd_table_size = new_size;
+    }
+    fd_table[fd] = pr;
+}
+
+/* Start dispatching input on FD to PR. */
+static void
+register_proc_fd(struct Proc *pr, int fd)
+{
+    set_fd_proc(fd, pr);
+    rep_register_input_fd(fd, read_from_process);
+}
+
+static void
+deregister_proc_fd(int fd)
+{
+    if(fd < fd_table_size)
+	fd_table[fd] = 0;
+    rep_deregister_input_fd(fd);
+}
+
+/* Enter the running process PR into the pid table. */
+static void
+add_running_proc(struct Proc *pr)
+{
+    unsigned int i;
+    if(pid_table_count >= pid_table_size)
+    {
+	unsigned int old_size = pid_table_size;
+	struct Proc **old_table = pid_table;
+	pid_table_size = old_size ? old_size * 2 : 32;
+	pid_table = rep_alloc(pid_table_size * sizeof(struct Proc *));
+	memset(pid_table, 0, pid_table_size * sizeof(struct Proc *));
+	for(i = 0; i < old_size; i++)
+	{
+	    struct Proc *x = old_table[i];
+	    while(x != 0)
+	    {
+		struct Proc *next = x->pr_PidNext;
+		x->pr_PidNext = pid_table[PID_BUCKET(x->pr_Pid)];
+		pid_table[PID_BUCKET(x->pr_Pid)] = x;
+		x = next;
+	    }
+	}
+	if(old_table != 0)
+	    rep_free(old_table);
+    }
+    i = PID_BUCKET(pr->pr_Pid);
+    pr->pr_PidNext = pid_table[i];
+    pid_table[i] = pr;
+    pid_table_count++;
+}
+
+static void
+remove_running_proc(struct Proc *pr)
+{
+    struct Proc **ptr;
+    if(pid_table_size == 0)
+	return;
+    for(ptr = &pid_table[PID_BUCKET(pr->pr_Pid)]; *ptr != 0;
+	ptr = &((*ptr)->pr_PidNext))
+    {
+	if(*ptr == pr)
+	{
+	    *ptr = pr->pr_PidNext;
+	    pr->pr_PidNext = 0;
+	    pid_table_count--;
+	    return;
+	}
+    }
+}
+
+static struct Proc *
+find_running_proc(pid_t pid)
+{
+    struct Proc *pr;
+    if(pid_table_size == 0)
+	return 0;
+    for(pr = pid_table[PID_BUCKET(pid)]; pr != 0; pr = pr->pr_PidNext)
+    {
+	if(pr->pr_Pid == pid)
+	    return pr;
+    }
+    return 0;
+}
+
+static void
+stop_flushing(struct Proc *pr)
+{
+    if(pr->pr_Car & PR_FLUSHING)
+    {
+	rep_deregister_output_fd(pr->pr_Stdin);
+	pr->pr_Car &= ~PR_FLUSHING;
+    }
+}
+
+/* Throw away any queued input for PR. */
+static void
+discard_proc_output(struct Proc *pr)
+{
+    stop_flushing(pr);
+    if(pr->pr_OutBuf != 0)
+    {
+	rep_free(pr->pr_OutBuf);
+	pr->pr_OutBuf = 0;
+    }
+    pr->pr_OutLen = pr->pr_OutSize = 0;
+}
+
 static void
 close_proc_files(struct Proc *pr)
 {
+    discard_proc_output(pr);
     if(pr->pr_Stdout)
     {
-	rep_deregister_input_fd(pr->pr_Stdout);
+	deregister_proc_fd(pr->pr_Stdout);
 	close(pr->pr_Stdout);
     }
     if(pr->pr_Stderr && pr->pr_Stderr != pr->pr_Stdout)
     {
-	rep_deregister_input_fd(pr->pr_Stderr);
+	deregister_proc_fd(pr->pr_Stderr);
 	close(pr->pr_Stderr);
     }
     if(pr->pr_Stdin && (pr->pr_Stdin != pr->pr_Stdout))
+    {
+	if(pr->pr_Stdin < fd_table_size && fd_table[pr->pr_Stdin] == pr)
+	    fd_table[pr->pr_Stdin] = 0;
 	close(pr->pr_Stdin);
+    }
     pr->pr_Stdout = pr->pr_Stdin = pr->pr_Stderr = 0;
 }
     
@@ -229,6 +391,35 @@ proc_notification(void)
     return rep_TRUE;
 }
 
+/* PR's WriteFun will be called when possible. */
+static void
+queue_drain(struct Proc *pr)
+{
+    if(!(pr->pr_Car & PR_DRAIN_QUEUED))
+    {
+	pr->pr_Car |= PR_DRAIN_QUEUED;
+	pr->pr_DrainNext = drain_chain;
+	drain_chain = pr;
+    }
+}
+
+static rep_bool
+proc_drain_notification(void)
+{
+    if(!drain_chain)
+	return rep_FALSE;
+    while(drain_chain != NULL && !rep_INTERRUPTP)
+    {
+	struct Proc *pr = drain_chain;
+	drain_chain = pr->pr_DrainNext;
+	pr->pr_DrainNext = NULL;
+	pr->pr_Car &= ~PR_DRAIN_QUEUED;
+	if(pr->pr_WriteFun && !rep_NILP(pr->pr_WriteFun))
+	    rep_call_lisp1(pr->pr_WriteFun, rep_VAL(pr));
+    }
+    return rep_TRUE;
+}
+
 static inline rep_bool
 notify_queued_p (struct Proc *pr)
 {
@@ -268,38 +459,35 @@ check_for_zombies(void)
 	if(pid > 0)
 	{
 	    /* Got a process id, find its process structure. */
-	    for(pr = process_chain; pr != 0; pr = pr->pr_Next)
+	    pr = find_running_proc(pid);
+	    if(pr != 0)
 	    {
-		if(PR_ACTIVE_P(pr) && (pr->pr_Pid == pid))
-		{
-		    /* Got it. */
 #ifdef WIFSTOPPED
-		    if(WIFSTOPPED(status))
-		    {
-			/* Process is suspended. */
-			PR_SET_STATUS(pr, PR_ACTIVE | PR_STOPPED);
-			queue_notify(pr);
-		    }
-		    else
+		if(WIFSTOPPED(status))
+		{
+		    /* Process is suspended. */
+		    PR_SET_STATUS(pr, PR_ACTIVE | PR_STOPPED);
+		    queue_notify(pr);
+		}
+		else
 #endif
-		    {
-			/* Process is dead. */
-			pr->pr_ExitStatus = status;
-			process_run_count--;
-			PR_SET_STATUS(pr, PR_DEAD);
+		{
+		    /* Process is dead. */
+		    pr->pr_ExitStatus = status;
+		    process_run_count--;
+		    PR_SET_STATUS(pr, PR_DEAD);
+		    remove_running_proc(pr);
 
-			/* Try to read any pending output */
-			if(pr->pr_Stdout)
-			    read_from_one_fd(pr, pr->pr_Stdout);
-			if(pr->pr_Stderr && pr->pr_Stderr != pr->pr_Stdout)
-			    read_from_one_fd(pr, pr->pr_Stderr);
+		    /* Try to read any pending output */
+		    if(pr->pr_Stdout)
+			read_from_one_fd(pr, pr->pr_Stdout);
+		    if(pr->pr_Stderr && pr->pr_Stderr != pr->pr_Stdout)
+			read_from_one_fd(pr, pr->pr_Stderr);
 
-			/* Then close the streams */
-			close_proc_files(pr);
+		    /* Then close the streams */
+		    close_proc_files(pr);
 
-			queue_notify(pr);
-		    }
-		    break;
+		    queue_notify(pr);
 		}
 	    }
 	}
@@ -322,6 +510,8 @@ static rep_bool
 proc_periodically(void)
 {
     rep_bool rc = check_for_zombies();
+    if(proc_drain_notification())
+	rc = rep_TRUE;
     if(proc_notification())
 	rc = rep_TRUE;
     return rc;
@@ -349,7 +539,7 @@ read_from_one_fd(struct Proc *pr, int fd)
     {
 	/* We assume EOF  */
 
-	rep_deregister_input_fd(fd);
+	deregister_proc_fd(fd);
 	close(fd);
 
 	/* Could be either pr_Stdout or pr_Stderr */
@@ -358,7 +548,10 @@ read_from_one_fd(struct Proc *pr, int fd)
 	else
 	{
 	    if(pr->pr_Stdin && (pr->pr_Stdin == pr->pr_Stdout))
+	    {
+		discard_proc_output(pr);
 		pr->pr_Stdin = 0;
+	    }
 	    if(pr->pr_Stderr && (pr->pr_Stderr == pr->pr_Stdout))
 		pr->pr_Stderr = 0;
 	    pr->pr_Stdout = 0;
@@ -369,49 +562,178 @@ read_from_one_fd(struct Proc *pr, int fd)
 static void
 read_from_process(int fd)
 {
-    struct Proc *pr;
-    pr = process_chain;
-    while(pr)
+    struct Proc *pr = (fd < fd_table_size) ? fd_table[fd] : 0;
+    if(pr != 0 && PR_ACTIVE_P(pr)
+       && (pr->pr_Stdout == fd || pr->pr_Stderr == fd))
+	read_from_one_fd(pr, fd);
+}
+
+/* Input queueing
+
+   Input for a process is written to its (non-blocking) stdin as soon
+   as possible. Whatever the process isn't ready to accept is appended
+   to pr_OutBuf, and the event loop writes it once pr_Stdin becomes
+   writable, before queueing a call to the process' write function.
+   Lisp code can use that function to feed a process incrementally;
+   without one, writing waits while more than OUTPUT-HIGH-WATER bytes
+   of input are queued. */
+
+static rep_bool
+buffer_proc_output(struct Proc *pr, const char *data, size_t len)
+{
+    if(pr->pr_OutLen + len > pr->pr_OutSize)
+    {
+	size_t new_size = MAX(pr->pr_OutSize * 2, 1024);
+	char *new;
+	while(new_size < pr->pr_OutLen + len)
+	    new_size *= 2;
+	new = (pr->pr_OutBuf == 0 ? rep_alloc(new_size)
+	       : rep_realloc(pr->pr_OutBuf, new_size));
+	if(new == 0)
+	    return rep_FALSE;
+	pr->pr_OutBuf = new;
+	pr->pr_OutSize = new_size;
+    }
+    memcpy(pr->pr_OutBuf + pr->pr_OutLen, data, len);
+    pr->pr_OutLen += len;
+    return rep_TRUE;
+}
+
+/* Write as much of the queued input of PR followed by LEN bytes from
+   DATA as possible without blocking, queueing the rest. Returns false
+   with errno set if an error occurred. */
+static rep_bool
+push_proc_output(struct Proc *pr, const char *data, size_t len)
+{
+    struct iovec iov[2];
+    int n = 0;
+    ssize_t actual;
+
+    if(pr->pr_OutLen > 0)
+    {
+	iov[n].iov_base = pr->pr_OutBuf;
+	iov[n].iov_len = pr->pr_OutLen;
+	n++;
+    }
+    if(len > 0)
+    {
+	iov[n].iov_base = (char *) data;
+	iov[n].iov_len = len;
+	n++;
+    }
+    if(n == 0)
+	return rep_TRUE;
+
+    do {
+	actual = writev(pr->pr_Stdin, iov, n);
+    } while(actual < 0 && errno == EINTR);
+
+    if(actual < 0)
+    {
+	if(errno != EAGAIN && errno != EWOULDBLOCK)
+	    return rep_FALSE;
+	actual = 0;
+    }
+
+    if((size_t) actual >= pr->pr_OutLen)
+    {
+	actual -= pr->pr_OutLen;
+	pr->pr_OutLen = 0;
+	data += actual;
+	len -= actual;
+    }
+    else
+    {
+	memmove(pr->pr_OutBuf, pr->pr_OutBuf + actual,
+		pr->pr_OutLen - actual);
+	pr->pr_OutLen -= actual;
+    }
+
+    if(len > 0 && !buffer_proc_output(pr, data, len))
+    {
+	errno = ENOMEM;
+	return rep_FALSE;
+    }
+    return rep_TRUE;
+}
+
+/* Write all queued input of PR, blocking if necessary. */
+static rep_bool
+flush_proc_output(struct Proc *pr)
+{
+    while(pr->pr_OutLen > 0)
+    {
+	if(!push_proc_output(pr, 0, 0))
+	    return rep_FALSE;
+	if(pr->pr_OutLen > 0 && !rep_unix_wait_for_output(pr->pr_Stdin))
+	    return rep_FALSE;
+    }
+    stop_flushing(pr);
+    return rep_TRUE;
+}
+
+static void
+proc_writable(int fd)
+{
+    struct Proc *pr = (fd < fd_table_size) ? fd_table[fd] : 0;
+    if(pr == 0 || pr->pr_Stdin != fd)
+    {
+	rep_deregister_output_fd(fd);
+	return;
+    }
+    if(!push_proc_output(pr, 0, 0))
+    {
+	/* Nobody to tell; the next write will signal the error */
+	discard_proc_output(pr);
+    }
+    else if(pr->pr_OutLen == 0)
     {
-	if(PR_ACTIVE_P(pr) && (pr->pr_Stdout == fd || pr->pr_Stderr == fd))
-	    read_from_one_fd(pr, fd);
-	pr = pr->pr_Next;
+	stop_flushing(pr);
+	queue_drain(pr);
+	rep_output_needs_dispatch();
     }
 }
 
 static int
 write_to_process(repv pr, char *buf, int bufLen)
 {
-    int act = 0;
+    struct Proc *p;
     if(!PROCESSP(pr))
 	return(0);
-    if(PR_ACTIVE_P(VPROC(pr)))
+    p = VPROC(pr);
+    if(!PR_ACTIVE_P(p))
     {
-	if(VPROC(pr)->pr_Stdin == 0)
-	{
-	    Fsignal(Qprocess_error, rep_list_2(pr, rep_VAL(&no_link)));
-	}
-	else
-	{
-	    do {
-		/* This will block */
-		int this = write(VPROC(pr)->pr_Stdin, buf + act, bufLen - act);
-		if (this < 0)
-		{
-		    if (errno != EINTR)
-		    {
-			rep_signal_file_error(pr);
-			break;
-		    }
-		}
-		else
-		    act += this;
-	    } while (act < bufLen);
-	}
-    }
-    else
 	Fsignal(Qprocess_error, rep_list_2(pr, rep_VAL(&not_running)));
-    return(act);
+	return -1;
+    }
+    if(p->pr_Stdin == 0)
+    {
+	Fsignal(Qprocess_error, rep_list_2(pr, rep_VAL(&no_link)));
+	return -1;
+    }
+
+    if(!push_proc_output(p, buf, bufLen)
+       || ((p->pr_WriteFun == rep_NULL || rep_NILP(p->pr_WriteFun))
+	   && p->pr_OutLen > (size_t) output_high_water
+	   && !flush_proc_output(p)))
+    {
+	goto error;
+    }
+
+    if(p->pr_OutLen > 0 && !(p->pr_Car & PR_FLUSHING))
+    {
+	set_fd_proc(p->pr_Stdin, p);
+	if(rep_register_output_fd(p->pr_Stdin, proc_writable))
+	    p->pr_Car |= PR_FLUSHING;
+	else if(!flush_proc_output(p))
+	    goto error;
+    }
+    return bufLen;
+
+error:
+    discard_proc_output(p);
+    rep_signal_file_error(pr);
+    return -1;
 }
 
 static rep_bool
@@ -461,8 +783,10 @@ kill_process(struct Proc *pr)
 	    kill(-pr->pr_Pid, SIGKILL);
 	waitpid(pr->pr_Pid, &pr->pr_ExitStatus, 0);
 	process_run_count--;
+	remove_running_proc(pr);
 	close_proc_files(pr);
     }
+    discard_proc_output(pr);
     rep_FREE_CELL(pr);
 }
 
@@ -525,20 +849,22 @@ none:
     return 0;
 }
 
-static void
-child_build_environ (void)
+/* Returns the environment for new processes built from the value of
+   process-environment, or null if the current one should be used. */
+static char **
+build_environ (void)
 {
-    /* Build the environment */
+    char **env = 0;
     repv tem = Fsymbol_value(Qprocess_environment, Qt);
     if(rep_CONSP(tem))
     {
 	repv len = Flength(tem);
 	if(len && rep_INTP(len))
 	{
-	    environ = rep_alloc(sizeof(char *) * (rep_INT(len) + 1));
-	    if(environ != 0)
+	    env = rep_alloc(sizeof(char *) * (rep_INT(len) + 1));
+	    if(env != 0)
 	    {
-		char **ptr = environ;
+		char **ptr = env;
 		while(rep_CONSP(tem))
 		{
 		    *ptr++ = rep_STR(rep_CAR(tem));
@@ -548,6 +874,117 @@ child_build_environ (void)
 	    }
 	}
     }
+    return env;
+}
+
+static void
+child_build_environ (void)
+{
+    char **env = build_environ ();
+    if (env != 0)
+	environ = env;
+}
+
+#ifdef USE_POSIX_SPAWN
+/* True if ENV has the same search path as the current environment. */
+static rep_bool
+same_path_p (char **env)
+{
+    char *path = getenv ("PATH");
+    for (; *env != 0; env++)
+    {
+	if (strncmp (*env, "PATH=", 5) == 0)
+	    return path != 0 && strcmp (*env + 5, path) == 0;
+    }
+    return path == 0;
+}
+
+/* Start the program ARGV for PR with its standard streams connected to
+   the pipes in STDIN_FDS, STDOUT_FDS and STDERR_FDS (STDIN_FDS[0] only,
+   if SYNC_INPUT), like the child branch of run_process () does. Since
+   posix_spawn () doesn't need to copy our page tables this is much
+   cheaper than fork () when the heap is large. Returns the new pid, or
+   -1 if fork () must be used instead. */
+static pid_t
+spawn_piped_child (struct Proc *pr, char **argv, char *sync_input,
+		   int *stdin_fds, int *stdout_fds, int *stderr_fds)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigdef;
+    char **env;
+    pid_t pid;
+    int err;
+
+    if (rep_STRINGP (pr->pr_Dir) && rep_STRING_LEN (pr->pr_Dir) > 0)
+    {
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	return -1;
+#endif
+    }
+
+    env = build_environ ();
+    if (env != 0 && strchr (argv[0], '/') == 0 && !same_path_p (env))
+    {
+	/* posix_spawnp () would search our PATH, not the child's */
+	rep_free (env);
+	return -1;
+    }
+
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_adddup2 (&actions, stdin_fds[0], 0);
+    posix_spawn_file_actions_addclose (&actions, stdin_fds[0]);
+    if (sync_input == NULL)
+	posix_spawn_file_actions_addclose (&actions, stdin_fds[1]);
+    posix_spawn_file_actions_adddup2 (&actions, stdout_fds[1], 1);
+    posix_spawn_file_actions_adddup2 (&actions, stderr_fds[1], 2);
+    posix_spawn_file_actions_addclose (&actions, stdout_fds[0]);
+    posix_spawn_file_actions_addclose (&actions, stdout_fds[1]);
+    posix_spawn_file_actions_addclose (&actions, stderr_fds[0]);
+    posix_spawn_file_actions_addclose (&actions, stderr_fds[1]);
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+    if (rep_STRINGP (pr->pr_Dir) && rep_STRING_LEN (pr->pr_Dir) > 0)
+	posix_spawn_file_actions_addchdir_np (&actions, rep_STR (pr->pr_Dir));
+#endif
+
+    posix_spawnattr_init (&attr);
+    posix_spawnattr_setflags (&attr, (POSIX_SPAWN_SETPGROUP
+				      | POSIX_SPAWN_SETSIGDEF));
+    posix_spawnattr_setpgroup (&attr, 0);
+    sigemptyset (&sigdef);
+    sigaddset (&sigdef, SIGPIPE);
+    posix_spawnattr_setsigdefault (&attr, &sigdef);
+
+    err = posix_spawnp (&pid, argv[0], &actions, &attr,
+			argv, env != 0 ? env : environ);
+
+    posix_spawnattr_destroy (&attr);
+    posix_spawn_file_actions_destroy (&actions);
+    if (env != 0)
+	rep_free (env);
+
+    /* On failure let a forked child report the error, as usual */
+    return err == 0 ? pid : -1;
+}
+#endif /* USE_POSIX_SPAWN */
+
+/* Create the child process for run_process (), returning zero in the
+   child if it was forked, or its pid in the parent. */
+static pid_t
+start_child (struct Proc *pr, char **argv, char *sync_input,
+	     int *stdin_fds, int *stdout_fds, int *stderr_fds)
+{
+#ifdef USE_POSIX_SPAWN
+    /* Ptys and socketpairs need the child to set itself up */
+    if (PR_CONN_PIPE_P (pr))
+    {
+	pid_t pid = spawn_piped_child (pr, argv, sync_input, stdin_fds,
+				       stdout_fds, stderr_fds);
+	if (pid > 0)
+	    return pid;
+    }
+#endif
+    return fork ();
 }
 
 /* does the dirty stuff of getting the process running. if SYNC_INPUT
@@ -663,7 +1100,8 @@ run_process(struct Proc *pr, char **argv, char *sync_input)
 		}
 	    }
 
-	    switch(pr->pr_Pid = fork())
+	    switch(pr->pr_Pid = start_child(pr, argv, sync_input, stdin_fds,
+					    stdout_fds, stderr_fds))
 	    {
 	    case 0:
 		/* Child process */
@@ -777,6 +1215,7 @@ run_process(struct Proc *pr, char **argv, char *sync_input)
 		if (pty_slave_fd != -1)
 		    close (pty_slave_fd);
 		PR_SET_STATUS(pr, PR_RUNNING);
+		add_running_proc(pr);
 		if (PR_CONN_SOCKETPAIR_P(pr))
 		{
 		    close (stdin_fds[1]);
@@ -801,13 +1240,13 @@ run_process(struct Proc *pr, char **argv, char *sync_input)
 			}
 		    }
 		    rep_unix_set_fd_cloexec(pr->pr_Stdin);
+		    rep_unix_set_fd_nonblocking(pr->pr_Stdin);
 		    rep_unix_set_fd_nonblocking(pr->pr_Stdout);
-		    rep_register_input_fd(pr->pr_Stdout, read_from_process);
+		    register_proc_fd(pr, pr->pr_Stdout);
 		    if(pr->pr_Stderr != pr->pr_Stdout)
 		    {
 			rep_unix_set_fd_nonblocking(pr->pr_Stderr);
-			rep_register_input_fd(pr->pr_Stderr,
-					      read_from_process);
+			register_proc_fd(pr, pr->pr_Stderr);
 		    }
 		    process_run_count++;
 		}
@@ -950,6 +1389,7 @@ run_process(struct Proc *pr, char **argv, char *sync_input)
 		    pr->pr_Stdout = 0;
 		    pr->pr_Stderr = 0;
 		    PR_SET_STATUS(pr, PR_DEAD);
+		    remove_running_proc(pr);
 		    queue_notify(pr);
 		}
 		rc = rep_TRUE;
@@ -974,17 +1414,18 @@ proc_mark(repv pr)
     rep_MARKVAL(VPROC(pr)->pr_Args);
     rep_MARKVAL(VPROC(pr)->pr_Dir);
     rep_MARKVAL(VPROC(pr)->pr_ConnType);
+    rep_MARKVAL(VPROC(pr)->pr_WriteFun);
 }
 
 static void
 mark_active_processes(void)
 {
-    struct Proc *pr = process_chain;
-    while(pr != 0)
+    unsigned int i;
+    for(i = 0; i < pid_table_size; i++)
     {
-	if(PR_ACTIVE_P(pr))
+	struct Proc *pr;
+	for(pr = pid_table[i]; pr != 0; pr = pr->pr_PidNext)
 	    rep_MARKVAL(rep_VAL(pr));
-	pr = pr->pr_Next;
     }
 }
 
@@ -1006,6 +1447,19 @@ proc_sweep(void)
 	pr = pr->pr_NotifyNext;
     }
 
+    pr = drain_chain;
+    drain_chain = NULL;
+    while(pr)
+    {
+	struct Proc *nxt = pr->pr_DrainNext;
+	if(rep_GC_CELL_MARKEDP(rep_VAL(pr)))
+	{
+	    pr->pr_DrainNext = drain_chain;
+	    drain_chain = pr;
+	}
+	pr = nxt;
+    }
+
     /* ...then do the normal sweep stuff.  */
     pr = process_chain;
     process_chain = NULL;
@@ -1071,6 +1525,24 @@ proc_puts(repv stream, void *data, int len, rep_bool is_lisp)
     return write_to_process(stream, buf, len);
 }
 
+/* Let copy-stream write to the process' stdin itself, unless output
+   is being sent asynchronously. */
+static int
+proc_fd(repv stream)
+{
+    struct Proc *p = VPROC(stream);
+    if(!PR_ACTIVE_P(p) || p->pr_Stdin == 0
+       || (p->pr_WriteFun != rep_NULL && !rep_NILP(p->pr_WriteFun)))
+	return -1;
+    if(!flush_proc_output(p))
+    {
+	discard_proc_output(p);
+	rep_signal_file_error(stream);
+	return -1;
+    }
+    return p->pr_Stdin;
+}
+
 DEFUN("make-process", Fmake_process, Smake_process, (repv stream, repv fun, repv dir, repv prog, repv args), rep_Subr5) /*
 ::doc:rep.io.processes#make-process::
 make-process [OUTPUT-STREAM] [FUN] [DIR] [PROGRAM] [ARGS]
@@ -1098,6 +1570,11 @@ If the DIR parameter is nil it will be inherited from the
 	VPROC(pr)->pr_Next = process_chain;
 	process_chain = VPROC(pr);
 	VPROC(pr)->pr_NotifyNext = NULL;
+	VPROC(pr)->pr_PidNext = NULL;
+	VPROC(pr)->pr_DrainNext = NULL;
+	VPROC(pr)->pr_OutBuf = 0;
+	VPROC(pr)->pr_OutLen = VPROC(pr)->pr_OutSize = 0;
+	VPROC(pr)->pr_WriteFun = Qnil;
 	PR_SET_STATUS(VPROC(pr), PR_DEAD);
 	VPROC(pr)->pr_Pid = 0;
 	VPROC(pr)->pr_Stdin = VPROC(pr)->pr_Stdout = 0;
@@ -1131,10 +1608,12 @@ DEFUN("close-process", Fclose_process,
 close-processes [PROCESS]
 
 Closes the stdin, stdout, and stderr streams of the asynchronous process-
-object PROCESS.
+object PROCESS, after writing any of its input that is still queued.
 ::end:: */
 {
     rep_DECLARE1(proc, PROCESSP);
+    if(VPROC(proc)->pr_OutLen > 0 && PR_ACTIVE_P(VPROC(proc)))
+	flush_proc_output(VPROC(proc));
     close_proc_files(VPROC(proc));
     return(Qnil); 
 }
@@ -1812,6 +2291,56 @@ Set the function which is called when PROCESS changes state to FUNCTION.
     return(fn);
 }
 
+DEFUN("process-write-function", Fprocess_write_function, Sprocess_write_function, (repv proc), rep_Subr1) /*
+::doc:rep.io.processes#process-write-function::
+process-write-function PROCESS
+
+Return the function which is called when input for PROCESS that couldn't
+be written immediately has all been written.
+::end:: */
+{
+    rep_DECLARE1(proc, PROCESSP);
+    return VPROC(proc)->pr_WriteFun;
+}
+
+DEFUN("set-process-write-function", Fset_process_write_function, Sset_process_write_function, (repv proc, repv fn), rep_Subr2) /*
+::doc:rep.io.processes#set-process-write-function::
+set-process-write-function PROCESS FUNCTION
+
+Set the write function of PROCESS to FUNCTION. It is called with PROCESS
+as its argument each time input that PROCESS wasn't ready to read has
+all been written to it. While PROCESS has a write function, writing to
+it never waits for the process to read its input.
+::end:: */
+{
+    rep_DECLARE1(proc, PROCESSP);
+    VPROC(proc)->pr_WriteFun = fn;
+    return(fn);
+}
+
+DEFUN("process-output-pending", Fprocess_output_pending, Sprocess_output_pending, (repv proc), rep_Subr1) /*
+::doc:rep.io.processes#process-output-pending::
+process-output-pending PROCESS
+
+Return the number of bytes written to PROCESS that it hasn't yet read.
+::end:: */
+{
+    rep_DECLARE1(proc, PROCESSP);
+    return rep_make_long_uint(VPROC(proc)->pr_OutLen);
+}
+
+DEFUN("process-output-high-water", Fprocess_output_high_water, Sprocess_output_high_water, (repv arg), rep_Subr1) /*
+::doc:rep.io.processes#process-output-high-water::
+process-output-high-water [NEW-VALUE]
+
+When more than this many bytes written to a process without a write
+function are waiting to be read by it, writing waits until it has read
+them all.
+::end:: */
+{
+    return rep_handle_var_int(arg, &output_high_water);
+}
+
 DEFUN("process-dir", Fprocess_dir, Sprocess_dir, (repv proc), rep_Subr1) /*
 ::doc:rep.io.processes#process-dir::
 process-dir PROCESS
@@ -1937,14 +2466,14 @@ Note that output includes notification of process termination.
     rep_DECLARE2_OPT(secs, rep_NUMERICP);
     rep_DECLARE3_OPT(msecs, rep_NUMERICP);
     /* Only wait for output if nothing already waiting. */
-    if(!got_sigchld && !notify_chain)
+    if(!got_sigchld && !notify_chain && !drain_chain)
     {
 	result = (rep_accept_input_for_callbacks
 		  ((rep_get_long_int (secs) * 1000)
 		   + (rep_get_long_int (msecs)),
 		   n_input_handlers, input_handlers));
     }
-    if(got_sigchld || notify_chain)
+    if(got_sigchld || notify_chain || drain_chain)
     {
 	result = Qnil;
 	rep_proc_periodically();
@@ -2069,6 +2598,34 @@ rep_system (char *command)
     }
 }
 
+/* The processes of a forked child's parent aren't its own: forget
+   them and close its copies of their pipes, so that the parent sees
+   them close when it does. */
+static void
+proc_after_fork (void)
+{
+    struct Proc *pr;
+    for(pr = process_chain; pr != 0; pr = pr->pr_Next)
+    {
+	if(PR_ACTIVE_P(pr))
+	{
+	    close_proc_files(pr);
+	    PR_SET_STATUS(pr, PR_DEAD);
+	    pr->pr_ExitStatus = -1;
+	}
+	pr->pr_NotifyNext = 0;
+	pr->pr_DrainNext = 0;
+	pr->pr_PidNext = 0;
+	pr->pr_Car &= ~PR_DRAIN_QUEUED;
+    }
+    notify_chain = drain_chain = 0;
+    if(pid_table != 0)
+	memset(pid_table, 0, pid_table_size * sizeof(struct Proc *));
+    pid_table_count = 0;
+    process_run_count = 0;
+    got_sigchld = rep_FALSE;
+}
+
 void
 rep_proc_init(void)
 {
@@ -2089,6 +2646,8 @@ rep_proc_init(void)
     /* Is this necessary?? Better safe than core-dumped ;-)  */
     signal(SIGPIPE, SIG_IGN);
 
+    rep_add_after_fork_callback(proc_after_fork);
+
     rep_INTERN(pipe);
     rep_INTERN(pty);
     rep_INTERN(socketpair);
@@ -2120,6 +2679,10 @@ rep_proc_init(void)
     rep_ADD_SUBR(Sset_process_error_stream);
     rep_ADD_SUBR(Sprocess_function);
     rep_ADD_SUBR(Sset_process_function);
+    rep_ADD_SUBR(Sprocess_write_function);
+    rep_ADD_SUBR(Sset_process_write_function);
+    rep_ADD_SUBR(Sprocess_output_pending);
+    rep_ADD_SUBR(Sprocess_output_high_water);
     rep_ADD_SUBR(Sprocess_dir);
     rep_ADD_SUBR(Sset_process_dir);
     rep_ADD_SUBR(Sprocess_connection_type);
@@ -2134,6 +2697,7 @@ rep_proc_init(void)
 					  proc_sweep, proc_mark,
 					  mark_active_processes,
 					  0, 0, proc_putc, proc_puts, 0, 0);
+    rep_get_data_type(process_type)->fd = proc_fd;
     rep_register_process_input_handler (read_from_process);
     rep_add_event_loop_callback (proc_periodically);
 }
@@ -30,6 +30,8 @@
 #include <config.h>
 #include "repint.h"
 
+#include <string.h>
+
 static const char utf8_skip_data[256] = {
   1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
   1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
@@ -185,6 +187,187 @@ utf8_offset_to_pointer  (const char *str,
   return (char *)s;
 }
 
+/* Character indexes of long strings
+
+   Finding the Nth character of a string means counting the N
+   characters before it, so walking along a long string one character
+   at a time takes quadratic time. To avoid that, the byte offset of
+   every INDEX_STRIDE'th character of recently used long strings is
+   remembered. The cached strings are kept alive, and their indexes are
+   dropped when rep_string_modified says their contents changed (or if
+   their length has changed, for good measure).
+
+   Characters are counted as the bytes that aren't UTF-8 continuation
+   bytes (10xxxxxx), which is the same thing for well-formed strings,
+   and never steps past the end of malformed ones. */
+
+#define INDEX_STRIDE 64
+#define INDEX_CACHE_SIZE 8
+
+/* Strings shorter than this aren't worth indexing */
+#define INDEX_MIN_BYTES 256
+
+struct utf8_index {
+    repv string;		/* rep_NULL if unused */
+    long nbytes, nchars;
+    long *offsets;		/* null if all characters are single bytes */
+    unsigned long last_used;
+};
+
+static struct utf8_index index_cache[INDEX_CACHE_SIZE];
+static unsigned long index_clock;
+
+static void (*next_string_modified_fun)(repv string);
+
+#define CONTINUATION_P(c) (((c) & 0xc0) == 0x80)
+
+/* Each byte of X with its top bit set */
+#define HIGH_BITS (~0UL / 0xff * 0x80)
+
+/* Return the number of characters in the LEN bytes at P, looking at a
+   word at a time where possible */
+static long
+count_chars (const char *p, long len)
+{
+    const unsigned char *s = (const unsigned char *) p;
+    const unsigned char *end = s + len;
+    long count = len;
+
+    while (end - s >= (long) sizeof (unsigned long))
+    {
+	unsigned long w;
+	memcpy (&w, s, sizeof (w));
+
+	/* the top bit of each byte that's 10xxxxxx, then the number of
+	   them, summed into the top byte */
+	w = (w & ~(w << 1) & HIGH_BITS) >> 7;
+	count -= (w * (~0UL / 0xff)) >> ((sizeof (unsigned long) - 1) * 8);
+	s += sizeof (unsigned long);
+    }
+    while (s < end)
+	count -= CONTINUATION_P (*s++);
+    return count;
+}
+
+/* Return a pointer to character N of the string at P */
+static char *
+skip_chars (const char *p, long n)
+{
+    const unsigned char *s = (const unsigned char *) p;
+    while (n-- > 0 && *s != 0)
+    {
+	s++;
+	while (CONTINUATION_P (*s))
+	    s++;
+    }
+    return (char *) s;
+}
+
+static void
+free_index (struct utf8_index *x)
+{
+    if (x->offsets != 0)
+	rep_free (x->offsets);
+    x->offsets = 0;
+    x->string = rep_NULL;
+    x->last_used = 0;
+}
+
+static void
+string_modified (repv string)
+{
+    int i;
+    for (i = 0; i < INDEX_CACHE_SIZE; i++)
+    {
+	if (index_cache[i].string == string)
+	    free_index (&index_cache[i]);
+    }
+    if (next_string_modified_fun != 0)
+	(*next_string_modified_fun) (string);
+}
+
+/* Return the index of STRING, making it if necessary, or null if
+   there's no memory for it */
+static struct utf8_index *
+string_index (repv string)
+{
+    struct utf8_index *x, *lru = 0;
+    const unsigned char *s;
+    long nbytes = rep_STRING_LEN (string), c, n;
+    int i;
+
+    for (i = 0; i < INDEX_CACHE_SIZE; i++)
+    {
+	x = &index_cache[i];
+	if (x->string == string && x->nbytes == nbytes)
+	{
+	    x->last_used = ++index_clock;
+	    return x;
+	}
+	if (lru == 0 || x->last_used < lru->last_used)
+	    lru = x;
+    }
+
+    x = lru;
+    free_index (x);
+    x->nbytes = nbytes;
+    x->nchars = count_chars (rep_STR (string), nbytes);
+    if (x->nchars != nbytes)
+    {
+	x->offsets = rep_alloc (sizeof (long)
+				* (x->nchars / INDEX_STRIDE + 1));
+	if (x->offsets == 0)
+	    return 0;
+	s = (const unsigned char *) rep_STR (string);
+	for (c = n = 0; c < nbytes; c++)
+	{
+	    if (!CONTINUATION_P (s[c]))
+	    {
+		if (n % INDEX_STRIDE == 0)
+		    x->offsets[n / INDEX_STRIDE] = c;
+		n++;
+	    }
+	}
+    }
+    x->string = string;
+    x->last_used = ++index_clock;
+    return x;
+}
+
+/* Return the number of characters in STRING */
+static long
+string_chars (repv string)
+{
+    if (rep_STRING_LEN (string) >= INDEX_MIN_BYTES)
+    {
+	struct utf8_index *x = string_index (string);
+	if (x != 0)
+	    return x->nchars;
+    }
+    return count_chars (rep_STR (string), rep_STRING_LEN (string));
+}
+
+/* Return a pointer to character N of STRING, which has at least N */
+static char *
+string_char_pointer (repv string, long n)
+{
+    if (rep_STRING_LEN (string) >= INDEX_MIN_BYTES)
+    {
+	struct utf8_index *x = string_index (string);
+	if (x != 0)
+	{
+	    if (x->offsets == 0)
+		return rep_STR (string) + n;
+	    else if (n >= x->nchars)
+		return rep_STR (string) + x->nbytes;
+	    return skip_chars (rep_STR (string)
+			       + x->offsets[n / INDEX_STRIDE],
+			       n % INDEX_STRIDE);
+	}
+    }
+    return skip_chars (rep_STR (string), n);
+}
+
 DEFUN("utf8-string-length", Futf8_string_length, Sutf8_string_length, (repv string), rep_Subr1) /*
 ::doc:rep.util.utf8#utf8-string-length::
 utf8-string-length STRING
@@ -193,7 +376,7 @@ Returns the number of characters in utf-8 encoded STRING.
 ::end:: */
 {
      rep_DECLARE1(string, rep_STRINGP);
-     return rep_MAKE_INT(utf8_strlen (rep_STR(string),-1));
+     return rep_MAKE_INT(string_chars (string));
 }
 
 DEFUN("utf8-substring", Futf8_substring, Sutf8_substring, (repv string, repv start, repv end), rep_Subr3) /*
@@ -205,21 +388,24 @@ character number START and ending at the character before END (or the
 end of the string if END is not given). All indices start at zero.
 ::end:: */
 {
-    int utf8len, slen;
+    long utf8len, slen;
     char *pstart;
     char *pend;
     rep_DECLARE1(string, rep_STRINGP);
     rep_DECLARE2(start, rep_INTP);
     rep_DECLARE3_OPT(end, rep_INTP);
-    utf8len = utf8_strlen(rep_STR(string), -1);
+    utf8len = string_chars(string);
     if(rep_INT(start) > utf8len || rep_INT(start) < 0)
         return(rep_signal_arg_error(start, 2));
-    pstart = utf8_offset_to_pointer(rep_STR(string), rep_INT(start));
+    pstart = string_char_pointer(string, rep_INT(start));
     if(rep_INTP(end))
     {
         if((rep_INT(end) > utf8len) || (rep_INT(end) < rep_INT(start)))
             return(rep_signal_arg_error(end, 3));
-	pend = utf8_offset_to_pointer(rep_STR(string),rep_INT(end));
+	if(rep_INT(end) - rep_INT(start) < INDEX_STRIDE)
+	    pend = skip_chars(pstart, rep_INT(end) - rep_INT(start));
+	else
+	    pend = string_char_pointer(string, rep_INT(end));
         return(rep_string_dupn(pstart, pend - pstart));
     }
     else
@@ -233,6 +419,14 @@ repv
 rep_dl_init (void)
 {
     repv tem = rep_push_structure ("rep.util.utf8");
+    int i;
+    for (i = 0; i < INDEX_CACHE_SIZE; i++)
+    {
+	index_cache[i].string = rep_NULL;
+	rep_mark_static (&index_cache[i].string);
+    }
+    next_string_modified_fun = rep_string_modified_fun;
+    rep_string_modified_fun = string_modified;
     rep_ADD_SUBR(Sutf8_substring);
     rep_ADD_SUBR(Sutf8_string_length);
     return rep_pop_structure (tem);
@@ -39,29 +39,48 @@ char *alloca ();
 #endif
 
 #include "repint.h"
+#include "probes.h"
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 
 #ifdef NEED_MEMORY_H
 # include <memory.h>
 #endif
 
+#ifdef HAVE_MALLOC_TRIM
+# include <malloc.h>
+#endif
+
+#ifdef PARALLEL_GC
+# include <pthread.h>
+# include <signal.h>
+# include <unistd.h>
+#endif
+
 /* #define GC_MONITOR_STK */
 
-#define rep_STRINGBLK_SIZE	510		/* ~4k */
+#define rep_STRINGBLK_SIZE	(rep_CELLBLK_SLOTS - rep_CELLBLK_HEADER_SLOTS)
 
-/* Structure of string header allocation blocks */
+/* Structure of string header allocation blocks; these share the mark
+   bitmap layout of cons blocks (see rep_lisp.h) */
 typedef struct rep_string_block_struct {
     union {
-	struct rep_string_block_struct *p;
+	rep_cell_block_header h;
 	/* ensure that the following cons cell is aligned to at
 	   least sizeof (rep_string) (for the dcache) */
-	rep_string dummy;
-    } next;
+	rep_string dummy[rep_CELLBLK_HEADER_SLOTS];
+    } hdr;
     rep_string data[rep_STRINGBLK_SIZE];
 } rep_string_block;
 
+#define STRINGBLK_NEXT(sb) ((rep_string_block *) (sb)->hdr.h.next)
+
+/* The bitmap indexing assumes that both kinds of cell are the same size */
+typedef char string_and_cons_sizes_differ[(sizeof (rep_string)
+					   == sizeof (rep_cons)) ? 1 : -1];
+
 /* Dumped data */
 rep_cons *rep_dumped_cons_start, *rep_dumped_cons_end;
 rep_symbol *rep_dumped_symbols_start, *rep_dumped_symbols_end;
@@ -70,6 +89,350 @@ repv rep_dumped_non_constants;
 int rep_guardian_type;
 
 DEFSYM(after_gc_hook, "after-gc-hook");
+DEFSYM(count, "count");
+DEFSYM(idle_count, "idle-count");
+DEFSYM(total, "total");
+DEFSYM(maximum, "maximum");
+DEFSYM(last, "last");
+DEFSYM(types, "types");
+DEFSYM(phases, "phases");
+DEFSYM(mark, "mark");
+DEFSYM(guardians, "guardians");
+DEFSYM(weak, "weak");
+DEFSYM(sweep, "sweep");
+DEFSYM(histogram, "histogram");
+DEFSYM(allocated, "allocated");
+DEFSYM(live, "live");
+DEFSYM(resident, "resident");
+DEFSYM(limit, "limit");
+DEFSYM(threshold, "threshold");
+DEFSYM(memory_exhausted, "memory-exhausted");
+DEFSTRING(err_memory_exhausted, "Heap limit exceeded");
+
+
+/* Cell blocks */
+
+/* Allocate SIZE bytes aligned to SIZE (a power of two). The pointer
+   that must eventually be passed to free () is stored in *BASE. */
+static void *
+alloc_aligned (size_t size, void **base)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+    void *mem;
+    if (posix_memalign (&mem, size, size) != 0)
+	return 0;
+    *base = mem;
+    return mem;
+#else
+    char *mem = malloc (2 * size);
+    if (mem == 0)
+	return 0;
+    *base = mem;
+    return (void *) ((rep_PTR_SIZED_INT) (mem + size - 1)
+		     & ~(rep_PTR_SIZED_INT) (size - 1));
+#endif
+}
+
+/* Allocate a block of rep_CELLBLK_BYTES, aligned to its own size so
+   that the header of any cell can be found by masking its address. */
+static void *
+alloc_cell_block (void)
+{
+    void *base;
+    rep_cell_block_header *h = alloc_aligned (rep_CELLBLK_BYTES, &base);
+    if (h == 0)
+	return 0;
+    h->base = base;
+    memset (h->mark, 0, sizeof (h->mark));
+    return h;
+}
+
+static void
+free_cell_block (void *block)
+{
+    free (((rep_cell_block_header *) block)->base);
+}
+
+static inline rep_bool
+cell_block_markedp (rep_cell_block_header *h, int slot)
+{
+    return (h->mark[slot / rep_VALUE_BITS]
+	    & (rep_VALUE_CONST(1) << (slot % rep_VALUE_BITS))) != 0;
+}
+
+static int
+cell_block_live_count (rep_cell_block_header *h)
+{
+    int i, count = 0;
+    for (i = 0; i < rep_CELLBLK_SLOTS / rep_VALUE_BITS; i++)
+    {
+	repv word = h->mark[i];
+	while (word != 0)
+	{
+	    word &= word - 1;
+	    count++;
+	}
+    }
+    return count;
+}
+
+
+/* Small object pools
+
+   Vectors and string bodies of up to POOL_MAX_SIZE bytes are carved
+   out of POOL_CHUNK_SIZE chunks, each holding objects of a single size
+   class. Fresh chunks are allocated from by bumping a pointer, so
+   objects created together are adjacent in memory; freed objects are
+   reused before the chunk is extended, and chunks that become empty
+   are given back to malloc.
+
+   pool_free () may also be given memory that came from malloc (e.g.
+   strings created by rep_box_string), so the addresses of all chunks
+   are kept in a hash set to tell the two apart. */
+
+#define POOL_CHUNK_SIZE	32768
+#define POOL_MAX_SIZE	256
+#define POOL_QUANTUM	16
+
+typedef struct pool_chunk_struct pool_chunk;
+typedef struct pool_class_struct pool_class;
+
+struct pool_chunk_struct {
+    pool_chunk *next, *prev;		/* in the class' list of chunks
+					   with free space */
+    pool_class *class;
+    void *base;
+    void *free;				/* freed objects, linked */
+    char *bump, *end;			/* unallocated space */
+    int used;
+    rep_bool in_list;
+};
+
+struct pool_class_struct {
+    size_t size;
+    pool_chunk *chunks;
+};
+
+#define POOL_HEADER_SIZE \
+    ((sizeof (pool_chunk) + POOL_QUANTUM - 1) & ~(POOL_QUANTUM - 1))
+
+#define POOL_CHUNK_OF(p) \
+    ((pool_chunk *) ((rep_PTR_SIZED_INT) (p) \
+		     & ~(rep_PTR_SIZED_INT) (POOL_CHUNK_SIZE - 1)))
+
+static pool_class pool_classes[] = {
+    { 16 }, { 32 }, { 48 }, { 64 }, { 80 }, { 96 }, { 128 },
+    { 160 }, { 192 }, { 256 }
+};
+
+/* Maps (SIZE + POOL_QUANTUM - 1) / POOL_QUANTUM to a size class */
+static pool_class *pool_class_map[POOL_MAX_SIZE / POOL_QUANTUM + 1];
+
+/* Open-addressed set of chunk addresses */
+static pool_chunk **pool_chunk_set;
+static unsigned int pool_chunk_set_size, pool_chunk_set_count;
+
+#define POOL_SET_HASH(c) \
+    ((unsigned int) (((rep_PTR_SIZED_INT) (c) / POOL_CHUNK_SIZE) \
+		     * 2654435761U))
+
+static rep_bool
+pool_set_add (pool_chunk *c)
+{
+    unsigned int i;
+    if (2 * (pool_chunk_set_count + 1) > pool_chunk_set_size)
+    {
+	unsigned int old_size = pool_chunk_set_size, new_size, j;
+	pool_chunk **old = pool_chunk_set;
+	new_size = old_size ? old_size * 2 : 64;
+	pool_chunk_set = calloc (new_size, sizeof (pool_chunk *));
+	if (pool_chunk_set == 0)
+	{
+	    pool_chunk_set = old;
+	    return rep_FALSE;
+	}
+	pool_chunk_set_size = new_size;
+	for (j = 0; j < old_size; j++)
+	{
+	    if (old[j] != 0)
+	    {
+		i = POOL_SET_HASH (old[j]) & (new_size - 1);
+		while (pool_chunk_set[i] != 0)
+		    i = (i + 1) & (new_size - 1);
+		pool_chunk_set[i] = old[j];
+	    }
+	}
+	free (old);
+    }
+    i = POOL_SET_HASH (c) & (pool_chunk_set_size - 1);
+    while (pool_chunk_set[i] != 0)
+	i = (i + 1) & (pool_chunk_set_size - 1);
+    pool_chunk_set[i] = c;
+    pool_chunk_set_count++;
+    return rep_TRUE;
+}
+
+static inline rep_bool
+pool_set_member (pool_chunk *c)
+{
+    unsigned int i, mask = pool_chunk_set_size - 1;
+    if (pool_chunk_set_size == 0)
+	return rep_FALSE;
+    i = POOL_SET_HASH (c) & mask;
+    while (pool_chunk_set[i] != 0)
+    {
+	if (pool_chunk_set[i] == c)
+	    return rep_TRUE;
+	i = (i + 1) & mask;
+    }
+    return rep_FALSE;
+}
+
+static void
+pool_set_remove (pool_chunk *c)
+{
+    unsigned int i, j, mask = pool_chunk_set_size - 1;
+    i = POOL_SET_HASH (c) & mask;
+    while (pool_chunk_set[i] != c)
+	i = (i + 1) & mask;
+    pool_chunk_set[i] = 0;
+    pool_chunk_set_count--;
+    /* close the gap, so that later entries stay reachable */
+    for (j = (i + 1) & mask; pool_chunk_set[j] != 0; j = (j + 1) & mask)
+    {
+	unsigned int k = POOL_SET_HASH (pool_chunk_set[j]) & mask;
+	if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+	{
+	    pool_chunk_set[i] = pool_chunk_set[j];
+	    pool_chunk_set[j] = 0;
+	    i = j;
+	}
+    }
+}
+
+static inline void
+pool_list_remove (pool_chunk *c)
+{
+    if (c->prev != 0)
+	c->prev->next = c->next;
+    else
+	c->class->chunks = c->next;
+    if (c->next != 0)
+	c->next->prev = c->prev;
+    c->in_list = rep_FALSE;
+}
+
+static inline void
+pool_list_push (pool_chunk *c)
+{
+    c->prev = 0;
+    c->next = c->class->chunks;
+    if (c->next != 0)
+	c->next->prev = c;
+    c->class->chunks = c;
+    c->in_list = rep_TRUE;
+}
+
+static pool_chunk *
+pool_new_chunk (pool_class *class)
+{
+    void *base;
+    pool_chunk *c = alloc_aligned (POOL_CHUNK_SIZE, &base);
+    if (c == 0)
+	return 0;
+    if (!pool_set_add (c))
+    {
+	free (base);
+	return 0;
+    }
+    c->class = class;
+    c->base = base;
+    c->free = 0;
+    c->bump = ((char *) c) + POOL_HEADER_SIZE;
+    c->end = ((char *) c) + POOL_CHUNK_SIZE;
+    c->used = 0;
+    pool_list_push (c);
+    return c;
+}
+
+/* Allocate LENGTH bytes, from a pool if it's small enough. The memory
+   must be released using pool_free (). */
+static void *
+pool_alloc (size_t length)
+{
+    pool_class *class;
+    pool_chunk *c;
+    void *obj;
+
+    if (length > POOL_MAX_SIZE || length == 0)
+	return rep_alloc (length);
+
+    class = pool_class_map[(length + POOL_QUANTUM - 1) / POOL_QUANTUM];
+    c = class->chunks;
+    if (c == 0)
+    {
+	c = pool_new_chunk (class);
+	if (c == 0)
+	    return rep_alloc (length);
+    }
+
+    if (c->free != 0)
+    {
+	obj = c->free;
+	c->free = *(void **) obj;
+    }
+    else
+    {
+	obj = c->bump;
+	c->bump += class->size;
+    }
+    c->used++;
+
+    if (c->free == 0 && c->bump + class->size > c->end)
+	pool_list_remove (c);
+
+    return obj;
+}
+
+static void
+pool_free (void *obj)
+{
+    pool_chunk *c = POOL_CHUNK_OF (obj);
+
+    if (!pool_set_member (c))
+    {
+	rep_free (obj);
+	return;
+    }
+
+    *(void **) obj = c->free;
+    c->free = obj;
+    c->used--;
+
+    if (c->used == 0 && (c->in_list ? (c->prev != 0 || c->next != 0)
+			 : c->class->chunks != 0))
+    {
+	/* Empty, and it's not the only chunk of its class with space */
+	if (c->in_list)
+	    pool_list_remove (c);
+	pool_set_remove (c);
+	free (c->base);
+    }
+    else if (!c->in_list)
+	pool_list_push (c);
+}
+
+static void
+pool_init (void)
+{
+    int i, j = 0;
+    for (i = 0; i <= POOL_MAX_SIZE / POOL_QUANTUM; i++)
+    {
+	while (pool_classes[j].size < (size_t) (i * POOL_QUANTUM))
+	    j++;
+	pool_class_map[i] = &pool_classes[j];
+    }
+}
 
 
 /* Type handling */
@@ -115,6 +478,7 @@ rep_register_type(unsigned int code, char *name,
     t->puts = puts;
     t->bind = bind;
     t->unbind = unbind;
+    t->fd = 0;
     t->next = data_types[TYPE_HASH(code)];
     data_types[TYPE_HASH(code)] = t;
 }
@@ -239,12 +603,12 @@ rep_box_string (char *ptr, long len)
     if(str == NULL)
     {
 	rep_string_block *cb;
-	cb = rep_alloc(sizeof(rep_string_block));
+	cb = alloc_cell_block ();
 	if(cb != NULL)
 	{
 	    int i;
 	    allocated_strings += rep_STRINGBLK_SIZE;
-	    cb->next.p = string_block_chain;
+	    cb->hdr.h.next = string_block_chain;
 	    string_block_chain = cb;
 	    for(i = 0; i < (rep_STRINGBLK_SIZE - 1); i++)
 		cb->data[i].car = rep_VAL(&cb->data[i + 1]);
@@ -261,6 +625,7 @@ rep_box_string (char *ptr, long len)
 
     str->car = rep_MAKE_STRING_CAR (len);
     rep_data_after_gc += len;
+    rep_ALLOC_SAMPLE (sizeof (rep_string) + len);
     str->data = ptr;
     return rep_VAL (str);
 }
@@ -270,7 +635,7 @@ rep_box_string (char *ptr, long len)
 repv
 rep_make_string(long len)
 {
-    char *data = rep_alloc (len);
+    char *data = pool_alloc (len);
     if(data != NULL)
 	return rep_box_string (data, len - 1);
     else
@@ -295,6 +660,237 @@ rep_string_dup(const char *src)
     return rep_string_dupn(src, strlen(src));
 }
 
+
+/* String slices
+
+   A slice is a string whose data points into the characters of
+   another (parent) string. Since C code expects the data of every
+   string to be zero-terminated, only suffixes of a string are shared,
+   using the parent's terminator. Both the slice and its parent have
+   rep_STRING_SHARED_BIT set; writing into either one first gives the
+   slice a private copy of its characters (rep_string_unshare).
+
+   The parent of each slice is recorded in a hash table keyed by the
+   slice's header. Parents aren't marked while tracing, after it
+   settle_slices () keeps alive the parents of live slices that
+   use a good part of them, and gives the others their own copies. */
+
+#define SLICE_MIN_LENGTH 64
+
+/* A slice that is unreachable except via slices is only kept if the
+   slices cover at least 1/SLICE_MAX_WASTE of it */
+#define SLICE_MAX_WASTE 4
+
+typedef struct {
+    rep_string *slice;
+    rep_string *parent;		/* null if no longer a slice */
+} slice_entry;
+
+static slice_entry *slice_table;
+static unsigned int slice_table_size, slice_table_count;
+
+#define SLICE_HASH(s) \
+    ((unsigned int) ((rep_PTR_SIZED_INT) (s) / sizeof (rep_string)) \
+     * 2654435761U)
+
+static slice_entry *
+slice_lookup (rep_string *s)
+{
+    unsigned int i;
+    if (slice_table_size == 0)
+	return 0;
+    i = SLICE_HASH (s) & (slice_table_size - 1);
+    while (slice_table[i].slice != 0)
+    {
+	if (slice_table[i].slice == s)
+	    return &slice_table[i];
+	i = (i + 1) & (slice_table_size - 1);
+    }
+    return 0;
+}
+
+static void
+slice_insert_1 (slice_entry *table, unsigned int size,
+		rep_string *s, rep_string *parent)
+{
+    unsigned int i = SLICE_HASH (s) & (size - 1);
+    while (table[i].slice != 0)
+	i = (i + 1) & (size - 1);
+    table[i].slice = s;
+    table[i].parent = parent;
+}
+
+static rep_bool
+slice_insert (rep_string *s, rep_string *parent)
+{
+    if (2 * (slice_table_count + 1) > slice_table_size)
+    {
+	unsigned int new_size = slice_table_size ? slice_table_size * 2 : 256;
+	slice_entry *new = calloc (new_size, sizeof (slice_entry));
+	unsigned int i;
+	if (new == 0)
+	    return rep_FALSE;
+	for (i = 0; i < slice_table_size; i++)
+	{
+	    if (slice_table[i].slice != 0)
+		slice_insert_1 (new, new_size, slice_table[i].slice,
+				slice_table[i].parent);
+	}
+	free (slice_table);
+	slice_table = new;
+	slice_table_size = new_size;
+    }
+    slice_insert_1 (slice_table, slice_table_size, s, parent);
+    slice_table_count++;
+    return rep_TRUE;
+}
+
+/* Give slice S its own copy of its characters. */
+static rep_bool
+flatten_slice (rep_string *s)
+{
+    long len = rep_STRING_LEN (rep_VAL (s));
+    char *data = pool_alloc (len + 1);
+    if (data == 0)
+	return rep_FALSE;
+    memcpy (data, s->data, len + 1);
+    s->data = data;
+    s->car &= ~rep_STRING_SHARED_BIT;
+    rep_data_after_gc += len;
+    return rep_TRUE;
+}
+
+/* Return the characters of STRING from START to the end. Long enough
+   suffixes share the characters of STRING instead of copying them. */
+repv
+rep_string_slice (repv string, long start)
+{
+    long len = rep_STRING_LEN (string) - start;
+    rep_string *parent = rep_STRING (string);
+    repv slice;
+
+    if (len < SLICE_MIN_LENGTH || rep_STR (string)[rep_STRING_LEN (string)] != 0)
+	return rep_string_dupn (rep_STR (string) + start, len);
+
+    if (rep_STRING_SHARED_P (string))
+    {
+	slice_entry *e = slice_lookup (parent);
+	if (e != 0 && e->parent != 0)
+	    parent = e->parent;
+    }
+
+    slice = rep_box_string (rep_STR (string) + start, len);
+    if (slice == rep_NULL)
+	return slice;
+    rep_data_after_gc -= len;
+    if (!slice_insert (rep_STRING (slice), parent))
+    {
+	/* Leave the header for the GC, with data it won't free. */
+	rep_STRING (slice)->data = 0;
+	rep_STRING (slice)->car = rep_MAKE_STRING_CAR (0);
+	return rep_string_dupn (rep_STR (string) + start, len);
+    }
+    rep_STRING (slice)->car |= rep_STRING_SHARED_BIT;
+    if (rep_STRING_WRITABLE_P (rep_VAL (parent)))
+	parent->car |= rep_STRING_SHARED_BIT;
+    return slice;
+}
+
+/* Called before modifying the characters of STRING (normally through
+   rep_STRING_UNSHARE), makes sure no other string shares them. */
+void
+rep_string_unshare (repv string)
+{
+    rep_string *s = rep_STRING (string);
+    slice_entry *e = slice_lookup (s);
+    if (e != 0 && e->parent != 0)
+    {
+	if (flatten_slice (s))
+	    e->parent = 0;
+	else
+	    rep_mem_error ();
+    }
+    else
+    {
+	unsigned int i;
+	for (i = 0; i < slice_table_size; i++)
+	{
+	    rep_string *x = slice_table[i].slice;
+	    if (x != 0 && slice_table[i].parent == s
+		&& rep_STRING_SHARED_P (rep_VAL (x)))
+	    {
+		if (!flatten_slice (x))
+		{
+		    rep_mem_error ();
+		    return;
+		}
+		slice_table[i].parent = 0;
+	    }
+	}
+	s->car &= ~rep_STRING_SHARED_BIT;
+    }
+}
+
+/* Called after marking. Decides which parents of live slices to keep,
+   and rebuilds the slice table from the slices that survive. */
+static void
+settle_slices (void)
+{
+    slice_entry *old = slice_table;
+    unsigned int old_size = slice_table_size, i;
+
+    if (slice_table_count == 0)
+	return;
+
+    /* Keep the parents of big enough slices. */
+    for (i = 0; i < old_size; i++)
+    {
+	rep_string *x = old[i].slice, *p = old[i].parent;
+	if (x != 0 && p != 0 && rep_GC_STRING_MARKEDP (rep_VAL (x))
+	    && !rep_GC_STRING_MARKEDP (rep_VAL (p))
+	    && (rep_STRING_LEN (rep_VAL (x)) * SLICE_MAX_WASTE
+		>= rep_STRING_LEN (rep_VAL (p))))
+	{
+	    rep_GC_SET_STRING (rep_VAL (p));
+	}
+    }
+
+    slice_table = calloc (old_size, sizeof (slice_entry));
+    if (slice_table == 0)
+    {
+	/* Can't lose track of the slices, keep all parents. */
+	slice_table = old;
+	for (i = 0; i < old_size; i++)
+	{
+	    rep_string *x = old[i].slice, *p = old[i].parent;
+	    if (x != 0 && p != 0 && rep_STRING_WRITABLE_P (rep_VAL (p)))
+		rep_GC_SET_STRING (rep_VAL (p));
+	}
+	return;
+    }
+    slice_table_count = 0;
+
+    for (i = 0; i < old_size; i++)
+    {
+	rep_string *x = old[i].slice, *p = old[i].parent;
+	if (x == 0 || p == 0)
+	    continue;
+	if (!rep_GC_STRING_MARKEDP (rep_VAL (x)))
+	{
+	    /* Dead slice, stop the sweeper freeing the parent's data */
+	    x->data = 0;
+	}
+	else if (rep_GC_STRING_MARKEDP (rep_VAL (p)) || !flatten_slice (x))
+	{
+	    if (rep_STRING_WRITABLE_P (rep_VAL (p)))
+		rep_GC_SET_STRING (rep_VAL (p));
+	    slice_insert_1 (slice_table, old_size, x, p);
+	    slice_table_count++;
+	}
+    }
+    free (old);
+}
+
 repv
 rep_concat2(char *s1, char *s2)
 {
@@ -336,6 +932,9 @@ string_cmp(repv v1, repv v2)
 	return 1;
 }
 
+/* Strings are swept eagerly (unlike conses) so that the character data
+   of dead strings is released as soon as possible. Only dead cells are
+   written to; live headers are just read. */
 static void
 string_sweep(void)
 {
@@ -346,51 +945,123 @@ string_sweep(void)
     allocated_string_bytes = 0;
     while(cb != NULL)
     {
-	rep_string_block *nxt = cb->next.p;
+	rep_string_block *nxt = STRINGBLK_NEXT (cb);
 	rep_string *newfree = NULL, *newfreetail = NULL, *this;
-	int i, newused = 0;
-	for(i = 0, this = cb->data; i < rep_STRINGBLK_SIZE; i++, this++)
+	int i, newused = cell_block_live_count (&cb->hdr.h);
+	if (newused == 0)
+	{
+	    /* Whole block is unused, get rid of it.  */
+	    for (i = 0, this = cb->data; i < rep_STRINGBLK_SIZE; i++, this++)
+	    {
+		if (!rep_CELL_CONS_P (rep_VAL (this)) && this->data != 0)
+		    pool_free (this->data);
+	    }
+	    free_cell_block (cb);
+	    allocated_strings -= rep_STRINGBLK_SIZE;
+	    cb = nxt;
+	    continue;
+	}
+	for(i = rep_STRINGBLK_SIZE - 1, this = cb->data + i; i >= 0; i--, this--)
 	{
-	    /* if on the freelist then the CELL_IS_8 bit
-	       will be unset (since the pointer is long aligned) */
-	    if(rep_CELL_CONS_P(rep_VAL(this))
-	       || !rep_GC_CELL_MARKEDP(rep_VAL(this)))
+	    if (cell_block_markedp (&cb->hdr.h, rep_CELLBLK_HEADER_SLOTS + i))
+		allocated_string_bytes += rep_STRING_LEN(rep_VAL(this));
+	    else
 	    {
+		/* if on the freelist then the CELL_IS_8 bit
+		   will be unset (since the pointer is long aligned) */
 		if(!newfreetail)
 		    newfreetail = this;
-		if (!rep_CELL_CONS_P(rep_VAL(this)))
-		    rep_free (this->data);
+		if (!rep_CELL_CONS_P(rep_VAL(this)) && this->data != 0)
+		    pool_free (this->data);
 		this->car = rep_VAL(newfree);
 		newfree = this;
 	    }
-	    else
-	    {
-		rep_GC_CLR_CELL(rep_VAL(this));
-		allocated_string_bytes += rep_STRING_LEN(rep_VAL(this));
-		newused++;
-	    }
 	}
-	if(newused == 0)
+	memset (cb->hdr.h.mark, 0, sizeof (cb->hdr.h.mark));
+	used_strings += newused;
+	if(newfreetail != NULL)
 	{
-	    /* Whole block is unused, get rid of it.  */
-	    rep_free(cb);
-	    allocated_strings -= rep_STRINGBLK_SIZE;
+	    /* Link this mini-freelist onto the main one.  */
+	    newfreetail->car = rep_VAL(string_freelist);
+	    string_freelist = newfree;
 	}
-	else
+	/* Have to rebuild the block chain as well.  */
+	cb->hdr.h.next = string_block_chain;
+	string_block_chain = cb;
+	cb = nxt;
+    }
+}
+
+/* Called just after a collection, makes live strings with the same
+   characters share them, each becoming a slice of the first found
+   (see above). Only strings that could be slices are considered, so a
+   write into any of them gives it back its own copy. Returns the
+   number of bytes freed.
+
+   The characters of the duplicates are freed straight away, so this
+   mustn't be called while C code up the stack holds pointers to
+   them. */
+static unsigned long
+dedupe_strings (void)
+{
+    rep_string **set;
+    rep_string_block *cb;
+    unsigned long size = 256, saved = 0;
+
+    while (size < 2 * (unsigned long) used_strings)
+	size *= 2;
+    set = calloc (size, sizeof (rep_string *));
+    if (set == 0)
+	return 0;
+
+    for (cb = string_block_chain; cb != 0; cb = STRINGBLK_NEXT (cb))
+    {
+	rep_string *this;
+	int i;
+	for (i = 0, this = cb->data; i < rep_STRINGBLK_SIZE; i++, this++)
 	{
-	    if(newfreetail != NULL)
+	    repv s = rep_VAL (this);
+	    const unsigned char *p;
+	    long j, len;
+	    unsigned long h = 0;
+
+	    if (!rep_STRINGP (s) || !rep_STRING_WRITABLE_P (s)
+		|| rep_STRING_SHARED_P (s)
+		|| (len = rep_STRING_LEN (s)) < SLICE_MIN_LENGTH
+		|| this->data[len] != 0)
 	    {
-		/* Link this mini-freelist onto the main one.  */
-		newfreetail->car = rep_VAL(string_freelist);
-		string_freelist = newfree;
-		used_strings += newused;
+		continue;
+	    }
+
+	    p = (const unsigned char *) this->data;
+	    for (j = 0; j < len; j++)
+		h = h * 33 + p[j];
+
+	    for (j = h & (size - 1); set[j] != 0; j = (j + 1) & (size - 1))
+	    {
+		rep_string *canon = set[j];
+		if (rep_STRING_LEN (rep_VAL (canon)) == len
+		    && memcmp (canon->data, this->data, len) == 0)
+		{
+		    break;
+		}
+	    }
+
+	    if (set[j] == 0)
+		set[j] = this;
+	    else if (slice_insert (this, set[j]))
+	    {
+		pool_free (this->data);
+		this->data = set[j]->data;
+		this->car |= rep_STRING_SHARED_BIT;
+		set[j]->car |= rep_STRING_SHARED_BIT;
+		saved += len + 1;
 	    }
-	    /* Have to rebuild the block chain as well.  */
-	    cb->next.p = string_block_chain;
-	    string_block_chain = cb;
 	}
-	cb = nxt;
     }
+
+    free (set);
+    return saved;
 }
 
 /* Sets the length-field of the dynamic string STR to LEN. */
@@ -399,6 +1070,7 @@ rep_set_string_len(repv str, long len)
 {
     if(rep_STRING_WRITABLE_P(str))
     {
+	rep_STRING_UNSHARE (str);
 	rep_STRING(str)->car = rep_MAKE_STRING_CAR(len);
 	return rep_TRUE;
     }
@@ -459,20 +1131,50 @@ rep_cons_block *rep_cons_block_chain;
 rep_cons *rep_cons_freelist;
 int rep_allocated_cons, rep_used_cons;
 
+/* Cons blocks are swept lazily: after each GC the freelist is empty
+   and the blocks from cons_sweep_next onwards still have the mark
+   bitmaps of the last collection. Blocks are swept one at a time as
+   the freelist runs dry. */
+static rep_cons_block *cons_sweep_next;
+
+/* Thread the unmarked cells of CB onto the freelist, lowest addresses
+   first. Only free cells are written. */
+static void
+sweep_cons_block (rep_cons_block *cb)
+{
+    rep_cons *tem_freelist = rep_cons_freelist;
+    int i;
+    for (i = rep_CONSBLK_SIZE - 1; i >= 0; i--)
+    {
+	if (!cell_block_markedp (&cb->hdr.h, rep_CELLBLK_HEADER_SLOTS + i))
+	{
+	    cb->cons[i].cdr = rep_CONS_VAL (tem_freelist);
+	    tem_freelist = &cb->cons[i];
+	}
+    }
+    rep_cons_freelist = tem_freelist;
+}
+
 rep_cons *
 rep_allocate_cons (void)
 {
     rep_cons *cn;
+    while (rep_cons_freelist == NULL && cons_sweep_next != NULL)
+    {
+	rep_cons_block *cb = cons_sweep_next;
+	cons_sweep_next = rep_CONSBLK_NEXT (cb);
+	sweep_cons_block (cb);
+    }
     cn = rep_cons_freelist;
     if(cn == NULL)
     {
 	rep_cons_block *cb;
-	cb = rep_alloc(sizeof(rep_cons_block));
+	cb = alloc_cell_block ();
 	if(cb != NULL)
 	{
 	    int i;
 	    rep_allocated_cons += rep_CONSBLK_SIZE;
-	    cb->next.p = rep_cons_block_chain;
+	    cb->hdr.h.next = rep_cons_block_chain;
 	    rep_cons_block_chain = cb;
 	    for(i = 0; i < (rep_CONSBLK_SIZE - 1); i++)
 		cb->cons[i].cdr = rep_CONS_VAL(&cb->cons[i + 1]);
@@ -499,6 +1201,7 @@ Returns a new cons-cell with car CAR and cdr CDR.
     rep_cons_freelist = rep_CONS (c->cdr);
     rep_used_cons++;
     rep_data_after_gc += sizeof(rep_cons);
+    rep_ALLOC_SAMPLE (sizeof (rep_cons));
 
     c->car = car;
     c->cdr = cdr;
@@ -513,32 +1216,49 @@ rep_cons_free(repv cn)
     rep_used_cons--;
 }
 
+/* Called before marking: forget the old freelist (every block will be
+   swept again) and clear the mark bitmaps. The cells aren't touched. */
 static void
-cons_sweep(void)
+cons_clear_marks (void)
 {
     rep_cons_block *cb;
-    rep_cons *tem_freelist = 0;
+    for (cb = rep_cons_block_chain; cb != 0; cb = rep_CONSBLK_NEXT (cb))
+	memset (cb->hdr.h.mark, 0, sizeof (cb->hdr.h.mark));
+    rep_cons_freelist = 0;
+    cons_sweep_next = 0;
+}
+
+/* The real sweeping happens in rep_allocate_cons. Here we just count
+   the survivors from the bitmaps and free blocks that have none. */
+static void
+cons_sweep(void)
+{
+    rep_cons_block *cb = rep_cons_block_chain, *last = 0;
     int tem_used = 0;
-    for (cb = rep_cons_block_chain; cb != 0; cb = cb->next.p)
+    rep_cons_block_chain = 0;
+    while (cb != 0)
     {
-	register rep_cons *this = cb->cons;
-	rep_cons *last = cb->cons + rep_CONSBLK_SIZE;
-	while (this < last)
+	rep_cons_block *next = rep_CONSBLK_NEXT (cb);
+	int used = cell_block_live_count (&cb->hdr.h);
+	if (used == 0)
 	{
-	    if (!rep_GC_CONS_MARKEDP (rep_CONS_VAL (this)))
-	    {
-		this->cdr = rep_CONS_VAL (tem_freelist);
-		tem_freelist = rep_CONS (this);
-	    }
-	    else
-	    {
-		rep_GC_CLR_CONS (rep_CONS_VAL (this));
-		tem_used++;
-	    }
-	    this++;
+	    free_cell_block (cb);
+	    rep_allocated_cons -= rep_CONSBLK_SIZE;
 	}
+	else
+	{
+	    tem_used += used;
+	    cb->hdr.h.next = 0;
+	    if (last != 0)
+		last->hdr.h.next = cb;
+	    else
+		rep_cons_block_chain = cb;
+	    last = cb;
+	}
+	cb = next;
     }
-    rep_cons_freelist = tem_freelist;
+    rep_cons_freelist = 0;
+    cons_sweep_next = rep_cons_block_chain;
     rep_used_cons = tem_used;
 }
 
@@ -589,13 +1309,13 @@ rep_list_5(repv v1, repv v2, repv v3, repv v4, repv v5)
 /* Vectors */
 
 static rep_vector *vector_chain;
-static int used_vector_slots;
+static int used_vector_slots, used_bytecode_slots;
 
 repv
 rep_make_vector(int size)
 {
     int len = rep_VECT_SIZE(size);
-    rep_vector *v = rep_ALLOC_CELL(len);
+    rep_vector *v = pool_alloc (len);
     if(v != NULL)
     {
 	rep_SET_VECT_LEN(rep_VAL(v), size);
@@ -603,26 +1323,56 @@ rep_make_vector(int size)
 	vector_chain = v;
 	used_vector_slots += size;
 	rep_data_after_gc += len;
+	rep_ALLOC_SAMPLE (len);
     }
     return rep_VAL(v);
 }
 
+/* Return a compiled-code object with LEN slots, all nil. It has an
+   extra hidden slot, used by the VM for its inline caches. */
+repv
+rep_make_compiled (int len)
+{
+    repv v = rep_make_vector (len + 1);
+    if (v != rep_NULL)
+    {
+	int i;
+	rep_SET_VECT_LEN (v, len);
+	rep_VECT(v)->car = (rep_VECT(v)->car & ~rep_CELL8_TYPE_MASK) | rep_Compiled;
+	for (i = 0; i < len; i++)
+	    rep_VECTI (v, i) = Qnil;
+	rep_SET_COMPILED_IC (v, 0);
+    }
+    return v;
+}
+
 static void
 vector_sweep(void)
 {
     rep_vector *this = vector_chain;
     vector_chain = NULL;
-    used_vector_slots = 0;
+    used_vector_slots = used_bytecode_slots = 0;
     while(this != NULL)
     {
 	rep_vector *nxt = this->next;
 	if(!rep_GC_CELL_MARKEDP(rep_VAL(this)))
-	    rep_FREE_CELL(this);
+	{
+	    if (rep_CELL8_TYPE(rep_VAL(this)) == rep_Compiled
+		&& rep_COMPILED_IC (rep_VAL(this)) != 0)
+	    {
+		if (rep_COMPILED_IC (rep_VAL(this))->jit != 0)
+		    rep_jit_free (rep_COMPILED_IC (rep_VAL(this))->jit);
+		rep_free (rep_COMPILED_IC (rep_VAL(this)));
+	    }
+	    pool_free (this);
+	}
 	else
 	{
 	    this->next = vector_chain;
 	    vector_chain = this;
 	    used_vector_slots += rep_VECT_LEN(this);
+	    if (rep_CELL8_TYPE(rep_VAL(this)) == rep_Compiled)
+		used_bytecode_slots += rep_VECT_LEN(this);
 	    rep_GC_CLR_CELL(rep_VAL(this));
 	}
 	this = nxt;
@@ -648,14 +1398,37 @@ vector_cmp(repv v1, repv v2)
 
 static rep_guardian *guardians;
 
+/* Append V to the array *ITEMS, holding *COUNT of *SIZE slots,
+   growing it as necessary. Returns false if out of memory. */
+static rep_bool
+guardian_append (repv **items, int *count, int *size, repv v)
+{
+    if (*count == *size)
+    {
+	int new_size = *size == 0 ? 16 : *size * 2;
+	repv *new_items = (*items == 0
+			   ? rep_alloc (new_size * sizeof (repv))
+			   : rep_realloc (*items, new_size * sizeof (repv)));
+	if (new_items == 0)
+	    return rep_FALSE;
+	*items = new_items;
+	*size = new_size;
+    }
+    (*items)[(*count)++] = v;
+    return rep_TRUE;
+}
+
 DEFUN("make-primitive-guardian", Fmake_primitive_guardian,
       Smake_primitive_guardian, (void), rep_Subr0)
 {
     rep_guardian *g = rep_ALLOC_CELL (sizeof (rep_guardian));
     rep_data_after_gc += sizeof (rep_guardian);
     g->car = rep_guardian_type;
-    g->accessible = Qnil;
-    g->inaccessible = Qnil;
+    g->accessible = 0;
+    g->accessible_count = g->accessible_size = 0;
+    g->inaccessible = 0;
+    g->inaccessible_head = 0;
+    g->inaccessible_count = g->inaccessible_size = 0;
     g->next = guardians;
     guardians = g;
     return rep_VAL(g);
@@ -664,19 +1437,27 @@ DEFUN("make-primitive-guardian", Fmake_primitive_guardian,
 DEFUN("primitive-guardian-push", Fprimitive_guardian_push,
        Sprimitive_guardian_push, (repv g, repv obj), rep_Subr2)
 {
+    rep_guardian *x;
     rep_DECLARE1 (g, rep_GUARDIANP);
-    rep_GUARDIAN(g)->accessible = Fcons (obj, rep_GUARDIAN(g)->accessible);
+    x = rep_GUARDIAN(g);
+    if (!guardian_append (&x->accessible, &x->accessible_count,
+			  &x->accessible_size, obj))
+	return rep_mem_error ();
+    rep_data_after_gc += sizeof (repv);
     return g;
 }
 
 DEFUN("primitive-guardian-pop", Fprimitive_guardian_pop,
       Sprimitive_guardian_pop, (repv g), rep_Subr1)
 {
+    rep_guardian *x;
     rep_DECLARE1 (g, rep_GUARDIANP);
-    if (rep_GUARDIAN(g)->inaccessible != Qnil)
+    x = rep_GUARDIAN(g);
+    if (x->inaccessible_head < x->inaccessible_count)
     {
-	repv ret = rep_CAR (rep_GUARDIAN(g)->inaccessible);
-	rep_GUARDIAN(g)->inaccessible = rep_CDR (rep_GUARDIAN(g)->inaccessible);
+	repv ret = x->inaccessible[x->inaccessible_head++];
+	if (x->inaccessible_head == x->inaccessible_count)
+	    x->inaccessible_head = x->inaccessible_count = 0;
 	return ret;
     }
     else
@@ -686,55 +1467,46 @@ DEFUN("primitive-guardian-pop", Fprimitive_guardian_pop,
 static void
 mark_guardian (repv g)
 {
-    /* accessible list is marked by run_guardians */
-    rep_MARKVAL (rep_GUARDIAN(g)->inaccessible);
+    /* accessible objects are dealt with by run_guardians */
+    rep_guardian *x = rep_GUARDIAN(g);
+    int i;
+    for (i = x->inaccessible_head; i < x->inaccessible_count; i++)
+	rep_MARKVAL (x->inaccessible[i]);
 }
 
 static void
 run_guardians (void)
 {
-    struct saved {
-	struct saved *next;
-	repv obj;
-    } *changed = 0;
-
-    /* scan all guardians for unmarked objects that used to be accessible */
     rep_guardian *g;
+    int i;
+
+    /* move unmarked objects to the inaccessible queues, compacting the
+       accessible arrays, before marking any of them */
     for (g = guardians; g != 0; g = g->next)
     {
-	repv *ptr = &g->accessible;
-	/* cons cells store mark bit in CDR, so mask it out. */
-	while ((*ptr & ~rep_VALUE_CONS_MARK_BIT) != Qnil)
+	int kept = 0;
+	for (i = 0; i < g->accessible_count; i++)
 	{
-	    repv cell = *ptr & ~rep_VALUE_CONS_MARK_BIT;
-	    if (!rep_GC_MARKEDP (rep_CAR (cell)))
+	    repv obj = g->accessible[i];
+	    if (rep_gc_live_p (obj))
+		g->accessible[kept++] = obj;
+	    else if (!guardian_append (&g->inaccessible,
+				       &g->inaccessible_count,
+				       &g->inaccessible_size, obj))
 	    {
-		/* move object to inaccessible list */
-		struct saved *new;
-		/* have to preserve the cons mark bit in *ptr */
-		*ptr = rep_GCDR (cell) | (*ptr & rep_VALUE_CONS_MARK_BIT);
-		rep_CDR (cell) = g->inaccessible;
-		g->inaccessible = cell;
-
-		/* note that we need to mark this object */
-		new = alloca (sizeof (struct saved));
-		new->obj = rep_CAR (cell);
-		new->next = changed;
-		changed = new;
+		/* no room, keep guarding it until next time */
+		g->accessible[kept++] = obj;
+		rep_MARKVAL (obj);
 	    }
-	    else
-		ptr = rep_CDRLOC (cell);
-
-	    /* mark the list infrastructure */
-	    rep_GC_SET_CONS (cell);
 	}
+	g->accessible_count = kept;
     }
 
-    /* mark any objects that changed state */
-    while (changed != 0)
+    /* then mark the objects that changed state */
+    for (g = guardians; g != 0; g = g->next)
     {
-	rep_MARKVAL (changed->obj);
-	changed = changed->next;
+	for (i = g->inaccessible_head; i < g->inaccessible_count; i++)
+	    rep_MARKVAL (g->inaccessible[i]);
     }
 }
 
@@ -747,7 +1519,13 @@ sweep_guardians (void)
     {
 	rep_guardian *next = g->next;
 	if (!rep_GC_CELL_MARKEDP (rep_VAL (g)))
+	{
+	    if (g->accessible != 0)
+		rep_free (g->accessible);
+	    if (g->inaccessible != 0)
+		rep_free (g->inaccessible);
 	    rep_FREE_CELL (g);
+	}
 	else
 	{
 	    rep_GC_CLR_CELL (rep_VAL (g));
@@ -780,6 +1558,69 @@ rep_bool rep_in_gc = rep_FALSE;
    rep_idle_gc_threshold = value that DAGC should be before gc'ing in idle time */
 int rep_data_after_gc, rep_gc_threshold = 200000, rep_idle_gc_threshold = 20000;
 
+/* rep_gc_threshold is recomputed after each collection as the larger of
+   gc_base_threshold (set by `garbage-threshold') and gc_live_ratio
+   percent of the data that survived. So a large, long-lived heap is
+   traversed in proportion to the amount of new data, not once per
+   fixed-size allocation quantum. */
+static int gc_base_threshold = 200000, gc_live_ratio = 50;
+
+/* When non-zero, the number of bytes of live data beyond which the
+   memory-exhausted error is signalled (see rep_collect_garbage). */
+static unsigned long heap_limit;
+
+/* When a collection leaves at least this many more bytes free than
+   will be allocated before the next one, free memory is returned to
+   the system. */
+static int gc_release_threshold = 4 * 1024 * 1024;
+
+/* Allocation sampling. Each allocator subtracts the size of the new
+   object from rep_alloc_sample_countdown, calling rep_alloc_sample_fun
+   when it reaches zero. By default nothing is listening, so the
+   countdown is just pushed back out of reach. */
+
+static void
+default_alloc_sample (void)
+{
+    rep_alloc_sample_countdown = INT_MAX;
+}
+
+int rep_alloc_sample_countdown = INT_MAX;
+void (*rep_alloc_sample_fun)(void) = default_alloc_sample;
+
+/* Approximate number of bytes that survived the last collection. */
+static unsigned long gc_live_bytes;
+
+/* Pause times of collections, in microseconds. */
+static struct {
+    unsigned long count, idle_count;
+    rep_long_long total, max, last;
+    /* number of pauses shorter than 100us, 1ms, ..., 1s, and longer */
+    unsigned long histogram[6];
+} gc_pauses;
+
+/* Maps type codes to indices into arrays of per-type data; cell8 types
+   come first, then the 256 possible cell16 types. */
+#define GC_TYPE_INDEX(code) \
+    (((code) & rep_CELL_IS_16) ? 16 + ((code) >> rep_CELL16_TYPE_SHIFT) \
+     : (code) >> 1)
+#define GC_TYPE_SLOTS (16 + 256)
+
+/* Details of the most recent collection. Phase times are in
+   microseconds; the number of objects of each type that were marked
+   is accumulated in the mark contexts, then summed into LIVE. */
+static struct {
+    unsigned long live[GC_TYPE_SLOTS];
+    rep_long_long mark, guardians, weak, sweep;
+    unsigned long allocated;		/* bytes, before the collection */
+} gc_stats;
+
+/* True while a collection requested by the idle loop is running. */
+static rep_bool gc_from_idle;
+
+/* Number of threads (including the main thread) that mark the heap. */
+static int gc_workers = 1;
+
 #ifdef GC_MONITOR_STK
 static int *gc_stack_high_tide;
 #endif
@@ -802,110 +1643,576 @@ rep_mark_static(repv *obj)
     static_roots[next_static_root++] = obj;
 }
 
-/* Mark a single Lisp object.
-   This attempts to eliminate as much tail-recursion as possible (by
-   changing the rep_VAL and jumping back to the `again' label).
-
-   Note that rep_VAL must not be NULL, and must not already have been
-   marked, (see the rep_MARKVAL macro in lisp.h) */
+/* Stop treating OBJ as a root, e.g. before freeing the memory holding
+   it. The order of the roots doesn't matter. */
 void
-rep_mark_value(register repv val)
+rep_unmark_static(repv *obj)
 {
-#ifdef GC_MONITOR_STK
-    int dummy;
-    /* Assumes that the stack grows downwards (towards 0) */
-    if(&dummy < gc_stack_high_tide)
-	gc_stack_high_tide = &dummy;
+    int i;
+    for (i = next_static_root - 1; i >= 0; i--)
+    {
+	if (static_roots[i] == obj)
+	{
+	    static_roots[i] = static_roots[--next_static_root];
+	    return;
+	}
+    }
+}
+
+
+/* Marking
+
+   Objects aren't traced recursively. Each one is marked when it is
+   first seen and pushed onto a mark stack, and its contents are marked
+   when it is popped again; so the depth of the data doesn't affect the
+   depth of the C stack. The mark hooks of data types call rep_MARKVAL
+   as before, which only pushes onto the stack while it's being
+   drained. Should the stack fail to grow, the object is scanned
+   straight away instead, i.e. recursively. */
+
+typedef struct {
+    repv *items;
+    size_t count, size;
+} mark_stack;
+
+typedef struct {
+    mark_stack work;			/* marked, contents not yet */
+#ifdef PARALLEL_GC
+    mark_stack defer;			/* need their type's mark hook */
+#endif
+    unsigned long live[GC_TYPE_SLOTS];	/* objects marked, by type */
+} mark_context;
+
+/* Flags for mark_object () and scan_object () */
+#define MARK_ATOMIC	1		/* other threads are marking */
+#define MARK_DEFER_HOOKS 2		/* don't call type mark hooks */
+
+#ifdef PARALLEL_GC
+# define MAX_GC_WORKERS 64
+#else
+# define MAX_GC_WORKERS 1
+#endif
+
+#ifdef __GNUC__
+# define PREFETCH(v) __builtin_prefetch ((void *) (v))
+#else
+# define PREFETCH(v)
+#endif
+
+static mark_context gc_ctx[MAX_GC_WORKERS];
+
+/* True while the main thread's work stack is being drained. */
+static rep_bool gc_draining;
+
+#ifdef PARALLEL_GC
+/* True while the main thread is queueing objects, not tracing them. */
+static rep_bool gc_deferring;
+#endif
+
+static rep_bool
+mark_stack_grow (mark_stack *st, size_t min_size)
+{
+    size_t new_size = st->size ? st->size : 1024;
+    repv *items;
+    while (new_size < min_size)
+	new_size *= 2;
+    items = realloc (st->items, new_size * sizeof (repv));
+    if (items == 0)
+	return rep_FALSE;
+    st->items = items;
+    st->size = new_size;
+    return rep_TRUE;
+}
+
+static inline rep_bool
+mark_stack_push (mark_stack *st, repv v)
+{
+    if (st->count == st->size && !mark_stack_grow (st, st->count + 1))
+	return rep_FALSE;
+    st->items[st->count++] = v;
+    return rep_TRUE;
+}
+
+/* Set BIT in *WORD, returning true if it wasn't already set. */
+static inline rep_bool
+set_mark_bit (repv *word, repv bit, int flags)
+{
+#ifdef PARALLEL_GC
+    if (flags & MARK_ATOMIC)
+	return (__atomic_fetch_or (word, bit, __ATOMIC_RELAXED) & bit) == 0;
 #endif
+    if (*word & bit)
+	return rep_FALSE;
+    *word |= bit;
+    return rep_TRUE;
+}
+
+static void scan_object (mark_context *ctx, repv v, int flags);
 
-again:
-    if(rep_INTP(val))
+static inline void
+queue_object (mark_context *ctx, repv v, int flags)
+{
+    if (!mark_stack_push (&ctx->work, v))
+	scan_object (ctx, v, flags);
+}
+
+/* Mark object V if it is collectable and not already marked, and queue
+   it if its contents need marking too. */
+static inline void
+mark_object (mark_context *ctx, repv v, int flags)
+{
+    rep_type *t;
+
+    if (v == 0 || rep_INTP(v))
 	return;
 
-    /* must be a cell */
-    if(rep_CELL_CONS_P(val))
+    if (rep_CELL_CONS_P(v))
     {
-	if(rep_CONS_WRITABLE_P(val))
+	if (rep_CONS_WRITABLE_P(v)
+	    && set_mark_bit (&rep_CELLBLK_MARK_WORD(v),
+			     rep_CELLBLK_MARK_BIT(v), flags))
 	{
-	    /* A cons. Attempts to walk though whole lists at a time
-	       (since Lisp lists mainly link from the cdr).  */
-	    rep_GC_SET_CONS(val);
-	    if(rep_NILP(rep_GCDR(val)))
-		/* End of a list. We can safely
-		   mark the car non-recursively.  */
-		val = rep_CAR(val);
-	    else
-	    {
-		rep_MARKVAL(rep_CAR(val));
-		val = rep_GCDR(val);
-	    }
-	    if(val && !rep_INTP(val) && !rep_GC_MARKEDP(val))
-		goto again;
+	    queue_object (ctx, v, flags);
+	}
+	return;
+    }
+
+    if (rep_CELL16P(v))
+    {
+	/* A user allocated type. */
+	t = rep_get_data_type (rep_CELL16_TYPE(v));
+	goto hooked;
+    }
+
+    switch (rep_CELL8_TYPE(v))
+    {
+    case rep_Vector:
+    case rep_Compiled:
+	if (!rep_VECTOR_WRITABLE_P(v))
 	    return;
+	goto scanned;
+
+    case rep_Funarg:
+	if (!rep_FUNARG_WRITABLE_P(v))
+	    return;
+	/* fall through */
+    case rep_Symbol:
+	/* Dumped symbols are dumped read-write, so no worries.. */
+    scanned:
+	if (set_mark_bit (&rep_PTR(v)->car, rep_CELL_MARK_BIT, flags))
+	{
+	    ctx->live[GC_TYPE_INDEX(rep_CELL8_TYPE(v))]++;
+	    queue_object (ctx, v, flags);
 	}
-	else
+	return;
+
+    case rep_String:
+	if (rep_STRING_WRITABLE_P(v))
 	{
-	    /* A constant cons cell. */
+	    set_mark_bit (&rep_CELLBLK_MARK_WORD(v),
+			  rep_CELLBLK_MARK_BIT(v), flags);
+	}
+	return;
+
+    case rep_Number:
+	if (set_mark_bit (&rep_PTR(v)->car, rep_CELL_MARK_BIT, flags))
+	    ctx->live[GC_TYPE_INDEX(rep_Number)]++;
+	return;
+
+    case rep_Subr0:
+    case rep_Subr1:
+    case rep_Subr2:
+    case rep_Subr3:
+    case rep_Subr4:
+    case rep_Subr5:
+    case rep_SubrN:
+    case rep_SF:
+	return;
+
+    default:
+	t = rep_get_data_type (rep_CELL8_TYPE(v));
+    hooked:
+	if (!set_mark_bit (&rep_PTR(v)->car, rep_CELL_MARK_BIT, flags))
 	    return;
+	ctx->live[GC_TYPE_INDEX(t->code)]++;
+	if (t->mark != 0)
+	{
+#ifdef PARALLEL_GC
+	    if (flags & MARK_DEFER_HOOKS)
+	    {
+		/* only the main thread may call the hook, and
+		   there's no other way of finding V again */
+		if (!mark_stack_push (&ctx->defer, v))
+		    abort ();
+		return;
+	    }
+#endif
+	    queue_object (ctx, v, flags);
 	}
     }
+}
 
-    if (rep_CELL16P(val))
+/* Mark the contents of V, which has been marked by mark_object (). */
+static void
+scan_object (mark_context *ctx, repv v, int flags)
+{
+    rep_type *t;
+    int i, len;
+
+    if (rep_CELL_CONS_P(v))
     {
-	/* A user allocated type. */
-	rep_type *t = rep_get_data_type(rep_CELL16_TYPE(val));
-	rep_GC_SET_CELL(val);
-	if (t->mark != 0)
-	    t->mark(val);
+	/* Walk along the cdrs of lists without queueing each cell,
+	   since Lisp lists mainly link from the cdr. */
+	mark_object (ctx, rep_CAR(v), flags);
+	v = rep_CDR(v);
+	while (rep_CONSP(v) && rep_CONS_WRITABLE_P(v))
+	{
+	    if (!set_mark_bit (&rep_CELLBLK_MARK_WORD(v),
+			       rep_CELLBLK_MARK_BIT(v), flags))
+		return;
+	    mark_object (ctx, rep_CAR(v), flags);
+	    v = rep_CDR(v);
+	}
+	mark_object (ctx, v, flags);
 	return;
     }
 
-    /* So we know that it's a cell8 object */
-    switch(rep_CELL8_TYPE(val))
+    if (rep_CELL16P(v))
     {
-	rep_type *t;
+	t = rep_get_data_type (rep_CELL16_TYPE(v));
+	t->mark (v);
+	return;
+    }
 
+    switch (rep_CELL8_TYPE(v))
+    {
     case rep_Vector:
     case rep_Compiled:
-	if(rep_VECTOR_WRITABLE_P(val))
-	{
-	    int i, len = rep_VECT_LEN(val);
-	    rep_GC_SET_CELL(val);
-	    for(i = 0; i < len; i++)
-		rep_MARKVAL(rep_VECTI(val, i));
-	}
+	len = rep_VECT_LEN(v);
+	for (i = 0; i < len; i++)
+	    mark_object (ctx, rep_VECTI(v, i), flags);
 	break;
 
     case rep_Symbol:
-	/* Dumped symbols are dumped read-write, so no worries.. */
-	rep_GC_SET_CELL(val);
-	rep_MARKVAL(rep_SYM(val)->name);
-	val = rep_SYM(val)->next;
-	if(val && !rep_INTP(val) && !rep_GC_MARKEDP(val))
-	    goto again;
+	mark_object (ctx, rep_SYM(v)->name, flags);
+	mark_object (ctx, rep_SYM(v)->next, flags);
 	break;
 
-    case rep_String:
-	if(!rep_STRING_WRITABLE_P(val))
-	    break;
-	rep_GC_SET_CELL(val);
+    case rep_Funarg:
+	mark_object (ctx, rep_FUNARG(v)->name, flags);
+	mark_object (ctx, rep_FUNARG(v)->env, flags);
+	mark_object (ctx, rep_FUNARG(v)->structure, flags);
+	mark_object (ctx, rep_FUNARG(v)->fun, flags);
 	break;
 
-    case rep_Number:
-	rep_GC_SET_CELL(val);
-	break;
+    default:
+	t = rep_get_data_type (rep_CELL8_TYPE(v));
+	t->mark (v);
+    }
+}
 
-    case rep_Funarg:
-	if (!rep_FUNARG_WRITABLE_P(val))
+/* Pop and scan objects until the work stack of CTX is empty. While
+   each object is scanned the next one is fetched into the cache. */
+static void
+mark_drain (mark_context *ctx)
+{
+    mark_stack *st = &ctx->work;
+    while (st->count > 0)
+    {
+	repv v = st->items[--st->count];
+	if (st->count > 0)
+	    PREFETCH (rep_PTR (st->items[st->count - 1]));
+	scan_object (ctx, v, 0);
+    }
+}
+
+#ifdef PARALLEL_GC
+
+/* Parallel marking
+
+   When more than one worker is enabled, the roots are only queued on
+   the work stack of the main thread, which is then published and
+   traced by all workers. Each worker has a private stack; when some
+   workers have nothing to do, a busy worker hands half of its stack
+   over to the shared pool, from where idle workers take their next
+   batch. Mark bits are set with atomic operations, so an object is
+   only ever scanned by the worker that marked it.
+
+   Only the built-in object types are traced by the workers, since the
+   mark hooks of other types can't be assumed to be thread-safe. Those
+   objects are queued and their hooks called by the main thread once
+   the workers have finished; anything they mark starts another round
+   of parallel tracing, until there's nothing left. */
+
+/* Minimum stack depth before work is handed to idle workers, and the
+   largest number of items taken from the shared pool at once. */
+#define MARK_SHARE_MIN 64
+#define MARK_BATCH 256
+
+static pthread_t gc_threads[MAX_GC_WORKERS];
+static int gc_threads_started;
+static pid_t gc_threads_pid;
+
+static pthread_mutex_t gc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gc_steal_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gc_done_cond = PTHREAD_COND_INITIALIZER;
+
+/* All of these are protected by gc_lock, except gc_hungry which may
+   be read without it */
+static mark_stack gc_shared;
+static unsigned int gc_generation;
+static int gc_participants, gc_idle, gc_finished;
+static int gc_hungry;
+
+/* Move the top N items of stack FROM to stack TO. */
+static rep_bool
+mark_stack_move (mark_stack *to, mark_stack *from, size_t n)
+{
+    if (to->count + n > to->size && !mark_stack_grow (to, to->count + n))
+	return rep_FALSE;
+    from->count -= n;
+    memcpy (to->items + to->count, from->items + from->count,
+	    n * sizeof (repv));
+    to->count += n;
+    return rep_TRUE;
+}
+
+/* Give half of the work stack of CTX to the shared pool. */
+static void
+par_share_work (mark_context *ctx)
+{
+    pthread_mutex_lock (&gc_lock);
+    if (mark_stack_move (&gc_shared, &ctx->work, ctx->work.count / 2))
+    {
+	__atomic_store_n (&gc_hungry, 0, __ATOMIC_RELAXED);
+	pthread_cond_broadcast (&gc_steal_cond);
+    }
+    pthread_mutex_unlock (&gc_lock);
+}
+
+/* Trace objects until every participating worker has run out. */
+static void
+par_drain (mark_context *ctx)
+{
+    /* so that taking a batch from the pool can't fail */
+    if (ctx->work.size < MARK_BATCH && !mark_stack_grow (&ctx->work, MARK_BATCH))
+	abort ();
+
+    for (;;)
+    {
+	size_t n;
+	while (ctx->work.count > 0)
+	{
+	    repv v = ctx->work.items[--ctx->work.count];
+	    if (ctx->work.count > 0)
+		PREFETCH (rep_PTR (ctx->work.items[ctx->work.count - 1]));
+	    scan_object (ctx, v, MARK_ATOMIC | MARK_DEFER_HOOKS);
+	    if (ctx->work.count > MARK_SHARE_MIN
+		&& __atomic_load_n (&gc_hungry, __ATOMIC_RELAXED))
+	    {
+		par_share_work (ctx);
+	    }
+	}
+
+	pthread_mutex_lock (&gc_lock);
+	gc_idle++;
+	while (gc_shared.count == 0 && gc_idle < gc_participants)
+	{
+	    __atomic_store_n (&gc_hungry, 1, __ATOMIC_RELAXED);
+	    pthread_cond_wait (&gc_steal_cond, &gc_lock);
+	}
+	if (gc_shared.count == 0)
+	{
+	    /* Everyone is idle, so no more work can appear */
+	    pthread_cond_broadcast (&gc_steal_cond);
+	    pthread_mutex_unlock (&gc_lock);
+	    return;
+	}
+	gc_idle--;
+	n = MIN (gc_shared.count, MARK_BATCH);
+	mark_stack_move (&ctx->work, &gc_shared, n);
+	pthread_mutex_unlock (&gc_lock);
+    }
+}
+
+static void *
+gc_worker_main (void *arg)
+{
+    int index = (int) (rep_PTR_SIZED_INT) arg;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock (&gc_lock);
+    for (;;)
+    {
+	while (generation == gc_generation)
+	    pthread_cond_wait (&gc_start_cond, &gc_lock);
+	generation = gc_generation;
+	if (index < gc_participants)
+	{
+	    pthread_mutex_unlock (&gc_lock);
+	    par_drain (&gc_ctx[index]);
+	    pthread_mutex_lock (&gc_lock);
+	    if (++gc_finished == gc_participants - 1)
+		pthread_cond_signal (&gc_done_cond);
+	}
+    }
+    return 0;
+}
+
+/* Make sure that N-1 worker threads exist. Returns the number of
+   workers that may be used. */
+static int
+par_start_workers (int n)
+{
+    sigset_t all, old;
+
+    if (gc_threads_started > 0 && gc_threads_pid != getpid ())
+    {
+	/* We've forked; the threads didn't come with us */
+	gc_threads_started = 0;
+	pthread_mutex_init (&gc_lock, 0);
+	pthread_cond_init (&gc_start_cond, 0);
+	pthread_cond_init (&gc_steal_cond, 0);
+	pthread_cond_init (&gc_done_cond, 0);
+    }
+    gc_threads_pid = getpid ();
+
+    /* Signals must only be delivered to the main thread */
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &old);
+    while (gc_threads_started < n - 1)
+    {
+	int index = gc_threads_started + 1;
+	if (pthread_create (&gc_threads[index], 0, gc_worker_main,
+			    (void *) (rep_PTR_SIZED_INT) index) != 0)
 	    break;
-	rep_GC_SET_CELL(val);
-	rep_MARKVAL(rep_FUNARG(val)->name);
-	rep_MARKVAL(rep_FUNARG(val)->env);
-	rep_MARKVAL(rep_FUNARG(val)->structure);
-	val = rep_FUNARG(val)->fun;
-	if (val && !rep_GC_MARKEDP(val))
-	    goto again;
-	break;
+	gc_threads_started++;
+    }
+    pthread_sigmask (SIG_SETMASK, &old, 0);
+
+    return MIN (n, gc_threads_started + 1);
+}
+
+/* Trace everything reachable from the work stack of the main thread,
+   using N workers. */
+static void
+par_run_workers (int n)
+{
+    mark_stack tem;
+
+    pthread_mutex_lock (&gc_lock);
+    /* the pool is empty between rounds */
+    tem = gc_shared;
+    gc_shared = gc_ctx[0].work;
+    gc_ctx[0].work = tem;
+    gc_participants = n;
+    gc_idle = 0;
+    gc_finished = 0;
+    gc_hungry = 0;
+    gc_generation++;
+    pthread_cond_broadcast (&gc_start_cond);
+    pthread_mutex_unlock (&gc_lock);
+
+    par_drain (&gc_ctx[0]);
+
+    pthread_mutex_lock (&gc_lock);
+    while (gc_finished < n - 1)
+	pthread_cond_wait (&gc_done_cond, &gc_lock);
+    pthread_mutex_unlock (&gc_lock);
+}
+
+/* Called after the roots have been queued; marks everything reachable
+   from them. */
+static void
+par_mark_queued (int n)
+{
+    for (;;)
+    {
+	rep_bool deferred = rep_FALSE;
+	int i;
+
+	if (gc_ctx[0].work.count > 0)
+	    par_run_workers (n);
+
+	for (i = 0; i < n; i++)
+	{
+	    mark_stack *defer = &gc_ctx[i].defer;
+	    while (defer->count > 0)
+	    {
+		repv v = defer->items[--defer->count];
+		rep_type *t = rep_get_data_type (rep_CELL16P(v)
+						 ? rep_CELL16_TYPE(v)
+						 : rep_CELL8_TYPE(v));
+		/* this may add to gc_ctx[0] */
+		t->mark (v);
+		deferred = rep_TRUE;
+	    }
+	}
+
+	if (!deferred && gc_ctx[0].work.count == 0)
+	    break;
+    }
+}
+
+#endif /* PARALLEL_GC */
+
+/* Mark a single Lisp object, and everything reachable from it.
+
+   Note that VAL must not be NULL, and must not already have been
+   marked, (see the rep_MARKVAL macro in lisp.h) */
+void
+rep_mark_value(repv val)
+{
+#ifdef GC_MONITOR_STK
+    int dummy;
+    /* Assumes that the stack grows downwards (towards 0) */
+    if(&dummy < gc_stack_high_tide)
+	gc_stack_high_tide = &dummy;
+#endif
+
+#ifdef PARALLEL_GC
+    if (gc_deferring)
+    {
+	mark_object (&gc_ctx[0], val, MARK_DEFER_HOOKS);
+	return;
+    }
+#endif
+
+    mark_object (&gc_ctx[0], val, 0);
+    if (!gc_draining)
+    {
+	gc_draining = rep_TRUE;
+	mark_drain (&gc_ctx[0]);
+	gc_draining = rep_FALSE;
+    }
+}
+
+/* Once marking has finished, return true if V will survive this
+   collection. Unlike rep_GC_MARKEDP this knows which objects are never
+   marked (fixnums, subrs and static data), so may be used on anything
+   a weak container holds. */
+rep_bool
+rep_gc_live_p (repv v)
+{
+    if (v == 0 || rep_INTP(v))
+	return rep_TRUE;
+
+    if (rep_CELL_CONS_P(v))
+	return !rep_CONS_WRITABLE_P(v) || rep_GC_CONS_MARKEDP(v);
+
+    if (rep_CELL16P(v))
+	return rep_GC_CELL_MARKEDP(v) != 0;
+
+    switch (rep_CELL8_TYPE(v))
+    {
+    case rep_Vector:
+    case rep_Compiled:
+    case rep_Funarg:
+	return rep_CELL_STATIC_P(v) || rep_GC_CELL_MARKEDP(v);
+
+    case rep_String:
+	return !rep_STRING_WRITABLE_P(v) || rep_GC_CONS_MARKEDP(v);
 
     case rep_Subr0:
     case rep_Subr1:
@@ -915,25 +2222,261 @@ again:
     case rep_Subr5:
     case rep_SubrN:
     case rep_SF:
-	break;
+	return rep_TRUE;
 
     default:
-	t = rep_get_data_type(rep_CELL8_TYPE(val));
-	rep_GC_SET_CELL(val);
-	if (t->mark != 0)
-	    t->mark(val);
+	return rep_GC_CELL_MARKEDP(v) != 0;
+    }
+}
+
+/* Weak containers
+
+   Types whose contents are held weakly register a pair of hooks. Their
+   mark hooks shouldn't mark the weak parts; instead, once everything
+   else reachable has been marked, each TRACE hook is called to mark
+   whatever the weak contents keep alive (for example the values of
+   weak table entries whose keys were marked, as ephemerons), returning
+   true if it marked anything. The TRACE hooks are called repeatedly
+   until none of them does. Then, while the mark bits are still valid,
+   each CLEAR hook removes the contents that didn't survive.
+
+   The hooks are called for every collection, so should only examine
+   the objects that were marked during it (their mark hooks can record
+   them), not every object of their type. */
+
+typedef struct rep_weak_hooks_struct rep_weak_hooks;
+struct rep_weak_hooks_struct {
+    rep_weak_hooks *next;
+    rep_bool (*trace) (void);
+    void (*clear) (void);
+};
+
+static rep_weak_hooks *weak_hooks;
+
+void
+rep_add_weak_hooks (rep_bool (*trace) (void), void (*clear) (void))
+{
+    rep_weak_hooks *h = rep_alloc (sizeof (rep_weak_hooks));
+    h->trace = trace;
+    h->clear = clear;
+    h->next = weak_hooks;
+    weak_hooks = h;
+}
+
+static void
+trace_weak_hooks (void)
+{
+    rep_bool changed;
+    do {
+	rep_weak_hooks *h;
+	changed = rep_FALSE;
+	for (h = weak_hooks; h != 0; h = h->next)
+	{
+	    if (h->trace != 0 && h->trace ())
+		changed = rep_TRUE;
+	}
+    } while (changed);
+}
+
+static void
+clear_weak_hooks (void)
+{
+    rep_weak_hooks *h;
+    for (h = weak_hooks; h != 0; h = h->next)
+    {
+	if (h->clear != 0)
+	    h->clear ();
     }
 }
 
+static void
+update_gc_threshold (void)
+{
+    unsigned long scaled = (gc_live_bytes / 100) * gc_live_ratio;
+    /* near the heap limit, collect before it could be passed */
+    if (heap_limit != 0 && gc_live_bytes + scaled > heap_limit)
+	scaled = heap_limit > gc_live_bytes ? heap_limit - gc_live_bytes : 0;
+    if (scaled > INT_MAX)
+	scaled = INT_MAX;
+    rep_gc_threshold = MAX (gc_base_threshold, (int) scaled);
+}
+
+/* Called instead of Fgarbage_collect when rep_data_after_gc reaches
+   rep_gc_threshold. Returns false, with memory-exhausted signalled, if
+   more data than the heap limit survived the collection. The caller
+   must be able to unwind.
+
+   The limit is only enforced here, never by the allocators themselves,
+   since most of their callers can't cope with a failure that isn't a
+   real shortage of memory. */
+rep_bool
+rep_collect_garbage (void)
+{
+    Fgarbage_collect (Qnil);
+    if (rep_throw_value != rep_NULL
+	|| heap_limit == 0 || gc_live_bytes <= heap_limit)
+	return rep_TRUE;
+    Fsignal (Qmemory_exhausted, rep_list_2 (rep_make_long_uint (gc_live_bytes),
+					    rep_make_long_uint (heap_limit)));
+    return rep_FALSE;
+}
+
+/* Give free memory back to the system. The collector frees empty
+   blocks of cells and numbers, but malloc usually keeps the pages. */
+static void
+release_free_memory (void)
+{
+#ifdef HAVE_MALLOC_TRIM
+    malloc_trim (0);
+#endif
+}
+
 DEFUN("garbage-threshold", Fgarbage_threshold, Sgarbage_threshold, (repv val), rep_Subr1) /*
 ::doc:rep.data#garbage-threshold::
 garbage-threshold [NEW-VALUE]
 
 The number of bytes of storage which must be used before a garbage-
-collection is triggered.
+collection is triggered. See also `garbage-threshold-ratio'.
+::end:: */
+{
+    repv ret = rep_handle_var_int(val, &gc_base_threshold);
+    update_gc_threshold ();
+    return ret;
+}
+
+DEFUN("garbage-threshold-ratio", Fgarbage_threshold_ratio,
+      Sgarbage_threshold_ratio, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-threshold-ratio::
+garbage-threshold-ratio [NEW-VALUE]
+
+The amount of storage which may be used between garbage collections,
+expressed as a percentage of the data that survived the previous
+collection. Collection is triggered when more than the larger of this
+and `garbage-threshold' has been allocated. Zero disables scaling.
+::end:: */
+{
+    repv ret;
+    if (rep_INTP (val) && rep_INT (val) < 0)
+	return rep_signal_arg_error (val, 1);
+    ret = rep_handle_var_int(val, &gc_live_ratio);
+    update_gc_threshold ();
+    return ret;
+}
+
+DEFUN("heap-limit", Fheap_limit, Sheap_limit, (repv val), rep_Subr1) /*
+::doc:rep.data#heap-limit::
+heap-limit [NEW-VALUE]
+
+The maximum number of bytes of live data, or nil if there's no limit.
+When a garbage collection finds more than this, the `memory-exhausted'
+error is signalled. Setting a NEW-VALUE of zero removes the limit.
+::end:: */
+{
+    repv ret = heap_limit ? rep_make_long_uint (heap_limit) : Qnil;
+    if (val != Qnil)
+    {
+	if (!rep_INTEGERP (val) || rep_get_long_int (val) < 0)
+	    return rep_signal_arg_error (val, 1);
+	heap_limit = rep_get_long_uint (val);
+	update_gc_threshold ();
+    }
+    return ret;
+}
+
+DEFUN("garbage-release-threshold", Fgarbage_release_threshold,
+      Sgarbage_release_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-release-threshold::
+garbage-release-threshold [NEW-VALUE]
+
+When a garbage collection leaves at least this many more bytes free
+than may be allocated before the next collection, the unused memory is
+given back to the operating system. Zero disables releasing memory.
+::end:: */
+{
+    if (rep_INTP (val) && rep_INT (val) < 0)
+	return rep_signal_arg_error (val, 1);
+    return rep_handle_var_int (val, &gc_release_threshold);
+}
+
+DEFUN("memory-usage", Fmemory_usage, Smemory_usage, (void), rep_Subr0) /*
+::doc:rep.data#memory-usage::
+memory-usage
+
+Return an alist describing the memory used by Lisp data:
+
+  `live'	the number of bytes of data that survived the most
+		recent garbage collection
+  `allocated'	the number of bytes allocated since then
+  `threshold'	the number of bytes that may be allocated before the
+		next collection
+  `limit'	the value of `heap-limit'
+  `resident'	the resident set size of the process in bytes, or nil
+		if it isn't known
+::end:: */
+{
+    long rss = rep_resident_set_size ();
+    return rep_list_5 (Fcons (Qlive, rep_make_long_uint (gc_live_bytes)),
+		       Fcons (Qallocated,
+			      rep_make_long_uint (rep_data_after_gc)),
+		       Fcons (Qthreshold, rep_MAKE_INT (rep_gc_threshold)),
+		       Fcons (Qlimit, (heap_limit
+				       ? rep_make_long_uint (heap_limit)
+				       : Qnil)),
+		       Fcons (Qresident, rss >= 0 ? rep_make_long_uint (rss) : Qnil));
+}
+
+DEFUN("dedupe-heap", Fdedupe_heap, Sdedupe_heap, (void), rep_Subr0) /*
+::doc:rep.data#dedupe-heap::
+dedupe-heap
+
+Garbage collect, then merge identical data to save memory: the
+constants of all compiled functions are coalesced, as when
+`dedupe-loaded-constants' is true, and live strings with the same
+contents are made to share their characters. Strings keep their
+identities, and one that is modified gets its own copy back. Returns
+the number of bytes saved.
+::end:: */
+{
+    rep_vector *v;
+    unsigned long before, saved;
+
+    Fgarbage_collect (Qnil);
+    before = gc_live_bytes;
+
+    for (v = vector_chain; v != 0; v = v->next)
+    {
+	if (rep_COMPILEDP (rep_VAL (v)))
+	    rep_dedupe_constants (rep_VAL (v));
+    }
+
+    Fgarbage_collect (Qnil);
+    saved = before > gc_live_bytes ? before - gc_live_bytes : 0;
+    saved += dedupe_strings ();
+    return rep_make_long_uint (saved);
+}
+
+DEFUN("garbage-collection-workers", Fgarbage_collection_workers,
+      Sgarbage_collection_workers, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-collection-workers::
+garbage-collection-workers [NEW-VALUE]
+
+The number of threads used to mark live data during garbage collection.
+Values greater than one only have an effect if librep was configured
+with `--enable-parallel-gc'.
 ::end:: */
 {
-    return rep_handle_var_int(val, &rep_gc_threshold);
+    if (rep_INTP (val))
+    {
+	if (rep_INT (val) < 1)
+	    return rep_signal_arg_error (val, 1);
+#ifdef PARALLEL_GC
+	if (rep_INT (val) > MAX_GC_WORKERS)
+	    val = rep_MAKE_INT (MAX_GC_WORKERS);
+#else
+	val = rep_MAKE_INT (1);
+#endif
+    }
+    return rep_handle_var_int (val, &gc_workers);
 }
 
 DEFUN("idle-garbage-threshold", Fidle_garbage_threshold, Sidle_garbage_threshold, (repv val), rep_Subr1) /*
@@ -960,14 +2503,29 @@ last garbage-collection is greater than `garbage-threshold'.
     rep_GC_root *rep_gc_root;
     rep_GC_n_roots *rep_gc_n_roots;
     struct rep_Call *lc;
+    rep_long_long start_time, phase_time, now, pause;
+    unsigned long surplus;
+#ifdef PARALLEL_GC
+    int workers = 1;
+#endif
 #ifdef GC_MONITOR_STK
     int dummy;
     gc_stack_high_tide = &dummy;
 #endif
 
+    start_time = rep_utime ();
     rep_in_gc = rep_TRUE;
+    gc_stats.allocated = rep_data_after_gc;
+    REP_PROBE2 (gc__start, (long) rep_data_after_gc, (int) gc_from_idle);
 
     rep_macros_before_gc ();
+    cons_clear_marks ();
+
+#ifdef PARALLEL_GC
+    if (gc_workers > 1)
+	workers = par_start_workers (gc_workers);
+    gc_deferring = (workers > 1);
+#endif
 
     /* mark static objects */
     for(i = 0; i < next_static_root; i++)
@@ -998,6 +2556,7 @@ last garbage-collection is greater than `garbage-threshold'.
     }
 
     rep_mark_regexp_data();
+    rep_mark_lambda_cache ();
     rep_mark_origins ();
 
 #ifdef HAVE_DYNAMIC_LOADING
@@ -1016,11 +2575,53 @@ last garbage-collection is greater than `garbage-threshold'.
 	lc = lc->next;
     }
 
+#ifdef PARALLEL_GC
+    if (gc_deferring)
+    {
+	par_mark_queued (workers);
+	gc_deferring = rep_FALSE;
+    }
+#endif
+
+    /* keep what's reachable through weak containers, and the
+       expansions of live forms */
+    trace_weak_hooks ();
+    rep_mark_macro_history (rep_FALSE);
+    trace_weak_hooks ();
+
+    now = rep_utime ();
+    gc_stats.mark = now - start_time;
+    phase_time = now;
+
     /* move and mark any guarded objects that became inaccessible */
     run_guardians ();
+    rep_mark_macro_history (rep_TRUE);
+    trace_weak_hooks ();
+    settle_slices ();
+
+    now = rep_utime ();
+    gc_stats.guardians = now - phase_time;
+    phase_time = now;
 
     /* look for dead weak references */
     rep_scan_weak_refs ();
+    clear_weak_hooks ();
+    rep_sweep_origins ();
+
+    now = rep_utime ();
+    gc_stats.weak = now - phase_time;
+    phase_time = now;
+
+    for (i = 0; i < GC_TYPE_SLOTS; i++)
+    {
+	int j;
+	gc_stats.live[i] = 0;
+	for (j = 0; j < MAX_GC_WORKERS; j++)
+	{
+	    gc_stats.live[i] += gc_ctx[j].live[i];
+	    gc_ctx[j].live[i] = 0;
+	}
+    }
 
     /* Finished marking, start sweeping. */
 
@@ -1036,9 +2637,43 @@ last garbage-collection is greater than `garbage-threshold'.
 	}
     }
 
+    surplus = gc_live_bytes + rep_data_after_gc;
+    gc_live_bytes = (rep_used_cons * sizeof (rep_cons)
+		     + rep_used_tuples * sizeof (rep_tuple)
+		     + used_strings * sizeof (rep_string)
+		     + allocated_string_bytes
+		     + used_vector_slots * sizeof (repv)
+		     + rep_used_funargs * sizeof (rep_funarg));
+    update_gc_threshold ();
+    /* release memory that won't be needed before the next collection */
+    surplus -= MIN (surplus, gc_live_bytes + rep_gc_threshold);
+    if (gc_release_threshold > 0
+	&& surplus >= (unsigned long) gc_release_threshold)
+	release_free_memory ();
+
     rep_data_after_gc = 0;
     rep_in_gc = rep_FALSE;
 
+    now = rep_utime ();
+    gc_stats.sweep = now - phase_time;
+    pause = now - start_time;
+    gc_pauses.count++;
+    if (gc_from_idle)
+	gc_pauses.idle_count++;
+    gc_pauses.total += pause;
+    gc_pauses.last = pause;
+    if (pause > gc_pauses.max)
+	gc_pauses.max = pause;
+    REP_PROBE6 (gc__done, (long) pause, (long) gc_stats.mark,
+		(long) gc_stats.guardians, (long) gc_stats.weak,
+		(long) gc_stats.sweep, (long) gc_live_bytes);
+    {
+	rep_long_long limit = 100;
+	for (i = 0; i < 5 && pause >= limit; i++)
+	    limit *= 10;
+	gc_pauses.histogram[i]++;
+    }
+
 #ifdef GC_MONITOR_STK
     fprintf(stderr, "gc: stack usage = %d\n",
 	    ((int)&dummy) - (int)gc_stack_high_tide);
@@ -1066,9 +2701,165 @@ last garbage-collection is greater than `garbage-threshold'.
 }
 
 
+/* Called from the input loop when it's idle and enough data has been
+   allocated to make a collection worthwhile. */
+void
+rep_idle_garbage_collect (void)
+{
+    gc_from_idle = rep_TRUE;
+    Fgarbage_collect (Qnil);
+    gc_from_idle = rep_FALSE;
+}
+
+DEFUN("garbage-collection-pauses", Fgarbage_collection_pauses,
+      Sgarbage_collection_pauses, (repv reset), rep_Subr1) /*
+::doc:rep.data#garbage-collection-pauses::
+garbage-collection-pauses [RESET]
+
+Return an alist describing the time spent in the garbage collector,
+with keys `count' (number of collections), `idle-count' (how many of
+those were run from the idle loop), `total', `maximum' and `last'
+(pause times in microseconds).
+
+If RESET is true, the statistics (and the histogram returned by
+`garbage-collection-statistics') are cleared after being read.
+::end:: */
+{
+    repv ret;
+    ret = rep_list_5 (Fcons (Qcount, rep_make_long_uint (gc_pauses.count)),
+		      Fcons (Qidle_count,
+			     rep_make_long_uint (gc_pauses.idle_count)),
+		      Fcons (Qtotal, rep_make_longlong_int (gc_pauses.total)),
+		      Fcons (Qmaximum, rep_make_longlong_int (gc_pauses.max)),
+		      Fcons (Qlast, rep_make_longlong_int (gc_pauses.last)));
+    if (reset != Qnil)
+	memset (&gc_pauses, 0, sizeof (gc_pauses));
+    return ret;
+}
+
+/* Return (NAME LIVE ALLOCATED BYTES) for type T, or null for types
+   that aren't allocated from the heap */
+static repv
+type_statistics (rep_type *t)
+{
+    unsigned long live = gc_stats.live[GC_TYPE_INDEX(t->code)];
+    repv alloc = Qnil, bytes = Qnil;
+
+    switch (t->code)
+    {
+    case rep_Int: case rep_Void: case rep_SF:
+    case rep_Subr0: case rep_Subr1: case rep_Subr2: case rep_Subr3:
+    case rep_Subr4: case rep_Subr5: case rep_SubrN:
+	return rep_NULL;
+
+    case rep_Cons:
+	live = rep_used_cons;
+	alloc = rep_make_long_uint (rep_allocated_cons);
+	bytes = rep_make_long_uint (live * sizeof (rep_cons));
+	break;
+
+    case rep_String:
+	live = used_strings;
+	alloc = rep_make_long_uint (allocated_strings);
+	bytes = rep_make_long_uint (live * sizeof (rep_string)
+				    + allocated_string_bytes);
+	break;
+
+    case rep_Vector:
+	bytes = rep_make_long_uint (live * rep_VECT_SIZE (0)
+				    + (used_vector_slots
+				       - used_bytecode_slots) * sizeof (repv));
+	break;
+
+    case rep_Compiled:
+	bytes = rep_make_long_uint (live * rep_VECT_SIZE (0)
+				    + used_bytecode_slots * sizeof (repv));
+	break;
+
+    case rep_Funarg:
+	live = rep_used_funargs;
+	alloc = rep_make_long_uint (rep_allocated_funargs);
+	bytes = rep_make_long_uint (live * sizeof (rep_funarg));
+	break;
+
+    case rep_Symbol:
+	bytes = rep_make_long_uint (live * sizeof (rep_symbol));
+	break;
+    }
+
+    return rep_list_4 (rep_string_dup (t->name),
+		       rep_make_long_uint (live), alloc, bytes);
+}
+
+DEFUN("garbage-collection-statistics", Fgarbage_collection_statistics,
+      Sgarbage_collection_statistics, (void), rep_Subr0) /*
+::doc:rep.data#garbage-collection-statistics::
+garbage-collection-statistics
+
+Return an alist describing the data found by the most recent garbage
+collection:
+
+  `types'	a list of (TYPE-NAME LIVE ALLOCATED BYTES) for each type
+		of object; ALLOCATED (the number of objects there is
+		space for) and BYTES (the size of the live objects) are
+		nil when unknown
+  `phases'	an alist of the time spent in microseconds marking live
+		data (`mark'), handling guardians (`guardians') and weak
+		references (`weak'), and freeing dead data (`sweep')
+  `allocated'	the number of bytes that had been allocated since the
+		collection before it
+
+The `histogram' element is a vector counting the pauses of all
+collections (since the counts were last reset by `garbage-collection-
+pauses') that were shorter than 100us, 1ms, 10ms, 100ms and 1s, and
+the number that were longer.
+::end:: */
+{
+    repv types = Qnil, phases, histogram;
+    int i;
+
+    for (i = 0; i < TYPE_HASH_SIZE; i++)
+    {
+	rep_type *t;
+	for (t = data_types[i]; t != 0; t = t->next)
+	{
+	    repv tem = type_statistics (t);
+	    if (tem != rep_NULL)
+		types = Fcons (tem, types);
+	}
+    }
+    types = Fcons (rep_list_4 (rep_string_dup ("tuple"),
+			       rep_make_long_uint (rep_used_tuples),
+			       rep_make_long_uint (rep_allocated_tuples),
+			       rep_make_long_uint (rep_used_tuples
+						   * sizeof (rep_tuple))),
+		   types);
+
+    histogram = Fmake_vector (rep_MAKE_INT (6), Qnil);
+    for (i = 0; i < 6; i++)
+	rep_VECTI (histogram, i) = rep_make_long_uint (gc_pauses.histogram[i]);
+
+    phases = rep_list_4 (Fcons (Qmark,
+				rep_make_longlong_int (gc_stats.mark)),
+			 Fcons (Qguardians,
+				rep_make_longlong_int (gc_stats.guardians)),
+			 Fcons (Qweak,
+				rep_make_longlong_int (gc_stats.weak)),
+			 Fcons (Qsweep,
+				rep_make_longlong_int (gc_stats.sweep)));
+
+    return rep_list_4 (Fcons (Qtypes, types),
+		       Fcons (Qphases, phases),
+		       Fcons (Qhistogram, histogram),
+		       Fcons (Qallocated,
+			      rep_make_long_uint (gc_stats.allocated)));
+}
+
+
 void
 rep_pre_values_init(void)
 {
+    pool_init ();
     rep_register_type(rep_Cons, "cons", cons_cmp,
 		  rep_lisp_prin, rep_lisp_prin, cons_sweep, 0, 0, 0, 0, 0, 0, 0, 0);
     rep_register_type(rep_Vector, "vector", vector_cmp,
@@ -1108,12 +2899,38 @@ rep_values_init(void)
     repv tem = rep_push_structure ("rep.data");
     rep_ADD_SUBR(Scons);
     rep_ADD_SUBR(Sgarbage_threshold);
+    rep_ADD_SUBR(Sgarbage_threshold_ratio);
+    rep_ADD_SUBR(Sgarbage_collection_workers);
+    rep_ADD_SUBR(Sheap_limit);
+    rep_ADD_SUBR(Sgarbage_release_threshold);
+    rep_ADD_SUBR(Smemory_usage);
+    rep_ADD_SUBR(Sdedupe_heap);
+    rep_ADD_SUBR(Sgarbage_collection_statistics);
     rep_ADD_SUBR(Sidle_garbage_threshold);
     rep_ADD_SUBR_INT(Sgarbage_collect);
+    rep_ADD_SUBR(Sgarbage_collection_pauses);
     rep_ADD_INTERNAL_SUBR(Smake_primitive_guardian);
     rep_ADD_INTERNAL_SUBR(Sprimitive_guardian_push);
     rep_ADD_INTERNAL_SUBR(Sprimitive_guardian_pop);
     rep_INTERN_SPECIAL(after_gc_hook);
+    rep_INTERN(count);
+    rep_INTERN(idle_count);
+    rep_INTERN(total);
+    rep_INTERN(maximum);
+    rep_INTERN(last);
+    rep_INTERN(types);
+    rep_INTERN(phases);
+    rep_INTERN(mark);
+    rep_INTERN(guardians);
+    rep_INTERN(weak);
+    rep_INTERN(sweep);
+    rep_INTERN(histogram);
+    rep_INTERN(allocated);
+    rep_INTERN(live);
+    rep_INTERN(resident);
+    rep_INTERN(limit);
+    rep_INTERN(threshold);
+    rep_INTERN(memory_exhausted); rep_ERROR(memory_exhausted);
     rep_pop_structure (tem);
 }
 
@@ -1123,31 +2940,44 @@ rep_values_kill(void)
     rep_cons_block *cb = rep_cons_block_chain;
     rep_vector *v = vector_chain;
     rep_string_block *s = string_block_chain;
+    unsigned int i;
     while(cb != NULL)
     {
-	rep_cons_block *nxt = cb->next.p;
-	rep_free(cb);
+	rep_cons_block *nxt = rep_CONSBLK_NEXT (cb);
+	free_cell_block (cb);
 	cb = nxt;
     }
     while(v != NULL)
     {
 	rep_vector *nxt = v->next;
-	rep_FREE_CELL(v);
+	pool_free (v);
 	v = nxt;
     }
+    for (i = 0; i < slice_table_size; i++)
+    {
+	/* slices don't own their characters */
+	if (slice_table[i].slice != 0 && slice_table[i].parent != 0)
+	    slice_table[i].slice->data = 0;
+    }
+    free (slice_table);
+    slice_table = 0;
+    slice_table_size = slice_table_count = 0;
     while(s != NULL)
     {
 	int i;
-	rep_string_block *nxt = s->next.p;
+	rep_string_block *nxt = STRINGBLK_NEXT (s);
 	for (i = 0; i < rep_STRINGBLK_SIZE; i++)
 	{
-	    if (!rep_CELL_CONS_P (rep_VAL(s->data + i)))
-		rep_free (s->data[i].data);
+	    if (!rep_CELL_CONS_P (rep_VAL(s->data + i))
+		&& s->data[i].data != 0)
+		pool_free (s->data[i].data);
 	}
-	rep_free(s);
+	free_cell_block (s);
 	s = nxt;
     }
     rep_cons_block_chain = NULL;
+    cons_sweep_next = NULL;
+    rep_cons_freelist = NULL;
     vector_chain = NULL;
     string_block_chain = NULL;
 }
@@ -26,10 +26,12 @@
 
 #define WEAKP(x)	rep_CELL16_TYPEP(x, weak_ref_type ())
 #define WEAK(v)		((rep_tuple *) rep_PTR (v))
-#define WEAK_NEXT(v)	(WEAK(v)->a)
 #define WEAK_REF(v)	(WEAK(v)->b)
 
-static repv weak_refs;
+/* All weak references, in an array so that the GC's scan of them is
+   a linear pass with no pointer chasing */
+static repv *weak_refs;
+static int weak_refs_count, weak_refs_size;
 
 static int weak_ref_type (void);
 
@@ -37,10 +39,21 @@ DEFUN ("make-weak-ref", Fmake_weak_ref, Smake_weak_ref, (repv ref), rep_Subr1)
 {
     repv weak_ref;
 
-    weak_ref = rep_make_tuple (weak_ref_type (), rep_NULL, rep_NULL);
+    if (weak_refs_count == weak_refs_size)
+    {
+	int new_size = weak_refs_size == 0 ? 64 : weak_refs_size * 2;
+	repv *new_refs = (weak_refs == 0
+			  ? rep_alloc (new_size * sizeof (repv))
+			  : rep_realloc (weak_refs, new_size * sizeof (repv)));
+	if (new_refs == 0)
+	    return rep_mem_error ();
+	weak_refs = new_refs;
+	weak_refs_size = new_size;
+    }
+
+    weak_ref = rep_make_tuple (weak_ref_type (), Qnil, rep_NULL);
     WEAK_REF (weak_ref) = ref;
-    WEAK_NEXT (weak_ref) = weak_refs;
-    weak_refs = weak_ref;
+    weak_refs[weak_refs_count++] = weak_ref;
 
     return weak_ref;
 }
@@ -61,25 +74,32 @@ DEFUN ("weak-ref-set", Fweak_ref_set, Sweak_ref_set, (repv weak, repv value), re
 void
 rep_scan_weak_refs (void)
 {
-    repv ref = weak_refs;
-    weak_refs = rep_NULL;
-    while (ref != rep_NULL)
+    int i, kept = 0;
+    for (i = 0; i < weak_refs_count; i++)
     {
-	repv next = WEAK_NEXT (ref);
+	repv ref = weak_refs[i];
 	if (rep_GC_CELL_MARKEDP (ref))
 	{
 	    /* this ref wasn't gc'd */
-	    WEAK_NEXT (ref) = weak_refs;
-	    weak_refs = ref;
-
-	    if (rep_CELLP (WEAK_REF (ref))
-		&& !rep_GC_MARKEDP (WEAK_REF (ref)))
+	    weak_refs[kept++] = ref;
+	    if (!rep_gc_live_p (WEAK_REF (ref)))
 	    {
 		/* but the object it points to was */
 		WEAK_REF (ref) = Qnil;
 	    }
 	}
-	ref = next;
+    }
+    weak_refs_count = kept;
+
+    if (weak_refs_size > 64 && kept * 4 < weak_refs_size)
+    {
+	repv *new_refs = rep_realloc (weak_refs,
+				      (weak_refs_size / 2) * sizeof (repv));
+	if (new_refs != 0)
+	{
+	    weak_refs = new_refs;
+	    weak_refs_size /= 2;
+	}
     }
 }
 
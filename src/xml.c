@@ -0,0 +1,578 @@
+/* xml.c -- tokenizer for rep.xml.reader
+
+   $Id$
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Splits XML text read from a stream into tokens, so that the Lisp
+   parser never has to look at individual characters. The tokens are:
+
+	STRING			character data, entities substituted
+	(start NAME PARAMS)	<NAME PARAMS...>
+	(empty NAME PARAMS)	<NAME PARAMS.../>
+	(end NAME)		</NAME>
+	(?NAME PARAMS)		<?NAME PARAMS...?>
+	(! STRING)		<!STRING>, including comments and CDATA
+
+   NAME is a symbol and PARAMS an alist mapping symbols to strings. The
+   last two forms are the same as the items read by read-xml-item.
+
+   Like the parser this replaces, it doesn't attempt to follow the XML
+   specification closely. */
+
+#define _GNU_SOURCE
+
+#include <config.h>
+#include "repint.h"
+#include <string.h>
+#include <ctype.h>
+
+DEFSYM (start, "start");
+DEFSYM (empty, "empty");
+DEFSYM (end, "end");
+DEFSYM (exclam, "!");
+
+DEFSTRING (expected_gt, "Expected '>' character");
+DEFSTRING (expected_eq, "Expected '=' character");
+DEFSTRING (xml_eof, "End of stream in XML markup");
+
+/* The stream being tokenized, and its FILE if it's a local file */
+struct input {
+    repv stream;
+    FILE *fh;
+};
+
+/* A growable buffer of bytes */
+struct buf {
+    char *data;
+    size_t len, size;
+    char initial[256];
+};
+
+static inline int
+next_char (struct input *in)
+{
+    if (in->fh != 0)
+    {
+	int c = rep_getc (in->fh);
+	if (c == '\n')
+	    rep_FILE (in->stream)->line_number++;
+	return c;
+    }
+    else
+	return rep_stream_getc (in->stream);
+}
+
+static inline void
+buf_init (struct buf *b)
+{
+    b->data = b->initial;
+    b->len = 0;
+    b->size = sizeof (b->initial);
+}
+
+static inline void
+buf_free (struct buf *b)
+{
+    if (b->data != b->initial)
+	rep_free (b->data);
+}
+
+static rep_bool
+buf_grow (struct buf *b)
+{
+    size_t size = b->size * 2;
+    char *data = rep_alloc (size);
+    if (data == 0)
+	return rep_FALSE;
+    memcpy (data, b->data, b->len);
+    buf_free (b);
+    b->data = data;
+    b->size = size;
+    return rep_TRUE;
+}
+
+static inline rep_bool
+buf_add (struct buf *b, int c)
+{
+    if (b->len == b->size && !buf_grow (b))
+	return rep_FALSE;
+    b->data[b->len++] = c;
+    return rep_TRUE;
+}
+
+static rep_bool
+buf_add_utf8 (struct buf *b, unsigned long c)
+{
+    if (c < 0x80)
+	return buf_add (b, c);
+    else if (c < 0x800)
+	return (buf_add (b, 0xc0 | (c >> 6))
+		&& buf_add (b, 0x80 | (c & 0x3f)));
+    else if (c < 0x10000)
+	return (buf_add (b, 0xe0 | (c >> 12))
+		&& buf_add (b, 0x80 | ((c >> 6) & 0x3f))
+		&& buf_add (b, 0x80 | (c & 0x3f)));
+    else
+	return (buf_add (b, 0xf0 | ((c >> 18) & 0x07))
+		&& buf_add (b, 0x80 | ((c >> 12) & 0x3f))
+		&& buf_add (b, 0x80 | ((c >> 6) & 0x3f))
+		&& buf_add (b, 0x80 | (c & 0x3f)));
+}
+
+static const struct {
+    const char *name;
+    const char *text;
+} entities[] = {
+    { "lt", "<" }, { "gt", ">" }, { "amp", "&" },
+    { "apos", "'" }, { "quot", "\"" },
+    { "Auml", "\303\204" }, { "auml", "\303\244" },
+    { "Uuml", "\303\234" }, { "uuml", "\303\274" },
+    { "Ouml", "\303\226" }, { "ouml", "\303\266" },
+    { "szlig", "\303\237" },
+    { 0, 0 }
+};
+
+/* The `&' of an entity reference has been read, add its replacement
+   text to B. Unknown entities are copied unchanged. Returns the next
+   character, or -2 if out of memory. */
+static int
+read_entity (struct input *in, struct buf *b)
+{
+    char name[16];
+    int c, i = 0;
+
+    while ((c = next_char (in)) != EOF && c != ';' && c != '<'
+	   && c != '&' && !isspace (c) && i < (int) sizeof (name) - 1)
+    {
+	name[i++] = c;
+    }
+    name[i] = 0;
+
+    if (c == ';')
+    {
+	c = next_char (in);
+	if (name[0] == '#')
+	{
+	    char *end;
+	    unsigned long code = (name[1] == 'x'
+				  ? strtoul (name + 2, &end, 16)
+				  : strtoul (name + 1, &end, 10));
+	    if (i > 1 && *end == 0 && code > 0 && code < 0x110000)
+		return buf_add_utf8 (b, code) ? c : -2;
+	}
+	else
+	{
+	    int j;
+	    for (j = 0; entities[j].name != 0; j++)
+	    {
+		if (strcmp (name, entities[j].name) == 0)
+		{
+		    const char *p;
+		    for (p = entities[j].text; *p != 0; p++)
+		    {
+			if (!buf_add (b, *p))
+			    return -2;
+		    }
+		    return c;
+		}
+	    }
+	}
+	/* not one we know; leave it alone */
+	if (!buf_add (b, '&'))
+	    return -2;
+	for (i = 0; name[i] != 0; i++)
+	{
+	    if (!buf_add (b, name[i]))
+		return -2;
+	}
+	return buf_add (b, ';') ? c : -2;
+    }
+
+    if (!buf_add (b, '&'))
+	return -2;
+    for (i = 0; name[i] != 0; i++)
+    {
+	if (!buf_add (b, name[i]))
+	    return -2;
+    }
+    return c;
+}
+
+/* Read characters into B until one of the characters in STOP (or EOF)
+   is found, returning it. Entities are substituted if SUBST is true;
+   returns -2 if out of memory */
+static int
+read_until (struct input *in, struct buf *b, int c,
+	    const char *stop, rep_bool subst)
+{
+    while (c != EOF && strchr (stop, c) == 0)
+    {
+	if (subst && c == '&')
+	{
+	    c = read_entity (in, b);
+	    if (c == -2)
+		return c;
+	}
+	else
+	{
+	    if (!buf_add (b, c))
+		return -2;
+	    c = next_char (in);
+	}
+    }
+    return c;
+}
+
+static inline int
+skip_space (struct input *in, int c)
+{
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+	c = next_char (in);
+    return c;
+}
+
+static repv
+xml_error (repv message, struct input *in)
+{
+    return Fsignal (Qerror, rep_list_2 (message, in->stream));
+}
+
+/* Characters that end names and unquoted attribute values (strchr also
+   matches the terminating null, EOF is handled separately) */
+static const char name_endings[] = " \t\n\r>=/?";
+static const char value_endings[] = " \t\n\r>/";
+
+/* Read a name, starting with character *C-P, leaving the first
+   character after it in *C-P. PREFIX is prepended to the name if
+   non-zero. */
+static repv
+read_name (struct input *in, int *c_p, int prefix)
+{
+    struct buf b;
+    repv name;
+    int c;
+
+    buf_init (&b);
+    if (prefix != 0)
+	buf_add (&b, prefix);
+    c = read_until (in, &b, *c_p, name_endings, rep_FALSE);
+    if (c == -2)
+    {
+	buf_free (&b);
+	return rep_mem_error ();
+    }
+    name = rep_intern_chars (b.data, b.len, rep_obarray);
+    buf_free (&b);
+    *c_p = c;
+    return name;
+}
+
+/* Read the attributes of a tag, starting with character *C-P. Stops at
+   `?', `/' or `>' leaving that character in *C-P. */
+static repv
+read_params (struct input *in, int *c_p)
+{
+    repv params = Qnil;
+    rep_GC_root gc_params;
+    int c = *c_p;
+
+    rep_PUSHGC (gc_params, params);
+    while (1)
+    {
+	repv name, value;
+	struct buf b;
+
+	c = skip_space (in, c);
+	if (c == '?' || c == '/' || c == '>')
+	    break;
+	else if (c == EOF)
+	{
+	    params = xml_error (rep_VAL (&xml_eof), in);
+	    break;
+	}
+
+	name = read_name (in, &c, 0);
+	if (name == rep_NULL)
+	{
+	    params = rep_NULL;
+	    break;
+	}
+	c = skip_space (in, c);
+	if (c != '=')
+	{
+	    params = xml_error (rep_VAL (&expected_eq), in);
+	    break;
+	}
+	c = skip_space (in, next_char (in));
+
+	buf_init (&b);
+	if (c == '"' || c == '\'')
+	{
+	    char delim[2];
+	    delim[0] = c;
+	    delim[1] = 0;
+	    c = read_until (in, &b, next_char (in), delim, rep_TRUE);
+	    if (c >= 0)
+		c = next_char (in);
+	}
+	else
+	    c = read_until (in, &b, c, value_endings, rep_TRUE);
+	if (c == -2)
+	{
+	    buf_free (&b);
+	    params = rep_mem_error ();
+	    break;
+	}
+	value = rep_string_dupn (b.data, b.len);
+	buf_free (&b);
+	params = Fcons (Fcons (name, value), params);
+    }
+    rep_POPGC;
+    *c_p = c;
+    return params != rep_NULL ? Fnreverse (params) : rep_NULL;
+}
+
+static inline rep_bool
+buf_ends_with (struct buf *b, const char *str, size_t len)
+{
+    return b->len >= len && memcmp (b->data + b->len - len, str, len) == 0;
+}
+
+/* Read the body of a `<!...>' item, the `<!' having been read and C
+   being the next character */
+static repv
+read_exclam (struct input *in, int c)
+{
+    static const char cdata[] = "[CDATA[";
+    const char *term = 0;
+    size_t start = 0;
+    struct buf b;
+    repv data = rep_NULL;
+    int depth = 0;
+
+    buf_init (&b);
+
+    /* comments and CDATA sections end at `-->' and `]]>', and have
+       no entities substituted */
+    if (c == '-' && buf_add (&b, c) && (c = next_char (in)) == '-')
+	term = "--";
+    else if (c == '[')
+    {
+	while (start < sizeof (cdata) - 1 && c == cdata[start]
+	       && buf_add (&b, c))
+	{
+	    c = next_char (in);
+	    start++;
+	}
+	if (start == sizeof (cdata) - 1)
+	    term = "]]";
+    }
+
+    if (term != 0)
+    {
+	if (start == 0)
+	{
+	    /* the second `-' of a comment, which mustn't end it */
+	    start = 2;
+	    if (!buf_add (&b, c))
+		c = -2;
+	    else
+		c = next_char (in);
+	}
+	while (c >= 0 && !(c == '>' && b.len >= start + 2
+			   && buf_ends_with (&b, term, 2)))
+	{
+	    if (!buf_add (&b, c))
+		c = -2;
+	    else
+		c = next_char (in);
+	}
+    }
+    else
+    {
+	/* declarations may contain bracketed subsets holding `>' */
+	while (c >= 0 && (c != '>' || depth > 0))
+	{
+	    if (c == '[')
+		depth++;
+	    else if (c == ']' && depth > 0)
+		depth--;
+	    if (c == '&')
+		c = read_entity (in, &b);
+	    else if (!buf_add (&b, c))
+		c = -2;
+	    else
+		c = next_char (in);
+	}
+    }
+
+    if (c == -2)
+	rep_mem_error ();
+    else if (c == EOF)
+	xml_error (rep_VAL (&xml_eof), in);
+    else
+	data = rep_list_2 (Qexclam, rep_string_dupn (b.data, b.len));
+    buf_free (&b);
+    return data;
+}
+
+/* Read the next token from IN, returning end-of-stream if there are
+   no more */
+static repv
+read_token (struct input *in)
+{
+    repv name, params;
+    rep_GC_root gc_name;
+    int c = next_char (in);
+
+    if (c == EOF)
+	return Qend_of_stream;
+
+    if (c != '<')
+    {
+	struct buf b;
+	repv text;
+	buf_init (&b);
+	c = read_until (in, &b, c, "<", rep_TRUE);
+	if (c == -2)
+	{
+	    buf_free (&b);
+	    return rep_mem_error ();
+	}
+	if (c != EOF)
+	    rep_stream_ungetc (in->stream, c);
+	text = rep_string_dupn (b.data, b.len);
+	buf_free (&b);
+	return text;
+    }
+
+    c = next_char (in);
+    switch (c)
+    {
+    case '/':
+	c = skip_space (in, next_char (in));
+	name = read_name (in, &c, 0);
+	if (name == rep_NULL)
+	    return rep_NULL;
+	c = skip_space (in, c);
+	if (c != '>')
+	    return xml_error (rep_VAL (&expected_gt), in);
+	return rep_list_2 (Qend, name);
+
+    case '!':
+	return read_exclam (in, next_char (in));
+
+    case EOF:
+	return xml_error (rep_VAL (&xml_eof), in);
+    }
+
+    if (c == '?')
+    {
+	c = skip_space (in, next_char (in));
+	name = read_name (in, &c, '?');
+    }
+    else
+	name = read_name (in, &c, 0);
+    if (name == rep_NULL)
+	return rep_NULL;
+
+    rep_PUSHGC (gc_name, name);
+    params = read_params (in, &c);
+    rep_POPGC;
+    if (params == rep_NULL)
+	return rep_NULL;
+
+    if (rep_STR (rep_SYM (name)->name)[0] == '?')
+    {
+	if (c != '?' || next_char (in) != '>')
+	    return xml_error (rep_VAL (&expected_gt), in);
+	return rep_list_2 (name, params);
+    }
+    else if (c == '/')
+    {
+	if (next_char (in) != '>')
+	    return xml_error (rep_VAL (&expected_gt), in);
+	return rep_list_3 (Qempty, name, params);
+    }
+    else if (c != '>')
+	return xml_error (rep_VAL (&expected_gt), in);
+    else
+	return rep_list_3 (Qstart, name, params);
+}
+
+DEFUN ("xml-read-tokens", Fxml_read_tokens, Sxml_read_tokens,
+       (repv stream, repv count), rep_Subr2) /*
+::doc:rep.xml.tokenizer#xml-read-tokens::
+xml-read-tokens STREAM [COUNT]
+
+Read up to COUNT (by default 64) XML tokens from STREAM, returning them
+as a list, or false if the end of the stream has been reached.
+
+Each token is either a string of character data, `(start NAME PARAMS)',
+`(empty NAME PARAMS)', `(end NAME)', `(?NAME PARAMS)' or `(! STRING)'.
+NAME is a symbol, PARAMS an alist mapping symbols to strings.
+::end:: */
+{
+    struct input in;
+    repv tokens = Qnil;
+    rep_GC_root gc_stream, gc_tokens;
+    int n;
+
+    rep_DECLARE (2, count, rep_NILP (count) || rep_INTP (count));
+    n = rep_INTP (count) ? rep_INT (count) : 64;
+
+    if (rep_NILP (stream)
+	&& !(stream = Fsymbol_value (Qstandard_input, Qnil)))
+    {
+	return rep_NULL;
+    }
+    in.stream = stream;
+    in.fh = ((rep_FILEP (stream) && rep_LOCAL_FILE_P (stream))
+	     ? rep_FILE (stream)->file.fh : 0);
+
+    rep_PUSHGC (gc_stream, in.stream);
+    rep_PUSHGC (gc_tokens, tokens);
+    while (n-- > 0)
+    {
+	repv token = read_token (&in);
+	if (token == rep_NULL)
+	{
+	    tokens = rep_NULL;
+	    break;
+	}
+	else if (token == Qend_of_stream)
+	    break;
+	tokens = Fcons (token, tokens);
+    }
+    rep_POPGC; rep_POPGC;
+
+    return tokens != rep_NULL ? Fnreverse (tokens) : rep_NULL;
+}
+
+repv
+rep_dl_init (void)
+{
+    repv tem;
+    rep_INTERN (start);
+    rep_INTERN (empty);
+    rep_INTERN (end);
+    rep_INTERN (exclam);
+    tem = rep_push_structure ("rep.xml.tokenizer");
+    rep_ADD_SUBR (Sxml_read_tokens);
+    return rep_pop_structure (tem);
+}